@@ -0,0 +1,31 @@
+// See LICENSE for license details.
+
+// NHARTS harts hammer one counter with amoadd, then hart 0 checks it.
+
+#include "bench.h"
+
+#define ITERS 200000
+
+static volatile uint64_t counter;
+static volatile uint64_t instret;
+static volatile uint32_t done;
+
+int main(int hartid)
+{
+  if (hartid >= NHARTS)
+    while (1)
+      asm volatile ("wfi");
+
+  for (int i = 0; i < ITERS; i++)
+    __atomic_fetch_add(&counter, 1, __ATOMIC_RELAXED);
+
+  __atomic_fetch_add(&instret, rdinstret(), __ATOMIC_RELAXED);
+  __atomic_fetch_add(&done, 1, __ATOMIC_RELEASE);
+  if (hartid != 0)
+    return 0;
+
+  while (__atomic_load_n(&done, __ATOMIC_ACQUIRE) != NHARTS)
+    ;
+  report_instret(instret);
+  return counter != (uint64_t)NHARTS * ITERS;
+}
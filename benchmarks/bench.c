@@ -0,0 +1,78 @@
+// See LICENSE for license details.
+
+#include "bench.h"
+
+volatile uint64_t tohost __attribute__((section(".tohost")));
+volatile uint64_t fromhost __attribute__((section(".tohost")));
+
+long syscall(long n, long a0, long a1, long a2, long a3, long a4)
+{
+  static volatile uint64_t magic_mem[8] __attribute__((aligned(64)));
+  magic_mem[0] = n;
+  magic_mem[1] = a0;
+  magic_mem[2] = a1;
+  magic_mem[3] = a2;
+  magic_mem[4] = a3;
+  magic_mem[5] = a4;
+  asm volatile ("fence" ::: "memory");
+
+  tohost = (uintptr_t)magic_mem;
+  while (fromhost == 0)
+    ;
+  fromhost = 0;
+
+  asm volatile ("fence" ::: "memory");
+  return magic_mem[0];
+}
+
+long write(int fd, const void* buf, size_t len)
+{
+  return syscall(64, fd, (long)buf, len, 0, 0);
+}
+
+void exit(int code)
+{
+  while (1)
+    tohost = (uint64_t)code << 1 | 1;
+}
+
+void report_instret(uint64_t n)
+{
+  char buf[32] = "instret ";
+  char digits[20];
+  int i = 0, len = 8;
+  do {
+    digits[i++] = '0' + n % 10;
+    n /= 10;
+  } while (n);
+  while (i)
+    buf[len++] = digits[--i];
+  buf[len++] = '\n';
+  write(1, buf, len);
+}
+
+void enter_supervisor_sv39(void)
+{
+  static uint64_t root[512] __attribute__((aligned(4096)));
+  // V, R, W, X, A and D
+  for (uint64_t i = 0; i < 4; i++)
+    root[i] = (i << 28) | 0xcf;
+
+  asm volatile (
+    "li t0, -1\n"
+    "csrw pmpaddr0, t0\n"
+    "csrw mcounteren, t0\n"
+    "li t0, 0x1f\n"
+    "csrw pmpcfg0, t0\n"
+    "csrw satp, %0\n"
+    "sfence.vma\n"
+    "li t0, 0x1800\n"
+    "csrc mstatus, t0\n"
+    "li t0, 0x0800\n"
+    "csrs mstatus, t0\n"
+    "la t0, 1f\n"
+    "csrw mepc, t0\n"
+    "mret\n"
+    "1:\n"
+    :: "r"((8ull << 60) | ((uintptr_t)root >> 12)) : "t0", "memory");
+}
@@ -0,0 +1,33 @@
+// See LICENSE for license details.
+#ifndef _BENCH_H
+#define _BENCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Harts that take part in multi-hart benchmarks; run those with -p<NHARTS>.
+#ifndef NHARTS
+#define NHARTS 4
+#endif
+
+// Host system calls through HTIF; only one hart may use them at a time.
+long syscall(long n, long a0, long a1, long a2, long a3, long a4);
+long write(int fd, const void* buf, size_t len);
+void exit(int code) __attribute__((noreturn));
+
+// Retired instructions of this hart so far.
+static inline uint64_t rdinstret(void)
+{
+  uint64_t n;
+  asm volatile ("rdinstret %0" : "=r"(n));
+  return n;
+}
+
+// Prints "instret <n>" for the runner, which divides n by the wall time.
+void report_instret(uint64_t n);
+
+// Maps the low 4 GiB with gigapages and drops to S-mode, so that memory
+// accesses go through the page table walker and the simulated TLB.
+void enter_supervisor_sv39(void);
+
+#endif
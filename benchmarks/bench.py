@@ -0,0 +1,115 @@
+#!/usr/bin/env python3
+
+"""Simulator throughput benchmarks.
+
+Builds the bare-metal programs in this directory with a RISC-V cross
+compiler ($RISCV/bin/riscv64-unknown-elf-gcc unless --cc is given), runs
+each of them under several spike configurations and prints the simulated
+MIPS.  Each program prints how many instructions it retired; the wall
+time of the whole spike run, including start-up, is what they are divided
+by.  Configurations that this spike build does not support are skipped.
+"""
+
+import argparse
+import os
+import re
+import subprocess
+import sys
+import tempfile
+import time
+
+BENCH_DIR = os.path.dirname(os.path.abspath(__file__))
+NHARTS = 4
+
+# name: (source, extra compiler flags, extra spike arguments)
+BENCHMARKS = {
+    "int_loop": ("int_loop.c", [], []),
+    "pointer_chase": ("pointer_chase.c", [], []),
+    "fp_kernel": ("fp_kernel.c", [], []),
+    "syscall_io": ("syscall_io.c", [], []),
+    "amo_contention": ("amo_contention.c", ["-DNHARTS=%d" % NHARTS],
+                       ["-p%d" % NHARTS]),
+}
+for lmul in ("m1", "m2", "m4", "m8"):
+    for vlen in (128, 256, 512):
+        BENCHMARKS["rvv_%s_vlen%d" % (lmul, vlen)] = (
+            "rvv_kernel.c", ["-march=rv64gcv", "-DLMUL=" + lmul],
+            ["--isa=rv64gcv", "--varch=vlen:%d,elen:64" % vlen])
+
+# name: spike arguments; {tmp} is a scratch directory
+CONFIGS = {
+    "plain": [],
+    "sift": ["--sift={tmp}/trace"],
+    "log-commits": ["--log-commits", "--log=/dev/null"],
+    "caches": ["--ic=64:4:64", "--dc=64:4:64"],
+}
+
+def compile_benchmark(cc, out_dir, name, source, cflags):
+    binary = os.path.join(out_dir, name)
+    cmd = [cc, "-O2", "-march=rv64gc", "-mabi=lp64d", "-mcmodel=medany",
+           "-static", "-nostdlib", "-nostartfiles", "-ffreestanding",
+           "-fno-tree-vectorize", "-T", os.path.join(BENCH_DIR, "link.ld"),
+           "-o", binary] + cflags + [
+           os.path.join(BENCH_DIR, "crt.S"),
+           os.path.join(BENCH_DIR, "bench.c"),
+           os.path.join(BENCH_DIR, source)]
+    subprocess.check_call(cmd)
+    return binary
+
+def run(spike, binary, args, tmp):
+    cmd = [spike] + [a.format(tmp=tmp) for a in args] + [binary]
+    start = time.perf_counter()
+    result = subprocess.run(cmd, stdin=subprocess.DEVNULL,
+                            stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+    seconds = time.perf_counter() - start
+    match = re.search(rb"^instret (\d+)$", result.stdout, re.M)
+    if result.returncode != 0 or not match:
+        return None, seconds
+    return int(match.group(1)), seconds
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--spike", default="spike", help="spike to run")
+    parser.add_argument("--cc", default=os.path.expandvars(
+        "$RISCV/bin/riscv64-unknown-elf-gcc"), help="RISC-V C compiler")
+    parser.add_argument("--configs", default=",".join(CONFIGS),
+                        help="comma-separated configurations to run")
+    parser.add_argument("-k", dest="filter", default="",
+                        help="only run benchmarks whose name contains this")
+    args = parser.parse_args()
+
+    configs = args.configs.split(",")
+    for config in configs:
+        if config not in CONFIGS:
+            parser.error("unknown configuration %r" % config)
+
+    with tempfile.TemporaryDirectory() as tmp:
+        binaries = {}
+        for name, (source, cflags, _) in BENCHMARKS.items():
+            if args.filter in name:
+                binaries[name] = compile_benchmark(args.cc, tmp, name, source,
+                                                   cflags)
+
+        failed = False
+        print("%-22s %-12s %14s %9s %9s" %
+              ("benchmark", "config", "instret", "seconds", "MIPS"))
+        for name, binary in binaries.items():
+            for config in configs:
+                spike_args = BENCHMARKS[name][2] + CONFIGS[config]
+                instret, seconds = run(args.spike, binary, spike_args, tmp)
+                if instret is None:
+                    # Only a failure of the plain run is a real failure;
+                    # the others may just not be built in.
+                    failed |= config == "plain"
+                    print("%-22s %-12s %14s %9.2f %9s" %
+                          (name, config, "-", seconds, "n/a"))
+                else:
+                    print("%-22s %-12s %14d %9.2f %9.1f" %
+                          (name, config, instret, seconds,
+                           instret / seconds / 1e6))
+                sys.stdout.flush()
+
+    return 1 if failed else 0
+
+if __name__ == "__main__":
+    sys.exit(main())
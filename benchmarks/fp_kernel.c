@@ -0,0 +1,46 @@
+// See LICENSE for license details.
+
+// Double-precision DAXPY, dot product and matrix multiply.
+
+#include "bench.h"
+
+#define N 4096
+#define M 48
+#define ROUNDS 200
+
+static double x[N], y[N];
+static double a[M][M], b[M][M], c[M][M];
+
+int main(int hartid)
+{
+  for (int i = 0; i < N; i++) {
+    x[i] = i * 0.5;
+    y[i] = 1.0 / (i + 1);
+  }
+  for (int i = 0; i < M; i++)
+    for (int j = 0; j < M; j++) {
+      a[i][j] = i + j * 0.25;
+      b[i][j] = i - j * 0.125;
+    }
+
+  double sum = 0;
+  for (int r = 0; r < ROUNDS; r++) {
+    double alpha = 1.0 + r * 1e-3;
+    for (int i = 0; i < N; i++)
+      y[i] += alpha * x[i];
+    for (int i = 0; i < N; i++)
+      sum += x[i] * y[i];
+  }
+
+  for (int r = 0; r < 4; r++)
+    for (int i = 0; i < M; i++)
+      for (int j = 0; j < M; j++) {
+        double s = c[i][j];
+        for (int k = 0; k < M; k++)
+          s += a[i][k] * b[k][j];
+        c[i][j] = s;
+      }
+
+  report_instret(rdinstret());
+  return sum + c[1][1] == 0;
+}
@@ -0,0 +1,34 @@
+// See LICENSE for license details.
+
+// Integer ALU, multiply and branch-heavy loops over a small array.
+
+#include "bench.h"
+
+#define N 1024
+#define ROUNDS 5000
+
+static uint32_t data[N];
+
+int main(int hartid)
+{
+  uint32_t x = 12345;
+  for (int i = 0; i < N; i++) {
+    x = x * 1103515245 + 12345;
+    data[i] = x;
+  }
+
+  uint64_t hash = 0;
+  for (int r = 0; r < ROUNDS; r++) {
+    for (int i = 0; i < N; i++) {
+      uint32_t v = data[i];
+      if (v & 1)
+        hash = (hash << 5) + hash + v;
+      else
+        hash ^= (uint64_t)v * 0x9e3779b1 >> 7;
+      data[i] = v + (uint32_t)hash;
+    }
+  }
+
+  report_instret(rdinstret());
+  return hash == 0;
+}
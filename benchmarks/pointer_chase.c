@@ -0,0 +1,45 @@
+// See LICENSE for license details.
+
+// Follows a random cycle with one node per page through 64 MiB under
+// Sv39, so that nearly every load misses in the simulated TLB.
+
+#include "bench.h"
+
+#define PAGE 4096
+#define PAGES ((64 << 20) / PAGE)
+#define STEPS 4000000
+
+static char arena[PAGES * PAGE] __attribute__((aligned(PAGE)));
+
+int main(int hartid)
+{
+  enter_supervisor_sv39();
+
+  // Sattolo's algorithm gives a single cycle through all pages.
+  static uint32_t order[PAGES];
+  for (uint32_t i = 0; i < PAGES; i++)
+    order[i] = i;
+  uint64_t x = 88172645463325252ull;
+  for (uint32_t i = PAGES - 1; i > 0; i--) {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    uint32_t j = x % i;
+    uint32_t t = order[i];
+    order[i] = order[j];
+    order[j] = t;
+  }
+  for (uint32_t i = 0; i < PAGES; i++) {
+    // Vary the offset within the page too.
+    char* node = arena + (uint64_t)i * PAGE + (i % 64) * 64;
+    char* next = arena + (uint64_t)order[i] * PAGE + (order[i] % 64) * 64;
+    *(char**)node = next;
+  }
+
+  char* p = arena;
+  for (int i = 0; i < STEPS; i++)
+    p = *(char**)p;
+
+  report_instret(rdinstret());
+  return p == 0;
+}
@@ -0,0 +1,71 @@
+// See LICENSE for license details.
+
+// Strip-mined single-precision SAXPY and reduction with the vector
+// extension, at the LMUL given by -DLMUL=m1, m2, m4 or m8.
+
+#include "bench.h"
+
+#ifndef LMUL
+#define LMUL m1
+#endif
+#define STR(x) #x
+#define XSTR(x) STR(x)
+
+#define N 8192
+#define ROUNDS 400
+
+static float x[N], y[N];
+
+static void saxpy(size_t n, float a, const float* px, float* py)
+{
+  while (n > 0) {
+    size_t vl;
+    asm volatile (
+      "vsetvli %0, %1, e32, " XSTR(LMUL) ", ta, ma\n"
+      "vle32.v v8, (%2)\n"
+      "vle32.v v16, (%3)\n"
+      "vfmacc.vf v16, %4, v8\n"
+      "vse32.v v16, (%3)\n"
+      : "=&r"(vl) : "r"(n), "r"(px), "r"(py), "f"(a) : "memory");
+    n -= vl;
+    px += vl;
+    py += vl;
+  }
+}
+
+static float sum(size_t n, const float* p)
+{
+  float s;
+  asm volatile (
+    "vsetvli t0, zero, e32, m1, ta, ma\n"
+    "vmv.v.i v0, 0\n" ::: "t0");
+  while (n > 0) {
+    size_t vl;
+    asm volatile (
+      "vsetvli %0, %1, e32, " XSTR(LMUL) ", ta, ma\n"
+      "vle32.v v8, (%2)\n"
+      "vfredusum.vs v0, v8, v0\n"
+      : "=&r"(vl) : "r"(n), "r"(p) : "memory");
+    n -= vl;
+    p += vl;
+  }
+  asm volatile ("vfmv.f.s %0, v0" : "=f"(s));
+  return s;
+}
+
+int main(int hartid)
+{
+  for (int i = 0; i < N; i++) {
+    x[i] = i * 0.5f;
+    y[i] = 1.0f;
+  }
+
+  float s = 0;
+  for (int r = 0; r < ROUNDS; r++) {
+    saxpy(N, 1.0f + r * 1e-4f, x, y);
+    s += sum(N, y);
+  }
+
+  report_instret(rdinstret());
+  return s == 0;
+}
@@ -0,0 +1,26 @@
+// See LICENSE for license details.
+
+// Many small writes to /dev/null through HTIF system calls.
+
+#include "bench.h"
+
+#define WRITES 20000
+
+int main(int hartid)
+{
+  static const char path[] = "/dev/null";
+  long fd = syscall(56, -100, (long)path, sizeof(path), 1, 0);
+  if (fd < 0)
+    return 1;
+
+  static char buf[256];
+  for (int i = 0; i < WRITES; i++) {
+    buf[i % sizeof(buf)] = i;
+    if (write(fd, buf, 16 + i % 240) < 0)
+      return 2;
+  }
+  syscall(57, fd, 0, 0, 0, 0);
+
+  report_instret(rdinstret());
+  return 0;
+}
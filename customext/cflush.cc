@@ -1,5 +1,6 @@
 #include "insn_macros.h"
 #include "extension.h"
+#include "mmu.h"
 #include <cstring>
 
 struct : public arg_t {
@@ -15,6 +16,27 @@ static reg_t custom_cflush(processor_t* p, insn_t insn, reg_t pc)
   return pc + 4; \
 }
 
+// With an address in rs1 the data cache variants act on its line, as the
+// Zicbom instructions do, so that cache models and traces see them; with
+// x0 they act on the whole cache, which is not modeled.
+static reg_t custom_cflush_d(processor_t* p, insn_t insn, reg_t pc)
+{
+  require_privilege(PRV_M);
+  if (insn.rs1() != 0)
+    MMU.clean_inval(RS1, true, true);
+
+  return pc + 4;
+}
+
+static reg_t custom_cdiscard_d(processor_t* p, insn_t insn, reg_t pc)
+{
+  require_privilege(PRV_M);
+  if (insn.rs1() != 0)
+    MMU.clean_inval(RS1, false, true);
+
+  return pc + 4;
+}
+
 class cflush_t : public extension_t
 {
  public:
@@ -24,8 +46,8 @@ class cflush_t : public extension_t
 
   std::vector<insn_desc_t> get_instructions() {
     std::vector<insn_desc_t> insns;
-    insns.push_back((insn_desc_t){0xFC000073, 0xFFF07FFF, custom_cflush, custom_cflush, custom_cflush, custom_cflush});
-    insns.push_back((insn_desc_t){0xFC200073, 0xFFF07FFF, custom_cflush, custom_cflush, custom_cflush, custom_cflush});
+    insns.push_back((insn_desc_t){0xFC000073, 0xFFF07FFF, custom_cflush_d, custom_cflush_d, custom_cflush_d, custom_cflush_d});
+    insns.push_back((insn_desc_t){0xFC200073, 0xFFF07FFF, custom_cdiscard_d, custom_cdiscard_d, custom_cdiscard_d, custom_cdiscard_d});
     insns.push_back((insn_desc_t){0xFC100073, 0xFFF07FFF, custom_cflush, custom_cflush, custom_cflush, custom_cflush});
     return insns;
   }
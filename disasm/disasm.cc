@@ -2111,7 +2111,15 @@ void disassembler_t::add_instructions(const isa_parser_t* isa)
 
 }
 
+const insn_bits_t disassembler_t::KEY_MASK[NKEYS] = {
+  0xfc00707f, 0x707f, 0x7f, // opcode, with funct3 and funct6 if fixed
+  0xe003,                   // compressed quadrant and funct3
+  0,                        // everything else
+};
+const int disassembler_t::KEY_CLASS[NKEYS] = { 0, 0, 0, 1, 2 };
+
 disassembler_t::disassembler_t(const isa_parser_t *isa)
+  : next_priority(0), constructed(false)
 {
   // highest priority: instructions explicitly enabled
   add_instructions(isa);
@@ -2125,45 +2133,80 @@ disassembler_t::disassembler_t(const isa_parser_t *isa)
   // finally: instructions with known opcodes but unknown arguments
   add_unknown_insns(this);
 
-  // Now, reverse the lists, because we search them back-to-front (so that
-  // custom instructions later added with add_insn have highest priority).
-  for (size_t i = 0; i < HASH_SIZE+1; i++)
-    std::reverse(chain[i].begin(), chain[i].end());
+  // Now, invert the priorities, because we search them back-to-front (so
+  // that custom instructions later added with add_insn have highest priority).
+  for (auto& t : table) {
+    for (auto& b : t) {
+      for (auto& e : b.second)
+        e.first = next_priority - e.first;
+      std::reverse(b.second.begin(), b.second.end());
+    }
+  }
+  next_priority++;
+
+  clear_memo();
+  constructed = true;
 }
 
-const disasm_insn_t* disassembler_t::probe_once(insn_t insn, size_t idx) const
+void disassembler_t::clear_memo()
 {
-  for (auto it = chain[idx].rbegin(); it != chain[idx].rend(); ++it)
-    if (*(*it) == insn)
-      return *it;
+  for (auto& m : memo)
+    m.store(0, std::memory_order_relaxed);
+}
 
-  return NULL;
+uint32_t disassembler_t::probe(insn_t insn) const
+{
+  uint32_t best = MEMO_NONE;
+  size_t best_priority = 0;
+  for (int k = 0; k < NKEYS; k++) {
+    if (k > 0 && KEY_CLASS[k] != KEY_CLASS[k - 1] && best != MEMO_NONE)
+      return best;
+
+    auto b = table[k].find(insn.bits() & KEY_MASK[k]);
+    if (b == table[k].end())
+      continue;
+    for (auto it = b->second.rbegin(); it != b->second.rend() && it->first > best_priority; ++it) {
+      if (*insns[it->second - 1] == insn) {
+        best = it->second;
+        best_priority = it->first;
+        break;
+      }
+    }
+  }
+  return best;
 }
 
 const disasm_insn_t* disassembler_t::lookup(insn_t insn) const
 {
-  if (auto p = probe_once(insn, hash(insn.bits(), MASK1)))
-    return p;
-
-  if (auto p = probe_once(insn, hash(insn.bits(), MASK2)))
-    return p;
-
-  return probe_once(insn, HASH_SIZE);
+  insn_bits_t bits = insn.bits();
+  uint32_t slot;
+  if (bits >> 32) {
+    slot = probe(insn);
+  } else {
+    size_t idx = (bits ^ (bits >> 12) ^ (bits >> 25)) % MEMO_SIZE;
+    uint64_t entry = memo[idx].load(std::memory_order_relaxed);
+    slot = entry;
+    if (slot == 0 || (entry >> 32) != bits) {
+      slot = probe(insn);
+      memo[idx].store(bits << 32 | slot, std::memory_order_relaxed);
+    }
+  }
+  return slot == MEMO_NONE ? NULL : insns[slot - 1];
 }
 
 void NOINLINE disassembler_t::add_insn(disasm_insn_t* insn)
 {
-  size_t idx =
-    (insn->get_mask() & MASK1) == MASK1 ? hash(insn->get_match(), MASK1) :
-    (insn->get_mask() & MASK2) == MASK2 ? hash(insn->get_match(), MASK2) :
-    HASH_SIZE;
-
-  chain[idx].push_back(insn);
+  int k = 0;
+  while ((insn->get_mask() & KEY_MASK[k]) != KEY_MASK[k])
+    k++;
+  insns.push_back(insn);
+  table[k][insn->get_match() & KEY_MASK[k]].emplace_back(next_priority++, insns.size());
+  if (constructed)
+    clear_memo();
 }
 
 disassembler_t::~disassembler_t()
 {
-  for (size_t i = 0; i < HASH_SIZE+1; i++)
-    for (size_t j = 0; j < chain[i].size(); j++)
-      delete chain[i][j];
+  for (auto insn : insns)
+    delete insn;
 }
@@ -13,9 +13,91 @@ context_t::context_t()
 #else
     context(new ucontext_t)
 #endif
+#ifdef USE_FAST_SWITCH
+    , sp(NULL)
+#endif
 {
 }
 
+#ifdef USE_FAST_SWITCH
+// Push the callee-saved state on the current stack and store the stack
+// pointer to *save.  Then either pop the state saved on the stack at sp or,
+// for a context that has never run, enter it with setcontext(start).
+extern "C" void context_fast_switch(void** save, void* sp, ucontext_t* start);
+
+#if defined(__x86_64__)
+asm(".text\n"
+    ".p2align 4\n"
+    ".type context_fast_switch, @function\n"
+    "context_fast_switch:\n"
+    "  pushq %rbp\n"
+    "  pushq %rbx\n"
+    "  pushq %r12\n"
+    "  pushq %r13\n"
+    "  pushq %r14\n"
+    "  pushq %r15\n"
+    "  subq $8, %rsp\n"
+    "  stmxcsr (%rsp)\n"
+    "  fnstcw 4(%rsp)\n"
+    "  movq %rsp, (%rdi)\n"
+    "  testq %rdx, %rdx\n"
+    "  jnz 1f\n"
+    "  movq %rsi, %rsp\n"
+    "  ldmxcsr (%rsp)\n"
+    "  fldcw 4(%rsp)\n"
+    "  addq $8, %rsp\n"
+    "  popq %r15\n"
+    "  popq %r14\n"
+    "  popq %r13\n"
+    "  popq %r12\n"
+    "  popq %rbx\n"
+    "  popq %rbp\n"
+    "  ret\n"
+    "1:\n"
+    "  movq %rdx, %rdi\n"
+    "  call setcontext@PLT\n"
+    "  ud2\n"
+    ".size context_fast_switch, .-context_fast_switch\n");
+#elif defined(__aarch64__)
+asm(".text\n"
+    ".p2align 4\n"
+    ".type context_fast_switch, %function\n"
+    "context_fast_switch:\n"
+    "  sub sp, sp, #160\n"
+    "  stp x19, x20, [sp, #0]\n"
+    "  stp x21, x22, [sp, #16]\n"
+    "  stp x23, x24, [sp, #32]\n"
+    "  stp x25, x26, [sp, #48]\n"
+    "  stp x27, x28, [sp, #64]\n"
+    "  stp x29, x30, [sp, #80]\n"
+    "  stp d8, d9, [sp, #96]\n"
+    "  stp d10, d11, [sp, #112]\n"
+    "  stp d12, d13, [sp, #128]\n"
+    "  stp d14, d15, [sp, #144]\n"
+    "  mov x3, sp\n"
+    "  str x3, [x0]\n"
+    "  cbnz x2, 1f\n"
+    "  mov sp, x1\n"
+    "  ldp x19, x20, [sp, #0]\n"
+    "  ldp x21, x22, [sp, #16]\n"
+    "  ldp x23, x24, [sp, #32]\n"
+    "  ldp x25, x26, [sp, #48]\n"
+    "  ldp x27, x28, [sp, #64]\n"
+    "  ldp x29, x30, [sp, #80]\n"
+    "  ldp d8, d9, [sp, #96]\n"
+    "  ldp d10, d11, [sp, #112]\n"
+    "  ldp d12, d13, [sp, #128]\n"
+    "  ldp d14, d15, [sp, #144]\n"
+    "  add sp, sp, #160\n"
+    "  ret\n"
+    "1:\n"
+    "  mov x0, x2\n"
+    "  bl setcontext\n"
+    "  brk #0\n"
+    ".size context_fast_switch, .-context_fast_switch\n");
+#endif
+#endif
+
 #ifdef USE_UCONTEXT
 #ifndef GLIBC_64BIT_PTR_BUG
 void context_t::wrapper(context_t* ctx)
@@ -27,6 +109,11 @@ void context_t::wrapper(unsigned int hi, unsigned int lo)
 #endif
   ctx->creator->switch_to();
   ctx->func(ctx->arg);
+#ifdef USE_FAST_SWITCH
+  // The creator was suspended by a fast switch, not in its ucontext, so
+  // return to it explicitly rather than through uc_link.
+  ctx->creator->switch_to();
+#endif
 }
 #else
 void* context_t::wrapper(void* a)
@@ -84,8 +171,14 @@ void context_t::switch_to()
 #ifdef USE_UCONTEXT
   context_t* prev = cur;
   cur = this;
+#ifdef USE_FAST_SWITCH
+  void* target_sp = sp;
+  sp = NULL;
+  context_fast_switch(&prev->sp, target_sp, target_sp ? NULL : context.get());
+#else
   if (swapcontext(prev->context.get(), context.get()) != 0)
     abort();
+#endif
 #else
   cur->flag = 0;
   this->flag = 1;
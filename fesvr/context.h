@@ -23,6 +23,14 @@ static_assert (sizeof(void*)         == 8, "ptr size doesn't match expected 64bi
 
 #endif
 
+// On x86-64 and AArch64, switches between contexts only swap the
+// callee-saved registers and the stack pointer instead of going through
+// swapcontext, which also saves and restores the signal mask with a system
+// call.  ucontext is then only used to enter a new context the first time.
+#if defined(USE_UCONTEXT) && (defined(__x86_64__) || defined(__aarch64__))
+# define USE_FAST_SWITCH
+#endif
+
 class context_t
 {
  public:
@@ -37,6 +45,11 @@ class context_t
   void* arg;
 #ifdef USE_UCONTEXT
   std::unique_ptr<ucontext_t> context;
+#ifdef USE_FAST_SWITCH
+  // Saved stack pointer while suspended, or NULL while running or before
+  // the context first runs.
+  void* sp;
+#endif
 #ifndef GLIBC_64BIT_PTR_BUG
   static void wrapper(context_t*);
 #else
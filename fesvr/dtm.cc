@@ -246,20 +246,39 @@ void dtm_t::read_chunk(uint64_t taddr, size_t len, void* dst)
 
   RUN_AC_OR_DIE(command, prog, 3, data, xlen/(4*8));
 
-  // TODO: could use autoexec here.
-  for (size_t i = 0; i < (len * 8 / xlen); i++){
-    command = AC_ACCESS_REGISTER_TRANSFER |
-      AC_AR_SIZE(xlen) |
-      AC_AR_REGNO(S1);
-    if ((i + 1) < (len * 8 / xlen)) {
-      command |= AC_ACCESS_REGISTER_POSTEXEC;
+  // Copy S1 into data and load the next word, then with autoexec, each
+  // read of data0 returns a word and fetches the one after.  The last
+  // word is copied by a command without postexec, so nothing past the
+  // chunk is loaded.
+  size_t words = len * 8 / xlen;
+  command = AC_ACCESS_REGISTER_TRANSFER |
+    AC_AR_SIZE(xlen) |
+    AC_AR_REGNO(S1);
+  if (words > 1) {
+    RUN_AC_OR_DIE(command | AC_ACCESS_REGISTER_POSTEXEC, 0, 0, data, 0);
+    if (words > 2)
+      write(DMI_ABSTRACTAUTO, 1 << DMI_ABSTRACTAUTO_AUTOEXECDATA_OFFSET);
+    for (size_t i = 0; i + 1 < words; i++) {
+      if (i + 2 == words && words > 2)
+        write(DMI_ABSTRACTAUTO, 0);
+      if (xlen == 64)
+        data[1] = read(DMI_DATA0 + 1);
+      data[0] = read(DMI_DATA0);  // Triggers the next command w/ autoexec.
+      memcpy(curr, data, xlen/8);
+      curr += xlen/8;
+
+      if (i + 2 < words) {
+        uint32_t abstractcs;
+        do {
+          abstractcs = read(DMI_ABSTRACTCS);
+        } while (abstractcs & DMI_ABSTRACTCS_BUSY);
+        if (get_field(abstractcs, DMI_ABSTRACTCS_CMDERR))
+          die(get_field(abstractcs, DMI_ABSTRACTCS_CMDERR));
+      }
     }
-    
-    RUN_AC_OR_DIE(command, 0, 0, data, xlen/(4*8));
-
-    memcpy(curr, data, xlen/8);
-    curr += xlen/8;
   }
+  RUN_AC_OR_DIE(command, 0, 0, data, xlen/(4*8));
+  memcpy(curr, data, xlen/8);
 
   restore_reg(S0, s0);
   restore_reg(S1, s1);
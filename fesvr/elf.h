@@ -29,6 +29,13 @@
 
 #define SHT_NOBITS 8
 
+#define SHN_UNDEF 0
+
+#define STT_FUNC 2
+#define STT_SECTION 3
+#define STT_FILE 4
+#define ELF_ST_TYPE(info) ((info) & 0xf)
+
 typedef struct {
   uint8_t  e_ident[16];
   uint16_t e_type;
@@ -1,9 +1,55 @@
 // See LICENSE for license details.
 
+// elf2hex writes the memory image of an ELF file as lines of width bytes,
+// most significant first, for Verilog's $readmemh.  The loadable segments
+// are sorted by address and each line is built from the mmap'd file as it
+// is written, so the image is never held in memory; lines that no segment
+// touches are written as zeros.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
-#include "htif_hexwriter.h"
-#include "memif.h"
-#include "elfloader.h"
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "byteorder.h"
+#include "elf.h"
+
+// memsz bytes at addr: the first filesz of them from data, the rest zeros.
+// Where segments overlap, the one later in the program headers wins, as
+// it would when loading them in order.
+struct segment_t {
+  uint64_t addr;
+  uint64_t filesz;
+  uint64_t memsz;
+  const uint8_t* data;
+  size_t order;
+};
+
+template<typename ehdr_t, typename phdr_t>
+static bool read_segments(const char* buf, size_t size, std::vector<segment_t>& segs)
+{
+  const ehdr_t* eh = (const ehdr_t*)buf;
+  auto fix = [eh](auto val) { return ELF_SWAP(*eh, val); };
+  if (size < fix(eh->e_phoff) + fix(eh->e_phnum) * sizeof(phdr_t))
+    return false;
+  const phdr_t* ph = (const phdr_t*)(buf + fix(eh->e_phoff));
+  for (unsigned i = 0; i < fix(eh->e_phnum); i++) {
+    if (fix(ph[i].p_type) != PT_LOAD || !fix(ph[i].p_memsz))
+      continue;
+    if (size < fix(ph[i].p_offset) + fix(ph[i].p_filesz) ||
+        fix(ph[i].p_filesz) > fix(ph[i].p_memsz))
+      return false;
+    segs.push_back({fix(ph[i].p_paddr), fix(ph[i].p_filesz), fix(ph[i].p_memsz),
+                    (const uint8_t*)buf + fix(ph[i].p_offset), segs.size()});
+  }
+  return true;
+}
 
 int main(int argc, char** argv)
 {
@@ -37,11 +83,94 @@ int main(int argc, char** argv)
     return 1;
   }
 
-  htif_hexwriter_t htif(base, width, depth);
-  memif_t memif(&htif);
-  reg_t entry;
-  load_elf(argv[3], &memif, &entry);
-  std::cout << htif;
+  int fd = open(argv[3], O_RDONLY);
+  struct stat s;
+  if (fd < 0 || fstat(fd, &s) < 0) {
+    perror(argv[3]);
+    return 1;
+  }
+  size_t size = s.st_size;
+  const char* buf = size ? (const char*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+  close(fd);
+  if (buf == MAP_FAILED) {
+    perror(argv[3]);
+    return 1;
+  }
+
+  std::vector<segment_t> segs;
+  const Elf64_Ehdr* eh64 = (const Elf64_Ehdr*)buf;
+  bool ok = size >= sizeof(Elf64_Ehdr) && IS_ELF_EXEC(*eh64) &&
+    (IS_ELF_RISCV(*eh64) || IS_ELF_EM_NONE(*eh64)) && IS_ELF_VCURRENT(*eh64);
+  if (ok && IS_ELF32(*eh64))
+    ok = read_segments<Elf32_Ehdr, Elf32_Phdr>(buf, size, segs);
+  else if (ok && IS_ELF64(*eh64))
+    ok = read_segments<Elf64_Ehdr, Elf64_Phdr>(buf, size, segs);
+  else
+    ok = false;
+  if (!ok) {
+    std::cerr << argv[3] << " is not a valid RISC-V executable" << std::endl;
+    return 1;
+  }
+
+  const uint64_t end = base + uint64_t(width) * depth;
+  for (auto& seg : segs) {
+    if (seg.addr < base || seg.addr + seg.memsz > end || seg.addr + seg.memsz < seg.addr) {
+      std::cerr << "segment at 0x" << std::hex << seg.addr << " does not fit in memory" << std::endl;
+      return 1;
+    }
+  }
+  std::stable_sort(segs.begin(), segs.end(),
+                   [](const segment_t& a, const segment_t& b) { return a.addr < b.addr; });
+
+  static const char hex[] = "0123456789abcdef";
+  const std::string zero_line = std::string(2 * width, '0') + '\n';
+  std::vector<uint8_t> line(width);
+  std::string out;
+  out.reserve((1 << 20) + zero_line.size());
+
+  // The segments overlapping the current line, in program header order
+  std::vector<const segment_t*> active;
+  size_t next = 0;
+  for (uint64_t lo = base; lo < end; lo += width) {
+    uint64_t hi = lo + width;
+    active.erase(std::remove_if(active.begin(), active.end(),
+                                [lo](const segment_t* seg) { return seg->addr + seg->memsz <= lo; }),
+                 active.end());
+    bool added = false;
+    for (; next < segs.size() && segs[next].addr < hi; next++, added = true)
+      active.push_back(&segs[next]);
+    if (added)
+      std::sort(active.begin(), active.end(),
+                [](const segment_t* a, const segment_t* b) { return a->order < b->order; });
+
+    if (active.empty()) {
+      out += zero_line;
+    } else {
+      std::fill(line.begin(), line.end(), 0);
+      for (const segment_t* seg : active) {
+        uint64_t from = std::max(lo, seg->addr);
+        uint64_t to = std::min(hi, seg->addr + seg->memsz);
+        uint64_t file_to = std::min(to, seg->addr + seg->filesz);
+        if (from < file_to)
+          memcpy(&line[from - lo], seg->data + (from - seg->addr), file_to - from);
+        if (std::max(from, file_to) < to)
+          memset(&line[std::max(from, file_to) - lo], 0, to - std::max(from, file_to));
+      }
+      for (size_t j = width; j-- > 0; ) {
+        out += hex[line[j] >> 4];
+        out += hex[line[j] & 0xf];
+      }
+      out += '\n';
+    }
+
+    if (out.size() >= (1 << 20)) {
+      fwrite(out.data(), 1, out.size(), stdout);
+      out.clear();
+    }
+  }
+  fwrite(out.data(), 1, out.size(), stdout);
 
-  return 0;
+  if (buf)
+    munmap((void*)buf, size);
+  return fflush(stdout) == 0 ? 0 : 1;
 }
@@ -2,6 +2,7 @@
 
 #include "elf.h"
 #include "memif.h"
+#include "elfloader.h"
 #include "byteorder.h"
 #include <cstring>
 #include <string>
@@ -16,7 +17,7 @@
 #include <vector>
 #include <map>
 
-std::map<std::string, uint64_t> load_elf(const char* fn, memif_t* memif, reg_t* entry)
+void load_elf(const char* fn, memif_t* memif, reg_t* entry, elf_symtab_t* symtab)
 {
   int fd = open(fn, O_RDONLY);
   struct stat s;
@@ -38,7 +39,6 @@ std::map<std::string, uint64_t> load_elf(const char* fn, memif_t* memif, reg_t*
   assert(IS_ELF_VCURRENT(*eh64));
 
   std::vector<uint8_t> zeros;
-  std::map<std::string, uint64_t> symbols;
 
 #define LOAD_ELF(ehdr_t, phdr_t, shdr_t, sym_t, bswap)                         \
   do {                                                                         \
@@ -60,6 +60,8 @@ std::map<std::string, uint64_t> load_elf(const char* fn, memif_t* memif, reg_t*
         }                                                                      \
       }                                                                        \
     }                                                                          \
+    if (!symtab)                                                               \
+      break;                                                                   \
     shdr_t* sh = (shdr_t*)(buf + bswap(eh->e_shoff));                          \
     assert(size >= bswap(eh->e_shoff) + bswap(eh->e_shnum) * sizeof(*sh));     \
     assert(bswap(eh->e_shstrndx) < bswap(eh->e_shnum));                        \
@@ -80,16 +82,10 @@ std::map<std::string, uint64_t> load_elf(const char* fn, memif_t* memif, reg_t*
         symtabidx = i;                                                         \
     }                                                                          \
     if (strtabidx && symtabidx) {                                              \
-      char* strtab = buf + bswap(sh[strtabidx].sh_offset);                     \
-      sym_t* sym = (sym_t*)(buf + bswap(sh[symtabidx].sh_offset));             \
-      for (unsigned i = 0; i < bswap(sh[symtabidx].sh_size) / sizeof(sym_t);   \
-           i++) {                                                              \
-        unsigned max_len =                                                     \
-            bswap(sh[strtabidx].sh_size) - bswap(sym[i].st_name);              \
-        assert(bswap(sym[i].st_name) < bswap(sh[strtabidx].sh_size));          \
-        assert(strnlen(strtab + bswap(sym[i].st_name), max_len) < max_len);    \
-        symbols[strtab + bswap(sym[i].st_name)] = bswap(sym[i].st_value);      \
-      }                                                                        \
+      symtab->strtab = buf + bswap(sh[strtabidx].sh_offset);                   \
+      symtab->strtab_size = bswap(sh[strtabidx].sh_size);                      \
+      symtab->syms = buf + bswap(sh[symtabidx].sh_offset);                     \
+      symtab->nsyms = bswap(sh[symtabidx].sh_size) / sizeof(sym_t);            \
     }                                                                          \
   } while (0)
 
@@ -111,7 +107,75 @@ std::map<std::string, uint64_t> load_elf(const char* fn, memif_t* memif, reg_t*
 #endif
   }
 
-  munmap(buf, size);
+  // The symbol table keeps the file mapped; it only reads the pages it
+  // needs, when it needs them.
+  if (symtab && symtab->syms) {
+    symtab->map = buf;
+    symtab->map_size = size;
+    symtab->elf64 = IS_ELF64(*eh64);
+    symtab->big_endian = IS_ELFBE(*eh64);
+  } else {
+    munmap(buf, size);
+  }
+}
 
+std::map<std::string, uint64_t> load_elf(const char* fn, memif_t* memif, reg_t* entry,
+                                         std::vector<elf_symbol_t>* symtab)
+{
+  elf_symtab_t table;
+  load_elf(fn, memif, entry, &table);
+
+  std::map<std::string, uint64_t> symbols;
+  table.for_each([&](const char* name, uint64_t value, uint64_t size, unsigned type, bool defined) {
+    symbols[name] = value;
+    if (symtab && defined && type != STT_SECTION && type != STT_FILE && name[0] != '\0')
+      symtab->push_back({value, size, type == STT_FUNC, name});
+  });
   return symbols;
 }
+
+elf_symtab_t::~elf_symtab_t()
+{
+  if (map)
+    munmap(map, map_size);
+}
+
+template<typename sym_t, typename swap_t>
+static void visit_symbols(const char* syms, size_t nsyms, const char* strtab, size_t strtab_size,
+                          swap_t bswap, const elf_symtab_t::visitor_t& visit)
+{
+  const sym_t* sym = (const sym_t*)syms;
+  for (size_t i = 0; i < nsyms; i++) {
+    unsigned max_len = strtab_size - bswap(sym[i].st_name);
+    assert(bswap(sym[i].st_name) < strtab_size);
+    assert(strnlen(strtab + bswap(sym[i].st_name), max_len) < max_len);
+    visit(strtab + bswap(sym[i].st_name), bswap(sym[i].st_value), bswap(sym[i].st_size),
+          ELF_ST_TYPE(sym[i].st_info), bswap(sym[i].st_shndx) != SHN_UNDEF);
+  }
+}
+
+void elf_symtab_t::for_each(const visitor_t& visit) const
+{
+  auto le = [](auto val) { return from_le(val); };
+  auto be = [](auto val) { return from_be(val); };
+  if (elf64 && big_endian)
+    visit_symbols<Elf64_Sym>(syms, nsyms, strtab, strtab_size, be, visit);
+  else if (elf64)
+    visit_symbols<Elf64_Sym>(syms, nsyms, strtab, strtab_size, le, visit);
+  else if (big_endian)
+    visit_symbols<Elf32_Sym>(syms, nsyms, strtab, strtab_size, be, visit);
+  else
+    visit_symbols<Elf32_Sym>(syms, nsyms, strtab, strtab_size, le, visit);
+}
+
+bool elf_symtab_t::find(const char* name, uint64_t* value) const
+{
+  bool found = false;
+  for_each([&](const char* sym_name, uint64_t sym_value, uint64_t, unsigned, bool) {
+    if (strcmp(sym_name, name) == 0) {
+      *value = sym_value;
+      found = true;
+    }
+  });
+  return found;
+}
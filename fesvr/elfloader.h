@@ -4,10 +4,61 @@
 #define _ELFLOADER_H
 
 #include "elf.h"
+#include <functional>
 #include <map>
 #include <string>
+#include <vector>
+
+// A defined symbol as the symbol table gives it; size is 0 if unknown.
+struct elf_symbol_t {
+  uint64_t start;
+  uint64_t size;
+  bool func;
+  std::string name;
+};
 
 class memif_t;
-std::map<std::string, uint64_t> load_elf(const char* fn, memif_t* memif, reg_t* entry);
+class elf_symtab_t;
+// Returns the ELF's symbols by name, and if symtab is given, also appends
+// every defined symbol other than section and file names to it.
+std::map<std::string, uint64_t> load_elf(const char* fn, memif_t* memif, reg_t* entry,
+                                         std::vector<elf_symbol_t>* symtab = NULL);
+// Loads the ELF and, if symtab is given, leaves its symbol table there,
+// undecoded.
+void load_elf(const char* fn, memif_t* memif, reg_t* entry, elf_symtab_t* symtab);
+
+// The symbol table of a loaded ELF, read in place from the mapped file, so
+// that a binary with hundreds of thousands of symbols costs nothing until
+// they are asked for.
+class elf_symtab_t
+{
+public:
+  typedef std::function<void(const char* name, uint64_t value, uint64_t size,
+                             unsigned type, bool defined)> visitor_t;
+
+  elf_symtab_t() {}
+  ~elf_symtab_t();
+  elf_symtab_t(const elf_symtab_t&) = delete;
+  elf_symtab_t& operator=(const elf_symtab_t&) = delete;
+
+  // The value of the last symbol called name; false if there is none.
+  // Scans the table.
+  bool find(const char* name, uint64_t* value) const;
+  // Visits every symbol in table order, with its ELF type (STT_*).  Names
+  // point into the file, and live as long as the table.
+  void for_each(const visitor_t& visit) const;
+
+private:
+  friend void load_elf(const char*, memif_t*, reg_t*, elf_symtab_t*);
+
+  char* map = nullptr;
+  size_t map_size = 0;
+  const char* strtab = nullptr;
+  size_t strtab_size = 0;
+  const char* syms = nullptr;
+  size_t nsyms = 0;
+  bool elf64 = false;
+  bool big_endian = false;
+};
 
 #endif
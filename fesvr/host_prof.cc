@@ -0,0 +1,150 @@
+// See LICENSE for license details.
+
+#include "host_prof.h"
+#include <chrono>
+#include <cinttypes>
+#include <mutex>
+#include <set>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+bool host_prof_enabled = false;
+
+static const char* const region_names[HOST_PROF_NREGIONS] = {
+  "refill_icache",
+  "walk",
+  "load_slow_path",
+  "store_slow_path",
+  "mem_trace",
+  "sift_trace",
+  "take_trap",
+  "htif_command",
+};
+
+static uint64_t now()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+struct host_prof_counts_t
+{
+  uint64_t calls[HOST_PROF_NREGIONS] = {};
+  uint64_t total[HOST_PROF_NREGIONS] = {};
+  uint64_t self[HOST_PROF_NREGIONS] = {};
+
+  void add(const host_prof_counts_t& other)
+  {
+    for (int i = 0; i < HOST_PROF_NREGIONS; i++) {
+      calls[i] += other.calls[i];
+      total[i] += other.total[i];
+      self[i] += other.self[i];
+    }
+  }
+};
+
+// Counts of the threads still running, and of those that have exited.
+static std::mutex threads_lock;
+static std::set<host_prof_counts_t*> live_threads;
+static host_prof_counts_t exited_threads;
+
+static uint64_t start_ticks;
+static std::chrono::steady_clock::time_point start_time;
+
+// Each thread counts on its own and registers its counts on first use.
+struct host_prof_thread_t
+{
+  host_prof_counts_t counts;
+  host_prof_scope_t* current = nullptr;
+
+  host_prof_thread_t()
+  {
+    std::lock_guard<std::mutex> guard(threads_lock);
+    live_threads.insert(&counts);
+  }
+  ~host_prof_thread_t()
+  {
+    std::lock_guard<std::mutex> guard(threads_lock);
+    live_threads.erase(&counts);
+    exited_threads.add(counts);
+  }
+};
+
+static thread_local host_prof_thread_t thread_counts;
+
+void host_prof_enable()
+{
+  start_time = std::chrono::steady_clock::now();
+  start_ticks = now();
+  host_prof_enabled = true;
+}
+
+void host_prof_scope_t::enter()
+{
+  parent = thread_counts.current;
+  thread_counts.current = this;
+  children = 0;
+  start = now();
+}
+
+void host_prof_scope_t::leave()
+{
+  uint64_t elapsed = now() - start;
+  auto& t = thread_counts;
+  t.counts.calls[region]++;
+  t.counts.total[region] += elapsed;
+  t.counts.self[region] += elapsed - children;
+  if (parent)
+    parent->children += elapsed;
+  t.current = parent;
+}
+
+void host_prof_report(FILE* f)
+{
+  if (!host_prof_enabled)
+    return;
+
+  uint64_t ticks = now() - start_ticks;
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+  double ticks_per_second = seconds > 0 ? ticks / seconds : 0;
+
+  host_prof_counts_t counts;
+  {
+    std::lock_guard<std::mutex> guard(threads_lock);
+    counts.add(exited_threads);
+    for (auto t : live_threads)
+      counts.add(*t);
+  }
+
+  // Own time is exclusive of nested regions; percentages are of the time
+  // since profiling started, so they can add up to more than 100 when
+  // several harts run in parallel.
+  fprintf(f, "Host profile: %.3f s\n", seconds);
+  fprintf(f, "%-16s %12s %12s %12s %7s %12s\n",
+          "region", "calls", "total s", "own s", "own %", "ticks/call");
+  for (int i = 0; i < HOST_PROF_NREGIONS; i++) {
+    if (!counts.calls[i])
+      continue;
+    fprintf(f, "%-16s %12" PRIu64 " %12.3f %12.3f %6.1f%% %12" PRIu64 "\n",
+            region_names[i], counts.calls[i],
+            ticks_per_second ? counts.total[i] / ticks_per_second : 0,
+            ticks_per_second ? counts.self[i] / ticks_per_second : 0,
+            ticks ? 100.0 * counts.self[i] / ticks : 0,
+            counts.total[i] / counts.calls[i]);
+  }
+
+  // Instruction dispatch and execution, and everything else not covered.
+  uint64_t covered = 0;
+  for (int i = 0; i < HOST_PROF_NREGIONS; i++)
+    covered += counts.self[i];
+  if (covered < ticks) {
+    fprintf(f, "%-16s %12s %12s %12.3f %6.1f%%\n", "(rest)", "", "",
+            ticks_per_second ? (ticks - covered) / ticks_per_second : 0,
+            100.0 * (ticks - covered) / ticks);
+  }
+}
@@ -0,0 +1,62 @@
+// See LICENSE for license details.
+
+#ifndef _HOST_PROF_H
+#define _HOST_PROF_H
+
+#include <cstdint>
+#include <cstdio>
+
+// Where the simulator itself spends host time.  Regions nest: the time of
+// a region run inside another one is counted as the inner region's own
+// time and as part of the outer region's total.
+enum host_prof_region_t
+{
+  HOST_PROF_REFILL_ICACHE,
+  HOST_PROF_WALK,
+  HOST_PROF_LOAD_SLOW_PATH,
+  HOST_PROF_STORE_SLOW_PATH,
+  HOST_PROF_MEM_TRACE,
+  HOST_PROF_SIFT_TRACE,
+  HOST_PROF_TAKE_TRAP,
+  HOST_PROF_HTIF_COMMAND,
+  HOST_PROF_NREGIONS
+};
+
+extern bool host_prof_enabled;
+
+// Starts profiling; the report covers the time from here on.
+void host_prof_enable();
+
+// Prints calls, total and own time per region for all threads so far.
+void host_prof_report(FILE* f);
+
+// Times the enclosing scope as region r while profiling is enabled, and
+// costs a predictable branch otherwise.
+class host_prof_scope_t
+{
+ public:
+  host_prof_scope_t(host_prof_region_t r) : region(r), start(0)
+  {
+    if (__builtin_expect(host_prof_enabled, 0))
+      enter();
+  }
+  ~host_prof_scope_t()
+  {
+    if (__builtin_expect(start != 0, 0))
+      leave();
+  }
+
+  host_prof_scope_t(const host_prof_scope_t&) = delete;
+  host_prof_scope_t& operator=(const host_prof_scope_t&) = delete;
+
+ private:
+  void enter();
+  void leave();
+
+  host_prof_region_t region;
+  host_prof_scope_t* parent;
+  uint64_t start;
+  uint64_t children;
+};
+
+#endif
@@ -6,6 +6,7 @@
 #include "platform.h"
 #include "byteorder.h"
 #include "trap.h"
+#include "host_prof.h"
 #include <algorithm>
 #include <assert.h>
 #include <vector>
@@ -76,6 +77,7 @@ htif_t::htif_t(const std::vector<std::string>& args) : htif_t()
 
 htif_t::~htif_t()
 {
+  stop_async_syscalls();
   for (auto d : dynamic_devices)
     delete d;
 }
@@ -86,6 +88,9 @@ void htif_t::start()
       load_program();
 
   reset();
+
+  if (async_syscalls && !async_thread.joinable())
+    async_thread = std::thread(&htif_t::serve_async_syscalls, this);
 }
 
 static void bad_address(const std::string& situation, reg_t addr)
@@ -95,7 +100,7 @@ static void bad_address(const std::string& situation, reg_t addr)
   exit(-1);
 }
 
-std::map<std::string, uint64_t> htif_t::load_payload(const std::string& payload, reg_t* entry)
+void htif_t::load_payload(const std::string& payload, reg_t* entry, elf_symtab_t* symtab)
 {
   std::string path;
   if (access(payload.c_str(), F_OK) == 0)
@@ -129,7 +134,7 @@ std::map<std::string, uint64_t> htif_t::load_payload(const std::string& payload,
   } preload_aware_memif(this);
 
   try {
-    return load_elf(path.c_str(), &preload_aware_memif, entry);
+    load_elf(path.c_str(), &preload_aware_memif, entry, symtab);
   } catch (mem_trap_t& t) {
     bad_address("loading payload " + payload, t.get_tval());
     abort();
@@ -138,20 +143,26 @@ std::map<std::string, uint64_t> htif_t::load_payload(const std::string& payload,
 
 void htif_t::load_program()
 {
-  std::map<std::string, uint64_t> symbols = load_payload(targs[0], &entry);
-
-  if (symbols.count("tohost") && symbols.count("fromhost")) {
-    tohost_addr = symbols["tohost"];
-    fromhost_addr = symbols["fromhost"];
+  // Only the symbols HTIF needs are looked up now; the rest are indexed
+  // when something first asks for one.
+  symtab.reset(new elf_symtab_t);
+  load_payload(targs[0], &entry, symtab.get());
+
+  uint64_t tohost, fromhost;
+  if (symtab->find("tohost", &tohost) && symtab->find("fromhost", &fromhost)) {
+    tohost_addr = tohost;
+    fromhost_addr = fromhost;
   } else {
     fprintf(stderr, "warning: tohost and fromhost symbols not in ELF; can't communicate with target\n");
   }
 
   // detect torture tests so we can print the memory signature at the end
-  if (symbols.count("begin_signature") && symbols.count("end_signature"))
+  uint64_t begin_signature, end_signature;
+  if (symtab->find("begin_signature", &begin_signature) &&
+      symtab->find("end_signature", &end_signature))
   {
-    sig_addr = symbols["begin_signature"];
-    sig_len = symbols["end_signature"] - sig_addr;
+    sig_addr = begin_signature;
+    sig_len = end_signature - sig_addr;
   }
 
   for (auto payload : payloads)
@@ -159,25 +170,123 @@ void htif_t::load_program()
     reg_t dummy_entry;
     load_payload(payload, &dummy_entry);
   }
-
-   for (auto i : symbols)
-   {
-     auto it = addr2symbol.find(i.second);
-     if ( it == addr2symbol.end())
-       addr2symbol[i.second] = i.first;
-   }
-
-   return;
 }
 
 const char* htif_t::get_symbol(uint64_t addr)
 {
-  auto it = addr2symbol.find(addr);
+  std::call_once(symbols_indexed, &htif_t::index_symbols, this);
+  auto it = std::lower_bound(addr2symbol.begin(), addr2symbol.end(), addr,
+                             [](const std::pair<uint64_t, const char*>& s, uint64_t a) { return s.first < a; });
 
-  if(it == addr2symbol.end())
+  if (it == addr2symbol.end() || it->first != addr)
       return nullptr;
 
-  return it->second.c_str();
+  return it->second;
+}
+
+bool htif_t::find_symbol(const std::string& name, uint64_t* start, uint64_t* end)
+{
+  std::call_once(symbols_indexed, &htif_t::index_symbols, this);
+  for (auto it = addr2symbol.begin(); it != addr2symbol.end(); ++it) {
+    if (it->second == name) {
+      *start = it->first;
+      auto next = std::next(it);
+      *end = next == addr2symbol.end() ? UINT64_MAX : next->first;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Where symbols share a start, a function beats other symbols and a sized
+// symbol an unsized one.  A symbol inside a sized one, such as a label in
+// an assembly function, does not split it.
+void htif_t::index_symbols()
+{
+  if (!symtab)
+    return;
+
+  // Where a name repeats, its last symbol counts, and where an address
+  // has several names, the alphabetically first.
+  std::vector<std::pair<const char*, uint64_t>> names;
+  struct defined_t {
+    uint64_t start;
+    uint64_t size;
+    bool func;
+    const char* name;
+  };
+  std::vector<defined_t> defined;
+  symtab->for_each([&](const char* name, uint64_t value, uint64_t size, unsigned type, bool is_defined) {
+    names.emplace_back(name, value);
+    if (is_defined && type != STT_SECTION && type != STT_FILE && name[0] != '\0')
+      defined.push_back({value, size, type == STT_FUNC, name});
+  });
+  auto by_name = [](const std::pair<const char*, uint64_t>& a, const std::pair<const char*, uint64_t>& b) {
+    return strcmp(a.first, b.first) < 0;
+  };
+  std::stable_sort(names.begin(), names.end(), by_name);
+  addr2symbol.clear();
+  for (size_t i = 0; i < names.size(); i++)
+    if (i + 1 == names.size() || by_name(names[i], names[i + 1]))
+      addr2symbol.emplace_back(names[i].second, names[i].first);
+  std::stable_sort(addr2symbol.begin(), addr2symbol.end(),
+                   [](const std::pair<uint64_t, const char*>& a, const std::pair<uint64_t, const char*>& b) {
+                     return a.first < b.first;
+                   });
+  addr2symbol.erase(std::unique(addr2symbol.begin(), addr2symbol.end(),
+                                [](const std::pair<uint64_t, const char*>& a,
+                                   const std::pair<uint64_t, const char*>& b) {
+                                  return a.first == b.first;
+                                }),
+                    addr2symbol.end());
+
+  std::sort(defined.begin(), defined.end(), [](const defined_t& a, const defined_t& b) {
+    if (a.start != b.start)
+      return a.start < b.start;
+    if (a.func != b.func)
+      return a.func;
+    return a.size > b.size;
+  });
+
+  symbol_index.clear();
+  uint64_t covered = 0;  // end of the last sized range
+  for (auto& sym : defined) {
+    if (!symbol_index.empty() && (sym.start == symbol_index.back().start || sym.start < covered))
+      continue;
+    if (!symbol_index.empty() && symbol_index.back().end > sym.start)
+      symbol_index.back().end = sym.start;
+    uint64_t end = sym.size ? sym.start + sym.size : UINT64_MAX;
+    symbol_index.push_back({sym.start, end, sym.name, sym.func});
+    if (sym.size)
+      covered = end;
+  }
+}
+
+bool htif_t::find_function(const std::string& name, uint64_t* start)
+{
+  std::call_once(symbols_indexed, &htif_t::index_symbols, this);
+  for (auto& r : symbol_index) {
+    if (r.func && r.name == name) {
+      *start = r.start;
+      return true;
+    }
+  }
+  return false;
+}
+
+const char* htif_t::get_enclosing_symbol(uint64_t addr, uint64_t* start, uint64_t* end)
+{
+  std::call_once(symbols_indexed, &htif_t::index_symbols, this);
+  auto it = std::upper_bound(symbol_index.begin(), symbol_index.end(), addr,
+                             [](uint64_t a, const symbol_range_t& r) { return a < r.start; });
+
+  if (it == symbol_index.begin() || addr >= (--it)->end)
+    return nullptr;
+
+  *start = it->start;
+  if (end)
+    *end = it->end;
+  return it->name;
 }
 
 void htif_t::stop()
@@ -204,6 +313,7 @@ void htif_t::stop()
     sigs.close();
   }
 
+  stop_async_syscalls();
   stopped = true;
 }
 
@@ -220,55 +330,122 @@ int htif_t::run()
 {
   start();
 
-  auto enq_func = [](std::queue<reg_t>* q, uint64_t x) { q->push(x); };
-  std::queue<reg_t> fromhost_queue;
-  std::function<void(reg_t)> fromhost_callback =
-    std::bind(enq_func, &fromhost_queue, std::placeholders::_1);
-
+  // Without tohost, only request_exit() ends the run.
   if (tohost_addr == 0) {
-    while (true)
+    while (!signal_exit && exitcode == 0)
       idle();
   }
 
   while (!signal_exit && exitcode == 0)
-  {
-    uint64_t tohost;
+    serve(true);
 
-    try {
-      if ((tohost = from_target(mem.read_uint64(tohost_addr))) != 0)
-        mem.write_uint64(tohost_addr, target_endian<uint64_t>::zero);
-    } catch (mem_trap_t& t) {
-      bad_address("accessing tohost", t.get_tval());
-    }
+  stop();
 
-    try {
-      if (tohost != 0) {
-        command_t cmd(mem, tohost, fromhost_callback);
-        device_list.handle_command(cmd);
-      } else {
-        idle();
+  return exit_code();
+}
+
+bool htif_t::poll()
+{
+  if (stopped)
+    return false;
+  if (tohost_addr == 0)
+    return true;
+
+  serve(false);
+  if (!signal_exit && exitcode == 0)
+    return true;
+  stop();
+  return false;
+}
+
+void htif_t::serve(bool may_idle)
+{
+  uint64_t tohost;
+
+  try {
+    if ((tohost = from_target(mem.read_uint64(tohost_addr))) != 0)
+      mem.write_uint64(tohost_addr, target_endian<uint64_t>::zero);
+  } catch (mem_trap_t& t) {
+    bad_address("accessing tohost", t.get_tval());
+  }
+
+  try {
+    // Device 0 is the syscall proxy, and a payload with bit 0 set is exit.
+    if (tohost != 0 && async_thread.joinable() && (tohost >> 56) == 0 && !(tohost & 1)) {
+      {
+        std::lock_guard<std::mutex> guard(async_lock);
+        async_requests.push(tohost);
       }
+      async_work.notify_one();
+    } else if (tohost != 0) {
+      host_prof_scope_t prof(HOST_PROF_HTIF_COMMAND);
+      command_t cmd(mem, tohost, [this](reg_t x) { fromhost_queue.push(x); });
+      device_list.handle_command(cmd);
+    } else if (may_idle) {
+      idle();
+    }
 
-      device_list.tick();
-    } catch (mem_trap_t& t) {
-      std::stringstream tohost_hex;
-      tohost_hex << std::hex << tohost;
-      bad_address("host was accessing memory on behalf of target (tohost = 0x" + tohost_hex.str() + ")", t.get_tval());
+    device_list.tick();
+  } catch (mem_trap_t& t) {
+    std::stringstream tohost_hex;
+    tohost_hex << std::hex << tohost;
+    bad_address("host was accessing memory on behalf of target (tohost = 0x" + tohost_hex.str() + ")", t.get_tval());
+  }
+
+  if (async_ready.load(std::memory_order_acquire)) {
+    std::lock_guard<std::mutex> guard(async_lock);
+    for (; !async_replies.empty(); async_replies.pop())
+      fromhost_queue.push(async_replies.front());
+    async_ready.store(false, std::memory_order_relaxed);
+  }
+
+  try {
+    if (!fromhost_queue.empty() && !mem.read_uint64(fromhost_addr)) {
+      mem.write_uint64(fromhost_addr, to_target(fromhost_queue.front()));
+      fromhost_queue.pop();
     }
+  } catch (mem_trap_t& t) {
+    bad_address("accessing fromhost", t.get_tval());
+  }
+}
+
+void htif_t::serve_async_syscalls()
+{
+  std::unique_lock<std::mutex> guard(async_lock);
+  while (true) {
+    async_work.wait(guard, [this] { return async_stopping || !async_requests.empty(); });
+    if (async_stopping)
+      return;
+    reg_t tohost = async_requests.front();
+    async_requests.pop();
+    guard.unlock();
 
     try {
-      if (!fromhost_queue.empty() && !mem.read_uint64(fromhost_addr)) {
-        mem.write_uint64(fromhost_addr, to_target(fromhost_queue.front()));
-        fromhost_queue.pop();
-      }
+      command_t cmd(mem, tohost, [this](reg_t x) {
+        std::lock_guard<std::mutex> reply_guard(async_lock);
+        async_replies.push(x);
+        async_ready.store(true, std::memory_order_release);
+      });
+      device_list.handle_command(cmd);
     } catch (mem_trap_t& t) {
-      bad_address("accessing fromhost", t.get_tval());
+      std::stringstream tohost_hex;
+      tohost_hex << std::hex << tohost;
+      bad_address("host was accessing memory on behalf of target (tohost = 0x" + tohost_hex.str() + ")", t.get_tval());
     }
+    guard.lock();
   }
+}
 
-  stop();
-
-  return exit_code();
+void htif_t::stop_async_syscalls()
+{
+  if (!async_thread.joinable())
+    return;
+  {
+    std::lock_guard<std::mutex> guard(async_lock);
+    async_stopping = true;
+  }
+  async_work.notify_one();
+  async_thread.join();
 }
 
 bool htif_t::done()
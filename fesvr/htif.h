@@ -4,11 +4,18 @@
 #define __HTIF_H
 
 #include "memif.h"
+#include "elfloader.h"
 #include "syscall.h"
 #include "device.h"
 #include "byteorder.h"
 #include <string.h>
+#include <atomic>
+#include <condition_variable>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
 #include <vector>
 #include <assert.h>
 
@@ -24,11 +31,26 @@ class htif_t : public chunked_memif_t
   virtual void stop();
 
   int run();
+  // For a host that runs the target itself rather than through run():
+  // serves any request the target has made, without waiting for one.
+  // Returns false, after calling stop(), once the target has exited.
+  bool poll();
   bool done();
   int exit_code();
 
   virtual memif_t& memif() { return mem; }
 
+  // Runs the target's system calls, other than exit, on a thread of their
+  // own from start() on, so that the target keeps running while a call
+  // waits on host I/O; the reply goes to fromhost once the call returns.
+  // The host must be able to reach target memory from that thread while
+  // the target runs, as it can flat memory through direct_ptr.
+  void set_async_syscalls(bool enable) { async_syscalls = enable; }
+  bool get_async_syscalls() const { return async_syscalls; }
+  // Whether an asynchronous call has finished and its reply waits for
+  // serve() to pass it on
+  bool async_reply_ready() { return async_ready.load(std::memory_order_acquire); }
+
   template<typename T> inline T from_target(target_endian<T> n) const
   {
     memif_endianness_t endianness = get_target_endianness();
@@ -55,25 +77,51 @@ class htif_t : public chunked_memif_t
   virtual size_t chunk_align() = 0;
   virtual size_t chunk_max_size() = 0;
 
-  virtual std::map<std::string, uint64_t> load_payload(const std::string& payload, reg_t* entry);
+  virtual void load_payload(const std::string& payload, reg_t* entry, elf_symtab_t* symtab = NULL);
   virtual void load_program();
   virtual void idle() {}
+  // Makes run() return code once control is back on the host.
+  void request_exit(int code) { exitcode = (code << 1) | 1; }
 
   const std::vector<std::string>& host_args() { return hargs; }
+  const std::vector<std::string>& target_args() { return targs; }
+  // Services a Linux system call as syscall_t::emulate() does.
+  reg_t proxy_syscall(reg_t n, const reg_t* args) { return syscall_proxy.emulate(n, args); }
 
   reg_t get_entry_point() { return entry; }
+  addr_t get_tohost_addr() { return tohost_addr; }
+  addr_t get_fromhost_addr() { return fromhost_addr; }
+  // Leaves tohost and fromhost to another process that shares the target's
+  // memory, so that run() only ends on request_exit().
+  void detach_tohost() { tohost_addr = fromhost_addr = 0; }
 
   // indicates that the initial program load can skip writing this address
   // range to memory, because it has already been loaded through a sideband
   virtual bool is_address_preloaded(addr_t taddr, size_t len) { return false; }
 
+  // The symbol lookups below index the program's symbols on first use.
   // Given an address, return symbol from addr2symbol map
   const char* get_symbol(uint64_t addr);
+  // Given a symbol name, return its address and the address of the next
+  // symbol (or UINT64_MAX); false if the ELF has no such symbol
+  bool find_symbol(const std::string& name, uint64_t* start, uint64_t* end);
+  // Given an address, return the symbol whose range holds it, preferring
+  // functions, and set start and, if given, end to that range; nullptr if
+  // there is none.  O(log n) in the number of symbols.
+  const char* get_enclosing_symbol(uint64_t addr, uint64_t* start, uint64_t* end = nullptr);
+  // Given a symbol name, return the address of the function of that name;
+  // false if the ELF has none, or the symbol is data or an ifunc resolver
+  bool find_function(const std::string& name, uint64_t* start);
 
  private:
   void parse_arguments(int argc, char ** argv);
   void register_devices();
   void usage(const char * program_name);
+  void index_symbols();
+  // One round of run(), calling idle() if may_idle and there was no request.
+  void serve(bool may_idle);
+  void serve_async_syscalls();
+  void stop_async_syscalls();
 
   memif_t mem;
   reg_t entry;
@@ -86,8 +134,18 @@ class htif_t : public chunked_memif_t
   addr_t sig_len; // torture
   addr_t tohost_addr;
   addr_t fromhost_addr;
-  int exitcode;
+  std::atomic<int> exitcode;
   bool stopped;
+  std::queue<reg_t> fromhost_queue;
+
+  bool async_syscalls = false;
+  std::thread async_thread;
+  std::mutex async_lock;
+  std::condition_variable async_work;
+  std::queue<reg_t> async_requests;
+  std::queue<reg_t> async_replies;
+  std::atomic<bool> async_ready{false};
+  bool async_stopping = false;
 
   device_list_t device_list;
   syscall_t syscall_proxy;
@@ -95,9 +153,24 @@ class htif_t : public chunked_memif_t
   std::vector<device_t*> dynamic_devices;
   std::vector<std::string> payloads;
 
-  const std::vector<std::string>& target_args() { return targs; }
-
-  std::map<uint64_t, std::string> addr2symbol;
+  // The program's symbol table, left undecoded until a lookup needs it.
+  // Names below point into it.
+  std::unique_ptr<elf_symtab_t> symtab;
+  std::once_flag symbols_indexed;
+
+  // Each address with a symbol and the alphabetically first name there,
+  // sorted by address
+  std::vector<std::pair<uint64_t, const char*>> addr2symbol;
+
+  // Disjoint symbol ranges sorted by start address.  A sized symbol covers
+  // its size, and one without a size runs up to the next range.
+  struct symbol_range_t {
+    uint64_t start;
+    uint64_t end;
+    const char* name;
+    bool func;
+  };
+  std::vector<symbol_range_t> symbol_index;
 
   friend class memif_t;
   friend class syscall_t;
@@ -6,8 +6,40 @@
 #include <stdexcept>
 #include "memif.h"
 
+// Calls copy(host, pos, n) on each run of [addr, addr + len) that is plain
+// target memory, up to the first part that is not, and returns the length
+// of the prefix covered.
+template<typename F>
+static size_t copy_direct(chunked_memif_t* cmemif, addr_t addr, size_t len, F copy)
+{
+  size_t pos = 0, run;
+  while (pos < len) {
+    char* host = cmemif->direct_ptr(addr + pos, len - pos, &run);
+    if (!host)
+      break;
+    copy(host, pos, run);
+    pos += run;
+  }
+  return pos;
+}
+
+static bool is_zero(const void* bytes, size_t len)
+{
+  for (size_t i = 0; i < len; i++)
+    if (((const char*)bytes)[i] != 0)
+      return false;
+  return true;
+}
+
 void memif_t::read(addr_t addr, size_t len, void* bytes)
 {
+  size_t done = copy_direct(cmemif, addr, len, [&](char* host, size_t pos, size_t n) {
+    memcpy((char*)bytes + pos, host, n);
+  });
+  bytes = (char*)bytes + done;
+  addr += done;
+  len -= done;
+
   size_t align = cmemif->chunk_align();
   if (len && (addr & (align-1)))
   {
@@ -41,6 +73,16 @@ void memif_t::read(addr_t addr, size_t len, void* bytes)
 
 void memif_t::write(addr_t addr, size_t len, const void* bytes)
 {
+  // Zeros are left to clear_chunk, which need not allocate untouched memory.
+  if (!is_zero(bytes, len)) {
+    size_t done = copy_direct(cmemif, addr, len, [&](char* host, size_t pos, size_t n) {
+      memcpy(host, (const char*)bytes + pos, n);
+    });
+    bytes = (const char*)bytes + done;
+    addr += done;
+    len -= done;
+  }
+
   size_t align = cmemif->chunk_align();
   if (len && (addr & (align-1)))
   {
@@ -70,11 +112,7 @@ void memif_t::write(addr_t addr, size_t len, const void* bytes)
   }
 
   // now we're aligned
-  bool all_zero = len != 0;
-  for (size_t i = 0; i < len; i++)
-    all_zero &= ((const char*)bytes)[i] == 0;
-
-  if (all_zero) {
+  if (len != 0 && is_zero(bytes, len)) {
     cmemif->clear_chunk(addr, len);
   } else {
     size_t max_chunk = cmemif->chunk_max_size();
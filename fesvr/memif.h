@@ -24,6 +24,11 @@ public:
   virtual void write_chunk(addr_t taddr, size_t len, const void* src) = 0;
   virtual void clear_chunk(addr_t taddr, size_t len) = 0;
 
+  // Optionally return a host pointer to the target memory at taddr, setting
+  // *run to how many of the len bytes from there are contiguous on the
+  // host.  Returns NULL if taddr is not plain memory.
+  virtual char* direct_ptr(addr_t taddr, size_t len, size_t* run) { return NULL; }
+
   virtual size_t chunk_align() = 0;
   virtual size_t chunk_max_size() = 0;
 
@@ -43,6 +48,11 @@ public:
   virtual void read(addr_t addr, size_t len, void* bytes);
   virtual void write(addr_t addr, size_t len, const void* bytes);
 
+  // host pointer to a run of target memory; see chunked_memif_t
+  virtual char* direct_ptr(addr_t addr, size_t len, size_t* run) {
+    return cmemif->direct_ptr(addr, len, run);
+  }
+
   // read and write 8-bit words
   virtual target_endian<uint8_t> read_uint8(addr_t addr);
   virtual target_endian<int8_t> read_int8(addr_t addr);
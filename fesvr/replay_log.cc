@@ -0,0 +1,102 @@
+// See LICENSE for license details.
+
+#include "replay_log.h"
+#include <chrono>
+#include <cinttypes>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+replay_log_t* replay_log = nullptr;
+
+static const char MAGIC[8] = {'S', 'P', 'K', 'R', 'P', 'L', '0', '1'};
+
+// A source that waits this long for its turn will never get it.
+static const auto STALL_TIMEOUT = std::chrono::seconds(30);
+
+static const char* const event_names[] = {
+  "atomic",
+  "entropy",
+  "input",
+  "mtime",
+};
+
+replay_log_t::replay_log_t(const char* path, bool replaying)
+  : file_replaying(replaying), have_next(false), events(0)
+{
+  file = fopen(path, replaying ? "rb" : "wb");
+  if (!file)
+    throw std::runtime_error(std::string("could not open ") + path);
+
+  if (replaying) {
+    char magic[sizeof(MAGIC)];
+    if (fread(magic, 1, sizeof(magic), file) != sizeof(magic) ||
+        memcmp(magic, MAGIC, sizeof(MAGIC)) != 0) {
+      fclose(file);
+      throw std::runtime_error(std::string(path) + " is not a replay log");
+    }
+    have_next = read_next();
+  } else {
+    fwrite(MAGIC, 1, sizeof(MAGIC), file);
+  }
+}
+
+replay_log_t::~replay_log_t()
+{
+  fclose(file);
+}
+
+bool replay_log_t::read_next()
+{
+  return fread(&next, sizeof(next), 1, file) == 1;
+}
+
+void replay_log_t::diverged(uint32_t source, replay_event_t type, const char* why)
+{
+  if (source == REPLAY_HOST)
+    fprintf(stderr, "replay diverged at event %" PRIu64 ": host %s event %s\n",
+            events, event_names[type], why);
+  else
+    fprintf(stderr, "replay diverged at event %" PRIu64 ": hart %u %s event %s\n",
+            events, source, event_names[type], why);
+  abort();
+}
+
+uint64_t replay_log_t::begin_turn(uint32_t source, replay_event_t type, uint64_t value)
+{
+  // The lock is held until end_turn.
+  std::unique_lock<std::mutex> turn(lock);
+  if (!file_replaying) {
+    turn.release();
+    next = {source, uint32_t(type), value};
+    return value;
+  }
+
+  auto my_turn = [&]{ return !have_next || next.source == source; };
+  while (!turn_done.wait_for(turn, STALL_TIMEOUT, my_turn)) {
+    char why[64];
+    snprintf(why, sizeof(why), "stalled waiting for source %u", next.source);
+    diverged(source, type, why);
+  }
+  if (!have_next)
+    diverged(source, type, "is past the end of the log");
+  if (next.type != uint32_t(type))
+    diverged(source, type, "does not match the log");
+  turn.release();
+  return next.value;
+}
+
+void replay_log_t::end_turn()
+{
+  if (file_replaying) {
+    have_next = read_next();
+  } else if (fwrite(&next, sizeof(next), 1, file) != 1) {
+    perror("replay log");
+    exit(1);
+  }
+  events++;
+  lock.unlock();
+  if (file_replaying)
+    turn_done.notify_all();
+}
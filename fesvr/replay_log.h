@@ -0,0 +1,100 @@
+// See LICENSE for license details.
+
+#ifndef _REPLAY_LOG_H
+#define _REPLAY_LOG_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+
+// The events that can make two runs of the same program differ: the order
+// in which harts running in parallel do their atomic memory operations,
+// and the inputs the simulator takes from the host.
+enum replay_event_t
+{
+  REPLAY_ATOMIC,   // an AMO, LR or SC to RAM, ordered among all harts
+  REPLAY_ENTROPY,  // a read of the seed CSR
+  REPLAY_INPUT,    // a character read from the terminal, or -1
+  REPLAY_MTIME,    // mtime read from the host clock
+};
+
+// Events from the host thread rather than from a hart.
+static const uint32_t REPLAY_HOST = UINT32_MAX;
+
+// Records these events to a file in the order they happen, or replays
+// them: each source then waits until the log says it is its turn and gets
+// the recorded value.  Harts still run in parallel between events, so a
+// replay reproduces the run exactly as long as the harts only communicate
+// through atomics, as data-race-free programs do.
+class replay_log_t
+{
+ public:
+  replay_log_t(const char* path, bool replaying);
+  ~replay_log_t();
+
+  bool replaying() const { return file_replaying; }
+
+  // Takes the turn of source for an event of the given type, and returns
+  // the value to use: value when recording, the recorded one when
+  // replaying.  end_turn must follow.
+  uint64_t begin_turn(uint32_t source, replay_event_t type, uint64_t value);
+  void end_turn();
+
+ private:
+  struct record_t {
+    uint32_t source;
+    uint32_t type;
+    uint64_t value;
+  };
+
+  bool read_next();
+  [[noreturn]] void diverged(uint32_t source, replay_event_t type, const char* why);
+
+  FILE* file;
+  bool file_replaying;
+  std::mutex lock;
+  std::condition_variable turn_done;
+  record_t next;
+  bool have_next;
+  uint64_t events;
+};
+
+// The log of this run, if --record or --replay was given.
+extern replay_log_t* replay_log;
+
+// Returns value, or its recorded counterpart when replaying.
+inline uint64_t replay_value(uint32_t source, replay_event_t type, uint64_t value)
+{
+  if (__builtin_expect(replay_log == nullptr, 1))
+    return value;
+  value = replay_log->begin_turn(source, type, value);
+  replay_log->end_turn();
+  return value;
+}
+
+// Holds the turn of source for an event while the scope runs, so that the
+// event happens in the recorded order among those of all sources.
+class replay_turn_t
+{
+ public:
+  replay_turn_t(uint32_t source, replay_event_t type, bool enabled = true)
+    : held(enabled && replay_log != nullptr)
+  {
+    if (__builtin_expect(held, 0))
+      replay_log->begin_turn(source, type, 0);
+  }
+  ~replay_turn_t()
+  {
+    if (__builtin_expect(held, 0))
+      replay_log->end_turn();
+  }
+
+  replay_turn_t(const replay_turn_t&) = delete;
+  replay_turn_t& operator=(const replay_turn_t&) = delete;
+
+ private:
+  bool held;
+};
+
+#endif
@@ -10,13 +10,14 @@
 #include <string>
 #include <cstring>
 #include <cinttypes>
+#include <algorithm>
 using namespace std::placeholders;
 
 rfb_t::rfb_t(int display)
   : sockfd(-1), afd(-1),
     memif(0), addr(0), width(0), height(0), bpp(0), display(display),
-    thread(pthread_self()), fb1(0), fb2(0), read_pos(0),
-    lock(PTHREAD_MUTEX_INITIALIZER)
+    thread(pthread_self()), fb(0), read_pos(0),
+    lock(PTHREAD_MUTEX_INITIALIZER), full_update(false), hextile(false)
 {
   register_command(0, std::bind(&rfb_t::handle_configure, this, _1), "configure");
   register_command(1, std::bind(&rfb_t::handle_set_address, this, _1), "set_address");
@@ -69,6 +70,8 @@ void rfb_t::thread_main()
   serverinit += name;
   write(serverinit);
 
+  hextile = false;
+  full_update = true;
   pthread_mutex_unlock(&lock);
 
   while (memif == NULL)
@@ -84,7 +87,10 @@ void rfb_t::thread_main()
     {
       case 0: set_pixel_format(s); break;
       case 2: set_encodings(s); break;
-      case 3: break;
+      case 3:
+        if (s[1] == 0) // not incremental
+          full_update = true;
+        break;
     }
   }
 
@@ -103,14 +109,25 @@ rfb_t::~rfb_t()
   memif = 0;
   if (!pthread_equal(pthread_self(), thread))
     pthread_join(thread, 0);
-  delete [] fb1;
-  delete [] fb2;
+  delete [] fb;
 }
 
 void rfb_t::set_encodings(const std::string& s)
 {
   uint16_t n = htons(*(uint16_t*)&s[2]);
-  for (size_t b = s.length(); b < 4U+4U*n; b += read().length());
+  std::string msg = s;
+  while (msg.length() < 4U+4U*n) {
+    std::string more = read();
+    if (more.empty())
+      return;
+    msg += more;
+  }
+
+  bool hex = false;
+  for (size_t i = 0; i < n; i++)
+    if (int32_t(ntohl(*(uint32_t*)&msg[4 + 4*i])) == 5)
+      hex = true;
+  hextile = hex;
 }
 
 void rfb_t::set_pixel_format(const std::string& s)
@@ -119,22 +136,95 @@ void rfb_t::set_pixel_format(const std::string& s)
     throw std::runtime_error("bad pixel format");
 }
 
-void rfb_t::fb_update(const std::string& s)
+void rfb_t::mark_dirty(size_t pos, size_t len)
+{
+  size_t pixel = bpp/8, stride = size_t(width) * pixel;
+  for (size_t y = pos / stride; y <= (pos + len - 1) / stride; y++) {
+    size_t begin = std::max(pos, y * stride) - y * stride;
+    size_t end = std::min(pos + len, (y + 1) * stride) - y * stride;
+    uint16_t x0 = begin / pixel, x1 = (end + pixel - 1) / pixel;
+    auto& d = dirty[y];
+    if (d.first >= d.second)
+      d = {x0, x1};
+    else
+      d = {std::min(d.first, x0), std::max(d.second, x1)};
+  }
+}
+
+// Each tile is either a single colour, sent as that colour, or sent raw.
+void rfb_t::append_hextile(uint16_t x, uint16_t y, uint16_t w, uint16_t h)
+{
+  size_t pixel = bpp/8, stride = size_t(width) * pixel;
+  for (uint16_t ty = y; ty < y + h; ty += HEXTILE_SIZE) {
+    uint16_t th = std::min<int>(HEXTILE_SIZE, y + h - ty);
+    for (uint16_t tx = x; tx < x + w; tx += HEXTILE_SIZE) {
+      uint16_t tw = std::min<int>(HEXTILE_SIZE, x + w - tx);
+      const char* first = fb + ty * stride + tx * pixel;
+
+      bool solid = true;
+      for (uint16_t r = 0; r < th && solid; r++) {
+        const char* row = first + r * stride;
+        for (uint16_t c = 0; c < tw && solid; c++)
+          solid = memcmp(row + c * pixel, first, pixel) == 0;
+      }
+
+      if (solid) {
+        update += char(2); // background specified
+        update.append(first, pixel);
+      } else {
+        update += char(1); // raw
+        for (uint16_t r = 0; r < th; r++)
+          update.append(first + r * stride, tw * pixel);
+      }
+    }
+  }
+}
+
+void rfb_t::fb_update()
 {
-  std::string u;
-  u += str(uint8_t(0));
-  u += str(uint8_t(0));
-  u += str(uint16_t(htons(1)));
-  u += str(uint16_t(htons(0)));
-  u += str(uint16_t(htons(0)));
-  u += str(uint16_t(htons(width)));
-  u += str(uint16_t(htons(height)));
-  u += str(uint32_t(htonl(0)));
-  u += std::string((char*)fb1, fb_bytes());
+  size_t pixel = bpp/8, stride = size_t(width) * pixel;
+  uint16_t rects = 0;
+  update.clear();
+  update += str(uint8_t(0));
+  update += str(uint8_t(0));
+  update += str(uint16_t(0)); // number of rectangles, filled in below
+
+  // A rectangle per run of changed rows, as wide as their changes.
+  for (uint16_t y = 0; y < height; ) {
+    if (dirty[y].first >= dirty[y].second) {
+      y++;
+      continue;
+    }
+    uint16_t y0 = y, x0 = dirty[y].first, x1 = dirty[y].second;
+    for (; y < height && dirty[y].first < dirty[y].second; y++) {
+      x0 = std::min(x0, dirty[y].first);
+      x1 = std::max(x1, dirty[y].second);
+      dirty[y] = {0, 0};
+    }
+
+    update += str(uint16_t(htons(x0)));
+    update += str(uint16_t(htons(y0)));
+    update += str(uint16_t(htons(x1 - x0)));
+    update += str(uint16_t(htons(y - y0)));
+    if (hextile) {
+      update += str(uint32_t(htonl(5)));
+      append_hextile(x0, y0, x1 - x0, y - y0);
+    } else {
+      update += str(uint32_t(htonl(0)));
+      for (uint16_t r = y0; r < y; r++)
+        update.append(fb + r * stride + x0 * pixel, (x1 - x0) * pixel);
+    }
+    rects++;
+  }
+
+  if (rects == 0)
+    return;
+  uint16_t n = htons(rects);
+  memcpy(&update[2], &n, sizeof(n));
 
   try
   {
-    write(u);
+    write(update);
   }
   catch (std::runtime_error& e)
   {
@@ -146,14 +236,21 @@ void rfb_t::tick()
   if (fb_bytes() == 0 || memif == NULL)
     return;
 
-  memif->read(addr + read_pos, FB_ALIGN, const_cast<char*>(fb2 + read_pos));
+  char chunk[FB_ALIGN];
+  memif->read(addr + read_pos, FB_ALIGN, chunk);
+  if (memcmp(chunk, fb + read_pos, FB_ALIGN) != 0) {
+    memcpy(fb + read_pos, chunk, FB_ALIGN);
+    mark_dirty(read_pos, FB_ALIGN);
+  }
   read_pos = (read_pos + FB_ALIGN) % fb_bytes();
   if (read_pos == 0)
   {
-    std::swap(fb1, fb2);
     if (pthread_mutex_trylock(&lock) == 0)
     {
-      fb_update("");
+      if (full_update.exchange(false))
+        mark_dirty(0, fb_bytes());
+      if (afd >= 0)
+        fb_update();
       pthread_mutex_unlock(&lock);
     }
   }
@@ -183,8 +280,12 @@ std::string rfb_t::pixel_format()
 
 void rfb_t::write(const std::string& s)
 {
-  if ((size_t)::write(afd, s.c_str(), s.length()) != s.length())
-    throw std::runtime_error("could not write");
+  for (size_t done = 0; done < s.length(); ) {
+    ssize_t n = ::write(afd, s.data() + done, s.length() - done);
+    if (n <= 0)
+      throw std::runtime_error("could not write");
+    done += n;
+  }
 }
 
 std::string rfb_t::read()
@@ -200,7 +301,7 @@ std::string rfb_t::read()
 
 void rfb_t::handle_configure(command_t cmd)
 {
-  if (fb1)
+  if (fb)
     throw std::runtime_error("you must only set the rfb configuration once");
 
   width = cmd.payload();
@@ -213,8 +314,8 @@ void rfb_t::handle_configure(command_t cmd)
   if (fb_bytes() % FB_ALIGN != 0)
     throw std::runtime_error("rfb size must be a multiple of " + std::to_string(FB_ALIGN));
 
-  fb1 = new char[fb_bytes()];
-  fb2 = new char[fb_bytes()];
+  fb = new char[fb_bytes()]();
+  dirty.assign(height, {0, 0});
   if (pthread_create(&thread, 0, rfb_thread_main, this))
     throw std::runtime_error("could not create thread");
   cmd.respond(1);
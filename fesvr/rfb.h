@@ -3,7 +3,10 @@
 
 #include "device.h"
 #include "memif.h"
+#include <atomic>
 #include <pthread.h>
+#include <utility>
+#include <vector>
 
 // remote frame buffer
 class rfb_t : public device_t
@@ -25,7 +28,9 @@ class rfb_t : public device_t
   void thread_main();
   friend void* rfb_thread_main(void*);
   std::string pixel_format();
-  void fb_update(const std::string& s);
+  void mark_dirty(size_t pos, size_t len);
+  void fb_update();
+  void append_hextile(uint16_t x, uint16_t y, uint16_t w, uint16_t h);
   void set_encodings(const std::string& s);
   void set_pixel_format(const std::string& s);
   void write(const std::string& s);
@@ -42,12 +47,21 @@ class rfb_t : public device_t
   uint16_t bpp;
   int display;
   pthread_t thread;
-  volatile char* volatile fb1;
-  volatile char* volatile fb2;
+  // The frame as last read from memory, a chunk per tick, and the
+  // columns [first, second) of each row that changed since the last
+  // update was sent.  Only the changed rectangles are sent.
+  char* fb;
+  std::vector<std::pair<uint16_t, uint16_t>> dirty;
+  std::string update;
   size_t read_pos;
   pthread_mutex_t lock;
+  // Set when a client connects or asks for a whole frame.
+  std::atomic<bool> full_update;
+  // Whether the client accepts the hextile encoding.
+  std::atomic<bool> hextile;
 
   static const int FB_ALIGN = 256;
+  static const int HEXTILE_SIZE = 16;
 };
 
 #endif
@@ -11,6 +11,10 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <termios.h>
+#include <time.h>
+#include <algorithm>
+#include <chrono>
+#include <random>
 #include <sstream>
 #include <iostream>
 using namespace std::placeholders;
@@ -217,8 +221,50 @@ static reg_t sysret_errno(sreg_t ret)
   return ret == -1 ? -errno : ret;
 }
 
+bool syscall_t::direct_iov(reg_t pbuf, reg_t len, std::vector<struct iovec>& iov)
+{
+  for (reg_t pos = 0; pos < len; ) {
+    size_t run;
+    char* host = memif->direct_ptr(pbuf + pos, len - pos, &run);
+    if (!host)
+      return false;
+    iov.push_back({host, run});
+    pos += run;
+  }
+  return true;
+}
+
+// Issues io on at most IOV_MAX buffers at a time, stopping after the first
+// short transfer.  io is passed the number of bytes already transferred.
+template<typename F>
+static ssize_t iov_transfer(const std::vector<struct iovec>& iov, F io)
+{
+  ssize_t total = 0;
+  for (size_t i = 0; i < iov.size(); i += IOV_MAX) {
+    int n = std::min<size_t>(IOV_MAX, iov.size() - i);
+    size_t want = 0;
+    for (int j = 0; j < n; j++)
+      want += iov[i + j].iov_len;
+    ssize_t ret = io(&iov[i], n, total);
+    if (ret < 0)
+      return total ? total : ret;
+    total += ret;
+    if (size_t(ret) < want)
+      break;
+  }
+  return total;
+}
+
 reg_t syscall_t::sys_read(reg_t fd, reg_t pbuf, reg_t len, reg_t a3, reg_t a4, reg_t a5, reg_t a6)
 {
+  std::vector<struct iovec> iov;
+  if (len != 0 && direct_iov(pbuf, len, iov)) {
+    int host_fd = fds.lookup(fd);
+    return sysret_errno(iov_transfer(iov, [&](const struct iovec* v, int n, ssize_t) {
+      return readv(host_fd, v, n);
+    }));
+  }
+
   std::vector<char> buf(len);
   ssize_t ret = read(fds.lookup(fd), buf.data(), len);
   reg_t ret_errno = sysret_errno(ret);
@@ -229,6 +275,14 @@ reg_t syscall_t::sys_read(reg_t fd, reg_t pbuf, reg_t len, reg_t a3, reg_t a4, r
 
 reg_t syscall_t::sys_pread(reg_t fd, reg_t pbuf, reg_t len, reg_t off, reg_t a4, reg_t a5, reg_t a6)
 {
+  std::vector<struct iovec> iov;
+  if (len != 0 && direct_iov(pbuf, len, iov)) {
+    int host_fd = fds.lookup(fd);
+    return sysret_errno(iov_transfer(iov, [&](const struct iovec* v, int n, ssize_t done) {
+      return preadv(host_fd, v, n, off + done);
+    }));
+  }
+
   std::vector<char> buf(len);
   ssize_t ret = pread(fds.lookup(fd), buf.data(), len, off);
   reg_t ret_errno = sysret_errno(ret);
@@ -239,6 +293,14 @@ reg_t syscall_t::sys_pread(reg_t fd, reg_t pbuf, reg_t len, reg_t off, reg_t a4,
 
 reg_t syscall_t::sys_write(reg_t fd, reg_t pbuf, reg_t len, reg_t a3, reg_t a4, reg_t a5, reg_t a6)
 {
+  std::vector<struct iovec> iov;
+  if (len != 0 && direct_iov(pbuf, len, iov)) {
+    int host_fd = fds.lookup(fd);
+    return sysret_errno(iov_transfer(iov, [&](const struct iovec* v, int n, ssize_t) {
+      return writev(host_fd, v, n);
+    }));
+  }
+
   std::vector<char> buf(len);
   memif->read(pbuf, len, buf.data());
   reg_t ret = sysret_errno(write(fds.lookup(fd), buf.data(), len));
@@ -247,6 +309,14 @@ reg_t syscall_t::sys_write(reg_t fd, reg_t pbuf, reg_t len, reg_t a3, reg_t a4,
 
 reg_t syscall_t::sys_pwrite(reg_t fd, reg_t pbuf, reg_t len, reg_t off, reg_t a4, reg_t a5, reg_t a6)
 {
+  std::vector<struct iovec> iov;
+  if (len != 0 && direct_iov(pbuf, len, iov)) {
+    int host_fd = fds.lookup(fd);
+    return sysret_errno(iov_transfer(iov, [&](const struct iovec* v, int n, ssize_t done) {
+      return pwritev(host_fd, v, n, off + done);
+    }));
+  }
+
   std::vector<char> buf(len);
   memif->read(pbuf, len, buf.data());
   reg_t ret = sysret_errno(pwrite(fds.lookup(fd), buf.data(), len, off));
@@ -445,6 +515,129 @@ reg_t syscall_t::sys_chdir(reg_t path, reg_t a1, reg_t a2, reg_t a3, reg_t a4, r
   return sysret_errno(chdir(buf.data()));
 }
 
+reg_t syscall_t::string_size(reg_t p)
+{
+  reg_t size = 0;
+  while (memif->read_uint8(p + size++))
+    ;
+  return size;
+}
+
+void syscall_t::write_time(reg_t p, uint64_t ns, uint64_t unit)
+{
+  target_endian<uint64_t> t[2] = {
+    htif->to_target<uint64_t>(ns / 1000000000),
+    htif->to_target<uint64_t>(ns % 1000000000 / unit)
+  };
+  memif->write(p, sizeof(t), t);
+}
+
+reg_t syscall_t::emulate_iov(reg_t fd, reg_t piov, reg_t iovcnt, bool write)
+{
+  reg_t total = 0;
+  for (reg_t i = 0; i < iovcnt; i++) {
+    reg_t base = htif->from_target(memif->read_uint64(piov + 16 * i));
+    reg_t len = htif->from_target(memif->read_uint64(piov + 16 * i + 8));
+    reg_t ret = write ? sys_write(fd, base, len, 0, 0, 0, 0) : sys_read(fd, base, len, 0, 0, 0, 0);
+    if (sreg_t(ret) < 0)
+      return total ? total : ret;
+    total += ret;
+    if (ret < len)
+      break;
+  }
+  return total;
+}
+
+// The Linux generic numbering, which pk uses too.  pk passes the size of
+// each path after it, which the Linux calls leave out; other calls a
+// static program makes at startup are answered here without touching the
+// host, and signals are never delivered.  Guest structures are those of
+// RV64.
+reg_t syscall_t::emulate(reg_t n, const reg_t* a)
+{
+  auto since_epoch = [](auto clock) {
+    return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+      decltype(clock)::now().time_since_epoch()).count());
+  };
+
+  switch (n) {
+    case 17: case 25: case 46: case 49: case 57: case 62: case 63: case 64:
+    case 67: case 68: case 80:
+      return (this->*table[n])(a[0], a[1], a[2], a[3], a[4], a[5], 0);
+    case 34:  // mkdirat
+    case 35:  // unlinkat
+    case 48:  // faccessat
+    case 56:  // openat
+    case 79:  // newfstatat
+      return (this->*table[n])(a[0], a[1], string_size(a[1]), a[2], a[3], 0, 0);
+    case 291:  // statx
+      return sys_statx(a[0], a[1], string_size(a[1]), a[2], a[3], a[4], 0);
+    case 37:  // linkat
+      return sys_linkat(a[0], a[1], string_size(a[1]), a[2], a[3], string_size(a[3]), a[4]);
+    case 38:  // renameat
+      return sys_renameat(a[0], a[1], string_size(a[1]), a[2], a[3], string_size(a[3]), 0);
+    case 65:  // readv
+    case 66:  // writev
+      return emulate_iov(a[0], a[1], a[2], n == 66);
+    case 93:  // exit
+    case 94:  // exit_group
+      return sys_exit(a[0], 0, 0, 0, 0, 0, 0);
+    case 129:  // kill
+    case 131:  // tgkill
+      return sys_exit(128 + a[n == 129 ? 1 : 2], 0, 0, 0, 0, 0, 0);
+    case 160: {  // uname
+      static const char fields[6][65] = {"Linux", "spike", "6.1.0", "#1", "riscv64", ""};
+      memif->write(a[0], sizeof(fields), fields);
+      return 0;
+    }
+    case 113:  // clock_gettime
+      write_time(a[1], a[0] == CLOCK_REALTIME ? since_epoch(std::chrono::system_clock())
+                                               : since_epoch(std::chrono::steady_clock()), 1);
+      return 0;
+    case 169:  // gettimeofday
+      if (a[0])
+        write_time(a[0], since_epoch(std::chrono::system_clock()), 1000);
+      return 0;
+    case 278: {  // getrandom
+      std::random_device random;
+      std::vector<uint8_t> bytes(a[1]);
+      for (auto& byte : bytes)
+        byte = random();
+      memif->write(a[0], bytes.size(), bytes.data());
+      return a[1];
+    }
+    case 96:   // set_tid_address
+    case 172:  // getpid
+    case 173:  // getppid
+    case 178:  // gettid
+      return getpid();
+    case 174: return getuid();
+    case 175: return geteuid();
+    case 176: return getgid();
+    case 177: return getegid();
+    case 29:   // ioctl: no file is a terminal
+      return -ENOTTY;
+    case 99:   // set_robust_list
+    case 101:  // nanosleep
+    case 124:  // sched_yield
+    case 132:  // sigaltstack
+    case 134:  // rt_sigaction
+    case 135:  // rt_sigprocmask
+    case 226:  // mprotect
+    case 233:  // madvise
+      return 0;
+  }
+
+  static std::vector<bool> warned;
+  if (n >= warned.size())
+    warned.resize(n + 1);
+  if (!warned[n]) {
+    warned[n] = true;
+    std::cerr << "warning: system call " << n << " is not emulated" << std::endl;
+  }
+  return -ENOSYS;
+}
+
 void syscall_t::dispatch(reg_t mm)
 {
   target_endian<reg_t> magicmem[8];
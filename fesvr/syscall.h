@@ -7,6 +7,7 @@
 #include "memif.h"
 #include <vector>
 #include <string>
+#include <sys/uio.h>
 
 class syscall_t;
 typedef reg_t (syscall_t::*syscall_func_t)(reg_t, reg_t, reg_t, reg_t, reg_t, reg_t, reg_t);
@@ -30,6 +31,11 @@ class syscall_t : public device_t
   syscall_t(htif_t*);
 
   void set_chroot(const char* where);
+
+  // Services system call n of a Linux program that runs without pk, as in
+  // qemu-user, given its six argument registers.  Calls that manage the
+  // address space are the caller's.
+  reg_t emulate(reg_t n, const reg_t* a);
   
  private:
   const char* identity() { return "syscall_proxy"; }
@@ -42,6 +48,18 @@ class syscall_t : public device_t
   void handle_syscall(command_t cmd);
   void dispatch(addr_t mm);
 
+  // Describe the target buffer [pbuf, pbuf + len) as host buffers, so that
+  // I/O can go straight to target memory; false if part of it is not
+  // plain memory.
+  bool direct_iov(reg_t pbuf, reg_t len, std::vector<struct iovec>& iov);
+
+  // Size, with the NUL, of the string at p.
+  reg_t string_size(reg_t p);
+  // Writes the target's timespec or timeval for ns nanoseconds, with
+  // the fraction in units of unit nanoseconds.
+  void write_time(reg_t p, uint64_t ns, uint64_t unit);
+  reg_t emulate_iov(reg_t fd, reg_t piov, reg_t iovcnt, bool write);
+
   std::string chroot;
   std::string do_chroot(const char* fn);
   std::string undo_chroot(const char* fn);
@@ -1,4 +1,5 @@
 #include "term.h"
+#include "replay_log.h"
 #include <termios.h>
 #include <unistd.h>
 #include <poll.h>
@@ -39,11 +40,11 @@ int canonical_terminal_t::read()
   pfd.events = POLLIN;
   int ret = poll(&pfd, 1, 0);
   if (ret <= 0 || !(pfd.revents & POLLIN))
-    return -1;
+    return (int)replay_value(REPLAY_HOST, REPLAY_INPUT, -1);
 
   unsigned char ch;
   ret = ::read(0, &ch, 1);
-  return ret <= 0 ? -1 : ch;
+  return (int)replay_value(REPLAY_HOST, REPLAY_INPUT, ret <= 0 ? -1 : ch);
 }
 
 void canonical_terminal_t::write(char ch)
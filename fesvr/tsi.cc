@@ -1,4 +1,5 @@
 #include "tsi.h"
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
 
@@ -58,11 +59,15 @@ void tsi_t::read_chunk(addr_t taddr, size_t nbytes, void* dst)
   push_addr(taddr);
   push_len(len - 1);
 
-  for (size_t i = 0; i < len; i++) {
+  // Take whatever the target has sent each time it yields, rather than a
+  // word per switch.
+  for (size_t i = 0; i < len; ) {
     while (out_data.empty())
       switch_to_target();
-    result[i] = out_data.front();
-    out_data.pop_front();
+    size_t n = std::min(out_data.size(), len - i);
+    std::copy(out_data.begin(), out_data.begin() + n, result + i);
+    out_data.erase(out_data.begin(), out_data.begin() + n);
+    i += n;
   }
 }
 
@@ -90,6 +95,19 @@ uint32_t tsi_t::recv_word(void)
   return word;
 }
 
+void tsi_t::send_words(const uint32_t* words, size_t n)
+{
+  out_data.insert(out_data.end(), words, words + n);
+}
+
+size_t tsi_t::recv_words(uint32_t* words, size_t max)
+{
+  size_t n = std::min(in_data.size(), max);
+  std::copy(in_data.begin(), in_data.begin() + n, words);
+  in_data.erase(in_data.begin(), in_data.begin() + n);
+  return n;
+}
+
 bool tsi_t::data_available(void)
 {
   return !in_data.empty();
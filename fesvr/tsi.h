@@ -24,6 +24,11 @@ class tsi_t : public htif_t
   bool data_available();
   void send_word(uint32_t word);
   uint32_t recv_word();
+  // Bulk versions, for links that move more than a word per handshake:
+  // recv_words takes up to max words and returns how many it took.
+  size_t words_available() { return in_data.size(); }
+  void send_words(const uint32_t* words, size_t n);
+  size_t recv_words(uint32_t* words, size_t max);
   void switch_to_host();
 
   uint32_t in_bits() { return in_data.front(); }
@@ -9,6 +9,10 @@ class abstract_device_t {
  public:
   virtual bool load(reg_t addr, size_t len, uint8_t* bytes) = 0;
   virtual bool store(reg_t addr, size_t len, const uint8_t* bytes) = 0;
+  // Called at the end of each simulation quantum, while no hart is running,
+  // for devices the simulator has been asked to tick.  cycles is how long
+  // each hart ran in the quantum.
+  virtual void tick(reg_t cycles) {}
   virtual ~abstract_device_t() {}
 };
 
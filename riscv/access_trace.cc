@@ -0,0 +1,175 @@
+// See LICENSE for license details.
+
+#include "access_trace.h"
+#include <cstring>
+#include <stdexcept>
+
+static void put_varint(std::string& out, uint64_t value)
+{
+  while (value >= 0x80) {
+    out += char(value | 0x80);
+    value >>= 7;
+  }
+  out += char(value);
+}
+
+static void put_delta(std::string& out, uint64_t value, uint64_t& last)
+{
+  int64_t delta = value - last;
+  last = value;
+  put_varint(out, (uint64_t(delta) << 1) ^ uint64_t(delta >> 63));
+}
+
+static unsigned size_code(uint64_t bytes)
+{
+  for (unsigned code = 0; code < 7; code++)
+    if (bytes == uint64_t(1) << code)
+      return code;
+  return 7;
+}
+
+access_trace_writer_t::access_trace_writer_t(const char* filename, size_t nharts)
+{
+  file = fopen(filename, "wb");
+  if (!file)
+    throw std::runtime_error(std::string("could not open access trace file ") + filename);
+  fwrite(ACCESS_TRACE_MAGIC, 1, ACCESS_TRACE_MAGIC_LEN, file);
+  tracers.reserve(nharts);
+  for (size_t i = 0; i < nharts; i++)
+    tracers.emplace_back(this, i);
+}
+
+access_trace_writer_t::~access_trace_writer_t()
+{
+  fclose(file);
+}
+
+void access_trace_writer_t::write(const std::string& chunk)
+{
+  std::lock_guard<std::mutex> guard(lock);
+  fwrite(chunk.data(), 1, chunk.size(), file);
+}
+
+void access_trace_writer_t::tracer_t::begin_chunk(size_t count)
+{
+  chunk.clear();
+  put_varint(chunk, hart);
+  put_varint(chunk, count);
+}
+
+void access_trace_writer_t::tracer_t::trace_batch(const access_record_t* recs, size_t n)
+{
+  begin_chunk(n);
+  for (size_t i = 0; i < n; i++) {
+    const access_record_t& r = recs[i];
+    unsigned code = size_code(r.bytes);
+    bool same_pc = r.pc == context.pc;
+    chunk += char(r.type | (code << 2) | (same_pc << 5));
+    put_delta(chunk, r.addr, context.addr[r.type]);
+    if (!same_pc)
+      put_delta(chunk, r.pc, context.pc);
+    if (code == 7)
+      put_varint(chunk, r.bytes);
+  }
+  writer->write(chunk);
+}
+
+void access_trace_writer_t::tracer_t::clean_invalidate(uint64_t addr, size_t bytes,
+                                                       bool clean, bool inval)
+{
+  begin_chunk(1);
+  chunk += char(ACCESS_TRACE_CMO | (7 << 2) | (clean << 5) | (inval << 6));
+  put_delta(chunk, addr, context.addr[ACCESS_TRACE_CMO]);
+  put_varint(chunk, bytes);
+  writer->write(chunk);
+}
+
+access_trace_reader_t::access_trace_reader_t(const char* filename)
+  : hart(0), chunk_left(0)
+{
+  file = fopen(filename, "rb");
+  if (!file)
+    throw std::runtime_error(std::string("could not open access trace file ") + filename);
+  char magic[ACCESS_TRACE_MAGIC_LEN];
+  if (fread(magic, 1, sizeof(magic), file) != sizeof(magic) ||
+      memcmp(magic, ACCESS_TRACE_MAGIC, sizeof(magic)) != 0) {
+    fclose(file);
+    throw std::runtime_error(std::string(filename) + " is not an access trace");
+  }
+}
+
+access_trace_reader_t::~access_trace_reader_t()
+{
+  fclose(file);
+}
+
+bool access_trace_reader_t::read_varint(uint64_t* value)
+{
+  *value = 0;
+  for (unsigned shift = 0; shift < 64; shift += 7) {
+    int c = getc_unlocked(file);
+    if (c == EOF) {
+      if (shift != 0)
+        throw std::runtime_error("truncated access trace");
+      return false;
+    }
+    *value |= uint64_t(c & 0x7f) << shift;
+    if (!(c & 0x80))
+      return true;
+  }
+  throw std::runtime_error("corrupt access trace");
+}
+
+uint64_t access_trace_reader_t::next_varint()
+{
+  uint64_t value;
+  if (!read_varint(&value))
+    throw std::runtime_error("truncated access trace");
+  return value;
+}
+
+static uint64_t apply_delta(uint64_t zigzag, uint64_t& last)
+{
+  last += (zigzag >> 1) ^ -(zigzag & 1);
+  return last;
+}
+
+size_t access_trace_reader_t::read(access_trace_record_t* recs, size_t n)
+{
+  size_t i = 0;
+  while (i < n) {
+    if (chunk_left == 0) {
+      uint64_t h;
+      if (!read_varint(&h))
+        break;
+      hart = h;
+      chunk_left = next_varint();
+      if (hart >= contexts.size())
+        contexts.resize(hart + 1, access_trace_context_t());
+      continue;
+    }
+
+    int tag = getc_unlocked(file);
+    if (tag == EOF)
+      throw std::runtime_error("truncated access trace");
+    access_trace_context_t& context = contexts[hart];
+    access_trace_record_t& r = recs[i++];
+    r.hart = hart;
+    r.type = tag & 3;
+    unsigned code = (tag >> 2) & 7;
+    r.addr = apply_delta(next_varint(), context.addr[r.type]);
+    if (r.type == ACCESS_TRACE_CMO) {
+      r.pc = 0;
+      r.clean = tag & 0x20;
+      r.inval = tag & 0x40;
+    } else {
+      if (!(tag & 0x20))
+        apply_delta(next_varint(), context.pc);
+      r.pc = context.pc;
+      r.clean = r.inval = false;
+    }
+    r.bytes = code == 7 ? next_varint() : uint64_t(1) << code;
+    chunk_left--;
+  }
+  return i;
+}
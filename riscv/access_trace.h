@@ -0,0 +1,116 @@
+// See LICENSE for license details.
+#ifndef _RISCV_ACCESS_TRACE_H
+#define _RISCV_ACCESS_TRACE_H
+
+#include "memtracer.h"
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// An access trace starts with ACCESS_TRACE_MAGIC and then holds chunks of
+// one hart's traced accesses and cache-block operations, in the order the
+// hart's MMU handed them to its tracers:
+//
+//   varint hart, varint count, then count records of
+//   uint8_t tag:  bits 1:0  access_type, or ACCESS_TRACE_CMO
+//                 bits 4:2  size: 1 << code bytes for codes 0-6; 7 if a
+//                           varint size follows
+//                 bit 5     for accesses, the pc is that of the hart's last
+//                           record and is left out; for CMOs, clean
+//                 bit 6     for CMOs, invalidate
+//   zigzag varint address, less that of the hart's last record of the type
+//   zigzag varint pc, less that of the hart's last record, unless left out
+//   varint size, if the size code is 7
+//
+// Varints are little-endian base 128.  The deltas keep a record to a few
+// bytes, the usual job of a general-purpose compressor.
+// spike-cache-replay simulates cache configurations on it.
+#define ACCESS_TRACE_MAGIC "SPIKEAT1"
+#define ACCESS_TRACE_MAGIC_LEN 8
+
+enum {
+  ACCESS_TRACE_CMO = 3,
+};
+
+struct access_trace_record_t {
+  uint64_t addr;
+  uint64_t pc;
+  uint64_t bytes;
+  uint32_t hart;
+  uint8_t type;   // access_type, or ACCESS_TRACE_CMO
+  bool clean;     // for CMOs
+  bool inval;
+};
+
+// What a hart's records are encoded relative to
+struct access_trace_context_t {
+  uint64_t addr[4];  // last address by type
+  uint64_t pc;
+};
+
+// Writes the accesses traced by the tracers it hands out, one per hart, to
+// a file.  Harts may flush their buffers from several threads at once.
+class access_trace_writer_t
+{
+ public:
+  access_trace_writer_t(const char* filename, size_t nharts);
+  ~access_trace_writer_t();
+
+  memtracer_t* get_tracer(size_t hart) { return &tracers[hart]; }
+
+ private:
+  class tracer_t : public memtracer_t
+  {
+   public:
+    tracer_t(access_trace_writer_t* writer, uint32_t hart)
+      : writer(writer), hart(hart), context() {}
+    bool interested_in_range(uint64_t begin, uint64_t end, access_type type) { return true; }
+    void trace(uint64_t addr, size_t bytes, access_type type)
+    {
+      access_record_t rec = {addr, (uint32_t)bytes, type, context.pc};
+      trace_batch(&rec, 1);
+    }
+    void clean_invalidate(uint64_t addr, size_t bytes, bool clean, bool inval);
+    void trace_batch(const access_record_t* recs, size_t n);
+
+   private:
+    void begin_chunk(size_t count);
+
+    access_trace_writer_t* writer;
+    uint32_t hart;
+    access_trace_context_t context;
+    std::string chunk;
+  };
+
+  void write(const std::string& chunk);
+
+  FILE* file;
+  std::mutex lock;
+  std::vector<tracer_t> tracers;
+};
+
+class access_trace_reader_t
+{
+ public:
+  // Throws std::runtime_error if the file cannot be opened or is not a trace.
+  explicit access_trace_reader_t(const char* filename);
+  ~access_trace_reader_t();
+
+  // Reads up to n records into recs, returning how many it read: fewer
+  // only at the end of the trace.  Throws std::runtime_error if the trace
+  // is truncated.
+  size_t read(access_trace_record_t* recs, size_t n);
+
+ private:
+  bool read_varint(uint64_t* value);
+  uint64_t next_varint();
+
+  FILE* file;
+  uint32_t hart;
+  uint64_t chunk_left;
+  std::vector<access_trace_context_t> contexts;  // per hart
+};
+
+#endif
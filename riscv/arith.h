@@ -145,6 +145,9 @@ static inline uint64_t make_mask64(int pos, int len)
 
 static inline int popcount(uint64_t val)
 {
+#ifdef __GNUC__
+  return __builtin_popcountll(val);
+#else
   val = (val & 0x5555555555555555U) + ((val >>  1) & 0x5555555555555555U);
   val = (val & 0x3333333333333333U) + ((val >>  2) & 0x3333333333333333U);
   val = (val & 0x0f0f0f0f0f0f0f0fU) + ((val >>  4) & 0x0f0f0f0f0f0f0f0fU);
@@ -152,6 +155,7 @@ static inline int popcount(uint64_t val)
   val = (val & 0x0000ffff0000ffffU) + ((val >> 16) & 0x0000ffff0000ffffU);
   val = (val & 0x00000000ffffffffU) + ((val >> 32) & 0x00000000ffffffffU);
   return val;
+#endif
 }
 
 static inline int ctz(uint64_t val)
@@ -159,6 +163,9 @@ static inline int ctz(uint64_t val)
   if (!val)
     return 0;
 
+#ifdef __GNUC__
+  return __builtin_ctzll(val);
+#else
   int res = 0;
 
   if ((val << 32) == 0) res += 32, val >>= 32;
@@ -169,6 +176,7 @@ static inline int ctz(uint64_t val)
   if ((val << 63) == 0) res += 1, val >>= 1;
 
   return res;
+#endif
 }
 
 static inline int clz(uint64_t val)
@@ -0,0 +1,90 @@
+// See LICENSE for license details.
+
+#include "atomic_profile.h"
+#include <algorithm>
+#include <cinttypes>
+#include <map>
+
+void atomic_profile_t::record(event_t event, reg_t paddr, reg_t vaddr, reg_t pc)
+{
+  reg_t line = paddr >> LINE_SHIFT;
+  auto it = lines.find(line);
+  if (it == lines.end()) {
+    it = lines.emplace(line, line_t()).first;
+    it->second.vaddr = vaddr;
+    it->second.pc = pc;
+  }
+  line_t& l = it->second;
+
+  switch (event) {
+    case AMO:
+      l.amos++;
+      break;
+    case LR:
+      l.lrs++;
+      l.retries += line == failed_sc_line;
+      l.spins += line == last_lr_line;
+      last_lr_line = line;
+      failed_sc_line = reg_t(-1);
+      break;
+    case SC:
+    case SC_FAIL:
+      l.scs++;
+      l.sc_failures += event == SC_FAIL;
+      last_lr_line = reg_t(-1);
+      failed_sc_line = event == SC_FAIL ? line : reg_t(-1);
+      break;
+  }
+}
+
+void atomic_profile_t::reset_stats()
+{
+  lines.clear();
+  last_lr_line = reg_t(-1);
+  failed_sc_line = reg_t(-1);
+}
+
+void atomic_profile_t::write_report(FILE* f, const std::vector<const atomic_profile_t*>& harts,
+                                    const std::function<std::string(uint64_t)>& symbolize)
+{
+  struct merged_t {
+    line_t counts;
+    size_t harts = 0;
+  };
+  // The first hart to reach a line names it.
+  std::map<reg_t, merged_t> merged;
+  for (auto hart : harts) {
+    for (auto& [line, l] : hart->lines) {
+      merged_t& m = merged[line];
+      if (m.harts++ == 0) {
+        m.counts.vaddr = l.vaddr;
+        m.counts.pc = l.pc;
+      }
+      m.counts.amos += l.amos;
+      m.counts.lrs += l.lrs;
+      m.counts.scs += l.scs;
+      m.counts.sc_failures += l.sc_failures;
+      m.counts.retries += l.retries;
+      m.counts.spins += l.spins;
+    }
+  }
+
+  std::vector<std::pair<reg_t, merged_t>> order(merged.begin(), merged.end());
+  auto contention = [](const line_t& l) { return l.retries + l.spins + l.sc_failures; };
+  std::stable_sort(order.begin(), order.end(), [&](const std::pair<reg_t, merged_t>& a,
+                                                   const std::pair<reg_t, merged_t>& b) {
+    uint64_t ca = contention(a.second.counts), cb = contention(b.second.counts);
+    if (ca != cb)
+      return ca > cb;
+    return a.second.counts.amos + a.second.counts.lrs > b.second.counts.amos + b.second.counts.lrs;
+  });
+
+  fprintf(f, "line,symbol,pc,pc_symbol,harts,amos,lrs,scs,sc_failures,retries,spins\n");
+  for (auto& [line, m] : order) {
+    const line_t& l = m.counts;
+    fprintf(f, "0x%" PRIx64 ",%s,0x%" PRIx64 ",%s,%zu,%" PRIu64 ",%" PRIu64 ",%" PRIu64
+               ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 "\n",
+            line << LINE_SHIFT, symbolize(l.vaddr).c_str(), l.pc, symbolize(l.pc).c_str(),
+            m.harts, l.amos, l.lrs, l.scs, l.sc_failures, l.retries, l.spins);
+  }
+}
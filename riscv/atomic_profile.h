@@ -0,0 +1,55 @@
+// See LICENSE for license details.
+#ifndef _RISCV_ATOMIC_PROFILE_H
+#define _RISCV_ATOMIC_PROFILE_H
+
+#include "decode.h"
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Counts one hart's AMOs, LRs and SCs per physical cache line, to find the
+// contended locks and other synchronization of a multithreaded program.
+// Besides the successes and failures of SCs it counts
+//
+//   retries  LRs to the line of the hart's last SC, which failed
+//   spins    LRs to the line of the hart's last LR with no SC in between,
+//            as a loop of LR and a branch that waits for a value does
+//
+// Each hart counts on its own, so --parallel harts need no locks, and
+// write_report merges the harts, saying how many touched each line.
+class atomic_profile_t
+{
+ public:
+  enum event_t { AMO, LR, SC, SC_FAIL };
+  static const unsigned LINE_SHIFT = 6;
+
+  void record(event_t event, reg_t paddr, reg_t vaddr, reg_t pc);
+  void reset_stats();
+
+  // Writes a line per cache line, the most retried, spun on and failed
+  // first, of line,symbol,pc,pc_symbol,harts,amos,lrs,scs,sc_failures,
+  // retries,spins as CSV.  symbol names the first virtual address the
+  // line was reached at, and pc the first instruction to reach it.
+  static void write_report(FILE* f, const std::vector<const atomic_profile_t*>& harts,
+                           const std::function<std::string(uint64_t)>& symbolize);
+
+ private:
+  struct line_t {
+    reg_t vaddr = 0;
+    reg_t pc = 0;
+    uint64_t amos = 0;
+    uint64_t lrs = 0;
+    uint64_t scs = 0;
+    uint64_t sc_failures = 0;
+    uint64_t retries = 0;
+    uint64_t spins = 0;
+  };
+
+  std::unordered_map<reg_t, line_t> lines;
+  reg_t last_lr_line = reg_t(-1);  // with no SC since
+  reg_t failed_sc_line = reg_t(-1);  // of the last SC, if it failed
+};
+
+#endif
@@ -0,0 +1,59 @@
+// See LICENSE for license details.
+
+#include "bbv.h"
+#include <algorithm>
+#include <cinttypes>
+#include <stdexcept>
+
+bbv_profiler_t::bbv_profiler_t(const char* filename, uint64_t interval)
+  : interval(interval), interval_insns(0),
+    block_pc(0), next_pc(0), block_insns(0)
+{
+  file = fopen(filename, "w");
+  if (!file)
+    throw std::runtime_error(std::string("could not open BBV file ") + filename);
+}
+
+bbv_profiler_t::~bbv_profiler_t()
+{
+  if (block_insns != 0)
+    end_block();
+  if (interval_insns != 0)
+    dump_interval();
+  fclose(file);
+}
+
+void bbv_profiler_t::end_block()
+{
+  auto it = block_ids.find(block_pc);
+  if (it == block_ids.end()) {
+    it = block_ids.emplace(block_pc, block_ids.size() + 1).first;
+    counts.push_back(0);
+  }
+
+  uint32_t id = it->second;
+  if (counts[id - 1] == 0)
+    touched.push_back(id);
+  counts[id - 1] += block_insns;
+
+  interval_insns += block_insns;
+  block_insns = 0;
+
+  if (interval_insns >= interval)
+    dump_interval();
+}
+
+void bbv_profiler_t::dump_interval()
+{
+  std::sort(touched.begin(), touched.end());
+
+  fputc('T', file);
+  for (auto id : touched) {
+    fprintf(file, ":%" PRIu32 ":%" PRIu64 " ", id, counts[id - 1]);
+    counts[id - 1] = 0;
+  }
+  fputc('\n', file);
+
+  touched.clear();
+  interval_insns = 0;
+}
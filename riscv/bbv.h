@@ -0,0 +1,51 @@
+// See LICENSE for license details.
+#ifndef _RISCV_BBV_H
+#define _RISCV_BBV_H
+
+#include "decode.h"
+#include <cstdio>
+#include <unordered_map>
+#include <vector>
+
+// Collects SimPoint basic block vectors for one hart.  A basic block is the
+// run of instructions between two control transfers and is identified by the
+// PC of its first instruction.  Every interval instructions the execution
+// count of each block, weighted by its length, is written as one
+// "T:<id>:<count> ..." line of a SimPoint .bb file.
+class bbv_profiler_t
+{
+public:
+  bbv_profiler_t(const char* filename, uint64_t interval);
+  ~bbv_profiler_t();
+
+  // Called for every retired instruction; npc is the next PC it produced.
+  void retire(reg_t pc, reg_t npc, reg_t len)
+  {
+    if (block_insns != 0 && pc != next_pc)
+      end_block();  // a trap redirected control flow
+    if (block_insns++ == 0)
+      block_pc = pc;
+    next_pc = npc;
+    if (npc != pc + len)
+      end_block();
+  }
+
+private:
+  void end_block();
+  void dump_interval();
+
+  FILE* file;
+  uint64_t interval;
+  uint64_t interval_insns;
+
+  reg_t block_pc;
+  reg_t next_pc;
+  uint64_t block_insns;
+
+  // Block IDs are 1-based and assigned in order of first execution.
+  std::unordered_map<reg_t, uint32_t> block_ids;
+  std::vector<uint64_t> counts;        // indexed by block ID - 1
+  std::vector<uint32_t> touched;       // IDs with a nonzero count
+};
+
+#endif
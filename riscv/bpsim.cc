@@ -0,0 +1,221 @@
+// See LICENSE for license details.
+
+#include "bpsim.h"
+#include <algorithm>
+#include <cinttypes>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+
+static void help()
+{
+  std::cerr << "Branch predictor configurations must be one of" << std::endl;
+  std::cerr << "  bimodal[:n]      2^n two-bit counters (default 12)" << std::endl;
+  std::cerr << "  gshare[:n[:h]]   2^n two-bit counters hashed with h bits of" << std::endl;
+  std::cerr << "                   global history (default 14, with h = n)" << std::endl;
+  std::cerr << "  tage[:n]         four tagged tables of 2^n entries over a" << std::endl;
+  std::cerr << "                   base of 2^(n+2) counters (default 10)" << std::endl;
+  std::cerr << "where n is at most 24 (20 for tage) and h at most 64." << std::endl;
+  exit(1);
+}
+
+static unsigned parse_field(const std::string& s, unsigned max)
+{
+  char* end;
+  unsigned long v = strtoul(s.c_str(), &end, 10);
+  if (s.empty() || *end || v == 0 || v > max)
+    help();
+  return v;
+}
+
+bp_sim_t* bp_sim_t::construct(const char* config, const char* name)
+{
+  std::vector<std::string> fields;
+  for (const char* p = config; ; p++) {
+    const char* colon = strchr(p, ':');
+    fields.emplace_back(p, colon ? colon : p + strlen(p));
+    if (!colon)
+      break;
+    p = colon;
+  }
+
+  const std::string& model = fields[0];
+  if (model == "bimodal" && fields.size() <= 2)
+    return new bimodal_bp_sim_t(fields.size() > 1 ? parse_field(fields[1], 24) : 12, name);
+  if (model == "gshare" && fields.size() <= 3) {
+    unsigned n = fields.size() > 1 ? parse_field(fields[1], 24) : 14;
+    unsigned h = fields.size() > 2 ? parse_field(fields[2], 64) : n;
+    return new gshare_bp_sim_t(n, h, name);
+  }
+  if (model == "tage" && fields.size() <= 2)
+    return new tage_bp_sim_t(fields.size() > 1 ? parse_field(fields[1], 20) : 10, name);
+  help();
+  return nullptr;
+}
+
+void bp_sim_t::print_stats(uint64_t insns)
+{
+  if (branches == 0)
+    return;
+
+  std::cout << std::setprecision(3) << std::fixed;
+  std::cout << name << " ";
+  std::cout << "Branches:              " << branches << std::endl;
+  std::cout << name << " ";
+  std::cout << "Mispredicts:           " << mispredicts << std::endl;
+  std::cout << name << " ";
+  std::cout << "Accuracy:              " << 100.0 * (branches - mispredicts) / branches << '%' << std::endl;
+  if (insns != 0) {
+    std::cout << name << " ";
+    std::cout << "MPKI:                  " << 1000.0 * mispredicts / insns << std::endl;
+  }
+}
+
+void bp_sim_t::write_report(FILE* f, uint32_t hart, uint64_t insns,
+                            const std::function<std::string(uint64_t)>& symbolize)
+{
+  std::vector<std::pair<uint64_t, pc_stats_t>> pcs(pc_stats.begin(), pc_stats.end());
+  std::sort(pcs.begin(), pcs.end(), [](const std::pair<uint64_t, pc_stats_t>& a,
+                                       const std::pair<uint64_t, pc_stats_t>& b) {
+    return a.second.mispredicts != b.second.mispredicts ? a.second.mispredicts > b.second.mispredicts
+                                                        : a.first < b.first;
+  });
+  for (auto& it : pcs) {
+    fprintf(f, "%" PRIu32 ",0x%" PRIx64 ",%s,%" PRIu64 ",%" PRIu64 ",%.4f\n",
+            hart, it.first, symbolize(it.first).c_str(), it.second.branches,
+            it.second.mispredicts, insns ? 1000.0 * it.second.mispredicts / insns : 0.0);
+  }
+}
+
+void bp_sim_t::reset_stats()
+{
+  branches = 0;
+  mispredicts = 0;
+  pc_stats.clear();
+}
+
+static void train(uint8_t& counter, bool taken)
+{
+  if (taken)
+    counter += counter < 3;
+  else
+    counter -= counter > 0;
+}
+
+bimodal_bp_sim_t::bimodal_bp_sim_t(unsigned n, const std::string& name)
+  : bp_sim_t(name), counters(size_t(1) << n, 1)
+{
+}
+
+void bimodal_bp_sim_t::update(uint64_t pc, bool taken)
+{
+  train(counters[index(pc)], taken);
+}
+
+gshare_bp_sim_t::gshare_bp_sim_t(unsigned n, unsigned h, const std::string& name)
+  : bp_sim_t(name), counters(size_t(1) << n, 1), history(0),
+    history_mask(h == 64 ? ~uint64_t(0) : (uint64_t(1) << h) - 1)
+{
+}
+
+void gshare_bp_sim_t::update(uint64_t pc, bool taken)
+{
+  train(counters[index(pc)], taken);
+  history = ((history << 1) | taken) & history_mask;
+}
+
+static const unsigned tage_history_lengths[] = {5, 15, 44, 130};
+
+tage_bp_sim_t::tage_bp_sim_t(unsigned n, const std::string& name)
+  : bp_sim_t(name), log_entries(n), base(size_t(1) << (n + 2), 1), head(0), branch_count(0)
+{
+  for (int i = 0; i < TABLES; i++) {
+    tables[i].assign(size_t(1) << n, entry_t{0, 0, 0});
+    unsigned len = tage_history_lengths[i];
+    index_fold[i] = {0, len, n};
+    tag_fold[i][0] = {0, len, TAG_BITS};
+    tag_fold[i][1] = {0, len, TAG_BITS - 1};
+  }
+  memset(history, 0, sizeof(history));
+}
+
+bool tage_bp_sim_t::predict(uint64_t pc)
+{
+  uint64_t mask = (uint64_t(1) << log_entries) - 1;
+  provider = -1;
+  int alt = -1;
+  for (int i = TABLES; i-- > 0; ) {
+    indices[i] = ((pc >> 1) ^ (pc >> (log_entries + 1)) ^ index_fold[i].value) & mask;
+    tags[i] = ((pc >> 1) ^ tag_fold[i][0].value ^ (tag_fold[i][1].value << 1)) & ((1u << TAG_BITS) - 1);
+    if (tables[i][indices[i]].tag == tags[i]) {
+      if (provider < 0)
+        provider = i;
+      else if (alt < 0)
+        alt = i;
+    }
+  }
+
+  bool base_pred = base[(pc >> 1) & (base.size() - 1)] >= 2;
+  alt_pred = alt >= 0 ? tables[alt][indices[alt]].ctr >= 0 : base_pred;
+  provider_pred = provider >= 0 ? tables[provider][indices[provider]].ctr >= 0 : base_pred;
+  return provider_pred;
+}
+
+void tage_bp_sim_t::update(uint64_t pc, bool taken)
+{
+  if (provider >= 0) {
+    entry_t& e = tables[provider][indices[provider]];
+    // An entry is useful while it predicts better than what it overrides.
+    if (provider_pred != alt_pred) {
+      if (provider_pred == taken)
+        e.u += e.u < 3;
+      else
+        e.u -= e.u > 0;
+    }
+    if (taken)
+      e.ctr += e.ctr < 3;
+    else
+      e.ctr -= e.ctr > -4;
+  } else {
+    train(base[(pc >> 1) & (base.size() - 1)], taken);
+  }
+
+  if (provider_pred != taken && provider < TABLES - 1) {
+    bool allocated = false;
+    for (int i = provider + 1; i < TABLES && !allocated; i++) {
+      entry_t& e = tables[i][indices[i]];
+      if (e.u == 0) {
+        e = entry_t{tags[i], int8_t(taken ? 0 : -1), 0};
+        allocated = true;
+      }
+    }
+    if (!allocated) {
+      for (int i = provider + 1; i < TABLES; i++) {
+        uint8_t& u = tables[i][indices[i]].u;
+        u -= u > 0;
+      }
+    }
+  }
+
+  if (++branch_count % U_RESET_PERIOD == 0) {
+    for (auto& table : tables)
+      for (auto& e : table)
+        e.u >>= 1;
+  }
+
+  push_history(taken);
+}
+
+void tage_bp_sim_t::push_history(bool taken)
+{
+  head = (head + HISTORY_SIZE - 1) % HISTORY_SIZE;
+  history[head] = taken;
+  for (int i = 0; i < TABLES; i++) {
+    // The outcome that has just left this table's history
+    bool out = history_bit(tage_history_lengths[i]);
+    index_fold[i].update(taken, out);
+    tag_fold[i][0].update(taken, out);
+    tag_fold[i][1].update(taken, out);
+  }
+}
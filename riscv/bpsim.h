@@ -0,0 +1,165 @@
+// See LICENSE for license details.
+
+#ifndef _RISCV_BP_SIM_H
+#define _RISCV_BP_SIM_H
+
+#include "branchtracer.h"
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// A branch predictor model, fed one hart's conditional branches.  Each
+// branch is predicted and then trained with its outcome before the next is
+// looked at, so the model behaves as a predictor that is updated at
+// resolution with nothing in flight.
+class bp_sim_t : public branchtracer_t
+{
+ public:
+  virtual ~bp_sim_t() {}
+
+  void trace(uint64_t pc, bool taken) override
+  {
+    bool mispredicted = predict(pc) != taken;
+    update(pc, taken);
+    pc_stats_t& s = pc_stats[pc];
+    s.branches++;
+    s.mispredicts += mispredicted;
+    branches++;
+    mispredicts += mispredicted;
+  }
+
+  // MPKI is per thousand of the insns the hart retired while the branches
+  // were traced.
+  void print_stats(uint64_t insns);
+  // Appends a "hart,pc,symbol,branches,mispredicts,mpki" line per branch,
+  // worst first, naming pcs with symbolize.
+  void write_report(FILE* f, uint32_t hart, uint64_t insns,
+                    const std::function<std::string(uint64_t)>& symbolize);
+  // Zeroes the statistics, keeping what the predictor has learned.
+  void reset_stats();
+
+  // config is bimodal[:<n>], gshare[:<n>[:<h>]] or tage[:<n>].
+  static bp_sim_t* construct(const char* config, const char* name);
+
+ protected:
+  explicit bp_sim_t(const std::string& name) : name(name), branches(0), mispredicts(0) {}
+
+  // update() follows the predict() for the same branch.
+  virtual bool predict(uint64_t pc) = 0;
+  virtual void update(uint64_t pc, bool taken) = 0;
+
+  std::string name;
+
+ private:
+  struct pc_stats_t {
+    uint64_t branches;
+    uint64_t mispredicts;
+  };
+
+  uint64_t branches;
+  uint64_t mispredicts;
+  std::unordered_map<uint64_t, pc_stats_t> pc_stats;
+};
+
+// 2^n two-bit saturating counters indexed by the pc.
+class bimodal_bp_sim_t : public bp_sim_t
+{
+ public:
+  bimodal_bp_sim_t(unsigned n, const std::string& name);
+
+ protected:
+  bool predict(uint64_t pc) override { return counters[index(pc)] >= 2; }
+  void update(uint64_t pc, bool taken) override;
+
+ private:
+  size_t index(uint64_t pc) { return (pc >> 1) & (counters.size() - 1); }
+
+  std::vector<uint8_t> counters;
+};
+
+// 2^n two-bit counters indexed by the pc XORed with the outcomes of the
+// last h branches.
+class gshare_bp_sim_t : public bp_sim_t
+{
+ public:
+  gshare_bp_sim_t(unsigned n, unsigned h, const std::string& name);
+
+ protected:
+  bool predict(uint64_t pc) override { return counters[index(pc)] >= 2; }
+  void update(uint64_t pc, bool taken) override;
+
+ private:
+  size_t index(uint64_t pc) { return ((pc >> 1) ^ history) & (counters.size() - 1); }
+
+  std::vector<uint8_t> counters;
+  uint64_t history;
+  uint64_t history_mask;
+};
+
+// A TAGE predictor after Seznec and Michaud: a bimodal base of 2^(n+2)
+// counters and four tagged tables of 2^n entries, indexed and tagged by the
+// pc hashed with 5, 15, 44 and 130 bits of global history.  The longest
+// history that hits provides the prediction.  A misprediction allocates an
+// entry in one longer table whose entry is not useful, or else ages the
+// candidates.  Left out of this reference model are the alternate
+// prediction for newly allocated entries and the loop and statistical
+// correctors of later versions.
+class tage_bp_sim_t : public bp_sim_t
+{
+ public:
+  tage_bp_sim_t(unsigned n, const std::string& name);
+
+ protected:
+  bool predict(uint64_t pc) override;
+  void update(uint64_t pc, bool taken) override;
+
+ private:
+  static const int TABLES = 4;
+  static const unsigned TAG_BITS = 9;
+  static const unsigned HISTORY_SIZE = 256;  // more than the longest history
+  // Usefulness decays every this many branches.
+  static const uint64_t U_RESET_PERIOD = 1 << 18;
+
+  struct entry_t {
+    uint16_t tag;
+    int8_t ctr;  // -4..3, taken if nonnegative
+    uint8_t u;   // 0..3
+  };
+
+  // A history of len bits folded by XOR into width bits, kept up to date a
+  // bit at a time.
+  struct folded_history_t {
+    uint32_t value;
+    unsigned len, width;
+    void update(bool in, bool out)
+    {
+      value = (value << 1) | in;
+      value ^= (uint32_t)out << (len % width);
+      value ^= value >> width;
+      value &= (1u << width) - 1;
+    }
+  };
+
+  bool history_bit(unsigned i) const { return history[(head + i) % HISTORY_SIZE]; }
+  void push_history(bool taken);
+
+  unsigned log_entries;
+  std::vector<uint8_t> base;  // two-bit counters
+  std::vector<entry_t> tables[TABLES];
+  bool history[HISTORY_SIZE];
+  unsigned head;  // where the latest outcome is
+  folded_history_t index_fold[TABLES];
+  folded_history_t tag_fold[TABLES][2];
+  uint64_t branch_count;
+
+  // Left by predict() for update()
+  size_t indices[TABLES];
+  uint16_t tags[TABLES];
+  int provider;  // -1 for the base
+  bool provider_pred;
+  bool alt_pred;
+};
+
+#endif
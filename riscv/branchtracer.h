@@ -0,0 +1,35 @@
+// See LICENSE for license details.
+
+#ifndef _BRANCHTRACER_H
+#define _BRANCHTRACER_H
+
+#include <cstddef>
+#include <cstdint>
+
+struct branch_record_t {
+  uint64_t pc;
+  bool taken;
+};
+
+// Sees the outcome of every conditional branch a hart executes, as
+// memtracer_t sees its memory accesses.
+class branchtracer_t
+{
+ public:
+  branchtracer_t() {}
+  virtual ~branchtracer_t() {}
+
+  virtual void trace(uint64_t pc, bool taken) = 0;
+
+  // The hart buffers the branches it executes and hands them over in
+  // order, a batch at a time, when its buffer fills and at the end of the
+  // run.  Tracers that can do better than a trace() per branch override
+  // this.
+  virtual void trace_batch(const branch_record_t* recs, size_t n)
+  {
+    for (size_t i = 0; i < n; i++)
+      trace(recs[i].pc, recs[i].taken);
+  }
+};
+
+#endif
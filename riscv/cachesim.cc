@@ -2,12 +2,15 @@
 
 #include "cachesim.h"
 #include "common.h"
+#include <algorithm>
+#include <chrono>
 #include <cstdlib>
 #include <iostream>
 #include <iomanip>
 
-cache_sim_t::cache_sim_t(size_t _sets, size_t _ways, size_t _linesz, const char* _name)
-: sets(_sets), ways(_ways), linesz(_linesz), name(_name), log(false)
+cache_sim_t::cache_sim_t(size_t _sets, size_t _ways, size_t _linesz, const char* _name,
+                         cache_repl_t _repl)
+: repl(_repl), sets(_sets), ways(_ways), linesz(_linesz), name(_name), log(false)
 {
   init();
 }
@@ -15,9 +18,13 @@ cache_sim_t::cache_sim_t(size_t _sets, size_t _ways, size_t _linesz, const char*
 static void help()
 {
   std::cerr << "Cache configurations must be of the form" << std::endl;
-  std::cerr << "  sets:ways:blocksize" << std::endl;
+  std::cerr << "  sets:ways:blocksize[:policy][:prefetcher[=degree]]" << std::endl;
   std::cerr << "where sets, ways, and blocksize are positive integers, with" << std::endl;
-  std::cerr << "sets and blocksize both powers of two and blocksize at least 8." << std::endl;
+  std::cerr << "sets and blocksize both powers of two and blocksize at least 8," << std::endl;
+  std::cerr << "and policy is random (the default), lru, plru or srrip.  plru" << std::endl;
+  std::cerr << "needs ways to be a power of two no larger than 64 unless the" << std::endl;
+  std::cerr << "cache is fully associative.  The prefetcher, if any, is next," << std::endl;
+  std::cerr << "stride or stream, and degree a positive integer." << std::endl;
   exit(1);
 }
 
@@ -28,13 +35,148 @@ cache_sim_t* cache_sim_t::construct(const char* config, const char* name)
   const char* bp = strchr(wp, ':');
   if (!bp++) help();
 
+  const char* pp = strchr(bp, ':');
+
   size_t sets = atoi(std::string(config, wp).c_str());
   size_t ways = atoi(std::string(wp, bp).c_str());
-  size_t linesz = atoi(bp);
+  size_t linesz = atoi(std::string(bp, pp ? pp : bp + strlen(bp)).c_str());
+
+  // The policy and prefetcher fields are each optional, but in that order.
+  std::vector<std::string> fields;
+  while (pp) {
+    const char* next = strchr(pp + 1, ':');
+    fields.emplace_back(pp + 1, next ? next : pp + strlen(pp));
+    pp = next;
+  }
+  size_t field = 0;
+
+  cache_repl_t repl = REPL_RANDOM;
+  if (field < fields.size()) {
+    const std::string& policy = fields[field++];
+    if (policy == "random")
+      repl = REPL_RANDOM;
+    else if (policy == "lru")
+      repl = REPL_LRU;
+    else if (policy == "plru")
+      repl = REPL_PLRU;
+    else if (policy == "srrip")
+      repl = REPL_SRRIP;
+    else
+      field--;
+  }
 
+  std::unique_ptr<prefetcher_t> prefetcher;
+  if (field < fields.size()) {
+    prefetcher.reset(prefetcher_t::construct(fields[field++]));
+    if (!prefetcher)
+      help();
+  }
+  if (field < fields.size())
+    help();
+
+  cache_sim_t* cache;
   if (ways > 4 /* empirical */ && sets == 1)
-    return new fa_cache_sim_t(ways, linesz, name);
-  return new cache_sim_t(sets, ways, linesz, name);
+    cache = new fa_cache_sim_t(ways, linesz, name, repl);
+  else
+    cache = new cache_sim_t(sets, ways, linesz, name, repl);
+  cache->set_prefetcher(prefetcher.release());
+  return cache;
+}
+
+prefetcher_t* prefetcher_t::construct(const std::string& config)
+{
+  size_t eq = config.find('=');
+  std::string kind = config.substr(0, eq);
+  unsigned degree = 0;
+  if (eq != std::string::npos) {
+    char* end;
+    degree = strtoul(config.c_str() + eq + 1, &end, 10);
+    if (*end || degree == 0)
+      help();
+  }
+
+  if (kind == "next")
+    return new next_line_prefetcher_t(degree ? degree : 1);
+  if (kind == "stride")
+    return new stride_prefetcher_t(degree ? degree : 2);
+  if (kind == "stream")
+    return new stream_prefetcher_t(degree ? degree : 4);
+  return nullptr;
+}
+
+void next_line_prefetcher_t::access(uint64_t line, uint64_t pc, bool miss, bool prefetch_hit,
+                                    std::vector<uint64_t>& out)
+{
+  if (!miss && !prefetch_hit)
+    return;
+  for (unsigned i = 1; i <= degree; i++)
+    out.push_back(line + i);
+}
+
+void stride_prefetcher_t::access(uint64_t line, uint64_t pc, bool miss, bool prefetch_hit,
+                                 std::vector<uint64_t>& out)
+{
+  entry_t& e = table[(pc >> 1) % TABLE_SIZE];
+  if (e.pc != pc) {
+    e = entry_t{pc, line, 0, 0};
+    return;
+  }
+
+  // Accesses within one line say nothing about the stride.
+  int64_t stride = line - e.last_line;
+  if (stride == 0)
+    return;
+  e.last_line = line;
+  if (stride == e.stride) {
+    e.confidence += e.confidence < 3;
+  } else if (e.confidence > 0) {
+    e.confidence--;
+  } else {
+    e.stride = stride;
+  }
+
+  if (e.confidence >= 2)
+    for (unsigned i = 1; i <= degree; i++)
+      out.push_back(line + i * e.stride);
+}
+
+void stream_prefetcher_t::access(uint64_t line, uint64_t pc, bool miss, bool prefetch_hit,
+                                 std::vector<uint64_t>& out)
+{
+  if (!miss && !prefetch_hit)
+    return;
+  clock++;
+
+  stream_t* s = nullptr;
+  stream_t* lru = &streams[0];
+  for (auto& it : streams) {
+    int64_t distance = line - it.last_line;
+    if (it.last_use != 0 && distance != 0 && distance >= -WINDOW && distance <= WINDOW) {
+      s = &it;
+      break;
+    }
+    if (it.last_use < lru->last_use)
+      lru = &it;
+  }
+
+  if (!s) {
+    *lru = stream_t{line, 0, 0, clock};
+    return;
+  }
+
+  int direction = int64_t(line - s->last_line) > 0 ? 1 : -1;
+  if (direction == s->direction) {
+    s->confidence += s->confidence < 3;
+  } else {
+    s->direction = direction;
+    s->confidence = 1;
+  }
+  s->last_line = line;
+  s->last_use = clock;
+
+  if (s->confidence >= 2)
+    for (unsigned i = 1; i <= degree; i++)
+      out.push_back(line + i * direction);
 }
 
 void cache_sim_t::init()
@@ -44,11 +186,21 @@ void cache_sim_t::init()
   if (linesz < 8 || (linesz & (linesz-1)))
     help();
 
+  if (repl == REPL_PLRU && ways & (ways-1))
+    help();
+  if (repl == REPL_PLRU && sets > 1 && ways > 64)
+    help();
+
   idx_shift = 0;
   for (size_t x = linesz; x>1; x >>= 1)
     idx_shift++;
 
+  if (ways == 0)
+    help();
+
   tags = new uint64_t[sets*ways]();
+  repl_state = new uint64_t[sets*ways]();
+  repl_clock = 0;
   read_accesses = 0;
   read_misses = 0;
   bytes_read = 0;
@@ -57,21 +209,75 @@ void cache_sim_t::init()
   bytes_written = 0;
   writebacks = 0;
 
+  prefetches = useful_prefetches = useless_prefetches = 0;
+  late_prefetches = prefetch_lead = 0;
+
+  sample_ratio = 1;
+  sample_filter = false;
+  profile_pcs = false;
+
   miss_handler = NULL;
+  miss_stream = NULL;
+}
+
+void cache_sim_t::set_sampling(size_t ratio, bool filter)
+{
+  if (ratio == 0 || (ratio & (ratio-1)) || (filter && ratio > sets)) {
+    std::cerr << name << ": the sampling ratio must be a power of two no "
+              << "larger than the number of sets" << std::endl;
+    exit(1);
+  }
+
+  sample_ratio = ratio;
+  sample_filter = filter && ratio > 1;
+  if (!sample_filter)
+    return;
+
+  // Multiplying by an odd constant permutes the set indices, so exactly
+  // sets/ratio of them land below the cut, spread over the whole cache.
+  sampled_sets.assign(sets, false);
+  for (size_t idx = 0; idx < sets; idx++)
+    sampled_sets[idx] = ((idx * 0x9e3779b97f4a7c15ULL) & (sets-1)) < sets / ratio;
 }
 
 cache_sim_t::cache_sim_t(const cache_sim_t& rhs)
  : sets(rhs.sets), ways(rhs.ways), linesz(rhs.linesz),
    idx_shift(rhs.idx_shift), name(rhs.name), log(false)
 {
+  repl = rhs.repl;
+  miss_stream = NULL;
   tags = new uint64_t[sets*ways];
   memcpy(tags, rhs.tags, sets*ways*sizeof(uint64_t));
+  repl_state = new uint64_t[sets*ways];
+  memcpy(repl_state, rhs.repl_state, sets*ways*sizeof(uint64_t));
+  repl_clock = rhs.repl_clock;
+  sample_ratio = rhs.sample_ratio;
+  sample_filter = rhs.sample_filter;
+  sampled_sets = rhs.sampled_sets;
+  profile_pcs = rhs.profile_pcs;
+  pc_stats = rhs.pc_stats;
+  if (rhs.reuse)
+    reuse.reset(new reuse_histogram_t(*rhs.reuse));
+  if (rhs.prefetcher)
+    prefetcher.reset(rhs.prefetcher->clone());
+  prefetched = rhs.prefetched;
+  prefetch_time = rhs.prefetch_time;
+  prefetches = useful_prefetches = useless_prefetches = 0;
+  late_prefetches = prefetch_lead = 0;
+}
+
+void cache_sim_t::set_prefetcher(prefetcher_t* p)
+{
+  prefetcher.reset(p);
+  prefetched.assign(p ? sets*ways : 0, false);
+  prefetch_time.assign(p ? sets*ways : 0, 0);
 }
 
 cache_sim_t::~cache_sim_t()
 {
   print_stats();
   delete [] tags;
+  delete [] repl_state;
 }
 
 void cache_sim_t::print_stats()
@@ -80,24 +286,220 @@ void cache_sim_t::print_stats()
     return;
 
   float mr = 100.0f*(read_misses+write_misses)/(read_accesses+write_accesses);
+  // Sampled counts are estimates for the whole cache.
+  uint64_t k = sample_ratio;
 
   std::cout << std::setprecision(3) << std::fixed;
   std::cout << name << " ";
-  std::cout << "Bytes Read:            " << bytes_read << std::endl;
+  std::cout << "Bytes Read:            " << bytes_read*k << std::endl;
   std::cout << name << " ";
-  std::cout << "Bytes Written:         " << bytes_written << std::endl;
+  std::cout << "Bytes Written:         " << bytes_written*k << std::endl;
   std::cout << name << " ";
-  std::cout << "Read Accesses:         " << read_accesses << std::endl;
+  std::cout << "Read Accesses:         " << read_accesses*k << std::endl;
   std::cout << name << " ";
-  std::cout << "Write Accesses:        " << write_accesses << std::endl;
+  std::cout << "Write Accesses:        " << write_accesses*k << std::endl;
   std::cout << name << " ";
-  std::cout << "Read Misses:           " << read_misses << std::endl;
+  std::cout << "Read Misses:           " << read_misses*k << std::endl;
   std::cout << name << " ";
-  std::cout << "Write Misses:          " << write_misses << std::endl;
+  std::cout << "Write Misses:          " << write_misses*k << std::endl;
   std::cout << name << " ";
-  std::cout << "Writebacks:            " << writebacks << std::endl;
+  std::cout << "Writebacks:            " << writebacks*k << std::endl;
   std::cout << name << " ";
   std::cout << "Miss Rate:             " << mr << '%' << std::endl;
+  if (prefetcher) {
+    // Coverage is the share of would-be misses that prefetches removed.
+    uint64_t used = useful_prefetches;
+    std::cout << name << " ";
+    std::cout << "Prefetches:            " << prefetches*k << std::endl;
+    std::cout << name << " ";
+    std::cout << "Useful Prefetches:     " << used*k << std::endl;
+    std::cout << name << " ";
+    std::cout << "Useless Prefetches:    " << useless_prefetches*k << std::endl;
+    std::cout << name << " ";
+    std::cout << "Prefetch Accuracy:     " << (prefetches ? 100.0f*used/prefetches : 0.0f) << '%' << std::endl;
+    std::cout << name << " ";
+    std::cout << "Prefetch Coverage:     " << (used ? 100.0f*used/(used+read_misses+write_misses) : 0.0f) << '%' << std::endl;
+    std::cout << name << " ";
+    std::cout << "Late Prefetches:       " << (used ? 100.0f*late_prefetches/used : 0.0f) << '%' << std::endl;
+    std::cout << name << " ";
+    std::cout << "Mean Prefetch Lead:    " << (used ? (float)prefetch_lead/used : 0.0f) << " accesses" << std::endl;
+  }
+  if (k > 1) {
+    std::cout << name << " ";
+    std::cout << "Sampling Ratio:        1/" << k << std::endl;
+  }
+}
+
+void cache_sim_t::reset_stats()
+{
+  read_accesses = read_misses = bytes_read = 0;
+  write_accesses = write_misses = bytes_written = 0;
+  writebacks = 0;
+  prefetches = useful_prefetches = useless_prefetches = 0;
+  late_prefetches = prefetch_lead = 0;
+  pc_stats.clear();
+  if (reuse)
+    reuse->reset_counts();
+}
+
+static std::string json_string(const std::string& s)
+{
+  std::string res = "\"";
+  for (char c : s) {
+    if (c == '"' || c == '\\')
+      res += '\\';
+    if ((unsigned char)c >= 0x20)
+      res += c;
+  }
+  return res + "\"";
+}
+
+void stack_distance_t::add(uint64_t slot, int delta)
+{
+  for (uint64_t i = slot + 1; i <= tree.size(); i += i & -i)
+    tree[i - 1] += delta;
+}
+
+uint64_t stack_distance_t::count_before(uint64_t slot)
+{
+  uint64_t n = 0;
+  for (uint64_t i = slot; i > 0; i -= i & -i)
+    n += tree[i - 1];
+  return n;
+}
+
+void stack_distance_t::compact()
+{
+  std::vector<std::pair<uint64_t, uint64_t>> marks;  // slot, line
+  marks.reserve(last.size());
+  for (auto& it : last)
+    marks.emplace_back(it.second, it.first);
+  std::sort(marks.begin(), marks.end());
+
+  now = marks.size();
+  tree.assign(std::max<size_t>(4 * now, 1 << 16), 0);
+  for (uint64_t slot = 0; slot < now; slot++) {
+    last[marks[slot].second] = slot;
+    tree[slot] = 1;
+  }
+  // Build the tree in place: each node passes its sum up to its parent.
+  for (uint64_t slot = 0; slot < tree.size(); slot++) {
+    uint64_t parent = slot + 1 + ((slot + 1) & -(slot + 1));
+    if (parent <= tree.size())
+      tree[parent - 1] += tree[slot];
+  }
+}
+
+uint64_t stack_distance_t::access(uint64_t line)
+{
+  if (now == tree.size())
+    compact();
+
+  uint64_t distance = COLD;
+  auto it = last.find(line);
+  if (it == last.end()) {
+    last.emplace(line, now);
+  } else {
+    distance = count_before(now) - count_before(it->second + 1);
+    add(it->second, -1);
+    it->second = now;
+  }
+  add(now++, 1);
+  return distance;
+}
+
+void stack_distance_t::forget(uint64_t line)
+{
+  auto it = last.find(line);
+  if (it != last.end()) {
+    add(it->second, -1);
+    last.erase(it);
+  }
+}
+
+void reuse_histogram_t::access(uint64_t line)
+{
+  uint64_t distance = distances.access(line);
+  if (distance == stack_distance_t::COLD) {
+    cold++;
+    return;
+  }
+  size_t bucket = distance ? 64 - __builtin_clzll(distance) : 0;
+  if (bucket >= buckets.size())
+    buckets.resize(bucket + 1);
+  buckets[bucket]++;
+}
+
+void reuse_histogram_t::reset_counts()
+{
+  cold = 0;
+  buckets.assign(buckets.size(), 0);
+}
+
+void reuse_histogram_t::write_report(std::ostream& out)
+{
+  out << "{\"cold\": " << cold << ", \"buckets\": [";
+  for (size_t b = 0; b < buckets.size(); b++) {
+    uint64_t lo = b ? uint64_t(1) << (b - 1) : 0;
+    uint64_t hi = b ? (uint64_t(1) << b) - 1 : 0;
+    out << (b ? ", " : "") << "{\"min\": " << lo << ", \"max\": " << hi
+        << ", \"count\": " << buckets[b] << "}";
+  }
+  out << "]}";
+}
+
+void cache_sim_t::set_profiling(bool pcs, bool reuse_distance)
+{
+  profile_pcs = pcs;
+  if (reuse_distance && !reuse)
+    reuse.reset(new reuse_histogram_t());
+}
+
+void cache_sim_t::write_report(std::ostream& out,
+                               const std::function<std::string(uint64_t)>& symbolize)
+{
+  out << "{\"name\": " << json_string(name)
+      << ", \"sets\": " << sets << ", \"ways\": " << ways
+      << ", \"block_size\": " << linesz
+      << ", \"sampling_ratio\": " << sample_ratio
+      << ", \"read_accesses\": " << read_accesses
+      << ", \"read_misses\": " << read_misses
+      << ", \"write_accesses\": " << write_accesses
+      << ", \"write_misses\": " << write_misses
+      << ", \"writebacks\": " << writebacks;
+  if (prefetcher)
+    out << ", \"prefetches\": " << prefetches
+        << ", \"useful_prefetches\": " << useful_prefetches
+        << ", \"useless_prefetches\": " << useless_prefetches
+        << ", \"late_prefetches\": " << late_prefetches
+        << ", \"prefetch_lead\": " << prefetch_lead;
+
+  if (profile_pcs) {
+    // Worst offenders first.
+    std::vector<std::pair<uint64_t, pc_stats_t>> pcs(pc_stats.begin(), pc_stats.end());
+    std::sort(pcs.begin(), pcs.end(), [](const std::pair<uint64_t, pc_stats_t>& a,
+                                         const std::pair<uint64_t, pc_stats_t>& b) {
+      return a.second.misses != b.second.misses ? a.second.misses > b.second.misses
+                                                : a.first < b.first;
+    });
+    out << ",\n  \"pcs\": [";
+    for (size_t i = 0; i < pcs.size(); i++) {
+      out << (i ? ",\n    " : "\n    ")
+          << "{\"pc\": \"0x" << std::hex << pcs[i].first << std::dec << "\"";
+      std::string symbol = symbolize(pcs[i].first);
+      if (!symbol.empty())
+        out << ", \"symbol\": " << json_string(symbol);
+      out << ", \"accesses\": " << pcs[i].second.accesses
+          << ", \"misses\": " << pcs[i].second.misses << "}";
+    }
+    out << "]";
+  }
+
+  if (reuse) {
+    out << ",\n  \"reuse_distance\": ";
+    reuse->write_report(out);
+  }
+  out << "}";
 }
 
 uint64_t* cache_sim_t::check_tag(uint64_t addr)
@@ -112,17 +514,97 @@ uint64_t* cache_sim_t::check_tag(uint64_t addr)
   return NULL;
 }
 
+size_t cache_sim_t::choose_way(size_t idx)
+{
+  uint64_t* set = &tags[idx*ways];
+  uint64_t* state = &repl_state[idx*ways];
+
+  if (repl == REPL_RANDOM)
+    return lfsr.next() % ways;
+
+  for (size_t i = 0; i < ways; i++)
+    if (!(set[i] & VALID))
+      return i;
+
+  switch (repl) {
+    case REPL_LRU: {
+      size_t way = 0;
+      for (size_t i = 1; i < ways; i++)
+        if (state[i] < state[way])
+          way = i;
+      return way;
+    }
+    case REPL_PLRU: {
+      // Node n of the tree is bit n of the set's first word, and a set bit
+      // means the victim lies in the right subtree.
+      size_t node = 1;
+      while (node < ways)
+        node = 2*node + ((state[0] >> node) & 1);
+      return node - ways;
+    }
+    case REPL_SRRIP:
+      while (true) {
+        for (size_t i = 0; i < ways; i++)
+          if (state[i] == 3)
+            return i;
+        for (size_t i = 0; i < ways; i++)
+          state[i]++;
+      }
+    default:
+      abort();
+  }
+}
+
+void cache_sim_t::update(size_t idx, size_t way, bool fill)
+{
+  uint64_t* state = &repl_state[idx*ways];
+
+  switch (repl) {
+    case REPL_LRU:
+      state[way] = ++repl_clock;
+      break;
+    case REPL_PLRU:
+      for (size_t node = way + ways; node > 1; node /= 2) {
+        if (node & 1)
+          state[0] &= ~(uint64_t(1) << (node/2));
+        else
+          state[0] |= uint64_t(1) << (node/2);
+      }
+      break;
+    case REPL_SRRIP:
+      state[way] = fill ? 2 : 0;
+      break;
+    default:
+      break;
+  }
+}
+
+void cache_sim_t::touch(uint64_t* line)
+{
+  size_t i = line - tags;
+  update(i / ways, i % ways, false);
+}
+
 uint64_t cache_sim_t::victimize(uint64_t addr)
 {
   size_t idx = (addr >> idx_shift) & (sets-1);
-  size_t way = lfsr.next() % ways;
+  size_t way = choose_way(idx);
   uint64_t victim = tags[idx*ways + way];
   tags[idx*ways + way] = (addr >> idx_shift) | VALID;
+  update(idx, way, true);
   return victim;
 }
 
-void cache_sim_t::access(uint64_t addr, size_t bytes, bool store)
+void cache_sim_t::access(uint64_t addr, size_t bytes, bool store, uint64_t pc)
 {
+  if (unlikely(!sampled(addr)))
+    return;
+  if (unlikely(reuse != nullptr))
+    reuse->access(addr >> idx_shift);
+  pc_stats_t* pcs = unlikely(profile_pcs) ? &pc_stats[pc] : NULL;
+  if (pcs)
+    pcs->accesses++;
+
   store ? write_accesses++ : read_accesses++;
   (store ? bytes_written : bytes_read) += bytes;
 
@@ -131,10 +613,25 @@ void cache_sim_t::access(uint64_t addr, size_t bytes, bool store)
   {
     if (store)
       *hit_way |= DIRTY;
+    touch(hit_way);
+    if (unlikely(prefetcher != nullptr)) {
+      size_t i = hit_way - tags;
+      bool prefetch_hit = prefetched[i];
+      if (prefetch_hit) {
+        prefetched[i] = false;
+        uint64_t lead = read_accesses + write_accesses - prefetch_time[i];
+        useful_prefetches++;
+        late_prefetches += lead <= LATE_PREFETCH_LEAD;
+        prefetch_lead += lead;
+      }
+      prefetch(addr, pc, false, prefetch_hit);
+    }
     return;
   }
 
   store ? write_misses++ : read_misses++;
+  if (pcs)
+    pcs->misses++;
   if (log)
   {
     std::cerr << name << " "
@@ -143,20 +640,56 @@ void cache_sim_t::access(uint64_t addr, size_t bytes, bool store)
   }
 
   uint64_t victim = victimize(addr);
+  filled(prefetcher ? check_tag(addr) : NULL, victim, false, pc);
 
+  if (miss_handler)
+    miss_handler->access(addr & ~(linesz-1), linesz, false, pc);
+  else if (unlikely(miss_stream != nullptr))
+    miss_stream->record(addr, store ? MISS_STREAM_WRITE : MISS_STREAM_READ);
+
+  if (store)
+    *check_tag(addr) |= DIRTY;
+
+  if (unlikely(prefetcher != nullptr))
+    prefetch(addr, pc, true, false);
+}
+
+void cache_sim_t::filled(uint64_t* line, uint64_t victim, bool prefetch, uint64_t pc)
+{
   if ((victim & (VALID | DIRTY)) == (VALID | DIRTY))
   {
     uint64_t dirty_addr = (victim & ~(VALID | DIRTY)) << idx_shift;
     if (miss_handler)
-      miss_handler->access(dirty_addr, linesz, true);
+      miss_handler->access(dirty_addr, linesz, true, pc);
+    else if (unlikely(miss_stream != nullptr))
+      miss_stream->record(dirty_addr, MISS_STREAM_WRITEBACK);
     writebacks++;
   }
 
-  if (miss_handler)
-    miss_handler->access(addr & ~(linesz-1), linesz, false);
+  if (prefetcher) {
+    size_t i = line - tags;
+    useless_prefetches += prefetched[i];
+    prefetched[i] = prefetch;
+    prefetch_time[i] = read_accesses + write_accesses;
+  }
+}
 
-  if (store)
-    *check_tag(addr) |= DIRTY;
+void cache_sim_t::prefetch(uint64_t addr, uint64_t pc, bool miss, bool prefetch_hit)
+{
+  prefetch_candidates.clear();
+  prefetcher->access(addr >> idx_shift, pc, miss, prefetch_hit, prefetch_candidates);
+  for (uint64_t line : prefetch_candidates) {
+    uint64_t target = line << idx_shift;
+    if ((target ^ addr) >> 12 || !sampled(target) || check_tag(target))
+      continue;
+    prefetches++;
+    uint64_t victim = victimize(target);
+    filled(check_tag(target), victim, true, pc);
+    if (miss_handler)
+      miss_handler->access(target, linesz, false, pc);
+    else if (unlikely(miss_stream != nullptr))
+      miss_stream->record(target, MISS_STREAM_PREFETCH);
+  }
 }
 
 void cache_sim_t::clean_invalidate(uint64_t addr, size_t bytes, bool clean, bool inval)
@@ -172,6 +705,8 @@ void cache_sim_t::clean_invalidate(uint64_t addr, size_t bytes, bool clean, bool
         if (*hit_way & DIRTY) {
           writebacks++;
           *hit_way &= ~DIRTY;
+          if (!miss_handler && unlikely(miss_stream != nullptr))
+            miss_stream->record(cur_addr, MISS_STREAM_WRITEBACK);
         }
       }
 
@@ -184,27 +719,417 @@ void cache_sim_t::clean_invalidate(uint64_t addr, size_t bytes, bool clean, bool
     miss_handler->clean_invalidate(addr, bytes, clean, inval);
 }
 
-fa_cache_sim_t::fa_cache_sim_t(size_t ways, size_t linesz, const char* name)
-  : cache_sim_t(1, ways, linesz, name)
+fa_cache_sim_t::fa_cache_sim_t(size_t ways, size_t linesz, const char* name,
+                               cache_repl_t repl)
+  : cache_sim_t(1, ways, linesz, name, repl), used(0),
+    prev(ways + NLISTS), next(ways + NLISTS), srrip_base(0)
+{
+  for (size_t list = 0; list < NLISTS; list++)
+    prev[ways + list] = next[ways + list] = ways + list;
+  // The PLRU tree needs one bit per way, more than the base class keeps
+  // for a single set.
+  if (repl == REPL_PLRU) {
+    delete [] repl_state;
+    repl_state = new uint64_t[(ways + 63) / 64]();
+  }
+}
+
+void fa_cache_sim_t::unlink(size_t way)
 {
+  next[prev[way]] = next[way];
+  prev[next[way]] = prev[way];
+}
+
+void fa_cache_sim_t::push_front(size_t list, size_t way)
+{
+  size_t head = list_head(list);
+  prev[way] = head;
+  next[way] = next[head];
+  prev[next[head]] = way;
+  next[head] = way;
 }
 
 uint64_t* fa_cache_sim_t::check_tag(uint64_t addr)
 {
-  auto it = tags.find(addr >> idx_shift);
-  return it == tags.end() ? NULL : &it->second;
+  auto it = lookup.find(addr >> idx_shift);
+  if (it == lookup.end() || !(tags[it->second] & VALID))
+    return NULL;
+  return &tags[it->second];
+}
+
+void fa_cache_sim_t::touch(uint64_t* line)
+{
+  size_t way = line - tags;
+  switch (repl) {
+    case REPL_LRU:
+    case REPL_SRRIP:
+      unlink(way);
+      push_front(0, way);
+      break;
+    case REPL_PLRU:
+      for (size_t node = way + ways; node > 1; node /= 2) {
+        uint64_t bit = uint64_t(1) << (node/2 % 64);
+        if (node & 1)
+          repl_state[node/2 / 64] &= ~bit;
+        else
+          repl_state[node/2 / 64] |= bit;
+      }
+      break;
+    default:
+      break;
+  }
 }
 
 uint64_t fa_cache_sim_t::victimize(uint64_t addr)
 {
-  uint64_t old_tag = 0;
-  if (tags.size() == ways)
-  {
-    auto it = tags.begin();
-    std::advance(it, lfsr.next() % ways);
-    old_tag = it->second;
-    tags.erase(it);
+  uint64_t line = addr >> idx_shift;
+  bool listed = repl == REPL_LRU || repl == REPL_SRRIP;
+  size_t way;
+
+  // A line that was invalidated in place gets its old way back.
+  auto it = lookup.find(line);
+  if (it != lookup.end()) {
+    way = it->second;
+    if (listed)
+      unlink(way);
+  } else {
+    if (used < ways) {
+      way = used++;
+    } else {
+      switch (repl) {
+        case REPL_LRU:
+          way = prev[list_head(0)];
+          break;
+        case REPL_PLRU: {
+          size_t node = 1;
+          while (node < ways)
+            node = 2*node + ((repl_state[node / 64] >> (node % 64)) & 1);
+          way = node - ways;
+          break;
+        }
+        case REPL_SRRIP: {
+          // Age every line until some prediction reaches 3.
+          size_t list = NLISTS - 1;
+          while (next[list_head(list)] == list_head(list))
+            list--;
+          srrip_base -= NLISTS - 1 - list;
+          way = prev[list_head(NLISTS - 1)];
+          break;
+        }
+        default:
+          way = lfsr.next() % ways;
+          break;
+      }
+      lookup.erase(tags[way] & ~(VALID | DIRTY));
+      if (listed)
+        unlink(way);
+    }
+    lookup[line] = way;
+  }
+
+  uint64_t victim = tags[way];
+  tags[way] = line | VALID;
+  if (repl == REPL_LRU)
+    push_front(0, way);
+  else if (repl == REPL_SRRIP)
+    push_front(2, way);
+  else
+    touch(&tags[way]);
+  return victim;
+}
+
+cache_sim_thread_t::cache_sim_thread_t()
+  : ring(new request_t[RING_SIZE]), head(0), tail(0), stop(false)
+{
+  worker = std::thread(&cache_sim_thread_t::worker_main, this);
+}
+
+cache_sim_thread_t::~cache_sim_thread_t()
+{
+  stop.store(true, std::memory_order_release);
+  worker.join();
+  delete[] ring;
+}
+
+void cache_sim_thread_t::trace_batch(const access_record_t* recs, size_t n)
+{
+  size_t h = head.load(std::memory_order_relaxed);
+  for (size_t i = 0; i < n; i++, h++) {
+    while (h - tail.load(std::memory_order_acquire) >= RING_SIZE) {
+      // Publish what is queued so far before waiting for room.
+      head.store(h, std::memory_order_release);
+      std::this_thread::yield();
+    }
+    ring[h & (RING_SIZE - 1)] = request_t{recs[i].addr, recs[i].bytes, recs[i].type,
+                                          false, false, false, recs[i].pc};
+  }
+  head.store(h, std::memory_order_release);
+}
+
+void cache_sim_thread_t::sync()
+{
+  while (tail.load(std::memory_order_acquire) != head.load(std::memory_order_relaxed))
+    std::this_thread::yield();
+}
+
+void cache_sim_thread_t::drain()
+{
+  size_t t = tail.load(std::memory_order_relaxed);
+  size_t h = head.load(std::memory_order_acquire);
+
+  for (; t != h; t++) {
+    const request_t& req = ring[t & (RING_SIZE - 1)];
+    if (req.is_cmo) {
+      caches.clean_invalidate(req.addr, req.bytes, req.clean, req.inval);
+    } else {
+      access_record_t rec = {req.addr, req.bytes, req.type, req.pc};
+      caches.trace_batch(&rec, 1);
+    }
+    // Free slots in batches to keep the producer's cache line quiet.
+    if ((t & 255) == 255)
+      tail.store(t + 1, std::memory_order_release);
+  }
+  tail.store(t, std::memory_order_release);
+}
+
+void cache_sim_thread_t::worker_main()
+{
+  unsigned idle = 0;
+  while (true) {
+    bool stopping = stop.load(std::memory_order_acquire);
+    if (tail.load(std::memory_order_relaxed) != head.load(std::memory_order_acquire)) {
+      drain();
+      idle = 0;
+    } else if (stopping) {
+      break;
+    } else if (++idle < 64) {
+      std::this_thread::yield();
+    } else {
+      std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+  }
+}
+
+coherent_caches_t::coherent_caches_t(size_t nharts, const char* ic_config,
+                                     const char* dc_config, cache_sim_t* l2,
+                                     bool mesi)
+  : mesi(mesi), l2(l2), line_shift(0), invalidations(0), upgrades(0),
+    downgrades(0), coherence_misses(0), sample_ratio(1)
+{
+  if (nharts > 64) {
+    std::cerr << "Coherent caches support at most 64 harts" << std::endl;
+    exit(1);
+  }
+
+  for (size_t i = 0; i < nharts; i++) {
+    std::string prefix = "C" + std::to_string(i) + " ";
+    if (ic_config)
+      ic.push_back(cache_sim_t::construct(ic_config, (prefix + "I$").c_str()));
+    if (dc_config)
+      dc.push_back(cache_sim_t::construct(dc_config, (prefix + "D$").c_str()));
   }
-  tags[addr >> idx_shift] = (addr >> idx_shift) | VALID;
-  return old_tag;
+  // Prefetches would fill D$ lines behind the directory's back.
+  if (!dc.empty() && dc[0]->has_prefetcher()) {
+    std::cerr << "Coherent D$s cannot have a prefetcher" << std::endl;
+    exit(1);
+  }
+  for (auto c : ic)
+    c->set_miss_handler(l2);
+  for (auto c : dc)
+    c->set_miss_handler(l2);
+
+  if (!dc.empty())
+    while ((size_t(1) << line_shift) < dc[0]->linesz)
+      line_shift++;
+
+  tracers.reserve(nharts);
+  for (size_t i = 0; i < nharts; i++)
+    tracers.emplace_back(this, i);
+}
+
+coherent_caches_t::~coherent_caches_t()
+{
+  for (auto c : ic)
+    delete c;
+  for (auto c : dc)
+    delete c;
+  print_stats();
+}
+
+void coherent_caches_t::set_log(bool log)
+{
+  for (auto c : ic)
+    c->set_log(log);
+  for (auto c : dc)
+    c->set_log(log);
+}
+
+void coherent_caches_t::set_sampling(size_t ratio)
+{
+  for (auto c : ic)
+    c->set_sampling(ratio);
+  for (auto c : dc)
+    c->set_sampling(ratio);
+  sample_ratio = ratio;
+}
+
+void coherent_caches_t::set_profiling(bool pcs, bool reuse)
+{
+  for (auto c : ic)
+    c->set_profiling(pcs, reuse);
+  for (auto c : dc)
+    c->set_profiling(pcs, reuse);
+}
+
+void coherent_caches_t::write_report(std::ostream& out,
+                                     const std::function<std::string(uint64_t)>& symbolize)
+{
+  for (auto c : ic) {
+    c->write_report(out, symbolize);
+    out << ",\n";
+  }
+  for (auto c : dc) {
+    c->write_report(out, symbolize);
+    out << ",\n";
+  }
+  out << "{\"name\": \"Dir\", \"sampling_ratio\": " << sample_ratio
+      << ", \"invalidations\": " << invalidations
+      << ", \"upgrades\": " << upgrades
+      << ", \"downgrades\": " << downgrades
+      << ", \"coherence_misses\": " << coherence_misses << "}";
+}
+
+void coherent_caches_t::reset_stats()
+{
+  for (auto c : ic)
+    c->reset_stats();
+  for (auto c : dc)
+    c->reset_stats();
+  invalidations = upgrades = downgrades = coherence_misses = 0;
+}
+
+void coherent_caches_t::print_stats()
+{
+  if (dc.empty())
+    return;
+
+  uint64_t k = sample_ratio;
+  std::cout << "Dir Invalidations:         " << invalidations*k << std::endl;
+  std::cout << "Dir Upgrades:              " << upgrades*k << std::endl;
+  std::cout << "Dir Downgrades:            " << downgrades*k << std::endl;
+  std::cout << "Dir Coherence Misses:      " << coherence_misses*k << std::endl;
+}
+
+void coherent_caches_t::prune(dir_entry_t& e, uint64_t addr)
+{
+  for (uint64_t s = e.sharers; s; s &= s - 1) {
+    size_t j = __builtin_ctzll(s);
+    if (!dc[j]->check_tag(addr))
+      e.sharers &= ~(uint64_t(1) << j);
+  }
+  if (e.owner >= 0 && !(e.sharers & (uint64_t(1) << e.owner)))
+    e.owner = -1;
+}
+
+void coherent_caches_t::write_back(size_t i, uint64_t* line, uint64_t addr, uint64_t pc)
+{
+  cache_sim_t* c = dc[i];
+  if (!(*line & cache_sim_t::DIRTY))
+    return;
+
+  *line &= ~cache_sim_t::DIRTY;
+  c->writebacks++;
+  if (c->miss_handler)
+    c->miss_handler->access(addr & ~(c->linesz - 1), c->linesz, true, pc);
+}
+
+void coherent_caches_t::access(size_t hart, uint64_t addr, size_t bytes, access_type type,
+                               uint64_t pc)
+{
+  if (type == FETCH) {
+    if (!ic.empty())
+      ic[hart]->access(addr, bytes, false, pc);
+    return;
+  }
+  if (dc.empty())
+    return;
+
+  cache_sim_t* c = dc[hart];
+  if (!c->sampled(addr))
+    return;
+  bool store = type == STORE;
+  uint64_t* line = c->check_tag(addr);
+
+  // Loads that hit need nothing from the directory.
+  if (line && !store) {
+    c->access(addr, bytes, false, pc);
+    return;
+  }
+
+  uint64_t bit = uint64_t(1) << hart;
+  dir_entry_t& e = dir.emplace(addr >> line_shift, dir_entry_t{0, 0, -1}).first->second;
+  if (line && e.owner == (int)hart) {
+    c->access(addr, bytes, true, pc);
+    return;
+  }
+
+  if (!line && (e.lost & bit))
+    coherence_misses++;
+  e.lost &= ~bit;
+  prune(e, addr);
+
+  if (!store) {
+    if (e.owner >= 0) {
+      write_back(e.owner, dc[e.owner]->check_tag(addr), addr, pc);
+      downgrades++;
+    }
+    e.owner = mesi && e.sharers == 0 ? (int)hart : -1;
+    e.sharers |= bit;
+    c->access(addr, bytes, false, pc);
+    return;
+  }
+
+  if (line)
+    upgrades++;
+  for (uint64_t s = e.sharers & ~bit; s; s &= s - 1) {
+    size_t j = __builtin_ctzll(s);
+    uint64_t* copy = dc[j]->check_tag(addr);
+    write_back(j, copy, addr, pc);
+    *copy &= ~cache_sim_t::VALID;
+    e.lost |= uint64_t(1) << j;
+    invalidations++;
+  }
+  e.owner = hart;
+  e.sharers = bit;
+  c->access(addr, bytes, true, pc);
+}
+
+void coherent_caches_t::clean_invalidate_lines(cache_sim_t* c, uint64_t addr, size_t bytes,
+                                               bool clean, bool inval)
+{
+  uint64_t end_addr = (addr + bytes + c->linesz-1) & ~(c->linesz-1);
+  for (uint64_t cur_addr = addr & ~(c->linesz-1); cur_addr < end_addr; cur_addr += c->linesz) {
+    uint64_t* line = c->check_tag(cur_addr);
+    if (!line)
+      continue;
+    if (clean && (*line & cache_sim_t::DIRTY)) {
+      c->writebacks++;
+      *line &= ~cache_sim_t::DIRTY;
+    }
+    if (inval)
+      *line &= ~cache_sim_t::VALID;
+  }
+}
+
+void coherent_caches_t::clean_invalidate(size_t hart, uint64_t addr, size_t bytes,
+                                         bool clean, bool inval)
+{
+  // Cache-block operations act on every copy in the system, but the L2
+  // must see each only once.
+  if (!ic.empty())
+    clean_invalidate_lines(ic[hart], addr, bytes, clean, inval);
+  for (auto c : dc)
+    clean_invalidate_lines(c, addr, bytes, clean, inval);
+  if (l2)
+    l2->clean_invalidate(addr, bytes, clean, inval);
 }
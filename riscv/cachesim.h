@@ -4,10 +4,18 @@
 #define _RISCV_CACHE_SIM_H
 
 #include "memtracer.h"
+#include "miss_stream.h"
+#include <atomic>
 #include <cstring>
 #include <string>
 #include <map>
 #include <cstdint>
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 class lfsr_t
 {
@@ -19,30 +27,213 @@ class lfsr_t
   uint32_t reg;
 };
 
+// Replacement policies, selected by an optional fourth field of the cache
+// configuration string.  Apart from random, all of them fill empty ways
+// first.  SRRIP inserts lines with a re-reference prediction of 2 and
+// promotes them to 0 on a hit.
+enum cache_repl_t {
+  REPL_RANDOM,
+  REPL_LRU,
+  REPL_PLRU,   // tree pseudo-LRU; ways must be a power of two
+  REPL_SRRIP,
+};
+
+// LRU stack distances: the number of distinct lines touched between two
+// accesses to the same line.  Each access marks its slot in a Fenwick tree
+// over access times and clears the line's previous mark, so a distance is
+// a range count: O(log n) per access rather than a walk of the LRU stack.
+class stack_distance_t
+{
+ public:
+  static const uint64_t COLD = UINT64_MAX;
+
+  stack_distance_t() : now(0) {}
+  // Returns the line's distance, or COLD on its first access.
+  uint64_t access(uint64_t line);
+  // Drops the line, so that its next access is cold.
+  void forget(uint64_t line);
+
+ private:
+  void add(uint64_t slot, int delta);
+  uint64_t count_before(uint64_t slot);
+  // Renumbers the live marks from zero once the tree is full.
+  void compact();
+
+  std::unordered_map<uint64_t, uint64_t> last;  // line -> slot of its last access
+  std::vector<uint32_t> tree;
+  uint64_t now;                                 // slot of the next access
+};
+
+// Reuse distances gathered into power-of-two buckets.  A fully-associative
+// LRU cache of n lines hits exactly the accesses at distance below n.
+class reuse_histogram_t
+{
+ public:
+  reuse_histogram_t() : cold(0) {}
+  void access(uint64_t line);
+  void write_report(std::ostream& out);
+  // Forgets the distances counted so far, but not the lines seen.
+  void reset_counts();
+
+ private:
+  stack_distance_t distances;
+  uint64_t cold;                                // first accesses to a line
+  // Bucket 0 counts distance 0, and bucket b distances in [2^(b-1), 2^b).
+  std::vector<uint64_t> buckets;
+};
+
+// Proposes lines for a cache to prefetch.  It sees every demand access the
+// cache takes, as a line number with the pc making it, and whether it
+// missed or was the first use of a prefetched line.  Prefetches stay within
+// the 4 KiB page of the access that triggered them.  The optional fifth
+// field of a cache configuration selects one, as name[=degree]:
+//   next    the next degree lines after a miss or prefetch hit (default 1)
+//   stride  per pc, a confirmed stride between its lines, degree strides
+//           ahead (default 2)
+//   stream  up to 16 ascending or descending miss streams, followed degree
+//           lines ahead once two misses confirm the direction (default 4)
+class prefetcher_t
+{
+ public:
+  virtual ~prefetcher_t() {}
+  virtual prefetcher_t* clone() const = 0;
+  // Appends the lines to prefetch to out.
+  virtual void access(uint64_t line, uint64_t pc, bool miss, bool prefetch_hit,
+                      std::vector<uint64_t>& out) = 0;
+
+  // Null if config names no prefetcher
+  static prefetcher_t* construct(const std::string& config);
+};
+
+class next_line_prefetcher_t : public prefetcher_t
+{
+ public:
+  next_line_prefetcher_t(unsigned degree) : degree(degree) {}
+  prefetcher_t* clone() const { return new next_line_prefetcher_t(*this); }
+  void access(uint64_t line, uint64_t pc, bool miss, bool prefetch_hit,
+              std::vector<uint64_t>& out);
+ private:
+  unsigned degree;
+};
+
+class stride_prefetcher_t : public prefetcher_t
+{
+ public:
+  stride_prefetcher_t(unsigned degree) : degree(degree), table(TABLE_SIZE) {}
+  prefetcher_t* clone() const { return new stride_prefetcher_t(*this); }
+  void access(uint64_t line, uint64_t pc, bool miss, bool prefetch_hit,
+              std::vector<uint64_t>& out);
+ private:
+  static const size_t TABLE_SIZE = 256;  // direct-mapped by pc
+  struct entry_t {
+    uint64_t pc;
+    uint64_t last_line;
+    int64_t stride;
+    unsigned confidence;  // 0..3; prefetches from 2
+  };
+  unsigned degree;
+  std::vector<entry_t> table;
+};
+
+class stream_prefetcher_t : public prefetcher_t
+{
+ public:
+  stream_prefetcher_t(unsigned degree) : degree(degree), streams(STREAMS), clock(0) {}
+  prefetcher_t* clone() const { return new stream_prefetcher_t(*this); }
+  void access(uint64_t line, uint64_t pc, bool miss, bool prefetch_hit,
+              std::vector<uint64_t>& out);
+ private:
+  static const size_t STREAMS = 16;
+  static const int64_t WINDOW = 16;  // lines from a stream's last miss it may continue at
+  struct stream_t {
+    uint64_t last_line;
+    int direction;  // 0 until the second miss
+    unsigned confidence;
+    uint64_t last_use;  // for LRU replacement; 0 if unused
+  };
+  unsigned degree;
+  std::vector<stream_t> streams;
+  uint64_t clock;
+};
+
 class cache_sim_t
 {
  public:
-  cache_sim_t(size_t sets, size_t ways, size_t linesz, const char* name);
+  cache_sim_t(size_t sets, size_t ways, size_t linesz, const char* name,
+              cache_repl_t repl = REPL_RANDOM);
   cache_sim_t(const cache_sim_t& rhs);
   virtual ~cache_sim_t();
 
-  void access(uint64_t addr, size_t bytes, bool store);
+  // pc is the instruction the access is made for, if known.
+  void access(uint64_t addr, size_t bytes, bool store, uint64_t pc = 0);
   void clean_invalidate(uint64_t addr, size_t bytes, bool clean, bool inval);
   void print_stats();
+  // Read and write misses so far, scaled up as print_stats() scales them
+  uint64_t misses() const { return (read_misses + write_misses) * sample_ratio; }
+  size_t get_linesz() const { return linesz; }
+  // Zeroes the statistics and profiles, keeping the cache contents.
+  void reset_stats();
   void set_miss_handler(cache_sim_t* mh) { miss_handler = mh; }
   void set_log(bool _log) { log = _log; }
+  // Record the fills and writebacks of this cache, if it has no miss
+  // handler, to s, which the caller owns.
+  void set_miss_stream(miss_stream_t* s) { miss_stream = s; }
+  // Who makes the accesses that follow, for the miss stream, if any, of
+  // this cache or those behind it.
+  void set_context(uint32_t hart, uint64_t instret)
+  {
+    if (miss_handler)
+      miss_handler->set_context(hart, instret);
+    else if (miss_stream)
+      miss_stream->set_context(hart, instret);
+  }
+  // Simulate only 1/ratio of the sets and scale the statistics to match.
+  // A cache whose traffic comes only from sampled caches in front of it,
+  // such as an L2 behind sampled L1s with no more sets and the same block
+  // size, should scale without filtering.
+  void set_sampling(size_t ratio, bool filter = true);
+  bool sampled(uint64_t addr)
+  {
+    return !sample_filter || sampled_sets[(addr >> idx_shift) & (sets-1)];
+  }
+
+  // Count accesses and misses per pc, and/or keep a reuse-distance
+  // histogram of the lines accessed, for write_report().
+  void set_profiling(bool pcs, bool reuse);
+  // Takes ownership of p, which may be null.
+  void set_prefetcher(prefetcher_t* p);
+  bool has_prefetcher() const { return prefetcher != nullptr; }
+  // Writes the statistics and any profiles as a JSON object, naming pcs
+  // with symbolize where it returns a nonempty string.
+  void write_report(std::ostream& out, const std::function<std::string(uint64_t)>& symbolize);
 
   static cache_sim_t* construct(const char* config, const char* name);
 
  protected:
   static const uint64_t VALID = 1ULL << 63;
   static const uint64_t DIRTY = 1ULL << 62;
+  // A prefetch used within this many demand accesses of its fill counts
+  // as late: the demand would most likely have caught it in flight.
+  static const uint64_t LATE_PREFETCH_LEAD = 16;
 
   virtual uint64_t* check_tag(uint64_t addr);
   virtual uint64_t victimize(uint64_t addr);
+  // Replacement bookkeeping for a hit on the line check_tag returned.
+  virtual void touch(uint64_t* line);
+
+  size_t choose_way(size_t idx);
+  void update(size_t idx, size_t way, bool fill);
+  // Asks the prefetcher what a demand access to addr calls for, and fills
+  // it.
+  void prefetch(uint64_t addr, uint64_t pc, bool miss, bool prefetch_hit);
+  // Notes the fill of line, which held victim before, by a prefetch or
+  // not, and writes the victim back if it is dirty.
+  void filled(uint64_t* line, uint64_t victim, bool prefetch, uint64_t pc);
 
   lfsr_t lfsr;
+  cache_repl_t repl;
   cache_sim_t* miss_handler;
+  miss_stream_t* miss_stream;
 
   size_t sets;
   size_t ways;
@@ -50,7 +241,11 @@ class cache_sim_t
   size_t idx_shift;
 
   uint64_t* tags;
-  
+  // Per line, the LRU timestamp or SRRIP prediction; per set, the PLRU
+  // tree bits.
+  uint64_t* repl_state;
+  uint64_t repl_clock;
+
   uint64_t read_accesses;
   uint64_t read_misses;
   uint64_t bytes_read;
@@ -59,21 +254,66 @@ class cache_sim_t
   uint64_t bytes_written;
   uint64_t writebacks;
 
+  std::unique_ptr<prefetcher_t> prefetcher;
+  // Per line, whether a prefetch brought it in and it is unused yet, and
+  // the demand access count when it did.
+  std::vector<bool> prefetched;
+  std::vector<uint64_t> prefetch_time;
+  std::vector<uint64_t> prefetch_candidates;
+  uint64_t prefetches;
+  uint64_t useful_prefetches;
+  uint64_t useless_prefetches;  // evicted or invalidated unused
+  uint64_t late_prefetches;
+  uint64_t prefetch_lead;       // demand accesses between fill and use, summed
+
+  size_t sample_ratio;
+  bool sample_filter;
+  std::vector<bool> sampled_sets;
+
+  struct pc_stats_t {
+    uint64_t accesses;
+    uint64_t misses;
+  };
+  bool profile_pcs;
+  std::unordered_map<uint64_t, pc_stats_t> pc_stats;
+  std::unique_ptr<reuse_histogram_t> reuse;
+
   std::string name;
   bool log;
 
   void init();
+
+  friend class coherent_caches_t;
 };
 
+// A fully-associative cache keeps its lines in the base class's single
+// set, found through a hash map, so lookups take constant time however many
+// ways there are.  LRU and SRRIP are kept as intrusive lists of ways
+// (SRRIP one list per prediction value), making replacement constant time
+// too; PLRU walks its tree in log(ways).
 class fa_cache_sim_t : public cache_sim_t
 {
  public:
-  fa_cache_sim_t(size_t ways, size_t linesz, const char* name);
+  fa_cache_sim_t(size_t ways, size_t linesz, const char* name,
+                 cache_repl_t repl = REPL_RANDOM);
   uint64_t* check_tag(uint64_t addr);
   uint64_t victimize(uint64_t addr);
+  void touch(uint64_t* line);
  private:
-  static bool cmp(uint64_t a, uint64_t b);
-  std::map<uint64_t, uint64_t> tags;
+  static const size_t NLISTS = 4;
+
+  size_t list_head(size_t list) { return ways + ((list + srrip_base) & (NLISTS - 1)); }
+  void unlink(size_t way);
+  void push_front(size_t list, size_t way);
+
+  std::unordered_map<uint64_t, size_t> lookup;  // line address -> way
+  size_t used;                                  // ways filled so far
+  // Doubly-linked lists threaded through the ways, with one sentinel node
+  // per list after the last way.
+  std::vector<size_t> prev;
+  std::vector<size_t> next;
+  // Aging every line's SRRIP prediction just renames the lists.
+  size_t srrip_base;
 };
 
 class cache_memtracer_t : public memtracer_t
@@ -99,6 +339,15 @@ class cache_memtracer_t : public memtracer_t
   {
     cache->set_log(log);
   }
+  void set_sampling(size_t ratio)
+  {
+    cache->set_sampling(ratio);
+  }
+  void set_batch_context(uint32_t hart, uint64_t instret)
+  {
+    cache->set_context(hart, instret);
+  }
+  cache_sim_t* get_cache() { return cache; }
 
  protected:
   cache_sim_t* cache;
@@ -116,6 +365,12 @@ class icache_sim_t : public cache_memtracer_t
   {
     if (type == FETCH) cache->access(addr, bytes, false);
   }
+  void trace_batch(const access_record_t* recs, size_t n)
+  {
+    for (size_t i = 0; i < n; i++)
+      if (recs[i].type == FETCH)
+        cache->access(recs[i].addr, recs[i].bytes, false, recs[i].pc);
+  }
 };
 
 class dcache_sim_t : public cache_memtracer_t
@@ -130,6 +385,180 @@ class dcache_sim_t : public cache_memtracer_t
   {
     if (type == LOAD || type == STORE) cache->access(addr, bytes, type == STORE);
   }
+  void trace_batch(const access_record_t* recs, size_t n)
+  {
+    for (size_t i = 0; i < n; i++)
+      if (recs[i].type == LOAD || recs[i].type == STORE)
+        cache->access(recs[i].addr, recs[i].bytes, recs[i].type == STORE, recs[i].pc);
+  }
+};
+
+// Private I$ and D$ models for each hart in front of an optional shared L2,
+// with the D$s kept coherent by a directory.  Instruction caches are not
+// kept coherent with stores, as RISC-V leaves that to fence.i.
+//
+// The directory tracks, per D$ line, the harts that may hold it and the one
+// that holds it exclusively, if any.  Clean lines are evicted silently, so
+// the sharer set is checked against the caches themselves before acting on
+// it.  Under MSI a load miss always fills the line shared, and a store to a
+// shared line is an upgrade that invalidates the other copies; MESI fills
+// the line exclusive when no other D$ holds it, so that a later store needs
+// no upgrade.  A dirty line read by another hart is written back to the L2
+// and downgraded to shared.
+//
+// A miss on a line that this hart last lost to another's store is counted
+// as a coherence miss.  All harts must run on one host thread.
+class coherent_caches_t
+{
+ public:
+  coherent_caches_t(size_t nharts, const char* ic_config, const char* dc_config,
+                    cache_sim_t* l2, bool mesi);
+  ~coherent_caches_t();
+
+  // The tracer to register with hart i's MMU.
+  memtracer_t* get_tracer(size_t i) { return &tracers[i]; }
+  // Hart i's I$ and D$, or null if there are none.
+  const cache_sim_t* get_icache(size_t i) const { return ic.empty() ? nullptr : ic[i]; }
+  const cache_sim_t* get_dcache(size_t i) const { return dc.empty() ? nullptr : dc[i]; }
+  void set_log(bool log);
+  // Samples the sets of every I$ and D$, and the directory with them.
+  void set_sampling(size_t ratio);
+  void set_profiling(bool pcs, bool reuse);
+  // One JSON object per cache, comma-separated, and one for the directory.
+  void write_report(std::ostream& out, const std::function<std::string(uint64_t)>& symbolize);
+  void print_stats();
+  void reset_stats();
+
+ private:
+  class tracer_t : public memtracer_t
+  {
+   public:
+    tracer_t(coherent_caches_t* caches, size_t hart) : caches(caches), hart(hart) {}
+    bool interested_in_range(uint64_t begin, uint64_t end, access_type type)
+    {
+      return type == FETCH ? !caches->ic.empty() : !caches->dc.empty();
+    }
+    void trace(uint64_t addr, size_t bytes, access_type type)
+    {
+      caches->access(hart, addr, bytes, type, 0);
+    }
+    void trace_batch(const access_record_t* recs, size_t n)
+    {
+      for (size_t i = 0; i < n; i++)
+        caches->access(hart, recs[i].addr, recs[i].bytes, recs[i].type, recs[i].pc);
+    }
+    void clean_invalidate(uint64_t addr, size_t bytes, bool clean, bool inval)
+    {
+      caches->clean_invalidate(hart, addr, bytes, clean, inval);
+    }
+    void set_batch_context(uint32_t hart, uint64_t instret)
+    {
+      if (caches->l2)
+        caches->l2->set_context(hart, instret);
+    }
+   private:
+    coherent_caches_t* caches;
+    size_t hart;
+  };
+
+  struct dir_entry_t {
+    uint64_t sharers;  // harts whose D$ may hold the line
+    uint64_t lost;     // harts whose copy another hart's store invalidated
+    int owner;         // hart holding the line exclusive or modified, or -1
+  };
+
+  void access(size_t hart, uint64_t addr, size_t bytes, access_type type, uint64_t pc);
+  void clean_invalidate(size_t hart, uint64_t addr, size_t bytes, bool clean, bool inval);
+  // Drops the harts in e.sharers whose D$ no longer holds the line.
+  void prune(dir_entry_t& e, uint64_t addr);
+  // Writes hart i's copy back to the L2 if it is dirty.
+  void write_back(size_t i, uint64_t* line, uint64_t addr, uint64_t pc);
+  // clean_invalidate on one cache, without passing it on to the L2.
+  void clean_invalidate_lines(cache_sim_t* c, uint64_t addr, size_t bytes,
+                              bool clean, bool inval);
+
+  bool mesi;
+  cache_sim_t* l2;
+  std::vector<cache_sim_t*> ic;
+  std::vector<cache_sim_t*> dc;
+  std::vector<tracer_t> tracers;
+  std::unordered_map<uint64_t, dir_entry_t> dir;  // D$ line address -> entry
+  size_t line_shift;
+
+  uint64_t invalidations;
+  uint64_t upgrades;
+  uint64_t downgrades;
+  uint64_t coherence_misses;
+  size_t sample_ratio;
+};
+
+// Feeds the cache models hooked into it from a background thread.  The
+// simulation thread only appends each traced access or clean/invalidate to
+// a lock-free single-producer / single-consumer ring, and the thread replays
+// them in order, so the statistics come out exactly as if the caches were
+// driven directly.  Every hart must register the same instance, and all of
+// them must run on one host thread.  Destroying it drains the ring, so it
+// must go before the caches it feeds.
+class cache_sim_thread_t : public memtracer_t
+{
+ public:
+  cache_sim_thread_t();
+  ~cache_sim_thread_t();
+
+  void hook(memtracer_t* h) { caches.hook(h); }
+
+  bool interested_in_range(uint64_t begin, uint64_t end, access_type type)
+  {
+    return caches.interested_in_range(begin, end, type);
+  }
+  void trace(uint64_t addr, size_t bytes, access_type type)
+  {
+    push(request_t{addr, (uint32_t)bytes, type, false, false, false, 0});
+  }
+  void clean_invalidate(uint64_t addr, size_t bytes, bool clean, bool inval)
+  {
+    push(request_t{addr, (uint32_t)bytes, LOAD, true, clean, inval, 0});
+  }
+  void trace_batch(const access_record_t* recs, size_t n);
+  // Waits until the caches have seen everything queued so far.
+  void sync();
+
+ private:
+  struct request_t {
+    uint64_t addr;
+    uint32_t bytes;
+    access_type type;
+    bool is_cmo;  // a clean_invalidate rather than an access
+    bool clean;
+    bool inval;
+    uint64_t pc;
+  };
+
+  // Must be a power of two.
+  static const size_t RING_SIZE = 1 << 16;
+
+  void push(const request_t& req)
+  {
+    size_t h = head.load(std::memory_order_relaxed);
+    // Apply back-pressure when the cache thread falls behind.
+    while (h - tail.load(std::memory_order_acquire) >= RING_SIZE)
+      std::this_thread::yield();
+    ring[h & (RING_SIZE - 1)] = req;
+    head.store(h + 1, std::memory_order_release);
+  }
+
+  void drain();
+  void worker_main();
+
+  memtracer_list_t caches;
+  request_t* ring;
+
+  // Producer-owned and consumer-owned indices live on separate cache lines.
+  alignas(64) std::atomic<size_t> head;
+  alignas(64) std::atomic<size_t> tail;
+  alignas(64) std::atomic<bool> stop;
+
+  std::thread worker;
 };
 
 #endif
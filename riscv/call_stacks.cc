@@ -0,0 +1,134 @@
+// See LICENSE for license details.
+
+#include "call_stacks.h"
+#include "processor.h"
+#include <cinttypes>
+#include <stdexcept>
+
+call_stack_profiler_t::call_stack_profiler_t(const char* filename, processor_t* proc)
+  : proc(proc), stack(nullptr), next_pc(0), block_insns(0)
+{
+  file = fopen(filename, "w");
+  if (!file)
+    throw std::runtime_error(std::string("could not open call stack file ") + filename);
+}
+
+call_stack_profiler_t::~call_stack_profiler_t()
+{
+  if (block_insns != 0)
+    end_block();
+
+  std::unordered_map<size_t, std::string> roots;
+  for (auto& it : stacks) {
+    reg_t satp = it.first.first, prv = it.first.second;
+    char name[48];
+    if (satp != 0)
+      snprintf(name, sizeof(name), "[%c satp 0x%" PRIx64 "]", "USHM"[prv & 3], satp);
+    else
+      snprintf(name, sizeof(name), "[%c]", "USHM"[prv & 3]);
+    roots[it.second.root] = name;
+  }
+
+  for (size_t i = 0; i < nodes.size(); i++) {
+    if (nodes[i].insns == 0)
+      continue;
+    std::vector<std::string> names;
+    size_t n = i;
+    for (; nodes[n].caller != n; n = nodes[n].caller)
+      names.push_back(frame_name(nodes[n].func));
+    names.push_back(roots[n]);
+    for (auto it = names.rbegin(); it != names.rend(); ++it)
+      fprintf(file, "%s%s", it == names.rbegin() ? "" : ";", it->c_str());
+    fprintf(file, " %" PRIu64 "\n", nodes[i].insns);
+  }
+  fclose(file);
+}
+
+std::string call_stack_profiler_t::frame_name(reg_t func)
+{
+  uint64_t start;
+  const char* symbol = proc->get_enclosing_symbol(func, &start);
+  if (symbol)
+    return symbol;
+  char name[24];
+  snprintf(name, sizeof(name), "0x%" PRIx64, func);
+  return name;
+}
+
+void call_stack_profiler_t::switch_stack()
+{
+  // M-mode does not translate, whatever satp holds.
+  reg_t prv = proc->get_state()->prv;
+  std::pair<reg_t, reg_t> now(prv == PRV_M ? 0 : proc->get_state()->satp->read(), prv);
+  if (stack && now == context)
+    return;
+  context = now;
+  auto it = stacks.find(now);
+  if (it == stacks.end()) {
+    size_t root = nodes.size();
+    nodes.push_back({0, root, 0, {}});
+    it = stacks.emplace(now, stack_t{root, root, {}, 0}).first;
+  }
+  stack = &it->second;
+}
+
+size_t call_stack_profiler_t::callee(size_t node, reg_t func)
+{
+  auto it = nodes[node].callees.find(func);
+  if (it != nodes[node].callees.end())
+    return it->second;
+  nodes.push_back({func, node, 0, {}});
+  nodes[node].callees[func] = nodes.size() - 1;
+  return nodes.size() - 1;
+}
+
+static bool is_link_reg(reg_t r)
+{
+  return r == 1 || r == 5;
+}
+
+void call_stack_profiler_t::follow(reg_t pc, reg_t npc, insn_t insn)
+{
+  insn_bits_t bits = insn.bits();
+  bool call = false, ret = false;
+  if ((bits & 3) == 3) {
+    reg_t rd = (bits >> 7) & 31, rs1 = (bits >> 15) & 31;
+    if ((bits & 0x7f) == 0x6f) {         // jal
+      call = is_link_reg(rd);
+    } else if ((bits & 0x7f) == 0x67) {  // jalr
+      call = is_link_reg(rd);
+      ret = rd == 0 && is_link_reg(rs1);
+    }
+  } else {
+    reg_t rs1 = (bits >> 7) & 31;
+    if ((bits & 0xf07f) == 0x9002 && rs1 != 0)       // c.jalr
+      call = true;
+    else if ((bits & 0xf07f) == 0x8002 && rs1 != 0)  // c.jr
+      ret = is_link_reg(rs1);
+    else if ((bits & 0xe003) == 0x2001 && proc->get_xlen() == 32)  // c.jal
+      call = true;
+  }
+
+  if (call) {
+    if (stack->frames.size() == MAX_DEPTH) {
+      stack->dropped++;
+      return;
+    }
+    stack->frames.emplace_back(pc + insn.length(), stack->node);
+    stack->node = callee(stack->node, npc);
+  } else if (ret) {
+    if (stack->dropped != 0) {
+      stack->dropped--;
+      return;
+    }
+    // Unwind to the call this returns from, if it is on the stack, so a
+    // longjmp or a missed return resynchronizes at the next return.
+    for (size_t i = stack->frames.size(); i-- > 0; ) {
+      if (stack->frames[i].first == npc) {
+        stack->node = stack->frames[i].second;
+        stack->frames.resize(i);
+        return;
+      }
+    }
+  }
+}
@@ -0,0 +1,84 @@
+// See LICENSE for license details.
+#ifndef _RISCV_CALL_STACKS_H
+#define _RISCV_CALL_STACKS_H
+
+#include "decode.h"
+#include <cstdio>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+class processor_t;
+
+// Counts the instructions one hart retires per call stack.  A shadow stack
+// follows calls (jal and jalr linking ra or t0) and returns (jalr x0
+// through ra or t0), looking only at the last instruction of each basic
+// block.  Every address space (satp) and privilege mode has a stack of its
+// own, taken from the block's first instruction, so a kernel's context
+// switches move between processes' stacks; code outside any call seen is
+// charged to a root frame naming the stack.  At exit the counts are written
+// in the collapsed format of FlameGraph's flamegraph.pl, one
+// "outer;...;inner count" line per stack, from which the exclusive count of
+// a function is its own lines' and the inclusive count every line it is in.
+class call_stack_profiler_t
+{
+public:
+  call_stack_profiler_t(const char* filename, processor_t* proc);
+  ~call_stack_profiler_t();
+
+  // Called for every retired instruction; npc is the next PC it produced.
+  void retire(reg_t pc, reg_t npc, insn_t insn)
+  {
+    if (block_insns != 0 && pc != next_pc)
+      end_block();  // a trap redirected control flow
+    if (block_insns++ == 0)
+      switch_stack();
+    next_pc = npc;
+    if (npc != pc + insn.length()) {
+      end_block();
+      follow(pc, npc, insn);
+    }
+  }
+
+private:
+  // Deeper calls are counted in the deepest frame, so runaway recursion
+  // cannot grow the tree without bound.
+  static const size_t MAX_DEPTH = 1024;
+
+  // A node is a call stack, identified by its innermost function's entry
+  // point and the node of its caller.
+  struct node_t {
+    reg_t func;
+    size_t caller;
+    uint64_t insns;
+    std::unordered_map<reg_t, size_t> callees;
+  };
+
+  struct stack_t {
+    size_t root;  // its own caller, named after the stack's context
+    size_t node;
+    // Return address and caller's node of each call still in progress
+    std::vector<std::pair<reg_t, size_t>> frames;
+    size_t dropped;  // calls beyond MAX_DEPTH still in progress
+  };
+
+  void end_block() { nodes[stack->node].insns += block_insns; block_insns = 0; }
+  void switch_stack();
+  void follow(reg_t pc, reg_t npc, insn_t insn);
+  size_t callee(size_t node, reg_t func);
+  std::string frame_name(reg_t func);
+
+  FILE* file;
+  processor_t* proc;
+  std::vector<node_t> nodes;
+  // By satp and privilege
+  std::map<std::pair<reg_t, reg_t>, stack_t> stacks;
+  std::pair<reg_t, reg_t> context;
+  stack_t* stack;
+  reg_t next_pc;
+  uint64_t block_insns;
+};
+
+#endif
@@ -0,0 +1,364 @@
+// See LICENSE for license details.
+
+#include "checkpoint.h"
+#include "sim.h"
+#include "mmu.h"
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <unistd.h>
+
+checkpoint_writer_t::checkpoint_writer_t(const char* path)
+  : buf(nullptr), offset(0)
+{
+  file = fopen(path, "wb");
+  if (!file)
+    throw std::runtime_error(std::string("could not create checkpoint ") + path);
+}
+
+checkpoint_writer_t::checkpoint_writer_t(std::vector<char>* buf)
+  : file(nullptr), buf(buf), offset(0)
+{
+}
+
+checkpoint_writer_t::~checkpoint_writer_t()
+{
+  if (file)
+    fclose(file);
+}
+
+void checkpoint_writer_t::write(const void* data, size_t len)
+{
+  if (buf)
+    buf->insert(buf->end(), (const char*)data, (const char*)data + len);
+  else if (fwrite(data, 1, len, file) != len)
+    throw std::runtime_error("error writing checkpoint");
+  offset += len;
+}
+
+void checkpoint_writer_t::align(size_t boundary)
+{
+  static const char zeros[64] = {0};
+  while (offset % boundary != 0)
+    write(zeros, std::min(sizeof(zeros), boundary - offset % boundary));
+}
+
+checkpoint_reader_t::checkpoint_reader_t(const char* path)
+  : buf(nullptr), offset(0)
+{
+  file_fd = open(path, O_RDONLY);
+  if (file_fd < 0)
+    throw std::runtime_error(std::string("could not open checkpoint ") + path);
+}
+
+checkpoint_reader_t::checkpoint_reader_t(const std::vector<char>& buf)
+  : file_fd(-1), buf(&buf), offset(0)
+{
+}
+
+checkpoint_reader_t::~checkpoint_reader_t()
+{
+  if (file_fd >= 0)
+    close(file_fd);
+}
+
+void checkpoint_reader_t::read(void* data, size_t len)
+{
+  if (buf) {
+    if (offset + len > buf->size())
+      throw std::runtime_error("truncated checkpoint");
+    memcpy(data, buf->data() + offset, len);
+  } else if (pread(file_fd, data, len, offset) != ssize_t(len)) {
+    throw std::runtime_error("truncated checkpoint");
+  }
+  offset += len;
+}
+
+void checkpoint_reader_t::align(size_t boundary)
+{
+  offset += (boundary - offset % boundary) % boundary;
+}
+
+void checkpoint_reader_t::skip(size_t len)
+{
+  offset += len;
+}
+
+void processor_t::save_checkpoint(checkpoint_writer_t& ckpt)
+{
+  ckpt.put<reg_t>(state.pc);
+  ckpt.put<reg_t>(state.prv);
+  ckpt.put<uint8_t>(state.v);
+  for (size_t i = 0; i < NXPR; i++)
+    ckpt.put<reg_t>(state.XPR[i]);
+  for (size_t i = 0; i < NFPR; i++)
+    ckpt.put<freg_t>(state.FPR[i]);
+
+  // tdata1 and tdata2 only show the trigger tselect selects, so every
+  // trigger is saved on its own below.
+  std::vector<reg_t> csrs;
+  for (auto& csr : state.csrmap)
+    if (csr.first != CSR_TDATA1 && csr.first != CSR_TDATA2 && csr.first != CSR_TDATA3)
+      csrs.push_back(csr.first);
+  std::sort(csrs.begin(), csrs.end());
+  ckpt.put<uint32_t>(csrs.size());
+  for (auto addr : csrs) {
+    ckpt.put<reg_t>(addr);
+    ckpt.put<reg_t>(state.csrmap[addr]->read());
+  }
+
+  ckpt.put<uint32_t>(TM.count());
+  for (unsigned i = 0; i < TM.count(); i++) {
+    ckpt.put<reg_t>(TM.tdata1_read(this, i));
+    ckpt.put<reg_t>(TM.tdata2_read(this, i));
+  }
+
+  ckpt.put<reg_t>(VU.VLEN);
+  if (VU.VLEN != 0)
+    ckpt.write(VU.reg_file, NVPR * VU.vlenb);
+}
+
+// The hart is expected to be freshly reset, as it is when a checkpoint is
+// restored at startup.
+void processor_t::restore_checkpoint(checkpoint_reader_t& ckpt)
+{
+  state.pc = ckpt.get<reg_t>();
+  reg_t prv = ckpt.get<reg_t>();
+  bool v = ckpt.get<uint8_t>();
+  for (size_t i = 0; i < NXPR; i++)
+    state.XPR.write(i, ckpt.get<reg_t>());
+  for (size_t i = 0; i < NFPR; i++)
+    state.FPR.write(i, ckpt.get<freg_t>());
+
+  // The vector configuration and the counters need special handling.
+  std::map<reg_t, reg_t> saved;
+  uint32_t ncsrs = ckpt.get<uint32_t>();
+  for (uint32_t i = 0; i < ncsrs; i++) {
+    reg_t addr = ckpt.get<reg_t>();
+    reg_t val = ckpt.get<reg_t>();
+    if (!state.csrmap.count(addr))
+      throw std::runtime_error("checkpoint has a CSR this hart lacks");
+    saved[addr] = val;
+  }
+  restore_csrs(saved);
+
+  // A trigger's tdata2 is written first, since setting dmode in its tdata1
+  // makes both read-only outside debug mode.
+  if (ckpt.get<uint32_t>() != TM.count())
+    throw std::runtime_error("checkpoint was taken with a different number of triggers");
+  for (unsigned i = 0; i < TM.count(); i++) {
+    reg_t tdata1 = ckpt.get<reg_t>();
+    TM.tdata2_write(this, i, ckpt.get<reg_t>());
+    TM.tdata1_write(this, i, tdata1);
+  }
+
+  // Counter writes are pre-decremented to absorb the bump that follows an
+  // instruction, so undo that here.
+  state.minstret->write(saved[CSR_MINSTRET]);
+  state.minstret->bump(1);
+  state.mcycle->write(saved[CSR_MCYCLE]);
+  state.mcycle->bump(1);
+
+  reg_t vlen = ckpt.get<reg_t>();
+  if (vlen != VU.VLEN)
+    throw std::runtime_error("checkpoint was taken with a different VLEN");
+  if (VU.VLEN != 0) {
+    ckpt.read(VU.reg_file, NVPR * VU.vlenb);
+    VU.set_vl(1, 1, saved[CSR_VL], saved[CSR_VTYPE]);
+    VU.vstart->write_raw(saved[CSR_VSTART]);
+  }
+
+  set_privilege(prv);
+  set_virt(v);
+  mmu->flush_tlb();
+  mmu->flush_g_stage();
+  mmu->flush_icache();
+  mmu->yield_load_reservation();
+}
+
+// The order restore_csrs writes CSRs in.  misa decides which fields of the
+// others exist, and mstatus, the envcfgs and the delegations what the S
+// and VS views accept.  pmpaddr has to be written before pmpcfg can lock
+// it, and mseccfg's sticky bits set only once the PMP entries are in.
+// The address translation registers go last.
+static int csr_restore_rank(reg_t addr)
+{
+  switch (addr) {
+    case CSR_MISA:
+      return 0;
+    case CSR_MSTATUS: case CSR_MSTATUSH: case CSR_HSTATUS:
+    case CSR_MENVCFG: case CSR_MENVCFGH: case CSR_HENVCFG: case CSR_HENVCFGH:
+    case CSR_MEDELEG: case CSR_MIDELEG: case CSR_HEDELEG: case CSR_HIDELEG:
+      return 1;
+    case CSR_MSECCFG: case CSR_MSECCFGH:
+      return 5;
+    case CSR_SATP: case CSR_HGATP: case CSR_VSATP:
+      return 6;
+  }
+  if (addr >= CSR_PMPADDR0 && addr <= CSR_PMPADDR63)
+    return 3;
+  if (addr >= CSR_PMPCFG0 && addr <= CSR_PMPCFG15)
+    return 4;
+  return 2;
+}
+
+// CSRs are written back through their normal write paths, so derived state
+// (e.g. the MMU mode) is rebuilt as a side effect.
+void processor_t::restore_csrs(const std::map<reg_t, reg_t>& csrs)
+{
+  std::vector<std::pair<reg_t, reg_t>> ordered(csrs.begin(), csrs.end());
+  std::stable_sort(ordered.begin(), ordered.end(),
+                   [](const std::pair<reg_t, reg_t>& a, const std::pair<reg_t, reg_t>& b) {
+                     return csr_restore_rank(a.first) < csr_restore_rank(b.first);
+                   });
+  for (auto& [addr, val] : ordered)
+    if (addr != CSR_VL && addr != CSR_VTYPE && addr != CSR_VSTART)
+      state.csrmap.at(addr)->write(val);
+
+  // The bits the CLINT and the PLIC drive are read-only to CSR writes, and
+  // msip is kept nowhere else.
+  auto mip = csrs.find(CSR_MIP);
+  if (mip != csrs.end())
+    state.mip->backdoor_write_with_mask(~reg_t(0), mip->second);
+}
+
+static bool page_is_zero(const char* page)
+{
+  const uint64_t* words = (const uint64_t*)page;
+  for (size_t i = 0; i < PGSIZE / sizeof(uint64_t); i++)
+    if (words[i] != 0)
+      return false;
+  return true;
+}
+
+// Flat memories do not track which pages were touched, so only their
+// nonzero pages are saved; both kinds restore from the same format.
+void mem_t::save_checkpoint(checkpoint_writer_t& ckpt)
+{
+  std::vector<std::pair<reg_t, char*>> pages;
+  if (flat_base) {
+    for (reg_t ppn = 0; ppn < sz / PGSIZE; ppn++)
+      if (!page_is_zero(flat_base + ppn * PGSIZE))
+        pages.push_back(std::make_pair(ppn, flat_base + ppn * PGSIZE));
+  } else {
+    pages.assign(sparse_memory_map.begin(), sparse_memory_map.end());
+  }
+
+  ckpt.put<reg_t>(sz);
+  ckpt.put<uint64_t>(pages.size());
+  for (auto& page : pages)
+    ckpt.put<reg_t>(page.first);
+  ckpt.align(PGSIZE);
+  for (auto& page : pages)
+    ckpt.write(page.second, PGSIZE);
+}
+
+// Pages are mapped copy-on-write straight from the checkpoint file, so
+// restoring costs one mapping plus a page fault per page actually touched.
+void mem_t::restore_checkpoint(checkpoint_reader_t& ckpt)
+{
+  if (ckpt.get<reg_t>() != sz)
+    throw std::runtime_error("checkpoint memory size does not match");
+
+  uint64_t npages = ckpt.get<uint64_t>();
+  std::vector<reg_t> ppns(npages);
+  for (auto& ppn : ppns)
+    ppn = ckpt.get<reg_t>();
+  ckpt.align(PGSIZE);
+
+  if (flat_base) {
+    // Dropping file-backed pages would bring back the file's contents, so
+    // such a memory is mapped afresh.
+    if (!flat_discardable) {
+      if (!reserve_flat(flat_base))
+        throw std::runtime_error("could not reset flat memory");
+    } else {
+      madvise(flat_base, sz, MADV_DONTNEED);
+    }
+    for (auto ppn : ppns) {
+      if (ppn >= sz / PGSIZE)
+        throw std::runtime_error("checkpoint page lies outside memory");
+      ckpt.read(flat_base + ppn * PGSIZE, PGSIZE);
+    }
+    return;
+  }
+
+  for (auto& page : sparse_memory_map)
+    free_page(page.second);
+  sparse_memory_map.clear();
+  unmap_all();
+
+  size_t len = npages * PGSIZE;
+  char* base = nullptr;
+  if (npages != 0) {
+    base = map_pages(len, ckpt.fd(), ckpt.tell());
+    if (!base)
+      throw std::runtime_error("could not map checkpoint memory");
+  }
+
+  for (uint64_t i = 0; i < npages; i++)
+    sparse_memory_map[ppns[i]] = base + i * PGSIZE;
+  ckpt.skip(len);
+}
+
+void clint_t::save_checkpoint(checkpoint_writer_t& ckpt)
+{
+  increment(0);
+  ckpt.put<mtime_t>(mtime);
+  for (auto cmp : mtimecmp)
+    ckpt.put<mtimecmp_t>(cmp);
+}
+
+void clint_t::restore_checkpoint(checkpoint_reader_t& ckpt)
+{
+  mtime = ckpt.get<mtime_t>();
+  for (auto& cmp : mtimecmp)
+    cmp = ckpt.get<mtimecmp_t>();
+  sync_all();
+  increment(0);
+}
+
+void sim_t::save_checkpoint(const char* path)
+{
+  checkpoint_writer_t ckpt(path);
+  ckpt.put<uint64_t>(CHECKPOINT_MAGIC);
+  ckpt.put<uint32_t>(CHECKPOINT_VERSION);
+  ckpt.put<uint32_t>(procs.size());
+  ckpt.put<uint32_t>(mems.size());
+  ckpt.put<uint8_t>(clint != nullptr);
+
+  for (auto proc : procs)
+    proc->save_checkpoint(ckpt);
+  if (clint)
+    clint->save_checkpoint(ckpt);
+  for (auto& mem : mems) {
+    ckpt.put<reg_t>(mem.first);
+    mem.second->save_checkpoint(ckpt);
+  }
+}
+
+void sim_t::restore_checkpoint(const char* path)
+{
+  checkpoint_reader_t ckpt(path);
+  if (ckpt.get<uint64_t>() != CHECKPOINT_MAGIC ||
+      ckpt.get<uint32_t>() != CHECKPOINT_VERSION)
+    throw std::runtime_error(std::string(path) + " is not a spike checkpoint");
+  if (ckpt.get<uint32_t>() != procs.size() ||
+      ckpt.get<uint32_t>() != mems.size() ||
+      ckpt.get<uint8_t>() != (clint != nullptr))
+    throw std::runtime_error("checkpoint was taken on a different machine configuration");
+
+  for (auto proc : procs)
+    proc->restore_checkpoint(ckpt);
+  if (clint)
+    clint->restore_checkpoint(ckpt);
+  for (auto& mem : mems) {
+    if (ckpt.get<reg_t>() != mem.first)
+      throw std::runtime_error("checkpoint memory layout does not match");
+    mem.second->restore_checkpoint(ckpt);
+  }
+}
@@ -0,0 +1,62 @@
+// See LICENSE for license details.
+#ifndef _RISCV_CHECKPOINT_H
+#define _RISCV_CHECKPOINT_H
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#include <sys/types.h>
+
+// A checkpoint file is a flat sequence of fixed-size fields written in host
+// byte order, so it is only meant to be restored by the same spike build on
+// the same kind of host.  Memory pages are stored page-aligned so that they
+// can be mapped straight from the file on restore.
+#define CHECKPOINT_MAGIC   0x504b43454b495053ULL  // "SPIKECKP"
+#define CHECKPOINT_VERSION 2
+
+class checkpoint_writer_t
+{
+public:
+  checkpoint_writer_t(const char* path);
+  // Appends to buf instead of writing a file.
+  checkpoint_writer_t(std::vector<char>* buf);
+  ~checkpoint_writer_t();
+
+  void write(const void* data, size_t len);
+  template<typename T> void put(const T& value) { write(&value, sizeof(value)); }
+
+  // Zero-pad the file up to a multiple of boundary.
+  void align(size_t boundary);
+
+private:
+  FILE* file;
+  std::vector<char>* buf;
+  off_t offset;
+};
+
+class checkpoint_reader_t
+{
+public:
+  checkpoint_reader_t(const char* path);
+  // Reads what a checkpoint_writer_t appended to buf, which has no fd().
+  checkpoint_reader_t(const std::vector<char>& buf);
+  ~checkpoint_reader_t();
+
+  void read(void* data, size_t len);
+  template<typename T> T get() { T value; read(&value, sizeof(value)); return value; }
+
+  // Skip the padding written by checkpoint_writer_t::align.
+  void align(size_t boundary);
+  void skip(size_t len);
+
+  // The open file and current position, for mapping data in place.
+  int fd() const { return file_fd; }
+  off_t tell() const { return offset; }
+
+private:
+  int file_fd;
+  const std::vector<char>* buf;
+  off_t offset;
+};
+
+#endif
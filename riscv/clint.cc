@@ -1,16 +1,33 @@
-#include <sys/time.h>
+#include <algorithm>
+#include <limits>
+#include <time.h>
 #include "devices.h"
 #include "processor.h"
+#include "replay_log.h"
 
-clint_t::clint_t(std::vector<processor_t*>& procs, uint64_t freq_hz, bool real_time)
-  : procs(procs), freq_hz(freq_hz), real_time(real_time), mtime(0), mtimecmp(procs.size())
+clint_t::clint_t(std::vector<processor_t*>& procs, uint64_t freq_hz, bool real_time,
+                 uint64_t real_time_precision_ns)
+  : procs(procs), freq_hz(freq_hz), real_time(real_time),
+    real_time_precision_ns(std::max<uint64_t>(real_time_precision_ns, 1)),
+    mtime(0), mtimecmp(procs.size()), next_deadline(procs.size())
 {
-  struct timeval base;
+  // CLOCK_MONOTONIC is read without a system call and, unlike the wall
+  // clock, never steps back.  Its coarse variant, which only returns the
+  // time of the host's last tick, is cheaper still when that is precise
+  // enough.
+  host_clock = CLOCK_MONOTONIC;
+#ifdef CLOCK_MONOTONIC_COARSE
+  struct timespec res;
+  if (clock_getres(CLOCK_MONOTONIC_COARSE, &res) == 0 && res.tv_sec == 0 &&
+      uint64_t(res.tv_nsec) <= real_time_precision_ns)
+    host_clock = CLOCK_MONOTONIC_COARSE;
+#endif
+  real_time_ref_ns = 0;
+  real_time_ref_ns = real_time_ns();
 
-  gettimeofday(&base, NULL);
-
-  real_time_ref_secs = base.tv_sec;
-  real_time_ref_usecs = base.tv_usec;
+  for (size_t i = 0; i < procs.size(); i++)
+    hart_index[procs[i]] = i;
+  sync_all();
 }
 
 /* 0000 msip hart 0
@@ -60,31 +77,123 @@ bool clint_t::store(reg_t addr, size_t len, const uint8_t* bytes)
     }
   } else if (addr >= MTIMECMP_BASE && addr + len <= MTIMECMP_BASE + procs.size()*sizeof(mtimecmp_t)) {
     memcpy((uint8_t*)&mtimecmp[0] + addr - MTIMECMP_BASE, bytes, len);
+    for (size_t i = (addr - MTIMECMP_BASE) / sizeof(mtimecmp_t);
+         i <= (addr + len - 1 - MTIMECMP_BASE) / sizeof(mtimecmp_t); i++)
+      sync_hart(i);
   } else if (addr >= MTIME_BASE && addr + len <= MTIME_BASE + sizeof(mtime_t)) {
     memcpy((uint8_t*)&mtime + addr - MTIME_BASE, bytes, len);
+    sync_all();
   } else {
     return false;
   }
   increment(0);
+  if (store_hook)
+    store_hook(addr, len, bytes);
   return true;
 }
 
 void clint_t::increment(reg_t inc)
 {
+  mtime_t old_mtime = mtime;
   if (real_time) {
-   struct timeval now;
-   uint64_t diff_usecs;
-
-   gettimeofday(&now, NULL);
-   diff_usecs = ((now.tv_sec - real_time_ref_secs) * 1000000) + (now.tv_usec - real_time_ref_usecs);
-   mtime = diff_usecs * freq_hz / 1000000;
+    uint64_t ns = real_time_ns();
+    mtime = replay_value(REPLAY_HOST, REPLAY_MTIME,
+                         ns / 1000000000 * freq_hz + ns % 1000000000 * freq_hz / 1000000000);
   } else {
     mtime += inc;
   }
-  for (size_t i = 0; i < procs.size(); i++) {
-    procs[i]->state.time->sync(mtime);
-    procs[i]->state.mip->backdoor_write_with_mask(MIP_MTIP, 0);
-    if (mtime >= mtimecmp[i])
-      procs[i]->state.mip->backdoor_write_with_mask(MIP_MTIP, MIP_MTIP);
+
+  // Time ran backwards, e.g. by wrapping around; every deadline may have
+  // moved.
+  if (mtime < old_mtime) {
+    sync_all();
+    return;
+  }
+
+  while (!deadlines.empty() && deadlines.top().first <= mtime) {
+    deadline_t d = deadlines.top();
+    deadlines.pop();
+    if (next_deadline[d.second] == d.first)
+      sync_hart(d.second);
+  }
+}
+
+uint64_t clint_t::real_time_ns()
+{
+  struct timespec now;
+  clock_gettime(host_clock, &now);
+  uint64_t ns = uint64_t(now.tv_sec) * 1000000000 + now.tv_nsec - real_time_ref_ns;
+  return ns - ns % real_time_precision_ns;
+}
+
+void clint_t::advance_to_next_timer()
+{
+  if (real_time)
+    return;
+  while (!deadlines.empty() && next_deadline[deadlines.top().second] != deadlines.top().first)
+    deadlines.pop();
+  if (!deadlines.empty())
+    increment(deadlines.top().first - mtime);
+}
+
+void clint_t::timer_changed(processor_t* proc)
+{
+  auto it = hart_index.find(proc);
+  if (it != hart_index.end())
+    sync_hart(it->second);
+}
+
+void clint_t::set_mtime(uint64_t value)
+{
+  mtime = value;
+  sync_all();
+}
+
+void clint_t::set_mtimecmp(size_t hart, uint64_t value)
+{
+  mtimecmp[hart] = value;
+  sync_hart(hart);
+}
+
+void clint_t::sync_hart(size_t i)
+{
+  const mtime_t never = std::numeric_limits<mtime_t>::max();
+  state_t& state = procs[i]->state;
+
+  state.time->set_clock(&mtime);
+  state.time->sync(mtime);
+  state.mip->backdoor_write_with_mask(MIP_MTIP, mtime >= mtimecmp[i] ? MIP_MTIP : 0);
+
+  mtime_t next = never;
+  if (mtimecmp[i] > mtime)
+    next = mtimecmp[i];
+  if (procs[i]->extension_enabled(EXT_SSTC)) {
+    mtime_t s = state.stimecmp->read();
+    mtime_t vs = state.vstimecmp->read() - state.htimedelta->read();
+    if (s > mtime)
+      next = std::min(next, s);
+    if (vs > mtime)
+      next = std::min(next, vs);
+  }
+
+  next_deadline[i] = next;
+  if (next != never)
+    deadlines.emplace(next, i);
+
+  // Rewritten compare registers leave dead entries behind; drop them once
+  // they outnumber the live ones.
+  if (deadlines.size() > 4 * procs.size() + 64) {
+    decltype(deadlines) live;
+    for (size_t j = 0; j < procs.size(); j++)
+      if (next_deadline[j] != never)
+        live.emplace(next_deadline[j], j);
+    deadlines.swap(live);
   }
 }
+
+void clint_t::sync_all()
+{
+  deadlines = decltype(deadlines)();
+  for (size_t i = 0; i < procs.size(); i++)
+    sync_hart(i);
+}
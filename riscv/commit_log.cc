@@ -0,0 +1,79 @@
+// See LICENSE for license details.
+
+#include "commit_log.h"
+#include <algorithm>
+#include <cassert>
+#include <cinttypes>
+#include <cstdlib>
+#include <cstring>
+
+void commit_log_print_value(FILE *log_file, int width, const void *data)
+{
+  assert(log_file);
+
+  switch (width) {
+    case 8:
+      fprintf(log_file, "0x%01" PRIx8, *(const uint8_t *)data);
+      break;
+    case 16:
+      fprintf(log_file, "0x%04" PRIx16, *(const uint16_t *)data);
+      break;
+    case 32:
+      fprintf(log_file, "0x%08" PRIx32, *(const uint32_t *)data);
+      break;
+    case 64:
+      fprintf(log_file, "0x%016" PRIx64, *(const uint64_t *)data);
+      break;
+    default:
+      // max lengh of vector
+      if (((width - 1) & width) == 0) {
+        const uint64_t *arr = (const uint64_t *)data;
+
+        fprintf(log_file, "0x");
+        for (int idx = width / 64 - 1; idx >= 0; --idx) {
+          fprintf(log_file, "%016" PRIx64, arr[idx]);
+        }
+      } else {
+        abort();
+      }
+      break;
+  }
+}
+
+void commit_log_print_value(FILE *log_file, int width, uint64_t val)
+{
+  commit_log_print_value(log_file, width, &val);
+}
+
+commit_log_writer_t::commit_log_writer_t(FILE* file, bool compact, size_t capacity)
+  : file(file), compact_vregs(compact), buf(capacity), used(0)
+{
+}
+
+commit_log_writer_t::~commit_log_writer_t()
+{
+  flush();
+}
+
+void commit_log_writer_t::write(const void* data, size_t len)
+{
+  if (used + len > buf.size() && !file)
+    buf.resize(std::max(2 * buf.size(), used + len));
+  if (used + len > buf.size())
+    flush();
+  if (len > buf.size()) {
+    fwrite(data, 1, len, file);
+    return;
+  }
+  memcpy(&buf[used], data, len);
+  used += len;
+}
+
+void commit_log_writer_t::flush()
+{
+  if (!file)
+    return;
+  if (used != 0)
+    fwrite(buf.data(), 1, used, file);
+  used = 0;
+}
@@ -0,0 +1,102 @@
+// See LICENSE for license details.
+#ifndef _RISCV_COMMIT_LOG_H
+#define _RISCV_COMMIT_LOG_H
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+// A binary commit log starts with COMMIT_LOG_MAGIC and then holds one
+// record per retired instruction, in host byte order:
+//
+//   commit_log_insn_t
+//   commit_log_vconfig_t, if flags has COMMIT_LOG_VCONFIG
+//   nregs  x (uint32_t key, value): the key is the log_reg_write key; the
+//            value is 8 bytes for x and CSR registers, 16 bytes for f
+//            registers, vlen / 8 bytes for v registers and absent for
+//            vector element writes.  If flags has COMMIT_LOG_VBYTES, a v
+//            register's value is instead a commit_log_vbytes_t and the
+//            bytes it covers, those the instruction wrote.
+//   nloads x uint64_t address
+//   nstores x commit_log_store_t
+//
+// spike-commit-decode renders it in the --log-commits text format.
+#define COMMIT_LOG_MAGIC "SPIKECL1"
+#define COMMIT_LOG_MAGIC_LEN 8
+
+enum {
+  COMMIT_LOG_VCONFIG = 1,
+  COMMIT_LOG_VBYTES = 2,
+};
+
+struct commit_log_insn_t
+{
+  uint32_t core;
+  uint8_t priv;
+  uint8_t xlen;
+  uint8_t flen;
+  uint8_t insn_len;
+  uint64_t pc;
+  uint64_t insn;
+  uint16_t nregs;
+  uint16_t nloads;
+  uint16_t nstores;
+  uint16_t flags;
+};
+
+struct commit_log_vconfig_t
+{
+  uint64_t vsew;
+  uint64_t lmul;       // LMUL, or 1/LMUL if fractional
+  uint64_t vl;
+  uint32_t vlen;
+  uint32_t fractional;
+};
+
+// Bytes [offset, offset + bytes) of a vector register, counting from its
+// least-significant byte
+struct commit_log_vbytes_t
+{
+  uint32_t offset;
+  uint32_t bytes;
+};
+
+struct commit_log_store_t
+{
+  uint64_t addr;
+  uint64_t value;
+  uint64_t size;
+};
+
+// Print a width-bit value the way the text commit log does.
+void commit_log_print_value(FILE* log_file, int width, const void* data);
+void commit_log_print_value(FILE* log_file, int width, uint64_t val);
+
+// Collects one hart's binary records and writes them to the log file in
+// large blocks.  A compact writer logs vector registers as
+// COMMIT_LOG_VBYTES records.  Without a file, the records stay in the
+// buffer, which grows as needed, until the owner takes them with data()
+// and size() and then calls clear().
+class commit_log_writer_t
+{
+public:
+  commit_log_writer_t(FILE* file, bool compact = false, size_t capacity = 1 << 20);
+  ~commit_log_writer_t();
+
+  bool compact() const { return compact_vregs; }
+  void write(const void* data, size_t len);
+  template<typename T> void put(const T& value) { write(&value, sizeof(value)); }
+  void flush();
+
+  const char* data() const { return buf.data(); }
+  size_t size() const { return used; }
+  void clear() { used = 0; }
+
+private:
+  FILE* file;
+  bool compact_vregs;
+  std::vector<char> buf;
+  size_t used;
+};
+
+#endif
@@ -0,0 +1,177 @@
+// See LICENSE for license details.
+
+#include "cosim.h"
+#include "commit_log.h"
+#include "sim.h"
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static size_t padded(size_t len)
+{
+  return (len + 7) & ~size_t(7);
+}
+
+static void* map_ring(int fd, size_t size, const char* shm_name)
+{
+  void* base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED)
+    throw std::runtime_error(std::string("could not map cosim ring ") + shm_name);
+  return base;
+}
+
+cosim_t::cosim_t(sim_t* sim, const char* shm_name, size_t capacity, bool compact)
+  : sim(sim), shm_name(shm_name)
+{
+#ifndef RISCV_ENABLE_COMMITLOG
+  throw std::runtime_error("cosimulation needs commit logging; please re-build the "
+                           "riscv-isa-sim project using \"configure --enable-commitlog\"");
+#else
+  if (capacity < 4096 || (capacity & (capacity - 1)))
+    throw std::runtime_error("the cosim ring's capacity must be a power of two of at least 4096");
+
+  int fd = shm_open(shm_name, O_RDWR | O_CREAT | O_TRUNC, 0600);
+  map_size = sizeof(cosim_ring_header_t) + capacity;
+  if (fd < 0 || ftruncate(fd, map_size) != 0) {
+    if (fd >= 0)
+      close(fd);
+    throw std::runtime_error(std::string("could not create cosim ring ") + shm_name);
+  }
+  char* base = (char*)map_ring(fd, map_size, shm_name);
+  ring = (cosim_ring_header_t*)base;
+  records = base + sizeof(cosim_ring_header_t);
+  ring->capacity = capacity;
+  ring->head.store(0);
+  ring->tail.store(0);
+  // A reader that finds the magic finds the rest set up.
+  std::atomic_thread_fence(std::memory_order_release);
+  memcpy(ring->magic, COSIM_RING_MAGIC, COSIM_RING_MAGIC_LEN);
+
+  for (size_t i = 0; i < sim->nprocs(); i++) {
+    sim->get_core(i)->capture_commits(compact);
+    sim->get_core(i)->set_observer(this);
+  }
+#endif
+}
+
+cosim_t::~cosim_t()
+{
+  for (size_t i = 0; i < sim->nprocs(); i++)
+    sim->get_core(i)->set_observer(nullptr);
+  munmap(ring, map_size);
+  shm_unlink(shm_name.c_str());
+}
+
+uint64_t cosim_t::step(size_t hart)
+{
+  uint64_t retired = sim->step_hart(hart, 1);
+  publish_retired(sim->get_core(hart));
+  return retired;
+}
+
+void cosim_t::set_interrupt(size_t hart, uint64_t mask, bool level)
+{
+  sim->get_core(hart)->get_state()->mip->backdoor_write_with_mask(mask, level ? mask : 0);
+}
+
+void cosim_t::override_mmio_load(uint64_t addr, size_t len, uint64_t value)
+{
+  sim->override_mmio_load(addr, len, value);
+}
+
+void cosim_t::trap_taken(processor_t* p, reg_t cause, reg_t epc)
+{
+  // A vector memory instruction that faults partway is logged before its
+  // trap.
+  publish_retired(p);
+  cosim_trap_t trap = {(uint32_t)p->get_id(), 0, cause, epc};
+  push(COSIM_TRAP, &trap, sizeof(trap));
+}
+
+void cosim_t::publish_retired(processor_t* p)
+{
+#ifdef RISCV_ENABLE_COMMITLOG
+  commit_log_writer_t* writer = p->get_commit_log_writer();
+  if (writer->size() != 0) {
+    push(COSIM_RETIRE, writer->data(), writer->size());
+    writer->clear();
+  }
+#endif
+}
+
+void cosim_t::copy_in(uint64_t pos, const void* data, size_t len)
+{
+  size_t offset = pos & (ring->capacity - 1);
+  size_t first = std::min(len, size_t(ring->capacity - offset));
+  memcpy(records + offset, data, first);
+  memcpy(records, (const char*)data + first, len - first);
+}
+
+void cosim_t::push(uint32_t kind, const void* data, size_t len)
+{
+  size_t size = sizeof(cosim_record_t) + padded(len);
+  if (size > ring->capacity)
+    throw std::runtime_error("cosim record does not fit in the ring");
+
+  uint64_t head = ring->head.load(std::memory_order_relaxed);
+  while (head + size - ring->tail.load(std::memory_order_acquire) > ring->capacity)
+    sched_yield();
+
+  cosim_record_t rec = {kind, (uint32_t)len};
+  copy_in(head, &rec, sizeof(rec));
+  copy_in(head + sizeof(rec), data, len);
+  ring->head.store(head + size, std::memory_order_release);
+}
+
+cosim_reader_t::cosim_reader_t(const char* shm_name)
+{
+  int fd = shm_open(shm_name, O_RDWR, 0);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(cosim_ring_header_t)) {
+    if (fd >= 0)
+      close(fd);
+    throw std::runtime_error(std::string("could not open cosim ring ") + shm_name);
+  }
+  map_size = st.st_size;
+  char* base = (char*)map_ring(fd, map_size, shm_name);
+  ring = (cosim_ring_header_t*)base;
+  records = base + sizeof(cosim_ring_header_t);
+  if (memcmp(ring->magic, COSIM_RING_MAGIC, COSIM_RING_MAGIC_LEN) != 0) {
+    munmap(base, map_size);
+    throw std::runtime_error(std::string(shm_name) + " is not a cosim ring");
+  }
+  std::atomic_thread_fence(std::memory_order_acquire);
+}
+
+cosim_reader_t::~cosim_reader_t()
+{
+  munmap(ring, map_size);
+}
+
+void cosim_reader_t::copy_out(uint64_t pos, void* data, size_t len)
+{
+  size_t offset = pos & (ring->capacity - 1);
+  size_t first = std::min(len, size_t(ring->capacity - offset));
+  memcpy(data, records + offset, first);
+  memcpy((char*)data + first, records, len - first);
+}
+
+bool cosim_reader_t::next(uint32_t* kind, std::vector<char>& payload)
+{
+  uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+  if (ring->head.load(std::memory_order_acquire) == tail)
+    return false;
+
+  cosim_record_t rec;
+  copy_out(tail, &rec, sizeof(rec));
+  *kind = rec.kind;
+  payload.resize(rec.length);
+  copy_out(tail + sizeof(rec), payload.data(), rec.length);
+  ring->tail.store(tail + sizeof(rec) + padded(rec.length), std::memory_order_release);
+  return true;
+}
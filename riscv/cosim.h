@@ -0,0 +1,116 @@
+// See LICENSE for license details.
+
+#ifndef _RISCV_COSIM_H
+#define _RISCV_COSIM_H
+
+#include "hart_observer.h"
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class sim_t;
+
+// Lockstep cosimulation against an RTL design.  The testbench steps one
+// hart an instruction at a time and compares what it did from binary
+// records in a ring in POSIX shared memory, which the testbench can map
+// in this process or another one.
+//
+// The ring starts with a cosim_ring_header_t, followed by capacity bytes
+// of records.  Each record is a cosim_record_t and then length bytes of
+// payload, padded to a multiple of 8, and may wrap around the end:
+//
+//   COSIM_RETIRE  one commit log record, as in commit_log.h
+//   COSIM_TRAP    a cosim_trap_t
+//
+// A record is published by advancing head past it once it is written, and
+// consumed by advancing tail; head - tail bytes are in use.
+#define COSIM_RING_MAGIC "SPIKECS1"
+#define COSIM_RING_MAGIC_LEN 8
+
+enum {
+  COSIM_RETIRE = 1,
+  COSIM_TRAP = 2,
+};
+
+struct cosim_ring_header_t
+{
+  char magic[COSIM_RING_MAGIC_LEN];
+  uint64_t capacity;           // a power of two
+  std::atomic<uint64_t> head;  // bytes ever written
+  std::atomic<uint64_t> tail;  // bytes ever consumed
+};
+
+struct cosim_record_t
+{
+  uint32_t kind;
+  uint32_t length;
+};
+
+struct cosim_trap_t
+{
+  uint32_t core;
+  uint32_t pad;
+  uint64_t cause;
+  uint64_t epc;
+};
+
+// The simulator's side: owns the ring and steps the harts.  Every hart
+// records its commits for the ring from construction on, in compact form
+// if asked (see commit_log_vbytes_t).  Time does not pass by itself;
+// the testbench moves it with sim_t::advance_time().
+class cosim_t : public hart_observer_t
+{
+ public:
+  // Creates the shared memory object shm_name, which the destructor
+  // unlinks, with room for capacity bytes of records.
+  cosim_t(sim_t* sim, const char* shm_name, size_t capacity = 1 << 20,
+          bool compact = false);
+  ~cosim_t();
+
+  // Runs hart for one instruction and puts a record in the ring for each
+  // trap it takes and for the instruction, if it retires.  Waits for the
+  // reader while the ring is full.  Returns the number retired, which is
+  // 0 after a trap or while the hart waits for an interrupt.
+  uint64_t step(size_t hart);
+
+  // Drives the interrupt-pending bits in mask of hart to level, as the
+  // design's interrupt controller does, e.g. MIP_MEIP.
+  void set_interrupt(size_t hart, uint64_t mask, bool level);
+  // See sim_t::override_mmio_load.
+  void override_mmio_load(uint64_t addr, size_t len, uint64_t value);
+
+  void trap_taken(processor_t* p, reg_t cause, reg_t epc);
+
+ private:
+  void publish_retired(processor_t* p);
+  void push(uint32_t kind, const void* data, size_t len);
+  void copy_in(uint64_t pos, const void* data, size_t len);
+
+  sim_t* sim;
+  std::string shm_name;
+  cosim_ring_header_t* ring;
+  char* records;
+  size_t map_size;
+};
+
+// The testbench's side: maps a ring that a cosim_t created.
+class cosim_reader_t
+{
+ public:
+  cosim_reader_t(const char* shm_name);
+  ~cosim_reader_t();
+
+  // Takes the oldest record's kind and payload, or returns false if the
+  // ring is empty.
+  bool next(uint32_t* kind, std::vector<char>& payload);
+
+ private:
+  void copy_out(uint64_t pos, void* data, size_t len);
+
+  cosim_ring_header_t* ring;
+  char* records;
+  size_t map_size;
+};
+
+#endif
@@ -0,0 +1,145 @@
+// See LICENSE for license details.
+
+#include "crypto_kernels.h"
+#include "insns/aes_common.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define CK_X86 1
+#endif
+
+static uint64_t clmul_portable(uint64_t a, uint64_t b, uint64_t* hi)
+{
+  uint64_t lo = 0, h = 0;
+  for (int i = 0; i < 64; i++) {
+    if ((b >> i) & 1) {
+      lo ^= a << i;
+      if (i)
+        h ^= a >> (64 - i);
+    }
+  }
+  *hi = h;
+  return lo;
+}
+
+static uint64_t aes64_sub_bytes(uint64_t x, const uint8_t* sbox)
+{
+  uint64_t res = 0;
+  for (int i = 0; i < 64; i += 8)
+    res |= (uint64_t)sbox[(x >> i) & 0xFF] << i;
+  return res;
+}
+
+static uint64_t aes64_mix_columns(uint64_t x)
+{
+  uint32_t col_0 = x & 0xFFFFFFFF;
+  uint32_t col_1 = x >> 32;
+  col_0 = AES_MIXCOLUMN(col_0);
+  col_1 = AES_MIXCOLUMN(col_1);
+  return ((uint64_t)col_1 << 32) | col_0;
+}
+
+static uint64_t aes64_inv_mix_columns(uint64_t x)
+{
+  uint32_t col_0 = x & 0xFFFFFFFF;
+  uint32_t col_1 = x >> 32;
+  col_0 = AES_INVMIXCOLUMN(col_0);
+  col_1 = AES_INVMIXCOLUMN(col_1);
+  return ((uint64_t)col_1 << 32) | col_0;
+}
+
+#ifdef CK_X86
+// The AES-NI rounds end by adding a round key, which is zero here.
+#define CK_AES_STATE(rs1, rs2) _mm_set_epi64x((int64_t)(rs2), (int64_t)(rs1))
+#define CK_AES_LO(x) ((uint64_t)_mm_cvtsi128_si64(x))
+
+__attribute__((target("pclmul")))
+static uint64_t clmul_x86(uint64_t a, uint64_t b, uint64_t* hi)
+{
+  __m128i p = _mm_clmulepi64_si128(_mm_cvtsi64_si128(a), _mm_cvtsi64_si128(b), 0);
+  *hi = _mm_cvtsi128_si64(_mm_unpackhi_epi64(p, p));
+  return _mm_cvtsi128_si64(p);
+}
+
+__attribute__((target("aes")))
+static uint64_t aes64es_x86(uint64_t rs1, uint64_t rs2)
+{
+  return CK_AES_LO(_mm_aesenclast_si128(CK_AES_STATE(rs1, rs2), _mm_setzero_si128()));
+}
+
+__attribute__((target("aes")))
+static uint64_t aes64esm_x86(uint64_t rs1, uint64_t rs2)
+{
+  return CK_AES_LO(_mm_aesenc_si128(CK_AES_STATE(rs1, rs2), _mm_setzero_si128()));
+}
+
+__attribute__((target("aes")))
+static uint64_t aes64ds_x86(uint64_t rs1, uint64_t rs2)
+{
+  return CK_AES_LO(_mm_aesdeclast_si128(CK_AES_STATE(rs1, rs2), _mm_setzero_si128()));
+}
+
+__attribute__((target("aes")))
+static uint64_t aes64dsm_x86(uint64_t rs1, uint64_t rs2)
+{
+  return CK_AES_LO(_mm_aesdec_si128(CK_AES_STATE(rs1, rs2), _mm_setzero_si128()));
+}
+
+__attribute__((target("aes")))
+static uint64_t aes64im_x86(uint64_t rs1)
+{
+  return CK_AES_LO(_mm_aesimc_si128(CK_AES_STATE(rs1, 0)));
+}
+
+static const bool have_pclmul = [] {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("pclmul");
+}();
+
+static const bool have_aes = [] {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("aes");
+}();
+
+#define CK_HOST(have, call) \
+  if (have) \
+    return call
+#else
+#define CK_HOST(have, call)
+#endif
+
+uint64_t ck_clmul(uint64_t a, uint64_t b, uint64_t* hi)
+{
+  CK_HOST(have_pclmul, clmul_x86(a, b, hi));
+  return clmul_portable(a, b, hi);
+}
+
+uint64_t ck_aes64es(uint64_t rs1, uint64_t rs2)
+{
+  CK_HOST(have_aes, aes64es_x86(rs1, rs2));
+  return aes64_sub_bytes(AES_SHIFROWS_LO(rs1, rs2), AES_ENC_SBOX);
+}
+
+uint64_t ck_aes64esm(uint64_t rs1, uint64_t rs2)
+{
+  CK_HOST(have_aes, aes64esm_x86(rs1, rs2));
+  return aes64_mix_columns(aes64_sub_bytes(AES_SHIFROWS_LO(rs1, rs2), AES_ENC_SBOX));
+}
+
+uint64_t ck_aes64ds(uint64_t rs1, uint64_t rs2)
+{
+  CK_HOST(have_aes, aes64ds_x86(rs1, rs2));
+  return aes64_sub_bytes(AES_INVSHIFROWS_LO(rs1, rs2), AES_DEC_SBOX);
+}
+
+uint64_t ck_aes64dsm(uint64_t rs1, uint64_t rs2)
+{
+  CK_HOST(have_aes, aes64dsm_x86(rs1, rs2));
+  return aes64_inv_mix_columns(aes64_sub_bytes(AES_INVSHIFROWS_LO(rs1, rs2), AES_DEC_SBOX));
+}
+
+uint64_t ck_aes64im(uint64_t rs1)
+{
+  CK_HOST(have_aes, aes64im_x86(rs1));
+  return aes64_inv_mix_columns(rs1);
+}
@@ -0,0 +1,25 @@
+// See LICENSE for license details.
+#ifndef _RISCV_CRYPTO_KERNELS_H
+#define _RISCV_CRYPTO_KERNELS_H
+
+#include <cstdint>
+
+// Carry-less multiplication and the RV64 AES rounds.  On an x86-64 host
+// with PCLMULQDQ and AES-NI these take a single host instruction each;
+// elsewhere they fall back to portable code with the same results.  The
+// host is checked once, at startup.
+
+// Returns the low half of the 128-bit carry-less product of a and b, and
+// stores the high half to *hi.
+uint64_t ck_clmul(uint64_t a, uint64_t b, uint64_t* hi);
+
+// The AES state is rs2:rs1, with rs1 holding bytes 0-7, i.e. columns 0
+// and 1.  Each returns the low half of the new state, as the instruction
+// of the same name does.
+uint64_t ck_aes64es(uint64_t rs1, uint64_t rs2);   // ShiftRows, SubBytes
+uint64_t ck_aes64esm(uint64_t rs1, uint64_t rs2);  // ... then MixColumns
+uint64_t ck_aes64ds(uint64_t rs1, uint64_t rs2);   // InvShiftRows, InvSubBytes
+uint64_t ck_aes64dsm(uint64_t rs1, uint64_t rs2);  // ... then InvMixColumns
+uint64_t ck_aes64im(uint64_t rs1);                 // InvMixColumns
+
+#endif
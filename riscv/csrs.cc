@@ -62,7 +62,8 @@ void csr_t::log_write() const noexcept {
 
 void csr_t::log_special_write(const reg_t address, const reg_t val) const noexcept {
 #if defined(RISCV_ENABLE_COMMITLOG)
-  proc->get_state()->log_reg_write[((address) << 4) | 4] = {val, 0};
+  if (proc->get_log_capturing())
+    proc->get_state()->log_reg_write[((address) << 4) | 4] = {val, 0};
 #endif
 }
 
@@ -122,6 +123,7 @@ bool pmpaddr_csr_t::unlogged_write(const reg_t val) noexcept {
   }
   else
     return false;
+  proc->get_mmu()->pmp_changed();
   proc->get_mmu()->flush_tlb();
   return true;
 }
@@ -179,6 +181,22 @@ bool pmpaddr_csr_t::subset_match(reg_t addr, reg_t len) const noexcept {
   return !(is_tor ? tor_homogeneous : napot_homogeneous);
 }
 
+bool pmpaddr_csr_t::range(reg_t* first, reg_t* last) const noexcept {
+  if ((cfg & PMP_A) == 0) return false;
+  if ((cfg & PMP_A) == PMP_TOR) {
+    reg_t base = tor_base_paddr();
+    reg_t tor = tor_paddr();
+    if (base >= tor) return false;
+    *first = base;
+    *last = tor - 1;
+    return true;
+  }
+  // NAPOT or NA4:
+  *first = tor_paddr() & napot_mask();
+  *last = *first | ~napot_mask();
+  return true;
+}
+
 bool pmpaddr_csr_t::access_ok(access_type type, reg_t mode) const noexcept {
   const bool cfgx = cfg & PMP_X;
   const bool cfgw = cfg & PMP_W;
@@ -273,6 +291,7 @@ bool pmpcfg_csr_t::unlogged_write(const reg_t val) noexcept {
       write_success = true;
     }
   }
+  proc->get_mmu()->pmp_changed();
   proc->get_mmu()->flush_tlb();
   return write_success;
 }
@@ -436,7 +455,7 @@ void base_status_csr_t::maybe_flush_tlb(const reg_t newval) noexcept {
       (MSTATUS_MPP | MSTATUS_MPRV
        | (has_page ? (MSTATUS_MXR | MSTATUS_SUM) : 0)
       ))
-    proc->get_mmu()->flush_tlb();
+    proc->get_mmu()->flush_tlb_first_level();
 }
 
 namespace {
@@ -459,6 +478,7 @@ bool vsstatus_csr_t::unlogged_write(const reg_t val) noexcept {
   const reg_t newval = (this->val & ~sstatus_write_mask) | (val & sstatus_write_mask);
   if (state->v) maybe_flush_tlb(newval);
   this->val = adjust_sd(newval);
+  state->status_dirty = 0;
   return true;
 }
 
@@ -503,6 +523,7 @@ bool mstatus_csr_t::unlogged_write(const reg_t val) noexcept {
   const reg_t new_mstatus = (read() & ~mask) | (adjusted_val & mask);
   maybe_flush_tlb(new_mstatus);
   this->val = adjust_sd(new_mstatus);
+  state->status_dirty = 0;
   return true;
 }
 
@@ -571,8 +592,10 @@ sstatus_csr_t::sstatus_csr_t(processor_t* const proc, sstatus_proxy_csr_t_p orig
 void sstatus_csr_t::dirty(const reg_t dirties) {
   // As an optimization, return early if already dirty.
   if ((orig_sstatus->read() & dirties) == dirties) {
-    if (likely(!state->v || (virt_sstatus->read() & dirties) == dirties))
+    if (likely(!state->v || (virt_sstatus->read() & dirties) == dirties)) {
+      state->status_dirty |= dirties;
       return;
+    }
   }
 
   // Catch problems like #823 where P-extension instructions were not
@@ -583,6 +606,7 @@ void sstatus_csr_t::dirty(const reg_t dirties) {
   if (state->v) {
     virt_sstatus->write(virt_sstatus->read() | dirties);
   }
+  state->status_dirty |= dirties;
 }
 
 bool sstatus_csr_t::enabled(const reg_t which) {
@@ -652,7 +676,13 @@ bool misa_csr_t::unlogged_write(const reg_t val) noexcept {
     state->hstatus->write(0);
   }
 
-  return basic_csr_t::unlogged_write(new_misa);
+  bool written = basic_csr_t::unlogged_write(new_misa);
+  proc->update_extension_mask();
+  // Compressed instructions are only expanded at decode time while C is
+  // enabled.
+  if ((old_misa ^ new_misa) & (1L << ('C' - 'A')))
+    proc->get_mmu()->flush_icache();
+  return written;
 }
 
 bool misa_csr_t::extension_enabled_const(unsigned char ext) const noexcept {
@@ -671,10 +701,28 @@ reg_t mip_or_mie_csr_t::read() const noexcept {
 }
 
 void mip_or_mie_csr_t::write_with_mask(const reg_t mask, const reg_t val) noexcept {
-  this->val = (this->val & ~mask) | (val & mask);
+  merge_val(mask, val);
+  update_interrupt_maybe_pending();
   log_write();
 }
 
+void mip_or_mie_csr_t::merge_val(const reg_t mask, const reg_t val) noexcept {
+  reg_t old = this->val.load();
+  while (!this->val.compare_exchange_weak(old, (old & ~mask) | (val & mask)))
+    ;
+}
+
+// Another hart's thread may change mip while this one changes mie, and
+// each then stores what it saw.  Whichever stores last checks again, so
+// the flag settles on mip & mie as they end up.
+void mip_or_mie_csr_t::update_interrupt_maybe_pending() noexcept {
+  bool pending;
+  do {
+    pending = (state->mip->read() & state->mie->read()) != 0;
+    state->interrupt_maybe_pending.store(pending);
+  } while (pending != ((state->mip->read() & state->mie->read()) != 0));
+}
+
 bool mip_or_mie_csr_t::unlogged_write(const reg_t val) noexcept {
   write_with_mask(write_mask(), val);
   return false; // avoid double logging: already logged by write_with_mask()
@@ -685,7 +733,8 @@ mip_csr_t::mip_csr_t(processor_t* const proc, const reg_t addr):
 }
 
 void mip_csr_t::backdoor_write_with_mask(const reg_t mask, const reg_t val) noexcept {
-  this->val = (this->val & ~mask) | (val & mask);
+  merge_val(mask, val);
+  update_interrupt_maybe_pending();
 }
 
 reg_t mip_csr_t::write_mask() const noexcept {
@@ -874,7 +923,7 @@ base_atp_csr_t::base_atp_csr_t(processor_t* const proc, const reg_t addr):
 bool base_atp_csr_t::unlogged_write(const reg_t val) noexcept {
   const reg_t newval = proc->supports_impl(IMPL_MMU) ? compute_new_satp(val) : 0;
   if (newval != read())
-    proc->get_mmu()->flush_tlb();
+    proc->get_mmu()->flush_tlb_context();
   return basic_csr_t::unlogged_write(newval);
 }
 
@@ -973,19 +1022,60 @@ reg_t wide_counter_csr_t::written_value() const noexcept {
   return this->val + 1;
 }
 
+// implement class hpm_counter_csr_t
+hpm_counter_csr_t::hpm_counter_csr_t(processor_t* const proc, const reg_t addr):
+  csr_t(proc, addr),
+  val(0),
+  event(0),
+  event_base(0) {
+}
+
+reg_t hpm_counter_csr_t::read() const noexcept {
+  // The cache models' statistics restart when they are reset.
+  uint64_t count = proc->hpm_event_count(event);
+  return val + (count >= event_base ? count - event_base : count);
+}
+
+void hpm_counter_csr_t::set_event(const reg_t event) noexcept {
+  val = read();
+  this->event = event;
+  event_base = proc->hpm_event_count(event);
+}
+
+bool hpm_counter_csr_t::unlogged_write(const reg_t val) noexcept {
+  // Unlike minstret, nothing bumps these after the writing instruction.
+  this->val = val;
+  event_base = proc->hpm_event_count(event);
+  return true;
+}
+
+// implement class hpm_event_csr_t
+hpm_event_csr_t::hpm_event_csr_t(processor_t* const proc, const reg_t addr, hpm_counter_csr_t_p counter):
+  basic_csr_t(proc, addr, 0),
+  counter(counter) {
+}
+
+bool hpm_event_csr_t::unlogged_write(const reg_t val) noexcept {
+  const reg_t event = val < HPM_NUM_EVENTS ? val : 0;
+  counter->set_event(event);
+  return basic_csr_t::unlogged_write(event);
+}
+
 // implement class time_counter_csr_t
 time_counter_csr_t::time_counter_csr_t(processor_t* const proc, const reg_t addr):
   csr_t(proc, addr),
-  shadow_val(0) {
+  shadow_val(0),
+  clock(nullptr) {
 }
 
 reg_t time_counter_csr_t::read() const noexcept {
+  reg_t time = clock ? *clock : shadow_val;
   // reading the time CSR in VS or VU mode returns the sum of the contents of
   // htimedelta and the actual value of time.
   if (state->v)
-    return shadow_val + state->htimedelta->read();
+    return time + state->htimedelta->read();
   else
-    return shadow_val;
+    return time;
 }
 
 void time_counter_csr_t::sync(const reg_t val) noexcept {
@@ -1272,7 +1362,7 @@ void seed_csr_t::verify_permissions(insn_t insn, bool write) const {
 }
 
 reg_t seed_csr_t::read() const noexcept {
-  return proc->es.get_seed();
+  return replay_value(proc->get_id(), REPLAY_ENTROPY, proc->es.get_seed());
 }
 
 bool seed_csr_t::unlogged_write(const reg_t val) noexcept {
@@ -1296,12 +1386,17 @@ void vector_csr_t::write_raw(const reg_t val) noexcept {
   const bool success = basic_csr_t::unlogged_write(val);
   if (success)
     log_write();
+  if (address == CSR_VSTART)
+    proc->VU.update_vcfg();
 }
 
 bool vector_csr_t::unlogged_write(const reg_t val) noexcept {
   if (mask == 0) return false;
   dirty_vs_state;
-  return basic_csr_t::unlogged_write(val & mask);
+  const bool success = basic_csr_t::unlogged_write(val & mask);
+  if (address == CSR_VSTART)
+    proc->VU.update_vcfg();
+  return success;
 }
 
 vxsat_csr_t::vxsat_csr_t(processor_t* const proc, const reg_t addr):
@@ -1413,7 +1508,19 @@ stimecmp_csr_t::stimecmp_csr_t(processor_t* const proc, const reg_t addr, const
 
 bool stimecmp_csr_t::unlogged_write(const reg_t val) noexcept {
   state->mip->backdoor_write_with_mask(intr_mask, state->time->read() >= val ? intr_mask : 0);
-  return basic_csr_t::unlogged_write(val);
+  basic_csr_t::unlogged_write(val);
+  proc->timer_changed();
+  return true;
+}
+
+htimedelta_csr_t::htimedelta_csr_t(processor_t* const proc, const reg_t addr):
+  basic_csr_t(proc, addr, 0) {
+}
+
+bool htimedelta_csr_t::unlogged_write(const reg_t val) noexcept {
+  basic_csr_t::unlogged_write(val);
+  proc->timer_changed();
+  return true;
 }
 
 virtualized_stimecmp_csr_t::virtualized_stimecmp_csr_t(processor_t* const proc, csr_t_p orig, csr_t_p virt):
@@ -6,6 +6,8 @@
 #include "decode.h"
 // For std::shared_ptr
 #include <memory>
+// For std::atomic
+#include <atomic>
 // For access_type:
 #include "memtracer.h"
 #include <cassert>
@@ -88,6 +90,9 @@ class pmpaddr_csr_t: public csr_t {
   // Does the specified range match only a proper subset of this page?
   bool subset_match(reg_t addr, reg_t len) const noexcept;
 
+  // The addresses match4() accepts, as [*first, *last]; false if none.
+  bool range(reg_t* first, reg_t* last) const noexcept;
+
   // Is the specified access allowed given the pmpcfg privileges?
   bool access_ok(access_type type, reg_t mode) const noexcept;
 
@@ -340,7 +345,11 @@ class mip_or_mie_csr_t: public csr_t {
 
  protected:
   virtual bool unlogged_write(const reg_t val) noexcept override final;
-  reg_t val;
+  void update_interrupt_maybe_pending() noexcept;
+  void merge_val(const reg_t mask, const reg_t val) noexcept;
+  // The CLINT and PLIC write mip from whichever hart's thread stores to
+  // them under --parallel.
+  std::atomic<reg_t> val;
  private:
   virtual reg_t write_mask() const noexcept = 0;
 };
@@ -519,15 +528,49 @@ class time_counter_csr_t: public csr_t {
   virtual reg_t read() const noexcept override;
 
   void sync(const reg_t val) noexcept;
+  // Reads follow *clock, when set, rather than the last value synced.
+  void set_clock(const reg_t* clock) noexcept { this->clock = clock; }
 
  protected:
   virtual bool unlogged_write(const reg_t val) noexcept override { return false; };
  private:
   reg_t shadow_val;
+  const reg_t* clock;
 };
 
 typedef std::shared_ptr<time_counter_csr_t> time_counter_csr_t_p;
 
+// For mhpmcounter3-31, which count what instructions bump() them for plus
+// the event (see processor_t::hpm_event_count()) their mhpmevent selects.
+// The simulator keeps the event counts anyway, so they are only sampled
+// when the counter is read, written or reassigned.
+class hpm_counter_csr_t: public csr_t {
+ public:
+  hpm_counter_csr_t(processor_t* const proc, const reg_t addr);
+  // Always returns full 64-bit value
+  virtual reg_t read() const noexcept override;
+  void bump(const reg_t howmuch) noexcept { val += howmuch; }
+  void set_event(const reg_t event) noexcept;
+ protected:
+  virtual bool unlogged_write(const reg_t val) noexcept override;
+ private:
+  reg_t val;
+  reg_t event;
+  uint64_t event_base;  // the event's count when val was last updated
+};
+
+typedef std::shared_ptr<hpm_counter_csr_t> hpm_counter_csr_t_p;
+
+// For mhpmevent3-31.  Unknown events read back as 0, counting nothing.
+class hpm_event_csr_t: public basic_csr_t {
+ public:
+  hpm_event_csr_t(processor_t* const proc, const reg_t addr, hpm_counter_csr_t_p counter);
+ protected:
+  virtual bool unlogged_write(const reg_t val) noexcept override;
+ private:
+  hpm_counter_csr_t_p counter;
+};
+
 // For a CSR that is an alias of another
 class proxy_csr_t: public csr_t {
  public:
@@ -725,6 +768,13 @@ class senvcfg_csr_t final: public masked_csr_t {
   virtual void verify_permissions(insn_t insn, bool write) const override;
 };
 
+class htimedelta_csr_t: public basic_csr_t {
+ public:
+  htimedelta_csr_t(processor_t* const proc, const reg_t addr);
+ protected:
+  virtual bool unlogged_write(const reg_t val) noexcept override;
+};
+
 class stimecmp_csr_t: public basic_csr_t {
  public:
   stimecmp_csr_t(processor_t* const proc, const reg_t addr, const reg_t imask);
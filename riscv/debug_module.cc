@@ -44,6 +44,7 @@ debug_module_t::debug_module_t(sim_t *sim, const debug_module_config_t &config)
   // them because I'm too lazy to add the code to just ignore accesses.
   hart_state(1 << field_width(sim->nprocs())),
   hart_array_mask(sim->nprocs()),
+  sb_write_buf_address(0),
   rti_remaining(0)
 {
   D(fprintf(stderr, "debug_data_start=0x%x\n", debug_data_start));
@@ -339,6 +340,32 @@ void debug_module_t::sb_write()
 {
   reg_t address = ((uint64_t) sbaddress[1] << 32) | sbaddress[0];
   D(fprintf(stderr, "sb_write() 0x%x @ 0x%lx\n", sbdata[0], address));
+  unsigned bytes = sb_access_bits() / 8;
+  if (sbcs.autoincrement && sbcs.sbaccess <= 3 &&
+      config.max_sba_data_width >= sb_access_bits() &&
+      sim->addr_to_mem(address) && sim->addr_to_mem(address + bytes - 1)) {
+    if (!sb_write_buf.empty() &&
+        (sb_write_buf_address + sb_write_buf.size() != address ||
+         sb_write_buf.size() >= sb_write_buf_max))
+      flush_sb_writes();
+    if (sb_write_buf.empty())
+      sb_write_buf_address = address;
+
+    auto append = [&](auto value) {
+      auto data = sim->debug_mmu->to_target(value);
+      const uint8_t* p = (const uint8_t*) &data;
+      sb_write_buf.insert(sb_write_buf.end(), p, p + sizeof(data));
+    };
+    switch (sbcs.sbaccess) {
+      case 0: append(uint8_t(sbdata[0])); break;
+      case 1: append(uint16_t(sbdata[0])); break;
+      case 2: append(uint32_t(sbdata[0])); break;
+      case 3: append((((uint64_t) sbdata[1]) << 32) | sbdata[0]); break;
+    }
+    return;
+  }
+
+  flush_sb_writes();
   if (sbcs.sbaccess == 0 && config.max_sba_data_width >= 8) {
     sim->debug_mmu->store_uint8(address, sbdata[0]);
   } else if (sbcs.sbaccess == 1 && config.max_sba_data_width >= 16) {
@@ -353,10 +380,30 @@ void debug_module_t::sb_write()
   }
 }
 
+void debug_module_t::flush_sb_writes()
+{
+  if (sb_write_buf.empty())
+    return;
+
+  // The run may cross from one memory into another, which the bus cannot
+  // store in one go; then store it byte by byte.
+  if (!sim->mmio_store(sb_write_buf_address, sb_write_buf.size(),
+                       sb_write_buf.data())) {
+    try {
+      for (size_t i = 0; i < sb_write_buf.size(); i++)
+        sim->debug_mmu->store_uint8(sb_write_buf_address + i, sb_write_buf[i]);
+    } catch (trap_store_access_fault& t) {
+      sbcs.error = 2;
+    }
+  }
+  sb_write_buf.clear();
+}
+
 bool debug_module_t::dmi_read(unsigned address, uint32_t *value)
 {
   uint32_t result = 0;
   D(fprintf(stderr, "dmi_read(0x%x) -> ", address));
+  flush_sb_writes();
   if (address >= DM_DATA0 && address < DM_DATA0 + abstractcs.datacount) {
     unsigned i = address - DM_DATA0;
     result = read32(dmdata, i);
@@ -752,6 +799,8 @@ bool debug_module_t::perform_abstract_command()
 bool debug_module_t::dmi_write(unsigned address, uint32_t value)
 {
   D(fprintf(stderr, "dmi_write(0x%x, 0x%x)\n", address, value));
+  if (address != DM_SBDATA0)
+    flush_sb_writes();
 
   if (!dmstatus.authenticated && address != DM_AUTHDATA &&
       address != DM_DMCONTROL)
@@ -128,6 +128,11 @@ class debug_module_t : public abstract_device_t
     // Called when one of the attached harts was reset.
     void proc_reset(unsigned id);
 
+    // Stores the system bus writes that are still buffered.  Must be called
+    // before the harts run again; any DMI access other than the next write
+    // of a sequence does so too.
+    void flush_sb_writes();
+
   private:
     static const unsigned datasize = 2;
     unsigned nprocs;
@@ -178,6 +183,12 @@ class debug_module_t : public abstract_device_t
     uint32_t sbaddress[4];
     uint32_t sbdata[4];
 
+    // A run of autoincrementing system bus writes to RAM, such as a program
+    // download, is gathered here and stored as one block.
+    static const size_t sb_write_buf_max = 64 * 1024;
+    std::vector<uint8_t> sb_write_buf;
+    reg_t sb_write_buf_address;
+
     uint32_t challenge;
     const uint32_t secret = 1;
 
@@ -198,26 +198,38 @@ private:
     */
 # define WRITE_REG(reg, value) ({ \
     reg_t wdata = (value); /* value may have side effects */ \
-    STATE.log_reg_write[(reg) << 4] = {wdata, 0}; \
+    if (unlikely(p->get_log_capturing())) \
+      STATE.log_reg_write[(reg) << 4] = {wdata, 0}; \
     CHECK_REG(reg); \
     STATE.XPR.write(reg, wdata); \
   })
 # define WRITE_FREG(reg, value) ({ \
     freg_t wdata = freg(value); /* value may have side effects */ \
-    STATE.log_reg_write[((reg) << 4) | 1] = wdata; \
+    if (unlikely(p->get_log_capturing())) \
+      STATE.log_reg_write[((reg) << 4) | 1] = wdata; \
     DO_WRITE_FREG(reg, wdata); \
   })
-# define WRITE_VSTATUS STATE.log_reg_write[3] = {0, 0};
+# define WRITE_VSTATUS ({ \
+    if (unlikely(p->get_log_capturing())) \
+      STATE.log_reg_write[3] = {0, 0}; \
+  })
 #endif
 
 #ifdef RISCV_ENABLE_SIFT
-# define LOG_BRANCH(taken) ({ \
-    STATE.log_is_branch = true; \
-    STATE.log_is_branch_taken = (taken); \
+# define LOG_SIFT_BRANCH(taken) ({ \
+    if (STATE.log_sift_capturing()) { \
+      STATE.log_is_branch = true; \
+      STATE.log_is_branch_taken = (taken); \
+    } \
   })
 #else
-# define LOG_BRANCH(taken) do {} while(false)
+# define LOG_SIFT_BRANCH(taken) do {} while(false)
 #endif
+#define LOG_BRANCH(taken) ({ \
+    if (unlikely(p->get_branch_tracer() != nullptr)) \
+      p->log_branch(pc, (taken)); \
+    LOG_SIFT_BRANCH(taken); \
+  })
 
 // RVC macros
 #define WRITE_RVC_RS1S(value) WRITE_REG(insn.rvc_rs1s(), value)
@@ -248,9 +260,11 @@ private:
 #define FRS3_H READ_FREG_H(insn.rs3())
 #define FRS3_F READ_FREG_F(insn.rs3())
 #define FRS3_D READ_FREG_D(insn.rs3())
-#define dirty_fp_state  STATE.sstatus->dirty(SSTATUS_FS)
-#define dirty_ext_state STATE.sstatus->dirty(SSTATUS_XS)
-#define dirty_vs_state  STATE.sstatus->dirty(SSTATUS_VS)
+#define dirty_state(bits) \
+  (likely((STATE.status_dirty & (bits)) == (bits)) ? (void)0 : STATE.sstatus->dirty(bits))
+#define dirty_fp_state  dirty_state(SSTATUS_FS)
+#define dirty_ext_state dirty_state(SSTATUS_XS)
+#define dirty_vs_state  dirty_state(SSTATUS_VS)
 #define DO_WRITE_FREG(reg, value) (STATE.FPR.write(reg, value), dirty_fp_state)
 #define WRITE_FRD(value) WRITE_FREG(insn.rd(), value)
 #define WRITE_FRD_H(value) \
@@ -305,8 +319,16 @@ do { \
 #define require_fp          STATE.fflags->verify_permissions(insn, false)
 #define require_accelerator require(STATE.sstatus->enabled(SSTATUS_XS))
 #define require_vector_vs   require(STATE.sstatus->enabled(SSTATUS_VS))
+// The common case, a legal configuration with mstatus.VS already dirty,
+// checks only the cached vector configuration and status_dirty.
 #define require_vector(alu) \
   do { \
+    if (likely((STATE.status_dirty & SSTATUS_VS) && \
+               (P.VU.vcfg & ((alu) ? P.VU.VCFG_ALU_READY : P.VU.VCFG_LEGAL)) && \
+               p->extension_enabled('V'))) { \
+      WRITE_VSTATUS; \
+      break; \
+    } \
     require_vector_vs; \
     require_extension('V'); \
     require(!P.VU.vill); \
@@ -363,6 +385,10 @@ do { \
 
 class wait_for_interrupt_t {};
 
+// Thrown before a hart executes an instruction at an interactive breakpoint
+// or a store to an interactive watchpoint; see mmu_t::set_breakpoint.
+class interactive_stop_t {};
+
 #define wfi() \
   do { set_pc_and_serialize(npc); \
        throw wait_for_interrupt_t(); \
@@ -373,8 +399,18 @@ class wait_for_interrupt_t {};
 /* Sentinel PC values to serialize simulator pipeline */
 #define PC_SERIALIZE_BEFORE 3
 #define PC_SERIALIZE_AFTER 5
+/* Sentinel PC for a trap raised with raise_trap_cause */
+#define PC_TRAP 7
 #define invalid_pc(pc) ((pc) & 1)
 
+/* Raise a trap that has no tval, such as an ecall, without the cost of
+   throwing: the cause is left in the state for processor_t::step. */
+#define raise_trap_cause(cause) \
+  do { \
+    STATE.pending_trap = (cause); \
+    return PC_TRAP; \
+  } while (0)
+
 /* Convenience wrappers to simplify softfloat code sequences */
 #define isBoxedF16(r) (isBoxedF32(r) && ((uint64_t)((r.v[0] >> 16) + 1) == ((uint64_t)1 << 48)))
 #define unboxF16(r) (isBoxedF16(r) ? (uint16_t)r.v[0] : defaultNaNF16UI)
@@ -1,6 +1,13 @@
 #include "devices.h"
 #include "mmu.h"
 #include <stdexcept>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifndef MPOL_INTERLEAVE
+#define MPOL_INTERLEAVE 3
+#endif
 
 void bus_t::add_device(reg_t addr, abstract_device_t* dev)
 {
@@ -10,49 +17,62 @@ void bus_t::add_device(reg_t addr, abstract_device_t* dev)
   // iteration over this sort, which it does. (python's
   // SortedDict is a good analogy)
   devices[addr] = dev;
+
+  device_list.assign(devices.begin(), devices.end());
+  if (device_list.size() >= (reg_t(1) << PAGE_CACHE_INDEX_BITS))
+    throw std::runtime_error("too many devices on the bus");
+  for (auto& entry : page_cache)
+    entry.store(0, std::memory_order_relaxed);
 }
 
 bool bus_t::load(reg_t addr, size_t len, uint8_t* bytes)
 {
-  // Find the device with the base address closest to but
-  // less than addr (price-is-right search)
-  auto it = devices.upper_bound(addr);
-  if (devices.empty() || it == devices.begin()) {
-    // Either the bus is empty, or there weren't 
-    // any items with a base address <= addr
+  auto desc = find_device(addr);
+  if (!desc.second)
     return false;
-  }
-  // Found at least one item with base address <= addr
-  // The iterator points to the device after this, so
-  // go back by one item.
-  it--;
-  return it->second->load(addr - it->first, len, bytes);
+  return desc.second->load(addr - desc.first, len, bytes);
 }
 
 bool bus_t::store(reg_t addr, size_t len, const uint8_t* bytes)
 {
-  // See comments in bus_t::load
-  auto it = devices.upper_bound(addr);
-  if (devices.empty() || it == devices.begin()) {
+  auto desc = find_device(addr);
+  if (!desc.second)
     return false;
-  }
-  it--;
-  return it->second->store(addr - it->first, len, bytes);
+  return desc.second->store(addr - desc.first, len, bytes);
 }
 
 std::pair<reg_t, abstract_device_t*> bus_t::find_device(reg_t addr)
 {
-  // See comments in bus_t::load
+  reg_t page = addr >> PGSHIFT;
+  std::atomic<uint64_t>& slot = page_cache[page % PAGE_CACHE_SIZE];
+  uint64_t cached = slot.load(std::memory_order_relaxed);
+  if (likely(cached != 0 && cached >> PAGE_CACHE_INDEX_BITS == page))
+    return device_list[(cached & ((reg_t(1) << PAGE_CACHE_INDEX_BITS) - 1)) - 1];
+
+  // Find the device with the base address closest to but
+  // less than addr (price-is-right search)
   auto it = devices.upper_bound(addr);
   if (devices.empty() || it == devices.begin()) {
+    // Either the bus is empty, or there weren't
+    // any items with a base address <= addr
     return std::make_pair((reg_t)0, (abstract_device_t*)NULL);
   }
+  // The iterator points to the device after the one we want, which
+  // bounds how far the one we want may extend.
+  reg_t page_base = page << PGSHIFT;
+  reg_t page_end = page_base + PGSIZE;
+  bool whole_page = (it == devices.end() || it->first >= page_end || page_end == 0);
   it--;
+  if (whole_page && it->first <= page_base) {
+    size_t index = std::distance(devices.begin(), it);
+    slot.store((page << PAGE_CACHE_INDEX_BITS) | (index + 1), std::memory_order_relaxed);
+  }
   return std::make_pair(it->first, it->second);
 }
 
-// Type for holding all registered MMIO plugins by name.
-using mmio_plugin_map_t = std::map<std::string, mmio_plugin_t>;
+// Type for holding all registered MMIO plugins by name.  Version 1 plugins
+// are kept as version 2 ones without the optional callbacks.
+using mmio_plugin_map_t = std::map<std::string, mmio_plugin_v2_t>;
 
 // Simple singleton instance of an mmio_plugin_map_t.
 static mmio_plugin_map_t& mmio_plugin_map()
@@ -61,8 +81,8 @@ static mmio_plugin_map_t& mmio_plugin_map()
   return instance;
 }
 
-void register_mmio_plugin(const char* name_cstr,
-                          const mmio_plugin_t* mmio_plugin)
+void register_mmio_plugin_v2(const char* name_cstr,
+                             const mmio_plugin_v2_t* mmio_plugin)
 {
   std::string name(name_cstr);
   if (!mmio_plugin_map().emplace(name, *mmio_plugin).second) {
@@ -70,38 +90,262 @@ void register_mmio_plugin(const char* name_cstr,
   }
 }
 
+void register_mmio_plugin(const char* name_cstr,
+                          const mmio_plugin_t* mmio_plugin)
+{
+  mmio_plugin_v2_t plugin = {*mmio_plugin, NULL, NULL, NULL};
+  register_mmio_plugin_v2(name_cstr, &plugin);
+}
+
 mmio_plugin_device_t::mmio_plugin_device_t(const std::string& name,
                                            const std::string& args)
-  : plugin(mmio_plugin_map().at(name)), user_data((*plugin.alloc)(args.c_str()))
+  : plugin(mmio_plugin_map().at(name)), user_data((*plugin.v1.alloc)(args.c_str())),
+    host{NULL, NULL}
 {
 }
 
 mmio_plugin_device_t::~mmio_plugin_device_t()
 {
-  (*plugin.dealloc)(user_data);
+  flush_stores();
+  (*plugin.v1.dealloc)(user_data);
 }
 
 bool mmio_plugin_device_t::load(reg_t addr, size_t len, uint8_t* bytes)
 {
-  return (*plugin.load)(user_data, addr, len, bytes);
+  flush_stores();
+  return (*plugin.v1.load)(user_data, addr, len, bytes);
 }
 
 bool mmio_plugin_device_t::store(reg_t addr, size_t len, const uint8_t* bytes)
 {
-  return (*plugin.store)(user_data, addr, len, bytes);
+  if (!plugin.store_vec)
+    return (*plugin.v1.store)(user_data, addr, len, bytes);
+
+  posted.push_back({addr, len, NULL});
+  posted_data.insert(posted_data.end(), bytes, bytes + len);
+  if (posted.size() == MAX_POSTED_STORES)
+    flush_stores();
+  return true;
+}
+
+void mmio_plugin_device_t::flush_stores()
+{
+  if (posted.empty())
+    return;
+
+  const uint8_t* bytes = posted_data.data();
+  for (auto& access : posted) {
+    access.bytes = bytes;
+    bytes += access.len;
+  }
+  (*plugin.store_vec)(user_data, posted.data(), posted.size());
+  posted.clear();
+  posted_data.clear();
+}
+
+void mmio_plugin_device_t::attach(const mmio_host_t& host)
+{
+  this->host = host;
+  if (plugin.attach)
+    (*plugin.attach)(user_data, &this->host);
+}
+
+void mmio_plugin_device_t::tick(reg_t cycles)
+{
+  flush_stores();
+  if (plugin.tick)
+    (*plugin.tick)(user_data, cycles);
 }
 
-mem_t::mem_t(reg_t size)
-  : sz(size)
+mem_t::mem_t(reg_t size, bool flat, bool huge)
+  : sz(size), flat_base(nullptr), flat_flags(0), flat_nodemask(0), flat_discardable(true)
 {
   if (size == 0 || size % PGSIZE != 0)
     throw std::runtime_error("memory size must be a positive multiple of 4 KiB");
+
+  if (flat) {
+    flat_flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+#ifdef MAP_HUGETLB
+    if (huge) {
+      flat_flags |= MAP_HUGETLB;
+      flat_base = reserve_flat(nullptr);
+      if (flat_base)
+        return;
+      flat_flags &= ~MAP_HUGETLB;
+    }
+#endif
+    flat_base = reserve_flat(nullptr);
+    if (!flat_base)
+      throw std::runtime_error("could not reserve flat memory");
+  }
+}
+
+// Maps the flat memory at fixed, or anywhere if that is null, with its
+// flags and NUMA policy.
+char* mem_t::reserve_flat(char* fixed)
+{
+  void* base = mmap(fixed, sz, PROT_READ | PROT_WRITE, flat_flags | (fixed ? MAP_FIXED : 0), -1, 0);
+  if (base == MAP_FAILED)
+    return nullptr;
+  flat_discardable = true;
+#ifdef MAP_HUGETLB
+  // Partial huge pages cannot be dropped.
+  flat_discardable = !(flat_flags & MAP_HUGETLB);
+#endif
+#ifdef MADV_HUGEPAGE
+  if (flat_discardable)
+    madvise(base, sz, MADV_HUGEPAGE);
+#endif
+  if (flat_nodemask) {
+    unsigned long nodemask = flat_nodemask;
+    syscall(SYS_mbind, base, sz, MPOL_INTERLEAVE, &nodemask, sizeof(nodemask) * 8 + 1, 0);
+  }
+  return (char*)base;
+}
+
+bool mem_t::interleave_nodes(unsigned long nodemask)
+{
+  if (!flat_base)
+    return false;
+  unsigned long mask = nodemask;
+  if (syscall(SYS_mbind, flat_base, sz, MPOL_INTERLEAVE, &mask, sizeof(mask) * 8 + 1, 0) != 0)
+    return false;
+  flat_nodemask = nodemask;
+  return true;
+}
+
+bool mem_t::share(int fd, off_t offset)
+{
+  if (!flat_base)
+    return false;
+  if (mmap(flat_base, sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, offset) == MAP_FAILED)
+    return false;
+  // Dropping a shared file's pages does not zero them.
+  flat_discardable = false;
+  return true;
 }
 
 mem_t::~mem_t()
 {
   for (auto& entry : sparse_memory_map)
-    free(entry.second);
+    free_page(entry.second);
+  unmap_all();
+  if (flat_base)
+    munmap(flat_base, sz);
+}
+
+void mem_t::free_page(char* page)
+{
+  for (auto& m : mappings)
+    if (page >= m.first && page < m.first + m.second)
+      return;
+  free(page);
+}
+
+char* mem_t::map_pages(size_t len, int fd, off_t offset, char* fixed)
+{
+  void* base = mmap(fixed, len, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | (fixed ? MAP_FIXED : 0), fd, offset);
+  if (base == MAP_FAILED)
+    return nullptr;
+  if (!fixed)
+    mappings.push_back({(char*)base, len});
+  return (char*)base;
+}
+
+void mem_t::unmap_all()
+{
+  for (auto& m : mappings)
+    munmap(m.first, m.second);
+  mappings.clear();
+}
+
+bool mem_t::map_file(reg_t addr, size_t len, int fd, off_t offset)
+{
+  if (flat_base) {
+    if (!map_pages(len, fd, offset, flat_base + addr))
+      return false;
+    flat_discardable = false;
+    return true;
+  }
+
+  char* base = map_pages(len, fd, offset);
+  if (!base)
+    return false;
+  for (reg_t pos = 0; pos < len; pos += PGSIZE) {
+    reg_t ppn = (addr + pos) >> PGSHIFT;
+    auto search = sparse_memory_map.find(ppn);
+    if (search != sparse_memory_map.end())
+      free_page(search->second);
+    sparse_memory_map[ppn] = base + pos;
+  }
+  return true;
+}
+
+bool mem_t::copy_file(reg_t addr, size_t len, int fd, off_t offset)
+{
+  std::vector<uint8_t> buf(std::min<size_t>(len, 1 << 20));
+  while (len > 0) {
+    size_t n = std::min(len, buf.size());
+    if (pread(fd, buf.data(), n, offset) != ssize_t(n) || !store(addr, n, buf.data()))
+      return false;
+    addr += n;
+    offset += n;
+    len -= n;
+  }
+  return true;
+}
+
+bool mem_t::load_file(reg_t addr, size_t len, int fd, off_t offset)
+{
+  if (addr + len < addr || addr + len > sz)
+    return false;
+
+  // Only pages at the same offset within a page in the file and in memory
+  // can be mapped.
+  reg_t start = addr, end = addr;
+  if ((addr - reg_t(offset)) % PGSIZE == 0) {
+    start = std::min((addr + PGSIZE - 1) & ~reg_t(PGSIZE - 1), addr + len);
+    end = std::max(start, (addr + len) & ~reg_t(PGSIZE - 1));
+  }
+  if (end > start && !map_file(start, end - start, fd, offset + (start - addr)))
+    start = end = addr;
+  return copy_file(addr, start - addr, fd, offset) &&
+         copy_file(end, addr + len - end, fd, offset + (end - addr));
+}
+
+static bool pwrite_all(int fd, const char* buf, size_t len, off_t offset)
+{
+  while (len > 0) {
+    ssize_t n = pwrite(fd, buf, len, offset);
+    if (n <= 0)
+      return false;
+    buf += n;
+    offset += n;
+    len -= n;
+  }
+  return true;
+}
+
+bool mem_t::save_file(reg_t addr, size_t len, int fd, off_t offset)
+{
+  if (addr + len < addr || addr + len > sz)
+    return false;
+
+  if (flat_base)
+    return pwrite_all(fd, flat_base + addr, len, offset);
+
+  while (len > 0) {
+    auto n = std::min(PGSIZE - (addr % PGSIZE), reg_t(len));
+    auto search = sparse_memory_map.find(addr >> PGSHIFT);
+    if (search != sparse_memory_map.end() &&
+        !pwrite_all(fd, search->second + addr % PGSIZE, n, offset))
+      return false;
+    addr += n;
+    offset += n;
+    len -= n;
+  }
+  return true;
 }
 
 bool mem_t::load_store(reg_t addr, size_t len, uint8_t* bytes, bool store)
@@ -109,6 +353,14 @@ bool mem_t::load_store(reg_t addr, size_t len, uint8_t* bytes, bool store)
   if (addr + len < addr || addr + len > sz)
     return false;
 
+  if (flat_base) {
+    if (store)
+      memcpy(flat_base + addr, bytes, len);
+    else
+      memcpy(bytes, flat_base + addr, len);
+    return true;
+  }
+
   while (len > 0) {
     auto n = std::min(PGSIZE - (addr % PGSIZE), reg_t(len));
 
@@ -125,7 +377,39 @@ bool mem_t::load_store(reg_t addr, size_t len, uint8_t* bytes, bool store)
   return true;
 }
 
+bool mem_t::clear(reg_t addr, size_t len)
+{
+  if (addr + len < addr || addr + len > sz)
+    return false;
+
+  if (flat_base) {
+    reg_t start = (addr + PGSIZE - 1) & ~reg_t(PGSIZE - 1);
+    reg_t end = (addr + len) & ~reg_t(PGSIZE - 1);
+    if (start >= end || !flat_discardable) {
+      memset(flat_base + addr, 0, len);
+    } else {
+      memset(flat_base + addr, 0, start - addr);
+      madvise(flat_base + start, end - start, MADV_DONTNEED);
+      memset(flat_base + end, 0, addr + len - end);
+    }
+    return true;
+  }
+
+  while (len > 0) {
+    auto n = std::min(PGSIZE - (addr % PGSIZE), reg_t(len));
+    auto search = sparse_memory_map.find(addr >> PGSHIFT);
+    if (search != sparse_memory_map.end())
+      memset(search->second + addr % PGSIZE, 0, n);
+    addr += n;
+    len -= n;
+  }
+  return true;
+}
+
 char* mem_t::contents(reg_t addr) {
+  if (flat_base)
+    return flat_base + addr;
+
   reg_t ppn = addr >> PGSHIFT, pgoff = addr % PGSIZE;
   auto search = sparse_memory_map.find(ppn);
   if (search == sparse_memory_map.end()) {
@@ -5,11 +5,26 @@
 #include "mmio_plugin.h"
 #include "abstract_device.h"
 #include "platform.h"
+#include "qemu_ckpt.h"
+#include <atomic>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <condition_variable>
+#include <functional>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <queue>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 #include <utility>
 
 class processor_t;
+class simif_t;
+class checkpoint_writer_t;
+class checkpoint_reader_t;
 
 class bus_t : public abstract_device_t {
  public:
@@ -21,6 +36,17 @@ class bus_t : public abstract_device_t {
 
  private:
   std::map<reg_t, abstract_device_t*> devices;
+
+  // A direct-mapped cache of pages that lie wholly within one device, so
+  // that most lookups skip the map.  Each entry packs the page number with
+  // one more than the device's index in device_list, in a single word, so
+  // that harts running in parallel can share it without a lock.  Devices
+  // are only added during setup, and adding one empties the cache.
+  static const size_t PAGE_CACHE_SIZE = 1024;
+  // The page number of a 64-bit address leaves 12 bits for the index.
+  static const reg_t PAGE_CACHE_INDEX_BITS = 12;
+  std::vector<std::pair<reg_t, abstract_device_t*>> device_list;
+  std::atomic<uint64_t> page_cache[PAGE_CACHE_SIZE] = {};
 };
 
 class rom_device_t : public abstract_device_t {
@@ -35,7 +61,11 @@ class rom_device_t : public abstract_device_t {
 
 class mem_t : public abstract_device_t {
  public:
-  mem_t(reg_t size);
+  // A flat memory reserves its whole size up front as one lazily zeroed
+  // mapping, so that contents() is a pointer offset rather than a lookup.
+  // A huge one asks for hugetlbfs pages, and for transparent huge pages
+  // when the host has too few of those reserved.
+  mem_t(reg_t size, bool flat = false, bool huge = false);
   mem_t(const mem_t& that) = delete;
   ~mem_t();
 
@@ -43,32 +73,420 @@ class mem_t : public abstract_device_t {
   bool store(reg_t addr, size_t len, const uint8_t* bytes) { return load_store(addr, len, const_cast<uint8_t*>(bytes), true); }
   char* contents(reg_t addr);
   reg_t size() { return sz; }
+  bool is_flat() const { return flat_base != nullptr; }
+
+  // Zero a range without allocating pages that are still untouched.
+  bool clear(reg_t addr, size_t len);
+
+  // Load len bytes of the file from offset on to addr.  Whole pages are
+  // mapped from the file copy-on-write rather than copied, so processes
+  // loading the same file share them in the host page cache until the
+  // target writes to them.
+  bool load_file(reg_t addr, size_t len, int fd, off_t offset);
+  // Write len bytes from addr to the file at offset.  Pages never touched
+  // are skipped, so they read back as zeros from a file that was truncated
+  // to its size beforehand.
+  bool save_file(reg_t addr, size_t len, int fd, off_t offset);
+
+  // Spread a flat memory's pages across the NUMA nodes in nodemask as they
+  // are first touched.
+  bool interleave_nodes(unsigned long nodemask);
+
+  // Map a flat memory from the file at offset, shared with every other
+  // process that maps it, in place of its private pages.
+  bool share(int fd, off_t offset);
+
+  void save_checkpoint(checkpoint_writer_t& ckpt);
+  void restore_checkpoint(checkpoint_reader_t& ckpt);
 
  private:
   bool load_store(reg_t addr, size_t len, uint8_t* bytes, bool store);
+  void free_page(char* page);
 
   std::map<reg_t, char*> sparse_memory_map;
   reg_t sz;
+  char* flat_base;  // null unless flat
+
+  // Pages restored from a checkpoint or mapped from a file live in these
+  // mappings, not on the heap.
+  std::vector<std::pair<char*, size_t>> mappings;
+  char* map_pages(size_t len, int fd, off_t offset, char* fixed = nullptr);
+  void unmap_all();
+  bool map_file(reg_t addr, size_t len, int fd, off_t offset);
+  bool copy_file(reg_t addr, size_t len, int fd, off_t offset);
+  int flat_flags;  // how flat_base was mapped
+  unsigned long flat_nodemask;  // NUMA nodes it is interleaved across, if any
+  bool flat_discardable;  // MADV_DONTNEED zeroes any part of it
+  char* reserve_flat(char* fixed);
 };
 
 class clint_t : public abstract_device_t {
  public:
-  clint_t(std::vector<processor_t*>&, uint64_t freq_hz, bool real_time);
+  // With real_time, mtime follows the host's monotonic clock, in steps of
+  // real_time_precision_ns; a precision no finer than the host's coarse
+  // clock lets mtime be read from that, at next to no cost.
+  clint_t(std::vector<processor_t*>&, uint64_t freq_hz, bool real_time,
+          uint64_t real_time_precision_ns = 0);
   bool load(reg_t addr, size_t len, uint8_t* bytes);
   bool store(reg_t addr, size_t len, const uint8_t* bytes);
   size_t size() { return CLINT_SIZE; }
   void increment(reg_t inc);
+  // Move mtime forward to the earliest timer compare still ahead of it, if
+  // any, as though the harts had idled until then.
+  void advance_to_next_timer();
+  // Re-evaluate proc's timer interrupts after it was reset or wrote one of
+  // the registers they depend on.
+  void timer_changed(processor_t* proc);
+  // Called with each store to the registers, e.g. to mirror it into the
+  // CLINT of another process.
+  void set_store_hook(std::function<void(reg_t, size_t, const uint8_t*)> hook) { store_hook = hook; }
+  void save_checkpoint(checkpoint_writer_t& ckpt);
+  void restore_checkpoint(checkpoint_reader_t& ckpt);
+  // Takes mtime and mtimecmp from the CLINT section of a QEMU checkpoint.
+  void import_qemu_state(const qemu_regs_t& regs);
+  // For handing the timer to a hart running outside the simulator and back
+  uint64_t get_mtime() const { return mtime; }
+  void set_mtime(uint64_t value);
+  uint64_t get_mtimecmp(size_t hart) const { return mtimecmp[hart]; }
+  void set_mtimecmp(size_t hart, uint64_t value);
  private:
   typedef uint64_t mtime_t;
   typedef uint64_t mtimecmp_t;
   typedef uint32_t msip_t;
+  typedef std::pair<mtime_t, size_t> deadline_t;  // mtime, hart index
+
+  // Brings hart i's time CSR and timer interrupts up to date with mtime,
+  // and queues the next mtime at which they change.
+  void sync_hart(size_t i);
+  void sync_all();
+  // Host nanoseconds since the CLINT was made, rounded down to the
+  // precision
+  uint64_t real_time_ns();
+
   std::vector<processor_t*>& procs;
   uint64_t freq_hz;
   bool real_time;
-  uint64_t real_time_ref_secs;
-  uint64_t real_time_ref_usecs;
+  uint64_t real_time_precision_ns;
+  clockid_t host_clock;
+  uint64_t real_time_ref_ns;
   mtime_t mtime;
   std::vector<mtimecmp_t> mtimecmp;
+
+  // The time CSRs read mtime directly, so a hart only needs attention when
+  // mtime reaches its next deadline: the earliest of mtimecmp and, with
+  // Sstc, stimecmp and vstimecmp less htimedelta.  Deadlines are kept in a
+  // min-heap; an entry is live only while it matches next_deadline.
+  std::priority_queue<deadline_t, std::vector<deadline_t>, std::greater<deadline_t>> deadlines;
+  std::vector<mtime_t> next_deadline;
+  std::unordered_map<processor_t*, size_t> hart_index;
+  std::function<void(reg_t, size_t, const uint8_t*)> store_hook;
+};
+
+// A platform-level interrupt controller laid out as riscv,plic0, with two
+// contexts per hart: M-mode, then S-mode.  Sources are level-triggered.
+// Each context caches the source it would have claimed, which an interrupt
+// level change updates by comparing the one source against it, so that
+// devices raising and lowering lines cost the same however many sources
+// there are.  Only a change to the cached source's own state, or to
+// priorities, enables or a threshold, rescans a context's sources, a word
+// of 32 at a time.
+class plic_t : public abstract_device_t {
+ public:
+  plic_t(std::vector<processor_t*>& procs, uint32_t ndev);
+  bool load(reg_t addr, size_t len, uint8_t* bytes);
+  bool store(reg_t addr, size_t len, const uint8_t* bytes);
+  uint32_t num_sources() { return ndev; }
+  void set_interrupt_level(uint32_t id, bool level);
+ private:
+  struct context_t {
+    std::vector<uint32_t> enable;
+    uint32_t threshold = 0;
+    uint32_t best = 0;  // what best_source returns
+    bool asserted = false;  // whether the hart's MEIP or SEIP is set
+  };
+
+  // The highest-priority source pending and enabled above the threshold
+  // for context c, or 0 if there is none; ties go to the lowest ID.
+  uint32_t best_source(size_t c);
+  bool beats(uint32_t id, uint32_t best, uint32_t threshold);
+  // Brings context c's cached source, and its hart's interrupt, up to date
+  // after source id changed or, for id 0, after anything did.
+  void update_context(size_t c, uint32_t id = 0);
+  void source_changed(uint32_t id);
+  static bool bit(const std::vector<uint32_t>& v, uint32_t id) { return (v[id / 32] >> (id % 32)) & 1; }
+  static void set_bit(std::vector<uint32_t>& v, uint32_t id, bool b);
+
+  std::vector<processor_t*>& procs;
+  uint32_t ndev;  // sources are numbered 1 to ndev
+  std::vector<uint32_t> priority;
+  std::vector<uint32_t> level;
+  std::vector<uint32_t> pending;
+  std::vector<uint32_t> claimed;
+  std::vector<context_t> contexts;
+};
+
+// An ns16550a UART on the host's terminal, with byte-wide registers.
+// Output collects in a buffer that a host thread writes out, so the guest
+// never waits on the terminal; input is polled for without blocking at
+// quantum boundaries.
+class ns16550_t : public abstract_device_t {
+ public:
+  ns16550_t(const std::string& args);
+  virtual ~ns16550_t() override;
+  bool load(reg_t addr, size_t len, uint8_t* bytes);
+  bool store(reg_t addr, size_t len, const uint8_t* bytes);
+  virtual void tick(reg_t cycles) override;
+  void attach(plic_t* plic, uint32_t irq);
+  uint32_t interrupt_id() { return irq; }
+  // Takes the registers from the UART section of a QEMU checkpoint.
+  void import_qemu_state(const qemu_regs_t& regs);
+
+ private:
+  void update_interrupt();
+  void flush_output();
+  void writer_main();
+
+  static const size_t OUTPUT_FLUSH_BYTES = 64 * 1024;
+  static const size_t RX_FIFO_SIZE = 64;
+  static const reg_t POLL_INTERVAL = 16;  // quanta between input polls
+
+  plic_t* plic;
+  uint32_t irq;
+  uint8_t dll, dlm, ier, lcr, mcr, scr;
+  bool fifo_enabled;
+  bool thre_pending;  // the transmit-empty interrupt, until IIR reports it
+  std::deque<uint8_t> rx_fifo;
+  reg_t quanta;
+
+  std::string output;  // written by the guest since the last hand-off
+  std::mutex writer_lock;
+  std::condition_variable writer_ready;
+  std::string writing;  // handed to the writer thread
+  bool writer_exit;
+  std::thread writer;
+};
+
+// The virtio-mmio transport (version 2 register layout) that the virtio
+// devices share: feature negotiation, device status, the interrupt, and
+// split virtqueues in guest memory, which the devices reach through host
+// pointers.
+class virtio_mmio_t : public abstract_device_t {
+ public:
+  virtual ~virtio_mmio_t() override {}
+  bool load(reg_t addr, size_t len, uint8_t* bytes);
+  bool store(reg_t addr, size_t len, const uint8_t* bytes);
+  // Connects the device to guest memory and to its interrupt line.
+  void attach(simif_t* sim, plic_t* plic, uint32_t irq);
+  uint32_t interrupt_id() { return irq; }
+
+ protected:
+  // features are the device's, without VIRTIO_F_VERSION_1, which every
+  // device offers and requires.
+  virtio_mmio_t(uint32_t device_id, uint64_t features, size_t num_queues, uint32_t queue_size);
+
+  struct queue_t {
+    uint32_t num;
+    bool ready;
+    reg_t desc_addr, avail_addr, used_addr;
+    uint16_t last_avail;
+    uint16_t used_idx;
+  };
+
+  // One buffer of a descriptor chain; write buffers are the device's to fill.
+  struct desc_t {
+    reg_t addr;
+    uint32_t len;
+    bool write;
+  };
+
+  // The driver has made buffers available in queue q.
+  virtual void notify(size_t q) = 0;
+  // Reads the device configuration space at offset.
+  virtual bool load_config(reg_t offset, size_t len, uint8_t* bytes) = 0;
+  // The driver is resetting the device, whose transport state is reset
+  // right after.
+  virtual void reset_device() {}
+
+  // The head of the next chain the driver made available in q, which
+  // stays available until q.last_avail is advanced past it.
+  bool peek_avail(queue_t& q, uint16_t* head);
+  void read_chain(queue_t& q, uint16_t head, std::vector<desc_t>& chain);
+  // Returns a chain to the driver, having written written bytes to it.
+  void push_used(queue_t& q, uint16_t head, uint32_t written);
+  // Makes the chains pushed since the last call visible to the driver and
+  // interrupts it, unless it asked not to be.
+  void publish_used(queue_t& q);
+  // Host pointers to the guest's memory for [addr, addr + len), split at
+  // page boundaries; false if any of it is not RAM.
+  bool map_guest(reg_t addr, size_t len, std::vector<std::pair<uint8_t*, size_t>>& out);
+  template<class T> T guest_load(reg_t addr);
+  template<class T> void guest_store(reg_t addr, T val);
+
+  simif_t* sim;
+  plic_t* plic;
+  uint32_t irq;
+  uint64_t driver_features;
+  std::vector<queue_t> queues;
+
+ private:
+  void reset_transport();
+
+  const uint32_t device_id;
+  const uint64_t device_features;
+  const uint32_t queue_size;
+  uint32_t device_features_sel, driver_features_sel;
+  uint32_t status;
+  uint32_t interrupt_status;
+  uint32_t queue_sel;
+};
+
+// A virtio block device backed by a host file.  Requests are handed to a
+// pool of host threads as they are notified, and their completions are
+// posted, with an interrupt, at the end of the quantum in which they
+// finish.
+class virtio_blk_t : public virtio_mmio_t {
+ public:
+  // args is the path of the image, with ",ro" appended for a read-only
+  // device.
+  virtio_blk_t(const std::string& args);
+  virtual ~virtio_blk_t() override;
+  virtual void tick(reg_t cycles) override;
+
+ private:
+  struct request_t {
+    uint16_t head;
+    uint32_t type;
+    uint64_t offset;
+    std::vector<std::pair<uint8_t*, size_t>> data;
+    uint8_t* status;
+    uint32_t written;  // bytes put in the driver's buffers
+    uint8_t result;
+  };
+
+  virtual void notify(size_t q) override;
+  virtual bool load_config(reg_t offset, size_t len, uint8_t* bytes) override;
+  virtual void reset_device() override;
+  void submit(uint16_t head);
+  void complete(request_t* req, uint8_t result);
+  void worker_main();
+  void execute(request_t* req);
+
+  static const uint32_t QUEUE_SIZE = 128;
+  static const size_t NUM_WORKERS = 4;
+
+  int fd;
+  bool read_only;
+  uint64_t capacity;  // in 512-byte sectors
+
+  // Requests waiting for a worker, and those finished but not yet posted
+  // to the used ring.
+  std::mutex lock;
+  std::condition_variable work_ready;
+  std::condition_variable drained;
+  std::deque<request_t*> submitted;
+  std::vector<request_t*> finished;
+  size_t in_flight;
+  bool workers_exit;
+  std::vector<std::thread> workers;
+};
+
+// A virtio network device on a host TAP interface.  Frames move straight
+// between the TAP and the guest's buffers, virtio-net header included,
+// and both queues are serviced at quantum boundaries: transmit buffers
+// once the driver has notified them, and received frames every few quanta.
+class virtio_net_t : public virtio_mmio_t {
+ public:
+  // args is "tap:<interface>", optionally followed by ",mac=<xx:xx:...>".
+  virtio_net_t(const std::string& args);
+  virtual ~virtio_net_t() override;
+  virtual void tick(reg_t cycles) override;
+
+ private:
+  virtual void notify(size_t q) override;
+  virtual bool load_config(reg_t offset, size_t len, uint8_t* bytes) override;
+  virtual void reset_device() override;
+  void transmit();
+  void receive();
+  // The iovecs of chain's buffers that are, or are not, the device's to
+  // write; false if a buffer is not RAM.
+  bool map_chain(const std::vector<desc_t>& chain, bool write, std::vector<struct iovec>& iov);
+
+  static const uint32_t QUEUE_SIZE = 256;
+  static const reg_t POLL_INTERVAL = 16;  // quanta between receive polls
+
+  int fd;
+  uint8_t mac[6];
+  bool tx_pending;
+  reg_t quanta;
+};
+
+// A virtio 9P device exporting a host directory over 9P2000.L, which
+// Linux mounts with "mount -t 9p -o trans=virtio,version=9p2000.L <tag>".
+// As with virtio_blk_t, requests go to a pool of host threads, which move
+// file data straight between the host file and the guest's buffers, and
+// replies are posted at the end of the quantum in which they are ready.
+// Files are accessed as the simulator's user, and ownership changes are
+// ignored.  The guest is trusted with the directory: a symlink it swaps in
+// for a directory it has already walked into would lead out of it.
+class virtio_9p_t : public virtio_mmio_t {
+ public:
+  // args is the host directory, with ",tag=<tag>" optionally appended;
+  // the mount tag defaults to "spike".
+  virtio_9p_t(const std::string& args);
+  virtual ~virtio_9p_t() override;
+  virtual void tick(reg_t cycles) override;
+
+ private:
+  struct fid_t;
+
+  struct request_t {
+    uint16_t head;
+    uint8_t type;
+    uint16_t tag;
+    // The driver's message, and the room for the reply
+    std::vector<std::pair<uint8_t*, size_t>> in, out;
+    size_t in_len, out_len;
+    uint32_t written;
+  };
+
+  virtual void notify(size_t q) override;
+  virtual bool load_config(reg_t offset, size_t len, uint8_t* bytes) override;
+  virtual void reset_device() override;
+  void submit(uint16_t head);
+  void worker_main();
+  void execute(request_t* req);
+  // Carries out the message in msg, leaving the body of the reply in reply
+  // and, for a read, the extra bytes of data already put in req->out after
+  // it.  Returns 0, or the errno to reply with instead.
+  int serve(request_t* req, const std::vector<uint8_t>& msg, std::vector<uint8_t>& reply, size_t* extra);
+  // The fid and, since a rename may change it, a copy of its path
+  std::shared_ptr<fid_t> lookup(uint32_t id, std::string* path);
+  void rename_fids(const std::string& from, const std::string& to);
+  std::string host_path(const std::string& path) { return path.empty() ? root : root + "/" + path; }
+
+  static const uint32_t QUEUE_SIZE = 128;
+  static const size_t NUM_WORKERS = 4;
+
+  std::string root;
+  std::string tag;
+
+  // The fids and their paths, relative to root
+  std::mutex fids_lock;
+  std::unordered_map<uint32_t, std::shared_ptr<fid_t>> fids;
+
+  // Requests waiting for a worker, and those finished but not yet posted
+  // to the used ring.  A flush is answered once the request it names is
+  // neither waiting nor running, after that request's reply.
+  std::mutex lock;
+  std::condition_variable work_ready;
+  std::condition_variable drained;
+  std::deque<request_t*> submitted;
+  std::vector<request_t*> finished;
+  std::vector<std::pair<request_t*, uint16_t>> flushes;
+  std::multiset<uint16_t> active_tags;
+  size_t in_flight;
+  bool workers_exit;
+  std::vector<std::thread> workers;
 };
 
 class mmio_plugin_device_t : public abstract_device_t {
@@ -79,9 +497,23 @@ class mmio_plugin_device_t : public abstract_device_t {
   virtual bool load(reg_t addr, size_t len, uint8_t* bytes) override;
   virtual bool store(reg_t addr, size_t len, const uint8_t* bytes) override;
 
+  // Hooks for version 2 plugins; no-ops for version 1.
+  void attach(const mmio_host_t& host);
+  virtual void tick(reg_t cycles) override;
+
  private:
-  mmio_plugin_t plugin;
+  // Hands the posted stores to the plugin.
+  void flush_stores();
+
+  static const size_t MAX_POSTED_STORES = 256;
+
+  mmio_plugin_v2_t plugin;
   void* user_data;
+  mmio_host_t host;
+  // Posted stores, whose bytes are laid end to end in posted_data and
+  // pointed to only when they are handed over.
+  std::vector<mmio_access_t> posted;
+  std::vector<uint8_t> posted_data;
 };
 
 #endif
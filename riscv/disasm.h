@@ -9,6 +9,8 @@
 #include <sstream>
 #include <algorithm>
 #include <vector>
+#include <unordered_map>
+#include <atomic>
 
 extern const char* xpr_name[NXPR];
 extern const char* fpr_name[NFPR];
@@ -90,20 +92,36 @@ class disassembler_t
   void add_insn(disasm_insn_t* insn);
 
  private:
-  static const int HASH_SIZE = 255;
-  std::vector<const disasm_insn_t*> chain[HASH_SIZE+1];
+  // Instructions are filed under the first of these key masks that their
+  // own mask covers.  Keys of the same class are probed together and the
+  // newest match among them wins, so the finer keys below only split the
+  // long per-opcode chains (e.g. OP-V) without changing which instruction
+  // a lookup returns.  Classes are probed in order.
+  static const int NKEYS = 5;
+  static const insn_bits_t KEY_MASK[NKEYS];
+  static const int KEY_CLASS[NKEYS];
+
+  // Entries are (priority, slot) pairs, kept in ascending priority order
+  // and searched back-to-front.
+  typedef std::vector<std::pair<size_t, uint32_t>> bucket_t;
+  std::unordered_map<insn_bits_t, bucket_t> table[NKEYS];
+  size_t next_priority;
+
+  // Direct-mapped memo of recent lookups, keyed by instruction bits.  Each
+  // entry packs (bits << 32) | slot into one word so that threads sharing a
+  // disassembler never see a torn entry.  Slot 0 means empty, MEMO_NONE
+  // means no instruction matched, and otherwise slot indexes insns[slot - 1].
+  // add_insn flushes it once the built-in instructions are in.
+  static const size_t MEMO_SIZE = 4096;
+  static const uint32_t MEMO_NONE = UINT32_MAX;
+  mutable std::atomic<uint64_t> memo[MEMO_SIZE];
+  std::vector<const disasm_insn_t*> insns;
+  bool constructed;
 
   void add_instructions(const isa_parser_t* isa);
 
-  const disasm_insn_t* probe_once(insn_t insn, size_t idx) const;
-
-  static const unsigned int MASK1 = 0x7f;
-  static const unsigned int MASK2 = 0xe003;
-
-  static unsigned int hash(insn_bits_t insn, unsigned int mask)
-  {
-    return (insn & mask) % HASH_SIZE;
-  }
+  uint32_t probe(insn_t insn) const;
+  void clear_memo();
 };
 
 #endif
@@ -0,0 +1,299 @@
+// See LICENSE for license details.
+
+#include "distributed.h"
+#include "devices.h"
+#include "mmu.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// How long the other ranks keep trying to reach rank 0, which may start
+// after them
+static const int CONNECT_TIMEOUT_MS = 60000;
+static const int CONNECT_RETRY_MS = 100;
+
+struct hello_t {
+  uint32_t rank;
+  uint32_t ranks;
+  uint32_t nharts;
+};
+
+distributed_t::distributed_t(size_t rank, size_t ranks, const char* server, size_t nharts)
+  : rank(rank), ranks(ranks), nharts(nharts), listen_fd(-1), fds(ranks, -1),
+    clint(nullptr), applying(false), idle(false), mem_fd(-1), reservation_owners(nullptr)
+{
+  if (ranks < 2 || rank >= ranks || ranks > nharts)
+    throw std::runtime_error("there must be at least two ranks, and no more than harts");
+  first = rank * nharts / ranks;
+  end = (rank + 1) * nharts / ranks;
+
+  const char* colon = strrchr(server, ':');
+  if (!colon || colon == server || !colon[1])
+    throw std::runtime_error(std::string("rank server must be <host>:<port>, not ") + server);
+  host.assign(server, colon - server);
+  port = colon + 1;
+
+  // Listen before loading anything, so that no rank waits on rank 0 for
+  // longer than it must.
+  if (rank == 0) {
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0)
+      throw std::runtime_error(std::string("could not resolve rank server ") + server);
+    int reuseaddr = 1;
+    listen_fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    bool ok = listen_fd >= 0 &&
+      setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuseaddr, sizeof(reuseaddr)) == 0 &&
+      bind(listen_fd, res->ai_addr, res->ai_addrlen) == 0 &&
+      listen(listen_fd, ranks) == 0;
+    freeaddrinfo(res);
+    if (!ok)
+      throw std::runtime_error(std::string("could not listen for ranks on ") + server +
+                               ": " + strerror(errno));
+  }
+}
+
+distributed_t::~distributed_t()
+{
+  for (int fd : fds)
+    if (fd >= 0)
+      close(fd);
+  if (listen_fd >= 0)
+    close(listen_fd);
+  for (auto& m : mappings)
+    munmap(m.first, m.second);
+  if (mem_fd >= 0)
+    close(mem_fd);
+}
+
+void distributed_t::share_memory(const char* path, const std::vector<std::pair<reg_t, mem_t*>>& mems)
+{
+  mem_fd = open(path, O_RDWR | O_CREAT, 0644);
+  if (mem_fd < 0)
+    throw std::runtime_error(std::string("could not open shared memory file ") + path);
+
+  off_t offset = 0;
+  for (auto& m : mems)
+    offset += m.second->size();
+  size_t table_size = (mmu_t::RESERVATION_SLOTS * sizeof(std::atomic<uint32_t>) + PGSIZE - 1) &
+                      ~size_t(PGSIZE - 1);
+  struct stat st;
+  if (fstat(mem_fd, &st) != 0 ||
+      (st.st_size < off_t(offset + table_size) && ftruncate(mem_fd, offset + table_size) != 0))
+    throw std::runtime_error(std::string("could not size shared memory file ") + path);
+
+  offset = 0;
+  for (auto& m : mems) {
+    if (!m.second->share(mem_fd, offset))
+      throw std::runtime_error(std::string("could not map shared memory file ") + path);
+    offset += m.second->size();
+  }
+  void* table = mmap(nullptr, table_size, PROT_READ | PROT_WRITE, MAP_SHARED, mem_fd, offset);
+  if (table == MAP_FAILED)
+    throw std::runtime_error(std::string("could not map shared memory file ") + path);
+  mappings.push_back({table, table_size});
+  // A file grown by ftruncate reads as zeros, which is no owner.
+  reservation_owners = (std::atomic<uint32_t>*)table;
+}
+
+void distributed_t::attach(clint_t* clint)
+{
+  this->clint = clint;
+  clint->set_store_hook([this](reg_t addr, size_t len, const uint8_t* bytes) {
+    if (applying)
+      return;
+    clint_store_t s = {addr, 0, uint32_t(std::min(len, sizeof(uint64_t))), uint32_t(rank)};
+    memcpy(&s.data, bytes, s.len);
+    stores.push_back(s);
+  });
+}
+
+void distributed_t::connect()
+{
+  hello_t expected = {0, uint32_t(ranks), uint32_t(nharts)};
+  int nodelay = 1;
+
+  if (rank == 0) {
+    for (size_t connected = 1; connected < ranks; connected++) {
+      int fd = accept(listen_fd, NULL, NULL);
+      hello_t hello;
+      if (fd < 0 || !recv_all(fd, &hello, sizeof(hello)))
+        throw std::runtime_error("could not accept a rank");
+      if (hello.ranks != expected.ranks || hello.nharts != expected.nharts ||
+          hello.rank == 0 || hello.rank >= ranks || fds[hello.rank] >= 0)
+        throw std::runtime_error("rank " + std::to_string(hello.rank) +
+                                 " does not match the ranks or harts of rank 0, or is taken");
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+      fds[hello.rank] = fd;
+    }
+    close(listen_fd);
+    listen_fd = -1;
+    return;
+  }
+
+  struct addrinfo hints, *res;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0)
+    throw std::runtime_error("could not resolve rank server " + host + ":" + port);
+  int fd = -1;
+  for (int waited = 0; fd < 0 && waited < CONNECT_TIMEOUT_MS; waited += CONNECT_RETRY_MS) {
+    fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (fd >= 0 && ::connect(fd, res->ai_addr, res->ai_addrlen) != 0) {
+      close(fd);
+      fd = -1;
+      usleep(CONNECT_RETRY_MS * 1000);
+    }
+  }
+  freeaddrinfo(res);
+  if (fd < 0)
+    throw std::runtime_error("could not reach rank 0 at " + host + ":" + port);
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+  fds[0] = fd;
+  hello_t hello = expected;
+  hello.rank = rank;
+  if (!send_all(fd, &hello, sizeof(hello)))
+    throw std::runtime_error("could not reach rank 0 at " + host + ":" + port);
+}
+
+bool distributed_t::send_all(int fd, const void* buf, size_t len)
+{
+  const char* p = (const char*)buf;
+  while (len > 0) {
+    ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+bool distributed_t::recv_all(int fd, void* buf, size_t len)
+{
+  char* p = (char*)buf;
+  while (len > 0) {
+    ssize_t n = recv(fd, p, len, 0);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+bool distributed_t::recv_round(int fd, header_t* h, std::vector<clint_store_t>* stores)
+{
+  if (!recv_all(fd, h, sizeof(*h)))
+    return false;
+  size_t base = stores->size();
+  stores->resize(base + h->nstores);
+  return recv_all(fd, stores->data() + base, h->nstores * sizeof(clint_store_t));
+}
+
+bool distributed_t::send_round(int fd, const header_t& h, const clint_store_t* stores)
+{
+  return send_all(fd, &h, sizeof(h)) &&
+         send_all(fd, stores, h.nstores * sizeof(clint_store_t));
+}
+
+void distributed_t::apply(const clint_store_t& s)
+{
+  applying = true;
+  clint->store(s.addr, s.len, (const uint8_t*)&s.data);
+  applying = false;
+}
+
+bool distributed_t::sync(bool local_idle, int* exit_code)
+{
+  header_t h = {local_idle ? SYNC_IDLE : 0, 0, uint32_t(stores.size()), 0};
+
+  if (rank != 0) {
+    bool ok = send_round(fds[0], h, stores.data());
+    stores.clear();
+    if (!ok || !recv_round(fds[0], &h, &stores)) {
+      fprintf(stderr, "rank %zu lost rank 0\n", rank);
+      *exit_code = 1;
+      return false;
+    }
+    if (h.flags & SYNC_EXIT) {
+      *exit_code = h.exit_code;
+      return false;
+    }
+    idle = h.flags & SYNC_IDLE;
+    for (auto& s : stores)
+      apply(s);
+    stores.clear();
+    return true;
+  }
+
+  // Rank 0's stores are already in the list, and the others follow them
+  // in rank order.
+  bool all_idle = local_idle;
+  for (size_t r = 1; r < ranks; r++) {
+    if (!recv_round(fds[r], &h, &stores)) {
+      fprintf(stderr, "rank 0 lost rank %zu\n", r);
+      finish(1);
+      *exit_code = 1;
+      return false;
+    }
+    all_idle &= bool(h.flags & SYNC_IDLE);
+  }
+
+  std::vector<clint_store_t> others;
+  for (size_t r = 1; r < ranks; r++) {
+    others.clear();
+    for (auto& s : stores)
+      if (s.rank != r)
+        others.push_back(s);
+    header_t reply = {all_idle ? SYNC_IDLE : 0, 0, uint32_t(others.size()), 0};
+    if (!send_round(fds[r], reply, others.data())) {
+      fprintf(stderr, "rank 0 lost rank %zu\n", r);
+      finish(1);
+      *exit_code = 1;
+      return false;
+    }
+  }
+
+  idle = all_idle;
+  for (auto& s : stores)
+    if (s.rank != 0)
+      apply(s);
+  stores.clear();
+  return true;
+}
+
+void distributed_t::finish(int code)
+{
+  if (rank != 0)
+    return;
+  // Every other rank is running its round, or waiting for the reply to it.
+  header_t h;
+  std::vector<clint_store_t> discard;
+  for (size_t r = 1; r < ranks; r++) {
+    if (fds[r] < 0)
+      continue;
+    header_t reply = {SYNC_EXIT, code, 0, 0};
+    if (recv_round(fds[r], &h, &discard))
+      send_round(fds[r], reply, nullptr);
+    close(fds[r]);
+    fds[r] = -1;
+  }
+}
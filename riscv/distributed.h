@@ -0,0 +1,101 @@
+// See LICENSE for license details.
+#ifndef _RISCV_DISTRIBUTED_H
+#define _RISCV_DISTRIBUTED_H
+
+#include "decode.h"
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+class mem_t;
+class clint_t;
+
+// Splits the harts of one machine across several spike processes, or
+// ranks, so that more harts run at once than one process's threads and
+// memory allow.  Rank r of n runs harts [r*N/n, (r+1)*N/n) and leaves the
+// rest alone.
+//
+// Guest memory is one file that every rank maps shared, together with the
+// LR/SC reservation table, so loads, stores and AMOs need no messages; the
+// harts' atomics work as with --parallel.  The ranks' CLINTs are kept
+// equal instead: after each round of quanta, every rank sends the CLINT
+// stores its harts made, and whether they all wait for an interrupt, to
+// rank 0 over TCP, which hands every rank the other ranks' stores, in rank
+// order, and whether every hart waits.  So mtime advances in lockstep, and
+// an IPI to another rank's hart arrives at the end of the round.  Rank 0
+// alone serves the HTIF, for every hart, and tells the others when the
+// program exits.
+class distributed_t
+{
+ public:
+  // server is the <host>:<port> rank 0 listens on.
+  distributed_t(size_t rank, size_t ranks, const char* server, size_t nharts);
+  ~distributed_t();
+
+  size_t get_rank() const { return rank; }
+  size_t first_hart() const { return first; }
+  size_t end_hart() const { return end; }
+
+  // Maps mems, in order, and then the reservation table, from the file at
+  // path, growing it as needed.  The file must start out empty or absent.
+  void share_memory(const char* path, const std::vector<std::pair<reg_t, mem_t*>>& mems);
+  std::atomic<uint32_t>* get_reservation_owners() { return reservation_owners; }
+
+  // Mirrors the stores this rank's harts make to clint on the other ranks.
+  void attach(clint_t* clint);
+  // Waits for every rank to be ready to run.
+  void connect();
+  // Ends a round, local_idle saying whether every hart of this rank waits
+  // for an interrupt.  Returns false, and the exit code, once rank 0 has
+  // exited.
+  bool sync(bool local_idle, int* exit_code);
+  // Whether every hart of every rank waited at the last sync
+  bool all_idle() const { return idle; }
+  // On rank 0, tells the other ranks that the program exited with code.
+  void finish(int code);
+
+ private:
+  struct clint_store_t {
+    uint64_t addr;
+    uint64_t data;
+    uint32_t len;
+    uint32_t rank;  // whose hart made it
+  };
+  struct header_t {
+    uint32_t flags;
+    int32_t exit_code;
+    uint32_t nstores;
+    uint32_t reserved;
+  };
+  static const uint32_t SYNC_IDLE = 1;
+  static const uint32_t SYNC_EXIT = 2;
+
+  bool send_all(int fd, const void* buf, size_t len);
+  bool recv_all(int fd, void* buf, size_t len);
+  // A header and its nstores stores, which recv_round appends to stores
+  bool send_round(int fd, const header_t& h, const clint_store_t* stores);
+  bool recv_round(int fd, header_t* h, std::vector<clint_store_t>* stores);
+  void apply(const clint_store_t& s);
+
+  size_t rank;
+  size_t ranks;
+  size_t nharts;
+  size_t first;
+  size_t end;
+  std::string host;
+  std::string port;
+  int listen_fd;
+  std::vector<int> fds;  // on rank 0, per rank; elsewhere, [0] is rank 0
+  clint_t* clint;
+  bool applying;  // replaying another rank's store
+  bool idle;
+  std::vector<clint_store_t> stores;  // made by this rank's harts this round
+
+  int mem_fd;
+  std::vector<std::pair<void*, size_t>> mappings;
+  std::atomic<uint32_t>* reservation_owners;
+};
+
+#endif
@@ -6,16 +6,21 @@
 #include <cassert>
 #include <iostream>
 #include <sstream>
-#include <signal.h>
-#include <unistd.h>
-#include <sys/wait.h>
-#include <sys/types.h>
+
+static const char* default_bootargs(const char* bootargs, bool initrd)
+{
+  if (bootargs)
+    return bootargs;
+  return initrd ? "root=/dev/ram console=hvc0 earlycon=sbi" : "console=hvc0 earlycon=sbi";
+}
 
 std::string make_dts(size_t insns_per_rtc_tick, size_t cpu_hz,
                      reg_t initrd_start, reg_t initrd_end,
                      const char* bootargs,
                      std::vector<processor_t*> procs,
-                     std::vector<std::pair<reg_t, mem_t*>> mems)
+                     std::vector<std::pair<reg_t, mem_t*>> mems,
+                     std::vector<std::pair<reg_t, ns16550_t*>> uarts,
+                     std::vector<std::pair<reg_t, virtio_mmio_t*>> virtio_devices)
 {
   std::stringstream s;
   s << std::dec <<
@@ -30,12 +35,8 @@ std::string make_dts(size_t insns_per_rtc_tick, size_t cpu_hz,
   if (initrd_start < initrd_end) {
     s << "    linux,initrd-start = <" << (size_t)initrd_start << ">;\n"
          "    linux,initrd-end = <" << (size_t)initrd_end << ">;\n";
-    if (!bootargs)
-      bootargs = "root=/dev/ram console=hvc0 earlycon=sbi";
-  } else {
-    if (!bootargs)
-      bootargs = "console=hvc0 earlycon=sbi";
   }
+  bootargs = default_bootargs(bootargs, initrd_start < initrd_end);
     s << "    bootargs = \"";
   for (size_t i = 0; i < strlen(bootargs); i++) {
     if (bootargs[i] == '"')
@@ -44,6 +45,9 @@ std::string make_dts(size_t insns_per_rtc_tick, size_t cpu_hz,
     s << bootargs[i];
   }
     s << "\";\n";
+  if (!uarts.empty()) {
+    s << "    stdout-path = \"/soc/serial@" << std::hex << uarts[0].first << std::dec << "\";\n";
+  }
     s << "  };\n"
          "  cpus {\n"
          "    #address-cells = <1>;\n"
@@ -92,8 +96,46 @@ std::string make_dts(size_t insns_per_rtc_tick, size_t cpu_hz,
   s << std::hex << ">;\n"
          "      reg = <0x" << (clintbs >> 32) << " 0x" << (clintbs & (uint32_t)-1) <<
                      " 0x" << (clintsz >> 32) << " 0x" << (clintsz & (uint32_t)-1) << ">;\n"
-         "    };\n"
-         "  };\n"
+         "    };\n";
+  if (!uarts.empty() || !virtio_devices.empty()) {
+    reg_t plicbs = PLIC_BASE;
+    reg_t plicsz = PLIC_SIZE;
+    s << "    PLIC: interrupt-controller@" << plicbs << " {\n"
+         "      compatible = \"riscv,plic0\";\n"
+         "      #address-cells = <0>;\n"
+         "      #interrupt-cells = <1>;\n"
+         "      interrupt-controller;\n"
+         "      interrupts-extended = <" << std::dec;
+    for (size_t i = 0; i < procs.size(); i++)
+      s << "&CPU" << i << "_intc 11 &CPU" << i << "_intc 9 ";
+    s << ">;\n"
+         "      riscv,ndev = <" << uarts.size() + virtio_devices.size() << ">;\n" << std::hex <<
+         "      reg = <0x" << (plicbs >> 32) << " 0x" << (plicbs & (uint32_t)-1) <<
+                     " 0x" << (plicsz >> 32) << " 0x" << (plicsz & (uint32_t)-1) << ">;\n"
+         "    };\n";
+    for (auto& u : uarts) {
+      s << "    serial@" << u.first << " {\n"
+           "      compatible = \"ns16550a\";\n"
+           "      clock-frequency = <" << std::dec << NS16550_CLOCK_HZ << std::hex << ">;\n"
+           "      reg = <0x" << (u.first >> 32) << " 0x" << (u.first & (uint32_t)-1) <<
+                       " 0x0 0x" << NS16550_SIZE << ">;\n"
+           "      reg-shift = <0>;\n"
+           "      reg-io-width = <1>;\n"
+           "      interrupt-parent = <&PLIC>;\n"
+           "      interrupts = <" << std::dec << u.second->interrupt_id() << std::hex << ">;\n"
+           "    };\n";
+    }
+    for (auto& v : virtio_devices) {
+      s << "    virtio_mmio@" << v.first << " {\n"
+           "      compatible = \"virtio,mmio\";\n"
+           "      reg = <0x" << (v.first >> 32) << " 0x" << (v.first & (uint32_t)-1) <<
+                       " 0x0 0x" << VIRTIO_MMIO_SIZE << ">;\n"
+           "      interrupt-parent = <&PLIC>;\n"
+           "      interrupts = <" << std::dec << v.second->interrupt_id() << std::hex << ">;\n"
+           "    };\n";
+    }
+  }
+  s <<   "  };\n"
          "  htif {\n"
          "    compatible = \"ucb,htif0\";\n"
          "  };\n"
@@ -101,86 +143,196 @@ std::string make_dts(size_t insns_per_rtc_tick, size_t cpu_hz,
   return s.str();
 }
 
-std::string dts_compile(const std::string& dts)
+#define FDT_TRY(x) do { int err = (x); if (err < 0) return err; } while (0)
+
+static int fdt_property_reg(void *fdt, reg_t base, reg_t size)
 {
-  // Convert the DTS to DTB
-  int dts_pipe[2];
-  pid_t dts_pid;
+  fdt64_t reg[2] = { cpu_to_fdt64(base), cpu_to_fdt64(size) };
+  return fdt_property(fdt, "reg", reg, sizeof(reg));
+}
 
-  fflush(NULL); // flush stdout/stderr before forking
-  if (pipe(dts_pipe) != 0 || (dts_pid = fork()) < 0) {
-    std::cerr << "Failed to fork dts child: " << strerror(errno) << std::endl;
-    exit(1);
-  }
+// Writes the tree that make_dts describes.  Each CPU's interrupt
+// controller gets the phandle dtc would give a referenced label: one more
+// than the CPU's index.  The PLIC, if any, comes next.
+static int write_dtb(void *fdt, int size, size_t insns_per_rtc_tick,
+                     size_t cpu_hz, reg_t initrd_start, reg_t initrd_end,
+                     const char* bootargs,
+                     const std::vector<processor_t*>& procs,
+                     const std::vector<std::pair<reg_t, mem_t*>>& mems,
+                     const std::vector<std::pair<reg_t, ns16550_t*>>& uarts,
+                     const std::vector<std::pair<reg_t, virtio_mmio_t*>>& virtio_devices)
+{
+  static const char soc_compatible[] = "ucbbar,spike-bare-soc\0simple-bus";
 
-  // Child process to output dts
-  if (dts_pid == 0) {
-    close(dts_pipe[0]);
-    int step, len = dts.length();
-    const char *buf = dts.c_str();
-    for (int done = 0; done < len; done += step) {
-      step = write(dts_pipe[1], buf+done, len-done);
-      if (step == -1) {
-        std::cerr << "Failed to write dts: " << strerror(errno) << std::endl;
-        exit(1);
-      }
+  FDT_TRY(fdt_create(fdt, size));
+  FDT_TRY(fdt_finish_reservemap(fdt));
+  FDT_TRY(fdt_begin_node(fdt, ""));
+  FDT_TRY(fdt_property_u32(fdt, "#address-cells", 2));
+  FDT_TRY(fdt_property_u32(fdt, "#size-cells", 2));
+  FDT_TRY(fdt_property_string(fdt, "compatible", "ucbbar,spike-bare-dev"));
+  FDT_TRY(fdt_property_string(fdt, "model", "ucbbar,spike-bare"));
+
+  FDT_TRY(fdt_begin_node(fdt, "chosen"));
+  if (initrd_start < initrd_end) {
+    // A DTS cell holds 32 bits, so larger values take two.
+    if (initrd_end <= UINT32_MAX) {
+      FDT_TRY(fdt_property_u32(fdt, "linux,initrd-start", initrd_start));
+      FDT_TRY(fdt_property_u32(fdt, "linux,initrd-end", initrd_end));
+    } else {
+      FDT_TRY(fdt_property_u64(fdt, "linux,initrd-start", initrd_start));
+      FDT_TRY(fdt_property_u64(fdt, "linux,initrd-end", initrd_end));
     }
-    close(dts_pipe[1]);
-    exit(0);
   }
-
-  pid_t dtb_pid;
-  int dtb_pipe[2];
-  if (pipe(dtb_pipe) != 0 || (dtb_pid = fork()) < 0) {
-    std::cerr << "Failed to fork dtb child: " << strerror(errno) << std::endl;
-    exit(1);
+  FDT_TRY(fdt_property_string(fdt, "bootargs", bootargs));
+  if (!uarts.empty()) {
+    std::stringstream stdout_path;
+    stdout_path << "/soc/serial@" << std::hex << uarts[0].first;
+    FDT_TRY(fdt_property_string(fdt, "stdout-path", stdout_path.str().c_str()));
   }
+  FDT_TRY(fdt_end_node(fdt));
 
-  // Child process to output dtb
-  if (dtb_pid == 0) {
-    dup2(dts_pipe[0], 0);
-    dup2(dtb_pipe[1], 1);
-    close(dts_pipe[0]);
-    close(dts_pipe[1]);
-    close(dtb_pipe[0]);
-    close(dtb_pipe[1]);
-    execlp(DTC, DTC, "-O", "dtb", 0);
-    std::cerr << "Failed to run " DTC ": " << strerror(errno) << std::endl;
-    exit(1);
+  FDT_TRY(fdt_begin_node(fdt, "cpus"));
+  FDT_TRY(fdt_property_u32(fdt, "#address-cells", 1));
+  FDT_TRY(fdt_property_u32(fdt, "#size-cells", 0));
+  FDT_TRY(fdt_property_u32(fdt, "timebase-frequency", cpu_hz/insns_per_rtc_tick));
+  for (size_t i = 0; i < procs.size(); i++) {
+    std::string name = "cpu@" + std::to_string(i);
+    std::string mmu_type = procs[i]->get_isa().get_max_xlen() <= 32 ? "riscv,sv32" : "riscv,sv57";
+    FDT_TRY(fdt_begin_node(fdt, name.c_str()));
+    FDT_TRY(fdt_property_string(fdt, "device_type", "cpu"));
+    FDT_TRY(fdt_property_u32(fdt, "reg", i));
+    FDT_TRY(fdt_property_string(fdt, "status", "okay"));
+    FDT_TRY(fdt_property_string(fdt, "compatible", "riscv"));
+    FDT_TRY(fdt_property_string(fdt, "riscv,isa", procs[i]->get_isa().get_isa_string().c_str()));
+    FDT_TRY(fdt_property_string(fdt, "mmu-type", mmu_type.c_str()));
+    FDT_TRY(fdt_property_u32(fdt, "riscv,pmpregions", 16));
+    FDT_TRY(fdt_property_u32(fdt, "riscv,pmpgranularity", 4));
+    FDT_TRY(fdt_property_u32(fdt, "clock-frequency", cpu_hz));
+    FDT_TRY(fdt_begin_node(fdt, "interrupt-controller"));
+    FDT_TRY(fdt_property_u32(fdt, "#address-cells", 2));
+    FDT_TRY(fdt_property_u32(fdt, "#interrupt-cells", 1));
+    FDT_TRY(fdt_property(fdt, "interrupt-controller", NULL, 0));
+    FDT_TRY(fdt_property_string(fdt, "compatible", "riscv,cpu-intc"));
+    FDT_TRY(fdt_property_u32(fdt, "phandle", i + 1));
+    FDT_TRY(fdt_end_node(fdt));
+    FDT_TRY(fdt_end_node(fdt));
   }
+  FDT_TRY(fdt_end_node(fdt));
 
-  close(dts_pipe[1]);
-  close(dts_pipe[0]);
-  close(dtb_pipe[1]);
-
-  // Read-out dtb
-  std::stringstream dtb;
-
-  int got;
-  char buf[4096];
-  while ((got = read(dtb_pipe[0], buf, sizeof(buf))) > 0) {
-    dtb.write(buf, got);
+  for (auto& m : mems) {
+    std::stringstream name;
+    name << "memory@" << std::hex << m.first;
+    FDT_TRY(fdt_begin_node(fdt, name.str().c_str()));
+    FDT_TRY(fdt_property_string(fdt, "device_type", "memory"));
+    FDT_TRY(fdt_property_reg(fdt, m.first, m.second->size()));
+    FDT_TRY(fdt_end_node(fdt));
   }
-  if (got == -1) {
-    std::cerr << "Failed to read dtb: " << strerror(errno) << std::endl;
-    exit(1);
+
+  std::stringstream clint_name;
+  clint_name << "clint@" << std::hex << CLINT_BASE;
+  std::vector<fdt32_t> clint_irqs;
+  for (size_t i = 0; i < procs.size(); i++) {
+    for (uint32_t irq : {3, 7}) {
+      clint_irqs.push_back(cpu_to_fdt32(i + 1));
+      clint_irqs.push_back(cpu_to_fdt32(irq));
+    }
   }
-  close(dtb_pipe[0]);
 
-  // Reap children
-  int status;
-  waitpid(dts_pid, &status, 0);
-  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
-    std::cerr << "Child dts process failed" << std::endl;
-    exit(1);
+  FDT_TRY(fdt_begin_node(fdt, "soc"));
+  FDT_TRY(fdt_property_u32(fdt, "#address-cells", 2));
+  FDT_TRY(fdt_property_u32(fdt, "#size-cells", 2));
+  FDT_TRY(fdt_property(fdt, "compatible", soc_compatible, sizeof(soc_compatible)));
+  FDT_TRY(fdt_property(fdt, "ranges", NULL, 0));
+  FDT_TRY(fdt_begin_node(fdt, clint_name.str().c_str()));
+  FDT_TRY(fdt_property_string(fdt, "compatible", "riscv,clint0"));
+  FDT_TRY(fdt_property(fdt, "interrupts-extended", clint_irqs.data(),
+                       clint_irqs.size() * sizeof(fdt32_t)));
+  FDT_TRY(fdt_property_reg(fdt, CLINT_BASE, CLINT_SIZE));
+  FDT_TRY(fdt_end_node(fdt));
+  if (!uarts.empty() || !virtio_devices.empty()) {
+    uint32_t plic_phandle = procs.size() + 1;
+    std::stringstream plic_name;
+    plic_name << "interrupt-controller@" << std::hex << PLIC_BASE;
+    std::vector<fdt32_t> plic_irqs;
+    for (size_t i = 0; i < procs.size(); i++) {
+      for (uint32_t irq : {11, 9}) {
+        plic_irqs.push_back(cpu_to_fdt32(i + 1));
+        plic_irqs.push_back(cpu_to_fdt32(irq));
+      }
+    }
+    FDT_TRY(fdt_begin_node(fdt, plic_name.str().c_str()));
+    FDT_TRY(fdt_property_string(fdt, "compatible", "riscv,plic0"));
+    FDT_TRY(fdt_property_u32(fdt, "#address-cells", 0));
+    FDT_TRY(fdt_property_u32(fdt, "#interrupt-cells", 1));
+    FDT_TRY(fdt_property(fdt, "interrupt-controller", NULL, 0));
+    FDT_TRY(fdt_property(fdt, "interrupts-extended", plic_irqs.data(),
+                         plic_irqs.size() * sizeof(fdt32_t)));
+    FDT_TRY(fdt_property_u32(fdt, "riscv,ndev", uarts.size() + virtio_devices.size()));
+    FDT_TRY(fdt_property_reg(fdt, PLIC_BASE, PLIC_SIZE));
+    FDT_TRY(fdt_property_u32(fdt, "phandle", plic_phandle));
+    FDT_TRY(fdt_end_node(fdt));
+    for (auto& u : uarts) {
+      std::stringstream name;
+      name << "serial@" << std::hex << u.first;
+      FDT_TRY(fdt_begin_node(fdt, name.str().c_str()));
+      FDT_TRY(fdt_property_string(fdt, "compatible", "ns16550a"));
+      FDT_TRY(fdt_property_u32(fdt, "clock-frequency", NS16550_CLOCK_HZ));
+      FDT_TRY(fdt_property_reg(fdt, u.first, NS16550_SIZE));
+      FDT_TRY(fdt_property_u32(fdt, "reg-shift", 0));
+      FDT_TRY(fdt_property_u32(fdt, "reg-io-width", 1));
+      FDT_TRY(fdt_property_u32(fdt, "interrupt-parent", plic_phandle));
+      FDT_TRY(fdt_property_u32(fdt, "interrupts", u.second->interrupt_id()));
+      FDT_TRY(fdt_end_node(fdt));
+    }
+    for (auto& v : virtio_devices) {
+      std::stringstream name;
+      name << "virtio_mmio@" << std::hex << v.first;
+      FDT_TRY(fdt_begin_node(fdt, name.str().c_str()));
+      FDT_TRY(fdt_property_string(fdt, "compatible", "virtio,mmio"));
+      FDT_TRY(fdt_property_reg(fdt, v.first, VIRTIO_MMIO_SIZE));
+      FDT_TRY(fdt_property_u32(fdt, "interrupt-parent", plic_phandle));
+      FDT_TRY(fdt_property_u32(fdt, "interrupts", v.second->interrupt_id()));
+      FDT_TRY(fdt_end_node(fdt));
+    }
   }
-  waitpid(dtb_pid, &status, 0);
-  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
-    std::cerr << "Child dtb process failed" << std::endl;
+  FDT_TRY(fdt_end_node(fdt));
+
+  FDT_TRY(fdt_begin_node(fdt, "htif"));
+  FDT_TRY(fdt_property_string(fdt, "compatible", "ucb,htif0"));
+  FDT_TRY(fdt_end_node(fdt));
+
+  FDT_TRY(fdt_end_node(fdt));
+  return fdt_finish(fdt);
+}
+
+#undef FDT_TRY
+
+std::string build_dtb(size_t insns_per_rtc_tick, size_t cpu_hz,
+                      reg_t initrd_start, reg_t initrd_end,
+                      const char* bootargs,
+                      std::vector<processor_t*> procs,
+                      std::vector<std::pair<reg_t, mem_t*>> mems,
+                      std::vector<std::pair<reg_t, ns16550_t*>> uarts,
+                      std::vector<std::pair<reg_t, virtio_mmio_t*>> virtio_devices)
+{
+  bootargs = default_bootargs(bootargs, initrd_start < initrd_end);
+
+  // Start from a size that fits the usual configurations, and double it
+  // until the tree fits.
+  std::vector<char> buf(4096 + 1024 * procs.size());
+  int err;
+  while ((err = write_dtb(buf.data(), buf.size(), insns_per_rtc_tick, cpu_hz,
+                          initrd_start, initrd_end, bootargs, procs, mems,
+                          uarts, virtio_devices))
+         == -FDT_ERR_NOSPACE)
+    buf.resize(buf.size() * 2);
+
+  if (err < 0) {
+    std::cerr << "Failed to build dtb: " << fdt_strerror(err) << std::endl;
     exit(1);
   }
 
-  return dtb.str();
+  return std::string(buf.data(), fdt_totalsize(buf.data()));
 }
 
 static int fdt_get_node_addr_size(void *fdt, int node, reg_t *addr,
@@ -11,9 +11,18 @@ std::string make_dts(size_t insns_per_rtc_tick, size_t cpu_hz,
                      reg_t initrd_start, reg_t initrd_end,
                      const char* bootargs,
                      std::vector<processor_t*> procs,
-                     std::vector<std::pair<reg_t, mem_t*>> mems);
+                     std::vector<std::pair<reg_t, mem_t*>> mems,
+                     std::vector<std::pair<reg_t, ns16550_t*>> uarts,
+                     std::vector<std::pair<reg_t, virtio_mmio_t*>> virtio_devices);
 
-std::string dts_compile(const std::string& dts);
+// Builds the DTB for the tree make_dts describes directly with libfdt.
+std::string build_dtb(size_t insns_per_rtc_tick, size_t cpu_hz,
+                      reg_t initrd_start, reg_t initrd_end,
+                      const char* bootargs,
+                      std::vector<processor_t*> procs,
+                      std::vector<std::pair<reg_t, mem_t*>> mems,
+                      std::vector<std::pair<reg_t, ns16550_t*>> uarts,
+                      std::vector<std::pair<reg_t, virtio_mmio_t*>> virtio_devices);
 
 int fdt_get_offset(void *fdt, const char *field);
 int fdt_get_first_subnode(void *fdt, int node);
@@ -3,21 +3,46 @@
 #include "processor.h"
 #include "mmu.h"
 #include "disasm.h"
+#include "extension.h"
+#include "arith.h"
+#include "bbv.h"
+#include "call_stacks.h"
+#include "vector_stats.h"
+#include "trap_profile.h"
+#include "hart_observer.h"
+#include "commit_log.h"
+#include "insn_log.h"
 #include <cassert>
 
 #ifdef RISCV_ENABLE_SIFT
-# include "sift_writer.h"
+# include "sift_stream.h"
 #endif
 
+const char* processor_t::get_enclosing_symbol(uint64_t addr, uint64_t* start)
+{
+  if (!(addr >= symbol_cache.start && addr < symbol_cache.end)) {
+    uint64_t end;
+    const char* name = sim->get_enclosing_symbol(addr, start, &end);
+    if (!name)
+      return nullptr;
+    symbol_cache = {*start, end, name};
+  }
+  *start = symbol_cache.start;
+  return symbol_cache.name;
+}
+
+void processor_t::timer_changed()
+{
+  if (sim)
+    sim->timer_changed(this);
+}
+
 #ifdef RISCV_ENABLE_COMMITLOG
 static void commit_log_reset(processor_t* p)
 {
   p->get_state()->log_reg_write.clear();
   p->get_state()->log_mem_read.clear();
   p->get_state()->log_mem_write.clear();
-  p->get_state()->log_addr_valid = 0;
-  p->get_state()->log_is_branch = false;
-  p->get_state()->log_is_branch_taken = false;
 }
 
 static void commit_log_stash_privilege(processor_t* p)
@@ -28,59 +53,89 @@ static void commit_log_stash_privilege(processor_t* p)
   state->last_inst_flen = p->get_flen();
 }
 
-uint32_t sift_executed_insn;
-
-
-void record_executed_insn (uint64_t insn)
+const char* processor_t::get_symbol(uint64_t addr)
 {
-  sift_executed_insn = insn;
+  return sim->get_symbol(addr);
 }
 
-static void commit_log_print_value(FILE *log_file, int width, const void *data)
+static void commit_log_record_insn(processor_t *p, reg_t pc, insn_t insn)
 {
-  assert(log_file);
+  commit_log_writer_t* writer = p->get_commit_log_writer();
+  state_t* state = p->get_state();
 
-  switch (width) {
-    case 8:
-      fprintf(log_file, "0x%01" PRIx8, *(const uint8_t *)data);
-      break;
-    case 16:
-      fprintf(log_file, "0x%04" PRIx16, *(const uint16_t *)data);
-      break;
-    case 32:
-      fprintf(log_file, "0x%08" PRIx32, *(const uint32_t *)data);
-      break;
-    case 64:
-      fprintf(log_file, "0x%016" PRIx64, *(const uint64_t *)data);
-      break;
-    default:
-      // max lengh of vector
-      if (((width - 1) & width) == 0) {
-        const uint64_t *arr = (const uint64_t *)data;
+  commit_log_insn_t rec = {};
+  rec.core = p->get_id();
+  rec.priv = state->last_inst_priv;
+  rec.xlen = state->last_inst_xlen;
+  rec.flen = state->last_inst_flen;
+  rec.insn_len = insn.length();
+  rec.pc = pc;
+  rec.insn = insn.bits();
+  for (auto& item : state->log_reg_write) {
+    if (item.first == 0)
+      continue;
+    rec.nregs++;
+    if ((item.first & 0xf) == 2 || (item.first & 0xf) == 3)
+      rec.flags |= COMMIT_LOG_VCONFIG;
+  }
+  if (writer->compact())
+    rec.flags |= COMMIT_LOG_VBYTES;
+  rec.nloads = state->log_mem_read.size();
+  rec.nstores = state->log_mem_write.size();
+  writer->put(rec);
+
+  if (rec.flags & COMMIT_LOG_VCONFIG) {
+    commit_log_vconfig_t vconfig;
+    vconfig.vsew = p->VU.vsew;
+    vconfig.fractional = p->VU.vflmul < 1;
+    vconfig.lmul = vconfig.fractional ? (reg_t)(1 / p->VU.vflmul) : (reg_t)p->VU.vflmul;
+    vconfig.vl = p->VU.vl->read();
+    vconfig.vlen = p->VU.VLEN;
+    writer->put(vconfig);
+  }
 
-        fprintf(log_file, "0x");
-        for (int idx = width / 64 - 1; idx >= 0; --idx) {
-          fprintf(log_file, "%016" PRIx64, arr[idx]);
+  for (auto& item : state->log_reg_write) {
+    if (item.first == 0)
+      continue;
+    writer->put<uint32_t>(item.first);
+    switch (item.first & 0xf) {
+      case 1:
+        writer->write(item.second.v, 16);
+        break;
+      case 2: {
+        const uint8_t* vreg = &p->VU.elt<uint8_t>(item.first >> 4, 0);
+        if (rec.flags & COMMIT_LOG_VBYTES) {
+          commit_log_vbytes_t range = {(uint32_t)item.second.v[0],
+                                       (uint32_t)(item.second.v[1] - item.second.v[0])};
+          writer->put(range);
+          writer->write(vreg + range.offset, range.bytes);
+        } else {
+          writer->write(vreg, p->VU.VLEN / 8);
         }
-      } else {
-        abort();
+        break;
       }
-      break;
+      case 3:
+        break;
+      default:
+        writer->put<uint64_t>(item.second.v[0]);
+        break;
+    }
   }
-}
 
-static void commit_log_print_value(FILE *log_file, int width, uint64_t val)
-{
-  commit_log_print_value(log_file, width, &val);
-}
+  for (auto& item : state->log_mem_read)
+    writer->put<uint64_t>(std::get<0>(item));
 
-const char* processor_t::get_symbol(uint64_t addr)
-{
-  return sim->get_symbol(addr);
+  for (auto& item : state->log_mem_write) {
+    commit_log_store_t store = {std::get<0>(item), std::get<1>(item), std::get<2>(item)};
+    writer->put(store);
+  }
 }
 
 static void commit_log_print_insn(processor_t *p, reg_t pc, insn_t insn)
 {
+  if (p->get_commit_log_writer())
+    return commit_log_record_insn(p, pc, insn);
+
   FILE *log_file = p->get_log_file();
 
   auto& reg = p->get_state()->log_reg_write;
@@ -175,138 +230,192 @@ static void commit_log_stash_privilege(processor_t* p) {}
 static void commit_log_print_insn(processor_t* p, reg_t pc, insn_t insn) {}
 #endif
 
-inline void processor_t::update_histogram(reg_t pc)
+// Counts one execution for -g and --insn-mix, in the icache entry the
+// instruction came from when it is still cached there.
+inline void processor_t::count_execution(icache_entry_t* entry, reg_t pc, insn_t insn)
 {
-#ifdef RISCV_ENABLE_HISTOGRAM
-  pc_histogram[pc]++;
-#endif
+  if (likely(entry && entry->tag == pc) &&
+      !(insn_mix_enabled && is_vector_insn(insn.bits())))
+    entry->executions++;
+  else
+    count_executions(pc, insn.bits(), 1);
 }
 
 
 
-static void log_print_sift_trace(processor_t* p, reg_t pc, insn_t insn)
+#ifdef RISCV_ENABLE_SIFT
+static bool insn_writes_memory(uint32_t bits)
+{
+  if ((bits & 3) != 3) {
+    switch (bits & 0xe003) {
+      case 0xa000:  // c.fsd
+      case 0xc000:  // c.sw
+      case 0xe000:  // c.sd, c.fsw
+      case 0xa002:  // c.fsdsp
+      case 0xc002:  // c.swsp
+      case 0xe002:  // c.sdsp, c.fswsp
+        return true;
+    }
+    return false;
+  }
+  switch (bits & 0x7f) {
+    case 0x23:  // stores
+    case 0x27:  // FP and vector stores
+      return true;
+    case 0x2f:  // AMOs and SC, but not LR
+      return (bits >> 27) != 0x02;
+  }
+  return false;
+}
+
+// Adds what an untraced instruction touched before the ROI to the footprint
+// the reader is warmed with.
+static void sift_warm(state_t* state, reg_t pc, uint32_t bits)
 {
+  sift_warmup_t* warmup = state->log_warmup;
+  warmup->fetch(pc);
+  bool write = insn_writes_memory(bits);
+  for (unsigned i = 0; i < state->log_addr_valid; i++)
+    warmup->access(pc, state->log_addr[i], write);
+  if (state->log_is_branch)
+    warmup->branch(pc, state->log_is_branch_taken);
+}
+#endif
+
 #ifdef RISCV_ENABLE_SIFT
+// A user ecall that Sniper models, such as a futex wait or a clone, goes
+// into the trace with its arguments so Sniper can block, wake and spawn
+// threads instead of simulating their spin loops.
+static void log_sift_syscall(processor_t* p)
+{
+  state_t* state = p->get_state();
+  int number = sift_host_syscall(state->XPR[17]);
+  if (number < 0)
+    return;
+  uint64_t args[6];
+  for (int i = 0; i < 6; i++)
+    args[i] = state->XPR[10 + i];
+  state->log_writer->Syscall(number, args);
+}
+#endif
+
+static void log_print_sift_trace(processor_t* p, reg_t pc, insn_fetch_t fetch)
+{
+#ifdef RISCV_ENABLE_SIFT
+  host_prof_scope_t prof(HOST_PROF_SIFT_TRACE);
+  // Outside the ROI or in filtered code nothing is logged, so there is
+  // nothing to emit unless this is the ROI start marker switching tracing on.
+  state_t* state = p->get_state();
+  uint32_t bits = fetch.insn.bits();
+  bool roi_entered = false;
+  if (unlikely(!state->log_sift_active)) {
+    if (bits == 0x00100013 && !state->log_sift_in_roi && p->get_sift_roi_only()) {
+      state->log_sift_in_roi = true;
+      roi_entered = true;
+      state->log_sift_warming = false;
+      if (state->log_warmup && state->log_writer)
+        state->log_warmup->emit(state->log_writer);
+    } else if (state->log_sift_warming) {
+      sift_warm(state, pc, bits);
+    }
+    state->log_sift_active = state->log_sift_in_roi && !state->log_filtered;
+    if (!state->log_sift_active)
+      return;
+    // Nothing captured what this instruction accessed.
+    state->sift_log_reset();
+  }
+
+  if (unlikely(state->log_segment_length != 0))
+    p->next_sift_insn(pc);
+
   uint64_t addr = pc;
-  uint64_t size = insn.length();
+  uint64_t size = fetch.insn.length();
+  sift_stream_t* writer = p->get_state()->log_writer;
+
+  // Offer the writer the code pages this instruction spans the first time
+  // it runs from them.
+  if (writer->sends_code_pages()) {
+    for (reg_t page = addr & PGMASK; page < addr + size; page += PGSIZE) {
+      if (unlikely(!writer->has_code_page(page))) {
+        uint8_t code[PGSIZE];
+        p->get_mmu()->copy_insn_page(page, code);
+        writer->add_code_page(page, code);
+      }
+    }
+  }
+
   uint64_t num_addresses = p->get_state()->log_addr_valid;
   uint64_t *addresses = p->get_state()->log_addr;
   reg_t    *wr_regs = p->get_state()->log_reg_addr;
   bool     is_branch = p->get_state()->log_is_branch;
   bool     taken = p->get_state()->log_is_branch_taken;
 
-  auto& reg = p->get_state()->log_reg_write;
-
-  std::vector<reg_t>vreg_array;
-  for (auto i: reg) {
-    if ((i.first & 0xf) == 2) {
-      vreg_array.push_back(i.first >> 4);
-    }
-  }
+  // Bucket the logged addresses by vector register with a counting sort:
+  // one pass to count, one to scatter, so every micro-op gets its addresses
+  // as a contiguous run without rescanning log_addr[] per register.
+  reg_t vreg_mask = p->get_state()->log_vreg_write;
+  unsigned int vreg_count[NVPR] = {};
   for (uint64_t addr_i = 0; addr_i < num_addresses; addr_i++) {
-    if (std::find(vreg_array.begin(), vreg_array.end(), wr_regs[addr_i]) == vreg_array.end()) {
-      vreg_array.push_back(wr_regs[addr_i]);
-    }
+    assert(wr_regs[addr_i] < NVPR);
+    vreg_mask |= reg_t(1) << wr_regs[addr_i];
+    vreg_count[wr_regs[addr_i]]++;
   }
 
-  std::sort(vreg_array.begin(), vreg_array.end() );
-
-  if (vreg_array.size() > 0) {
-    for (reg_t vreg_idx = 0; vreg_idx < vreg_array.size(); vreg_idx++) {
-      uint64_t uop_addresses[1024];
-
-      uint64_t num_mem_addr = 0;
-
-      // fprintf (stderr, "vreg_array.size() = %d, vreg_idx = %d\n", vreg_array.size(), vreg_array[vreg_idx]);
-
-      for (uint64_t addr_i = 0; addr_i < num_addresses; addr_i++) {
-        if (vreg_array[vreg_idx] == wr_regs[addr_i]) {
-          uop_addresses[num_mem_addr++] = addresses[addr_i];
-          // fprintf (stderr, "vreg = %d, address set to %08lx\n", vreg_array[vreg_idx], addresses[addr_i]);
-        }
-      }
-      p->get_state()->log_writer->Instruction(addr, size, num_mem_addr, uop_addresses, is_branch, taken, 0 /*is_predicate*/, 1 /*executed*/);
-
-      // One increment vd
-      char vd_origin = (sift_executed_insn >> 7) & 0x01f;
-      vd_origin++;
-      // fprintf(stderr, "Before sift_executed_insn = %08lx\n", sift_executed_insn);
-      sift_executed_insn = (sift_executed_insn & ~(0x1f << 7)) | (vd_origin << 7);
-      // fprintf(stderr, "After sift_executed_insn = %08lx\n", sift_executed_insn);
-
-      bool is_opivx = ((sift_executed_insn & 0x7f) == 0x57) &
-          (((sift_executed_insn >> 12) & 0x7) == 0x4);
-      bool is_opfvf = ((sift_executed_insn & 0x7f) == 0x57) &
-          (((sift_executed_insn >> 12) & 0x7) == 0x5);
-      bool is_opmvx = ((sift_executed_insn & 0x7f) == 0x57) &
-          (((sift_executed_insn >> 12) & 0x7) == 0x6);
-
-      bool is_opfvv_vfunary0 = ((sift_executed_insn & 0x7f) == 0x57) &
-          (((sift_executed_insn >> 12) & 0x7) == 0x1) &
-          (((sift_executed_insn >> 26) & 0x3f) == 0x12);
-      bool is_opfvv_vfunary1 = ((sift_executed_insn & 0x7f) == 0x57) &
-          (((sift_executed_insn >> 12) & 0x7) == 0x1) &
-          (((sift_executed_insn >> 26) & 0x3f) == 0x13);
-      bool is_opmvv_vxunary1 = ((sift_executed_insn & 0x7f) == 0x57) &
-          (((sift_executed_insn >> 12) & 0x7) == 0x2) &
-          (((sift_executed_insn >> 26) & 0x3f) == 0x13);
-      bool is_opmvv_vmunary1 = ((sift_executed_insn & 0x7f) == 0x57) &
-          (((sift_executed_insn >> 12) & 0x7) == 0x2) &
-          (((sift_executed_insn >> 26) & 0x3f) == 0x14);
-
-      bool is_vlx_indexed = ((sift_executed_insn & 0x7f) == 0x07) & (((sift_executed_insn >> 26) & 0x1) == 1);
-      bool is_vsx_indexed = ((sift_executed_insn & 0x7f) == 0x27) & (((sift_executed_insn >> 26) & 0x1) == 1);
-
-      bool is_opivi = ((sift_executed_insn & 0x7f) == 0x57) &
-          (((sift_executed_insn >> 12) & 0x7) == 0x3);
-
-      // One increment vs1
-      if ((num_addresses == 0) &  // not memory instruction
-          !is_opfvv_vfunary0 & !is_opfvv_vfunary1 &
-          !is_opmvv_vxunary1 & !is_opmvv_vmunary1 &
-          !is_opivx & !is_opfvf & !is_opmvx & !is_opivi) {
-        char vs1_origin = (sift_executed_insn >> 15) & 0x01f;
-        vs1_origin++;
-        sift_executed_insn = (sift_executed_insn & ~(0x1f << 15)) | (vs1_origin << 15);
+  if (vreg_mask != 0 && state->log_sift_uop_regs == 0) {
+    p->get_state()->log_writer->Instruction(addr, size, bits, num_addresses, addresses, is_branch, taken, 0 /*is_predicate*/, 1 /*executed*/);
+  } else if (vreg_mask != 0) {
+    reg_t *uop_addresses = p->get_state()->log_uop_addr;
+    unsigned int vreg_start[NVPR], vreg_fill[NVPR];
+    for (unsigned int vreg = 0, offset = 0; vreg < NVPR; vreg++) {
+      vreg_start[vreg] = vreg_fill[vreg] = offset;
+      offset += vreg_count[vreg];
+    }
+    for (uint64_t addr_i = 0; addr_i < num_addresses; addr_i++)
+      uop_addresses[vreg_fill[wr_regs[addr_i]]++] = addresses[addr_i];
+
+    // Each run of log_sift_uop_regs registers of the group, or each part
+    // of a register, becomes one micro-op whose register fields advance as
+    // described by the plan computed at decode time.  A run's addresses
+    // are contiguous because the registers are bucketed in order.
+    uint32_t uop_bits = bits;
+    uint32_t uop_step = num_addresses == 0 ? fetch.sift_plan.arith_step : fetch.sift_plan.mem_step;
+    unsigned regs = state->log_sift_uop_regs, parts = state->log_sift_uop_parts;
+    for (reg_t mask = vreg_mask; mask != 0; ) {
+      int first = ctz(mask), last = first;
+      uint32_t run_bits = uop_bits;
+      for (unsigned i = 0; i < regs && mask != 0; i++, mask &= mask - 1) {
+        last = ctz(mask);
+        uop_bits += uop_step;
       }
-
-      if (num_addresses == 0 ||  // arithmetic instruction
-          is_vlx_indexed ||
-          is_vsx_indexed) {
-        if (is_opfvv_vfunary0 & (sift_executed_insn >> 18) & 1 || // Widening Convertion
-            (MASK_VMV_V_X & sift_executed_insn) == MATCH_VMV_V_X) {  // VMV_V_X
-          // Do nothing
-        } else {
-          // One increment vs2
-          char vs2_origin = (sift_executed_insn >> 20) & 0x01f;
-          vs2_origin++;
-          sift_executed_insn = (sift_executed_insn & ~(0x1f << 20)) | (vs2_origin << 20);
-        }
+      unsigned start = vreg_start[first];
+      unsigned count = vreg_start[last] + vreg_count[last] - start;
+      for (unsigned part = 0; part < parts; part++) {
+        unsigned from = count * part / parts, to = count * (part + 1) / parts;
+        p->get_state()->log_writer->Instruction(addr, size, run_bits, to - from, &uop_addresses[start + from], is_branch, taken, 0 /*is_predicate*/, 1 /*executed*/);
       }
     }
   } else {
-    p->get_state()->log_writer->Instruction(addr, size, num_addresses, addresses, is_branch, taken, 0 /*is_predicate*/, 1 /*executed*/);
-    if (sift_executed_insn == 0x00100013) {
+    p->get_state()->log_writer->Instruction(addr, size, bits, num_addresses, addresses, is_branch, taken, 0 /*is_predicate*/, 1 /*executed*/);
+    if (bits == 0x00100013) {
       p->get_state()->log_writer->Magic (1, 0, 0);   // SIM_ROI_START = 1 at sim_api.h
+      if (roi_entered) {
+        // The vsetvl that configured the vector unit was not traced.
+        p->get_state()->log_writer->VectorConfig(p->VU.vl->read(), p->VU.vtype->read());
+      }
     }
-    if (sift_executed_insn == 0x00200013) { 
+    if (bits == 0x00200013) { 
       p->get_state()->log_writer->Magic (2, 0, 0);   // SIM_ROI_END = 2 at sim_api.h
+      if (p->get_sift_roi_only()) {
+        state->log_sift_in_roi = state->log_sift_active = false;
+        state->log_sift_warming = state->log_warmup != nullptr;
+      }
     }
-    if ((sift_executed_insn & MASK_VSETVLI) == MATCH_VSETVLI ||
-        (sift_executed_insn & MASK_VSETIVLI) == MATCH_VSETIVLI ||
-        (sift_executed_insn & MASK_VSETVL)   == MATCH_VSETVL) {
-      auto vl = p->VU.vl;
-      auto vtype = p->VU.vtype;
-      auto vl_value = vl->read();
-      auto vtype_value = vtype->read();
-      p->get_state()->log_writer->Magic(5, vl_value, vtype_value);  // SIM_CMD_USER = 5 at sim_api.h
+    if ((bits & MASK_VSETVLI) == MATCH_VSETVLI ||
+        (bits & MASK_VSETIVLI) == MATCH_VSETIVLI ||
+        (bits & MASK_VSETVL)   == MATCH_VSETVL) {
+      p->get_state()->log_writer->VectorConfig(p->VU.vl->read(), p->VU.vtype->read());
     }
   }
-
-  // p->get_state()->log_addr = 0;
-  p->get_state()->log_addr_valid = 0;
-  p->get_state()->log_is_branch = false;
-  p->get_state()->log_is_branch_taken = false;
 #endif
 }
 
@@ -315,43 +424,58 @@ static void log_print_sift_trace(processor_t* p, reg_t pc, insn_t insn)
 // function calls.
 static inline reg_t execute_insn(processor_t* p, reg_t pc, insn_fetch_t fetch)
 {
+  if (unlikely(p->get_insn_log_batch() != nullptr) && !p->get_state()->serialized)
+    p->get_insn_log_batch()->insn(pc, fetch.insn.bits());
+
 #ifdef RISCV_ENABLE_COMMITLOG
-  commit_log_reset(p);
-  commit_log_stash_privilege(p);
+  if (unlikely(p->get_log_capturing())) {
+    commit_log_reset(p);
+    commit_log_stash_privilege(p);
+  }
+#endif
+#ifdef RISCV_ENABLE_SIFT
+  if (p->get_state()->log_sift_capturing())
+    p->get_state()->sift_log_reset();
 #endif
 
   reg_t npc;
 
   try {
-    npc = fetch.func(p, fetch.insn, pc);
+    npc = fetch.func(p, fetch.func_insn, pc) - fetch.npc_adjust;
+    // Like a thrown trap, a raised one is not logged.
+    if (unlikely(npc == PC_TRAP)) {
+#ifdef RISCV_ENABLE_SIFT
+      if (p->get_state()->log_sift_syscalls && p->get_state()->log_sift_active &&
+          p->get_state()->pending_trap == CAUSE_USER_ECALL)
+        log_sift_syscall(p);
+#endif
+      return npc;
+    }
     if (npc != PC_SERIALIZE_BEFORE) {
 
 #ifdef RISCV_ENABLE_COMMITLOG
-      record_executed_insn (fetch.insn.bits());
-      if (p->get_log_commits_enabled()) {
+      if (p->get_log_commits_enabled() && !p->get_state()->log_filtered) {
         commit_log_print_insn(p, pc, fetch.insn);
       }
 #endif
 
-      log_print_sift_trace(p, pc, fetch.insn);
+      log_print_sift_trace(p, pc, fetch);
 
     }
 #ifdef RISCV_ENABLE_COMMITLOG
   } catch (wait_for_interrupt_t &t) {
-      record_executed_insn (fetch.insn.bits());
-      if (p->get_log_commits_enabled()) {
+      if (p->get_log_commits_enabled() && !p->get_state()->log_filtered) {
         commit_log_print_insn(p, pc, fetch.insn);
-        log_print_sift_trace(p, pc, fetch.insn);
+        log_print_sift_trace(p, pc, fetch);
       }
       throw;
   } catch(mem_trap_t& t) {
       //handle segfault in midlle of vector load/store
-      if (p->get_log_commits_enabled()) {
+      if (p->get_log_commits_enabled() && !p->get_state()->log_filtered) {
         for (auto item : p->get_state()->log_reg_write) {
           if ((item.first & 3) == 3) {
-            record_executed_insn (fetch.insn.bits());
             commit_log_print_insn(p, pc, fetch.insn);
-            log_print_sift_trace(p, pc, fetch.insn);
+            log_print_sift_trace(p, pc, fetch);
             break;
           }
         }
@@ -361,19 +485,162 @@ static inline reg_t execute_insn(processor_t* p, reg_t pc, insn_fetch_t fetch)
   } catch(...) {
     throw;
   }
-  p->update_histogram(pc);
+  if (unlikely(p->get_observing_retires()))
+    p->observe_retire(pc, npc, fetch.insn);
 
   return npc;
 }
 
+void processor_t::observe_retire(reg_t pc, reg_t npc, insn_t insn)
+{
+  reg_t len = insn.length();
+  if (bbv)
+    bbv->retire(pc, npc, len);
+  if (call_stacks)
+    call_stacks->retire(pc, npc, insn);
+  if (vector_stats)
+    vector_stats->retire(insn);
+  if (!observer)
+    return;
+
+  // Blocks end as bbv_profiler_t's do.
+  if (observed_insns != 0 && pc != observed_next_pc) {
+    observer->block_retired(this, observed_pc, observed_insns);
+    observed_insns = 0;
+  }
+  if (observed_insns++ == 0)
+    observed_pc = pc;
+  observed_next_pc = npc;
+  if (npc != pc + len) {
+    observer->block_retired(this, observed_pc, observed_insns);
+    observed_insns = 0;
+  }
+}
+
 bool processor_t::slow_path()
 {
   return debug || state.single_step != state.STEP_NONE || state.debug_mode;
 }
 
 // fetch/decode/execute loop
+// How much of a block may run without instruction handlers: nothing while
+// anything observes single instructions, and only 32-bit instructions while
+// the C extension is disabled.
+static inline int inline_level(processor_t* p)
+{
+#ifdef RISCV_ENABLE_COMMITLOG
+  if (p->get_log_commits_enabled())
+    return 0;
+#endif
+#ifdef RISCV_ENABLE_SIFT
+  if (p->get_state()->log_sift_capturing())
+    return 0;
+#endif
+  if (p->get_counting_executions() || p->get_insn_log_batch() != nullptr ||
+      p->get_observing_retires() || p->get_branch_tracer() != nullptr)
+    return 0;
+  return p->extension_enabled('C') ? 2 : 1;
+}
+
+// The block cache's fast path is direct-threaded: each pre-decoded
+// operation has its own label in processor_t::step and ends with its own
+// indirect jump to the next instruction's, so the host's branch predictor
+// learns what follows each operation instead of sharing one dispatch
+// branch among all of them.  Without GNU C's labels as values, a switch
+// stands in for the jump table.
+#ifdef __GNUC__
+# define INLINE_LABEL_ADDRESS(name) &&inline_##name,
+# define INLINE_FUSED_LABEL_ADDRESS(first, second) &&inline_##first##_##second,
+# define INLINE_DISPATCH(op) goto *inline_handlers[op]
+#else
+# define INLINE_CASE(name) case INLINE_##name: goto inline_##name;
+# define INLINE_FUSED_CASE(first, second) \
+  case INLINE_##first##_##second: goto inline_##first##_##second;
+# define INLINE_DISPATCH(op) \
+  switch (op) { \
+    INLINE_OPS(INLINE_CASE) \
+    INLINE_FUSED_OPS(INLINE_FUSED_CASE) \
+    default: goto inline_NONE; \
+  }
+#endif
+
+// Retire the current block entry and dispatch the next one, following the
+// block's successors; leave the block when control goes anywhere else.
+#define INLINE_NEXT() \
+  do { \
+    if (i == block->ninsns) { \
+      insn_block_t* next = block->successor(pc); \
+      if (unlikely(!next)) { \
+        prev = block; \
+        goto block_done; \
+      } \
+      block = next; \
+      level = inline_level(this); \
+      i = 0; \
+    } else if (unlikely(pc != entry->npc)) { \
+      goto block_done; \
+    } \
+    if (unlikely(instret + 1 == n)) \
+      goto block_done; \
+    instret++; \
+    state.pc = pc; \
+    entry = &block->insns[i++]; \
+    INLINE_DISPATCH(level > entry->rvc ? entry->op : INLINE_NONE); \
+  } while (0)
+
+#define INLINE_HANDLER(name, value) \
+  inline_##name: \
+    xpr.write(entry->rd, sext_xlen(value)); \
+    pc = sext_xlen(entry->npc); \
+    INLINE_NEXT()
+
+#define INLINE_LOAD(name, type) \
+  inline_##name: \
+    xpr.write(entry->rd, _mmu->load_##type(xpr[entry->rs1] + entry->imm)); \
+    pc = sext_xlen(entry->npc); \
+    INLINE_NEXT()
+
+#define INLINE_STORE(name, type) \
+  inline_##name: \
+    _mmu->store_##type(xpr[entry->rs1] + entry->imm, xpr[entry->rs2]); \
+    pc = sext_xlen(entry->npc); \
+    INLINE_NEXT()
+
+// Without the C extension a jump to a target that is not 4-byte aligned
+// traps; the handler raises that.
+#define INLINE_JUMP(rd_value) \
+  if (unlikely((target & 2) && level < 2)) \
+    goto inline_NONE; \
+  xpr.write(entry->rd, rd_value); \
+  pc = sext_xlen(target); \
+  INLINE_NEXT()
+
+// A fused pair retires its first instruction, an ALU op, and jumps straight
+// to the second's handler.  The pair is split when only the first may run.
+#define INLINE_FUSED(first, second, first_value) \
+  inline_##first##_##second: \
+    if (unlikely(instret + 1 == n)) \
+      goto inline_##first; \
+    xpr.write(entry->rd, sext_xlen(first_value)); \
+    pc = sext_xlen(entry->npc); \
+    instret++; \
+    state.pc = pc; \
+    entry = &block->insns[i++]; \
+    goto inline_##second
+
+#define INLINE_BRANCH(name, cond) \
+  inline_##name: \
+    target = (cond) ? pc + entry->imm : entry->npc; \
+    if (unlikely((target & 2) && level < 2)) \
+      goto inline_NONE; \
+    pc = sext_xlen(target); \
+    INLINE_NEXT()
+
 void processor_t::step(size_t n)
 {
+  in_wfi = false;
+  interactive_stopped = false;
+
   if (!state.debug_mode) {
     if (halt_request == HR_REGULAR) {
       enter_debug_mode(DCSR_CAUSE_DEBUGINT);
@@ -395,6 +662,7 @@ void processor_t::step(size_t n)
         switch (pc) { \
           case PC_SERIALIZE_BEFORE: state.serialized = true; break; \
           case PC_SERIALIZE_AFTER: ++instret; break; \
+          case PC_TRAP: take_raised_trap(state.pc); n = instret; break; \
           default: abort(); \
         } \
         pc = state.pc; \
@@ -406,7 +674,15 @@ void processor_t::step(size_t n)
 
     try
     {
-      take_pending_interrupt();
+      if (reg_t cause = pending_interrupt_cause()) {
+        trap_t t(cause);
+        take_trap(t, pc);
+        step_after_trap();
+        // Nothing has retired in this run for minstret to miss.
+        if (unlikely(trap_profile != nullptr))
+          trap_profile->settle(state.minstret->read());
+        break;
+      }
 
       if (unlikely(slow_path()))
       {
@@ -426,19 +702,138 @@ void processor_t::step(size_t n)
             state.single_step = state.STEP_STEPPED;
           }
 
+          if (unlikely(trace_filter_enabled))
+            update_trace_filter(pc);
+
           insn_fetch_t fetch = mmu->load_insn(pc);
           if (debug && !state.serialized)
             disasm(fetch.insn);
+          reg_t insn_pc = pc;
           pc = execute_insn(this, pc, fetch);
+          if (unlikely(counting_executions))
+            count_execution(nullptr, insn_pc, fetch.insn);
+          advance_pc();
+        }
+      }
+      else if (_mmu->block_cache_enabled() && !counting_executions)
+      {
+        // Main simulation loop, fast path with basic-block dispatch.  Blocks
+        // chain directly to their recent successors; the loop falls back to
+        // a block lookup when control leaves a block some other way.
+        // Pre-decoded instructions run inline while nothing traces them.
+        insn_block_t* prev = nullptr;
+        while (instret < n)
+        {
+          if (unlikely(trace_filter_enabled))
+            update_trace_filter(pc);
+
+          insn_block_t* block = _mmu->access_block(pc, prev);
+          if (unlikely(block->hooks != nullptr))
+            block->hooks->run(this, pc);
+          int level = inline_level(this);
+          size_t i = 0;
+          const insn_block_entry_t* entry = &block->insns[i++];
+          auto& xpr = state.XPR;
+          const reg_t shift_mask = xlen - 1;
+          reg_t target;
+#ifdef __GNUC__
+          static const void* const inline_handlers[INLINE_NUM_OPS] = {
+            &&inline_NONE,
+            INLINE_OPS(INLINE_LABEL_ADDRESS)
+            INLINE_FUSED_OPS(INLINE_FUSED_LABEL_ADDRESS)
+          };
+#endif
+          prev = nullptr;
+          INLINE_DISPATCH(level > entry->rvc ? entry->op : INLINE_NONE);
+
+        inline_NONE:
+          pc = execute_insn(this, pc, entry->fetch);
+          INLINE_NEXT();
+        INLINE_HANDLER(ADDI, xpr[entry->rs1] + entry->imm);
+        INLINE_HANDLER(XORI, xpr[entry->rs1] ^ entry->imm);
+        INLINE_HANDLER(ORI, xpr[entry->rs1] | entry->imm);
+        INLINE_HANDLER(ANDI, xpr[entry->rs1] & entry->imm);
+        INLINE_HANDLER(SLTI, sreg_t(xpr[entry->rs1]) < entry->imm);
+        INLINE_HANDLER(SLTIU, xpr[entry->rs1] < reg_t(entry->imm));
+        INLINE_HANDLER(SLLI, xpr[entry->rs1] << entry->imm);
+        INLINE_HANDLER(SRLI, zext_xlen(xpr[entry->rs1]) >> entry->imm);
+        INLINE_HANDLER(SRAI, sext_xlen(xpr[entry->rs1]) >> entry->imm);
+        INLINE_HANDLER(LUI, entry->imm);
+        INLINE_HANDLER(AUIPC, pc + entry->imm);
+        INLINE_HANDLER(ADD, xpr[entry->rs1] + xpr[entry->rs2]);
+        INLINE_HANDLER(SUB, xpr[entry->rs1] - xpr[entry->rs2]);
+        INLINE_HANDLER(XOR, xpr[entry->rs1] ^ xpr[entry->rs2]);
+        INLINE_HANDLER(OR, xpr[entry->rs1] | xpr[entry->rs2]);
+        INLINE_HANDLER(AND, xpr[entry->rs1] & xpr[entry->rs2]);
+        INLINE_HANDLER(SLT, sreg_t(xpr[entry->rs1]) < sreg_t(xpr[entry->rs2]));
+        INLINE_HANDLER(SLTU, xpr[entry->rs1] < xpr[entry->rs2]);
+        INLINE_HANDLER(SLL, xpr[entry->rs1] << (xpr[entry->rs2] & shift_mask));
+        INLINE_HANDLER(SRL, zext_xlen(xpr[entry->rs1]) >> (xpr[entry->rs2] & shift_mask));
+        INLINE_HANDLER(SRA, sext_xlen(xpr[entry->rs1]) >> (xpr[entry->rs2] & shift_mask));
+        INLINE_HANDLER(ADDIW, sext32(xpr[entry->rs1] + entry->imm));
+        INLINE_HANDLER(SLLIW, sext32(xpr[entry->rs1] << entry->imm));
+        INLINE_HANDLER(SRLIW, sext32(zext32(xpr[entry->rs1]) >> entry->imm));
+        INLINE_HANDLER(SRAIW, sext32(int32_t(xpr[entry->rs1]) >> entry->imm));
+        INLINE_HANDLER(ADDW, sext32(xpr[entry->rs1] + xpr[entry->rs2]));
+        INLINE_HANDLER(SUBW, sext32(xpr[entry->rs1] - xpr[entry->rs2]));
+        INLINE_LOAD(LB, int8);
+        INLINE_LOAD(LH, int16);
+        INLINE_LOAD(LW, int32);
+        INLINE_LOAD(LD, int64);
+        INLINE_LOAD(LBU, uint8);
+        INLINE_LOAD(LHU, uint16);
+        INLINE_LOAD(LWU, uint32);
+        INLINE_STORE(SB, uint8);
+        INLINE_STORE(SH, uint16);
+        INLINE_STORE(SW, uint32);
+        INLINE_STORE(SD, uint64);
+        INLINE_BRANCH(BEQ, xpr[entry->rs1] == xpr[entry->rs2]);
+        INLINE_BRANCH(BNE, xpr[entry->rs1] != xpr[entry->rs2]);
+        INLINE_BRANCH(BLT, sreg_t(xpr[entry->rs1]) < sreg_t(xpr[entry->rs2]));
+        INLINE_BRANCH(BGE, sreg_t(xpr[entry->rs1]) >= sreg_t(xpr[entry->rs2]));
+        INLINE_BRANCH(BLTU, xpr[entry->rs1] < xpr[entry->rs2]);
+        INLINE_BRANCH(BGEU, xpr[entry->rs1] >= xpr[entry->rs2]);
+        inline_JAL:
+          target = pc + entry->imm;
+          INLINE_JUMP(sext_xlen(entry->npc));
+        inline_JALR:
+          target = (xpr[entry->rs1] + entry->imm) & ~reg_t(1);
+          INLINE_JUMP(sext_xlen(entry->npc));
+        INLINE_FUSED(LUI, ADDI, entry->imm);
+        INLINE_FUSED(LUI, ADDIW, entry->imm);
+        INLINE_FUSED(AUIPC, ADDI, pc + entry->imm);
+        INLINE_FUSED(AUIPC, JALR, pc + entry->imm);
+        INLINE_FUSED(AUIPC, LW, pc + entry->imm);
+        INLINE_FUSED(AUIPC, LD, pc + entry->imm);
+        INLINE_FUSED(SLLI, ADD, xpr[entry->rs1] << entry->imm);
+        INLINE_FUSED(ADDI, BNE, xpr[entry->rs1] + entry->imm);
+        INLINE_FUSED(SLT, BEQ, sreg_t(xpr[entry->rs1]) < sreg_t(xpr[entry->rs2]));
+        INLINE_FUSED(SLT, BNE, sreg_t(xpr[entry->rs1]) < sreg_t(xpr[entry->rs2]));
+        INLINE_FUSED(SLTU, BEQ, xpr[entry->rs1] < xpr[entry->rs2]);
+        INLINE_FUSED(SLTU, BNE, xpr[entry->rs1] < xpr[entry->rs2]);
+        INLINE_FUSED(SLTI, BEQ, sreg_t(xpr[entry->rs1]) < entry->imm);
+        INLINE_FUSED(SLTI, BNE, sreg_t(xpr[entry->rs1]) < entry->imm);
+        INLINE_FUSED(SLTIU, BEQ, xpr[entry->rs1] < reg_t(entry->imm));
+        INLINE_FUSED(SLTIU, BNE, xpr[entry->rs1] < reg_t(entry->imm));
+
+        block_done:
           advance_pc();
         }
       }
       else while (instret < n)
       {
-        // Main simulation loop, fast path.
+        // Main simulation loop, fast path.  Trace filters are evaluated
+        // once per run of chained icache entries, i.e. per basic block.
+        // Execution counts for -g and --insn-mix are kept in the entries.
+        if (unlikely(trace_filter_enabled))
+          update_trace_filter(pc);
+
         for (auto ic_entry = _mmu->access_icache(pc); ; ) {
           auto fetch = ic_entry->data;
+          reg_t insn_pc = pc;
           pc = execute_insn(this, pc, fetch);
+          if (unlikely(counting_executions))
+            count_execution(ic_entry, insn_pc, fetch.insn);
           ic_entry = ic_entry->next;
           if (unlikely(ic_entry->tag != pc))
             break;
@@ -455,11 +850,7 @@ void processor_t::step(size_t n)
     {
       take_trap(t, pc);
       n = instret;
-
-      if (unlikely(state.single_step == state.STEP_STEPPED)) {
-        state.single_step = state.STEP_NONE;
-        enter_debug_mode(DCSR_CAUSE_STEP);
-      }
+      step_after_trap();
     }
     catch (triggers::matched_t& t)
     {
@@ -470,7 +861,10 @@ void processor_t::step(size_t n)
         // instructions are idempotent so restarting is safe.)
 
         insn_fetch_t fetch = mmu->load_insn(pc);
+        reg_t insn_pc = pc;
         pc = execute_insn(this, pc, fetch);
+        if (unlikely(counting_executions))
+          count_execution(nullptr, insn_pc, fetch.insn);
         advance_pc();
 
         delete mmu->matched_trigger;
@@ -493,6 +887,14 @@ void processor_t::step(size_t n)
     {
       enter_debug_mode(DCSR_CAUSE_SWBP);
     }
+    catch (interactive_stop_t&)
+    {
+      // Leave the instruction unexecuted; the caller disarms the breakpoint
+      // or watchpoint before stepping over it.
+      state.pc = pc;
+      n = instret;
+      interactive_stopped = true;
+    }
     catch (wait_for_interrupt_t &t)
     {
       // Return to the outer simulation loop, which gives other devices/harts a
@@ -502,13 +904,26 @@ void processor_t::step(size_t n)
       // allows us to switch to other threads only once per idle loop in case
       // there is activity.
       n = ++instret;
+      in_wfi = true;
     }
 
     state.minstret->bump(instret);
+    if (unlikely(trap_profile != nullptr))
+      trap_profile->settle(state.minstret->read());
 
     // Model a hart whose CPI is 1.
     state.mcycle->bump(instret);
 
     n -= instret;
+
+    // A watched marker just retired (see mmu_t::watch_markers).
+    if (unlikely(mmu->marker_seen))
+      break;
   }
+
+  if (insn_log_batch && !insn_log_batch->empty())
+    insn_log->submit(*insn_log_batch);
+
+  for (auto e : custom_extensions)
+    e.second->quantum_end();
 }
@@ -2,6 +2,7 @@
 
 #include "extension.h"
 #include "trap.h"
+#include "simif.h"
 
 extension_t::~extension_t()
 {
@@ -21,3 +22,8 @@ void extension_t::raise_interrupt()
 void extension_t::clear_interrupt()
 {
 }
+
+char* extension_t::host_memory(reg_t paddr)
+{
+  return p->sim->addr_to_mem(paddr);
+}
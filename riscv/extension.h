@@ -16,6 +16,9 @@ class extension_t
   virtual const char* name() = 0;
   virtual void reset() {};
   virtual void set_debug(bool value) {};
+  // Called on the hart's thread each time it finishes a quantum of
+  // instructions.
+  virtual void quantum_end() {};
   virtual ~extension_t();
 
   void set_processor(processor_t* _p) { p = _p; }
@@ -25,6 +28,8 @@ class extension_t
   void illegal_instruction();
   void raise_interrupt();
   void clear_interrupt();
+  // The host address of a byte of guest RAM, or NULL if paddr is not RAM.
+  char* host_memory(reg_t paddr);
 };
 
 std::function<extension_t*()> find_extension(const char* name);
@@ -0,0 +1,504 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstdio>
+
+#include "gdb_server.h"
+#include "sim.h"
+#include "mmu.h"
+#include "processor.h"
+
+// GDB's RISC-V register numbers
+#define GDB_REG_PC 32
+#define GDB_REG_F0 33
+#define GDB_REG_CSR0 65
+#define GDB_REG_PRIV (GDB_REG_CSR0 + 4096)
+
+#define GDB_SIGINT 2
+#define GDB_SIGTRAP 5
+
+static std::string hex_value(reg_t value, size_t bytes)
+{
+  std::string s;
+  char buf[3];
+  for (size_t i = 0; i < bytes; i++) {
+    snprintf(buf, sizeof(buf), "%02x", unsigned((value >> (8 * i)) & 0xff));
+    s += buf;
+  }
+  return s;
+}
+
+// The little-endian value of the hex digits at pos, which advances past them.
+static reg_t parse_value(const std::string& s, size_t* pos, size_t bytes)
+{
+  reg_t value = 0;
+  for (size_t i = 0; i < bytes && *pos + 2 <= s.size(); i++, *pos += 2)
+    value |= reg_t(strtoul(s.substr(*pos, 2).c_str(), NULL, 16)) << (8 * i);
+  return value;
+}
+
+gdb_server_t::gdb_server_t(uint16_t port, sim_t* sim) :
+  sim(sim),
+  socket_fd(-1),
+  client_fd(-1),
+  running(false),
+  single_step(false),
+  g_hart(0),
+  c_hart(0)
+{
+  socket_fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (socket_fd == -1) {
+    fprintf(stderr, "gdb_server failed to make socket: %s (%d)\n",
+        strerror(errno), errno);
+    abort();
+  }
+
+  int reuseaddr = 1;
+  if (setsockopt(socket_fd, SOL_SOCKET, SO_REUSEADDR, &reuseaddr,
+        sizeof(int)) == -1) {
+    fprintf(stderr, "gdb_server failed setsockopt: %s (%d)\n",
+        strerror(errno), errno);
+    abort();
+  }
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = INADDR_ANY;
+  addr.sin_port = htons(port);
+
+  if (bind(socket_fd, (struct sockaddr *) &addr, sizeof(addr)) == -1) {
+    fprintf(stderr, "gdb_server failed to bind socket: %s (%d)\n",
+        strerror(errno), errno);
+    abort();
+  }
+
+  if (listen(socket_fd, 1) == -1) {
+    fprintf(stderr, "gdb_server failed to listen on socket: %s (%d)\n",
+        strerror(errno), errno);
+    abort();
+  }
+
+  socklen_t addrlen = sizeof(addr);
+  if (getsockname(socket_fd, (struct sockaddr *) &addr, &addrlen) == -1) {
+    fprintf(stderr, "gdb_server getsockname failed: %s (%d)\n",
+        strerror(errno), errno);
+    abort();
+  }
+
+  printf("Listening for GDB connection on port %d.\n", ntohs(addr.sin_port));
+  fflush(stdout);
+}
+
+gdb_server_t::~gdb_server_t()
+{
+  if (client_fd >= 0) {
+    char reply[8];
+    snprintf(reply, sizeof(reply), "W%02x", sim->exit_code() & 0xff);
+    send_packet(reply);
+    close(client_fd);
+  }
+  close(socket_fd);
+}
+
+void gdb_server_t::accept()
+{
+  do {
+    client_fd = ::accept(socket_fd, NULL, NULL);
+  } while (client_fd == -1 && errno == EINTR);
+  if (client_fd == -1) {
+    fprintf(stderr, "failed to accept on socket: %s (%d)\n", strerror(errno),
+        errno);
+    abort();
+  }
+  received.clear();
+}
+
+// The harts carry on without breakpoints.
+void gdb_server_t::close_client()
+{
+  for (auto addr : std::set<reg_t>(breakpoints))
+    set_breakpoint(addr, false);
+  close(client_fd);
+  client_fd = -1;
+  running = true;
+  single_step = false;
+}
+
+bool gdb_server_t::read_packet(std::string& packet, bool block)
+{
+  while (client_fd >= 0) {
+    // Acknowledgements and anything else between packets are skipped.
+    size_t start = received.find_first_of("$\x03");
+    if (start == std::string::npos) {
+      received.clear();
+    } else if (received[start] == '\x03') {
+      received.erase(0, start + 1);
+      packet = "\x03";
+      return true;
+    } else {
+      size_t end = received.find('#', start);
+      if (end != std::string::npos && received.size() >= end + 3) {
+        packet = received.substr(start + 1, end - start - 1);
+        received.erase(0, end + 3);
+        // TCP already delivers the packet intact.
+        if (write(client_fd, "+", 1) != 1) {
+          close_client();
+          return false;
+        }
+        return true;
+      }
+    }
+
+    char buf[4096];
+    ssize_t n = recv(client_fd, buf, sizeof(buf), block ? 0 : MSG_DONTWAIT);
+    if (n > 0) {
+      received.append(buf, n);
+    } else if (n == 0 || (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK)) {
+      close_client();
+    } else if (!block && errno != EINTR) {
+      return false;
+    }
+  }
+  return false;
+}
+
+void gdb_server_t::send_packet(const std::string& data)
+{
+  unsigned checksum = 0;
+  for (unsigned char c : data)
+    checksum += c;
+  char tail[4];
+  snprintf(tail, sizeof(tail), "#%02x", checksum & 0xff);
+  std::string buf = "$" + data + tail;
+
+  size_t sent = 0;
+  while (sent < buf.size() && client_fd >= 0) {
+    ssize_t bytes = write(client_fd, buf.data() + sent, buf.size() - sent);
+    if (bytes == -1) {
+      if (errno == EINTR)
+        continue;
+      close_client();
+      return;
+    }
+    sent += bytes;
+  }
+}
+
+processor_t* gdb_server_t::hart() const
+{
+  return sim->procs[g_hart];
+}
+
+size_t gdb_server_t::reg_size(size_t regno) const
+{
+  if (regno >= GDB_REG_F0 && regno < GDB_REG_CSR0)
+    return hart()->extension_enabled('D') ? 8 : 4;
+  return hart()->get_xlen() / 8;
+}
+
+bool gdb_server_t::read_reg(size_t regno, reg_t* value) const
+{
+  processor_t* p = hart();
+  state_t* state = p->get_state();
+  if (regno < GDB_REG_PC) {
+    *value = state->XPR[regno];
+  } else if (regno == GDB_REG_PC) {
+    *value = state->pc;
+  } else if (regno < GDB_REG_CSR0) {
+    if (!p->extension_enabled('F'))
+      return false;
+    *value = state->FPR[regno - GDB_REG_F0].v[0];
+  } else if (regno < GDB_REG_PRIV) {
+    try {
+      *value = p->get_csr(regno - GDB_REG_CSR0);
+    } catch (trap_t&) {
+      return false;
+    }
+  } else if (regno == GDB_REG_PRIV) {
+    *value = state->prv;
+  } else {
+    return false;
+  }
+  *value &= reg_size(regno) == 8 ? reg_t(-1) : (reg_t(1) << (8 * reg_size(regno))) - 1;
+  return true;
+}
+
+bool gdb_server_t::write_reg(size_t regno, reg_t value)
+{
+  processor_t* p = hart();
+  state_t* state = p->get_state();
+  if (regno < GDB_REG_PC) {
+    if (regno != 0)
+      state->XPR.write(regno, p->get_xlen() == 32 ? sreg_t(int32_t(value)) : value);
+  } else if (regno == GDB_REG_PC) {
+    state->pc = p->get_xlen() == 32 ? sreg_t(int32_t(value)) : value;
+  } else if (regno < GDB_REG_CSR0) {
+    if (!p->extension_enabled('F'))
+      return false;
+    // Single-precision values are NaN-boxed.
+    freg_t f;
+    f.v[0] = reg_size(regno) == 8 ? value : value | 0xffffffff00000000;
+    f.v[1] = -1;
+    state->FPR.write(regno - GDB_REG_F0, f);
+  } else if (regno < GDB_REG_PRIV) {
+    try {
+      p->put_csr(regno - GDB_REG_CSR0, value);
+    } catch (trap_t&) {
+      return false;
+    }
+  } else if (regno == GDB_REG_PRIV) {
+    p->set_privilege(value);
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// Memory is read as the hart sees it, through its translation.
+std::string gdb_server_t::read_memory(reg_t addr, size_t len)
+{
+  std::string hex;
+  for (size_t i = 0; i < len; i++) {
+    try {
+      hex += hex_value(hart()->get_mmu()->load_uint8(addr + i), 1);
+    } catch (trap_t&) {
+      break;
+    }
+  }
+  return hex.empty() && len != 0 ? "E14" : hex;
+}
+
+bool gdb_server_t::write_memory(reg_t addr, const std::string& hex)
+{
+  size_t pos = 0;
+  bool ok = true;
+  for (reg_t a = addr; ok && pos + 2 <= hex.size(); a++) {
+    try {
+      hart()->get_mmu()->store_uint8(a, parse_value(hex, &pos, 1));
+    } catch (trap_t&) {
+      ok = false;
+    }
+  }
+  // The debugger may have patched code.
+  for (auto p : sim->procs)
+    p->get_mmu()->flush_icache();
+  return ok;
+}
+
+void gdb_server_t::set_breakpoint(reg_t addr, bool insert)
+{
+  if (insert)
+    breakpoints.insert(addr);
+  else
+    breakpoints.erase(addr);
+  for (auto p : sim->procs) {
+    if (insert)
+      p->get_mmu()->add_breakpoint(addr);
+    else
+      p->get_mmu()->remove_breakpoint(addr);
+  }
+}
+
+void gdb_server_t::stop(int signal)
+{
+  running = false;
+  single_step = false;
+  g_hart = c_hart;
+  char reply[32];
+  snprintf(reply, sizeof(reply), "T%02xthread:%zx;", signal, c_hart + 1);
+  send_packet(reply);
+}
+
+// A hart stopped at a breakpoint first executes the instruction there.
+void gdb_server_t::resume(bool step)
+{
+  processor_t* p = sim->procs[c_hart];
+  reg_t pc = p->get_state()->pc;
+  bool at_breakpoint = breakpoints.count(pc);
+  if (step || at_breakpoint) {
+    if (at_breakpoint)
+      p->get_mmu()->remove_breakpoint(pc);
+    p->step(1);
+    if (at_breakpoint)
+      p->get_mmu()->add_breakpoint(pc);
+  }
+  running = true;
+  single_step = step;
+}
+
+void gdb_server_t::handle(const std::string& packet)
+{
+  const char* args = packet.c_str() + 1;
+  char* end;
+  switch (packet[0]) {
+    case '?':
+      stop(GDB_SIGTRAP);
+      return;
+
+    case 'g': {
+      std::string reply;
+      reg_t value;
+      for (size_t regno = 0; regno <= GDB_REG_PC; regno++) {
+        read_reg(regno, &value);
+        reply += hex_value(value, reg_size(regno));
+      }
+      send_packet(reply);
+      return;
+    }
+
+    case 'G': {
+      size_t pos = 1;
+      for (size_t regno = 0; regno <= GDB_REG_PC; regno++)
+        write_reg(regno, parse_value(packet, &pos, reg_size(regno)));
+      send_packet("OK");
+      return;
+    }
+
+    case 'p': {
+      size_t regno = strtoul(args, NULL, 16);
+      reg_t value;
+      send_packet(read_reg(regno, &value) ? hex_value(value, reg_size(regno)) : "E01");
+      return;
+    }
+
+    case 'P': {
+      size_t regno = strtoul(args, &end, 16);
+      size_t pos = end + 1 - packet.c_str();
+      bool ok = *end == '=' && write_reg(regno, parse_value(packet, &pos, reg_size(regno)));
+      send_packet(ok ? "OK" : "E01");
+      return;
+    }
+
+    case 'm': {
+      reg_t addr = strtoull(args, &end, 16);
+      size_t len = *end == ',' ? strtoul(end + 1, NULL, 16) : 0;
+      send_packet(read_memory(addr, len));
+      return;
+    }
+
+    case 'M': {
+      reg_t addr = strtoull(args, &end, 16);
+      const char* data = strchr(end, ':');
+      send_packet(data && write_memory(addr, data + 1) ? "OK" : "E14");
+      return;
+    }
+
+    case 'c':
+    case 's':
+      if (*args)
+        sim->procs[c_hart]->get_state()->pc = strtoull(args, NULL, 16);
+      resume(packet[0] == 's');
+      return;
+
+    case 'H': {
+      // Thread IDs are hart numbers plus one; 0 and -1 leave the choice.
+      long tid = strtol(args + 1, NULL, 16);
+      if (tid > 0 && size_t(tid) <= sim->procs.size()) {
+        if (args[0] == 'g')
+          g_hart = tid - 1;
+        else
+          c_hart = tid - 1;
+      }
+      send_packet("OK");
+      return;
+    }
+
+    case 'T': {
+      long tid = strtol(args, NULL, 16);
+      send_packet(tid > 0 && size_t(tid) <= sim->procs.size() ? "OK" : "E01");
+      return;
+    }
+
+    case 'Z':
+    case 'z':
+      // Hardware breakpoints are as cheap as software ones here.
+      if (args[0] == '0' || args[0] == '1') {
+        set_breakpoint(strtoull(args + 2, NULL, 16), packet[0] == 'Z');
+        send_packet("OK");
+      } else {
+        send_packet("");
+      }
+      return;
+
+    case 'D':
+      send_packet("OK");
+      close_client();
+      return;
+
+    case 'k':
+      exit(0);
+
+    case 'q':
+      if (packet.compare(0, 11, "qSupported:") == 0 || packet == "qSupported") {
+        send_packet("PacketSize=4000");
+      } else if (packet == "qAttached") {
+        send_packet("1");
+      } else if (packet == "qC") {
+        char reply[32];
+        snprintf(reply, sizeof(reply), "QC%zx", c_hart + 1);
+        send_packet(reply);
+      } else if (packet == "qfThreadInfo") {
+        std::string reply = "m";
+        char tid[32];
+        for (size_t i = 0; i < sim->procs.size(); i++) {
+          snprintf(tid, sizeof(tid), "%s%zx", i ? "," : "", i + 1);
+          reply += tid;
+        }
+        send_packet(reply);
+      } else if (packet == "qsThreadInfo") {
+        send_packet("l");
+      } else {
+        send_packet("");
+      }
+      return;
+
+    case 'v':
+      if (packet.compare(0, 5, "vKill") == 0)
+        exit(0);
+      send_packet("");
+      return;
+
+    default:
+      send_packet("");
+      return;
+  }
+}
+
+void gdb_server_t::tick()
+{
+  if (client_fd < 0 && !running)
+    accept();
+
+  std::string packet;
+  if (!running) {
+    while (!running && read_packet(packet, true))
+      if (packet != "\x03")
+        handle(packet);
+    return;
+  }
+
+  if (single_step) {
+    stop(GDB_SIGTRAP);
+    return;
+  }
+
+  sim->step(sim->interleave);
+  if (client_fd < 0)
+    return;
+
+  for (size_t i = 0; i < sim->procs.size(); i++) {
+    if (sim->procs[i]->is_interactive_stopped()) {
+      c_hart = i;
+      stop(GDB_SIGTRAP);
+      return;
+    }
+  }
+  if (read_packet(packet, false) && packet == "\x03")
+    stop(GDB_SIGINT);
+}
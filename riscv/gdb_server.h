@@ -0,0 +1,62 @@
+#ifndef GDB_SERVER_H
+#define GDB_SERVER_H
+
+#include <stdint.h>
+
+#include <set>
+#include <string>
+
+#include "decode.h"
+
+class sim_t;
+class processor_t;
+
+// A GDB remote serial protocol stub that reads and writes the harts'
+// state and memory directly, rather than through the debug module.  Each
+// hart is a thread.  Software breakpoints are marked in the harts'
+// icaches (see mmu_t::add_breakpoint), so running to one costs nothing
+// per instruction.
+class gdb_server_t
+{
+public:
+  // Listen for a debugger on the given port.  The harts stay stopped until
+  // one connects and resumes them.
+  gdb_server_t(uint16_t port, sim_t* sim);
+  ~gdb_server_t();
+
+  // Do a bit of work: serve the debugger while the harts are stopped,
+  // and otherwise run them for a quantum, stopping at a breakpoint or
+  // when the debugger interrupts them.
+  void tick();
+
+private:
+  sim_t* sim;
+  int socket_fd;
+  int client_fd;
+  std::string received;
+  bool running;
+  bool single_step;
+  size_t g_hart;  // hart for register and memory packets (Hg)
+  size_t c_hart;  // hart reported as having stopped
+  std::set<reg_t> breakpoints;
+
+  void accept();
+  void close_client();
+  // False once the debugger has gone, or if block is false and no whole
+  // packet has arrived.  A lone interrupt byte (0x03) comes back as "\x03".
+  bool read_packet(std::string& packet, bool block);
+  void send_packet(const std::string& data);
+  void handle(const std::string& packet);
+  void resume(bool step);
+  void stop(int signal);
+
+  processor_t* hart() const;
+  size_t reg_size(size_t regno) const;
+  bool read_reg(size_t regno, reg_t* value) const;
+  bool write_reg(size_t regno, reg_t value);
+  std::string read_memory(reg_t addr, size_t len);
+  bool write_memory(reg_t addr, const std::string& hex);
+  void set_breakpoint(reg_t addr, bool insert);
+};
+
+#endif
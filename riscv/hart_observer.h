@@ -0,0 +1,27 @@
+// See LICENSE for license details.
+
+#ifndef _RISCV_HART_OBSERVER_H
+#define _RISCV_HART_OBSERVER_H
+
+#include "decode.h"
+
+class processor_t;
+
+// Events of one hart, for a host that embeds the simulator.  Register an
+// observer with processor_t::set_observer(); its methods are called on the
+// thread running the hart, and the ones not overridden cost nothing more.
+// While an observer is registered, no instruction runs inline.
+class hart_observer_t
+{
+ public:
+  virtual ~hart_observer_t() {}
+
+  // A basic block, the run of insns instructions from pc up to one that
+  // did not fall through to the next, has retired.  A trap also ends a
+  // block, which is reported when the next one starts.
+  virtual void block_retired(processor_t* p, reg_t pc, uint64_t insns) {}
+  // The hart is taking a trap with this cause, raised at epc.
+  virtual void trap_taken(processor_t* p, reg_t cause, reg_t epc) {}
+};
+
+#endif
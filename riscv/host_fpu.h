@@ -0,0 +1,302 @@
+// See LICENSE for license details.
+#ifndef _RISCV_HOST_FPU_H
+#define _RISCV_HOST_FPU_H
+
+#include "softfloat.h"
+#include <cfloat>
+#include <cstring>
+
+// fast_f32_add() and friends return the same result and raise the same
+// softfloat exception flags as their softfloat namesakes.  In a build
+// configured with --enable-host-fpu, round-to-nearest-even operations whose
+// operands and result are zero or normal numbers well inside the exponent
+// range are done with host doubles instead; everything else (NaNs,
+// infinities, subnormals, results near overflow or underflow, and the other
+// rounding modes) goes to softfloat.
+//
+// Within that range inexact is the only flag an operation can raise.  It
+// is derived from the exact rounding error rather than read back from the
+// host's status register, which costs more than softfloat itself on x86.
+// Single precision is computed in double and rounded once more, which is
+// exact for +, -, *, / and sqrt since double has more than twice float's
+// precision.
+
+#if defined(RISCV_ENABLE_HOST_FPU) && FLT_EVAL_METHOD == 0
+
+#include <cmath>
+
+#define HOST_FPU_RNE (softfloat_roundingMode == softfloat_round_near_even)
+
+static inline double host_fpu_in(float32_t a)
+{
+  float h;
+  memcpy(&h, &a, sizeof(h));
+  return h;
+}
+
+static inline double host_fpu_in(float64_t a)
+{
+  double h;
+  memcpy(&h, &a, sizeof(h));
+  return h;
+}
+
+// Zero, or a normal number at least 2^-126 away from the subnormals.
+static inline bool host_fpu_ok(float32_t a)
+{
+  uint32_t exp = (a.v >> 23) & 0xff;
+  return (exp > 1 && exp != 0xff) || (a.v << 1) == 0;
+}
+
+// Zero, or a normal number within 2^+-895, so that no partial product or
+// rounding error below underflows and no split overflows.
+static inline bool host_fpu_ok(float64_t a)
+{
+  uint64_t exp = (a.v >> 52) & 0x7ff;
+  return (exp >= 0x80 && exp < 0x780) || (a.v << 1) == 0;
+}
+
+// Whether a double in float's normal range lies exactly halfway between
+// two floats, where rounding it with a nonzero error term pending could go
+// the wrong way.
+static inline bool host_fpu_float_tie(double s)
+{
+  uint64_t bits;
+  memcpy(&bits, &s, sizeof(bits));
+  return (bits & 0x1fffffff) == 0x10000000;
+}
+
+// Rounds x to float, returning false if the result is not one we may keep.
+static inline bool host_fpu_out(float32_t& res, double x, bool inexact)
+{
+  if (!(std::fabs(x) < 0x1p+128))
+    return false;
+  float f = x;
+  memcpy(&res, &f, sizeof(res));
+  inexact |= f != x;
+  if (!host_fpu_ok(res) || ((res.v << 1) == 0 && inexact))
+    return false;
+  if (inexact)
+    softfloat_exceptionFlags |= softfloat_flag_inexact;
+  return true;
+}
+
+static inline bool host_fpu_out(float64_t& res, double x, bool inexact)
+{
+  memcpy(&res, &x, sizeof(res));
+  if (!host_fpu_ok(res) || ((res.v << 1) == 0 && inexact))
+    return false;
+  if (inexact)
+    softfloat_exceptionFlags |= softfloat_flag_inexact;
+  return true;
+}
+
+// s = x + y rounded, and e its exact error.
+static inline void host_fpu_two_sum(double x, double y, double& s, double& e)
+{
+  s = x + y;
+  double yv = s - x, xv = s - yv;
+  e = (x - xv) + (y - yv);
+}
+
+// p = x * y rounded, and e its exact error.
+static inline void host_fpu_two_prod(double x, double y, double& p, double& e)
+{
+  p = x * y;
+#ifdef FP_FAST_FMA
+  e = fma(x, y, -p);
+#else
+  const double split = 134217729.0;  // 2^27 + 1
+  double t = split * x, xh = t - (t - x), xl = x - xh;
+  t = split * y;
+  double yh = t - (t - y), yl = y - yh;
+  e = ((xh * yh - p) + xh * yl + xl * yh) + xl * yl;
+#endif
+}
+
+#define HOST_FPU_PREFIX(a, b) \
+  if (!HOST_FPU_RNE || !host_fpu_ok(a) || !host_fpu_ok(b)) \
+    return false; \
+  double x = host_fpu_in(a), y = host_fpu_in(b)
+
+static inline bool host_fpu_add(float32_t& res, float32_t a, float32_t b)
+{
+  HOST_FPU_PREFIX(a, b);
+  double s, e;
+  host_fpu_two_sum(x, y, s, e);
+  if (e != 0 && host_fpu_float_tie(s))
+    return false;
+  return host_fpu_out(res, s, e != 0);
+}
+
+static inline bool host_fpu_mul(float32_t& res, float32_t a, float32_t b)
+{
+  HOST_FPU_PREFIX(a, b);
+  return host_fpu_out(res, x * y, false);
+}
+
+static inline bool host_fpu_div(float32_t& res, float32_t a, float32_t b)
+{
+  HOST_FPU_PREFIX(a, b);
+  if (y == 0)
+    return false;
+  float q = x / y;
+  return host_fpu_out(res, q, (double)q * y != x);
+}
+
+static inline bool host_fpu_sqrt(float32_t& res, float32_t a)
+{
+  if (!HOST_FPU_RNE || !host_fpu_ok(a) || (a.v >> 31))
+    return false;
+  double x = host_fpu_in(a);
+  float r = sqrt(x);
+  return host_fpu_out(res, r, (double)r * r != x);
+}
+
+static inline bool host_fpu_add(float64_t& res, float64_t a, float64_t b)
+{
+  HOST_FPU_PREFIX(a, b);
+  double s, e;
+  host_fpu_two_sum(x, y, s, e);
+  return host_fpu_out(res, s, e != 0);
+}
+
+static inline bool host_fpu_mul(float64_t& res, float64_t a, float64_t b)
+{
+  HOST_FPU_PREFIX(a, b);
+  double p, e;
+  host_fpu_two_prod(x, y, p, e);
+  if (p == 0 && x != 0 && y != 0)
+    return false;
+  return host_fpu_out(res, p, e != 0);
+}
+
+static inline bool host_fpu_div(float64_t& res, float64_t a, float64_t b)
+{
+  HOST_FPU_PREFIX(a, b);
+  if (y == 0)
+    return false;
+  double q = x / y, p, e;
+  if (q == 0 && x != 0)
+    return false;
+  host_fpu_two_prod(q, y, p, e);
+  return host_fpu_out(res, q, p != x || e != 0);
+}
+
+static inline bool host_fpu_sqrt(float64_t& res, float64_t a)
+{
+  if (!HOST_FPU_RNE || !host_fpu_ok(a) || (a.v >> 63))
+    return false;
+  double x = host_fpu_in(a), r = sqrt(x), p, e;
+  host_fpu_two_prod(r, r, p, e);
+  return host_fpu_out(res, r, p != x || e != 0);
+}
+
+static inline bool host_fpu_mulAdd(float32_t& res, float32_t a, float32_t b, float32_t c)
+{
+  if (!HOST_FPU_RNE || !host_fpu_ok(a) || !host_fpu_ok(b) || !host_fpu_ok(c))
+    return false;
+  double s, e;
+  host_fpu_two_sum(host_fpu_in(a) * host_fpu_in(b), host_fpu_in(c), s, e);
+  if (e != 0 && host_fpu_float_tie(s))
+    return false;
+  return host_fpu_out(res, s, e != 0);
+}
+
+#ifdef FP_FAST_FMA
+static inline bool host_fpu_mulAdd(float64_t& res, float64_t a, float64_t b, float64_t c)
+{
+  if (!HOST_FPU_RNE || !host_fpu_ok(a) || !host_fpu_ok(b) || !host_fpu_ok(c))
+    return false;
+  double x = host_fpu_in(a), y = host_fpu_in(b), z = host_fpu_in(c);
+  double p, pe, d, de;
+  host_fpu_two_prod(x, y, p, pe);
+  if (std::fabs(p) >= 0x1p+896 || (std::fabs(p) < 0x1p-895 && x != 0 && y != 0))
+    return false;
+  // Exact iff r - z, itself exactly d + de, equals the product p + pe;
+  // both pairs are normalized, so that means equal parts.
+  double r = fma(x, y, z);
+  host_fpu_two_sum(r, -z, d, de);
+  return host_fpu_out(res, r, d != p || de != pe);
+}
+#else
+// Without a hardware fma the host's is a slow library routine.
+static inline bool host_fpu_mulAdd(float64_t&, float64_t, float64_t, float64_t)
+{
+  return false;
+}
+#endif
+
+#undef HOST_FPU_PREFIX
+#undef HOST_FPU_RNE
+
+#define HOST_FPU_OP2(name, type, op) \
+  static inline type fast_##name(type a, type b) \
+  { \
+    type res; \
+    return host_fpu_##op(res, a, b) ? res : name(a, b); \
+  }
+
+HOST_FPU_OP2(f32_add, float32_t, add)
+HOST_FPU_OP2(f32_mul, float32_t, mul)
+HOST_FPU_OP2(f32_div, float32_t, div)
+HOST_FPU_OP2(f64_add, float64_t, add)
+HOST_FPU_OP2(f64_mul, float64_t, mul)
+HOST_FPU_OP2(f64_div, float64_t, div)
+
+#undef HOST_FPU_OP2
+
+static inline float32_t fast_f32_sub(float32_t a, float32_t b)
+{
+  float32_t res;
+  return host_fpu_add(res, a, float32_t{b.v ^ 0x80000000u}) ? res : f32_sub(a, b);
+}
+
+static inline float64_t fast_f64_sub(float64_t a, float64_t b)
+{
+  float64_t res;
+  return host_fpu_add(res, a, float64_t{b.v ^ 0x8000000000000000ull}) ? res : f64_sub(a, b);
+}
+
+static inline float32_t fast_f32_sqrt(float32_t a)
+{
+  float32_t res;
+  return host_fpu_sqrt(res, a) ? res : f32_sqrt(a);
+}
+
+static inline float64_t fast_f64_sqrt(float64_t a)
+{
+  float64_t res;
+  return host_fpu_sqrt(res, a) ? res : f64_sqrt(a);
+}
+
+static inline float32_t fast_f32_mulAdd(float32_t a, float32_t b, float32_t c)
+{
+  float32_t res;
+  return host_fpu_mulAdd(res, a, b, c) ? res : f32_mulAdd(a, b, c);
+}
+
+static inline float64_t fast_f64_mulAdd(float64_t a, float64_t b, float64_t c)
+{
+  float64_t res;
+  return host_fpu_mulAdd(res, a, b, c) ? res : f64_mulAdd(a, b, c);
+}
+
+#else
+
+#define fast_f32_add f32_add
+#define fast_f32_sub f32_sub
+#define fast_f32_mul f32_mul
+#define fast_f32_div f32_div
+#define fast_f32_sqrt f32_sqrt
+#define fast_f32_mulAdd f32_mulAdd
+#define fast_f64_add f64_add
+#define fast_f64_sub f64_sub
+#define fast_f64_mul f64_mul
+#define fast_f64_div f64_div
+#define fast_f64_sqrt f64_sqrt
+#define fast_f64_mulAdd f64_mulAdd
+
+#endif
+
+#endif
@@ -0,0 +1,122 @@
+// See LICENSE for license details.
+
+#include "insn_log.h"
+#include "processor.h"
+#include "disasm.h"
+#include <cinttypes>
+#include <ostream>
+
+insn_log_t::insn_log_t(FILE* file, std::streambuf* sout)
+  : file(file), sout(sout), exit(false)
+{
+  writer = std::thread(&insn_log_t::writer_main, this);
+}
+
+insn_log_t::~insn_log_t()
+{
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    exit = true;
+  }
+  ready.notify_one();
+  writer.join();
+}
+
+void insn_log_t::submit(insn_log_batch_t& batch)
+{
+  std::unique_lock<std::mutex> guard(lock);
+  room.wait(guard, [&]{ return queue.size() < MAX_QUEUED; });
+  queue.emplace_back(batch.proc);
+  std::swap(queue.back(), batch);
+  guard.unlock();
+  ready.notify_one();
+}
+
+void insn_log_t::format(const insn_log_batch_t& batch, std::string& out)
+{
+  processor_t* p = batch.proc;
+  hart_state_t& h = harts[p];
+  unsigned max_xlen = p->get_isa().get_max_xlen();
+  unsigned id = p->get_id();
+  const char* text = batch.texts.data();
+  char line[64];
+
+  for (auto& r : batch.records) {
+    if (r.pc == insn_log_batch_t::TEXT) {
+      out.append(text, r.bits);
+      text += r.bits;
+      continue;
+    }
+
+    if (h.last_pc == r.pc && h.last_bits == r.bits) {
+      h.executions++;
+      continue;
+    }
+
+#ifdef RISCV_ENABLE_COMMITLOG
+    if (const char* sym = p->get_symbol(r.pc)) {
+      snprintf(line, sizeof(line), "core %3u: >>>>  ", id);
+      out += line;
+      out += sym;
+      out += '\n';
+    }
+#endif
+
+    if (h.executions != 1) {
+      snprintf(line, sizeof(line), "core %3u: Executed %" PRIu64 " times\n", id, h.executions);
+      out += line;
+    }
+
+    auto it = h.dasm.find(r.bits);
+    if (it == h.dasm.end())
+      it = h.dasm.emplace(r.bits, p->get_disassembler()->disassemble(r.bits)).first;
+
+    snprintf(line, sizeof(line), "core %3u: 0x%0*" PRIx64 " (0x%08" PRIx64 ") ",
+             id, int(max_xlen / 4), zext(r.pc, max_xlen), uint64_t(r.bits));
+    out += line;
+    out += it->second;
+    out += '\n';
+
+    h.last_pc = r.pc;
+    h.last_bits = r.bits;
+    h.executions = 1;
+  }
+}
+
+void insn_log_t::write(const std::string& out)
+{
+  if (file == stderr) {
+    std::ostream os(sout);
+    os.write(out.data(), out.size());
+  } else {
+    fwrite(out.data(), 1, out.size(), file);
+  }
+}
+
+void insn_log_t::writer_main()
+{
+  std::unique_lock<std::mutex> guard(lock);
+  std::string out;
+  while (true) {
+    ready.wait(guard, [&]{ return exit || !queue.empty(); });
+    if (queue.empty())
+      break;
+
+    insn_log_batch_t batch(nullptr);
+    std::swap(batch, queue.front());
+    queue.pop_front();
+    guard.unlock();
+    room.notify_all();
+
+    out.clear();
+    format(batch, out);
+    write(out);
+
+    guard.lock();
+  }
+
+  if (file == stderr)
+    sout->pubsync();
+  else
+    fflush(file);
+}
@@ -0,0 +1,95 @@
+// See LICENSE for license details.
+#ifndef _RISCV_INSN_LOG_H
+#define _RISCV_INSN_LOG_H
+
+#include "decode.h"
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+class processor_t;
+
+// One hart's share of the -l instruction log since it was last submitted:
+// a compact record per instruction, plus any text the hart logged itself,
+// such as trap messages.  Only the thread running the hart touches it.
+class insn_log_batch_t
+{
+public:
+  insn_log_batch_t(processor_t* proc) : proc(proc) {}
+
+  void insn(reg_t pc, insn_bits_t bits) { records.push_back({pc, bits}); }
+  void text(const std::string& s)
+  {
+    records.push_back({TEXT, s.size()});
+    texts += s;
+  }
+  bool empty() const { return records.empty(); }
+
+private:
+  // Instruction PCs are aligned, so this marks a text record, whose bits
+  // hold the length of its text.
+  static constexpr reg_t TEXT = -1;
+
+  struct record_t {
+    reg_t pc;
+    insn_bits_t bits;
+  };
+
+  processor_t* proc;
+  std::vector<record_t> records;
+  std::string texts;
+
+  friend class insn_log_t;
+};
+
+// Formats the -l instruction log on a host thread of its own, so that a
+// logging hart keeps running on the icache fast path.  Harts submit their
+// batches at the end of each step(), which keeps the order in which they
+// ran.  The output matches processor_t::disasm(), including the collapsing
+// of repeated executions, and disassembly text is cached per encoding.
+class insn_log_t
+{
+public:
+  // Like processor_t::debug_output_log, text goes to sout when file is
+  // stderr and to file otherwise.
+  insn_log_t(FILE* file, std::streambuf* sout);
+  ~insn_log_t();
+
+  // Hands the batch over to the formatter and leaves it empty.  Blocks
+  // while the formatter is too far behind.  Destroying the log writes out
+  // everything submitted.
+  void submit(insn_log_batch_t& batch);
+
+private:
+  static constexpr size_t MAX_QUEUED = 64;
+
+  struct hart_state_t {
+    uint64_t last_pc = 1;
+    uint64_t last_bits = 0;
+    uint64_t executions = 1;
+    std::unordered_map<insn_bits_t, std::string> dasm;
+  };
+
+  void format(const insn_log_batch_t& batch, std::string& out);
+  void write(const std::string& out);
+  void writer_main();
+
+  FILE* file;
+  std::streambuf* sout;
+  std::unordered_map<processor_t*, hart_state_t> harts;
+
+  std::mutex lock;
+  std::condition_variable ready;
+  std::condition_variable room;
+  std::deque<insn_log_batch_t> queue;
+  bool exit;
+  std::thread writer;
+};
+
+#endif
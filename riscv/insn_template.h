@@ -6,4 +6,8 @@
 #include "internals.h"
 #include "specialize.h"
 #include "tracer.h"
+#include "v_ext_kernels.h"
+#include "crypto_kernels.h"
+#include "p_ext_kernels.h"
+#include "host_fpu.h"
 #include <assert.h>
@@ -4,7 +4,7 @@
 require_rv64;
 require_either_extension(EXT_ZKND, EXT_ZKNE);
 
-uint8_t     round_consts [10] = {
+static const uint8_t round_consts[10] = {
     0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1b, 0x36
 };
 
@@ -1,6 +1,3 @@
 require_extension(EXT_ZBC);
-reg_t a = zext_xlen(RS1), b = zext_xlen(RS2), x = 0;
-for (int i = 0; i < xlen; i++)
-  if ((b >> i) & 1)
-    x ^= a >> (xlen-i-1);
-WRITE_RD(sext_xlen(x));
+uint64_t hi, lo = ck_clmul(zext_xlen(RS1), zext_xlen(RS2), &hi);
+WRITE_RD(sext_xlen(xlen == 64 ? (hi << 1) | (lo >> 63) : lo >> 31));
@@ -1,11 +1,11 @@
 switch (STATE.prv)
 {
-  case PRV_U: throw trap_user_ecall();
+  case PRV_U: raise_trap_cause(CAUSE_USER_ECALL);
   case PRV_S:
     if (STATE.v)
-      throw trap_virtual_supervisor_ecall();
+      raise_trap_cause(CAUSE_VIRTUAL_SUPERVISOR_ECALL);
     else
-      throw trap_supervisor_ecall();
-  case PRV_M: throw trap_machine_ecall();
+      raise_trap_cause(CAUSE_SUPERVISOR_ECALL);
+  case PRV_M: raise_trap_cause(CAUSE_MACHINE_ECALL);
   default: abort();
 }
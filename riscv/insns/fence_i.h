@@ -1 +1 @@
-MMU.flush_icache();
+MMU.flush_modified_icache();
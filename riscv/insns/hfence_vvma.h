@@ -1,4 +1,4 @@
 require_extension('H');
 require_novirt();
 require_privilege(PRV_S);
-MMU.flush_tlb();
+MMU.fence_vma(true, insn.rs1() != 0, RS1, insn.rs2() != 0, RS2);
@@ -1,4 +1,4 @@
 require_vector_vs;
-P_REDUCTION_LOOP(32, 16, false, true, {
+P_REDUCTION_LOOP_KERNEL(32, 16, false, true, pk_kmada, {
   pd_res += ps1 * ps2;
 })
@@ -1,5 +1,5 @@
 require_vector_vs;
-P_LOOP(16, {
+P_LOOP_SAT_KERNEL(16, pk_ksub16, {
   bool sat = false;
   pd = (sat_sub<int16_t, uint16_t>(ps1, ps2, sat));
   P_SET_OV(sat);
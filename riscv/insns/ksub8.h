@@ -1,5 +1,5 @@
 require_vector_vs;
-P_LOOP(8, {
+P_LOOP_SAT_KERNEL(8, pk_ksub8, {
   bool sat = false;
   pd = (sat_sub<int8_t, uint8_t>(ps1, ps2, sat));
   P_SET_OV(sat);
@@ -1,5 +1,7 @@
 require_extension('A');
 require_rv64;
+// The load and the reservation are one atomic event for --record/--replay.
+replay_turn_t turn(p->get_id(), REPLAY_ATOMIC, MMU.parallel_atomics);
 auto res = MMU.load_int64(RS1, true);
-MMU.acquire_load_reservation(RS1);
+MMU.acquire_load_reservation(RS1, res);
 WRITE_RD(res);
@@ -1,4 +1,6 @@
 require_extension('A');
+// The load and the reservation are one atomic event for --record/--replay.
+replay_turn_t turn(p->get_id(), REPLAY_ATOMIC, MMU.parallel_atomics);
 auto res = MMU.load_int32(RS1, true);
-MMU.acquire_load_reservation(RS1);
+MMU.acquire_load_reservation(RS1, (uint32_t)res);
 WRITE_RD(res);
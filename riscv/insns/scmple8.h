@@ -1,3 +1,3 @@
-P_LOOP(8, {
+P_LOOP_KERNEL(8, pk_scmple8, {
   pd = (ps1 <= ps2) ? -1 : 0;
 })
@@ -1,3 +1,3 @@
-P_LOOP(16, {
+P_LOOP_KERNEL(16, pk_scmplt16, {
   pd = (ps1 < ps2) ? -1 : 0;
 })
@@ -1,3 +1,3 @@
-P_REDUCTION_LOOP(32, 8, true, false, {
+P_REDUCTION_LOOP_KERNEL(32, 8, true, false, pk_smaqa, {
   pd_res += ps1 * ps2;
 })
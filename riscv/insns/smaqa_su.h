@@ -1,3 +1,3 @@
-P_REDUCTION_SULOOP(32, 8, true, false, {
+P_REDUCTION_SULOOP_KERNEL(32, 8, true, false, pk_smaqa_su, {
   pd_res += ps1 * ps2;
 })
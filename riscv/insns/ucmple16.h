@@ -1,3 +1,3 @@
-P_ULOOP(16, {
+P_ULOOP_KERNEL(16, pk_ucmple16, {
   pd = (ps1 <= ps2) ? -1 : 0;
 })
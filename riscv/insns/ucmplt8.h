@@ -1,3 +1,3 @@
-P_ULOOP(8, {
+P_ULOOP_KERNEL(8, pk_ucmplt8, {
   pd = (ps1 < ps2) ? -1 : 0;
 })
@@ -1,5 +1,5 @@
 require_vector_vs;
-P_ULOOP(16, {
+P_ULOOP_SAT_KERNEL(16, pk_uksub16, {
   bool sat = false;
   pd = (sat_subu<uint16_t>(ps1, ps2, sat));
   P_SET_OV(sat);
@@ -1,5 +1,5 @@
 require_vector_vs;
-P_ULOOP(8, {
+P_ULOOP_SAT_KERNEL(8, pk_uksub8, {
   bool sat = false;
   pd = (sat_subu<uint8_t>(ps1, ps2, sat));
   P_SET_OV(sat);
@@ -1,3 +1,3 @@
-P_REDUCTION_ULOOP(32, 8, true, false, {
+P_REDUCTION_ULOOP_KERNEL(32, 8, true, false, pk_umaqa, {
   pd_res += ps1 * ps2;
 })
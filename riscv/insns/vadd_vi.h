@@ -1,6 +1,6 @@
 // vadd.vi vd, simm5, vs2, vm
-VI_VI_LOOP
+VI_VI_KERNEL_LOOP(VK_ADD, type_sew_t, insn.v_simm5(), VI_VI_LOOP,
 ({
   vd = simm5 + vs2;
-})
+}))
 P.get_state()->mhpmcounter[10]->bump(1);
@@ -5,30 +5,32 @@ require_align(insn.rs2(), P.VU.vflmul);
 require(insn.rd() != insn.rs2());
 require_noover(insn.rd(), P.VU.vflmul, insn.rs1(), 1);
 
-reg_t pos = 0;
+if (!VI_COMPRESS_BULK()) {
+  reg_t pos = 0;
 
-VI_GENERAL_LOOP_BASE
-  const int midx = i / 64;
-  const int mpos = i % 64;
+  VI_LOOP_COMMON
+  for (reg_t base = 0; base < vl; base += 64) {
+    uint64_t bits = P.VU.elt<uint64_t>(rs1_num, base / 64) & P.VU.active_mask(base, 0, vl, false);
+    for (; bits != 0; bits &= bits - 1) {
+      reg_t i = base + ctz(bits);
+      switch (sew) {
+      case e8:
+        P.VU.elt<uint8_t>(rd_num, pos, true) = P.VU.elt<uint8_t>(rs2_num, i);
+        break;
+      case e16:
+        P.VU.elt<uint16_t>(rd_num, pos, true) = P.VU.elt<uint16_t>(rs2_num, i);
+        break;
+      case e32:
+        P.VU.elt<uint32_t>(rd_num, pos, true) = P.VU.elt<uint32_t>(rs2_num, i);
+        break;
+      default:
+        P.VU.elt<uint64_t>(rd_num, pos, true) = P.VU.elt<uint64_t>(rs2_num, i);
+        break;
+      }
 
-  bool do_mask = (P.VU.elt<uint64_t>(rs1_num, midx) >> mpos) & 0x1;
-  if (do_mask) {
-    switch (sew) {
-    case e8:
-      P.VU.elt<uint8_t>(rd_num, pos, true) = P.VU.elt<uint8_t>(rs2_num, i);
-      break;
-    case e16:
-      P.VU.elt<uint16_t>(rd_num, pos, true) = P.VU.elt<uint16_t>(rs2_num, i);
-      break;
-    case e32:
-      P.VU.elt<uint32_t>(rd_num, pos, true) = P.VU.elt<uint32_t>(rs2_num, i);
-      break;
-    default:
-      P.VU.elt<uint64_t>(rd_num, pos, true) = P.VU.elt<uint64_t>(rs2_num, i);
-      break;
+      ++pos;
     }
-
-    ++pos;
   }
-VI_LOOP_END;
+  P.VU.vstart->write(0);
+}
 P.get_state()->mhpmcounter[10]->bump(1);
@@ -1,6 +1,6 @@
 // vfadd.vf vd, vs2, rs1
-VI_VFP_VF_LOOP
-({
+VI_VFP_VF_KERNEL_LOOP(VKF_ADD,
+{
   vd = f16_add(rs1, vs2);
 },
 {
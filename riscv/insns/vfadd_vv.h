@@ -1,6 +1,6 @@
 // vfadd.vv vd, vs2, vs1
-VI_VFP_VV_LOOP
-({
+VI_VFP_VV_KERNEL_LOOP(VKF_ADD,
+{
   vd = f16_add(vs1, vs2);
 },
 {
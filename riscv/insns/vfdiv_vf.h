@@ -1,6 +1,6 @@
 // vfdiv.vf vd, vs2, rs1
-VI_VFP_VF_LOOP
-({
+VI_VFP_VF_KERNEL_LOOP(VKF_DIV,
+{
   vd = f16_div(vs2, rs1);
 },
 {
@@ -1,6 +1,6 @@
 // vfdiv.vv  vd, vs2, vs1
-VI_VFP_VV_LOOP
-({
+VI_VFP_VV_KERNEL_LOOP(VKF_DIV,
+{
   vd = f16_div(vs2, vs1);
 },
 {
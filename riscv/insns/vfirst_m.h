@@ -7,12 +7,11 @@ reg_t rd_num = insn.rd();
 reg_t rs2_num = insn.rs2();
 require(P.VU.vstart->read() == 0);
 reg_t pos = -1;
-for (reg_t i=P.VU.vstart->read(); i < vl; ++i) {
-  VI_LOOP_ELEMENT_SKIP()
-
-  bool vs2_lsb = ((P.VU.elt<uint64_t>(rs2_num, midx ) >> mpos) & 0x1) == 1;
-  if (vs2_lsb) {
-    pos = i;
+for (reg_t base = 0; base < vl; base += 64) {
+  uint64_t active = P.VU.active_mask(base, 0, vl, insn.v_vm() == 0);
+  uint64_t bits = P.VU.elt<uint64_t>(rs2_num, base / 64) & active;
+  if (bits != 0) {
+    pos = base + ctz(bits);
     break;
   }
 }
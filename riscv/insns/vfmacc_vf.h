@@ -1,6 +1,6 @@
 // vfmacc.vf vd, rs1, vs2, vm    # vd[i] = +(vs2[i] * x[rs1]) + vd[i]
-VI_VFP_VF_LOOP
-({
+VI_VFP_VF_KERNEL_LOOP(VKF_MACC,
+{
   vd = f16_mulAdd(rs1, vs2, vd);
 },
 {
@@ -1,6 +1,6 @@
 // vfmacc.vv vd, rs1, vs2, vm    # vd[i] = +(vs2[i] * vs1[i]) + vd[i]
-VI_VFP_VV_LOOP
-({
+VI_VFP_VV_KERNEL_LOOP(VKF_MACC,
+{
   vd = f16_mulAdd(vs1, vs2, vd);
 },
 {
@@ -1,6 +1,6 @@
 // vfmadd: vd[i] = +(vd[i] * f[rs1]) + vs2[i]
-VI_VFP_VF_LOOP
-({
+VI_VFP_VF_KERNEL_LOOP(VKF_MADD,
+{
   vd = f16_mulAdd(vd, rs1, vs2);
 },
 {
@@ -1,6 +1,6 @@
 // vfmadd: vd[i] = +(vd[i] * vs1[i]) + vs2[i]
-VI_VFP_VV_LOOP
-({
+VI_VFP_VV_KERNEL_LOOP(VKF_MADD,
+{
   vd = f16_mulAdd(vd, vs1, vs2);
 },
 {
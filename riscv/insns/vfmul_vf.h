@@ -1,6 +1,6 @@
 // vfmul.vf vd, vs2, rs1, vm
-VI_VFP_VF_LOOP
-({
+VI_VFP_VF_KERNEL_LOOP(VKF_MUL,
+{
   vd = f16_mul(vs2, rs1);
 },
 {
@@ -1,6 +1,6 @@
 // vfmul.vv vd, vs1, vs2, vm
-VI_VFP_VV_LOOP
-({
+VI_VFP_VV_KERNEL_LOOP(VKF_MUL,
+{
   vd = f16_mul(vs1, vs2);
 },
 {
@@ -1,6 +1,6 @@
 // vfrdiv.vf vd, vs2, rs1, vm  # scalar-vector, vd[i] = f[rs1]/vs2[i]
-VI_VFP_VF_LOOP
-({
+VI_VFP_VF_KERNEL_LOOP(VKF_RDIV,
+{
   vd = f16_div(rs1, vs2);
 },
 {
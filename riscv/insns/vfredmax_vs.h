@@ -1,7 +1,7 @@
 // vfredmax vd, vs2, vs1
 bool is_propagate = false;
-VI_VFP_VV_LOOP_REDUCTION
-({
+VI_VFP_VV_REDUCTION_KERNEL_LOOP(VKFR_MAX,
+{
   vd_0 = f16_max(vd_0, vs2);
 },
 {
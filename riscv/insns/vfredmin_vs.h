@@ -1,7 +1,7 @@
 // vfredmin vd, vs2, vs1
 bool is_propagate = false;
-VI_VFP_VV_LOOP_REDUCTION
-({
+VI_VFP_VV_REDUCTION_KERNEL_LOOP(VKFR_MIN,
+{
   vd_0 = f16_min(vd_0, vs2);
 },
 {
@@ -1,7 +1,7 @@
 // vfredsum: vd[0] =  sum( vs2[*] , vs1[0] )
 bool is_propagate = true;
-VI_VFP_VV_LOOP_REDUCTION
-({
+VI_VFP_VV_REDUCTION_KERNEL_LOOP(VKFR_SUM,
+{
   vd_0 = f16_add(vd_0, vs2);
 },
 {
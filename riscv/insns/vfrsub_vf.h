@@ -1,6 +1,6 @@
 // vfsub.vf vd, vs2, rs1
-VI_VFP_VF_LOOP
-({
+VI_VFP_VF_KERNEL_LOOP(VKF_RSUB,
+{
   vd = f16_sub(rs1, vs2);
 },
 {
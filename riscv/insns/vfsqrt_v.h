@@ -1,6 +1,6 @@
 // vsqrt.v vd, vd2, vm
-VI_VFP_V_LOOP
-({
+VI_VFP_V_KERNEL_LOOP(VKF_SQRT,
+{
   vd = f16_sqrt(vs2);
 },
 {
@@ -1,6 +1,6 @@
 // vfsub.vv vd, vs2, vs1
-VI_VFP_VV_LOOP
-({
+VI_VFP_VV_KERNEL_LOOP(VKF_SUB,
+{
   vd = f16_sub(vs2, vs1);
 },
 {
@@ -1,7 +1,7 @@
 // vfwredsum.vs vd, vs2, vs1
 bool is_propagate = true;
-VI_VFP_VV_LOOP_WIDE_REDUCTION
-({
+VI_VFP_VV_WIDE_REDUCTION_KERNEL_LOOP(
+{
   vd_0 = f32_add(vd_0, vs2);
 },
 {
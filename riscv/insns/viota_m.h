@@ -12,42 +12,28 @@ require_align(rd_num, P.VU.vflmul);
 require_noover(rd_num, P.VU.vflmul, rs2_num, 1);
 
 int cnt = 0;
-for (reg_t i = 0; i < vl; ++i) {
-  const int midx = i / 64;
-  const int mpos = i % 64;
+for (reg_t base = 0; base < vl; base += 64) {
+  uint64_t active = P.VU.active_mask(base, 0, vl, insn.v_vm() == 0);
+  uint64_t vs2 = P.VU.elt<uint64_t>(rs2_num, base / 64) & active;
 
-  bool vs2_lsb = ((P.VU.elt<uint64_t>(rs2_num, midx) >> mpos) & 0x1) == 1;
-  bool do_mask = (P.VU.elt<uint64_t>(0, midx) >> mpos) & 0x1;
-
-  bool has_one = false;
-  if (insn.v_vm() == 1 || (insn.v_vm() == 0 && do_mask)) {
-    if (vs2_lsb) {
-      has_one = true;
+  // Masked-off elements keep their old value, so only active ones are visited.
+  for (uint64_t bits = active; bits != 0; bits &= bits - 1) {
+    reg_t i = base + ctz(bits);
+    switch (sew) {
+    case e8:
+      P.VU.elt<uint8_t>(rd_num, i, true) = cnt;
+      break;
+    case e16:
+      P.VU.elt<uint16_t>(rd_num, i, true) = cnt;
+      break;
+    case e32:
+      P.VU.elt<uint32_t>(rd_num, i, true) = cnt;
+      break;
+    default:
+      P.VU.elt<uint64_t>(rd_num, i, true) = cnt;
+      break;
     }
-  }
 
-  bool use_ori = (insn.v_vm() == 0) && !do_mask;
-  switch (sew) {
-  case e8:
-    P.VU.elt<uint8_t>(rd_num, i, true) = use_ori ?
-                                   P.VU.elt<uint8_t>(rd_num, i) : cnt;
-    break;
-  case e16:
-    P.VU.elt<uint16_t>(rd_num, i, true) = use_ori ?
-                                    P.VU.elt<uint16_t>(rd_num, i) : cnt;
-    break;
-  case e32:
-    P.VU.elt<uint32_t>(rd_num, i, true) = use_ori ?
-                                    P.VU.elt<uint32_t>(rd_num, i) : cnt;
-    break;
-  default:
-    P.VU.elt<uint64_t>(rd_num, i, true) = use_ori ?
-                                    P.VU.elt<uint64_t>(rd_num, i) : cnt;
-    break;
-  }
-
-  if (has_one) {
-    cnt++;
+    cnt += (vs2 >> (i - base)) & 1;
   }
 }
-
@@ -1,3 +1,3 @@
 // vle16.v and vlseg[2-8]e16.v
-VI_LD(0, (i * nf + fn), int16, false);
+VI_LD_UNIT_STRIDE(int16, false);
 P.get_state()->mhpmcounter[10]->bump(1);
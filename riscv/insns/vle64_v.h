@@ -1,4 +1,4 @@
 // vle64.v and vlseg[2-8]e64.v
-VI_LD(0, (i * nf + fn), int64, false);
+VI_LD_UNIT_STRIDE(int64, false);
 P.get_state()->mhpmcounter[10]->bump(1);
 P.get_state()->mhpmcounter[10]->bump(1);
@@ -1,3 +1,3 @@
 // vle1.v and vlseg[2-8]e8.v
-VI_LD(0, (i * nf + fn), int8, true);
+VI_LD_UNIT_STRIDE(int8, true);
 P.get_state()->mhpmcounter[10]->bump(1);
@@ -1,11 +1,6 @@
 // vmax.vv vd, vs2, vs1, vm   # Vector-vector
-VI_VV_LOOP
+VI_VV_KERNEL_LOOP(VK_MAX, type_sew_t, VI_VV_LOOP,
 ({
-  if (vs1 >= vs2) {
-    vd = vs1;
-  } else {
-    vd = vs2;
-  }
-
-})
+  vd = vs1 >= vs2 ? vs1 : vs2;
+}))
 P.get_state()->mhpmcounter[10]->bump(1);
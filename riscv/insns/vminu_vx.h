@@ -1,11 +1,6 @@
 // vminu.vx vd, vs2, rs1, vm   # vector-scalar
-VI_VX_ULOOP
+VI_VX_KERNEL_LOOP(VK_MIN, type_usew_t, VI_VX_ULOOP,
 ({
-  if (rs1 <= vs2) {
-    vd = rs1;
-  } else {
-    vd = vs2;
-  }
-
-})
+  vd = rs1 <= vs2 ? rs1 : vs2;
+}))
 P.get_state()->mhpmcounter[10]->bump(1);
@@ -10,23 +10,20 @@ reg_t rd_num = insn.rd();
 reg_t rs2_num = insn.rs2();
 
 bool has_one = false;
-for (reg_t i = P.VU.vstart->read(); i < vl; ++i) {
-  const int midx = i / 64;
-  const int mpos = i % 64;
-  const uint64_t mmask = UINT64_C(1) << mpos; \
+for (reg_t base = 0; base < vl; base += 64) {
+  uint64_t active = P.VU.active_mask(base, 0, vl, insn.v_vm() == 0);
+  if (active == 0)
+    continue;
 
-  bool vs2_lsb = ((P.VU.elt<uint64_t>(rs2_num, midx ) >> mpos) & 0x1) == 1;
-  bool do_mask = (P.VU.elt<uint64_t>(0, midx) >> mpos) & 0x1;
-
-  if (insn.v_vm() == 1 || (insn.v_vm() == 0 && do_mask)) {
-    auto &vd = P.VU.elt<uint64_t>(rd_num, midx, true);
-    uint64_t res = 0;
-    if (!has_one && !vs2_lsb) {
-      res = 1;
-    } else if (!has_one && vs2_lsb) {
-      has_one = true;
-      res = 1;
-    }
-    vd = (vd & ~mmask) | ((res << mpos) & mmask);
+  // Active elements up to and including the first active set bit of vs2
+  // are set.
+  uint64_t bits = P.VU.elt<uint64_t>(rs2_num, base / 64) & active;
+  uint64_t res = 0;
+  if (!has_one) {
+    res = bits ? active & (((bits & -bits) << 1) - 1) : active;
+    has_one = bits != 0;
   }
+
+  auto &vd = P.VU.elt<uint64_t>(rd_num, base / 64, true);
+  vd = (vd & ~active) | res;
 }
@@ -1,6 +1,6 @@
 // vmul vd, vs2, vs1
-VI_VV_LOOP
+VI_VV_KERNEL_LOOP(VK_MUL, type_sew_t, VI_VV_LOOP,
 ({
   vd = vs2 * vs1;
-})
+}))
 P.get_state()->mhpmcounter[10]->bump(1);
@@ -1,6 +1,6 @@
 // vmul vd, vs2, rs1
-VI_VX_LOOP
+VI_VX_KERNEL_LOOP(VK_MUL, type_sew_t, VI_VX_LOOP,
 ({
   vd = vs2 * rs1;
-})
+}))
 P.get_state()->mhpmcounter[10]->bump(1);
@@ -9,20 +9,10 @@ require_align(vs2, len);
 const reg_t size = len * P.VU.vlenb;
 const reg_t start = P.VU.vstart->read() * (P.VU.vsew >> 3);
 
-//register needs one-by-one copy to keep commitlog correct
+// elt_group logs every register of the destination written
 if (vd != vs2 && start < size) {
-  reg_t i = start / P.VU.vlenb;
-  reg_t off = start % P.VU.vlenb;
-  if (off) {
-    memcpy(&P.VU.elt<uint8_t>(vd + i, off, true),
-           &P.VU.elt<uint8_t>(vs2 + i, off), P.VU.vlenb - off);
-    i++;
-  }
-
-  for (; i < len; ++i) {
-    memcpy(&P.VU.elt<uint8_t>(vd + i, 0, true),
-           &P.VU.elt<uint8_t>(vs2 + i, 0), P.VU.vlenb);
-  }
+  memcpy(&P.VU.elt_group<uint8_t>(vd, start, size, true)[start],
+         &P.VU.elt_group<uint8_t>(vs2, start, size)[start], size - start);
 }
 
 P.VU.vstart->write(0);
@@ -1,6 +1,6 @@
 // vor
-VI_VV_LOOP
+VI_VV_KERNEL_LOOP(VK_OR, type_sew_t, VI_VV_LOOP,
 ({
   vd = vs1 | vs2;
-})
+}))
 P.get_state()->mhpmcounter[10]->bump(1);
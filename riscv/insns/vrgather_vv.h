@@ -5,29 +5,31 @@ require_align(insn.rs1(), P.VU.vflmul);
 require(insn.rd() != insn.rs2() && insn.rd() != insn.rs1());
 require_vm;
 
-VI_LOOP_BASE
-  switch (sew) {
-  case e8: {
-    auto vs1 = P.VU.elt<uint8_t>(rs1_num, i);
-    //if (i > 255) continue;
-    P.VU.elt<uint8_t>(rd_num, i, true) = vs1 >= P.VU.vlmax ? 0 : P.VU.elt<uint8_t>(rs2_num, vs1);
-    break;
-  }
-  case e16: {
-    auto vs1 = P.VU.elt<uint16_t>(rs1_num, i);
-    P.VU.elt<uint16_t>(rd_num, i, true) = vs1 >= P.VU.vlmax ? 0 : P.VU.elt<uint16_t>(rs2_num, vs1);
-    break;
-  }
-  case e32: {
-    auto vs1 = P.VU.elt<uint32_t>(rs1_num, i);
-    P.VU.elt<uint32_t>(rd_num, i, true) = vs1 >= P.VU.vlmax ? 0 : P.VU.elt<uint32_t>(rs2_num, vs1);
-    break;
-  }
-  default: {
-    auto vs1 = P.VU.elt<uint64_t>(rs1_num, i);
-    P.VU.elt<uint64_t>(rd_num, i, true) = vs1 >= P.VU.vlmax ? 0 : P.VU.elt<uint64_t>(rs2_num, vs1);
-    break;
-  }
-  }
-VI_LOOP_END;
+if (!VI_GATHER_BULK(uint8_t, uint16_t, uint32_t, uint64_t)) {
+  VI_LOOP_BASE
+    switch (sew) {
+    case e8: {
+      auto vs1 = P.VU.elt<uint8_t>(rs1_num, i);
+      //if (i > 255) continue;
+      P.VU.elt<uint8_t>(rd_num, i, true) = vs1 >= P.VU.vlmax ? 0 : P.VU.elt<uint8_t>(rs2_num, vs1);
+      break;
+    }
+    case e16: {
+      auto vs1 = P.VU.elt<uint16_t>(rs1_num, i);
+      P.VU.elt<uint16_t>(rd_num, i, true) = vs1 >= P.VU.vlmax ? 0 : P.VU.elt<uint16_t>(rs2_num, vs1);
+      break;
+    }
+    case e32: {
+      auto vs1 = P.VU.elt<uint32_t>(rs1_num, i);
+      P.VU.elt<uint32_t>(rd_num, i, true) = vs1 >= P.VU.vlmax ? 0 : P.VU.elt<uint32_t>(rs2_num, vs1);
+      break;
+    }
+    default: {
+      auto vs1 = P.VU.elt<uint64_t>(rs1_num, i);
+      P.VU.elt<uint64_t>(rd_num, i, true) = vs1 >= P.VU.vlmax ? 0 : P.VU.elt<uint64_t>(rs2_num, vs1);
+      break;
+    }
+    }
+  VI_LOOP_END;
+}
 P.get_state()->mhpmcounter[10]->bump(1);
@@ -1,3 +1,3 @@
 // vse16.v and vsseg[2-8]e16.v
-VI_ST(0, (i * nf + fn), uint16, false);
+VI_ST_UNIT_STRIDE(uint16, false);
 P.get_state()->mhpmcounter[10]->bump(1);
@@ -1,3 +1,3 @@
 // vse32.v and vsseg[2-8]e32.v
-VI_ST(0, (i * nf + fn), uint32, false);
+VI_ST_UNIT_STRIDE(uint32, false);
 P.get_state()->mhpmcounter[10]->bump(1);
@@ -1,3 +1,3 @@
 // vse64.v and vsseg[2-8]e64.v
-VI_ST(0, (i * nf + fn), uint64, false);
+VI_ST_UNIT_STRIDE(uint64, false);
 P.get_state()->mhpmcounter[10]->bump(1);
@@ -1,3 +1,3 @@
 // vse8.v and vsseg[2-8]e8.v
-VI_ST(0, (i * nf + fn), uint8, false);
+VI_ST_UNIT_STRIDE(uint8, false);
 P.get_state()->mhpmcounter[10]->bump(1);
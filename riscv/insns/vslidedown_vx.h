@@ -2,36 +2,38 @@
 VI_CHECK_SLIDE(false);
 
 const uint128_t sh = RS1;
-VI_LOOP_BASE
+if (!VI_SLIDEDOWN_BULK(sh)) {
+  VI_LOOP_BASE
 
-reg_t offset = 0;
-bool is_valid = (i + sh) < P.VU.vlmax;
+  reg_t offset = 0;
+  bool is_valid = (i + sh) < P.VU.vlmax;
 
-if (is_valid) {
-  offset = sh;
-}
+  if (is_valid) {
+    offset = sh;
+  }
 
-switch (sew) {
-case e8: {
-  VI_XI_SLIDEDOWN_PARAMS(e8, offset);
-  vd = is_valid ? vs2 : 0;
-}
-break;
-case e16: {
-  VI_XI_SLIDEDOWN_PARAMS(e16, offset);
-  vd = is_valid ? vs2 : 0;
-}
-break;
-case e32: {
-  VI_XI_SLIDEDOWN_PARAMS(e32, offset);
-  vd = is_valid ? vs2 : 0;
-}
-break;
-default: {
-  VI_XI_SLIDEDOWN_PARAMS(e64, offset);
-  vd = is_valid ? vs2 : 0;
-}
-break;
+  switch (sew) {
+  case e8: {
+    VI_XI_SLIDEDOWN_PARAMS(e8, offset);
+    vd = is_valid ? vs2 : 0;
+  }
+  break;
+  case e16: {
+    VI_XI_SLIDEDOWN_PARAMS(e16, offset);
+    vd = is_valid ? vs2 : 0;
+  }
+  break;
+  case e32: {
+    VI_XI_SLIDEDOWN_PARAMS(e32, offset);
+    vd = is_valid ? vs2 : 0;
+  }
+  break;
+  default: {
+    VI_XI_SLIDEDOWN_PARAMS(e64, offset);
+    vd = is_valid ? vs2 : 0;
+  }
+  break;
+  }
+  VI_LOOP_END
 }
-VI_LOOP_END
 P.get_state()->mhpmcounter[10]->bump(1);
@@ -2,31 +2,33 @@
 VI_CHECK_SLIDE(true);
 
 const reg_t offset = insn.v_zimm5();
-VI_LOOP_BASE
-if (P.VU.vstart->read() < offset && i < offset)
-  continue;
+if (!VI_SLIDEUP_BULK(offset)) {
+  VI_LOOP_BASE
+  if (P.VU.vstart->read() < offset && i < offset)
+    continue;
 
-switch (sew) {
-case e8: {
-  VI_XI_SLIDEUP_PARAMS(e8, offset);
-  vd = vs2;
+  switch (sew) {
+  case e8: {
+    VI_XI_SLIDEUP_PARAMS(e8, offset);
+    vd = vs2;
+  }
+  break;
+  case e16: {
+    VI_XI_SLIDEUP_PARAMS(e16, offset);
+    vd = vs2;
+  }
+  break;
+  case e32: {
+    VI_XI_SLIDEUP_PARAMS(e32, offset);
+    vd = vs2;
+  }
+  break;
+  default: {
+    VI_XI_SLIDEUP_PARAMS(e64, offset);
+    vd = vs2;
+  }
+  break;
+  }
+  VI_LOOP_END
 }
-break;
-case e16: {
-  VI_XI_SLIDEUP_PARAMS(e16, offset);
-  vd = vs2;
-}
-break;
-case e32: {
-  VI_XI_SLIDEUP_PARAMS(e32, offset);
-  vd = vs2;
-}
-break;
-default: {
-  VI_XI_SLIDEUP_PARAMS(e64, offset);
-  vd = vs2;
-}
-break;
-}
-VI_LOOP_END
 P.get_state()->mhpmcounter[10]->bump(1);
@@ -1,6 +1,6 @@
 // vsll.vi  vd, vs2, zimm5
-VI_VI_LOOP
+VI_VI_KERNEL_LOOP(VK_SLL, type_sew_t, insn.v_zimm5(), VI_VI_LOOP,
 ({
   vd = vs2 << (simm5 & (sew - 1) & 0x1f);
-})
+}))
 P.get_state()->mhpmcounter[10]->bump(1);
@@ -1,6 +1,6 @@
 // vsll
-VI_VV_LOOP
+VI_VV_KERNEL_LOOP(VK_SLL, type_sew_t, VI_VV_LOOP,
 ({
   vd = vs2 << (vs1 & (sew - 1));
-})
+}))
 P.get_state()->mhpmcounter[10]->bump(1);
@@ -1,6 +1,6 @@
 // vsll
-VI_VX_LOOP
+VI_VX_KERNEL_LOOP(VK_SLL, type_sew_t, VI_VX_LOOP,
 ({
   vd = vs2 << (rs1 & (sew - 1));
-})
+}))
 P.get_state()->mhpmcounter[10]->bump(1);
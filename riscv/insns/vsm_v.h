@@ -1,3 +1,3 @@
 // vse1.v
-VI_ST(0, (i * nf + fn), uint8, true);
+VI_ST_UNIT_STRIDE(uint8, true);
 P.get_state()->mhpmcounter[10]->bump(1);
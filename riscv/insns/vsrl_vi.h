@@ -1,6 +1,6 @@
 // vsrl.vi vd, vs2, zimm5
-VI_VI_ULOOP
+VI_VI_KERNEL_LOOP(VK_SRL, type_usew_t, insn.v_zimm5(), VI_VI_ULOOP,
 ({
   vd = vs2 >> (zimm5 & (sew - 1) & 0x1f);
-})
+}))
 P.get_state()->mhpmcounter[10]->bump(1);
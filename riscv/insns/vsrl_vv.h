@@ -1,6 +1,6 @@
 // vsrl.vv  vd, vs2, vs1
-VI_VV_ULOOP
+VI_VV_KERNEL_LOOP(VK_SRL, type_usew_t, VI_VV_ULOOP,
 ({
   vd = vs2 >> (vs1 & (sew - 1));
-})
+}))
 P.get_state()->mhpmcounter[10]->bump(1);
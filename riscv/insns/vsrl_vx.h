@@ -1,6 +1,6 @@
 // vsrl.vx vd, vs2, rs1
-VI_VX_ULOOP
+VI_VX_KERNEL_LOOP(VK_SRL, type_usew_t, VI_VX_ULOOP,
 ({
   vd = vs2 >> (rs1 & (sew - 1));
-})
+}))
 P.get_state()->mhpmcounter[10]->bump(1);
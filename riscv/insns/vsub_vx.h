@@ -1,6 +1,6 @@
 // vsub: vd[i] = (vd[i] * x[rs1]) - vs2[i]
-VI_VX_LOOP
+VI_VX_KERNEL_LOOP(VK_SUB, type_sew_t, VI_VX_LOOP,
 ({
   vd = vs2 - rs1;
-})
+}))
 P.get_state()->mhpmcounter[10]->bump(1);
@@ -1,6 +1,6 @@
 // vwredsum.vs vd, vs2, vs1
-VI_VV_ULOOP_WIDE_REDUCTION
+VI_VV_WIDE_REDUCTION_KERNEL_LOOP(type_usew_t, VI_VV_ULOOP_WIDE_REDUCTION,
 ({
   vd_0_res += vs2;
-})
+}))
 P.get_state()->mhpmcounter[10]->bump(1);
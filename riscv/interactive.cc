@@ -21,6 +21,7 @@
 #include <math.h>
 
 #define MAX_CMD_STR 40 // maximum possible size of a command line
+#define INTERACTIVE_RUN_STEPS 1000000 // "until" re-checks at least this often
 
 #define STR_(X) #X      // these definitions allow to use a macro as a string
 #define STR(X) STR_(X)
@@ -135,6 +136,10 @@ void sim_t::interactive()
   funcs["until"] = &sim_t::interactive_until_silent;
   funcs["untiln"] = &sim_t::interactive_until_noisy;
   funcs["while"] = &sim_t::interactive_until_silent;
+  funcs["reverse-step"] = &sim_t::interactive_reverse_step;
+  funcs["rstep"] = funcs["reverse-step"];
+  funcs["reverse-continue"] = &sim_t::interactive_reverse_continue;
+  funcs["rc"] = funcs["reverse-continue"];
   funcs["quit"] = &sim_t::interactive_quit;
   funcs["q"] = funcs["quit"];
   funcs["help"] = &sim_t::interactive_help;
@@ -225,6 +230,10 @@ void sim_t::interactive_help(const std::string& cmd, const std::vector<std::stri
     "run [count]                     # Resume noisy execution (until CTRL+C, or [count] insns)\n"
     "r [count]                         Alias for run\n"
     "rs [count]                      # Resume silent execution (until CTRL+C, or [count] insns)\n"
+    "reverse-step [count]            # Go back [count] steps (default 1), as run counts them\n"
+    "rstep [count]                     Alias for reverse-step\n"
+    "reverse-continue [cond]         # Go back to the last step where [cond], given as to until, held (the last snapshot if omitted)\n"
+    "rc [cond]                         Alias for reverse-continue\n"
     "quit                            # End the simulation\n"
     "q                                 Alias for quit\n"
     "help                            # This screen!\n"
@@ -538,40 +547,94 @@ void sim_t::interactive_until_noisy(const std::string& cmd, const std::vector<st
   interactive_until(cmd, args, true);
 }
 
-void sim_t::interactive_until(const std::string& cmd, const std::vector<std::string>& args, bool noisy)
+sim_t::until_cond_t sim_t::parse_until(const std::vector<std::string>& args)
 {
-  bool cmd_until = cmd == "until" || cmd == "untiln";
-
   if (args.size() < 3)
     throw trap_interactive();
 
   if (args.size() == 3)
     get_core(args[1]); // make sure that argument is a valid core number
 
+  until_cond_t cond;
   char *end;
-  reg_t val = strtol(args[args.size()-1].c_str(),&end,16);
-  if (val == LONG_MAX)
-    val = strtoul(args[args.size()-1].c_str(),&end,16);
+  cond.val = strtol(args[args.size()-1].c_str(),&end,16);
+  if (cond.val == LONG_MAX)
+    cond.val = strtoul(args[args.size()-1].c_str(),&end,16);
   if (args[args.size()-1].c_str() == end)  // not a valid number
     throw trap_interactive();
 
   // mask bits above max_xlen
-  int max_xlen = procs[strtol(args[1].c_str(),NULL,10)]->get_isa().get_max_xlen();
-  if (max_xlen == 32) val &= 0xFFFFFFFF;
+  cond.max_xlen = procs[strtol(args[1].c_str(),NULL,10)]->get_isa().get_max_xlen();
+  if (cond.max_xlen == 32) cond.val &= 0xFFFFFFFF;
 
-  std::vector<std::string> args2;
-  args2 = std::vector<std::string>(args.begin()+1,args.end()-1);
+  cond.args = std::vector<std::string>(args.begin()+1,args.end()-1);
 
-  auto func = args[0] == "reg" ? &sim_t::get_reg :
+  cond.func = args[0] == "reg" ? &sim_t::get_reg :
               args[0] == "pc"  ? &sim_t::get_pc :
               args[0] == "mem" ? &sim_t::get_mem :
               NULL;
 
-  if (func == NULL)
+  if (cond.func == NULL)
     throw trap_interactive();
+  return cond;
+}
+
+bool sim_t::until_holds(const until_cond_t& cond)
+{
+  try {
+    reg_t current = (this->*cond.func)(cond.args);
+
+    // mask bits above max_xlen
+    if (cond.max_xlen == 32) current &= 0xFFFFFFFF;
+
+    return current == cond.val;
+  } catch (trap_t& t) {
+    return false;
+  }
+}
+
+void sim_t::interactive_until(const std::string& cmd, const std::vector<std::string>& args, bool noisy)
+{
+  bool cmd_until = cmd == "until" || cmd == "untiln";
+
+  until_cond_t cond = parse_until(args);
+  auto func = cond.func;
+  auto& args2 = cond.args;
+  reg_t val = cond.val;
+  int max_xlen = cond.max_xlen;
+
+  // Reaching a PC, or a store to the word that "mem" reads, can be left to
+  // the harts, which then run at full speed between checks.  Registers,
+  // per-core virtual addresses and noisy runs are checked every instruction.
+  // So is everything under reverse execution, which could not repeat a
+  // step() that a breakpoint cut short.
+  processor_t* bp_proc = NULL;
+  reg_t bp_pc = max_xlen == 32 ? (reg_t)(int32_t)val : val;
+  reg_t watch_lo = 0, watch_hi = 0;
+  bool may_stop = !noisy && !reverse_interval;
+  if (may_stop && func == &sim_t::get_pc && cmd_until) {
+    bp_proc = get_core(args2[0]);
+  } else if (may_stop && func == &sim_t::get_mem && args2.size() == 1) {
+    watch_lo = strtoul(args2[0].c_str(), NULL, 16);
+    watch_hi = watch_lo + (watch_lo % 8 == 0 ? 8 : watch_lo % 4 == 0 ? 4 : watch_lo % 2 == 0 ? 2 : 1);
+  }
+  bool fast = bp_proc || watch_hi != 0;
+
+  auto arm = [&](bool on) {
+    if (bp_proc)
+      bp_proc->get_mmu()->set_breakpoint(on ? bp_pc : -1);
+    if (watch_hi != 0)
+      for (auto p : procs)
+        p->get_mmu()->set_watchpoint(on ? watch_lo : 0, on ? watch_hi : 0);
+  };
 
   ctrlc_pressed = false;
+  if (fast)
+    arm(true);
 
+  // Set after a hart stopped at the breakpoint or watchpoint, which must
+  // then be stepped over with both disarmed.
+  bool stopped = false;
   while (1)
   {
     try
@@ -589,6 +652,20 @@ void sim_t::interactive_until(const std::string& cmd, const std::vector<std::str
     catch (trap_t& t) {}
 
     set_procs_debug(noisy);
-    step(1);
+    if (stopped) {
+      arm(false);
+      step(1);
+      arm(true);
+      stopped = false;
+    } else if (fast) {
+      step(INTERACTIVE_RUN_STEPS);
+      for (auto p : procs)
+        stopped |= p->is_interactive_stopped();
+    } else {
+      step(1);
+    }
   }
+
+  if (fast)
+    arm(false);
 }
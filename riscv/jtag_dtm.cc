@@ -45,6 +45,7 @@ jtag_dtm_t::jtag_dtm_t(debug_module_t *dm, unsigned required_rti_cycles) :
   dtmcontrol((abits << DTM_DTMCS_ABITS_OFFSET) | 1),
   dmi(DMI_OP_STATUS_SUCCESS << DTM_DMI_OP_OFFSET),
   bypass(0),
+  dmi_needs_harts(false),
   _state(TEST_LOGIC_RESET)
 {
 }
@@ -54,10 +55,24 @@ void jtag_dtm_t::reset() {
   busy_stuck = false;
   rti_remaining = 0;
   dmi = 0;
+  dmi_needs_harts = false;
+}
+
+void jtag_dtm_t::flush()
+{
+  dm->flush_sb_writes();
+}
+
+static bool is_sb_register(unsigned address)
+{
+  return address == DM_SBCS ||
+    (address >= DM_SBADDRESS0 && address <= DM_SBADDRESS2) ||
+    address == DM_SBADDRESS3 ||
+    (address >= DM_SBDATA0 && address <= DM_SBDATA3);
 }
 
 void jtag_dtm_t::set_pins(bool tck, bool tms, bool tdi) {
-  const jtag_state_t next[16][2] = {
+  static const jtag_state_t next[16][2] = {
     /* TEST_LOGIC_RESET */    { RUN_TEST_IDLE, TEST_LOGIC_RESET },
     /* RUN_TEST_IDLE */       { RUN_TEST_IDLE, SELECT_DR_SCAN },
     /* SELECT_DR_SCAN */      { CAPTURE_DR, SELECT_IR_SCAN },
@@ -191,6 +206,8 @@ void jtag_dtm_t::update_dr()
     } else if (op == DMI_OP_WRITE) {
       success = dm->dmi_write(address, data);
     }
+    if (op != DMI_OP_NOP)
+      dmi_needs_harts = !is_sb_register(address);
 
     if (success) {
       dmi = set_field(dmi, DMI_OP, DMI_OP_STATUS_SUCCESS);
@@ -38,6 +38,15 @@ class jtag_dtm_t
 
     jtag_state_t state() const { return _state; }
 
+    // Whether the harts may have to run before the debugger's next DMI
+    // access can succeed, as after an abstract command or a halt request.
+    // Accesses to the system bus never need them, so a run of those can
+    // be served without returning to the simulation.
+    bool harts_needed() const { return dmi_needs_harts; }
+
+    // Lets the DM store what it has buffered before the harts run.
+    void flush();
+
   private:
     debug_module_t *dm;
     // The number of Run-Test/Idle cycles required before a DMI access is
@@ -59,6 +68,7 @@ class jtag_dtm_t
     // complete.
     unsigned rti_remaining;
     bool busy_stuck;
+    bool dmi_needs_harts;
 
     jtag_state_t _state;
 
@@ -0,0 +1,387 @@
+// See LICENSE for license details.
+
+#include "kvm_ff.h"
+#include "processor.h"
+#include "devices.h"
+#include "simif.h"
+#include "mmu.h"
+#include <stdexcept>
+#include <string>
+
+#if defined(__linux__) && defined(__riscv)
+
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/kvm.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define SBI_EXT_0_1_CONSOLE_PUTCHAR	0x01
+#define SBI_EXT_0_1_CONSOLE_GETCHAR	0x02
+#define SBI_ERR_NOT_SUPPORTED		(-2)
+
+#define CORE_REG(n)	(KVM_REG_RISCV | KVM_REG_SIZE_U64 | KVM_REG_RISCV_CORE | (n))
+#define CSR_REG(name)	(KVM_REG_RISCV | KVM_REG_SIZE_U64 | KVM_REG_RISCV_CSR | KVM_REG_RISCV_CSR_REG(name))
+#define TIMER_REG(name)	(KVM_REG_RISCV | KVM_REG_SIZE_U64 | KVM_REG_RISCV_TIMER | KVM_REG_RISCV_TIMER_REG(name))
+#define FP_D_REG(n)	(KVM_REG_RISCV | KVM_REG_SIZE_U64 | KVM_REG_RISCV_FP_D | (KVM_REG_RISCV_FP_D_REG(f[0]) + (n)))
+#define FP_D_FCSR	(KVM_REG_RISCV | KVM_REG_SIZE_U32 | KVM_REG_RISCV_FP_D | KVM_REG_RISCV_FP_D_REG(fcsr))
+#define FP_F_REG(n)	(KVM_REG_RISCV | KVM_REG_SIZE_U32 | KVM_REG_RISCV_FP_F | (KVM_REG_RISCV_FP_F_REG(f[0]) + (n)))
+#define FP_F_FCSR	(KVM_REG_RISCV | KVM_REG_SIZE_U32 | KVM_REG_RISCV_FP_F | KVM_REG_RISCV_FP_F_REG(fcsr))
+
+// The kvm_run of the vCPU being run, whose KVM_RUN the counter's signal
+// ends, even if it arrives just before the ioctl
+static kvm_run* volatile counted_run;
+
+static void handle_counter_signal(int sig)
+{
+  kvm_run* run = counted_run;
+  if (run)
+    run->immediate_exit = 1;
+}
+
+static void check(bool ok, const char* what)
+{
+  if (!ok)
+    throw std::runtime_error(std::string("KVM fast-forward: ") + what + ": " + strerror(errno));
+}
+
+kvm_ff_t::kvm_ff_t(simif_t* sim, const std::vector<std::pair<reg_t, mem_t*>>& mems)
+  : sim(sim), kvm_fd(-1), vm_fd(-1), vcpu_fd(-1), counter_fd(-1),
+    vcpu_run(nullptr), vcpu_run_size(0)
+{
+  kvm_fd = open("/dev/kvm", O_RDWR | O_CLOEXEC);
+  check(kvm_fd >= 0, "could not open /dev/kvm");
+  check(ioctl(kvm_fd, KVM_GET_API_VERSION, 0) == KVM_API_VERSION, "unsupported KVM API version");
+  vm_fd = ioctl(kvm_fd, KVM_CREATE_VM, 0);
+  check(vm_fd >= 0, "could not create a VM");
+
+  for (size_t i = 0; i < mems.size(); i++) {
+    mem_t* mem = mems[i].second;
+    if (!mem->is_flat())
+      throw std::runtime_error("KVM fast-forward requires --flat-mem");
+    struct kvm_userspace_memory_region region = {};
+    region.slot = i;
+    region.guest_phys_addr = mems[i].first;
+    region.memory_size = mem->size();
+    region.userspace_addr = (uint64_t)mem->contents(0);
+    check(ioctl(vm_fd, KVM_SET_USER_MEMORY_REGION, &region) == 0,
+          "could not map memory into the VM");
+  }
+
+  vcpu_fd = ioctl(vm_fd, KVM_CREATE_VCPU, 0);
+  check(vcpu_fd >= 0, "could not create a vCPU");
+  int size = ioctl(kvm_fd, KVM_GET_VCPU_MMAP_SIZE, 0);
+  check(size > 0, "could not size the vCPU's kvm_run");
+  vcpu_run_size = size;
+  void* run = mmap(NULL, vcpu_run_size, PROT_READ | PROT_WRITE, MAP_SHARED, vcpu_fd, 0);
+  check(run != MAP_FAILED, "could not map the vCPU's kvm_run");
+  vcpu_run = (kvm_run*)run;
+
+  struct sigaction sa = {};
+  sa.sa_handler = handle_counter_signal;
+  sigemptyset(&sa.sa_mask);
+  check(sigaction(SIGRTMIN, &sa, NULL) == 0, "could not install the counter's signal handler");
+}
+
+kvm_ff_t::~kvm_ff_t()
+{
+  if (counter_fd >= 0)
+    close(counter_fd);
+  if (vcpu_run)
+    munmap(vcpu_run, vcpu_run_size);
+  if (vcpu_fd >= 0)
+    close(vcpu_fd);
+  if (vm_fd >= 0)
+    close(vm_fd);
+  if (kvm_fd >= 0)
+    close(kvm_fd);
+}
+
+void kvm_ff_t::set_reg(uint64_t id, const void* value)
+{
+  struct kvm_one_reg reg = {id, (uint64_t)value};
+  check(ioctl(vcpu_fd, KVM_SET_ONE_REG, &reg) == 0, "could not set a register");
+}
+
+void kvm_ff_t::get_reg(uint64_t id, void* value)
+{
+  struct kvm_one_reg reg = {id, (uint64_t)value};
+  check(ioctl(vcpu_fd, KVM_GET_ONE_REG, &reg) == 0, "could not get a register");
+}
+
+// The S-mode CSRs KVM keeps for the guest, in its order
+static const struct {
+  reg_t csr;
+  uint64_t id;
+} kvm_csrs[] = {
+  {CSR_SSTATUS, CSR_REG(sstatus)},
+  {CSR_SIE, CSR_REG(sie)},
+  {CSR_STVEC, CSR_REG(stvec)},
+  {CSR_SSCRATCH, CSR_REG(sscratch)},
+  {CSR_SEPC, CSR_REG(sepc)},
+  {CSR_SCAUSE, CSR_REG(scause)},
+  {CSR_STVAL, CSR_REG(stval)},
+  {CSR_SIP, CSR_REG(sip)},
+  {CSR_SATP, CSR_REG(satp)},
+  {CSR_SCOUNTEREN, CSR_REG(scounteren)},
+};
+
+void kvm_ff_t::put_state(processor_t* proc, clint_t* clint)
+{
+  state_t* state = proc->get_state();
+  if (state->v || state->prv == PRV_M)
+    throw std::runtime_error("KVM fast-forward: the hart must be in S- or U-mode, and not virtualized");
+
+  uint64_t value = state->pc;
+  set_reg(CORE_REG(KVM_REG_RISCV_CORE_REG(regs.pc)), &value);
+  for (size_t i = 1; i < NXPR; i++) {
+    value = state->XPR[i];
+    set_reg(CORE_REG(i), &value);
+  }
+  value = state->prv == PRV_S ? KVM_RISCV_MODE_S : KVM_RISCV_MODE_U;
+  set_reg(CORE_REG(KVM_REG_RISCV_CORE_REG(mode)), &value);
+
+  for (auto& c : kvm_csrs) {
+    value = state->csrmap[c.csr]->read();
+    set_reg(c.id, &value);
+  }
+
+  if (proc->extension_enabled('D')) {
+    for (size_t i = 0; i < NFPR; i++)
+      set_reg(FP_D_REG(i), &state->FPR[i].v[0]);
+    uint32_t fcsr = state->csrmap[CSR_FCSR]->read();
+    set_reg(FP_D_FCSR, &fcsr);
+  } else if (proc->extension_enabled('F')) {
+    for (size_t i = 0; i < NFPR; i++) {
+      uint32_t f = state->FPR[i].v[0];
+      set_reg(FP_F_REG(i), &f);
+    }
+    uint32_t fcsr = state->csrmap[CSR_FCSR]->read();
+    set_reg(FP_F_FCSR, &fcsr);
+  }
+
+#ifdef KVM_REG_RISCV_VECTOR
+  if (proc->extension_enabled('V')) {
+    auto& VU = proc->VU;
+    const uint64_t v = KVM_REG_RISCV | KVM_REG_SIZE_U64 | KVM_REG_RISCV_VECTOR;
+    uint64_t csrs[] = {VU.vstart->read(), VU.vl->read(), VU.vtype->read(),
+                       state->csrmap[CSR_VCSR]->read()};
+    set_reg(v | KVM_REG_RISCV_VECTOR_CSR_REG(vstart), &csrs[0]);
+    set_reg(v | KVM_REG_RISCV_VECTOR_CSR_REG(vl), &csrs[1]);
+    set_reg(v | KVM_REG_RISCV_VECTOR_CSR_REG(vtype), &csrs[2]);
+    set_reg(v | KVM_REG_RISCV_VECTOR_CSR_REG(vcsr), &csrs[3]);
+    uint64_t size = uint64_t(__builtin_ctzl(VU.vlenb)) << KVM_REG_SIZE_SHIFT;
+    for (size_t i = 0; i < NVPR; i++)
+      set_reg(KVM_REG_RISCV | size | KVM_REG_RISCV_VECTOR | KVM_REG_RISCV_VECTOR_REG(i),
+              (uint8_t*)VU.reg_file + i * VU.vlenb);
+  }
+#endif
+
+  // KVM keeps the timer running while it is armed, from the guest's time.
+  value = clint->get_mtime();
+  set_reg(TIMER_REG(time), &value);
+  value = clint->get_mtimecmp(0);
+  set_reg(TIMER_REG(compare), &value);
+  value = value == UINT64_MAX ? KVM_RISCV_TIMER_STATE_OFF : KVM_RISCV_TIMER_STATE_ON;
+  set_reg(TIMER_REG(state), &value);
+}
+
+void kvm_ff_t::take_state(processor_t* proc, clint_t* clint, uint64_t retired)
+{
+  state_t* state = proc->get_state();
+  uint64_t value;
+  get_reg(CORE_REG(KVM_REG_RISCV_CORE_REG(regs.pc)), &value);
+  state->pc = value;
+  for (size_t i = 1; i < NXPR; i++) {
+    get_reg(CORE_REG(i), &value);
+    state->XPR.write(i, value);
+  }
+  get_reg(CORE_REG(KVM_REG_RISCV_CORE_REG(mode)), &value);
+  reg_t prv = value == KVM_RISCV_MODE_S ? PRV_S : PRV_U;
+
+  // satp and sstatus go in before the mode they are checked against.
+  for (auto& c : kvm_csrs) {
+    get_reg(c.id, &value);
+    state->csrmap[c.csr]->write(value);
+  }
+
+  if (proc->extension_enabled('D')) {
+    for (size_t i = 0; i < NFPR; i++) {
+      get_reg(FP_D_REG(i), &value);
+      state->FPR.write(i, freg(f64(value)));
+    }
+    uint32_t fcsr;
+    get_reg(FP_D_FCSR, &fcsr);
+    state->csrmap[CSR_FCSR]->write(fcsr);
+  } else if (proc->extension_enabled('F')) {
+    for (size_t i = 0; i < NFPR; i++) {
+      uint32_t f;
+      get_reg(FP_F_REG(i), &f);
+      state->FPR.write(i, freg(f32(f)));
+    }
+    uint32_t fcsr;
+    get_reg(FP_F_FCSR, &fcsr);
+    state->csrmap[CSR_FCSR]->write(fcsr);
+  }
+
+#ifdef KVM_REG_RISCV_VECTOR
+  if (proc->extension_enabled('V')) {
+    auto& VU = proc->VU;
+    const uint64_t v = KVM_REG_RISCV | KVM_REG_SIZE_U64 | KVM_REG_RISCV_VECTOR;
+    uint64_t vstart, vl, vtype, vcsr;
+    get_reg(v | KVM_REG_RISCV_VECTOR_CSR_REG(vstart), &vstart);
+    get_reg(v | KVM_REG_RISCV_VECTOR_CSR_REG(vl), &vl);
+    get_reg(v | KVM_REG_RISCV_VECTOR_CSR_REG(vtype), &vtype);
+    get_reg(v | KVM_REG_RISCV_VECTOR_CSR_REG(vcsr), &vcsr);
+    uint64_t size = uint64_t(__builtin_ctzl(VU.vlenb)) << KVM_REG_SIZE_SHIFT;
+    for (size_t i = 0; i < NVPR; i++)
+      get_reg(KVM_REG_RISCV | size | KVM_REG_RISCV_VECTOR | KVM_REG_RISCV_VECTOR_REG(i),
+              (uint8_t*)VU.reg_file + i * VU.vlenb);
+    VU.set_vl(1, 1, vl, vtype);
+    VU.vstart->write_raw(vstart);
+    state->csrmap[CSR_VCSR]->write(vcsr);
+  }
+#endif
+
+  // The firmware arms the machine timer for each SBI set_timer, so the
+  // guest's compare becomes mtimecmp with the timer interrupt enabled.
+  get_reg(TIMER_REG(time), &value);
+  clint->set_mtime(value);
+  uint64_t timer_state;
+  get_reg(TIMER_REG(state), &timer_state);
+  if (timer_state == KVM_RISCV_TIMER_STATE_ON) {
+    get_reg(TIMER_REG(compare), &value);
+    clint->set_mtimecmp(0, value);
+    state->mie->write_with_mask(MIP_MTIP, MIP_MTIP);
+  }
+
+  // As in restore_checkpoint, the counters absorb the bump that follows.
+  state->minstret->write(state->minstret->read() + retired);
+  state->minstret->bump(1);
+  state->mcycle->write(state->mcycle->read() + retired);
+  state->mcycle->bump(1);
+
+  proc->set_privilege(prv);
+  mmu_t* mmu = proc->get_mmu();
+  mmu->flush_tlb();
+  mmu->flush_icache();
+  mmu->yield_load_reservation();
+}
+
+void kvm_ff_t::arm_counter(uint64_t insns)
+{
+  struct perf_event_attr attr = {};
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+  attr.sample_period = insns;
+  attr.exclude_host = 1;
+  attr.exclude_hv = 1;
+  counter_fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+  check(counter_fd >= 0, "could not count the guest's instructions");
+
+  struct f_owner_ex owner = {F_OWNER_TID, (pid_t)syscall(SYS_gettid)};
+  check(fcntl(counter_fd, F_SETOWN_EX, &owner) == 0 &&
+        fcntl(counter_fd, F_SETSIG, SIGRTMIN) == 0 &&
+        fcntl(counter_fd, F_SETFL, O_ASYNC) == 0,
+        "could not have the instruction counter signal this thread");
+}
+
+uint64_t kvm_ff_t::read_counter()
+{
+  uint64_t count = 0;
+  if (counter_fd >= 0) {
+    if (read(counter_fd, &count, sizeof(count)) != sizeof(count))
+      count = 0;
+    close(counter_fd);
+    counter_fd = -1;
+  }
+  return count;
+}
+
+bool kvm_ff_t::handle_exit(int* exit_code)
+{
+  kvm_run* run = vcpu_run;
+  switch (run->exit_reason) {
+    case KVM_EXIT_MMIO: {
+      bool ok = run->mmio.is_write ? sim->mmio_store(run->mmio.phys_addr, run->mmio.len, run->mmio.data)
+                                   : sim->mmio_load(run->mmio.phys_addr, run->mmio.len, run->mmio.data);
+      if (!ok)
+        throw std::runtime_error("KVM fast-forward: access fault at " + std::to_string(run->mmio.phys_addr));
+      return true;
+    }
+    case KVM_EXIT_RISCV_SBI:
+      // KVM hands up only what it does not implement itself.
+      if (run->riscv_sbi.extension_id == SBI_EXT_0_1_CONSOLE_PUTCHAR) {
+        putchar(run->riscv_sbi.args[0]);
+        fflush(stdout);
+        run->riscv_sbi.ret[0] = 0;
+      } else if (run->riscv_sbi.extension_id == SBI_EXT_0_1_CONSOLE_GETCHAR) {
+        run->riscv_sbi.ret[0] = -1;
+      } else {
+        run->riscv_sbi.ret[0] = SBI_ERR_NOT_SUPPORTED;
+      }
+      return true;
+    case KVM_EXIT_SYSTEM_EVENT:
+      // A system reset with a failure reason ends the run with 1.
+      *exit_code = run->system_event.type != KVM_SYSTEM_EVENT_SHUTDOWN &&
+                   run->system_event.type != KVM_SYSTEM_EVENT_RESET;
+      if (run->system_event.ndata > 0 && run->system_event.data[0] != 0)
+        *exit_code = 1;
+      return false;
+    case KVM_EXIT_INTR:
+      return true;
+    default:
+      throw std::runtime_error("KVM fast-forward: unexpected exit " + std::to_string(run->exit_reason));
+  }
+}
+
+bool kvm_ff_t::run(processor_t* proc, clint_t* clint, uint64_t insns, int* exit_code)
+{
+  put_state(proc, clint);
+  if (insns)
+    arm_counter(insns);
+  counted_run = vcpu_run;
+
+  bool running = true;
+  while (running) {
+    if (ioctl(vcpu_fd, KVM_RUN, 0) < 0) {
+      check(errno == EINTR || errno == EAGAIN, "KVM_RUN failed");
+      vcpu_run->immediate_exit = 0;
+      if (insns)
+        break;
+      continue;
+    }
+    running = handle_exit(exit_code);
+  }
+
+  counted_run = nullptr;
+  vcpu_run->immediate_exit = 0;
+  take_state(proc, clint, read_counter());
+  return running;
+}
+
+#else
+
+kvm_ff_t::kvm_ff_t(simif_t* sim, const std::vector<std::pair<reg_t, mem_t*>>& mems)
+  : sim(sim), kvm_fd(-1), vm_fd(-1), vcpu_fd(-1), counter_fd(-1),
+    vcpu_run(nullptr), vcpu_run_size(0)
+{
+  throw std::runtime_error("KVM fast-forward requires a RISC-V Linux host");
+}
+
+kvm_ff_t::~kvm_ff_t()
+{
+}
+
+bool kvm_ff_t::run(processor_t* proc, clint_t* clint, uint64_t insns, int* exit_code)
+{
+  return true;
+}
+
+#endif
@@ -0,0 +1,71 @@
+// See LICENSE for license details.
+#ifndef _RISCV_KVM_FF_H
+#define _RISCV_KVM_FF_H
+
+#include "decode.h"
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+class mem_t;
+class clint_t;
+class processor_t;
+class simif_t;
+struct kvm_run;
+
+// Fast-forwards a single-hart machine by running its hart natively under
+// KVM, on a RISC-V Linux host with the H extension, and then hands the
+// hart back to spike for traced execution.
+//
+// KVM runs its guests in VS- and VU-mode and answers their SBI calls
+// itself, so only code below M-mode can run natively.  spike boots the
+// machine as usual, and the hart goes over to KVM once the firmware has
+// first left M-mode; the firmware is then still set up in spike to take
+// the SBI calls made after the hart comes back.  Memory is not copied:
+// each flat memory region is a KVM memory slot over spike's own pages.
+// The hart's pc, GPRs, FPRs, privilege mode, S-mode CSRs and, where the
+// host kernel exposes them, vector registers go over and back through
+// KVM's ONE_REG interface.  The guest's time starts from mtime and its
+// timer compare from mtimecmp, and both go back into the CLINT.
+//
+// Loads and stores outside memory exit to spike's devices, but the
+// devices raise no interrupts while the hart runs natively, and the
+// guest's time runs at the host's timebase frequency rather than the
+// machine's.  Sstc's stimecmp stays behind.
+class kvm_ff_t
+{
+ public:
+  // Throws std::runtime_error if KVM is missing, or a region is not flat.
+  kvm_ff_t(simif_t* sim, const std::vector<std::pair<reg_t, mem_t*>>& mems);
+  ~kvm_ff_t();
+
+  // Runs proc, which must be in S- or U-mode and not virtualized, from
+  // its state until it has retired about insns instructions, or with
+  // insns 0 until the guest shuts down, and then puts its state back.
+  // The count is taken from an overflow of the host's instruction
+  // counter, which stops the hart a little past it.  Returns false, with
+  // the exit code, once the guest has shut down.
+  bool run(processor_t* proc, clint_t* clint, uint64_t insns, int* exit_code);
+
+ private:
+  void set_reg(uint64_t id, const void* value);
+  void get_reg(uint64_t id, void* value);
+  void put_state(processor_t* proc, clint_t* clint);
+  void take_state(processor_t* proc, clint_t* clint, uint64_t retired);
+  // Arms the instruction counter to signal this thread after insns.
+  void arm_counter(uint64_t insns);
+  uint64_t read_counter();
+  // Services an exit; returns false once the guest has shut down.
+  bool handle_exit(int* exit_code);
+
+  simif_t* sim;
+  int kvm_fd;
+  int vm_fd;
+  int vcpu_fd;
+  int counter_fd;  // -1 while not counting
+  kvm_run* vcpu_run;
+  size_t vcpu_run_size;
+};
+
+#endif
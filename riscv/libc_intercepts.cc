@@ -0,0 +1,107 @@
+// See LICENSE for license details.
+
+#include "mmu.h"
+#include "processor.h"
+
+// Tracing, logging and debugging all need to see the routine's own
+// instructions.
+bool mmu_t::libc_intercept_bypassed(processor_t* p)
+{
+#ifdef RISCV_ENABLE_COMMITLOG
+  if (p->get_log_commits_enabled())
+    return true;
+#endif
+#ifdef RISCV_ENABLE_SIFT
+  if (p->get_state()->log_sift_capturing())
+    return true;
+#endif
+  return p->get_counting_executions() || p->get_insn_log_batch() != nullptr ||
+         p->get_observing_retires() || p->slow_path();
+}
+
+// Return value to ra, having retired insns instructions.  The hart's step
+// loop already counts this one.
+reg_t mmu_t::libc_return(processor_t* p, reg_t value, reg_t insns)
+{
+  state_t* state = p->get_state();
+  state->minstret->bump(insns - 1);
+  state->mcycle->bump(insns - 1);
+  state->XPR.write(10, value);
+  return state->XPR[1];
+}
+
+// The estimates are those of a word-at-a-time loop for the routines that
+// know their length, and of a byte-at-a-time loop for those that don't,
+// plus a few instructions of setup and the return.
+
+reg_t mmu_t::native_memcpy(processor_t* p, insn_t insn, reg_t pc)
+{
+  if (libc_intercept_bypassed(p))
+    return p->decode_insn(insn)(p, insn, pc);
+
+  mmu_t* mmu = p->get_mmu();
+  reg_t dst = p->get_state()->XPR[10], src = p->get_state()->XPR[11];
+  reg_t len = p->get_state()->XPR[12];
+  for (reg_t i = 0; i < len; i++)
+    mmu->store_uint8(dst + i, mmu->load_uint8(src + i));
+  return libc_return(p, dst, 4 + len / 8 * 3);
+}
+
+reg_t mmu_t::native_memset(processor_t* p, insn_t insn, reg_t pc)
+{
+  if (libc_intercept_bypassed(p))
+    return p->decode_insn(insn)(p, insn, pc);
+
+  mmu_t* mmu = p->get_mmu();
+  reg_t dst = p->get_state()->XPR[10], len = p->get_state()->XPR[12];
+  uint8_t c = p->get_state()->XPR[11];
+  for (reg_t i = 0; i < len; i++)
+    mmu->store_uint8(dst + i, c);
+  return libc_return(p, dst, 4 + len / 8 * 2);
+}
+
+reg_t mmu_t::native_strlen(processor_t* p, insn_t insn, reg_t pc)
+{
+  if (libc_intercept_bypassed(p))
+    return p->decode_insn(insn)(p, insn, pc);
+
+  mmu_t* mmu = p->get_mmu();
+  reg_t s = p->get_state()->XPR[10], len = 0;
+  while (mmu->load_uint8(s + len) != 0)
+    len++;
+  return libc_return(p, len, 4 + len * 3);
+}
+
+reg_t mmu_t::native_memcmp(processor_t* p, insn_t insn, reg_t pc)
+{
+  if (libc_intercept_bypassed(p))
+    return p->decode_insn(insn)(p, insn, pc);
+
+  mmu_t* mmu = p->get_mmu();
+  reg_t a = p->get_state()->XPR[10], b = p->get_state()->XPR[11];
+  reg_t len = p->get_state()->XPR[12], i = 0;
+  sreg_t diff = 0;
+  for (; i < len && diff == 0; i++)
+    diff = sreg_t(mmu->load_uint8(a + i)) - sreg_t(mmu->load_uint8(b + i));
+  return libc_return(p, diff, 4 + i / 8 * 4);
+}
+
+bool mmu_t::set_libc_intercept(reg_t pc, const std::string& name)
+{
+  static const std::unordered_map<std::string, insn_func_t> routines = {
+    {"memcpy", &native_memcpy}, {"memset", &native_memset},
+    {"strlen", &native_strlen}, {"memcmp", &native_memcmp},
+  };
+  auto it = routines.find(name);
+  if (it == routines.end())
+    return false;
+  libc_intercepts[pc] = it->second;
+  flush_icache();
+  return true;
+}
+
+void mmu_t::clear_libc_intercepts()
+{
+  libc_intercepts.clear();
+  flush_icache();
+}
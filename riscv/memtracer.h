@@ -13,6 +13,19 @@ enum access_type {
   FETCH,
 };
 
+struct access_record_t {
+  uint64_t addr;
+  uint32_t bytes;
+  access_type type;
+  uint64_t pc;  // of the instruction making the access
+  uint64_t vaddr;
+  // log2 of the size of the page vaddr was translated through, or 0 if it
+  // was not translated, and how many page-table entries a walker with no
+  // caches reads to translate it, G-stage walks included.
+  uint8_t page_shift;
+  uint8_t walk_refs;
+};
+
 class memtracer_t
 {
  public:
@@ -22,6 +35,20 @@ class memtracer_t
   virtual bool interested_in_range(uint64_t begin, uint64_t end, access_type type) = 0;
   virtual void trace(uint64_t addr, size_t bytes, access_type type) = 0;
   virtual void clean_invalidate(uint64_t addr, size_t bytes, bool clean, bool inval) = 0;
+
+  // The MMU buffers the accesses it traces and hands them over in order,
+  // a batch at a time, at the end of each hart's quantum or when its buffer
+  // fills; clean_invalidate() and the end of the run flush the buffer
+  // first.  Tracers that can do better than a trace() per access override
+  // this.
+  virtual void trace_batch(const access_record_t* recs, size_t n)
+  {
+    for (size_t i = 0; i < n; i++)
+      trace(recs[i].addr, recs[i].bytes, recs[i].type);
+  }
+  // Called before each batch with the hart that made the accesses and the
+  // number of instructions it had retired when it handed them over.
+  virtual void set_batch_context(uint32_t hart, uint64_t instret) {}
 };
 
 class memtracer_list_t : public memtracer_t
@@ -45,6 +72,23 @@ class memtracer_list_t : public memtracer_t
     for (auto it: list)
       it->clean_invalidate(addr, bytes, clean, inval);
   }
+  void trace_batch(const access_record_t* recs, size_t n)
+  {
+    // Tracers may share state, such as the L2 behind separate I$ and D$
+    // models, so several of them see the accesses interleaved as before.
+    if (list.size() == 1) {
+      list[0]->trace_batch(recs, n);
+      return;
+    }
+    for (size_t i = 0; i < n; i++)
+      for (auto it: list)
+        it->trace_batch(&recs[i], 1);
+  }
+  void set_batch_context(uint32_t hart, uint64_t instret)
+  {
+    for (auto it: list)
+      it->set_batch_context(hart, instret);
+  }
   void hook(memtracer_t* h)
   {
     list.push_back(h);
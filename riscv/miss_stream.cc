@@ -0,0 +1,89 @@
+// See LICENSE for license details.
+
+#include "miss_stream.h"
+#include <stdexcept>
+
+static void put_varint(std::string& out, uint64_t value)
+{
+  while (value >= 0x80) {
+    out += char(value | 0x80);
+    value >>= 7;
+  }
+  out += char(value);
+}
+
+miss_stream_t::miss_stream_t(const char* filename, size_t linesz)
+{
+  file = fopen(filename, "wb");
+  if (!file)
+    throw std::runtime_error(std::string("could not open miss stream file ") + filename);
+  fwrite(MISS_STREAM_MAGIC, 1, MISS_STREAM_MAGIC_LEN, file);
+  line_shift = 0;
+  while ((size_t(1) << line_shift) < linesz)
+    line_shift++;
+  chunk.reserve(CHUNK_SIZE + 32);
+  writer = std::thread(&miss_stream_t::writer_main, this);
+}
+
+miss_stream_t::~miss_stream_t()
+{
+  hand_over();
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    stop = true;
+  }
+  ready.notify_one();
+  writer.join();
+  fclose(file);
+}
+
+void miss_stream_t::record(uint64_t addr, miss_stream_type_t type)
+{
+  bool same_hart = hart == last_hart;
+  chunk += char(type | (same_hart << 2));
+  if (!same_hart)
+    put_varint(chunk, hart);
+  last_hart = hart;
+
+  uint64_t line = addr >> line_shift;
+  int64_t delta = line - last_line;
+  last_line = line;
+  put_varint(chunk, (uint64_t(delta) << 1) ^ uint64_t(delta >> 63));
+
+  if (hart >= last_instret.size())
+    last_instret.resize(hart + 1, 0);
+  put_varint(chunk, instret - last_instret[hart]);
+  last_instret[hart] = instret;
+
+  if (chunk.size() >= CHUNK_SIZE)
+    hand_over();
+}
+
+void miss_stream_t::hand_over()
+{
+  if (chunk.empty())
+    return;
+  std::string full;
+  full.reserve(CHUNK_SIZE + 32);
+  full.swap(chunk);
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    queue.push_back(std::move(full));
+  }
+  ready.notify_one();
+}
+
+void miss_stream_t::writer_main()
+{
+  std::unique_lock<std::mutex> guard(lock);
+  while (true) {
+    ready.wait(guard, [this] { return stop || !queue.empty(); });
+    if (queue.empty())
+      return;
+    std::string next = std::move(queue.front());
+    queue.pop_front();
+    guard.unlock();
+    fwrite(next.data(), 1, next.size(), file);
+    guard.lock();
+  }
+}
@@ -0,0 +1,78 @@
+// See LICENSE for license details.
+#ifndef _RISCV_MISS_STREAM_H
+#define _RISCV_MISS_STREAM_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// The traffic between the last level of the modeled caches and memory, as
+// input for DRAM models.  A miss stream starts with MISS_STREAM_MAGIC and
+// then holds records of
+//
+//   uint8_t tag:  bits 1:0  miss_stream_type_t
+//                 bit 2     the hart is that of the last record, or 0 for
+//                           the first, and is left out
+//   varint hart, unless left out
+//   zigzag varint line address, in lines, less that of the last record
+//   varint instret, less that of the hart's last record
+//
+// Varints are little-endian base 128, and the differences start from 0.
+// The instret is the number of instructions the hart had retired when its
+// MMU handed the access over to the caches, at the end of its quantum or
+// when its trace buffer filled, so records are in order of it per hart.
+#define MISS_STREAM_MAGIC "SPIKEMS1"
+#define MISS_STREAM_MAGIC_LEN 8
+
+enum miss_stream_type_t {
+  MISS_STREAM_READ = 0,       // a line filled for a load or fetch miss
+  MISS_STREAM_WRITE = 1,      // a line filled for a store miss
+  MISS_STREAM_PREFETCH = 2,   // a line filled by the prefetcher
+  MISS_STREAM_WRITEBACK = 3,  // a dirty line written back
+};
+
+// Encodes records on the simulation thread and writes them, a megabyte at
+// a time, from a thread of its own.  The caches that feed it must all run
+// on one host thread.
+class miss_stream_t
+{
+ public:
+  miss_stream_t(const char* filename, size_t linesz);
+  ~miss_stream_t();
+
+  // Who makes the accesses the caches see next
+  void set_context(uint32_t hart, uint64_t instret)
+  {
+    this->hart = hart;
+    this->instret = instret;
+  }
+  void record(uint64_t addr, miss_stream_type_t type);
+
+ private:
+  static const size_t CHUNK_SIZE = 1 << 20;
+
+  void hand_over();
+  void writer_main();
+
+  FILE* file;
+  unsigned line_shift;
+  uint32_t hart = 0;
+  uint64_t instret = 0;
+  uint32_t last_hart = 0;
+  uint64_t last_line = 0;
+  std::vector<uint64_t> last_instret;  // per hart
+  std::string chunk;
+
+  std::mutex lock;
+  std::condition_variable ready;
+  std::deque<std::string> queue;
+  bool stop = false;
+  std::thread writer;
+};
+
+#endif
@@ -0,0 +1,188 @@
+// See LICENSE for license details.
+
+#include "misscurve.h"
+#include <algorithm>
+#include <cinttypes>
+#include <cstdlib>
+#include <iostream>
+
+static bool is_pow2(uint64_t n)
+{
+  return n != 0 && (n & (n - 1)) == 0;
+}
+
+static size_t bucket_of(uint64_t distance)
+{
+  if (distance < 16)
+    return distance;
+  unsigned msb = 63 - __builtin_clzll(distance);
+  return 16 + (msb - 4) * 8 + ((distance >> (msb - 3)) & 7);
+}
+
+// The least distance counted in a bucket: the smallest cache, in lines,
+// that hits it.
+static uint64_t bucket_min(size_t bucket)
+{
+  if (bucket < 16)
+    return bucket;
+  size_t octave = (bucket - 16) / 8;
+  return uint64_t(8 + (bucket - 16) % 8) << (octave + 1);
+}
+
+static void bad_config()
+{
+  std::cerr << "Miss curve configurations must be of the form B[:S[,S...][:W]], for" << std::endl;
+  std::cerr << "B-byte lines and S sets of up to W ways, all powers of two." << std::endl;
+  exit(1);
+}
+
+miss_curve_t::miss_curve_t(const char* config, size_t sample_ratio)
+  : ways(16), sample_ratio(sample_ratio), accesses(0), cold(0)
+{
+  char* end;
+  uint64_t linesz = strtoul(config, &end, 10);
+  if (!is_pow2(linesz))
+    bad_config();
+  line_shift = __builtin_ctzll(linesz);
+
+  std::vector<size_t> set_counts;
+  if (*end == ':') {
+    do {
+      set_counts.push_back(strtoul(end + 1, &end, 10));
+      if (!is_pow2(set_counts.back()))
+        bad_config();
+    } while (*end == ',');
+    if (*end == ':') {
+      ways = strtoul(end + 1, &end, 10);
+      if (!is_pow2(ways))
+        bad_config();
+    }
+  }
+  if (*end)
+    bad_config();
+
+  if (!is_pow2(sample_ratio)) {
+    std::cerr << "miss curve: the sampling ratio must be a power of two" << std::endl;
+    exit(1);
+  }
+  sample_shift = __builtin_ctzll(sample_ratio);
+
+  for (size_t sets : set_counts) {
+    // One set is the fully-associative curve, which needs no stacks.
+    if (sets == 1)
+      continue;
+    if (sets < sample_ratio) {
+      std::cerr << "miss curve: the sampling ratio must be no larger than the "
+                << "number of sets" << std::endl;
+      exit(1);
+    }
+    curves.emplace_back();
+    curve_t& c = curves.back();
+    c.sets = sets;
+    c.sampled.resize(sets);
+    // The sets cache_sim_t::set_sampling keeps
+    for (size_t idx = 0; idx < sets; idx++)
+      c.sampled[idx] = ((idx * 0x9e3779b97f4a7c15ULL) & (sets-1)) < sets / sample_ratio;
+    c.stacks.assign(sets * ways, 0);
+    c.hits.assign(ways, 0);
+    c.accesses = 0;
+  }
+}
+
+void miss_curve_t::access(uint64_t line)
+{
+  if (line_sampled(line)) {
+    accesses++;
+    uint64_t distance = distances.access(line);
+    if (distance == stack_distance_t::COLD) {
+      cold++;
+    } else {
+      size_t bucket = bucket_of(distance << sample_shift);
+      if (bucket >= buckets.size())
+        buckets.resize(bucket + 1);
+      buckets[bucket]++;
+    }
+  }
+
+  for (curve_t& c : curves) {
+    size_t idx = line & (c.sets - 1);
+    if (!c.sampled[idx])
+      continue;
+    c.accesses++;
+    // Move the line to the top of its set's stack, pushing the lines above
+    // its old position down one; a line not found falls off the bottom
+    // of a full stack.
+    uint64_t* stack = &c.stacks[idx * ways];
+    uint64_t carried = line + 1;
+    for (size_t pos = 0; pos < ways; pos++) {
+      std::swap(carried, stack[pos]);
+      if (carried == line + 1) {
+        c.hits[pos]++;
+        break;
+      }
+      if (carried == 0)
+        break;
+    }
+  }
+}
+
+void miss_curve_t::clean_invalidate(uint64_t addr, size_t bytes, bool clean, bool inval)
+{
+  if (!inval)
+    return;
+
+  uint64_t first = addr >> line_shift;
+  uint64_t last = (addr + bytes - 1) >> line_shift;
+  for (uint64_t line = first; line <= last; line++) {
+    distances.forget(line);
+    for (curve_t& c : curves) {
+      uint64_t* stack = &c.stacks[(line & (c.sets - 1)) * ways];
+      for (size_t pos = 0; pos < ways; pos++) {
+        if (stack[pos] == line + 1) {
+          std::copy(stack + pos + 1, stack + ways, stack + pos);
+          stack[ways - 1] = 0;
+          break;
+        }
+      }
+    }
+  }
+}
+
+void miss_curve_t::write_report(FILE* out)
+{
+  uint64_t linesz = uint64_t(1) << line_shift;
+  auto row = [&](size_t sets, uint64_t ways, uint64_t accesses, uint64_t misses) {
+    fprintf(out, "%zu,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%.6f\n",
+            sets, ways, sets * ways * linesz, accesses * sample_ratio,
+            misses * sample_ratio, accesses ? double(misses) / accesses : 0.0);
+  };
+
+  fprintf(out, "sets,ways,bytes,accesses,misses,miss_ratio\n");
+  // Going down the buckets, the misses of a cache of bucket_min(b) lines
+  // are the cold accesses and those of bucket b and up.
+  std::vector<uint64_t> misses(buckets.size() + 1, cold);
+  for (size_t b = buckets.size(); b-- > 0; )
+    misses[b] = misses[b + 1] + buckets[b];
+  for (size_t b = 1; b < misses.size(); b++)
+    row(1, bucket_min(b), accesses, misses[b]);
+  if (misses.size() == 1)
+    row(1, 1, accesses, cold);
+
+  for (curve_t& c : curves) {
+    uint64_t hits = 0;
+    for (size_t w = 1; w <= ways; w++) {
+      hits += c.hits[w - 1];
+      row(c.sets, w, c.accesses, c.accesses - hits);
+    }
+  }
+}
+
+void miss_curve_t::reset_stats()
+{
+  accesses = cold = 0;
+  buckets.assign(buckets.size(), 0);
+  for (curve_t& c : curves) {
+    c.accesses = 0;
+    c.hits.assign(ways, 0);
+  }
+}
@@ -0,0 +1,83 @@
+// See LICENSE for license details.
+
+#ifndef _RISCV_MISS_CURVE_H
+#define _RISCV_MISS_CURVE_H
+
+#include "cachesim.h"
+#include "memtracer.h"
+#include <cstdio>
+#include <vector>
+
+// Miss counts of LRU caches of every size, from one pass over the data
+// accesses of every hart, as a shared D$ sees them.  A fully-associative
+// cache of n lines misses exactly the accesses at stack distance n or
+// more, so one distance histogram gives its whole curve, kept at eight
+// points per doubling of the capacity.  For each further number of sets S
+// the curve covers 1 to W ways, from a stack of the W most recent lines of
+// every set.
+//
+// Sampling at 1/n follows, for each number of sets, only the sets that
+// --cache-sample keeps, and for the fully-associative curve only the lines
+// whose hash falls in 1/n of its range, with their distances scaled by n as
+// in SHARDS.  Counts are scaled by n.
+class miss_curve_t : public memtracer_t
+{
+ public:
+  // config is <B>[:<S>[,<S>...][:<W>]], for B-byte lines and the curves of
+  // S sets by up to W ways (default 16), all powers of two.
+  miss_curve_t(const char* config, size_t sample_ratio);
+
+  bool interested_in_range(uint64_t begin, uint64_t end, access_type type)
+  {
+    return type == LOAD || type == STORE;
+  }
+  void trace(uint64_t addr, size_t bytes, access_type type)
+  {
+    if (type == LOAD || type == STORE)
+      access(addr >> line_shift);
+  }
+  void trace_batch(const access_record_t* recs, size_t n)
+  {
+    for (size_t i = 0; i < n; i++)
+      if (recs[i].type == LOAD || recs[i].type == STORE)
+        access(recs[i].addr >> line_shift);
+  }
+  // Invalidated lines are dropped, so that their next access misses.
+  void clean_invalidate(uint64_t addr, size_t bytes, bool clean, bool inval);
+
+  // Writes sets,ways,bytes,accesses,misses,miss_ratio per cache size as CSV.
+  void write_report(FILE* out);
+  // Forgets the counts so far, but not the lines seen.
+  void reset_stats();
+
+ private:
+  struct curve_t {
+    size_t sets;
+    std::vector<bool> sampled;
+    std::vector<uint64_t> stacks;  // per set, the W most recent lines + 1
+    std::vector<uint64_t> hits;    // per stack position
+    uint64_t accesses;
+  };
+
+  void access(uint64_t line);
+  bool line_sampled(uint64_t line)
+  {
+    return sample_shift == 0 || (line * 0x9e3779b97f4a7c15ULL) >> (64 - sample_shift) == 0;
+  }
+
+  unsigned line_shift;
+  size_t ways;
+  size_t sample_ratio;
+  unsigned sample_shift;
+
+  stack_distance_t distances;
+  uint64_t accesses;
+  uint64_t cold;
+  // Bucket d counts distance d below 16, and then each doubling of the
+  // distance is split into eight buckets; see bucket_of.
+  std::vector<uint64_t> buckets;
+
+  std::vector<curve_t> curves;
+};
+
+#endif
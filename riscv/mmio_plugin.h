@@ -35,11 +35,61 @@ typedef struct {
   void (*dealloc)(void*);
 } mmio_plugin_t;
 
+// One access in a vectored call: the memory offset, the number of bytes,
+// and the data.
+typedef struct {
+  reg_t offset;
+  size_t len;
+  const uint8_t* bytes;
+} mmio_access_t;
+
+// Services the simulator offers a version 2 plugin through attach.
+typedef struct {
+  // Opaque simulator state, to be passed back to the functions below.
+  void* sim;
+
+  // Return a host pointer to guest physical memory at paddr, for the device
+  // to read or write directly, and set *run to how many of the len bytes
+  // from there are contiguous on the host. Return NULL if paddr is not
+  // plain memory. As with a real DMA engine, the harts see code written
+  // this way only after a fence.i.
+  uint8_t* (*dma_ptr)(void* sim, reg_t paddr, size_t len, size_t* run);
+} mmio_host_t;
+
+// Version 2 of the plugin interface. Every callback past v1 is optional
+// and may be NULL.
+typedef struct {
+  // The per-access callbacks of version 1, all required. load is still
+  // called for every load.
+  mmio_plugin_t v1;
+
+  // Store a run of accesses in program order. The parameters are the
+  // user_data (void*), the accesses (const mmio_access_t*) and their number
+  // (size_t). A plugin that provides this has its stores posted: the
+  // simulator buffers them, completes them without a bus error, and hands
+  // them over in bulk before the device's next load, at the next tick, or
+  // when the buffer fills. v1.store is then never called.
+  void (*store_vec)(void*, const mmio_access_t*, size_t);
+
+  // Called at the end of every simulation quantum with the number of cycles
+  // each hart has run in it, while no hart is running. Posted stores have
+  // been delivered by then.
+  void (*tick)(void*, uint64_t);
+
+  // Called once, after alloc, when the device is added to a simulator.
+  // The mmio_host_t stays valid until dealloc.
+  void (*attach)(void*, const mmio_host_t*);
+} mmio_plugin_v2_t;
+
 // Register an mmio plugin with the application. This should be called by
 // plugins as part of their loading process.
 extern void register_mmio_plugin(const char* name_cstr,
                                  const mmio_plugin_t* mmio_plugin);
 
+// As register_mmio_plugin, for a plugin written to version 2.
+extern void register_mmio_plugin_v2(const char* name_cstr,
+                                    const mmio_plugin_v2_t* mmio_plugin);
+
 #ifdef __cplusplus
 }
 
@@ -86,6 +136,41 @@ struct mmio_plugin_registration_t
     register_mmio_plugin(name.c_str(), &plugin);
   }
 };
+
+// The same for version 2, where T also implements store_vec, tick and
+// attach with the signatures of the C callbacks less the user data.
+template <typename T>
+struct mmio_plugin_v2_registration_t
+{
+  typedef mmio_plugin_registration_t<T> base;
+
+  static void store_vec(void* self, const mmio_access_t* accesses, size_t n)
+  {
+    reinterpret_cast<T*>(self)->store_vec(accesses, n);
+  }
+
+  static void tick(void* self, uint64_t cycles)
+  {
+    reinterpret_cast<T*>(self)->tick(cycles);
+  }
+
+  static void attach(void* self, const mmio_host_t* host)
+  {
+    reinterpret_cast<T*>(self)->attach(host);
+  }
+
+  mmio_plugin_v2_registration_t(const std::string& name)
+  {
+    mmio_plugin_v2_t plugin = {
+      { base::alloc, base::load, base::store, base::dealloc },
+      mmio_plugin_v2_registration_t<T>::store_vec,
+      mmio_plugin_v2_registration_t<T>::tick,
+      mmio_plugin_v2_registration_t<T>::attach,
+    };
+
+    register_mmio_plugin_v2(name.c_str(), &plugin);
+  }
+};
 #endif // __cplusplus
 
 #endif
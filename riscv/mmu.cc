@@ -4,6 +4,9 @@
 #include "arith.h"
 #include "simif.h"
 #include "processor.h"
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
 
 mmu_t::mmu_t(simif_t* sim, processor_t* proc)
  : sim(sim), proc(proc),
@@ -15,29 +18,718 @@ mmu_t::mmu_t(simif_t* sim, processor_t* proc)
   check_triggers_store(false),
   matched_trigger(NULL)
 {
-  flush_tlb();
+  configure_icache(ICACHE_SETS, ICACHE_WAYS);
+  configure_tlb(TLB_ENTRIES, 1, 0);
   yield_load_reservation();
 }
 
 mmu_t::~mmu_t()
 {
+  flush_trace();
+  // Instructions a block or a chained entry leads to are not looked up,
+  // so these are lookups rather than fetches.
+  if (icache_stats && icache_lookups != 0) {
+    std::cout << std::setprecision(3) << std::fixed;
+    std::cout << "Hart " << (proc ? proc->get_id() : 0) << " icache ";
+    std::cout << "Lookups:          " << icache_lookups << std::endl;
+    std::cout << "Hart " << (proc ? proc->get_id() : 0) << " icache ";
+    std::cout << "Lookup Misses:    " << icache_misses << std::endl;
+    std::cout << "Hart " << (proc ? proc->get_id() : 0) << " icache ";
+    std::cout << "Lookup Miss Rate: " << 100.0 * icache_misses / icache_lookups << '%' << std::endl;
+  }
+
+  static const char* type_names[] = {"load", "store", "fetch"};
+  for (int type = LOAD; tlb_stats && type <= FETCH; type++) {
+    auto& stats = tlb_type_stats[type];
+    if (stats.misses == 0)
+      continue;
+    std::cout << "Hart " << (proc ? proc->get_id() : 0) << " TLB " << type_names[type] << " ";
+    std::cout << "Misses:     " << stats.misses << std::endl;
+    std::cout << "Hart " << (proc ? proc->get_id() : 0) << " TLB " << type_names[type] << " ";
+    std::cout << "STLB Hits:  " << stats.stlb_hits << std::endl;
+    std::cout << "Hart " << (proc ? proc->get_id() : 0) << " TLB " << type_names[type] << " ";
+    std::cout << "Walks:      " << stats.misses - stats.stlb_hits << std::endl;
+  }
+  if (tlb_stats && !walk_cache.empty()) {
+    std::cout << "Hart " << (proc ? proc->get_id() : 0) << " TLB ";
+    std::cout << "Walk Cache Hits: " << walk_cache_hits << std::endl;
+    std::cout << "Hart " << (proc ? proc->get_id() : 0) << " TLB ";
+    std::cout << "G-stage Cache Hits: " << g_stage_cache_hits << std::endl;
+  }
+}
+
+void mmu_t::configure_walk_cache(size_t entries)
+{
+  if (entries & (entries - 1))
+    throw std::invalid_argument("walk cache entries must be a power of two");
+  walk_cache.resize(entries);
+  g_stage_cache.resize(entries);
+  flush_tlb();
+  flush_g_stage();
+}
+
+void mmu_t::configure_tlb(size_t entries, size_t stlb_sets, size_t stlb_ways)
+{
+  if (entries == 0 || (entries & (entries - 1)) ||
+      stlb_sets == 0 || (stlb_sets & (stlb_sets - 1)))
+    throw std::invalid_argument("TLB entries and STLB sets must be powers of two");
+  tlb_entries = entries;
+  tlb_data.resize(entries);
+  tlb_xlate.resize(entries);
+  tlb_insn_tag.resize(entries);
+  tlb_load_tag.resize(entries);
+  tlb_store_tag.resize(entries);
+  for (auto& tags : tlb_traced_tag)
+    tags.resize(entries);
+  this->stlb_sets = stlb_sets;
+  this->stlb_ways = stlb_ways;
+  stlb.resize(stlb_sets * stlb_ways);
+  flush_tlb();
+}
+
+mmu_t::tlb_context_t mmu_t::tlb_context()
+{
+  state_t* state = proc->get_state();
+  bool virt = state->v;
+  reg_t sstatus = state->sstatus->readvirt(virt);
+  tlb_context_t context;
+  context.atp = state->prv == PRV_M ? 0 : state->satp->readvirt(virt);
+  context.hgatp = virt ? state->hgatp->read() : 0;
+  context.flags = state->prv | (virt ? TLB_CONTEXT_V : 0) |
+                  ((sstatus & MSTATUS_SUM) ? TLB_CONTEXT_SUM : 0) |
+                  (((sstatus | state->sstatus->readvirt(false)) & MSTATUS_MXR) ? TLB_CONTEXT_MXR : 0);
+  return context;
+}
+
+bool mmu_t::stlb_lookup(reg_t vpn, const tlb_context_t& context, access_type type, reg_t* ppn)
+{
+  stlb_entry_t* set = &stlb[(vpn & (stlb_sets - 1)) * stlb_ways];
+  for (size_t way = 0; way < stlb_ways; way++) {
+    if (set[way].vpn == vpn && (set[way].types & (1 << type)) &&
+        set[way].context == context) {
+      stlb_entry_t entry = set[way];
+      std::copy_backward(set, set + way, set + way + 1);
+      set[0] = entry;
+      *ppn = entry.ppn;
+      translated_leaf_bits = entry.leaf_bits;
+      translated_xlate = entry.xlate;
+      return true;
+    }
+  }
+  return false;
+}
+
+void mmu_t::stlb_insert(reg_t vpn, reg_t ppn, access_type type)
+{
+  tlb_context_t context = tlb_context();
+  stlb_entry_t* set = &stlb[(vpn & (stlb_sets - 1)) * stlb_ways];
+  size_t way = 0;
+  while (way < stlb_ways - 1 && !(set[way].vpn == vpn && set[way].context == context))
+    way++;
+
+  stlb_entry_t entry = set[way];
+  if (entry.vpn != vpn || !(entry.context == context) || entry.ppn != ppn)
+    entry = {vpn, ppn, context, uint8_t(translated_leaf_bits), 0, translated_xlate};
+  entry.types |= 1 << type;
+  std::copy_backward(set, set + way, set + way + 1);
+  set[0] = entry;
+}
+
+void mmu_t::configure_icache(size_t sets, size_t ways)
+{
+  if (sets == 0 || (sets & (sets - 1)) || ways == 0)
+    throw std::invalid_argument("icache sets must be a power of two and ways nonzero");
+  icache_sets = sets;
+  icache_ways = ways;
+  icache.resize(sets * ways);
+  flush_icache();
+}
+
+void mmu_t::fold_executions(icache_entry_t* entry)
+{
+  if (entry->tag != reg_t(-1))
+    proc->count_executions(entry->tag, entry->data.insn.bits(), entry->executions);
+  entry->executions = 0;
+}
+
+void mmu_t::fold_icache_executions()
+{
+  for (auto& entry : icache)
+    if (unlikely(entry.executions))
+      fold_executions(&entry);
 }
 
 void mmu_t::flush_icache()
 {
-  for (size_t i = 0; i < ICACHE_ENTRIES; i++)
-    icache[i].tag = -1;
+  fold_icache_executions();
+  for (auto& entry : icache)
+    entry.tag = -1;
+  for (auto& block : blocks)
+    block.tag = -1;
+}
+
+// Whether the instruction decoded from host still has the bits insn.
+static bool insn_unchanged(const char* host, insn_t insn)
+{
+  if (!host)
+    return false;
+  insn_bits_t bits = 0;
+  memcpy(&bits, host, insn.length());
+  return from_le(bits) == insn.bits();
+}
+
+void mmu_t::flush_modified_icache()
+{
+  for (auto& entry : icache) {
+    if (entry.tag != reg_t(-1) && !insn_unchanged(entry.host, entry.data.insn)) {
+      if (unlikely(entry.executions))
+        fold_executions(&entry);
+      entry.tag = -1;
+    }
+  }
+
+  // A block's instructions follow each other on one page.
+  for (auto& block : blocks) {
+    if (block.tag == reg_t(-1))
+      continue;
+    const char* host = block.host;
+    for (size_t i = 0; i < block.ninsns; i++) {
+      auto& insn = block.insns[i].fetch.insn;
+      if (!insn_unchanged(host, insn)) {
+        block.tag = -1;
+        break;
+      }
+      host += insn.length();
+    }
+  }
+}
+
+void mmu_t::flush_icache_page(reg_t vaddr)
+{
+  // An instruction may start up to 6 bytes before the page.
+  reg_t vpn = vaddr >> PGSHIFT;
+  auto on_page = [vpn](reg_t tag) {
+    return (tag >> PGSHIFT) == vpn || ((tag + 6) >> PGSHIFT) == vpn;
+  };
+  for (auto& entry : icache) {
+    if (on_page(entry.tag)) {
+      if (unlikely(entry.executions))
+        fold_executions(&entry);
+      entry.tag = -1;
+    }
+  }
+  for (auto& block : blocks) {
+    if (on_page(block.tag))
+      block.tag = -1;
+  }
+}
+
+void mmu_t::enable_block_cache(bool inline_ops, bool fuse_ops)
+{
+  block_inline_ops = inline_ops;
+  block_fuse_ops = inline_ops && fuse_ops;
+  blocks.resize(BLOCK_CACHE_ENTRIES);
+  for (auto& block : blocks) {
+    block.tag = -1;
+    block.succ[0] = block.succ[1] = nullptr;
+  }
+}
+
+// Conservatively true for any instruction that may transfer control, trap
+// on purpose, fence instruction fetch, or write a CSR.
+static bool insn_ends_block(insn_bits_t bits, unsigned xlen)
+{
+  switch (insn_length(bits)) {
+    case 2:
+      switch (bits & 0xe003) {
+        case 0x2001: return xlen == 32;                   // c.jal
+        case 0xa001:                                      // c.j
+        case 0xc001:                                      // c.beqz
+        case 0xe001: return true;                         // c.bnez
+        case 0x8002: return ((bits >> 2) & 0x1f) == 0;    // c.jr, c.jalr, c.ebreak
+      }
+      return false;
+    case 4:
+      switch (bits & 0x7f) {
+        case 0x0f:  // MISC-MEM
+        case 0x63:  // BRANCH
+        case 0x67:  // JALR
+        case 0x6f:  // JAL
+        case 0x73:  // SYSTEM
+        case 0x0b: case 0x2b: case 0x5b: case 0x7b:  // custom
+          return true;
+      }
+      return false;
+    default:
+      return true;
+  }
+}
+
+static void predecode_inline(insn_t insn, unsigned xlen, insn_block_entry_t* entry)
+{
+  entry->op = INLINE_NONE;
+  entry->rvc = insn_length(insn.bits()) == 2;
+
+  if (entry->rvc) {
+    uint64_t bits = insn.bits();
+    entry->rs1 = insn.rvc_rs1s();
+    entry->rs2 = entry->rd = insn.rvc_rs2s();
+    switch (bits & 0xe003) {
+      case 0x4000: entry->op = INLINE_LW; entry->imm = insn.rvc_lw_imm(); return;
+      case 0xc000: entry->op = INLINE_SW; entry->imm = insn.rvc_lw_imm(); return;
+      case 0x6000:  // c.ld; c.flw on RV32
+        if (xlen == 64) {
+          entry->op = INLINE_LD;
+          entry->imm = insn.rvc_ld_imm();
+        }
+        return;
+      case 0xe000:  // c.sd; c.fsw on RV32
+        if (xlen == 64) {
+          entry->op = INLINE_SD;
+          entry->imm = insn.rvc_ld_imm();
+        }
+        return;
+      case 0xc001:  // c.beqz
+      case 0xe001:  // c.bnez
+        entry->op = (bits & 0x2000) ? INLINE_BNE : INLINE_BEQ;
+        entry->rs2 = 0;
+        entry->imm = insn.rvc_b_imm();
+        return;
+      case 0xa001:  // c.j
+      case 0x2001:  // c.jal on RV32; c.addiw, below, on RV64
+        if (xlen == 32 || (bits & 0x8000)) {
+          entry->op = INLINE_JAL;
+          entry->rd = (bits & 0x8000) ? 0 : 1;
+          entry->imm = insn.rvc_j_imm();
+          return;
+        }
+        break;
+      case 0xc002:  // c.swsp
+      case 0xe002:  // c.sdsp; c.fswsp on RV32
+        entry->rs1 = 2;
+        entry->rs2 = insn.rvc_rs2();
+        if (!(bits & 0x2000)) {
+          entry->op = INLINE_SW;
+          entry->imm = insn.rvc_swsp_imm();
+        } else if (xlen == 64) {
+          entry->op = INLINE_SD;
+          entry->imm = insn.rvc_sdsp_imm();
+        }
+        return;
+      case 0x8002:  // c.jr, c.jalr
+        if (insn.rvc_rs2() == 0 && insn.rvc_rs1() != 0) {
+          entry->op = INLINE_JALR;
+          entry->rd = (bits & 0x1000) ? 1 : 0;
+          entry->rs1 = insn.rvc_rs1();
+          entry->imm = 0;
+          return;
+        }
+        break;
+    }
+
+    if ((bits & 0xe003) == 0x8001) {  // c.srli, c.srai, c.andi, c.sub, ...
+      entry->rd = entry->rs1 = insn.rvc_rs1s();
+      entry->rs2 = insn.rvc_rs2s();
+      entry->imm = insn.rvc_imm();
+      switch ((bits >> 10) & 3) {
+        case 0:
+        case 1:
+          entry->imm = insn.rvc_zimm();
+          if ((reg_t)entry->imm < xlen)
+            entry->op = (bits & 0x400) ? INLINE_SRAI : INLINE_SRLI;
+          return;
+        case 2: entry->op = INLINE_ANDI; return;
+      }
+      switch (bits & 0x1060) {
+        case 0x0000: entry->op = INLINE_SUB; return;
+        case 0x0020: entry->op = INLINE_XOR; return;
+        case 0x0040: entry->op = INLINE_OR; return;
+        case 0x0060: entry->op = INLINE_AND; return;
+        case 0x1000: if (xlen == 64) entry->op = INLINE_SUBW; return;
+        case 0x1020: if (xlen == 64) entry->op = INLINE_ADDW; return;
+      }
+      return;
+    }
+
+    entry->rd = insn.rd();
+    if (entry->rd == 0)
+      return;
+    switch (bits & 0xe003) {
+      case 0x0001:  // c.addi
+        entry->op = INLINE_ADDI;
+        entry->rs1 = entry->rd;
+        entry->imm = insn.rvc_imm();
+        break;
+      case 0x2001:  // c.addiw; c.jal on RV32
+        if (xlen == 64) {
+          entry->op = INLINE_ADDIW;
+          entry->rs1 = entry->rd;
+          entry->imm = insn.rvc_imm();
+        }
+        break;
+      case 0x4001:  // c.li
+        entry->op = INLINE_ADDI;
+        entry->rs1 = 0;
+        entry->imm = insn.rvc_imm();
+        break;
+      case 0x6001:  // c.lui
+        if (entry->rd != 2 && insn.rvc_imm() != 0) {
+          entry->op = INLINE_LUI;
+          entry->imm = insn.rvc_imm() << 12;
+        }
+        break;
+      case 0x0002:  // c.slli
+        if ((reg_t)insn.rvc_zimm() < xlen) {
+          entry->op = INLINE_SLLI;
+          entry->rs1 = entry->rd;
+          entry->imm = insn.rvc_zimm();
+        }
+        break;
+      case 0x8002:  // c.mv, c.add
+        if (insn.rvc_rs2() != 0) {
+          entry->op = INLINE_ADD;
+          entry->rs1 = (bits & 0x1000) ? entry->rd : 0;
+          entry->rs2 = insn.rvc_rs2();
+        }
+        break;
+      case 0x4002:  // c.lwsp
+      case 0x6002:  // c.ldsp; c.flwsp on RV32
+        entry->rs1 = 2;
+        if (!(bits & 0x2000)) {
+          entry->op = INLINE_LW;
+          entry->imm = insn.rvc_lwsp_imm();
+        } else if (xlen == 64) {
+          entry->op = INLINE_LD;
+          entry->imm = insn.rvc_ldsp_imm();
+        }
+        break;
+    }
+    return;
+  }
+
+  entry->rd = insn.rd();
+  entry->rs1 = insn.rs1();
+  entry->rs2 = insn.rs2();
+  entry->imm = insn.i_imm();
+
+  // Control transfers and stores do not need a destination register.
+  switch (insn.bits() & 0x707f) {
+    case 0x0063: entry->op = INLINE_BEQ; break;
+    case 0x1063: entry->op = INLINE_BNE; break;
+    case 0x4063: entry->op = INLINE_BLT; break;
+    case 0x5063: entry->op = INLINE_BGE; break;
+    case 0x6063: entry->op = INLINE_BLTU; break;
+    case 0x7063: entry->op = INLINE_BGEU; break;
+    case 0x0067: entry->op = INLINE_JALR; return;
+    case 0x0023: entry->op = INLINE_SB; entry->imm = insn.s_imm(); return;
+    case 0x1023: entry->op = INLINE_SH; entry->imm = insn.s_imm(); return;
+    case 0x2023: entry->op = INLINE_SW; entry->imm = insn.s_imm(); return;
+    case 0x3023: if (xlen == 64) entry->op = INLINE_SD; entry->imm = insn.s_imm(); return;
+  }
+  if (entry->op != INLINE_NONE) {
+    entry->imm = insn.sb_imm();
+    return;
+  }
+  if ((insn.bits() & 0x7f) == 0x6f) {
+    entry->op = INLINE_JAL;
+    entry->imm = insn.uj_imm();
+    return;
+  }
+
+  if (entry->rd == 0)
+    return;
+  switch (insn.bits() & 0x707f) {
+    case 0x0013: entry->op = INLINE_ADDI; return;
+    case 0x2013: entry->op = INLINE_SLTI; return;
+    case 0x3013: entry->op = INLINE_SLTIU; return;
+    case 0x4013: entry->op = INLINE_XORI; return;
+    case 0x6013: entry->op = INLINE_ORI; return;
+    case 0x7013: entry->op = INLINE_ANDI; return;
+    case 0x001b: if (xlen == 64) entry->op = INLINE_ADDIW; return;
+    case 0x0003: entry->op = INLINE_LB; return;
+    case 0x1003: entry->op = INLINE_LH; return;
+    case 0x2003: entry->op = INLINE_LW; return;
+    case 0x3003: if (xlen == 64) entry->op = INLINE_LD; return;
+    case 0x4003: entry->op = INLINE_LBU; return;
+    case 0x5003: entry->op = INLINE_LHU; return;
+    case 0x6003: if (xlen == 64) entry->op = INLINE_LWU; return;
+  }
+  switch (insn.bits() & 0x7f) {
+    case 0x37:
+      entry->op = INLINE_LUI;
+      entry->imm = insn.u_imm();
+      return;
+    case 0x17:
+      entry->op = INLINE_AUIPC;
+      entry->imm = insn.u_imm();
+      return;
+  }
+
+  // On RV64 the shift amount of slli, srli and srai has six bits.
+  entry->imm = insn.shamt();
+  switch (insn.bits() & (xlen == 64 ? 0xfc00707f : 0xfe00707f)) {
+    case 0x00001013: entry->op = INLINE_SLLI; return;
+    case 0x00005013: entry->op = INLINE_SRLI; return;
+    case 0x40005013: entry->op = INLINE_SRAI; return;
+  }
+  switch (insn.bits() & 0xfe00707f) {
+    case 0x00000033: entry->op = INLINE_ADD; return;
+    case 0x40000033: entry->op = INLINE_SUB; return;
+    case 0x00001033: entry->op = INLINE_SLL; return;
+    case 0x00002033: entry->op = INLINE_SLT; return;
+    case 0x00003033: entry->op = INLINE_SLTU; return;
+    case 0x00004033: entry->op = INLINE_XOR; return;
+    case 0x00005033: entry->op = INLINE_SRL; return;
+    case 0x40005033: entry->op = INLINE_SRA; return;
+    case 0x00006033: entry->op = INLINE_OR; return;
+    case 0x00007033: entry->op = INLINE_AND; return;
+  }
+  if (xlen != 64)
+    return;
+  switch (insn.bits() & 0xfe00707f) {
+    case 0x0000101b: entry->op = INLINE_SLLIW; return;
+    case 0x0000501b: entry->op = INLINE_SRLIW; return;
+    case 0x4000501b: entry->op = INLINE_SRAIW; return;
+    case 0x0000003b: entry->op = INLINE_ADDW; return;
+    case 0x4000003b: entry->op = INLINE_SUBW; return;
+  }
+}
+
+// The fused op for a pair of pre-decoded entries, or INLINE_NONE if they are
+// not one of the idioms or the second does not read the first's result.
+static inline_op_t fuse_inline(const insn_block_entry_t& first, const insn_block_entry_t& second)
+{
+  bool reads_rs2 = second.op == INLINE_ADD || second.op == INLINE_BEQ || second.op == INLINE_BNE;
+  if (second.rs1 != first.rd && !(reads_rs2 && second.rs2 == first.rd))
+    return INLINE_NONE;
+
+#define FUSE_OP(a, b) \
+  if (first.op == INLINE_##a && second.op == INLINE_##b) \
+    return INLINE_##a##_##b;
+  INLINE_FUSED_OPS(FUSE_OP)
+#undef FUSE_OP
+  return INLINE_NONE;
+}
+
+void mmu_t::refill_block(reg_t addr, insn_block_t* block)
+{
+  block->tag = addr;
+  block->ninsns = 0;
+  block->succ[0] = block->succ[1] = nullptr;
+
+  // Custom extensions may replace standard instructions, and RV32E limits
+  // the usable registers, so leave those configurations to the handlers.
+  bool inline_ops = block_inline_ops && proc &&
+    !proc->any_custom_extensions() && !proc->extension_enabled('E');
+
+  block->hooks = nullptr;
+
+  for (reg_t pc = addr; ; ) {
+    icache_entry_t* entry;
+    if (block->ninsns == 0) {
+      entry = access_icache(pc);
+    } else {
+      // Stay clear of the next page, and leave any fetch fault to be taken
+      // if and when the instruction is actually reached.
+      if (block->ninsns == insn_block_t::MAX_INSNS || PGSIZE - pc % PGSIZE < 8)
+        break;
+      try {
+        entry = access_icache(pc);
+      } catch (trap_t&) {
+        break;
+      }
+    }
+
+    // An uncacheable fetch (one the tracer wants to see) ends the block, or
+    // makes it a single-use block if it is the first instruction.
+    if (entry->tag != pc) {
+      if (block->ninsns != 0)
+        break;
+      block->tag = -1;
+    }
+
+    if (block->ninsns == 0)
+      block->host = entry->host;
+    auto& slot = block->insns[block->ninsns++];
+    slot.fetch = entry->data;
+    slot.npc = pc + entry->data.insn.length();
+    slot.op = INLINE_NONE;
+    if (inline_ops && entry->data.func != &breakpoint_insn &&
+        entry->data.func != &marker_insn && entry->data.func != &watched_marker_insn &&
+        entry->data.func != &plugin_insn && !libc_intercepts.count(pc))
+      predecode_inline(entry->data.insn, proc->get_xlen(), &slot);
+    if (block_fuse_ops && inline_ops && block->ninsns > 1) {
+      auto& first = block->insns[block->ninsns - 2];
+      inline_op_t fused = fuse_inline(first, slot);
+      if (fused != INLINE_NONE) {
+        first.op = fused;
+        first.rvc = first.rvc || slot.rvc;
+      }
+    }
+    if (block->tag != addr || insn_ends_block(entry->data.insn.bits(), proc ? proc->get_xlen() : 64))
+      break;
+    pc = slot.npc;
+  }
+
+  if (unlikely(proc && proc->has_plugins()))
+    instrument_block(block);
+}
+
+void mmu_t::instrument_insn(reg_t pc, insn_fetch_t& fetch)
+{
+  plugin_insn_t& hooked = plugin_insns[pc];
+  hooked.hooks.clear();
+  plugin_translation_t translation(pc, &fetch.insn, 1, &hooked.hooks);
+  for (auto plugin : proc->get_plugins())
+    plugin->translate_insn(proc, translation);
+  if (hooked.hooks.empty()) {
+    plugin_insns.erase(pc);
+    return;
+  }
+  hooked.func = fetch.func;
+  fetch.func = &plugin_insn;
+}
+
+void mmu_t::expand_rvc(reg_t pc, insn_fetch_t& fetch)
+{
+  if (fetch.func != proc->decode_insn(fetch.insn))
+    return;
+  // The 32-bit handler's pc + 4, less 2, is pc + 2 unless pc + 4 crosses
+  // the sign bit of an xlen address.
+  if ((((pc + 2) ^ (pc + 4)) >> (proc->get_xlen() - 1)) & 1)
+    return;
+  insn_bits_t bits = proc->expand_rvc(fetch.insn);
+  if (bits == 0)
+    return;
+  fetch.func = proc->decode_insn(bits);
+  fetch.func_insn = bits;
+  fetch.npc_adjust = 2;
+}
+
+void mmu_t::instrument_block(insn_block_t* block)
+{
+  // The block's tag is -1 if it is used only once.
+  reg_t pc = block->insns[0].npc - block->insns[0].fetch.insn.length();
+  insn_t insns[insn_block_t::MAX_INSNS];
+  for (size_t i = 0; i < block->ninsns; i++)
+    insns[i] = block->insns[i].fetch.insn;
+
+  plugin_hooks_t& hooks = plugin_blocks[pc];
+  hooks.clear();
+  plugin_translation_t translation(pc, insns, block->ninsns, &hooks);
+  for (auto plugin : proc->get_plugins())
+    plugin->translate_block(proc, translation);
+  if (hooks.empty())
+    plugin_blocks.erase(pc);
+  else
+    block->hooks = &hooks;
+}
+
+reg_t mmu_t::plugin_insn(processor_t* p, insn_t insn, reg_t pc)
+{
+  auto& hooked = p->get_mmu()->plugin_insns;
+  auto it = hooked.find(pc);
+  // Another translation at the same PC may have replaced this one.
+  if (unlikely(it == hooked.end()))
+    return p->decode_insn(insn.bits())(p, insn, pc);
+  it->second.hooks.run(p, pc);
+  return it->second.func(p, insn, pc);
+}
+
+void mmu_t::flush_tlb_first_level()
+{
+  std::fill(tlb_insn_tag.begin(), tlb_insn_tag.end(), reg_t(-1));
+  std::fill(tlb_load_tag.begin(), tlb_load_tag.end(), reg_t(-1));
+  std::fill(tlb_store_tag.begin(), tlb_store_tag.end(), reg_t(-1));
+  for (auto& tags : tlb_traced_tag)
+    std::fill(tags.begin(), tags.end(), reg_t(-1));
+  tlb_superpages = false;
 }
 
 void mmu_t::flush_tlb()
 {
-  memset(tlb_insn_tag, -1, sizeof(tlb_insn_tag));
-  memset(tlb_load_tag, -1, sizeof(tlb_load_tag));
-  memset(tlb_store_tag, -1, sizeof(tlb_store_tag));
+  flush_tlb_first_level();
+  for (auto& entry : stlb)
+    entry = {reg_t(-1), 0, {}, 0, 0};
+  for (auto& entry : walk_cache)
+    entry.root = -1;
 
   flush_icache();
 }
 
+void mmu_t::fence_vma(bool virt, bool has_addr, reg_t vaddr, bool has_asid, reg_t asid)
+{
+  bool rv32 = proc->get_const_xlen() == 32;
+  reg_t asid_mask = rv32 ? SATP32_ASID : SATP64_ASID;
+  reg_t vmid_mask = rv32 ? HGATP32_VMID : HGATP64_VMID;
+  reg_t vmid = get_field(proc->get_state()->hgatp->read(), vmid_mask);
+  reg_t vpn = vaddr >> PGSHIFT;
+  asid &= get_field(asid_mask, asid_mask);
+
+  // Whether translations made in this context are ones the fence orders.
+  // M-mode does not translate, and bare S-mode entries need no fence, but
+  // dropping those is harmless.
+  auto fenced = [&](const tlb_context_t& context) {
+    if ((context.flags & 3) == PRV_M || bool(context.flags & TLB_CONTEXT_V) != virt)
+      return false;
+    if (virt && get_field(context.hgatp, vmid_mask) != vmid)
+      return false;
+    return !has_asid || get_field(context.atp, asid_mask) == asid;
+  };
+
+  for (auto& entry : stlb) {
+    if (entry.vpn != reg_t(-1) && fenced(entry.context) &&
+        (!has_addr || ((entry.vpn ^ vpn) >> entry.leaf_bits) == 0))
+      entry = {reg_t(-1), 0, {}, 0, 0};
+  }
+
+  // The walk cache is not tagged with ASIDs, so a fence of a whole address
+  // space empties it; a fence of one address drops the levels above it.
+  unsigned idxbits = rv32 ? 10 : 9;
+  for (auto& entry : walk_cache) {
+    if (entry.virt == virt &&
+        (!has_addr || entry.prefix == vaddr >> (PGSHIFT + (entry.level + 1) * idxbits)))
+      entry.root = -1;
+  }
+
+  // The first-level TLB and the icache only hold the current context.
+  if (!fenced(tlb_context()))
+    return;
+  if (has_addr && !tlb_superpages) {
+    size_t idx = tlb_index(vpn);
+    tlb_insn_tag[idx] = tlb_load_tag[idx] = tlb_store_tag[idx] = -1;
+    for (auto& tags : tlb_traced_tag)
+      tags[idx] = -1;
+    flush_icache_page(vaddr);
+  } else {
+    flush_tlb_context();
+  }
+}
+
+void mmu_t::fence_gvma(bool has_vmid, reg_t vmid)
+{
+  reg_t vmid_mask = proc->get_const_xlen() == 32 ? HGATP32_VMID : HGATP64_VMID;
+  vmid &= get_field(vmid_mask, vmid_mask);
+  for (auto& entry : stlb) {
+    if ((entry.context.flags & TLB_CONTEXT_V) &&
+        (!has_vmid || get_field(entry.context.hgatp, vmid_mask) == vmid))
+      entry = {reg_t(-1), 0, {}, 0, 0};
+  }
+  for (auto& entry : walk_cache) {
+    if (entry.virt)
+      entry.root = -1;
+  }
+  flush_g_stage();
+  // hfence.gvma runs with V=0, whose translations it does not affect, so
+  // the first-level TLB and the icache can stay.
+}
+
+void mmu_t::flush_g_stage()
+{
+  for (auto& entry : g_stage_cache)
+    entry.gpn = -1;
+}
+
 static void throw_access_exception(bool virt, reg_t addr, access_type type)
 {
   switch (type) {
@@ -50,9 +742,21 @@ static void throw_access_exception(bool virt, reg_t addr, access_type type)
 
 reg_t mmu_t::translate(reg_t addr, reg_t len, access_type type, uint32_t xlate_flags)
 {
+  translated_xlate = {};
   if (!proc)
     return addr;
 
+  // The second-level TLB only holds translations that the first level may
+  // hold, so it is bypassed whenever the first level is.
+  tlb_type_stats[type].misses++;
+  reg_t ppn;
+  if (stlb_ways != 0 && xlate_flags == 0 &&
+      !get_field(proc->state.mstatus->read(), MSTATUS_MPRV) &&
+      stlb_lookup(addr >> PGSHIFT, tlb_context(), type, &ppn)) {
+    tlb_type_stats[type].stlb_hits++;
+    return (ppn << PGSHIFT) | (addr & (PGSIZE-1));
+  }
+
   bool virt = proc->state.v;
   bool hlvx = xlate_flags & RISCV_XLATE_VIRT_HLVX;
   reg_t mode = proc->state.prv;
@@ -88,6 +792,19 @@ tlb_entry_t mmu_t::fetch_slow_path(reg_t vaddr)
   }
 }
 
+void mmu_t::copy_insn_page(reg_t addr, uint8_t* dst)
+{
+  reg_t paddr = translate(addr & PGMASK, 1, FETCH, 0);
+
+  if (auto host_addr = sim->addr_to_mem(paddr)) {
+    memcpy(dst, host_addr, PGSIZE);
+  } else {
+    memset(dst, 0, PGSIZE);
+    for (reg_t offset = 0; offset < PGSIZE; offset += sizeof(fetch_temp))
+      mmio_load(paddr + offset, sizeof(fetch_temp), dst + offset);
+  }
+}
+
 reg_t reg_from_bytes(size_t len, const uint8_t* bytes)
 {
   switch (len) {
@@ -141,19 +858,20 @@ bool mmu_t::mmio_store(reg_t addr, size_t len, const uint8_t* bytes)
 
 void mmu_t::load_slow_path(reg_t addr, reg_t len, uint8_t* bytes, uint32_t xlate_flags)
 {
+  host_prof_scope_t prof(HOST_PROF_LOAD_SLOW_PATH);
   reg_t paddr = translate(addr, len, LOAD, xlate_flags);
 
   if (auto host_addr = sim->addr_to_mem(paddr)) {
     memcpy(bytes, host_addr, len);
-    if (tracer.interested_in_range(paddr, paddr + PGSIZE, LOAD))
-      tracer.trace(paddr, len, LOAD);
+    if (traced(addr, paddr, LOAD, xlate_flags == 0))
+      trace_access(paddr, len, LOAD, proc ? proc->get_state()->pc : 0, addr, translated_xlate);
     else if (xlate_flags == 0)
       refill_tlb(addr, paddr, host_addr, LOAD);
   } else if (!mmio_load(paddr, len, bytes)) {
     throw trap_load_access_fault((proc) ? proc->state.v : false, addr, 0, 0);
   }
 
-  if (!matched_trigger) {
+  if (!matched_trigger && check_triggers_load) {
     reg_t data = reg_from_bytes(len, bytes);
     matched_trigger = trigger_exception(triggers::OPERATION_LOAD, addr, data);
     if (matched_trigger)
@@ -163,9 +881,13 @@ void mmu_t::load_slow_path(reg_t addr, reg_t len, uint8_t* bytes, uint32_t xlate
 
 void mmu_t::store_slow_path(reg_t addr, reg_t len, const uint8_t* bytes, uint32_t xlate_flags, bool actually_store)
 {
+  host_prof_scope_t prof(HOST_PROF_STORE_SLOW_PATH);
   reg_t paddr = translate(addr, len, STORE, xlate_flags);
 
-  if (!matched_trigger) {
+  if (actually_store && proc && unlikely(watched(paddr, len)))
+    throw interactive_stop_t();
+
+  if (!matched_trigger && check_triggers_store) {
     reg_t data = reg_from_bytes(len, bytes);
     matched_trigger = trigger_exception(triggers::OPERATION_STORE, addr, data);
     if (matched_trigger)
@@ -174,9 +896,12 @@ void mmu_t::store_slow_path(reg_t addr, reg_t len, const uint8_t* bytes, uint32_
 
   if (actually_store) {
     if (auto host_addr = sim->addr_to_mem(paddr)) {
+      if (unlikely(journal_stores))
+        sim->journal_store(paddr, len);
       memcpy(host_addr, bytes, len);
-      if (tracer.interested_in_range(paddr, paddr + PGSIZE, STORE))
-        tracer.trace(paddr, len, STORE);
+      htif_store_seen |= htif_watched(paddr);
+      if (traced(addr, paddr, STORE, xlate_flags == 0))
+        trace_access(paddr, len, STORE, proc ? proc->get_state()->pc : 0, addr, translated_xlate);
       else if (xlate_flags == 0)
         refill_tlb(addr, paddr, host_addr, STORE);
     } else if (!mmio_store(paddr, len, bytes)) {
@@ -187,11 +912,19 @@ void mmu_t::store_slow_path(reg_t addr, reg_t len, const uint8_t* bytes, uint32_
 
 tlb_entry_t mmu_t::refill_tlb(reg_t vaddr, reg_t paddr, char* host_addr, access_type type)
 {
-  reg_t idx = (vaddr >> PGSHIFT) % TLB_ENTRIES;
+  reg_t idx = tlb_index(vaddr >> PGSHIFT);
   reg_t expected_tag = vaddr >> PGSHIFT;
 
   tlb_entry_t entry = {host_addr - vaddr, paddr - vaddr};
 
+  if (unlikely(page_heat != nullptr))
+    page_heat->refill(paddr);
+
+#ifdef RISCV_ENABLE_SIFT
+  if (proc && proc->state.log_writer->sends_va2pa())
+    proc->state.log_writer->PageMapping(vaddr & ~reg_t(PGSIZE - 1), paddr & ~reg_t(PGSIZE - 1));
+#endif
+
   if (proc && get_field(proc->state.mstatus->read(), MSTATUS_MPRV))
     return entry;
 
@@ -202,26 +935,150 @@ tlb_entry_t mmu_t::refill_tlb(reg_t vaddr, reg_t paddr, char* host_addr, access_
   if ((tlb_insn_tag[idx] & ~TLB_CHECK_TRIGGERS) != expected_tag)
     tlb_insn_tag[idx] = -1;
 
-  if ((check_triggers_fetch && type == FETCH) ||
-      (check_triggers_load && type == LOAD) ||
-      (check_triggers_store && type == STORE))
+  // Only pages some armed trigger, or the interactive watchpoint, could
+  // match take the checking path.
+  reg_t page = vaddr & ~reg_t(PGSIZE - 1);
+  if ((type == STORE && watched(paddr & ~reg_t(PGSIZE - 1), PGSIZE)) ||
+      (check_triggers_fetch && type == FETCH &&
+       proc->TM.may_match_page(triggers::OPERATION_EXECUTE, page)) ||
+      (check_triggers_load && type == LOAD &&
+       proc->TM.may_match_page(triggers::OPERATION_LOAD, page)) ||
+      (check_triggers_store && type == STORE &&
+       proc->TM.may_match_page(triggers::OPERATION_STORE, page)))
     expected_tag |= TLB_CHECK_TRIGGERS;
 
   if (pmp_homogeneous(paddr & ~reg_t(PGSIZE - 1), PGSIZE)) {
+    tlb_superpages |= translated_leaf_bits != 0;
     if (type == FETCH) tlb_insn_tag[idx] = expected_tag;
-    else if (type == STORE) tlb_store_tag[idx] = expected_tag;
-    else tlb_load_tag[idx] = expected_tag;
+    else if (type == LOAD) tlb_load_tag[idx] = expected_tag;
+    else if (!htif_watched(paddr)) tlb_store_tag[idx] = expected_tag;
+    if (stlb_ways != 0)
+      stlb_insert(vaddr >> PGSHIFT, paddr >> PGSHIFT, type);
   }
 
   tlb_data[idx] = entry;
+  tlb_xlate[idx] = translated_xlate;
   return entry;
 }
 
+void mmu_t::set_breakpoint(reg_t pc)
+{
+  breakpoint_pc = pc;
+  flush_icache();
+}
+
+void mmu_t::add_breakpoint(reg_t pc)
+{
+  breakpoints.insert(pc);
+  flush_icache();
+}
+
+void mmu_t::remove_breakpoint(reg_t pc)
+{
+  breakpoints.erase(pc);
+  flush_icache();
+}
+
+void mmu_t::set_watchpoint(reg_t lo, reg_t hi)
+{
+  watch_lo = lo;
+  watch_hi = hi;
+  flush_tlb();
+}
+
+reg_t mmu_t::breakpoint_insn(processor_t* p, insn_t insn, reg_t pc)
+{
+  throw interactive_stop_t();
+}
+
+void mmu_t::set_marker_stop(bool value)
+{
+  marker_stop = value;
+  flush_icache();
+}
+
+reg_t mmu_t::marker_insn(processor_t* p, insn_t insn, reg_t pc)
+{
+  p->get_mmu()->marker_stopped = true;
+  throw interactive_stop_t();
+}
+
+void mmu_t::watch_markers(const std::vector<insn_bits_t>& markers)
+{
+  watched_markers = markers;
+  flush_icache();
+}
+
+// The marker is a no-op.  Serializing after it ends the step's inner loop,
+// and processor_t::step then ends the step.
+reg_t mmu_t::watched_marker_insn(processor_t* p, insn_t insn, reg_t pc)
+{
+  p->get_mmu()->marker_seen = insn.bits();
+  p->get_state()->pc = pc + insn.length();
+  return PC_SERIALIZE_AFTER;
+}
+
+void mmu_t::set_htif_watch(reg_t lo, reg_t hi)
+{
+  htif_watch_lo = lo & ~reg_t(PGSIZE - 1);
+  htif_watch_hi = (hi + PGSIZE - 1) & ~reg_t(PGSIZE - 1);
+  flush_tlb();
+}
+
+void mmu_t::build_pmp_segments()
+{
+  std::vector<std::pair<reg_t, reg_t>> ranges(proc->n_pmp);
+  std::vector<reg_t> starts = {0};
+  for (size_t i = 0; i < proc->n_pmp; i++) {
+    auto& r = ranges[i];
+    if (!proc->state.pmpaddr[i]->range(&r.first, &r.second)) {
+      r = {1, 0};
+      continue;
+    }
+    starts.push_back(r.first);
+    if (r.second != reg_t(-1))
+      starts.push_back(r.second + 1);
+  }
+  std::sort(starts.begin(), starts.end());
+  starts.erase(std::unique(starts.begin(), starts.end()), starts.end());
+
+  pmp_segments.clear();
+  for (reg_t start : starts) {
+    int entry = -1;
+    for (size_t i = 0; i < ranges.size() && entry < 0; i++)
+      if (ranges[i].first <= start && start <= ranges[i].second)
+        entry = i;
+    pmp_segments.push_back({start, entry});
+  }
+}
+
+const mmu_t::pmp_segment_t& mmu_t::find_pmp_segment(reg_t addr, reg_t* end)
+{
+  if (pmp_segments.empty())
+    build_pmp_segments();
+
+  auto it = std::upper_bound(pmp_segments.begin(), pmp_segments.end(), addr,
+    [](reg_t a, const pmp_segment_t& s) { return a < s.start; });
+  *end = it == pmp_segments.end() ? reg_t(-1) : it->start - 1;
+  return *(it - 1);
+}
+
 bool mmu_t::pmp_ok(reg_t addr, reg_t len, access_type type, reg_t mode)
 {
   if (!proc || proc->n_pmp == 0)
     return true;
 
+  // When all the sectors checked below fall in one segment, they match the
+  // same entries, so the first of those decides.
+  reg_t end;
+  reg_t last = addr + ((len - 1) & ~reg_t((1 << PMP_SHIFT) - 1));
+  auto& segment = find_pmp_segment(addr, &end);
+  if (likely(addr <= last && last <= end)) {
+    if (segment.entry >= 0)
+      return proc->state.pmpaddr[segment.entry]->access_ok(type, mode);
+    return pmp_default_ok(type, mode);
+  }
+
   for (size_t i = 0; i < proc->n_pmp; i++) {
     // Check each 4-byte sector of the access
     bool any_match = false;
@@ -242,7 +1099,12 @@ bool mmu_t::pmp_ok(reg_t addr, reg_t len, access_type type, reg_t mode)
     }
   }
 
-  // in case matching region is not found
+  return pmp_default_ok(type, mode);
+}
+
+// in case matching region is not found
+bool mmu_t::pmp_default_ok(access_type type, reg_t mode)
+{
   const bool mseccfg_mml = proc->state.mseccfg->get_mml();
   const bool mseccfg_mmwp = proc->state.mseccfg->get_mmwp();
   return ((mode == PRV_M) && !mseccfg_mmwp
@@ -254,22 +1116,23 @@ reg_t mmu_t::pmp_homogeneous(reg_t addr, reg_t len)
   if ((addr | len) & (len - 1))
     abort();
 
-  if (!proc)
+  if (!proc || proc->n_pmp == 0)
     return true;
 
-  for (size_t i = 0; i < proc->n_pmp; i++)
-    if (proc->state.pmpaddr[i]->subset_match(addr, len))
-      return false;
-
-  return true;
+  // No entry begins or ends strictly inside the range.
+  reg_t end;
+  find_pmp_segment(addr, &end);
+  return end >= addr + len - 1;
 }
 
 reg_t mmu_t::s2xlate(reg_t gva, reg_t gpa, access_type type, access_type trap_type, bool virt, bool hlvx)
 {
+  g_stage_xlate = {};
   if (!virt)
     return gpa;
 
-  vm_info vm = decode_vm_info(proc->get_const_xlen(), true, 0, proc->get_state()->hgatp->read());
+  reg_t hgatp = proc->get_state()->hgatp->read();
+  vm_info vm = decode_vm_info(proc->get_const_xlen(), true, 0, hgatp);
   if (vm.levels == 0)
     return gpa;
 
@@ -277,6 +1140,25 @@ reg_t mmu_t::s2xlate(reg_t gva, reg_t gpa, access_type type, access_type trap_ty
   reg_t maxgpa = (1ULL << maxgpabits) - 1;
 
   bool mxr = proc->state.sstatus->readvirt(false) & MSTATUS_MXR;
+  reg_t page_mask = (reg_t(1) << PGSHIFT) - 1;
+  reg_t ad = PTE_A | ((type == STORE) * PTE_D);
+
+  // Only leaves that passed every check are cached, so a hit need only redo
+  // the checks that depend on the access.
+  g_stage_entry_t* cached = nullptr;
+  if (!g_stage_cache.empty()) {
+    cached = &g_stage_slot(hgatp, gpa >> PGSHIFT);
+    reg_t pte = cached->pte;
+    if (cached->gpn == gpa >> PGSHIFT && cached->hgatp == hgatp &&
+        (pte & ad) == ad &&
+        (type == FETCH || hlvx ? (pte & PTE_X) :
+         type == LOAD          ? (pte & PTE_R) || (mxr && (pte & PTE_X)) :
+                                 (pte & PTE_R) && (pte & PTE_W))) {
+      g_stage_cache_hits++;
+      g_stage_xlate = cached->xlate;
+      return (cached->hppn << PGSHIFT) | (gpa & page_mask);
+    }
+  }
 
   reg_t base = vm.ptbase;
   if ((gpa & ~maxgpa) == 0) {
@@ -319,13 +1201,15 @@ reg_t mmu_t::s2xlate(reg_t gva, reg_t gpa, access_type type, access_type trap_ty
       } else if ((ppn & ((reg_t(1) << ptshift) - 1)) != 0) {
         break;
       } else {
-        reg_t ad = PTE_A | ((type == STORE) * PTE_D);
 #ifdef RISCV_ENABLE_DIRTY
         // set accessed and possibly dirty bits.
         if ((pte & ad) != ad) {
           if (!pmp_ok(pte_paddr, vm.ptesize, STORE, PRV_S))
             throw_access_exception(virt, gva, trap_type);
-          *(target_endian<uint32_t>*)ppte |= to_target((uint32_t)ad);
+          if (unlikely(journal_stores))
+            sim->journal_store(pte_paddr, vm.ptesize);
+          __atomic_fetch_or((uint32_t*)ppte, raw_target((uint32_t)ad), __ATOMIC_SEQ_CST);
+          pte |= ad;
         }
 #else
         // take exception if access or possibly dirty bit is not set.
@@ -333,7 +1217,6 @@ reg_t mmu_t::s2xlate(reg_t gva, reg_t gpa, access_type type, access_type trap_ty
           break;
 #endif
         reg_t vpn = gpa >> PGSHIFT;
-        reg_t page_mask = (reg_t(1) << PGSHIFT) - 1;
 
         int napot_bits = ((pte & PTE_N) ? (ctz(ppn) + 1) : 0);
         if (((pte & PTE_N) && (ppn == 0 || i != 0)) || (napot_bits != 0 && napot_bits != 4))
@@ -342,6 +1225,10 @@ reg_t mmu_t::s2xlate(reg_t gva, reg_t gpa, access_type type, access_type trap_ty
         reg_t page_base = ((ppn & ~((reg_t(1) << napot_bits) - 1))
                           | (vpn & ((reg_t(1) << napot_bits) - 1))
                           | (vpn & ((reg_t(1) << ptshift) - 1))) << PGSHIFT;
+        g_stage_xlate = {uint8_t(PGSHIFT + ptshift + napot_bits), uint8_t(vm.levels - i)};
+        // Leaves with PBMT bits are left out, as they depend on menvcfg.
+        if (cached && !(pte & PTE_PBMT))
+          *cached = {hgatp, vpn, page_base >> PGSHIFT, pte, g_stage_xlate};
         return page_base | (gpa & page_mask);
       }
     }
@@ -357,11 +1244,16 @@ reg_t mmu_t::s2xlate(reg_t gva, reg_t gpa, access_type type, access_type trap_ty
 
 reg_t mmu_t::walk(reg_t addr, access_type type, reg_t mode, bool virt, bool hlvx)
 {
+  host_prof_scope_t prof(HOST_PROF_WALK);
   reg_t page_mask = (reg_t(1) << PGSHIFT) - 1;
   reg_t satp = proc->get_state()->satp->readvirt(virt);
   vm_info vm = decode_vm_info(proc->get_const_xlen(), false, mode, satp);
-  if (vm.levels == 0)
-    return s2xlate(addr, addr & ((reg_t(2) << (proc->xlen-1))-1), type, type, virt, hlvx) & ~page_mask; // zero-extend from xlen
+  translated_leaf_bits = 0;
+  if (vm.levels == 0) {
+    reg_t paddr = s2xlate(addr, addr & ((reg_t(2) << (proc->xlen-1))-1), type, type, virt, hlvx); // zero-extend from xlen
+    translated_xlate = g_stage_xlate;
+    return paddr & ~page_mask;
+  }
 
   bool s_mode = mode == PRV_S;
   bool sum = proc->state.sstatus->readvirt(virt) & MSTATUS_SUM;
@@ -375,7 +1267,19 @@ reg_t mmu_t::walk(reg_t addr, access_type type, reg_t mode, bool virt, bool hlvx
     vm.levels = 0;
 
   reg_t base = vm.ptbase;
-  for (int i = vm.levels - 1; i >= 0; i--) {
+  int start = vm.levels - 1;
+  for (int i = 0; i < start && !walk_cache.empty(); i++) {
+    reg_t prefix = addr >> (PGSHIFT + (i + 1) * vm.idxbits);
+    auto& entry = walk_cache_slot(vm.ptbase, prefix, i);
+    if (entry.root == vm.ptbase && entry.prefix == prefix &&
+        entry.level == i && entry.virt == virt) {
+      walk_cache_hits++;
+      base = entry.base;
+      start = i;
+    }
+  }
+
+  for (int i = start; i >= 0; i--) {
     int ptshift = i * vm.idxbits;
     reg_t idx = (addr >> (PGSHIFT + ptshift)) & ((1 << vm.idxbits) - 1);
 
@@ -401,6 +1305,10 @@ reg_t mmu_t::walk(reg_t addr, access_type type, reg_t mode, bool virt, bool hlvx
       if (pte & (PTE_D | PTE_A | PTE_U | PTE_N | PTE_PBMT))
         break;
       base = ppn << PGSHIFT;
+      if (i > 0 && !walk_cache.empty()) {
+        reg_t prefix = addr >> (PGSHIFT + ptshift);
+        walk_cache_slot(vm.ptbase, prefix, i - 1) = {vm.ptbase, prefix, i - 1, virt, base};
+      }
     } else if ((pte & PTE_U) ? s_mode && (type == FETCH || !sum) : !s_mode) {
       break;
     } else if (!(pte & PTE_V) || (!(pte & PTE_R) && (pte & PTE_W))) {
@@ -418,6 +1326,8 @@ reg_t mmu_t::walk(reg_t addr, access_type type, reg_t mode, bool virt, bool hlvx
       if ((pte & ad) != ad) {
         if (!pmp_ok(pte_paddr, vm.ptesize, STORE, PRV_S))
           throw_access_exception(virt, addr, type);
+        if (unlikely(journal_stores))
+          sim->journal_store(pte_paddr, vm.ptesize);
         *(target_endian<uint32_t>*)ppte |= to_target((uint32_t)ad);
       }
 #else
@@ -436,7 +1346,18 @@ reg_t mmu_t::walk(reg_t addr, access_type type, reg_t mode, bool virt, bool hlvx
                         | (vpn & ((reg_t(1) << napot_bits) - 1))
                         | (vpn & ((reg_t(1) << ptshift) - 1))) << PGSHIFT;
       reg_t phys = page_base | (addr & page_mask);
-      return s2xlate(addr, phys, type, type, virt, hlvx) & ~page_mask;
+      translated_leaf_bits = ptshift + napot_bits;
+      phys = s2xlate(addr, phys, type, type, virt, hlvx);
+
+      // Under two-stage translation every VS-stage PTE read takes a G-stage
+      // walk, as does the final guest-physical address.  Those for the PTEs
+      // are taken to be as deep as the final one.
+      unsigned vs_refs = vm.levels - i;
+      unsigned page_shift = PGSHIFT + translated_leaf_bits;
+      if (g_stage_xlate.page_shift != 0)
+        page_shift = std::min<unsigned>(page_shift, g_stage_xlate.page_shift);
+      translated_xlate = {uint8_t(page_shift), uint8_t(vs_refs + (vs_refs + 1) * g_stage_xlate.walk_refs)};
+      return phys & ~page_mask;
     }
   }
 
@@ -450,6 +1371,27 @@ reg_t mmu_t::walk(reg_t addr, access_type type, reg_t mode, bool virt, bool hlvx
 
 void mmu_t::register_memtracer(memtracer_t* t)
 {
+  flush_trace();
   flush_tlb();
   tracer.hook(t);
+  trace_buf.reserve(TRACE_BUF_SIZE);
+}
+
+void mmu_t::set_tracing_paused(bool paused)
+{
+  flush_trace();
+  tracing_paused = paused;
+  // Pages are tagged as traced or not when they are refilled.
+  flush_tlb();
+}
+
+void mmu_t::flush_trace()
+{
+  if (trace_buf.empty())
+    return;
+  host_prof_scope_t prof(HOST_PROF_MEM_TRACE);
+  if (proc)
+    tracer.set_batch_context(proc->get_id(), proc->get_state()->minstret->read());
+  tracer.trace_batch(trace_buf.data(), trace_buf.size());
+  trace_buf.clear();
 }
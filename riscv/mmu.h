@@ -12,7 +12,17 @@
 #include "memtracer.h"
 #include "byteorder.h"
 #include "triggers.h"
+#include "host_prof.h"
+#include "replay_log.h"
+#include "page_heat.h"
+#include "atomic_profile.h"
+#include "plugin.h"
 #include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 // virtual memory configuration
@@ -25,12 +35,101 @@ struct insn_fetch_t
 {
   insn_func_t func;
   insn_t insn;
+  // What func runs: insn, or the 32-bit instruction that a compressed insn
+  // was expanded to at decode time, whose handler steps the pc npc_adjust
+  // bytes further than insn does.
+  insn_t func_insn;
+  uint8_t npc_adjust;
+#ifdef RISCV_ENABLE_SIFT
+  sift_uop_plan_t sift_plan;
+#endif
 };
 
 struct icache_entry_t {
   reg_t tag;
   struct icache_entry_t* next;
   insn_fetch_t data;
+  uint64_t executions; // see processor_t::count_execution
+  // The instruction's bytes in host memory, so that fence.i can tell
+  // whether they changed; null if they are not all on one page of RAM.
+  const char* host;
+};
+
+// Integer instructions that the block cache can pre-decode and execute
+// inline, from their register indices and sign-extended immediate, without
+// calling their handlers.  Compressed instructions are expanded into them.
+// The ALU operations and loads all write an integer register other than x0.
+#define INLINE_OPS(X) \
+  X(ADDI) X(XORI) X(ORI) X(ANDI) X(SLTI) X(SLTIU) \
+  X(SLLI) X(SRLI) X(SRAI) X(LUI) X(AUIPC) \
+  X(ADD) X(SUB) X(XOR) X(OR) X(AND) X(SLT) X(SLTU) \
+  X(SLL) X(SRL) X(SRA) \
+  X(ADDIW) X(SLLIW) X(SRLIW) X(SRAIW) X(ADDW) X(SUBW) \
+  X(LB) X(LH) X(LW) X(LD) X(LBU) X(LHU) X(LWU) \
+  X(SB) X(SH) X(SW) X(SD) \
+  X(BEQ) X(BNE) X(BLT) X(BGE) X(BLTU) X(BGEU) X(JAL) X(JALR)
+
+// Pairs of inline ops that compilers emit together, the second consuming
+// the first's result: constants and addresses built by lui or auipc, far
+// calls and GOT loads, scaled indices and compare-and-branch.  A fused op
+// replaces the first op of the pair and runs both instructions with one
+// dispatch; the second entry keeps its own op.
+#define INLINE_FUSED_OPS(X) \
+  X(LUI, ADDI) X(LUI, ADDIW) X(AUIPC, ADDI) X(AUIPC, JALR) \
+  X(AUIPC, LW) X(AUIPC, LD) X(SLLI, ADD) X(ADDI, BNE) \
+  X(SLT, BEQ) X(SLT, BNE) X(SLTU, BEQ) X(SLTU, BNE) \
+  X(SLTI, BEQ) X(SLTI, BNE) X(SLTIU, BEQ) X(SLTIU, BNE)
+
+enum inline_op_t : uint8_t {
+  INLINE_NONE,
+#define DECLARE_INLINE_OP(name) INLINE_##name,
+  INLINE_OPS(DECLARE_INLINE_OP)
+#undef DECLARE_INLINE_OP
+#define DECLARE_FUSED_OP(first, second) INLINE_##first##_##second,
+  INLINE_FUSED_OPS(DECLARE_FUSED_OP)
+#undef DECLARE_FUSED_OP
+  INLINE_NUM_OPS
+};
+
+struct insn_block_entry_t {
+  insn_fetch_t fetch;
+  reg_t npc;          // fall-through PC
+  inline_op_t op;
+  bool rvc;           // op came from a compressed instruction
+  uint8_t rd, rs1, rs2;
+  sreg_t imm;
+};
+
+// A straight-line run of decoded instructions within one page, ending at the
+// first instruction that may redirect control flow or change how later
+// instructions are fetched.  Each block remembers the last two blocks that
+// followed it, so hot paths are dispatched without a cache lookup.
+struct insn_block_t {
+  static const size_t MAX_INSNS = 32;
+
+  reg_t tag;
+  size_t ninsns;
+  const char* host;  // the first instruction's icache_entry_t::host
+  insn_block_t* succ[2];
+  const plugin_hooks_t* hooks;  // run on entry to the block, or null
+  insn_block_entry_t insns[MAX_INSNS];
+
+  insn_block_t* successor(reg_t pc)
+  {
+    if (succ[0] && succ[0]->tag == pc)
+      return succ[0];
+    if (succ[1] && succ[1]->tag == pc)
+      return succ[1];
+    return nullptr;
+  }
+
+  void link(insn_block_t* next)
+  {
+    if (succ[0] != next) {
+      succ[1] = succ[0];
+      succ[0] = next;
+    }
+  }
 };
 
 struct tlb_entry_t {
@@ -38,6 +137,12 @@ struct tlb_entry_t {
   reg_t target_offset;
 };
 
+// How a translation was made, as access_record_t reports it
+struct tlb_xlate_t {
+  uint8_t page_shift;
+  uint8_t walk_refs;
+};
+
 // this class implements a processor's port into the virtual memory system.
 // an MMU and instruction cache are maintained for simulator performance.
 class mmu_t
@@ -52,9 +157,77 @@ public:
 #define RISCV_XLATE_VIRT (1U << 0)
 #define RISCV_XLATE_VIRT_HLVX (1U << 1)
 
+#ifdef RISCV_ENABLE_COMMITLOG
+# define READ_MEM(addr, size) ({ \
+    if (unlikely(proc->get_log_capturing())) \
+      proc->state.log_mem_read.push_back(std::make_tuple(addr, 0, size)); \
+  })
+#else
+# define READ_MEM(addr, size) ({})
+#endif
+
+#ifndef RISCV_ENABLE_COMMITLOG
+# define WRITE_MEM(addr, value, size) ({})
+#else
+# define WRITE_MEM(addr, val, size) ({ \
+    if (unlikely(proc->get_log_capturing())) \
+      proc->state.log_mem_write.push_back(std::make_tuple(addr, val, size)); \
+  })
+#endif
+
+  // Where the logs of the current instruction end, so that the byte
+  // accesses a misaligned access is split into can be dropped from them.
+  struct misaligned_log_mark_t {
+    unsigned addrs;
+    size_t reads;
+    size_t writes;
+  };
+  misaligned_log_mark_t misaligned_log_mark()
+  {
+    misaligned_log_mark_t mark = {};
+    if (!proc)
+      return mark;
+#ifdef RISCV_ENABLE_SIFT
+    mark.addrs = proc->state.log_addr_valid;
+#endif
+#ifdef RISCV_ENABLE_COMMITLOG
+    mark.reads = proc->state.log_mem_read.size();
+    mark.writes = proc->state.log_mem_write.size();
+#endif
+    return mark;
+  }
+  void misaligned_log_rewind(const misaligned_log_mark_t& mark)
+  {
+    if (!proc)
+      return;
+#ifdef RISCV_ENABLE_SIFT
+    proc->state.log_addr_valid = mark.addrs;
+#endif
+#ifdef RISCV_ENABLE_COMMITLOG
+    proc->state.log_mem_read.resize(mark.reads);
+    proc->state.log_mem_write.resize(mark.writes);
+#endif
+  }
+
+  // A misaligned access within a page whose translation is in the TLB is
+  // done on the host memory directly; other ones are split into bytes.
+  // Either way the trace logs the one access the instruction made, not
+  // the bytes it was carried out with.
   inline reg_t misaligned_load(reg_t addr, size_t size, uint32_t xlate_flags)
   {
 #ifdef RISCV_ENABLE_MISALIGNED
+    reg_t vpn = addr >> PGSHIFT;
+    if (xlate_flags == 0 && ((addr + size - 1) >> PGSHIFT) == vpn &&
+        likely(tlb_load_tag[tlb_index(vpn)] == vpn)) {
+      const uint8_t* host = (const uint8_t*)tlb_data[tlb_index(vpn)].host_offset + addr;
+      reg_t res = 0;
+      for (size_t i = 0; i < size; i++)
+        res += reg_t(host[target_big_endian? size-1-i : i]) << (i * 8);
+      if (proc) READ_MEM(addr, size);
+      return res;
+    }
+
+    misaligned_log_mark_t mark = misaligned_log_mark();
     reg_t res = 0;
     for (size_t i = 0; i < size; i++) {
       const reg_t byteaddr = addr + (target_big_endian? size-1-i : i);
@@ -65,6 +238,8 @@ public:
         ;
       res += bytedata << (i * 8);
     }
+    misaligned_log_rewind(mark);
+    if (proc) READ_MEM(addr, size);
     return res;
 #else
     bool gva = ((proc) ? proc->state.v : false) || (RISCV_XLATE_VIRT & xlate_flags);
@@ -75,6 +250,19 @@ public:
   inline void misaligned_store(reg_t addr, reg_t data, size_t size, uint32_t xlate_flags, bool actually_store=true)
   {
 #ifdef RISCV_ENABLE_MISALIGNED
+    reg_t vpn = addr >> PGSHIFT;
+    if (xlate_flags == 0 && ((addr + size - 1) >> PGSHIFT) == vpn &&
+        likely(tlb_store_tag[tlb_index(vpn)] == vpn)) {
+      if (actually_store) {
+        uint8_t* host = (uint8_t*)tlb_data[tlb_index(vpn)].host_offset + addr;
+        for (size_t i = 0; i < size; i++)
+          host[target_big_endian? size-1-i : i] = data >> (i * 8);
+        if (proc) WRITE_MEM(addr, data, size);
+      }
+      return;
+    }
+
+    misaligned_log_mark_t mark = misaligned_log_mark();
     for (size_t i = 0; i < size; i++) {
       const reg_t byteaddr = addr + (target_big_endian? size-1-i : i);
       const reg_t bytedata = data >> (i * 8);
@@ -84,29 +272,21 @@ public:
         store_uint8(byteaddr, bytedata, actually_store);
       }
     }
+    misaligned_log_rewind(mark);
+    if (actually_store && proc) WRITE_MEM(addr, data, size);
 #else
     bool gva = ((proc) ? proc->state.v : false) || (RISCV_XLATE_VIRT & xlate_flags);
     throw trap_store_address_misaligned(gva, addr, 0, 0);
 #endif
   }
 
-#ifdef RISCV_ENABLE_SIFT
-# define READ_MEM(addr, size) \
-  proc->state.log_mem_read.push_back(std::make_tuple(addr, 0, size));
-#else
-# define READ_MEM(addr, size) ({})
-#endif
-
   #ifdef RISCV_ENABLE_SIFT
 # define LOG_ADDR(addr, reg_addr) ({            \
-      if (proc && proc->get_state()) { \
-        proc->get_state()->log_addr[proc->get_state()->log_addr_valid] = addr; \
-        proc->get_state()->log_reg_addr[proc->get_state()->log_addr_valid] = reg_addr; \
-        proc->get_state()->log_addr_valid++; \
-      } \
+      if (proc && proc->get_state() && proc->get_state()->log_sift_capturing()) \
+        proc->get_state()->log_sift_addr(addr, reg_addr); \
     })
   #else
-  # define LOG_ADDR(addr) do {} while (false)
+  # define LOG_ADDR(addr, reg_addr) do {} while (false)
   #endif
 
   // template for functions that load an aligned value from memory
@@ -119,12 +299,12 @@ public:
       } \
       reg_t vpn = addr >> PGSHIFT; \
       size_t size = sizeof(type##_t); \
-      if ((xlate_flags) == 0 && likely(tlb_load_tag[vpn % TLB_ENTRIES] == vpn)) { \
+      if ((xlate_flags) == 0 && likely(tlb_load_tag[tlb_index(vpn)] == vpn)) { \
         if (proc) READ_MEM(addr, size); \
-        return from_target(*(target_endian<type##_t>*)(tlb_data[vpn % TLB_ENTRIES].host_offset + addr)); \
+        return from_target(*(target_endian<type##_t>*)(tlb_data[tlb_index(vpn)].host_offset + addr)); \
       } \
-      if ((xlate_flags) == 0 && unlikely(tlb_load_tag[vpn % TLB_ENTRIES] == (vpn | TLB_CHECK_TRIGGERS))) { \
-        type##_t data = from_target(*(target_endian<type##_t>*)(tlb_data[vpn % TLB_ENTRIES].host_offset + addr)); \
+      if ((xlate_flags) == 0 && unlikely(tlb_load_tag[tlb_index(vpn)] == (vpn | TLB_CHECK_TRIGGERS))) { \
+        type##_t data = from_target(*(target_endian<type##_t>*)(tlb_data[tlb_index(vpn)].host_offset + addr)); \
         if (!matched_trigger) { \
           matched_trigger = trigger_exception(triggers::OPERATION_LOAD, addr, data); \
           if (matched_trigger) \
@@ -149,12 +329,12 @@ public:
       } \
       reg_t vpn = addr >> PGSHIFT; \
       size_t size = sizeof(type##_t); \
-      if ((xlate_flags) == 0 && likely(tlb_load_tag[vpn % TLB_ENTRIES] == vpn)) { \
+      if ((xlate_flags) == 0 && likely(tlb_load_tag[tlb_index(vpn)] == vpn)) { \
         if (proc) READ_MEM(addr, size); \
-        return from_target(*(target_endian<type##_t>*)(tlb_data[vpn % TLB_ENTRIES].host_offset + addr)); \
+        return from_target(*(target_endian<type##_t>*)(tlb_data[tlb_index(vpn)].host_offset + addr)); \
       } \
-      if ((xlate_flags) == 0 && unlikely(tlb_load_tag[vpn % TLB_ENTRIES] == (vpn | TLB_CHECK_TRIGGERS))) { \
-        type##_t data = from_target(*(target_endian<type##_t>*)(tlb_data[vpn % TLB_ENTRIES].host_offset + addr)); \
+      if ((xlate_flags) == 0 && unlikely(tlb_load_tag[tlb_index(vpn)] == (vpn | TLB_CHECK_TRIGGERS))) { \
+        type##_t data = from_target(*(target_endian<type##_t>*)(tlb_data[tlb_index(vpn)].host_offset + addr)); \
         if (!matched_trigger) { \
           matched_trigger = trigger_exception(triggers::OPERATION_LOAD, addr, data); \
           if (matched_trigger) \
@@ -226,13 +406,6 @@ public:
   load_func_vec(int64, guest_load, RISCV_XLATE_VIRT)
 
 
-#ifndef RISCV_ENABLE_COMMITLOG
-# define WRITE_MEM(addr, value, size) ({})
-#else
-# define WRITE_MEM(addr, val, size) \
-  proc->state.log_mem_write.push_back(std::make_tuple(addr, val, size));
-#endif
-
   // template for functions that store an aligned value to memory
   #define store_func(type, prefix, xlate_flags) \
     void ALWAYS_INLINE prefix##_##type(reg_t addr, type##_t val, bool actually_store=true, bool require_alignment=false) { \
@@ -243,21 +416,22 @@ public:
       } \
       reg_t vpn = addr >> PGSHIFT; \
       size_t size = sizeof(type##_t); \
-      if ((xlate_flags) == 0 && likely(tlb_store_tag[vpn % TLB_ENTRIES] == vpn)) { \
+      if ((xlate_flags) == 0 && likely(tlb_store_tag[tlb_index(vpn)] == vpn)) { \
         if (actually_store) { \
           if (proc) WRITE_MEM(addr, val, size); \
-          *(target_endian<type##_t>*)(tlb_data[vpn % TLB_ENTRIES].host_offset + addr) = to_target(val); \
+          *(target_endian<type##_t>*)(tlb_data[tlb_index(vpn)].host_offset + addr) = to_target(val); \
         } \
       } \
-      else if ((xlate_flags) == 0 && unlikely(tlb_store_tag[vpn % TLB_ENTRIES] == (vpn | TLB_CHECK_TRIGGERS))) { \
+      else if ((xlate_flags) == 0 && unlikely(tlb_store_tag[tlb_index(vpn)] == (vpn | TLB_CHECK_TRIGGERS))) { \
         if (actually_store) { \
+          check_watchpoint(addr, size); \
           if (!matched_trigger) { \
             matched_trigger = trigger_exception(triggers::OPERATION_STORE, addr, val); \
             if (matched_trigger) \
               throw *matched_trigger; \
           } \
           if (proc) WRITE_MEM(addr, val, size); \
-          *(target_endian<type##_t>*)(tlb_data[vpn % TLB_ENTRIES].host_offset + addr) = to_target(val); \
+          *(target_endian<type##_t>*)(tlb_data[tlb_index(vpn)].host_offset + addr) = to_target(val); \
         } \
       } \
       else { \
@@ -279,18 +453,19 @@ public:
       } \
       reg_t vpn = addr >> PGSHIFT; \
       size_t size = sizeof(type##_t); \
-      if ((xlate_flags) == 0 && likely(tlb_store_tag[vpn % TLB_ENTRIES] == vpn)) { \
+      if ((xlate_flags) == 0 && likely(tlb_store_tag[tlb_index(vpn)] == vpn)) { \
         if (proc) WRITE_MEM(addr, val, size); \
-        *(target_endian<type##_t>*)(tlb_data[vpn % TLB_ENTRIES].host_offset + addr) = to_target(val); \
+        *(target_endian<type##_t>*)(tlb_data[tlb_index(vpn)].host_offset + addr) = to_target(val); \
       } \
-      else if ((xlate_flags) == 0 && unlikely(tlb_store_tag[vpn % TLB_ENTRIES] == (vpn | TLB_CHECK_TRIGGERS))) { \
+      else if ((xlate_flags) == 0 && unlikely(tlb_store_tag[tlb_index(vpn)] == (vpn | TLB_CHECK_TRIGGERS))) { \
+        check_watchpoint(addr, size); \
         if (!matched_trigger) { \
           matched_trigger = trigger_exception(triggers::OPERATION_STORE, addr, val); \
           if (matched_trigger) \
             throw *matched_trigger; \
         } \
         if (proc) WRITE_MEM(addr, val, size); \
-        *(target_endian<type##_t>*)(tlb_data[vpn % TLB_ENTRIES].host_offset + addr) = to_target(val); \
+        *(target_endian<type##_t>*)(tlb_data[tlb_index(vpn)].host_offset + addr) = to_target(val); \
       } \
       else { \
         target_endian<type##_t> target_val = to_target(val); \
@@ -321,11 +496,52 @@ public:
       convert_load_traps_to_store_traps({ \
         store_##type(addr, 0, false, true); \
         auto lhs = load_##type(addr, true); \
+        if (unlikely(atomic_profile != nullptr)) \
+          profile_atomic(atomic_profile_t::AMO, addr); \
+        if (unlikely(parallel_atomics)) { \
+          reg_t paddr = translate(addr, sizeof(type##_t), STORE, 0); \
+          if (auto host_addr = sim->addr_to_mem(paddr)) { \
+            if (unlikely(watched(paddr, sizeof(type##_t)))) \
+              throw interactive_stop_t(); \
+            htif_store_seen |= htif_watched(paddr); \
+            replay_turn_t turn(replay_source(), REPLAY_ATOMIC); \
+            type##_t old = amo_host(addr, (type##_t*)host_addr, lhs, f); \
+            break_reservation_line(paddr); \
+            return old; \
+          } \
+        } \
         store_##type(addr, f(lhs)); \
         return lhs; \
       }) \
     }
 
+  // template for functions that complete a store-conditional
+  #define store_conditional_func(type) \
+    bool store_conditional_##type(reg_t addr, type##_t val) { \
+      bool stored = try_store_conditional_##type(addr, val); \
+      if (unlikely(atomic_profile != nullptr)) \
+        profile_atomic(stored ? atomic_profile_t::SC : atomic_profile_t::SC_FAIL, addr); \
+      return stored; \
+    } \
+    bool try_store_conditional_##type(reg_t addr, type##_t val) { \
+      bool have_reservation = check_load_reservation(addr, sizeof(type##_t)); \
+      if (have_reservation && unlikely(parallel_atomics)) { \
+        reg_t paddr = translate(addr, sizeof(type##_t), STORE, 0); \
+        if (auto host_addr = sim->addr_to_mem(paddr)) { \
+          if (unlikely(watched(paddr, sizeof(type##_t)))) \
+            throw interactive_stop_t(); \
+          htif_store_seen |= htif_watched(paddr); \
+          replay_turn_t turn(replay_source(), REPLAY_ATOMIC); \
+          if (!release_reservation_line(paddr)) \
+            return false; \
+          return sc_host(addr, (type##_t*)host_addr, (type##_t)load_reservation_value, val); \
+        } \
+      } \
+      if (have_reservation) \
+        store_##type(addr, val); \
+      return have_reservation; \
+    }
+
   void store_float128(reg_t addr, float128_t val)
   {
 #ifndef RISCV_ENABLE_MISALIGNED
@@ -370,15 +586,278 @@ public:
   store_func_vec(uint32, guest_store, RISCV_XLATE_VIRT)
   store_func_vec(uint64, guest_store, RISCV_XLATE_VIRT)
 
+  // Whether each page of [lo, hi] already grants the access in the TLB with
+  // no triggers to check, looking at no more than max_pages of them.
+  // Strided and indexed vector accesses check the span of their elements
+  // once, and then reach the elements through the vec_hit accessors, which
+  // neither look up nor fault.
+  bool vec_span_hits(reg_t lo, reg_t hi, access_type type, reg_t max_pages)
+  {
+    if (hi < lo || (hi >> PGSHIFT) - (lo >> PGSHIFT) >= max_pages)
+      return false;
+    for (reg_t vpn = lo >> PGSHIFT; vpn <= hi >> PGSHIFT; vpn++) {
+      reg_t tag = type == STORE ? tlb_store_tag[tlb_index(vpn)] : tlb_load_tag[tlb_index(vpn)];
+      if (tag != vpn)
+        return false;
+    }
+    return true;
+  }
+
+  // The load_vec and store_vec accessors, for aligned elements of a span
+  // vec_span_hits has vouched for
+  #define load_func_vec_hit(type) \
+    type##_t ALWAYS_INLINE load_vec_hit_##type(reg_t addr, reg_t vreg_addr, reg_t vreg_inx) { \
+      reg_t elts_per_reg = (proc->VU.VLEN >> 3) / (sizeof(type##_t)); \
+      LOG_ADDR(addr, vreg_addr + vreg_inx / elts_per_reg); \
+      if (proc) READ_MEM(addr, sizeof(type##_t)); \
+      return from_target(*(target_endian<type##_t>*)(tlb_data[tlb_index(addr >> PGSHIFT)].host_offset + addr)); \
+    }
+
+  #define store_func_vec_hit(type) \
+    void ALWAYS_INLINE store_vec_hit_##type(reg_t addr, type##_t val, reg_t vreg_addr, reg_t vreg_inx) { \
+      reg_t elts_per_reg = (proc->VU.VLEN >> 3) / (sizeof(type##_t)); \
+      LOG_ADDR(addr, vreg_addr + vreg_inx / elts_per_reg); \
+      if (proc) WRITE_MEM(addr, val, sizeof(type##_t)); \
+      *(target_endian<type##_t>*)(tlb_data[tlb_index(addr >> PGSHIFT)].host_offset + addr) = to_target(val); \
+    }
+
+  load_func_vec_hit(uint8)
+  load_func_vec_hit(uint16)
+  load_func_vec_hit(uint32)
+  load_func_vec_hit(uint64)
+  load_func_vec_hit(int8)
+  load_func_vec_hit(int16)
+  load_func_vec_hit(int32)
+  load_func_vec_hit(int64)
+
+  store_func_vec_hit(uint8)
+  store_func_vec_hit(uint16)
+  store_func_vec_hit(uint32)
+  store_func_vec_hit(uint64)
+
+  // Host address of the len bytes at addr, or NULL unless they lie in one
+  // page whose TLB entry already grants the access with no triggers to
+  // check.  Unit-stride vector accesses, segmented or not, copy through it
+  // in one go.
+  char* vec_host_ptr(reg_t addr, reg_t len, access_type type)
+  {
+    reg_t vpn = addr >> PGSHIFT;
+    if (len == 0 || ((addr + len - 1) >> PGSHIFT) != vpn || target_big_endian)
+      return NULL;
+    reg_t tag = type == STORE ? tlb_store_tag[tlb_index(vpn)] : tlb_load_tag[tlb_index(vpn)];
+    return tag == vpn ? tlb_data[tlb_index(vpn)].host_offset + addr : NULL;
+  }
+
+  // Log n elements moved by such a bulk access, starting at addr and at
+  // element first of the register group vreg, as the per-element accessors
+  // would have.  A segment access moves n records of nf fields, field fn
+  // belonging to the group at vreg + fn * emul.  vals holds what was stored,
+  // in memory order, or is NULL for a load.
+  template<typename T>
+  void log_vec_range(reg_t addr, reg_t n, reg_t vreg, reg_t first, const T* vals,
+                     reg_t nf = 1, reg_t emul = 1)
+  {
+#ifdef RISCV_ENABLE_SIFT
+    state_t* state = proc ? proc->get_state() : NULL;
+    if (state && state->log_sift_capturing()) {
+      reg_t elts_per_reg = (proc->VU.VLEN >> 3) / sizeof(T);
+      for (reg_t k = 0; k < n * nf; k++)
+        state->log_sift_addr(addr + k * sizeof(T),
+                             vreg + (k % nf) * emul + (first + k / nf) / elts_per_reg);
+    }
+#endif
+#ifdef RISCV_ENABLE_COMMITLOG
+    if (!vals && proc && proc->get_log_capturing())
+      for (reg_t k = 0; k < n * nf; k++)
+        proc->state.log_mem_read.push_back(std::make_tuple(addr + k * sizeof(T), 0, sizeof(T)));
+    if (vals && proc && proc->get_log_capturing())
+      for (reg_t k = 0; k < n * nf; k++)
+        proc->state.log_mem_write.push_back(std::make_tuple(addr + k * sizeof(T), vals[k], sizeof(T)));
+#endif
+  }
+
 
   // perform an atomic memory operation at an aligned address
   amo_func(uint32)
   amo_func(uint64)
 
+  // store if the reservation taken by acquire_load_reservation still holds
+  store_conditional_func(uint32)
+  store_conditional_func(uint64)
+
+  // When harts run on parallel host threads, AMOs and store-conditionals to
+  // RAM are carried out with host atomics, so that they are also atomic with
+  // respect to plain stores from other harts.  A store-conditional succeeds
+  // if its hart still holds the reservation on the cache line in the shared
+  // reservation table, and memory still holds the value its load-reserved
+  // returned.  Without it, harts take turns and keep the exact sequential
+  // semantics that deterministic traces rely on.
+  bool parallel_atomics = false;
+  // The reservation table of this hart's simulation, set with
+  // parallel_atomics; RESERVATION_SLOTS entries.
+  std::atomic<uint32_t>* reservation_owners = nullptr;
+
+  // Stores to the physical range [lo, hi), which holds tohost and fromhost,
+  // never hit in the TLB.  The slow path sets htif_store_seen instead, so
+  // the simulator only has to hand control to the HTIF host loop once the
+  // target has actually written one of them.
+  void set_htif_watch(reg_t lo, reg_t hi);
+  bool htif_watched(reg_t paddr) const { return paddr >= htif_watch_lo && paddr < htif_watch_hi; }
+  bool htif_store_seen = false;
+
+  // Reverse execution support: every store to a page not in the store TLB,
+  // and every A/D update, is reported to simif_t::journal_store before it
+  // is made, so that dropping the store TLB with flush_store_tlb() makes
+  // the first store to each page since then visible.
+  bool journal_stores = false;
+  void flush_store_tlb() { std::fill(tlb_store_tag.begin(), tlb_store_tag.end(), reg_t(-1)); }
+
+  // Interactive "until" support: the hart throws interactive_stop_t before
+  // executing the instruction at the breakpoint, or before any store that
+  // overlaps the watched physical range [lo, hi).  The breakpoint is marked
+  // in its icache entry, and only stores to watched pages take the
+  // TLB_CHECK_TRIGGERS path, so everything else still runs at full speed.
+  // A breakpoint of -1 and an empty range disarm them.
+  void set_breakpoint(reg_t pc);
+  void set_watchpoint(reg_t lo, reg_t hi);
+  // Any number of further breakpoints, for the GDB stub.
+  void add_breakpoint(reg_t pc);
+  void remove_breakpoint(reg_t pc);
+  bool watched(reg_t paddr, reg_t len) const { return paddr < watch_hi && paddr + len > watch_lo; }
+
+  // Fast-forward support: the libc routine name at pc (memcpy, memset,
+  // strlen or memcmp) runs natively on guest memory and returns to ra,
+  // charging minstret an estimate of the instructions it would have taken.
+  // Like a breakpoint, the intercept is marked in the icache entry of the
+  // routine's first instruction, which it falls back to executing whenever
+  // the hart is traced.  False if name is not one of the routines.
+  bool set_libc_intercept(reg_t pc, const std::string& name);
+  void clear_libc_intercepts();
+
+  // Boot checkpoint support: while armed, the hart throws interactive_stop_t
+  // before executing a boot-done or ROI start marker (addi x0, x0, 3 or
+  // addi x0, x0, 1) and sets marker_stopped.  Like the breakpoint, this is
+  // decided when the instruction enters the icache.
+  void set_marker_stop(bool value);
+  bool marker_stopped = false;
+
+  // Termination support: the hart ends its step right after retiring any
+  // of the watched marker instructions (addi x0, x0, <id>) and leaves it in
+  // marker_seen.
+  void watch_markers(const std::vector<insn_bits_t>& markers);
+  insn_bits_t marker_seen = 0;
+
+  // Page heat map support: every first-level TLB refill is counted against
+  // its physical page (see page_heat_t).
+  page_heat_t* page_heat = nullptr;
+
+  // Synchronization profiling support: the hart's AMOs, LRs and SCs are
+  // counted per cache line (see atomic_profile_t).
+  atomic_profile_t* atomic_profile = nullptr;
+  void profile_atomic(atomic_profile_t::event_t event, reg_t vaddr)
+  {
+    // The access has been checked, so the translation cannot trap.
+    reg_t paddr = translate(vaddr, 1, STORE, 0);
+    atomic_profile->record(event, paddr, vaddr, proc ? proc->get_state()->pc : 0);
+  }
+
+  template<typename T> T raw_target(T n) const
+  {
+    target_endian<T> t = to_target(n);
+    T raw;
+    memcpy(&raw, &t, sizeof(raw));
+    return raw;
+  }
+
+  template<typename T> T from_raw_target(T raw) const
+  {
+    target_endian<T> t;
+    memcpy((void*)&t, &raw, sizeof(raw));
+    return from_target(t);
+  }
+
+  // The hart holding the reservation on each cache line, by id + 1, in a
+  // table shared by all harts of the simulation under parallel_atomics.
+  // An AMO or SC to a line breaks the reservations on it, so an SC fails
+  // after another hart's atomic update even if that put the reserved value
+  // back; plain stores are only noticed through the value.  Lines sharing
+  // a slot break each other's reservations, which makes SCs fail
+  // spuriously, as is allowed.
+  static const size_t RESERVATION_SLOTS = 1 << 12;
+  static const reg_t RESERVATION_LINE = 64;
+  std::atomic<uint32_t>& reservation_slot(reg_t paddr)
+  {
+    return reservation_owners[(paddr / RESERVATION_LINE) % RESERVATION_SLOTS];
+  }
+  uint32_t reservation_id() const { return proc ? proc->get_id() + 1 : uint32_t(-1); }
+  uint32_t replay_source() const { return proc ? proc->get_id() : REPLAY_HOST; }
+  // True if this hart held the reservation on the line, which it gives up.
+  bool release_reservation_line(reg_t paddr)
+  {
+    uint32_t id = reservation_id();
+    return reservation_slot(paddr).compare_exchange_strong(id, 0);
+  }
+  void break_reservation_line(reg_t paddr)
+  {
+    auto& slot = reservation_slot(paddr);
+    if (slot.load(std::memory_order_relaxed) != 0)
+      slot.store(0);
+  }
+
+  template<typename T, typename op>
+  T amo_host(reg_t addr, T* host_addr, T lhs, op f)
+  {
+    T expected = raw_target(lhs);
+    while (true) {
+      T result = f(lhs);
+      if (__atomic_compare_exchange_n(host_addr, &expected, raw_target(result), false,
+                                      __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+        LOG_ADDR(addr, 0);
+        if (proc) WRITE_MEM(addr, result, sizeof(T));
+        return lhs;
+      }
+      lhs = from_raw_target(expected);
+    }
+  }
+
+  template<typename T>
+  bool sc_host(reg_t addr, T* host_addr, T reserved, T val)
+  {
+    T expected = raw_target(reserved);
+    if (!__atomic_compare_exchange_n(host_addr, &expected, raw_target(val), false,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+      return false;
+    LOG_ADDR(addr, 0);
+    if (proc) WRITE_MEM(addr, val, sizeof(T));
+    return true;
+  }
+
+  // Zeroes the block with one memset when its page is in the TLB; the
+  // first byte is stored as usual to take any fault or trigger and to fill
+  // the TLB.  The trace gets the block address once, as for a single store.
   void cbo_zero(reg_t addr) {
     auto base = addr & ~(blocksz - 1);
-    for (size_t offset = 0; offset < blocksz; offset += 1)
-      store_uint8(base + offset, 0);
+    auto mark = misaligned_log_mark();
+    reg_t vpn = base >> PGSHIFT;
+    bool stored_first = false;
+    if (tlb_store_tag[tlb_index(vpn)] != vpn) {
+      store_uint8(base, 0);
+      stored_first = true;
+    }
+    if (likely(tlb_store_tag[tlb_index(vpn)] == vpn && blocksz <= PGSIZE)) {
+      memset(tlb_data[tlb_index(vpn)].host_offset + base, 0, blocksz);
+    } else {
+      for (size_t offset = stored_first ? 1 : 0; offset < blocksz; offset += 1)
+        store_uint8(base + offset, 0);
+    }
+    misaligned_log_rewind(mark);
+    LOG_ADDR(base, 0);
+#ifdef RISCV_ENABLE_COMMITLOG
+    size_t step = std::min<size_t>(sizeof(uint64_t), blocksz);
+    if (proc)
+      for (size_t offset = 0; offset < blocksz; offset += step)
+        WRITE_MEM(base + offset, 0, step);
+#endif
   }
 
   void clean_inval(reg_t addr, bool clean, bool inval) {
@@ -386,8 +865,13 @@ public:
       const reg_t vaddr = addr & ~(blocksz - 1);
       const reg_t paddr = translate(vaddr, blocksz, LOAD, 0);
       if (auto host_addr = sim->addr_to_mem(paddr)) {
-        if (tracer.interested_in_range(paddr, paddr + PGSIZE, LOAD))
+        // The trace gets the block address, for the timing model to
+        // clean or invalidate the line.
+        LOG_ADDR(vaddr, 0);
+        if (!tracing_paused && tracer.interested_in_range(paddr, paddr + PGSIZE, LOAD)) {
+          flush_trace();
           tracer.clean_invalidate(paddr, blocksz, clean, inval);
+        }
       } else {
         throw trap_store_access_fault((proc) ? proc->state.v : false, addr, 0, 0);
       }
@@ -399,13 +883,19 @@ public:
     load_reservation_address = (reg_t)-1;
   }
 
-  inline void acquire_load_reservation(reg_t vaddr)
+  // value is what the load-reserved returned, zero-extended.
+  inline void acquire_load_reservation(reg_t vaddr, reg_t value)
   {
+    load_reservation_value = value;
     reg_t paddr = translate(vaddr, 1, LOAD, 0);
     if (auto host_addr = sim->addr_to_mem(paddr))
       load_reservation_address = refill_tlb(vaddr, paddr, host_addr, LOAD).target_offset + vaddr;
     else
       throw trap_load_access_fault((proc) ? proc->state.v : false, vaddr, 0, 0); // disallow LR to I/O space
+    if (parallel_atomics)
+      reservation_slot(load_reservation_address).store(reservation_id());
+    if (unlikely(atomic_profile != nullptr))
+      atomic_profile->record(atomic_profile_t::LR, paddr, vaddr, proc ? proc->get_state()->pc : 0);
   }
 
   inline void load_reserved_address_misaligned(reg_t vaddr)
@@ -440,15 +930,47 @@ public:
       throw trap_store_access_fault((proc) ? proc->state.v : false, vaddr, 0, 0); // disallow SC to I/O space
   }
 
-  static const reg_t ICACHE_ENTRIES = 1024;
+  static const reg_t ICACHE_SETS = 1024;
+  static const reg_t ICACHE_WAYS = 1;
+
+  // Resize the instruction cache; sets must be a power of two.
+  void configure_icache(size_t sets, size_t ways);
+  void set_icache_stats(bool value) { icache_stats = value; }
+
+  static const reg_t TLB_ENTRIES = 256;
+
+  // Resize the TLB to entries direct-mapped entries, backed by a second
+  // level of stlb_sets x stlb_ways entries (none if stlb_ways is zero).
+  // entries and stlb_sets must be powers of two.
+  void configure_tlb(size_t entries, size_t stlb_sets, size_t stlb_ways);
+  void set_tlb_stats(bool value) { tlb_stats = value; }
 
+  // Running totals for the hardware performance counters
+  uint64_t get_icache_misses() const { return icache_misses; }
+  uint64_t get_tlb_misses() const
+  {
+    return tlb_type_stats[LOAD].misses + tlb_type_stats[STORE].misses + tlb_type_stats[FETCH].misses;
+  }
+  uint64_t get_page_walks() const
+  {
+    uint64_t stlb_hits = tlb_type_stats[LOAD].stlb_hits + tlb_type_stats[STORE].stlb_hits +
+                         tlb_type_stats[FETCH].stlb_hits;
+    return get_tlb_misses() - stlb_hits;
+  }
+
+  // Cache the upper levels of page-table walks, and G-stage translations,
+  // in entries slots each (a power of two, or zero to disable both).
+  void configure_walk_cache(size_t entries);
+
+  // Index of way 0 of the set that addr maps to.
   inline size_t icache_index(reg_t addr)
   {
-    return (addr / PC_ALIGN) % ICACHE_ENTRIES;
+    return ((addr / PC_ALIGN) & (icache_sets - 1)) * icache_ways;
   }
 
   inline icache_entry_t* refill_icache(reg_t addr, icache_entry_t* entry)
   {
+    host_prof_scope_t prof(HOST_PROF_REFILL_ICACHE);
     auto tlb_entry = translate_insn_addr(addr);
     insn_bits_t insn = from_le(*(uint16_t*)(tlb_entry.host_offset + addr));
     int length = insn_length(insn);
@@ -467,25 +989,124 @@ public:
       insn |= (insn_bits_t)from_le(*(const uint16_t*)translate_insn_addr_to_host(addr + 2)) << 16;
     }
 
-    insn_fetch_t fetch = {proc->decode_insn(insn), insn};
+    insn_fetch_t fetch = {proc->decode_insn(insn), insn, insn, 0};
+#ifdef RISCV_ENABLE_SIFT
+    fetch.sift_plan = sift_plan_uops(insn);
+#endif
+    if (unlikely(addr == breakpoint_pc) || unlikely(!breakpoints.empty() && breakpoints.count(addr)))
+      fetch.func = &breakpoint_insn;
+    if (unlikely(!watched_markers.empty()) &&
+        std::find(watched_markers.begin(), watched_markers.end(), insn) != watched_markers.end())
+      fetch.func = &watched_marker_insn;
+    if (unlikely(marker_stop) && (insn == BOOT_DONE_MARKER || insn == ROI_START_MARKER))
+      fetch.func = &marker_insn;
+    if (unlikely(!libc_intercepts.empty())) {
+      auto it = libc_intercepts.find(addr);
+      if (it != libc_intercepts.end())
+        fetch.func = it->second;
+    }
+    if (unlikely(proc && proc->has_plugins()))
+      instrument_insn(addr, fetch);
+    if (length == 2)
+      expand_rvc(addr, fetch);
     entry->tag = addr;
     entry->next = &icache[icache_index(addr + length)];
     entry->data = fetch;
+    entry->executions = 0;
+    entry->host = tlb_entry.host_offset + addr;
+    if (entry->host == (char*)&fetch_temp || addr % PGSIZE + length > PGSIZE)
+      entry->host = nullptr;
 
     reg_t paddr = tlb_entry.target_offset + addr;;
-    if (tracer.interested_in_range(paddr, paddr + 1, FETCH)) {
+    if (traced(addr, paddr, FETCH, true)) {
       entry->tag = -1;
-      tracer.trace(paddr, length, FETCH);
+      trace_access(paddr, length, FETCH, addr, addr, tlb_xlate[tlb_index(addr >> PGSHIFT)]);
     }
     return entry;
   }
 
+  // Ways are kept in LRU order, so the entry returned is always way 0 of its
+  // set, which is where the next pointers of other entries point.
   inline icache_entry_t* access_icache(reg_t addr)
   {
-    icache_entry_t* entry = &icache[icache_index(addr)];
-    if (likely(entry->tag == addr))
-      return entry;
-    return refill_icache(addr, entry);
+    if (unlikely(icache_stats))
+      icache_lookups++;
+    icache_entry_t* set = &icache[icache_index(addr)];
+    if (likely(set->tag == addr))
+      return set;
+
+    size_t way = 1;
+    while (way < icache_ways && set[way].tag != addr)
+      way++;
+    if (way < icache_ways) {
+      icache_entry_t entry = set[way];
+      std::copy_backward(set, set + way, set + way + 1);
+      set[0] = entry;
+      return set;
+    }
+
+    icache_misses++;
+    if (unlikely(set[icache_ways - 1].executions))
+      fold_executions(&set[icache_ways - 1]);
+    std::copy_backward(set, set + icache_ways - 1, set + icache_ways);
+    refill_icache(addr, set);
+    predecode_icache(addr, set);
+    return set;
+  }
+
+  // The aligned block of code that a miss decodes the rest of
+  static const reg_t PREDECODE_BYTES = 64;
+
+  // Whether straight-line code stops after the instruction: jumps, and
+  // the system instructions that trap or return.  c.addiw looks like
+  // RV32's c.jal, which only stops the decoding early.
+  static bool ends_straight_line(insn_bits_t bits)
+  {
+    switch (bits & 3) {
+      case 1: return ((bits >> 13) & 7) == 1 || ((bits >> 13) & 7) == 5;
+      case 2: return ((bits >> 13) & 7) == 4 && ((bits >> 2) & 0x1f) == 0;
+      case 3: return (bits & 0x7f) == 0x6f || (bits & 0x7f) == 0x67 || (bits & 0x7f) == 0x73;
+    }
+    return false;
+  }
+
+  // After a miss at addr, decode the instructions that follow it in its
+  // block into their sets as well, up to the first that ends straight-line
+  // code, so that cold code takes a miss per block rather than one per
+  // instruction.  Only RAM whose fetches are neither traced nor checked
+  // for triggers is decoded ahead, since the instructions may never run,
+  // and nothing is for plugins, which instrument each one decoded.
+  void predecode_icache(reg_t addr, icache_entry_t* first)
+  {
+    reg_t vpn = addr >> PGSHIFT;
+    if (!first->host || first->tag != addr || tlb_insn_tag[tlb_index(vpn)] != vpn ||
+        (proc && proc->has_plugins()))
+      return;
+
+    // first is only good until its set is refilled, which a small icache
+    // would do.
+    const char* host = first->host;
+    reg_t end = (addr | (PREDECODE_BYTES - 1)) + 1;
+    insn_bits_t bits = first->data.insn.bits();
+    for (reg_t pc = addr + insn_length(bits); !ends_straight_line(bits); pc += insn_length(bits)) {
+      if (pc >= end || icache_index(pc) == icache_index(addr))
+        return;
+      bits = from_le(*(const uint16_t*)(host + (pc - addr)));
+      if (pc + insn_length(bits) > end)
+        return;
+      icache_entry_t* set = &icache[icache_index(pc)];
+      size_t way = 0;
+      while (way < icache_ways && set[way].tag != pc)
+        way++;
+      if (way < icache_ways) {
+        bits = set[way].data.insn.bits();
+        continue;
+      }
+      if (unlikely(set[icache_ways - 1].executions))
+        fold_executions(&set[icache_ways - 1]);
+      std::copy_backward(set, set + icache_ways - 1, set + icache_ways);
+      bits = refill_icache(pc, set)->data.insn.bits();
+    }
   }
 
   inline insn_fetch_t load_insn(reg_t addr)
@@ -494,10 +1115,63 @@ public:
     return refill_icache(addr, &entry)->data;
   }
 
+  static const reg_t BLOCK_CACHE_ENTRIES = 1024;
+
+  // With inline_ops, simple integer instructions are also pre-decoded for
+  // execution without their handlers; with fuse_ops, common pairs of them
+  // are also fused into single ops.
+  void enable_block_cache(bool inline_ops, bool fuse_ops = false);
+  bool block_cache_enabled() const { return !blocks.empty(); }
+
+  // Look up the block starting at addr, decoding it on a miss.  The block
+  // is recorded as a successor of prev, which may be null.
+  inline insn_block_t* access_block(reg_t addr, insn_block_t* prev)
+  {
+    insn_block_t* block = &blocks[(addr / PC_ALIGN) % BLOCK_CACHE_ENTRIES];
+    if (unlikely(block->tag != addr))
+      refill_block(addr, block);
+    if (prev)
+      prev->link(block);
+    return block;
+  }
+
   void flush_tlb();
+  // Drops the first-level TLB, which only holds translations for the
+  // current privilege, V, satp, SUM and MXR; call when one of them changes.
+  void flush_tlb_first_level();
+  // The privilege, V or the address space changed, so instructions may be
+  // fetched from elsewhere: drop the first-level TLB and the icache.  The
+  // second-level TLB and the walk cache keep their (tagged) entries.
+  void flush_tlb_context() { flush_tlb_first_level(); flush_icache(); }
+  // sfence.vma, or hfence.vvma if virt: drop the S- or VS-stage
+  // translations of the page of vaddr and/or of address space asid.
+  void fence_vma(bool virt, bool has_addr, reg_t vaddr, bool has_asid, reg_t asid);
+  // hfence.gvma: drop every translation of the guest with the given VMID,
+  // or of all guests.
+  void fence_gvma(bool has_vmid, reg_t vmid);
+  // Drops the cached G-stage translations.
+  void flush_g_stage();
+  // Call when the PMP entries change.
+  void pmp_changed() { pmp_segments.clear(); flush_g_stage(); }
   void flush_icache();
+  // fence.i: drops the decoded instructions whose bytes have changed since
+  // they were decoded, whoever changed them.
+  void flush_modified_icache();
+  // Drops the decoded instructions that were fetched from the page of vaddr.
+  void flush_icache_page(reg_t vaddr);
+  // Hand the execution counts kept in the icache over to the processor.
+  void fold_icache_executions();
+
+  // Copy the code page containing addr for trace consumers that want whole
+  // pages; bytes that are not backed by readable memory read as zero.
+  void copy_insn_page(reg_t addr, uint8_t* dst);
 
   void register_memtracer(memtracer_t*);
+  // Hands the buffered accesses to the tracers.
+  void flush_trace();
+  // While paused the tracers see no accesses, and the pages they wanted
+  // run at full speed from the TLB.
+  void set_tracing_paused(bool paused);
 
   int is_dirty_enabled()
   {
@@ -550,22 +1224,208 @@ private:
   simif_t* sim;
   processor_t* proc;
   memtracer_list_t tracer;
+  bool tracing_paused = false;
+
+  // Traced accesses waiting to be handed over as a batch.
+  static const size_t TRACE_BUF_SIZE = 1024;
+  std::vector<access_record_t> trace_buf;
+  void trace_access(reg_t paddr, size_t len, access_type type, reg_t pc, reg_t vaddr,
+                    const tlb_xlate_t& xlate)
+  {
+    trace_buf.push_back(access_record_t{paddr, (uint32_t)len, type, pc, vaddr,
+                                        xlate.page_shift, xlate.walk_refs});
+    if (trace_buf.size() == TRACE_BUF_SIZE)
+      flush_trace();
+  }
   reg_t load_reservation_address;
+  reg_t load_reservation_value;
   uint16_t fetch_temp;
   uint64_t blocksz;
 
   // implement an instruction cache for simulator performance
-  icache_entry_t icache[ICACHE_ENTRIES];
+  std::vector<icache_entry_t> icache;
+  size_t icache_sets;
+  size_t icache_ways;
+  bool icache_stats = false;
+  reg_t htif_watch_lo = 0;
+  reg_t htif_watch_hi = 0;
+  uint64_t icache_lookups = 0;  // only counted with icache_stats
+  uint64_t icache_misses = 0;
+
+  // decoded basic blocks, allocated only when the block cache is enabled
+  std::vector<insn_block_t> blocks;
+  bool block_inline_ops;
+  bool block_fuse_ops;
+  void refill_block(reg_t addr, insn_block_t* block);
+
+  reg_t breakpoint_pc = -1;
+  std::unordered_set<reg_t> breakpoints;
+  reg_t watch_lo = 0;
+  reg_t watch_hi = 0;
+  static reg_t breakpoint_insn(processor_t* p, insn_t insn, reg_t pc);
+
+  static const insn_bits_t BOOT_DONE_MARKER = 0x00300013;
+  static const insn_bits_t ROI_START_MARKER = 0x00100013;
+  bool marker_stop = false;
+  static reg_t marker_insn(processor_t* p, insn_t insn, reg_t pc);
+  std::vector<insn_bits_t> watched_markers;
+  static reg_t watched_marker_insn(processor_t* p, insn_t insn, reg_t pc);
+
+  std::unordered_map<reg_t, insn_func_t> libc_intercepts;
+  static bool libc_intercept_bypassed(processor_t* p);
+  static reg_t libc_return(processor_t* p, reg_t value, reg_t insns);
+  static reg_t native_memcpy(processor_t* p, insn_t insn, reg_t pc);
+  static reg_t native_memset(processor_t* p, insn_t insn, reg_t pc);
+  static reg_t native_strlen(processor_t* p, insn_t insn, reg_t pc);
+  static reg_t native_memcmp(processor_t* p, insn_t insn, reg_t pc);
+
+  // Plugin instrumentation: an instrumented instruction's handler is
+  // replaced by plugin_insn, which runs its hooks and then the handler
+  // kept here by PC.
+  struct plugin_insn_t {
+    insn_func_t func;
+    plugin_hooks_t hooks;
+  };
+  std::unordered_map<reg_t, plugin_insn_t> plugin_insns;
+  std::unordered_map<reg_t, plugin_hooks_t> plugin_blocks;
+  void instrument_insn(reg_t pc, insn_fetch_t& fetch);
+  void instrument_block(insn_block_t* block);
+  static reg_t plugin_insn(processor_t* p, insn_t insn, reg_t pc);
+  // Have the compressed instruction at pc run on the handler of the 32-bit
+  // instruction it expands to, which decodes its operands from fixed
+  // fields, unless something replaced its handler.
+  void expand_rvc(reg_t pc, insn_fetch_t& fetch);
+
+  // Move the execution count of an icache entry over to the processor.
+  void fold_executions(icache_entry_t* entry);
+
+  inline void check_watchpoint(reg_t addr, reg_t len)
+  {
+    reg_t paddr = tlb_data[tlb_index(addr >> PGSHIFT)].target_offset + addr;
+    if (unlikely(watched(paddr, len)))
+      throw interactive_stop_t();
+  }
 
   // implement a TLB for simulator performance
-  static const reg_t TLB_ENTRIES = 256;
   // If a TLB tag has TLB_CHECK_TRIGGERS set, then the MMU must check for a
   // trigger match before completing an access.
   static const reg_t TLB_CHECK_TRIGGERS = reg_t(1) << 63;
-  tlb_entry_t tlb_data[TLB_ENTRIES];
-  reg_t tlb_insn_tag[TLB_ENTRIES];
-  reg_t tlb_load_tag[TLB_ENTRIES];
-  reg_t tlb_store_tag[TLB_ENTRIES];
+  size_t tlb_entries;
+  std::vector<tlb_entry_t> tlb_data;
+  std::vector<tlb_xlate_t> tlb_xlate;
+  std::vector<reg_t> tlb_insn_tag;
+  std::vector<reg_t> tlb_load_tag;
+  std::vector<reg_t> tlb_store_tag;
+  inline size_t tlb_index(reg_t vpn) { return vpn & (tlb_entries - 1); }
+
+  // Pages the tracers want to see, by access type, tagged and flushed like
+  // the TLB; pages they do not want are simply refilled into the TLB.
+  std::vector<reg_t> tlb_traced_tag[3];
+  // Whether the tracers want to see an access to paddr; cacheable says the
+  // translation of vaddr is the ordinary one, so the answer may be kept.
+  bool traced(reg_t vaddr, reg_t paddr, access_type type, bool cacheable)
+  {
+    reg_t vpn = vaddr >> PGSHIFT;
+    reg_t& tag = tlb_traced_tag[type][tlb_index(vpn)];
+    if (cacheable && tag == vpn)
+      return true;
+    if (tracing_paused || !tracer.interested_in_range(paddr, paddr + (type == FETCH ? 1 : PGSIZE), type))
+      return false;
+    if (cacheable)
+      tag = vpn;
+    return true;
+  }
+
+  // Set if the first-level TLB holds part of a superpage, so that a fence
+  // of one page must drop all of it.
+  bool tlb_superpages;
+  // VPN bits that the leaf of the last translation covered beyond its own
+  // page: nonzero for superpages and Svnapot mappings.
+  unsigned translated_leaf_bits = 0;
+  // The page size and walk cost of the last translation, for the tracers
+  // (see access_record_t), and those of the last G-stage translation.
+  tlb_xlate_t translated_xlate = {};
+  tlb_xlate_t g_stage_xlate = {};
+
+  // What a translation and its permission checks depended on besides the
+  // VPN.  Second-level TLB entries are tagged with it, so they survive
+  // privilege changes and context switches and are only dropped by the
+  // fences that concern them.
+  static const uint8_t TLB_CONTEXT_V = 1 << 2;
+  static const uint8_t TLB_CONTEXT_SUM = 1 << 3;
+  static const uint8_t TLB_CONTEXT_MXR = 1 << 4;
+  struct tlb_context_t {
+    reg_t atp;      // satp, or vsatp if V=1 (mode, ASID and root); 0 in M-mode
+    reg_t hgatp;    // hgatp if V=1 (mode, VMID and root), else 0
+    uint8_t flags;  // privilege | TLB_CONTEXT_*
+
+    bool operator==(const tlb_context_t& other) const
+    {
+      return atp == other.atp && hgatp == other.hgatp && flags == other.flags;
+    }
+  };
+  tlb_context_t tlb_context();
+
+  // A set-associative second-level TLB backs the direct-mapped one above.
+  // It is filled together with it and consulted before walking the page
+  // tables, but keeps translations of other contexts too.
+  struct stlb_entry_t {
+    reg_t vpn;
+    reg_t ppn;
+    tlb_context_t context;
+    uint8_t leaf_bits;  // see translated_leaf_bits
+    uint8_t types;      // bit (1 << access_type) set for each permitted access
+    tlb_xlate_t xlate;
+  };
+  std::vector<stlb_entry_t> stlb;
+  size_t stlb_sets;
+  size_t stlb_ways;
+  bool stlb_lookup(reg_t vpn, const tlb_context_t& context, access_type type, reg_t* ppn);
+  void stlb_insert(reg_t vpn, reg_t ppn, access_type type);
+
+  // The walk cache remembers, for the upper levels of recent walks, the
+  // base of the table the next level reads, so that a walk can start at
+  // the deepest level it has seen for the same root and VA prefix.  It is
+  // flushed by sfence.vma and hfence, and by hgatp writes.
+  struct walk_cache_entry_t {
+    reg_t root;     // -1 if invalid
+    reg_t prefix;   // VA bits above the level
+    int level;
+    bool virt;
+    reg_t base;
+  };
+  std::vector<walk_cache_entry_t> walk_cache;
+  uint64_t walk_cache_hits = 0;
+  walk_cache_entry_t& walk_cache_slot(reg_t root, reg_t prefix, int level)
+  {
+    return walk_cache[(prefix ^ root ^ level) & (walk_cache.size() - 1)];
+  }
+
+  // The G-stage cache holds recent guest-physical to host-physical page
+  // translations, tagged by the whole hgatp (mode, VMID and root), with the
+  // leaf PTE so that the permission checks can be redone on a hit.  Unlike
+  // the walk cache it survives sfence.vma, hfence.vvma and hgatp writes,
+  // and is only flushed by hfence.gvma and PMP changes.
+  struct g_stage_entry_t {
+    reg_t hgatp;
+    reg_t gpn;      // -1 if invalid
+    reg_t hppn;
+    reg_t pte;
+    tlb_xlate_t xlate;
+  };
+  std::vector<g_stage_entry_t> g_stage_cache;
+  uint64_t g_stage_cache_hits = 0;
+  g_stage_entry_t& g_stage_slot(reg_t hgatp, reg_t gpn)
+  {
+    return g_stage_cache[(gpn ^ hgatp) & (g_stage_cache.size() - 1)];
+  }
+
+  struct tlb_stats_t {
+    uint64_t misses;  // translations that missed the first-level TLB
+    uint64_t stlb_hits;
+  };
+  bool tlb_stats = false;
+  tlb_stats_t tlb_type_stats[3] = {};
 
   // finish translation on a TLB miss and update the TLB
   tlb_entry_t refill_tlb(reg_t vaddr, reg_t paddr, char* host_addr, access_type type);
@@ -589,16 +1449,16 @@ private:
   // ITLB lookup
   inline tlb_entry_t translate_insn_addr(reg_t addr) {
     reg_t vpn = addr >> PGSHIFT;
-    if (likely(tlb_insn_tag[vpn % TLB_ENTRIES] == vpn))
-      return tlb_data[vpn % TLB_ENTRIES];
+    if (likely(tlb_insn_tag[tlb_index(vpn)] == vpn))
+      return tlb_data[tlb_index(vpn)];
     tlb_entry_t result;
-    if (unlikely(tlb_insn_tag[vpn % TLB_ENTRIES] != (vpn | TLB_CHECK_TRIGGERS))) {
+    if (unlikely(tlb_insn_tag[tlb_index(vpn)] != (vpn | TLB_CHECK_TRIGGERS))) {
       result = fetch_slow_path(addr);
     } else {
-      result = tlb_data[vpn % TLB_ENTRIES];
+      result = tlb_data[tlb_index(vpn)];
     }
-    if (unlikely(tlb_insn_tag[vpn % TLB_ENTRIES] == (vpn | TLB_CHECK_TRIGGERS))) {
-      target_endian<uint16_t>* ptr = (target_endian<uint16_t>*)(tlb_data[vpn % TLB_ENTRIES].host_offset + addr);
+    if (unlikely(tlb_insn_tag[tlb_index(vpn)] == (vpn | TLB_CHECK_TRIGGERS))) {
+      target_endian<uint16_t>* ptr = (target_endian<uint16_t>*)(tlb_data[tlb_index(vpn)].host_offset + addr);
       triggers::action_t action;
       auto match = proc->TM.memory_access_match(&action, triggers::OPERATION_EXECUTE, addr, from_target(*ptr));
       if (match != triggers::MATCH_NONE) {
@@ -630,6 +1490,19 @@ private:
 
   reg_t pmp_homogeneous(reg_t addr, reg_t len);
   bool pmp_ok(reg_t addr, reg_t len, access_type type, reg_t mode);
+  bool pmp_default_ok(access_type type, reg_t mode);
+
+  // The physical address space cut where any PMP entry begins or ends, in
+  // ascending order.  Each segment runs up to the start of the next one
+  // and records the first entry that matches it, or -1.  Built on demand.
+  struct pmp_segment_t {
+    reg_t start;
+    int entry;
+  };
+  std::vector<pmp_segment_t> pmp_segments;
+  void build_pmp_segments();
+  // The segment containing addr, and in *end its last address.
+  const pmp_segment_t& find_pmp_segment(reg_t addr, reg_t* end);
 
 #ifdef RISCV_ENABLE_DUAL_ENDIAN
   bool target_big_endian;
@@ -0,0 +1,201 @@
+#include "devices.h"
+#include "term.h"
+#include <cerrno>
+#include <unistd.h>
+
+#define UART_RBR	0  // receive buffer, when read with DLAB clear
+#define UART_THR	0  // transmit holding, when written with DLAB clear
+#define UART_DLL	0  // divisor latch low, with DLAB set
+#define UART_IER	1
+#define UART_DLM	1  // divisor latch high, with DLAB set
+#define UART_IIR	2  // read
+#define UART_FCR	2  // write
+#define UART_LCR	3
+#define UART_MCR	4
+#define UART_LSR	5
+#define UART_MSR	6
+#define UART_SCR	7
+
+#define UART_IER_RDI	0x01
+#define UART_IER_THRI	0x02
+
+#define UART_IIR_NO_INT	0x01
+#define UART_IIR_THRI	0x02
+#define UART_IIR_RDI	0x04
+#define UART_IIR_FIFO	0xc0
+
+#define UART_FCR_ENABLE	0x01
+#define UART_FCR_CLEAR_RCVR	0x02
+
+#define UART_LCR_DLAB	0x80
+
+#define UART_LSR_DR	0x01
+#define UART_LSR_THRE	0x20
+#define UART_LSR_TEMT	0x40
+
+// Carrier detect, data set ready and clear to send: a line always up.
+#define UART_MSR_CONNECTED	0xb0
+
+ns16550_t::ns16550_t(const std::string& args)
+  : plic(NULL), irq(0), dll(0), dlm(0), ier(0), lcr(0), mcr(0), scr(0),
+    fifo_enabled(false), thre_pending(false), quanta(0), writer_exit(false)
+{
+  writer = std::thread(&ns16550_t::writer_main, this);
+}
+
+ns16550_t::~ns16550_t()
+{
+  flush_output();
+  {
+    std::lock_guard<std::mutex> guard(writer_lock);
+    writer_exit = true;
+  }
+  writer_ready.notify_one();
+  writer.join();
+}
+
+void ns16550_t::attach(plic_t* plic, uint32_t irq)
+{
+  this->plic = plic;
+  this->irq = irq;
+}
+
+void ns16550_t::update_interrupt()
+{
+  bool level = ((ier & UART_IER_RDI) && !rx_fifo.empty()) ||
+               ((ier & UART_IER_THRI) && thre_pending);
+  if (plic)
+    plic->set_interrupt_level(irq, level);
+}
+
+bool ns16550_t::load(reg_t addr, size_t len, uint8_t* bytes)
+{
+  if (len != 1 || addr > UART_SCR)
+    return false;
+
+  bool dlab = lcr & UART_LCR_DLAB;
+  uint8_t val = 0;
+  switch (addr) {
+    case UART_RBR:
+      if (dlab) {
+        val = dll;
+      } else if (!rx_fifo.empty()) {
+        val = rx_fifo.front();
+        rx_fifo.pop_front();
+      }
+      break;
+    case UART_IER:
+      val = dlab ? dlm : ier;
+      break;
+    case UART_IIR:
+      if ((ier & UART_IER_RDI) && !rx_fifo.empty()) {
+        val = UART_IIR_RDI;
+      } else if ((ier & UART_IER_THRI) && thre_pending) {
+        val = UART_IIR_THRI;
+        thre_pending = false;
+      } else {
+        val = UART_IIR_NO_INT;
+      }
+      if (fifo_enabled)
+        val |= UART_IIR_FIFO;
+      break;
+    case UART_LCR: val = lcr; break;
+    case UART_MCR: val = mcr; break;
+    case UART_LSR:
+      val = UART_LSR_THRE | UART_LSR_TEMT | (rx_fifo.empty() ? 0 : UART_LSR_DR);
+      break;
+    case UART_MSR: val = UART_MSR_CONNECTED; break;
+    case UART_SCR: val = scr; break;
+  }
+  update_interrupt();
+  bytes[0] = val;
+  return true;
+}
+
+bool ns16550_t::store(reg_t addr, size_t len, const uint8_t* bytes)
+{
+  if (len != 1 || addr > UART_SCR)
+    return false;
+
+  bool dlab = lcr & UART_LCR_DLAB;
+  uint8_t val = bytes[0];
+  switch (addr) {
+    case UART_THR:
+      if (dlab) {
+        dll = val;
+      } else {
+        // The byte leaves at once, so the holding register is empty again.
+        output.push_back(val);
+        if (output.size() >= OUTPUT_FLUSH_BYTES)
+          flush_output();
+        thre_pending = true;
+      }
+      break;
+    case UART_IER:
+      if (dlab) {
+        dlm = val;
+      } else {
+        if ((val & UART_IER_THRI) && !(ier & UART_IER_THRI))
+          thre_pending = true;
+        ier = val & 0x0f;
+      }
+      break;
+    case UART_FCR:
+      fifo_enabled = val & UART_FCR_ENABLE;
+      if (val & UART_FCR_CLEAR_RCVR)
+        rx_fifo.clear();
+      break;
+    case UART_LCR: lcr = val; break;
+    case UART_MCR: mcr = val; break;
+    case UART_SCR: scr = val; break;
+  }
+  update_interrupt();
+  return true;
+}
+
+void ns16550_t::tick(reg_t cycles)
+{
+  flush_output();
+
+  if (++quanta % POLL_INTERVAL != 0)
+    return;
+  int ch;
+  while (rx_fifo.size() < RX_FIFO_SIZE && (ch = canonical_terminal_t::read()) != -1)
+    rx_fifo.push_back(ch);
+  update_interrupt();
+}
+
+void ns16550_t::flush_output()
+{
+  if (output.empty())
+    return;
+  {
+    std::lock_guard<std::mutex> guard(writer_lock);
+    writing += output;
+  }
+  output.clear();
+  writer_ready.notify_one();
+}
+
+void ns16550_t::writer_main()
+{
+  std::unique_lock<std::mutex> guard(writer_lock);
+  while (true) {
+    writer_ready.wait(guard, [&]{ return writer_exit || !writing.empty(); });
+    if (writing.empty())
+      return;
+
+    std::string buf;
+    buf.swap(writing);
+    guard.unlock();
+    for (size_t done = 0; done < buf.size(); ) {
+      ssize_t n = ::write(1, buf.data() + done, buf.size() - done);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        break;
+      done += n;
+    }
+    guard.lock();
+  }
+}
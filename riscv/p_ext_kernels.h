@@ -0,0 +1,264 @@
+// See LICENSE for license details.
+#ifndef _RISCV_P_EXT_KERNELS_H
+#define _RISCV_P_EXT_KERNELS_H
+
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+#if defined(__x86_64__) && defined(__SSE2__)
+#include <emmintrin.h>
+#define PK_SSE2
+#endif
+
+// Whole-register kernels for the most common packed-SIMD instructions.
+// Each operates on all the 8-, 16- or 32-bit lanes of a 64-bit register at
+// once: with SSE2, which every x86-64 host has, as one or two host
+// instructions, elsewhere with a plain loop over the lanes.  For RV32 the
+// callers pass zero-extended registers, so the upper lanes never saturate,
+// and sign-extend the result.  The P_LOOP bodies in the instruction files
+// remain the reference; define P_EXT_SCALAR to build with those instead.
+
+#ifdef PK_SSE2
+static inline __m128i pk_in(uint64_t x) { return _mm_cvtsi64_si128(x); }
+static inline uint64_t pk_out(__m128i x) { return _mm_cvtsi128_si64(x); }
+
+// Flips the sign bit of each lane, which turns unsigned order into signed
+// order and back.
+static inline __m128i pk_flip8(__m128i x) { return _mm_xor_si128(x, _mm_set1_epi8(INT8_MIN)); }
+static inline __m128i pk_flip16(__m128i x) { return _mm_xor_si128(x, _mm_set1_epi16(INT16_MIN)); }
+
+// Whether the saturating result r differs from the wrapping one w.
+static inline bool pk_saturated8(__m128i r, __m128i w)
+{
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(r, w)) != 0xffff;
+}
+static inline bool pk_saturated16(__m128i r, __m128i w)
+{
+  return _mm_movemask_epi8(_mm_cmpeq_epi16(r, w)) != 0xffff;
+}
+#else
+// Returns the lanes f(a[i], b[i]) for lanes of type T.
+template<typename T, typename F>
+static inline uint64_t pk_lanes(uint64_t a, uint64_t b, F f)
+{
+  typedef typename std::make_unsigned<T>::type UT;
+  const int bits = sizeof(T) * 8;
+  uint64_t r = 0;
+  for (int i = 0; i < 64; i += bits)
+    r |= uint64_t(UT(f(T(a >> i), T(b >> i)))) << i;
+  return r;
+}
+
+template<typename T>
+static inline T pk_clamp(int64_t x, bool* sat)
+{
+  const int64_t lo = std::numeric_limits<T>::min(), hi = std::numeric_limits<T>::max();
+  if (x < lo || x > hi) {
+    *sat = true;
+    return x < lo ? lo : hi;
+  }
+  return x;
+}
+
+static const uint64_t PK_H8 = 0x8080808080808080;
+static const uint64_t PK_H16 = 0x8000800080008000;
+#endif
+
+// add8, add16, sub8, sub16: wrapping.
+#ifdef PK_SSE2
+static inline uint64_t pk_add8(uint64_t a, uint64_t b) { return pk_out(_mm_add_epi8(pk_in(a), pk_in(b))); }
+static inline uint64_t pk_add16(uint64_t a, uint64_t b) { return pk_out(_mm_add_epi16(pk_in(a), pk_in(b))); }
+static inline uint64_t pk_sub8(uint64_t a, uint64_t b) { return pk_out(_mm_sub_epi8(pk_in(a), pk_in(b))); }
+static inline uint64_t pk_sub16(uint64_t a, uint64_t b) { return pk_out(_mm_sub_epi16(pk_in(a), pk_in(b))); }
+#else
+// Adds the lanes without their top bits, so that no carry crosses a lane,
+// then puts the top bits back.
+static inline uint64_t pk_add8(uint64_t a, uint64_t b) { return ((a & ~PK_H8) + (b & ~PK_H8)) ^ ((a ^ b) & PK_H8); }
+static inline uint64_t pk_add16(uint64_t a, uint64_t b) { return ((a & ~PK_H16) + (b & ~PK_H16)) ^ ((a ^ b) & PK_H16); }
+static inline uint64_t pk_sub8(uint64_t a, uint64_t b) { return ((a | PK_H8) - (b & ~PK_H8)) ^ ((a ^ ~b) & PK_H8); }
+static inline uint64_t pk_sub16(uint64_t a, uint64_t b) { return ((a | PK_H16) - (b & ~PK_H16)) ^ ((a ^ ~b) & PK_H16); }
+#endif
+
+// kadd, ksub (signed) and ukadd, uksub (unsigned): saturating.  Each sets
+// *sat if any lane saturated and leaves it alone otherwise.
+#ifdef PK_SSE2
+#define PK_SAT_KERNEL(NAME, BIT, SAT_OP, WRAP_OP) \
+  static inline uint64_t NAME(uint64_t a, uint64_t b, bool* sat) \
+  { \
+    __m128i r = SAT_OP(pk_in(a), pk_in(b)); \
+    if (pk_saturated##BIT(r, WRAP_OP(pk_in(a), pk_in(b)))) \
+      *sat = true; \
+    return pk_out(r); \
+  }
+PK_SAT_KERNEL(pk_kadd8, 8, _mm_adds_epi8, _mm_add_epi8)
+PK_SAT_KERNEL(pk_kadd16, 16, _mm_adds_epi16, _mm_add_epi16)
+PK_SAT_KERNEL(pk_ksub8, 8, _mm_subs_epi8, _mm_sub_epi8)
+PK_SAT_KERNEL(pk_ksub16, 16, _mm_subs_epi16, _mm_sub_epi16)
+PK_SAT_KERNEL(pk_ukadd8, 8, _mm_adds_epu8, _mm_add_epi8)
+PK_SAT_KERNEL(pk_ukadd16, 16, _mm_adds_epu16, _mm_add_epi16)
+PK_SAT_KERNEL(pk_uksub8, 8, _mm_subs_epu8, _mm_sub_epi8)
+PK_SAT_KERNEL(pk_uksub16, 16, _mm_subs_epu16, _mm_sub_epi16)
+#else
+#define PK_SAT_KERNEL(NAME, T, OP) \
+  static inline uint64_t NAME(uint64_t a, uint64_t b, bool* sat) \
+  { \
+    return pk_lanes<T>(a, b, [sat](T x, T y) { return pk_clamp<T>(int64_t(x) OP int64_t(y), sat); }); \
+  }
+PK_SAT_KERNEL(pk_kadd8, int8_t, +)
+PK_SAT_KERNEL(pk_kadd16, int16_t, +)
+PK_SAT_KERNEL(pk_ksub8, int8_t, -)
+PK_SAT_KERNEL(pk_ksub16, int16_t, -)
+PK_SAT_KERNEL(pk_ukadd8, uint8_t, +)
+PK_SAT_KERNEL(pk_ukadd16, uint16_t, +)
+PK_SAT_KERNEL(pk_uksub8, uint8_t, -)
+PK_SAT_KERNEL(pk_uksub16, uint16_t, -)
+#endif
+#undef PK_SAT_KERNEL
+
+// cmpeq, scmplt, scmple, ucmplt, ucmple: all ones in each lane where the
+// comparison holds, zero elsewhere.
+#ifdef PK_SSE2
+static inline uint64_t pk_cmpeq8(uint64_t a, uint64_t b) { return pk_out(_mm_cmpeq_epi8(pk_in(a), pk_in(b))); }
+static inline uint64_t pk_cmpeq16(uint64_t a, uint64_t b) { return pk_out(_mm_cmpeq_epi16(pk_in(a), pk_in(b))); }
+static inline uint64_t pk_scmplt8(uint64_t a, uint64_t b) { return pk_out(_mm_cmplt_epi8(pk_in(a), pk_in(b))); }
+static inline uint64_t pk_scmplt16(uint64_t a, uint64_t b) { return pk_out(_mm_cmplt_epi16(pk_in(a), pk_in(b))); }
+static inline uint64_t pk_scmple8(uint64_t a, uint64_t b) { return ~pk_out(_mm_cmpgt_epi8(pk_in(a), pk_in(b))); }
+static inline uint64_t pk_scmple16(uint64_t a, uint64_t b) { return ~pk_out(_mm_cmpgt_epi16(pk_in(a), pk_in(b))); }
+static inline uint64_t pk_ucmplt8(uint64_t a, uint64_t b) { return pk_out(_mm_cmplt_epi8(pk_flip8(pk_in(a)), pk_flip8(pk_in(b)))); }
+static inline uint64_t pk_ucmplt16(uint64_t a, uint64_t b) { return pk_out(_mm_cmplt_epi16(pk_flip16(pk_in(a)), pk_flip16(pk_in(b)))); }
+static inline uint64_t pk_ucmple8(uint64_t a, uint64_t b) { return ~pk_out(_mm_cmpgt_epi8(pk_flip8(pk_in(a)), pk_flip8(pk_in(b)))); }
+static inline uint64_t pk_ucmple16(uint64_t a, uint64_t b) { return ~pk_out(_mm_cmpgt_epi16(pk_flip16(pk_in(a)), pk_flip16(pk_in(b)))); }
+#else
+#define PK_CMP_KERNEL(NAME, T, OP) \
+  static inline uint64_t NAME(uint64_t a, uint64_t b) \
+  { \
+    return pk_lanes<T>(a, b, [](T x, T y) { return x OP y ? T(-1) : T(0); }); \
+  }
+PK_CMP_KERNEL(pk_cmpeq8, int8_t, ==)
+PK_CMP_KERNEL(pk_cmpeq16, int16_t, ==)
+PK_CMP_KERNEL(pk_scmplt8, int8_t, <)
+PK_CMP_KERNEL(pk_scmplt16, int16_t, <)
+PK_CMP_KERNEL(pk_scmple8, int8_t, <=)
+PK_CMP_KERNEL(pk_scmple16, int16_t, <=)
+PK_CMP_KERNEL(pk_ucmplt8, uint8_t, <)
+PK_CMP_KERNEL(pk_ucmplt16, uint16_t, <)
+PK_CMP_KERNEL(pk_ucmple8, uint8_t, <=)
+PK_CMP_KERNEL(pk_ucmple16, uint16_t, <=)
+#undef PK_CMP_KERNEL
+#endif
+
+// smax, smin, umax, umin.  SSE2 only has signed 16-bit and unsigned 8-bit
+// min and max; the other two widths flip the sign bits around them.
+#ifdef PK_SSE2
+static inline uint64_t pk_smax8(uint64_t a, uint64_t b) { return pk_out(pk_flip8(_mm_max_epu8(pk_flip8(pk_in(a)), pk_flip8(pk_in(b))))); }
+static inline uint64_t pk_smin8(uint64_t a, uint64_t b) { return pk_out(pk_flip8(_mm_min_epu8(pk_flip8(pk_in(a)), pk_flip8(pk_in(b))))); }
+static inline uint64_t pk_smax16(uint64_t a, uint64_t b) { return pk_out(_mm_max_epi16(pk_in(a), pk_in(b))); }
+static inline uint64_t pk_smin16(uint64_t a, uint64_t b) { return pk_out(_mm_min_epi16(pk_in(a), pk_in(b))); }
+static inline uint64_t pk_umax8(uint64_t a, uint64_t b) { return pk_out(_mm_max_epu8(pk_in(a), pk_in(b))); }
+static inline uint64_t pk_umin8(uint64_t a, uint64_t b) { return pk_out(_mm_min_epu8(pk_in(a), pk_in(b))); }
+static inline uint64_t pk_umax16(uint64_t a, uint64_t b) { return pk_out(pk_flip16(_mm_max_epi16(pk_flip16(pk_in(a)), pk_flip16(pk_in(b))))); }
+static inline uint64_t pk_umin16(uint64_t a, uint64_t b) { return pk_out(pk_flip16(_mm_min_epi16(pk_flip16(pk_in(a)), pk_flip16(pk_in(b))))); }
+#else
+#define PK_MINMAX_KERNEL(NAME, T, OP) \
+  static inline uint64_t NAME(uint64_t a, uint64_t b) \
+  { \
+    return pk_lanes<T>(a, b, [](T x, T y) { return x OP y ? x : y; }); \
+  }
+PK_MINMAX_KERNEL(pk_smax8, int8_t, >)
+PK_MINMAX_KERNEL(pk_smin8, int8_t, <)
+PK_MINMAX_KERNEL(pk_smax16, int16_t, >)
+PK_MINMAX_KERNEL(pk_smin16, int16_t, <)
+PK_MINMAX_KERNEL(pk_umax8, uint8_t, >)
+PK_MINMAX_KERNEL(pk_umin8, uint8_t, <)
+PK_MINMAX_KERNEL(pk_umax16, uint16_t, >)
+PK_MINMAX_KERNEL(pk_umin16, uint16_t, <)
+#undef PK_MINMAX_KERNEL
+#endif
+
+// The multiply-accumulate reductions into the two 32-bit lanes of acc:
+// smaqa, umaqa and smaqa.su add the four products of the corresponding
+// bytes, wrapping; kmda and kmada add the two products of the
+// corresponding halfwords, saturating, and set *sat as above.  The
+// wrapping ones never saturate.  kmda is kmada with an acc of zero.
+#ifdef PK_SSE2
+// Sums adjacent pairs of the four 32-bit lanes of p into the two low lanes
+// and adds acc to them.
+static inline uint64_t pk_accumulate_pairs(uint64_t acc, __m128i p)
+{
+  p = _mm_add_epi32(p, _mm_srli_epi64(p, 32));
+  p = _mm_shuffle_epi32(p, _MM_SHUFFLE(3, 1, 2, 0));
+  return pk_out(_mm_add_epi32(pk_in(acc), p));
+}
+
+// Widen the eight bytes of x to halfwords.
+static inline __m128i pk_widen_s8(uint64_t x) { return _mm_srai_epi16(_mm_unpacklo_epi8(pk_in(x), pk_in(x)), 8); }
+static inline __m128i pk_widen_u8(uint64_t x) { return _mm_unpacklo_epi8(pk_in(x), _mm_setzero_si128()); }
+
+static inline uint64_t pk_smaqa(uint64_t acc, uint64_t a, uint64_t b, bool*)
+{
+  return pk_accumulate_pairs(acc, _mm_madd_epi16(pk_widen_s8(a), pk_widen_s8(b)));
+}
+static inline uint64_t pk_umaqa(uint64_t acc, uint64_t a, uint64_t b, bool*)
+{
+  return pk_accumulate_pairs(acc, _mm_madd_epi16(pk_widen_u8(a), pk_widen_u8(b)));
+}
+static inline uint64_t pk_smaqa_su(uint64_t acc, uint64_t a, uint64_t b, bool*)
+{
+  return pk_accumulate_pairs(acc, _mm_madd_epi16(pk_widen_s8(a), pk_widen_u8(b)));
+}
+
+// The pair of products in each 32-bit lane of _mm_madd_epi16 only wraps
+// when all four halfwords are INT16_MIN, to INT32_MIN, which is otherwise
+// out of its range; the true sum is then 2^31.
+static inline int64_t pk_madd_lane(__m128i p, int lane)
+{
+  int32_t x = lane ? _mm_cvtsi128_si32(_mm_srli_epi64(p, 32)) : _mm_cvtsi128_si32(p);
+  return x == INT32_MIN ? -int64_t(INT32_MIN) : x;
+}
+
+static inline uint64_t pk_kmada(uint64_t acc, uint64_t a, uint64_t b, bool* sat)
+{
+  __m128i p = _mm_madd_epi16(pk_in(a), pk_in(b));
+  uint64_t r = 0;
+  for (int i = 0; i < 2; i++) {
+    int64_t x = int64_t(int32_t(acc >> (i * 32))) + pk_madd_lane(p, i);
+    if (x > INT32_MAX || x < INT32_MIN) {
+      *sat = true;
+      x = x > INT32_MAX ? INT32_MAX : INT32_MIN;
+    }
+    r |= uint64_t(uint32_t(x)) << (i * 32);
+  }
+  return r;
+}
+#else
+template<typename T1, typename T2>
+static inline uint64_t pk_maqa(uint64_t acc, uint64_t a, uint64_t b)
+{
+  uint64_t r = 0;
+  for (int i = 0; i < 64; i += 32) {
+    uint32_t x = acc >> i;
+    for (int j = i; j < i + 32; j += 8)
+      x += int32_t(T1(a >> j)) * int32_t(T2(b >> j));
+    r |= uint64_t(x) << i;
+  }
+  return r;
+}
+
+static inline uint64_t pk_smaqa(uint64_t acc, uint64_t a, uint64_t b, bool*) { return pk_maqa<int8_t, int8_t>(acc, a, b); }
+static inline uint64_t pk_umaqa(uint64_t acc, uint64_t a, uint64_t b, bool*) { return pk_maqa<uint8_t, uint8_t>(acc, a, b); }
+static inline uint64_t pk_smaqa_su(uint64_t acc, uint64_t a, uint64_t b, bool*) { return pk_maqa<int8_t, uint8_t>(acc, a, b); }
+
+static inline uint64_t pk_kmada(uint64_t acc, uint64_t a, uint64_t b, bool* sat)
+{
+  uint64_t r = 0;
+  for (int i = 0; i < 64; i += 32) {
+    int64_t x = int32_t(acc >> i);
+    x += int64_t(int16_t(a >> i)) * int16_t(b >> i);
+    x += int64_t(int16_t(a >> (i + 16))) * int16_t(b >> (i + 16));
+    r |= uint64_t(uint32_t(pk_clamp<int32_t>(x, sat))) << i;
+  }
+  return r;
+}
+#endif
+
+#endif
@@ -368,6 +368,47 @@
   BODY \
   P_REDUCTION_LOOP_END(BIT, IS_SAT)
 
+// The same as P_LOOP, P_ULOOP and P_REDUCTION_LOOP, but run KERNEL from
+// p_ext_kernels.h on whole registers instead of BODY lane by lane, unless
+// P_EXT_SCALAR is defined.  The SAT forms pass the kernel a flag to set
+// when a lane saturates.
+#ifdef P_EXT_SCALAR
+#define P_LOOP_KERNEL(BIT, KERNEL, BODY) P_LOOP(BIT, BODY)
+#define P_ULOOP_KERNEL(BIT, KERNEL, BODY) P_ULOOP(BIT, BODY)
+#define P_LOOP_SAT_KERNEL(BIT, KERNEL, BODY) P_LOOP(BIT, BODY)
+#define P_ULOOP_SAT_KERNEL(BIT, KERNEL, BODY) P_ULOOP(BIT, BODY)
+#define P_REDUCTION_LOOP_KERNEL(BIT, BIT_INNER, USE_RD, IS_SAT, KERNEL, BODY) \
+  P_REDUCTION_LOOP(BIT, BIT_INNER, USE_RD, IS_SAT, BODY)
+#define P_REDUCTION_ULOOP_KERNEL(BIT, BIT_INNER, USE_RD, IS_SAT, KERNEL, BODY) \
+  P_REDUCTION_ULOOP(BIT, BIT_INNER, USE_RD, IS_SAT, BODY)
+#define P_REDUCTION_SULOOP_KERNEL(BIT, BIT_INNER, USE_RD, IS_SAT, KERNEL, BODY) \
+  P_REDUCTION_SULOOP(BIT, BIT_INNER, USE_RD, IS_SAT, BODY)
+#else
+#define P_LOOP_KERNEL(BIT, KERNEL, BODY) \
+  require_extension(EXT_ZPN); \
+  WRITE_RD(sext_xlen(KERNEL(zext_xlen(RS1), zext_xlen(RS2))));
+#define P_ULOOP_KERNEL(BIT, KERNEL, BODY) P_LOOP_KERNEL(BIT, KERNEL, BODY)
+#define P_LOOP_SAT_KERNEL(BIT, KERNEL, BODY) { \
+  require_extension(EXT_ZPN); \
+  bool sat = false; \
+  reg_t rd_tmp = KERNEL(zext_xlen(RS1), zext_xlen(RS2), &sat); \
+  P_SET_OV(sat); \
+  WRITE_RD(sext_xlen(rd_tmp)); \
+}
+#define P_ULOOP_SAT_KERNEL(BIT, KERNEL, BODY) P_LOOP_SAT_KERNEL(BIT, KERNEL, BODY)
+#define P_REDUCTION_LOOP_KERNEL(BIT, BIT_INNER, USE_RD, IS_SAT, KERNEL, BODY) { \
+  require_extension(EXT_ZPN); \
+  bool sat = false; \
+  reg_t rd_tmp = KERNEL(USE_RD ? zext_xlen(RD) : 0, zext_xlen(RS1), zext_xlen(RS2), &sat); \
+  P_SET_OV(sat); \
+  WRITE_RD(sext_xlen(rd_tmp)); \
+}
+#define P_REDUCTION_ULOOP_KERNEL(BIT, BIT_INNER, USE_RD, IS_SAT, KERNEL, BODY) \
+  P_REDUCTION_LOOP_KERNEL(BIT, BIT_INNER, USE_RD, IS_SAT, KERNEL, BODY)
+#define P_REDUCTION_SULOOP_KERNEL(BIT, BIT_INNER, USE_RD, IS_SAT, KERNEL, BODY) \
+  P_REDUCTION_LOOP_KERNEL(BIT, BIT_INNER, USE_RD, IS_SAT, KERNEL, BODY)
+#endif
+
 #define P_LOOP_END() \
   } \
   WRITE_RD(sext_xlen(rd_tmp));
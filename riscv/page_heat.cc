@@ -0,0 +1,84 @@
+// See LICENSE for license details.
+
+#include "page_heat.h"
+#include "mmu.h"
+#include <algorithm>
+#include <cinttypes>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+page_heat_t::page_heat_t(const char* filename, uint64_t epoch, uint64_t flush_period, bool exact)
+  : epoch(epoch), flush_period(flush_period), is_exact(exact),
+    next_epoch(epoch), next_flush(exact ? UINT64_MAX : flush_period)
+{
+  file = nullptr;
+  if (!filename)
+    return;
+  file = fopen(filename, "w");
+  if (!file)
+    throw std::runtime_error(std::string("could not open page heat file ") + filename);
+  fprintf(file, "epoch,page,count\n");
+}
+
+page_heat_t::~page_heat_t()
+{
+  // The last, partial epoch, of which the hook's owner may be gone
+  epoch_hook = nullptr;
+  write_epoch();
+  if (file)
+    fclose(file);
+}
+
+uint64_t page_heat_t::insns_until_due(uint64_t instret) const
+{
+  uint64_t due = std::min(next_epoch, next_flush);
+  return due > instret ? due - instret : 0;
+}
+
+bool page_heat_t::advance(uint64_t instret)
+{
+  if (instret >= next_epoch) {
+    write_epoch();
+    epoch_index++;
+    next_epoch = instret - instret % epoch + epoch;
+  }
+  if (instret < next_flush)
+    return false;
+  next_flush = instret - instret % flush_period + flush_period;
+  return true;
+}
+
+void page_heat_t::refill(reg_t paddr)
+{
+  counts[paddr >> PGSHIFT]++;
+}
+
+void page_heat_t::trace(uint64_t addr, size_t bytes, access_type type)
+{
+  counts[addr >> PGSHIFT]++;
+}
+
+void page_heat_t::trace_batch(const access_record_t* recs, size_t n)
+{
+  for (size_t i = 0; i < n; i++)
+    counts[recs[i].addr >> PGSHIFT]++;
+}
+
+void page_heat_t::write_epoch()
+{
+  if (counts.empty())
+    return;
+  if (epoch_hook)
+    epoch_hook(counts);
+  if (!file) {
+    counts.clear();
+    return;
+  }
+  std::vector<std::pair<reg_t, uint64_t>> pages(counts.begin(), counts.end());
+  std::sort(pages.begin(), pages.end());
+  for (auto& page : pages)
+    fprintf(file, "%" PRIu64 ",0x%" PRIx64 ",%" PRIu64 "\n",
+            epoch_index, uint64_t(page.first << PGSHIFT), page.second);
+  counts.clear();
+}
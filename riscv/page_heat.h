@@ -0,0 +1,63 @@
+// See LICENSE for license details.
+#ifndef _RISCV_PAGE_HEAT_H
+#define _RISCV_PAGE_HEAT_H
+
+#include "decode.h"
+#include "memtracer.h"
+#include <cstdio>
+#include <functional>
+#include <unordered_map>
+
+// Counts how often each physical page is touched in each epoch of hart 0's
+// instructions and writes the counts as CSV lines of epoch,page,count, the
+// pages of an epoch in address order and untouched pages left out.
+//
+// By default the count is of first-level TLB refills: every flush period
+// instructions sim_t::step flushes the harts' TLBs, so a page is counted
+// once for each flush period it is used in, and again for each time it is
+// evicted and used again.  That costs a hash update per refill.  The exact
+// mode instead registers as a memtracer on every hart and counts each
+// access, at the cost of tracing them all.
+class page_heat_t : public memtracer_t
+{
+public:
+  // With no filename the counts are only handed to the epoch hook.
+  page_heat_t(const char* filename, uint64_t epoch, uint64_t flush_period, bool exact);
+  ~page_heat_t();
+
+  typedef std::unordered_map<reg_t, uint64_t> counts_t;  // by physical page number
+  // Called with the counts of each epoch, the pages touched in it, as it
+  // ends.
+  void set_epoch_hook(std::function<void(const counts_t&)> hook) { epoch_hook = hook; }
+
+  bool exact() const { return is_exact; }
+
+  // How many more instructions hart 0 may retire before the next TLB
+  // flush or epoch boundary
+  uint64_t insns_until_due(uint64_t instret) const;
+  // Ends the epoch if hart 0 has reached its end, and returns whether the
+  // TLBs are due to be flushed.
+  bool advance(uint64_t instret);
+
+  void refill(reg_t paddr);
+
+  bool interested_in_range(uint64_t begin, uint64_t end, access_type type) { return is_exact; }
+  void trace(uint64_t addr, size_t bytes, access_type type);
+  void clean_invalidate(uint64_t addr, size_t bytes, bool clean, bool inval) {}
+  void trace_batch(const access_record_t* recs, size_t n);
+
+private:
+  void write_epoch();
+
+  FILE* file;
+  uint64_t epoch;
+  uint64_t flush_period;
+  bool is_exact;
+  uint64_t epoch_index = 0;
+  uint64_t next_epoch;
+  uint64_t next_flush;
+  counts_t counts;
+  std::function<void(const counts_t&)> epoch_hook;
+};
+
+#endif
@@ -0,0 +1,91 @@
+// See LICENSE for license details.
+
+#include "pc_sampler.h"
+#include "processor.h"
+#include "mmu.h"
+#include "simif.h"
+#include <cinttypes>
+#include <stdexcept>
+#include <string>
+
+pc_sampler_t::pc_sampler_t(const char* filename, uint64_t period, size_t depth, simif_t* sim)
+  : period(period), depth(depth), sim(sim)
+{
+  file = fopen(filename, "w");
+  if (!file)
+    throw std::runtime_error(std::string("could not open PC sample file ") + filename);
+}
+
+pc_sampler_t::~pc_sampler_t()
+{
+  fclose(file);
+}
+
+uint64_t& pc_sampler_t::next_sample(processor_t* p)
+{
+  if (p->get_id() >= next.size())
+    next.resize(p->get_id() + 1, period);
+  return next[p->get_id()];
+}
+
+uint64_t pc_sampler_t::insns_until_sample(processor_t* p)
+{
+  uint64_t retired = p->get_state()->minstret->read();
+  uint64_t due = next_sample(p);
+  return due > retired ? due - retired : 0;
+}
+
+// A return address is looked up one byte back, so that a call that ends
+// its function is charged to that function rather than the next.
+void pc_sampler_t::write_frame(reg_t addr, bool return_address)
+{
+  uint64_t start, end;
+  const char* symbol = sim->get_enclosing_symbol(addr - return_address, &start, &end);
+  if (symbol)
+    fprintf(file, "\t%16" PRIx64 " %s+0x%" PRIx64 " (guest)\n", addr, symbol, addr - start);
+  else
+    fprintf(file, "\t%16" PRIx64 " [unknown] (guest)\n", addr);
+}
+
+void pc_sampler_t::maybe_sample(processor_t* p)
+{
+  uint64_t retired = p->get_state()->minstret->read();
+  uint64_t& due = next_sample(p);
+  if (retired < due)
+    return;
+  // With --parallel a sample waits for the end of the quantum it falls in,
+  // and the next is due a period after it was taken.
+  due = retired + period;
+
+  state_t* state = p->get_state();
+  fprintf(file, "spike 0/%" PRIu32 " [%03" PRIu32 "] %" PRIu64 ".%09" PRIu64 ": %" PRIu64 " instructions:\n",
+          p->get_id(), p->get_id(), retired / 1000000000, retired % 1000000000, period);
+  write_frame(state->pc, false);
+
+  // The loads go through the hart's MMU, as interactive mode's do, and
+  // give up at the first that faults.
+  const reg_t word = p->get_xlen() / 8;
+  reg_t fp = state->XPR[8];
+  for (size_t i = 0; i < depth && fp != 0 && fp % word == 0; i++) {
+    reg_t ra, caller_fp;
+    try {
+      if (word == 8) {
+        ra = p->get_mmu()->load_uint64(fp - 8);
+        caller_fp = p->get_mmu()->load_uint64(fp - 16);
+      } else {
+        ra = p->get_mmu()->load_uint32(fp - 4);
+        caller_fp = p->get_mmu()->load_uint32(fp - 8);
+      }
+    } catch (trap_t&) {
+      break;
+    }
+    if (ra == 0)
+      break;
+    write_frame(ra, true);
+    // The stack grows down, so each caller's frame is above its callee's.
+    if (caller_fp <= fp)
+      break;
+    fp = caller_fp;
+  }
+  fputc('\n', file);
+}
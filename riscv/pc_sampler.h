@@ -0,0 +1,42 @@
+// See LICENSE for license details.
+#ifndef _RISCV_PC_SAMPLER_H
+#define _RISCV_PC_SAMPLER_H
+
+#include "decode.h"
+#include <cstdio>
+#include <vector>
+
+class processor_t;
+class simif_t;
+
+// Samples each hart's PC every period instructions it retires, along with
+// up to depth return addresses found by following the guest's frame
+// pointers, and writes the samples in the text format of `perf script`, so
+// that FlameGraph's stackcollapse-perf.pl and similar tools read them.
+// The time of a sample is the hart's instret in billions.  Frames are
+// found with the usual RISC-V layout, where s0 points just above the saved
+// return address and the caller's s0, so code built without
+// -fno-omit-frame-pointer yields only its PCs.
+class pc_sampler_t
+{
+public:
+  pc_sampler_t(const char* filename, uint64_t period, size_t depth, simif_t* sim);
+  ~pc_sampler_t();
+
+  // How many more instructions p may retire before its next sample
+  uint64_t insns_until_sample(processor_t* p);
+  // Samples p if it has reached its next sample.
+  void maybe_sample(processor_t* p);
+
+private:
+  uint64_t& next_sample(processor_t* p);
+  void write_frame(reg_t addr, bool return_address);
+
+  FILE* file;
+  uint64_t period;
+  size_t depth;
+  simif_t* sim;
+  std::vector<uint64_t> next;  // per hart ID, the instret of its next sample
+};
+
+#endif
@@ -5,6 +5,11 @@
 #define DEFAULT_RSTVEC     0x00001000
 #define CLINT_BASE         0x02000000
 #define CLINT_SIZE         0x000c0000
+#define PLIC_BASE          0x0c000000
+#define PLIC_SIZE          0x04000000
+#define VIRTIO_MMIO_SIZE   0x00001000
+#define NS16550_SIZE       0x00000100
+#define NS16550_CLOCK_HZ   10000000
 #define EXT_IO_BASE        0x40000000
 #define DRAM_BASE          0x80000000
 
@@ -0,0 +1,176 @@
+#include "devices.h"
+#include "processor.h"
+#include "arith.h"
+
+/* 000000 priority of source 0 (reserved), 1, 2, ...
+ * 001000 pending bits of sources 0-31, 32-63, ...
+ * 002000 enable bits of context 0, sources 0-31, ...
+ * 002080 enable bits of context 1, ...
+ * 200000 priority threshold of context 0
+ * 200004 claim/complete of context 0
+ * 201000 priority threshold of context 1, ...
+ */
+
+#define PRIORITY_BASE	0x0
+#define PENDING_BASE	0x1000
+#define ENABLE_BASE	0x2000
+#define ENABLE_STRIDE	0x80
+#define CONTEXT_BASE	0x200000
+#define CONTEXT_STRIDE	0x1000
+#define CONTEXT_THRESHOLD	0x0
+#define CONTEXT_CLAIM	0x4
+
+#define PLIC_MAX_DEVICES	1023
+#define PLIC_PRIORITY_MASK	0x7
+
+plic_t::plic_t(std::vector<processor_t*>& procs, uint32_t ndev)
+  : procs(procs), ndev(ndev), priority(ndev + 1), level((ndev + 32) / 32),
+    pending((ndev + 32) / 32), claimed((ndev + 32) / 32), contexts(2 * procs.size())
+{
+  if (ndev > PLIC_MAX_DEVICES)
+    throw std::runtime_error("too many PLIC interrupt sources");
+  for (auto& c : contexts)
+    c.enable.resize((ndev + 32) / 32);
+}
+
+void plic_t::set_bit(std::vector<uint32_t>& v, uint32_t id, bool b)
+{
+  v[id / 32] = (v[id / 32] & ~(1u << (id % 32))) | (uint32_t(b) << (id % 32));
+}
+
+bool plic_t::beats(uint32_t id, uint32_t best, uint32_t threshold)
+{
+  uint32_t best_priority = best ? priority[best] : threshold;
+  return priority[id] > best_priority || (best && priority[id] == best_priority && id < best);
+}
+
+uint32_t plic_t::best_source(size_t c)
+{
+  uint32_t best = 0;
+  for (size_t w = 0; w < pending.size(); w++) {
+    for (uint32_t bits = pending[w] & contexts[c].enable[w]; bits; bits &= bits - 1) {
+      uint32_t id = 32 * w + ctz(bits);
+      if (beats(id, best, contexts[c].threshold))
+        best = id;
+    }
+  }
+  return best;
+}
+
+void plic_t::update_context(size_t c, uint32_t id)
+{
+  context_t& ctx = contexts[c];
+  if (id == 0 || id == ctx.best)
+    ctx.best = best_source(c);
+  else if (bit(pending, id) && bit(ctx.enable, id) && beats(id, ctx.best, ctx.threshold))
+    ctx.best = id;
+
+  // Contexts alternate between each hart's M and S modes.
+  if ((ctx.best != 0) != ctx.asserted) {
+    ctx.asserted = ctx.best != 0;
+    reg_t mask = c % 2 ? MIP_SEIP : MIP_MEIP;
+    procs[c / 2]->state.mip->backdoor_write_with_mask(mask, ctx.asserted ? mask : 0);
+  }
+}
+
+void plic_t::source_changed(uint32_t id)
+{
+  for (size_t c = 0; c < contexts.size(); c++)
+    if (bit(contexts[c].enable, id))
+      update_context(c, id);
+}
+
+// The gateway passes a level on to the pending bits unless the source has
+// been claimed and not yet completed.
+void plic_t::set_interrupt_level(uint32_t id, bool lvl)
+{
+  if (id == 0 || id > ndev || bit(level, id) == lvl)
+    return;
+  set_bit(level, id, lvl);
+  if (!bit(claimed, id)) {
+    set_bit(pending, id, lvl);
+    source_changed(id);
+  }
+}
+
+bool plic_t::load(reg_t addr, size_t len, uint8_t* bytes)
+{
+  if (len != 4 || addr % 4 != 0)
+    return false;
+
+  uint32_t val = 0;
+  if (addr >= PRIORITY_BASE && addr < PRIORITY_BASE + 4 * (ndev + 1)) {
+    val = priority[(addr - PRIORITY_BASE) / 4];
+  } else if (addr >= PENDING_BASE && addr < PENDING_BASE + 4 * pending.size()) {
+    val = pending[(addr - PENDING_BASE) / 4];
+  } else if (addr >= ENABLE_BASE && addr < ENABLE_BASE + ENABLE_STRIDE * contexts.size()) {
+    size_t word = (addr - ENABLE_BASE) % ENABLE_STRIDE / 4;
+    auto& c = contexts[(addr - ENABLE_BASE) / ENABLE_STRIDE];
+    val = word < c.enable.size() ? c.enable[word] : 0;
+  } else if (addr >= CONTEXT_BASE && addr < CONTEXT_BASE + CONTEXT_STRIDE * contexts.size()) {
+    size_t c = (addr - CONTEXT_BASE) / CONTEXT_STRIDE;
+    switch ((addr - CONTEXT_BASE) % CONTEXT_STRIDE) {
+      case CONTEXT_THRESHOLD:
+        val = contexts[c].threshold;
+        break;
+      case CONTEXT_CLAIM:
+        val = contexts[c].best;
+        if (val) {
+          set_bit(pending, val, false);
+          set_bit(claimed, val, true);
+          source_changed(val);
+        }
+        break;
+    }
+  } else if (addr >= PLIC_SIZE) {
+    return false;
+  }
+
+  memcpy(bytes, &val, 4);
+  return true;
+}
+
+bool plic_t::store(reg_t addr, size_t len, const uint8_t* bytes)
+{
+  if (len != 4 || addr % 4 != 0)
+    return false;
+
+  uint32_t val;
+  memcpy(&val, bytes, 4);
+  if (addr >= PRIORITY_BASE && addr < PRIORITY_BASE + 4 * (ndev + 1)) {
+    size_t id = (addr - PRIORITY_BASE) / 4;
+    if (id != 0 && priority[id] != (val & PLIC_PRIORITY_MASK)) {
+      priority[id] = val & PLIC_PRIORITY_MASK;
+      // A lower priority may hand a context's interrupt to another source.
+      for (size_t c = 0; c < contexts.size(); c++)
+        update_context(c);
+    }
+  } else if (addr >= ENABLE_BASE && addr < ENABLE_BASE + ENABLE_STRIDE * contexts.size()) {
+    size_t word = (addr - ENABLE_BASE) % ENABLE_STRIDE / 4;
+    size_t c = (addr - ENABLE_BASE) / ENABLE_STRIDE;
+    if (word < contexts[c].enable.size()) {
+      contexts[c].enable[word] = word == 0 ? val & ~1u : val;
+      update_context(c);
+    }
+  } else if (addr >= CONTEXT_BASE && addr < CONTEXT_BASE + CONTEXT_STRIDE * contexts.size()) {
+    size_t c = (addr - CONTEXT_BASE) / CONTEXT_STRIDE;
+    switch ((addr - CONTEXT_BASE) % CONTEXT_STRIDE) {
+      case CONTEXT_THRESHOLD:
+        contexts[c].threshold = val & PLIC_PRIORITY_MASK;
+        update_context(c);
+        break;
+      case CONTEXT_CLAIM:
+        // Completing a source lets its level through the gateway again.
+        if (val != 0 && val <= ndev && bit(contexts[c].enable, val) && bit(claimed, val)) {
+          set_bit(claimed, val, false);
+          set_bit(pending, val, bit(level, val));
+          source_changed(val);
+        }
+        break;
+    }
+  } else if (addr >= PLIC_SIZE) {
+    return false;
+  }
+
+  return true;
+}
@@ -0,0 +1,21 @@
+// See LICENSE for license details.
+
+#include "plugin.h"
+#include <map>
+
+static std::map<std::string, plugin_factory_t>& plugins()
+{
+  static std::map<std::string, plugin_factory_t> v;
+  return v;
+}
+
+void register_plugin(const char* name, plugin_factory_t f)
+{
+  plugins()[name] = f;
+}
+
+plugin_factory_t find_plugin(const char* name)
+{
+  auto it = plugins().find(name);
+  return it == plugins().end() ? plugin_factory_t() : it->second;
+}
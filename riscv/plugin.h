@@ -0,0 +1,126 @@
+// See LICENSE for license details.
+#ifndef _RISCV_PLUGIN_H
+#define _RISCV_PLUGIN_H
+
+#include "decode.h"
+#include "memtracer.h"
+#include <functional>
+#include <string>
+#include <vector>
+
+class processor_t;
+
+// Translation-time instrumentation, in the manner of QEMU's TCG plugins.
+// A plugin is offered each instruction as it enters a hart's icache, and
+// each block as the block cache decodes it, and may then ask for a
+// callback or an inline counter on every execution of it.  Code that asks
+// for nothing runs as fast as it would without the plugin; an
+// instrumented instruction runs through its handler instead of inline.
+// Instructions may be offered again whenever they are refetched, so a
+// plugin must give the same answer each time.  Blocks are only decoded
+// with --block-cache, and a block's callbacks run when it is entered, even
+// if a trap leaves it early.
+//
+// A plugin may also see every memory access, in batches as memtracers do,
+// and every trap.  All of its methods run on the thread of the hart
+// concerned, which with --parallel differs from hart to hart.
+//
+// Plugins come from libraries loaded with --extlib, which register them
+// with REGISTER_PLUGIN, and are attached to every hart with
+// --plugin=<name>[:<args>].
+
+typedef void (*plugin_callback_t)(processor_t* p, reg_t pc, void* data);
+
+// The instrumentation of one instruction or block
+struct plugin_hooks_t
+{
+  std::vector<uint64_t*> counters;
+  std::vector<std::pair<plugin_callback_t, void*>> callbacks;
+
+  bool empty() const { return counters.empty() && callbacks.empty(); }
+  void clear() { counters.clear(); callbacks.clear(); }
+  void run(processor_t* p, reg_t pc) const
+  {
+    for (uint64_t* counter : counters)
+      ++*counter;
+    for (auto& callback : callbacks)
+      callback.first(p, pc, callback.second);
+  }
+};
+
+// An instruction or block being translated
+class plugin_translation_t
+{
+ public:
+  plugin_translation_t(reg_t pc, const insn_t* insns, size_t ninsns, plugin_hooks_t* hooks)
+    : pc(pc), insns(insns), ninsns(ninsns), hooks(hooks) {}
+
+  // The address of the (first) instruction, and the instructions, which
+  // follow each other in memory
+  reg_t get_pc() const { return pc; }
+  size_t size() const { return ninsns; }
+  insn_t insn(size_t i) const { return insns[i]; }
+
+  // Call callback with data each time the instruction or block runs.
+  void on_exec(plugin_callback_t callback, void* data) { hooks->callbacks.push_back({callback, data}); }
+  // Add 1 to *counter each time it runs, without a call.
+  void count(uint64_t* counter) { hooks->counters.push_back(counter); }
+
+ private:
+  reg_t pc;
+  const insn_t* insns;
+  size_t ninsns;
+  plugin_hooks_t* hooks;
+};
+
+class plugin_t
+{
+ public:
+  virtual ~plugin_t() {}
+
+  // Called once for each hart, before it runs.
+  virtual void attach(processor_t* p) {}
+  virtual void translate_insn(processor_t* p, plugin_translation_t& insn) {}
+  virtual void translate_block(processor_t* p, plugin_translation_t& block) {}
+
+  // Whether to trace every memory access to mem_batch(), which costs as
+  // much as any other memtracer.
+  virtual bool wants_memory() { return false; }
+  virtual void mem_batch(processor_t* p, const access_record_t* recs, size_t n) {}
+  // The hart is taking a trap with this cause, raised at epc.
+  virtual void trap_taken(processor_t* p, reg_t cause, reg_t epc) {}
+};
+
+// A plugin's constructor takes the <args> of --plugin=<name>:<args>, or an
+// empty string.
+typedef std::function<plugin_t*(const std::string& args)> plugin_factory_t;
+void register_plugin(const char* name, plugin_factory_t f);
+// The factory of a registered plugin, or an empty one.
+plugin_factory_t find_plugin(const char* name);
+
+#define REGISTER_PLUGIN(name, constructor) \
+  class register_plugin_##name { \
+    public: register_plugin_##name() { register_plugin(#name, constructor); } \
+  }; static register_plugin_##name dummy_plugin_##name;
+
+// Hands a hart's traced accesses to a plugin.
+class plugin_memtracer_t : public memtracer_t
+{
+ public:
+  plugin_memtracer_t(plugin_t* plugin, processor_t* p) : plugin(plugin), p(p) {}
+
+  bool interested_in_range(uint64_t begin, uint64_t end, access_type type) { return true; }
+  void trace(uint64_t addr, size_t bytes, access_type type)
+  {
+    access_record_t rec = {addr, uint32_t(bytes), type, 0, 0, 0, 0};
+    plugin->mem_batch(p, &rec, 1);
+  }
+  void clean_invalidate(uint64_t addr, size_t bytes, bool clean, bool inval) {}
+  void trace_batch(const access_record_t* recs, size_t n) { plugin->mem_batch(p, recs, n); }
+
+ private:
+  plugin_t* plugin;
+  processor_t* p;
+};
+
+#endif
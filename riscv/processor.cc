@@ -9,6 +9,15 @@
 #include "mmu.h"
 #include "disasm.h"
 #include "platform.h"
+#include "bbv.h"
+#include "call_stacks.h"
+#include "vector_stats.h"
+#include "trap_profile.h"
+#include "hart_observer.h"
+#include "plugin.h"
+#include "commit_log.h"
+#include "insn_log.h"
+#include "cachesim.h"
 #include <cinttypes>
 #include <cmath>
 #include <cstdlib>
@@ -19,6 +28,8 @@
 #include <stdexcept>
 #include <string>
 #include <algorithm>
+#include <atomic>
+#include <mutex>
 
 #undef STATE
 #define STATE state
@@ -28,14 +39,15 @@ processor_t::processor_t(const isa_parser_t *isa, const char* varch,
                          FILE* log_file, std::ostream& sout_,
                          mmu_t *debug_mmu,
                          const char* sift_filename)
-    : debug(false), halt_request(HR_NONE), isa(isa), sim(sim), id(id), xlen(0),
+    : debug(false), halt_request(HR_NONE), debug_mmu(debug_mmu), isa(isa), sim(sim), id(id), xlen(0),
       histogram_enabled(false), log_commits_enabled(false),
       log_file(log_file), sout_(sout_.rdbuf()), halt_on_reset(halt_on_reset),
-      impl_table(256, false), last_pc(1), executions(1), TM(4), sift_filename(sift_filename),
-      debug_mmu(debug_mmu)
+      impl_table(256, false), last_pc(1), last_bits(0), executions(1), reset_count(0), sift_filename(sift_filename), sift_async(false), sift_roi_only(false), exceptions_taken(0), interrupts_taken(0), hpm_icache(nullptr), hpm_dcache(nullptr), branch_tracer(nullptr), branch_buffered(0), bbv(nullptr), call_stacks(nullptr), vector_stats(nullptr), trap_profile(nullptr), observer(nullptr), observed_pc(0), observed_next_pc(0), observed_insns(0), trace_filter_enabled(false), trace_priv_mask(-1),
+      TM(4)
 {
   VU.p = this;
   TM.proc = this;
+  update_extension_mask();
 
 #ifndef __SIZEOF_INT128__
   if (extension_enabled('V')) {
@@ -46,12 +58,11 @@ processor_t::processor_t(const isa_parser_t *isa, const char* varch,
 
   parse_varch_string(varch);
 
-  register_base_instructions();
   mmu = new mmu_t(sim, this);
 
-  disassembler = new disassembler_t(isa);
   for (auto e : isa->get_extensions())
-    register_extension(e.second);
+    add_extension(e.second);
+  share_insn_tables();
 
   set_pmp_granularity(1 << PMP_SHIFT);
   set_pmp_num(state.max_pmp);
@@ -69,25 +80,24 @@ processor_t::processor_t(const isa_parser_t *isa, const char* varch,
 
 processor_t::~processor_t()
 {
-#ifdef RISCV_ENABLE_HISTOGRAM
   if (histogram_enabled)
-  {
-    fprintf(stderr, "PC Histogram size:%zu\n", pc_histogram.size());
-    for (auto it : pc_histogram)
-      fprintf(stderr, "%0" PRIx64 " %" PRIu64 "\n", it.first, it.second);
-  }
-#endif
+    report_histogram();
+
+  delete bbv;
+  delete call_stacks;
+  delete vector_stats;
+  delete trap_profile;
+  delete commit_log_writer;
+  delete insn_log_batch;
 
 #ifdef RISCV_ENABLE_SIFT
-  if (state.log_writer)
-  {
-    delete state.log_writer;
-    state.log_writer = nullptr;
-  }
+  state.close_sift_streams();
+  if (state.log_index)
+    fclose(state.log_index);
+  delete state.log_warmup;
 #endif
 
   delete mmu;
-  delete disassembler;
 }
 
 static void bad_option_string(const char *option, const char *value,
@@ -141,6 +151,7 @@ void processor_t::parse_varch_string(const char* s)
   int vlen = 0;
   int elen = 0;
   int vstart_alu = 0;
+  int agnostic_ones = 0;
 
   while (pos < len) {
     std::string attr = get_string_token(str, ':', pos);
@@ -153,6 +164,8 @@ void processor_t::parse_varch_string(const char* s)
       elen = get_int_token(str, ',', pos);
     else if (attr == "vstartalu")
       vstart_alu = get_int_token(str, ',', pos);
+    else if (attr == "agnostic")
+      agnostic_ones = get_int_token(str, ',', pos);
     else
       bad_varch_string(s, "Unsupported token");
 
@@ -172,10 +185,21 @@ void processor_t::parse_varch_string(const char* s)
   if (vlen > 4096)
     bad_varch_string(s, "vlen must be <= 4096");
 
+#ifdef RISCV_FIXED_VLEN
+  if (vlen != VU.VLEN)
+    bad_varch_string(s, "vlen must match the VLEN spike was built for");
+#else
   VU.VLEN = vlen;
-  VU.ELEN = elen;
   VU.vlenb = vlen / 8;
+#endif
+#ifdef RISCV_FIXED_ELEN
+  if (elen != VU.ELEN)
+    bad_varch_string(s, "elen must match the ELEN spike was built for");
+#else
+  VU.ELEN = elen;
+#endif
   VU.vstart_alu = vstart_alu;
+  VU.agnostic_ones = agnostic_ones;
 }
 
 static int xlen_to_uxl(int xlen)
@@ -188,23 +212,15 @@ static int xlen_to_uxl(int xlen)
 }
 
 
-extern uint32_t sift_executed_insn; // defined in execute.cc
-
-void getCode(uint8_t *dst, const uint8_t *src, uint32_t size, void* _mmu)
-{
-  for (uint32_t i = 0 ; i < size ; ++i) {
-    dst[i] = (sift_executed_insn >> (i * 8)) & 0xff;
-  }
-}
 
+// Harts usually share an ISA and so have the same CSRs: the size of the
+// last csrmap built sizes the next one's buckets up front.
+static std::atomic<size_t> csr_count_hint(0);
 
 void state_t::reset(processor_t* const proc, reg_t max_isa, mmu_t *mmu, uint32_t id, uint32_t reset_count, const char* sift_filename)
 {
 #ifdef RISCV_ENABLE_SIFT
-  if (log_writer) {
-    delete log_writer;
-    log_writer = nullptr;
-  }
+  close_sift_streams();
 #endif
 
   pc = DEFAULT_RSTVEC;
@@ -217,39 +233,41 @@ void state_t::reset(processor_t* const proc, reg_t max_isa, mmu_t *mmu, uint32_t
 
   prv = PRV_M;
   v = false;
-  csrmap[CSR_MISA] = misa = std::make_shared<misa_csr_t>(proc, CSR_MISA, max_isa);
-  mstatus = std::make_shared<mstatus_csr_t>(proc, CSR_MSTATUS);
+  if (csrmap.empty())
+    csrmap.reserve(csr_count_hint.load(std::memory_order_relaxed));
+  csrmap[CSR_MISA] = misa = make_pooled<misa_csr_t>(proc, CSR_MISA, max_isa);
+  mstatus = make_pooled<mstatus_csr_t>(proc, CSR_MSTATUS);
 
   if (xlen == 32) {
-    csrmap[CSR_MSTATUS] = std::make_shared<rv32_low_csr_t>(proc, CSR_MSTATUS, mstatus);
-    csrmap[CSR_MSTATUSH] = mstatush = std::make_shared<rv32_high_csr_t>(proc, CSR_MSTATUSH, mstatus);
+    csrmap[CSR_MSTATUS] = make_pooled<rv32_low_csr_t>(proc, CSR_MSTATUS, mstatus);
+    csrmap[CSR_MSTATUSH] = mstatush = make_pooled<rv32_high_csr_t>(proc, CSR_MSTATUSH, mstatus);
   } else {
     csrmap[CSR_MSTATUS] = mstatus;
   }
-  csrmap[CSR_MEPC] = mepc = std::make_shared<epc_csr_t>(proc, CSR_MEPC);
-  csrmap[CSR_MTVAL] = mtval = std::make_shared<basic_csr_t>(proc, CSR_MTVAL, 0);
-  csrmap[CSR_MSCRATCH] = std::make_shared<basic_csr_t>(proc, CSR_MSCRATCH, 0);
-  csrmap[CSR_MTVEC] = mtvec = std::make_shared<tvec_csr_t>(proc, CSR_MTVEC);
-  csrmap[CSR_MCAUSE] = mcause = std::make_shared<cause_csr_t>(proc, CSR_MCAUSE);
-  minstret = std::make_shared<wide_counter_csr_t>(proc, CSR_MINSTRET);
-  mcycle = std::make_shared<wide_counter_csr_t>(proc, CSR_MCYCLE);
-  time = std::make_shared<time_counter_csr_t>(proc, CSR_TIME);
+  csrmap[CSR_MEPC] = mepc = make_pooled<epc_csr_t>(proc, CSR_MEPC);
+  csrmap[CSR_MTVAL] = mtval = make_pooled<basic_csr_t>(proc, CSR_MTVAL, 0);
+  csrmap[CSR_MSCRATCH] = make_pooled<basic_csr_t>(proc, CSR_MSCRATCH, 0);
+  csrmap[CSR_MTVEC] = mtvec = make_pooled<tvec_csr_t>(proc, CSR_MTVEC);
+  csrmap[CSR_MCAUSE] = mcause = make_pooled<cause_csr_t>(proc, CSR_MCAUSE);
+  minstret = make_pooled<wide_counter_csr_t>(proc, CSR_MINSTRET);
+  mcycle = make_pooled<wide_counter_csr_t>(proc, CSR_MCYCLE);
+  time = make_pooled<time_counter_csr_t>(proc, CSR_TIME);
   if (proc->extension_enabled_const(EXT_ZICNTR)) {
-    csrmap[CSR_INSTRET] = std::make_shared<counter_proxy_csr_t>(proc, CSR_INSTRET, minstret);
-    csrmap[CSR_CYCLE] = std::make_shared<counter_proxy_csr_t>(proc, CSR_CYCLE, mcycle);
-    csrmap[CSR_TIME] = time_proxy = std::make_shared<counter_proxy_csr_t>(proc, CSR_TIME, time);
+    csrmap[CSR_INSTRET] = make_pooled<counter_proxy_csr_t>(proc, CSR_INSTRET, minstret);
+    csrmap[CSR_CYCLE] = make_pooled<counter_proxy_csr_t>(proc, CSR_CYCLE, mcycle);
+    csrmap[CSR_TIME] = time_proxy = make_pooled<counter_proxy_csr_t>(proc, CSR_TIME, time);
   }
   if (xlen == 32) {
     csr_t_p minstreth, mcycleh;
-    csrmap[CSR_MINSTRET] = std::make_shared<rv32_low_csr_t>(proc, CSR_MINSTRET, minstret);
-    csrmap[CSR_MINSTRETH] = minstreth = std::make_shared<rv32_high_csr_t>(proc, CSR_MINSTRETH, minstret);
-    csrmap[CSR_MCYCLE] = std::make_shared<rv32_low_csr_t>(proc, CSR_MCYCLE, mcycle);
-    csrmap[CSR_MCYCLEH] = mcycleh = std::make_shared<rv32_high_csr_t>(proc, CSR_MCYCLEH, mcycle);
+    csrmap[CSR_MINSTRET] = make_pooled<rv32_low_csr_t>(proc, CSR_MINSTRET, minstret);
+    csrmap[CSR_MINSTRETH] = minstreth = make_pooled<rv32_high_csr_t>(proc, CSR_MINSTRETH, minstret);
+    csrmap[CSR_MCYCLE] = make_pooled<rv32_low_csr_t>(proc, CSR_MCYCLE, mcycle);
+    csrmap[CSR_MCYCLEH] = mcycleh = make_pooled<rv32_high_csr_t>(proc, CSR_MCYCLEH, mcycle);
     if (proc->extension_enabled_const(EXT_ZICNTR)) {
-      auto timeh = std::make_shared<rv32_high_csr_t>(proc, CSR_TIMEH, time);
-      csrmap[CSR_INSTRETH] = std::make_shared<counter_proxy_csr_t>(proc, CSR_INSTRETH, minstreth);
-      csrmap[CSR_CYCLEH] = std::make_shared<counter_proxy_csr_t>(proc, CSR_CYCLEH, mcycleh);
-      csrmap[CSR_TIMEH] = std::make_shared<counter_proxy_csr_t>(proc, CSR_TIMEH, timeh);
+      auto timeh = make_pooled<rv32_high_csr_t>(proc, CSR_TIMEH, time);
+      csrmap[CSR_INSTRETH] = make_pooled<counter_proxy_csr_t>(proc, CSR_INSTRETH, minstreth);
+      csrmap[CSR_CYCLEH] = make_pooled<counter_proxy_csr_t>(proc, CSR_CYCLEH, mcycleh);
+      csrmap[CSR_TIMEH] = make_pooled<counter_proxy_csr_t>(proc, CSR_TIMEH, timeh);
     }
   } else {
     csrmap[CSR_MINSTRET] = minstret;
@@ -261,31 +279,31 @@ void state_t::reset(processor_t* const proc, reg_t max_isa, mmu_t *mmu, uint32_t
     const reg_t which_mcounterh = CSR_MHPMCOUNTER3H + i - 3;
     const reg_t which_counter = CSR_HPMCOUNTER3 + i - 3;
     const reg_t which_counterh = CSR_HPMCOUNTER3H + i - 3;
-    auto mevent = std::make_shared<const_csr_t>(proc, which_mevent, 0);
-    auto mcounter = std::make_shared<const_csr_t>(proc, which_mcounter, 0);
-    csrmap[which_mevent] = mevent;
-
-    // csrmap[which_mcounter] = mcounter;
-    mhpmcounter[i] = std::make_shared<wide_counter_csr_t>(proc, which_counter);
-    csrmap[which_mcounter] = mhpmcounter[i];
+    mhpmcounter[i] = make_pooled<hpm_counter_csr_t>(proc, which_mcounter);
+    csrmap[which_mevent] = make_pooled<hpm_event_csr_t>(proc, which_mevent, mhpmcounter[i]);
+    csr_t_p mcounter = mhpmcounter[i];
+    if (xlen == 32)
+      mcounter = make_pooled<rv32_low_csr_t>(proc, which_mcounter, mhpmcounter[i]);
+    csrmap[which_mcounter] = mcounter;
 
     if (proc->extension_enabled_const(EXT_ZICNTR) && proc->extension_enabled_const(EXT_ZIHPM)) {
-      auto counter = std::make_shared<counter_proxy_csr_t>(proc, which_counter, mcounter);
+      auto counter = make_pooled<counter_proxy_csr_t>(proc, which_counter, mcounter);
       csrmap[which_counter] = counter;
     }
     if (xlen == 32) {
-      auto mcounterh = std::make_shared<const_csr_t>(proc, which_mcounterh, 0);
+      auto mcounterh = make_pooled<rv32_high_csr_t>(proc, which_mcounterh, mhpmcounter[i]);
       csrmap[which_mcounterh] = mcounterh;
       if (proc->extension_enabled_const(EXT_ZICNTR) && proc->extension_enabled_const(EXT_ZIHPM)) {
-        auto counterh = std::make_shared<counter_proxy_csr_t>(proc, which_counterh, mcounterh);
+        auto counterh = make_pooled<counter_proxy_csr_t>(proc, which_counterh, mcounterh);
         csrmap[which_counterh] = counterh;
       }
     }
   }
-  csrmap[CSR_MCOUNTINHIBIT] = std::make_shared<const_csr_t>(proc, CSR_MCOUNTINHIBIT, 0);
-  csrmap[CSR_MIE] = mie = std::make_shared<mie_csr_t>(proc, CSR_MIE);
-  csrmap[CSR_MIP] = mip = std::make_shared<mip_csr_t>(proc, CSR_MIP);
-  auto sip_sie_accr = std::make_shared<generic_int_accessor_t>(
+  csrmap[CSR_MCOUNTINHIBIT] = make_pooled<const_csr_t>(proc, CSR_MCOUNTINHIBIT, 0);
+  csrmap[CSR_MIE] = mie = make_pooled<mie_csr_t>(proc, CSR_MIE);
+  csrmap[CSR_MIP] = mip = make_pooled<mip_csr_t>(proc, CSR_MIP);
+  interrupt_maybe_pending = false;
+  auto sip_sie_accr = make_pooled<generic_int_accessor_t>(
     this,
     ~MIP_HS_MASK,  // read_mask
     MIP_SSIP,      // ip_write_mask
@@ -294,7 +312,7 @@ void state_t::reset(processor_t* const proc, reg_t max_isa, mmu_t *mmu, uint32_t
     0              // shiftamt
   );
 
-  auto hip_hie_accr = std::make_shared<generic_int_accessor_t>(
+  auto hip_hie_accr = make_pooled<generic_int_accessor_t>(
     this,
     MIP_HS_MASK,   // read_mask
     MIP_VSSIP,     // ip_write_mask
@@ -303,7 +321,7 @@ void state_t::reset(processor_t* const proc, reg_t max_isa, mmu_t *mmu, uint32_t
     0              // shiftamt
   );
 
-  auto hvip_accr = std::make_shared<generic_int_accessor_t>(
+  auto hvip_accr = make_pooled<generic_int_accessor_t>(
     this,
     MIP_VS_MASK,   // read_mask
     MIP_VS_MASK,   // ip_write_mask
@@ -312,7 +330,7 @@ void state_t::reset(processor_t* const proc, reg_t max_isa, mmu_t *mmu, uint32_t
     0              // shiftamt
   );
 
-  auto vsip_vsie_accr = std::make_shared<generic_int_accessor_t>(
+  auto vsip_vsie_accr = make_pooled<generic_int_accessor_t>(
     this,
     MIP_VS_MASK,   // read_mask
     MIP_VSSIP,     // ip_write_mask
@@ -321,55 +339,55 @@ void state_t::reset(processor_t* const proc, reg_t max_isa, mmu_t *mmu, uint32_t
     1              // shiftamt
   );
 
-  auto nonvirtual_sip = std::make_shared<mip_proxy_csr_t>(proc, CSR_SIP, sip_sie_accr);
-  auto vsip = std::make_shared<mip_proxy_csr_t>(proc, CSR_VSIP, vsip_vsie_accr);
+  auto nonvirtual_sip = make_pooled<mip_proxy_csr_t>(proc, CSR_SIP, sip_sie_accr);
+  auto vsip = make_pooled<mip_proxy_csr_t>(proc, CSR_VSIP, vsip_vsie_accr);
   csrmap[CSR_VSIP] = vsip;
-  csrmap[CSR_SIP] = std::make_shared<virtualized_csr_t>(proc, nonvirtual_sip, vsip);
-  csrmap[CSR_HIP] = std::make_shared<mip_proxy_csr_t>(proc, CSR_HIP, hip_hie_accr);
-  csrmap[CSR_HVIP] = std::make_shared<mip_proxy_csr_t>(proc, CSR_HVIP, hvip_accr);
+  csrmap[CSR_SIP] = make_pooled<virtualized_csr_t>(proc, nonvirtual_sip, vsip);
+  csrmap[CSR_HIP] = make_pooled<mip_proxy_csr_t>(proc, CSR_HIP, hip_hie_accr);
+  csrmap[CSR_HVIP] = make_pooled<mip_proxy_csr_t>(proc, CSR_HVIP, hvip_accr);
 
-  auto nonvirtual_sie = std::make_shared<mie_proxy_csr_t>(proc, CSR_SIE, sip_sie_accr);
-  auto vsie = std::make_shared<mie_proxy_csr_t>(proc, CSR_VSIE, vsip_vsie_accr);
+  auto nonvirtual_sie = make_pooled<mie_proxy_csr_t>(proc, CSR_SIE, sip_sie_accr);
+  auto vsie = make_pooled<mie_proxy_csr_t>(proc, CSR_VSIE, vsip_vsie_accr);
   csrmap[CSR_VSIE] = vsie;
-  csrmap[CSR_SIE] = std::make_shared<virtualized_csr_t>(proc, nonvirtual_sie, vsie);
-  csrmap[CSR_HIE] = std::make_shared<mie_proxy_csr_t>(proc, CSR_HIE, hip_hie_accr);
+  csrmap[CSR_SIE] = make_pooled<virtualized_csr_t>(proc, nonvirtual_sie, vsie);
+  csrmap[CSR_HIE] = make_pooled<mie_proxy_csr_t>(proc, CSR_HIE, hip_hie_accr);
 
-  csrmap[CSR_MEDELEG] = medeleg = std::make_shared<medeleg_csr_t>(proc, CSR_MEDELEG);
-  csrmap[CSR_MIDELEG] = mideleg = std::make_shared<mideleg_csr_t>(proc, CSR_MIDELEG);
+  csrmap[CSR_MEDELEG] = medeleg = make_pooled<medeleg_csr_t>(proc, CSR_MEDELEG);
+  csrmap[CSR_MIDELEG] = mideleg = make_pooled<mideleg_csr_t>(proc, CSR_MIDELEG);
   const reg_t counteren_mask = 0xffffffffULL;
-  mcounteren = std::make_shared<masked_csr_t>(proc, CSR_MCOUNTEREN, counteren_mask, 0);
+  mcounteren = make_pooled<masked_csr_t>(proc, CSR_MCOUNTEREN, counteren_mask, 0);
   if (proc->extension_enabled_const('U')) csrmap[CSR_MCOUNTEREN] = mcounteren;
-  csrmap[CSR_SCOUNTEREN] = scounteren = std::make_shared<masked_csr_t>(proc, CSR_SCOUNTEREN, counteren_mask, 0);
-  auto nonvirtual_sepc = std::make_shared<epc_csr_t>(proc, CSR_SEPC);
-  csrmap[CSR_VSEPC] = vsepc = std::make_shared<epc_csr_t>(proc, CSR_VSEPC);
-  csrmap[CSR_SEPC] = sepc = std::make_shared<virtualized_csr_t>(proc, nonvirtual_sepc, vsepc);
-  auto nonvirtual_stval = std::make_shared<basic_csr_t>(proc, CSR_STVAL, 0);
-  csrmap[CSR_VSTVAL] = vstval = std::make_shared<basic_csr_t>(proc, CSR_VSTVAL, 0);
-  csrmap[CSR_STVAL] = stval = std::make_shared<virtualized_csr_t>(proc, nonvirtual_stval, vstval);
-  auto sscratch = std::make_shared<basic_csr_t>(proc, CSR_SSCRATCH, 0);
-  auto vsscratch = std::make_shared<basic_csr_t>(proc, CSR_VSSCRATCH, 0);
+  csrmap[CSR_SCOUNTEREN] = scounteren = make_pooled<masked_csr_t>(proc, CSR_SCOUNTEREN, counteren_mask, 0);
+  auto nonvirtual_sepc = make_pooled<epc_csr_t>(proc, CSR_SEPC);
+  csrmap[CSR_VSEPC] = vsepc = make_pooled<epc_csr_t>(proc, CSR_VSEPC);
+  csrmap[CSR_SEPC] = sepc = make_pooled<virtualized_csr_t>(proc, nonvirtual_sepc, vsepc);
+  auto nonvirtual_stval = make_pooled<basic_csr_t>(proc, CSR_STVAL, 0);
+  csrmap[CSR_VSTVAL] = vstval = make_pooled<basic_csr_t>(proc, CSR_VSTVAL, 0);
+  csrmap[CSR_STVAL] = stval = make_pooled<virtualized_csr_t>(proc, nonvirtual_stval, vstval);
+  auto sscratch = make_pooled<basic_csr_t>(proc, CSR_SSCRATCH, 0);
+  auto vsscratch = make_pooled<basic_csr_t>(proc, CSR_VSSCRATCH, 0);
   // Note: if max_isa does not include H, we don't really need this virtualized_csr_t at all (though it doesn't hurt):
-  csrmap[CSR_SSCRATCH] = std::make_shared<virtualized_csr_t>(proc, sscratch, vsscratch);
+  csrmap[CSR_SSCRATCH] = make_pooled<virtualized_csr_t>(proc, sscratch, vsscratch);
   csrmap[CSR_VSSCRATCH] = vsscratch;
-  auto nonvirtual_stvec = std::make_shared<tvec_csr_t>(proc, CSR_STVEC);
-  csrmap[CSR_VSTVEC] = vstvec = std::make_shared<tvec_csr_t>(proc, CSR_VSTVEC);
-  csrmap[CSR_STVEC] = stvec = std::make_shared<virtualized_csr_t>(proc, nonvirtual_stvec, vstvec);
-  auto nonvirtual_satp = std::make_shared<satp_csr_t>(proc, CSR_SATP);
-  csrmap[CSR_VSATP] = vsatp = std::make_shared<base_atp_csr_t>(proc, CSR_VSATP);
-  csrmap[CSR_SATP] = satp = std::make_shared<virtualized_satp_csr_t>(proc, nonvirtual_satp, vsatp);
-  auto nonvirtual_scause = std::make_shared<cause_csr_t>(proc, CSR_SCAUSE);
-  csrmap[CSR_VSCAUSE] = vscause = std::make_shared<cause_csr_t>(proc, CSR_VSCAUSE);
-  csrmap[CSR_SCAUSE] = scause = std::make_shared<virtualized_csr_t>(proc, nonvirtual_scause, vscause);
-  csrmap[CSR_MTVAL2] = mtval2 = std::make_shared<hypervisor_csr_t>(proc, CSR_MTVAL2);
-  csrmap[CSR_MTINST] = mtinst = std::make_shared<hypervisor_csr_t>(proc, CSR_MTINST);
+  auto nonvirtual_stvec = make_pooled<tvec_csr_t>(proc, CSR_STVEC);
+  csrmap[CSR_VSTVEC] = vstvec = make_pooled<tvec_csr_t>(proc, CSR_VSTVEC);
+  csrmap[CSR_STVEC] = stvec = make_pooled<virtualized_csr_t>(proc, nonvirtual_stvec, vstvec);
+  auto nonvirtual_satp = make_pooled<satp_csr_t>(proc, CSR_SATP);
+  csrmap[CSR_VSATP] = vsatp = make_pooled<base_atp_csr_t>(proc, CSR_VSATP);
+  csrmap[CSR_SATP] = satp = make_pooled<virtualized_satp_csr_t>(proc, nonvirtual_satp, vsatp);
+  auto nonvirtual_scause = make_pooled<cause_csr_t>(proc, CSR_SCAUSE);
+  csrmap[CSR_VSCAUSE] = vscause = make_pooled<cause_csr_t>(proc, CSR_VSCAUSE);
+  csrmap[CSR_SCAUSE] = scause = make_pooled<virtualized_csr_t>(proc, nonvirtual_scause, vscause);
+  csrmap[CSR_MTVAL2] = mtval2 = make_pooled<hypervisor_csr_t>(proc, CSR_MTVAL2);
+  csrmap[CSR_MTINST] = mtinst = make_pooled<hypervisor_csr_t>(proc, CSR_MTINST);
   const reg_t hstatus_init = set_field((reg_t)0, HSTATUS_VSXL, xlen_to_uxl(proc->get_const_xlen()));
   const reg_t hstatus_mask = HSTATUS_VTSR | HSTATUS_VTW
     | (proc->supports_impl(IMPL_MMU) ? HSTATUS_VTVM : 0)
     | HSTATUS_HU | HSTATUS_SPVP | HSTATUS_SPV | HSTATUS_GVA;
-  csrmap[CSR_HSTATUS] = hstatus = std::make_shared<masked_csr_t>(proc, CSR_HSTATUS, hstatus_mask, hstatus_init);
-  csrmap[CSR_HGEIE] = std::make_shared<const_csr_t>(proc, CSR_HGEIE, 0);
-  csrmap[CSR_HGEIP] = std::make_shared<const_csr_t>(proc, CSR_HGEIP, 0);
-  csrmap[CSR_HIDELEG] = hideleg = std::make_shared<hideleg_csr_t>(proc, CSR_HIDELEG, mideleg);
+  csrmap[CSR_HSTATUS] = hstatus = make_pooled<masked_csr_t>(proc, CSR_HSTATUS, hstatus_mask, hstatus_init);
+  csrmap[CSR_HGEIE] = make_pooled<const_csr_t>(proc, CSR_HGEIE, 0);
+  csrmap[CSR_HGEIP] = make_pooled<const_csr_t>(proc, CSR_HGEIP, 0);
+  csrmap[CSR_HIDELEG] = hideleg = make_pooled<hideleg_csr_t>(proc, CSR_HIDELEG, mideleg);
   const reg_t hedeleg_mask =
     (1 << CAUSE_MISALIGNED_FETCH) |
     (1 << CAUSE_FETCH_ACCESS) |
@@ -383,82 +401,83 @@ void state_t::reset(processor_t* const proc, reg_t max_isa, mmu_t *mmu, uint32_t
     (1 << CAUSE_FETCH_PAGE_FAULT) |
     (1 << CAUSE_LOAD_PAGE_FAULT) |
     (1 << CAUSE_STORE_PAGE_FAULT);
-  csrmap[CSR_HEDELEG] = hedeleg = std::make_shared<masked_csr_t>(proc, CSR_HEDELEG, hedeleg_mask, 0);
-  csrmap[CSR_HCOUNTEREN] = hcounteren = std::make_shared<masked_csr_t>(proc, CSR_HCOUNTEREN, counteren_mask, 0);
-  htimedelta = std::make_shared<basic_csr_t>(proc, CSR_HTIMEDELTA, 0);
+  csrmap[CSR_HEDELEG] = hedeleg = make_pooled<masked_csr_t>(proc, CSR_HEDELEG, hedeleg_mask, 0);
+  csrmap[CSR_HCOUNTEREN] = hcounteren = make_pooled<masked_csr_t>(proc, CSR_HCOUNTEREN, counteren_mask, 0);
+  htimedelta = make_pooled<htimedelta_csr_t>(proc, CSR_HTIMEDELTA);
   if (xlen == 32) {
-    csrmap[CSR_HTIMEDELTA] = std::make_shared<rv32_low_csr_t>(proc, CSR_HTIMEDELTA, htimedelta);
-    csrmap[CSR_HTIMEDELTAH] = std::make_shared<rv32_high_csr_t>(proc, CSR_HTIMEDELTAH, htimedelta);
+    csrmap[CSR_HTIMEDELTA] = make_pooled<rv32_low_csr_t>(proc, CSR_HTIMEDELTA, htimedelta);
+    csrmap[CSR_HTIMEDELTAH] = make_pooled<rv32_high_csr_t>(proc, CSR_HTIMEDELTAH, htimedelta);
   } else {
     csrmap[CSR_HTIMEDELTA] = htimedelta;
   }
-  csrmap[CSR_HTVAL] = htval = std::make_shared<basic_csr_t>(proc, CSR_HTVAL, 0);
-  csrmap[CSR_HTINST] = htinst = std::make_shared<basic_csr_t>(proc, CSR_HTINST, 0);
-  csrmap[CSR_HGATP] = hgatp = std::make_shared<hgatp_csr_t>(proc, CSR_HGATP);
-  auto nonvirtual_sstatus = std::make_shared<sstatus_proxy_csr_t>(proc, CSR_SSTATUS, mstatus);
-  csrmap[CSR_VSSTATUS] = vsstatus = std::make_shared<vsstatus_csr_t>(proc, CSR_VSSTATUS);
-  csrmap[CSR_SSTATUS] = sstatus = std::make_shared<sstatus_csr_t>(proc, nonvirtual_sstatus, vsstatus);
-
-  csrmap[CSR_DPC] = dpc = std::make_shared<dpc_csr_t>(proc, CSR_DPC);
-  csrmap[CSR_DSCRATCH0] = std::make_shared<debug_mode_csr_t>(proc, CSR_DSCRATCH0);
-  csrmap[CSR_DSCRATCH1] = std::make_shared<debug_mode_csr_t>(proc, CSR_DSCRATCH1);
-  csrmap[CSR_DCSR] = dcsr = std::make_shared<dcsr_csr_t>(proc, CSR_DCSR);
-
-  csrmap[CSR_TSELECT] = tselect = std::make_shared<tselect_csr_t>(proc, CSR_TSELECT);
-
-  csrmap[CSR_TDATA1] = std::make_shared<tdata1_csr_t>(proc, CSR_TDATA1);
-  csrmap[CSR_TDATA2] = tdata2 = std::make_shared<tdata2_csr_t>(proc, CSR_TDATA2);
-  csrmap[CSR_TDATA3] = std::make_shared<const_csr_t>(proc, CSR_TDATA3, 0);
+  csrmap[CSR_HTVAL] = htval = make_pooled<basic_csr_t>(proc, CSR_HTVAL, 0);
+  csrmap[CSR_HTINST] = htinst = make_pooled<basic_csr_t>(proc, CSR_HTINST, 0);
+  csrmap[CSR_HGATP] = hgatp = make_pooled<hgatp_csr_t>(proc, CSR_HGATP);
+  auto nonvirtual_sstatus = make_pooled<sstatus_proxy_csr_t>(proc, CSR_SSTATUS, mstatus);
+  csrmap[CSR_VSSTATUS] = vsstatus = make_pooled<vsstatus_csr_t>(proc, CSR_VSSTATUS);
+  csrmap[CSR_SSTATUS] = sstatus = make_pooled<sstatus_csr_t>(proc, nonvirtual_sstatus, vsstatus);
+  status_dirty = 0;
+
+  csrmap[CSR_DPC] = dpc = make_pooled<dpc_csr_t>(proc, CSR_DPC);
+  csrmap[CSR_DSCRATCH0] = make_pooled<debug_mode_csr_t>(proc, CSR_DSCRATCH0);
+  csrmap[CSR_DSCRATCH1] = make_pooled<debug_mode_csr_t>(proc, CSR_DSCRATCH1);
+  csrmap[CSR_DCSR] = dcsr = make_pooled<dcsr_csr_t>(proc, CSR_DCSR);
+
+  csrmap[CSR_TSELECT] = tselect = make_pooled<tselect_csr_t>(proc, CSR_TSELECT);
+
+  csrmap[CSR_TDATA1] = make_pooled<tdata1_csr_t>(proc, CSR_TDATA1);
+  csrmap[CSR_TDATA2] = tdata2 = make_pooled<tdata2_csr_t>(proc, CSR_TDATA2);
+  csrmap[CSR_TDATA3] = make_pooled<const_csr_t>(proc, CSR_TDATA3, 0);
   debug_mode = false;
   single_step = STEP_NONE;
 
-  csrmap[CSR_MSECCFG] = mseccfg = std::make_shared<mseccfg_csr_t>(proc, CSR_MSECCFG);
+  csrmap[CSR_MSECCFG] = mseccfg = make_pooled<mseccfg_csr_t>(proc, CSR_MSECCFG);
 
   for (int i = 0; i < max_pmp; ++i) {
-    csrmap[CSR_PMPADDR0 + i] = pmpaddr[i] = std::make_shared<pmpaddr_csr_t>(proc, CSR_PMPADDR0 + i);
+    csrmap[CSR_PMPADDR0 + i] = pmpaddr[i] = make_pooled<pmpaddr_csr_t>(proc, CSR_PMPADDR0 + i);
   }
   for (int i = 0; i < max_pmp; i += xlen / 8) {
     reg_t addr = CSR_PMPCFG0 + i / 4;
-    csrmap[addr] = std::make_shared<pmpcfg_csr_t>(proc, addr);
+    csrmap[addr] = make_pooled<pmpcfg_csr_t>(proc, addr);
   }
 
-  csrmap[CSR_FFLAGS] = fflags = std::make_shared<float_csr_t>(proc, CSR_FFLAGS, FSR_AEXC >> FSR_AEXC_SHIFT, 0);
-  csrmap[CSR_FRM] = frm = std::make_shared<float_csr_t>(proc, CSR_FRM, FSR_RD >> FSR_RD_SHIFT, 0);
+  csrmap[CSR_FFLAGS] = fflags = make_pooled<float_csr_t>(proc, CSR_FFLAGS, FSR_AEXC >> FSR_AEXC_SHIFT, 0);
+  csrmap[CSR_FRM] = frm = make_pooled<float_csr_t>(proc, CSR_FRM, FSR_RD >> FSR_RD_SHIFT, 0);
   assert(FSR_AEXC_SHIFT == 0);  // composite_csr_t assumes fflags begins at bit 0
-  csrmap[CSR_FCSR] = std::make_shared<composite_csr_t>(proc, CSR_FCSR, frm, fflags, FSR_RD_SHIFT);
+  csrmap[CSR_FCSR] = make_pooled<composite_csr_t>(proc, CSR_FCSR, frm, fflags, FSR_RD_SHIFT);
 
-  csrmap[CSR_SEED] = std::make_shared<seed_csr_t>(proc, CSR_SEED);
+  csrmap[CSR_SEED] = make_pooled<seed_csr_t>(proc, CSR_SEED);
 
-  csrmap[CSR_MARCHID] = std::make_shared<const_csr_t>(proc, CSR_MARCHID, 5);
-  csrmap[CSR_MIMPID] = std::make_shared<const_csr_t>(proc, CSR_MIMPID, 0);
-  csrmap[CSR_MVENDORID] = std::make_shared<const_csr_t>(proc, CSR_MVENDORID, 0);
-  csrmap[CSR_MHARTID] = std::make_shared<const_csr_t>(proc, CSR_MHARTID, proc->get_id());
-  csrmap[CSR_MCONFIGPTR] = std::make_shared<const_csr_t>(proc, CSR_MCONFIGPTR, 0);
+  csrmap[CSR_MARCHID] = make_pooled<const_csr_t>(proc, CSR_MARCHID, 5);
+  csrmap[CSR_MIMPID] = make_pooled<const_csr_t>(proc, CSR_MIMPID, 0);
+  csrmap[CSR_MVENDORID] = make_pooled<const_csr_t>(proc, CSR_MVENDORID, 0);
+  csrmap[CSR_MHARTID] = make_pooled<const_csr_t>(proc, CSR_MHARTID, proc->get_id());
+  csrmap[CSR_MCONFIGPTR] = make_pooled<const_csr_t>(proc, CSR_MCONFIGPTR, 0);
   if (proc->extension_enabled_const('U')) {
     const reg_t menvcfg_mask = (proc->extension_enabled(EXT_ZICBOM) ? MENVCFG_CBCFE | MENVCFG_CBIE : 0) |
                               (proc->extension_enabled(EXT_ZICBOZ) ? MENVCFG_CBZE : 0) |
                               (proc->extension_enabled(EXT_SVPBMT) ? MENVCFG_PBMTE : 0) |
                               (proc->extension_enabled(EXT_SSTC) ? MENVCFG_STCE : 0);
     const reg_t menvcfg_init = (proc->extension_enabled(EXT_SVPBMT) ? MENVCFG_PBMTE : 0);
-    menvcfg = std::make_shared<masked_csr_t>(proc, CSR_MENVCFG, menvcfg_mask, menvcfg_init);
+    menvcfg = make_pooled<masked_csr_t>(proc, CSR_MENVCFG, menvcfg_mask, menvcfg_init);
     if (xlen == 32) {
-      csrmap[CSR_MENVCFG] = std::make_shared<rv32_low_csr_t>(proc, CSR_MENVCFG, menvcfg);
-      csrmap[CSR_MENVCFGH] = std::make_shared<rv32_high_csr_t>(proc, CSR_MENVCFGH, menvcfg);
+      csrmap[CSR_MENVCFG] = make_pooled<rv32_low_csr_t>(proc, CSR_MENVCFG, menvcfg);
+      csrmap[CSR_MENVCFGH] = make_pooled<rv32_high_csr_t>(proc, CSR_MENVCFGH, menvcfg);
     } else {
       csrmap[CSR_MENVCFG] = menvcfg;
     }
     const reg_t senvcfg_mask = (proc->extension_enabled(EXT_ZICBOM) ? SENVCFG_CBCFE | SENVCFG_CBIE : 0) |
                               (proc->extension_enabled(EXT_ZICBOZ) ? SENVCFG_CBZE : 0);
-    csrmap[CSR_SENVCFG] = senvcfg = std::make_shared<senvcfg_csr_t>(proc, CSR_SENVCFG, senvcfg_mask, 0);
+    csrmap[CSR_SENVCFG] = senvcfg = make_pooled<senvcfg_csr_t>(proc, CSR_SENVCFG, senvcfg_mask, 0);
     const reg_t henvcfg_mask = (proc->extension_enabled(EXT_ZICBOM) ? HENVCFG_CBCFE | HENVCFG_CBIE : 0) |
                               (proc->extension_enabled(EXT_ZICBOZ) ? HENVCFG_CBZE : 0) |
                               (proc->extension_enabled(EXT_SVPBMT) ? HENVCFG_PBMTE : 0) |
                               (proc->extension_enabled(EXT_SSTC) ? HENVCFG_STCE : 0);
     const reg_t henvcfg_init = (proc->extension_enabled(EXT_SVPBMT) ? HENVCFG_PBMTE : 0);
-    henvcfg = std::make_shared<henvcfg_csr_t>(proc, CSR_HENVCFG, henvcfg_mask, henvcfg_init, menvcfg);
+    henvcfg = make_pooled<henvcfg_csr_t>(proc, CSR_HENVCFG, henvcfg_mask, henvcfg_init, menvcfg);
     if (xlen == 32) {
-      csrmap[CSR_HENVCFG] = std::make_shared<rv32_low_csr_t>(proc, CSR_HENVCFG, henvcfg);
-      csrmap[CSR_HENVCFGH] = std::make_shared<rv32_high_csr_t>(proc, CSR_HENVCFGH, henvcfg);
+      csrmap[CSR_HENVCFG] = make_pooled<rv32_low_csr_t>(proc, CSR_HENVCFG, henvcfg);
+      csrmap[CSR_HENVCFGH] = make_pooled<rv32_high_csr_t>(proc, CSR_HENVCFGH, henvcfg);
     } else {
       csrmap[CSR_HENVCFG] = henvcfg;
     }
@@ -469,37 +488,37 @@ void state_t::reset(processor_t* const proc, reg_t max_isa, mmu_t *mmu, uint32_t
     const reg_t mstateen0_mask = hstateen0_mask;
     for (int i = 0; i < 4; i++) {
       const reg_t mstateen_mask = i == 0 ? mstateen0_mask : MSTATEEN_HSTATEEN;
-      mstateen[i] = std::make_shared<masked_csr_t>(proc, CSR_MSTATEEN0 + i, mstateen_mask, 0);
+      mstateen[i] = make_pooled<masked_csr_t>(proc, CSR_MSTATEEN0 + i, mstateen_mask, 0);
       if (xlen == 32) {
-        csrmap[CSR_MSTATEEN0 + i] = std::make_shared<rv32_low_csr_t>(proc, CSR_MSTATEEN0 + i, mstateen[i]);
-        csrmap[CSR_MSTATEEN0H + i] = std::make_shared<rv32_high_csr_t>(proc, CSR_MSTATEEN0H + i, mstateen[i]);
+        csrmap[CSR_MSTATEEN0 + i] = make_pooled<rv32_low_csr_t>(proc, CSR_MSTATEEN0 + i, mstateen[i]);
+        csrmap[CSR_MSTATEEN0H + i] = make_pooled<rv32_high_csr_t>(proc, CSR_MSTATEEN0H + i, mstateen[i]);
       } else {
         csrmap[CSR_MSTATEEN0 + i] = mstateen[i];
       }
 
       const reg_t hstateen_mask = i == 0 ? hstateen0_mask : HSTATEEN_SSTATEEN;
-      hstateen[i] = std::make_shared<hstateen_csr_t>(proc, CSR_HSTATEEN0 + i, hstateen_mask, 0, i);
+      hstateen[i] = make_pooled<hstateen_csr_t>(proc, CSR_HSTATEEN0 + i, hstateen_mask, 0, i);
       if (xlen == 32) {
-        csrmap[CSR_HSTATEEN0 + i] = std::make_shared<rv32_low_csr_t>(proc, CSR_HSTATEEN0 + i, hstateen[i]);
-        csrmap[CSR_HSTATEEN0H + i] = std::make_shared<rv32_high_csr_t>(proc, CSR_HSTATEEN0H + i, hstateen[i]);
+        csrmap[CSR_HSTATEEN0 + i] = make_pooled<rv32_low_csr_t>(proc, CSR_HSTATEEN0 + i, hstateen[i]);
+        csrmap[CSR_HSTATEEN0H + i] = make_pooled<rv32_high_csr_t>(proc, CSR_HSTATEEN0H + i, hstateen[i]);
       } else {
         csrmap[CSR_HSTATEEN0 + i] = hstateen[i];
       }
 
       const reg_t sstateen_mask = i == 0 ? sstateen0_mask : 0;
-      csrmap[CSR_SSTATEEN0 + i] = sstateen[i] = std::make_shared<sstateen_csr_t>(proc, CSR_HSTATEEN0 + i, sstateen_mask, 0, i);
+      csrmap[CSR_SSTATEEN0 + i] = sstateen[i] = make_pooled<sstateen_csr_t>(proc, CSR_HSTATEEN0 + i, sstateen_mask, 0, i);
     }
   }
 
   if (proc->extension_enabled_const(EXT_SSTC)) {
-    stimecmp = std::make_shared<stimecmp_csr_t>(proc, CSR_STIMECMP, MIP_STIP);
-    vstimecmp = std::make_shared<stimecmp_csr_t>(proc, CSR_VSTIMECMP, MIP_VSTIP);
-    auto virtualized_stimecmp = std::make_shared<virtualized_stimecmp_csr_t>(proc, stimecmp, vstimecmp);
+    stimecmp = make_pooled<stimecmp_csr_t>(proc, CSR_STIMECMP, MIP_STIP);
+    vstimecmp = make_pooled<stimecmp_csr_t>(proc, CSR_VSTIMECMP, MIP_VSTIP);
+    auto virtualized_stimecmp = make_pooled<virtualized_stimecmp_csr_t>(proc, stimecmp, vstimecmp);
     if (xlen == 32) {
-      csrmap[CSR_STIMECMP] = std::make_shared<rv32_low_csr_t>(proc, CSR_STIMECMP, virtualized_stimecmp);
-      csrmap[CSR_STIMECMPH] = std::make_shared<rv32_high_csr_t>(proc, CSR_STIMECMPH, virtualized_stimecmp);
-      csrmap[CSR_VSTIMECMP] = std::make_shared<rv32_low_csr_t>(proc, CSR_VSTIMECMP, vstimecmp);
-      csrmap[CSR_VSTIMECMPH] = std::make_shared<rv32_high_csr_t>(proc, CSR_VSTIMECMPH, vstimecmp);
+      csrmap[CSR_STIMECMP] = make_pooled<rv32_low_csr_t>(proc, CSR_STIMECMP, virtualized_stimecmp);
+      csrmap[CSR_STIMECMPH] = make_pooled<rv32_high_csr_t>(proc, CSR_STIMECMPH, virtualized_stimecmp);
+      csrmap[CSR_VSTIMECMP] = make_pooled<rv32_low_csr_t>(proc, CSR_VSTIMECMP, vstimecmp);
+      csrmap[CSR_VSTIMECMPH] = make_pooled<rv32_high_csr_t>(proc, CSR_VSTIMECMPH, vstimecmp);
     } else {
       csrmap[CSR_STIMECMP] = virtualized_stimecmp;
       csrmap[CSR_VSTIMECMP] = vstimecmp;
@@ -509,24 +528,13 @@ void state_t::reset(processor_t* const proc, reg_t max_isa, mmu_t *mmu, uint32_t
   serialized = false;
 
 #ifdef RISCV_ENABLE_SIFT
-  //std::string filename = std::string(sift_filename)+"_h"+std::to_string(log_id);
-  //if (log_reset_count)
-  //{
-  //  filename += ("_r"+std::to_string(log_reset_count));
-  //}
-  //filename += ".sift";
-  std::string filename = sift_filename;
-  // log_writer = new Sift::Writer(filename.c_str(), nullptr, true, "", 0, false, true, false, getCode, reinterpret_cast<void*>(proc->debug_mmu));;
-  log_writer = new Sift::Writer(filename.c_str(), // filename
-                                nullptr, // getCodeFunc
-                                true, // useCompression
-                                "response", // response_filename
-                                0, // id
-                                false, // arch32
-                                true, // require_icache_per_insn
-                                false, // send_va2pa_mapping
-                                getCode, // getCodeFunc2
-                                reinterpret_cast<void*>(mmu));
+  // Each hart gets its own stream (and response channel) so that a
+  // multi-hart run can be replayed as a multi-threaded Sniper trace.  A hart
+  // that is reset again starts a new stream rather than truncating the old one.
+  log_id = id;
+  log_reset_count = reset_count;
+  this->sift_filename = sift_filename;
+  open_sift_stream(proc->get_sift_config(), proc->max_logged_addresses());
 #endif // RISCV_ENABLE_SIFT
 
 #ifdef RISCV_ENABLE_COMMITLOG
@@ -541,26 +549,49 @@ void state_t::reset(processor_t* const proc, reg_t max_isa, mmu_t *mmu, uint32_t
 
 void processor_t::vectorUnit_t::reset()
 {
-  free(reg_file);
-  VLEN = get_vlen();
-  ELEN = get_elen();
-  reg_file = malloc(NVPR * vlenb);
-  memset(reg_file, 0, NVPR * vlenb);
-
-  auto& csrmap = p->get_state()->csrmap;
-  csrmap[CSR_VXSAT] = vxsat = std::make_shared<vxsat_csr_t>(p, CSR_VXSAT);
-  csrmap[CSR_VSTART] = vstart = std::make_shared<vector_csr_t>(p, CSR_VSTART, /*mask*/ VLEN - 1);
-  csrmap[CSR_VXRM] = vxrm = std::make_shared<vector_csr_t>(p, CSR_VXRM, /*mask*/ 0x3ul);
-  csrmap[CSR_VL] = vl = std::make_shared<vector_csr_t>(p, CSR_VL, /*mask*/ 0);
-  csrmap[CSR_VTYPE] = vtype = std::make_shared<vector_csr_t>(p, CSR_VTYPE, /*mask*/ 0);
-  csrmap[CSR_VLENB] = std::make_shared<vector_csr_t>(p, CSR_VLENB, /*mask*/ 0, /*init*/ vlenb);
+  // The register file starts on a cache line and fills whole lines, so
+  // host kernels see aligned registers, registers of 64 bytes or more sit
+  // on lines of their own, and no other heap data shares a line with it
+  // when harts run on separate threads.  The registers themselves stay
+  // back to back: elt() and the bulk paths address a group as one array.
+  // A reset after the first clears it in place.
+  const size_t reg_file_size = (NVPR * vlenb + 63) & ~size_t(63);
+  if (!reg_file)
+    reg_file = aligned_alloc(64, reg_file_size);
+  memset(reg_file, 0, reg_file_size);
+
+  state_t* state = p->get_state();
+  auto& csrmap = state->csrmap;
+  csrmap[CSR_VXSAT] = vxsat = state->make_pooled<vxsat_csr_t>(p, CSR_VXSAT);
+  csrmap[CSR_VSTART] = vstart = state->make_pooled<vector_csr_t>(p, CSR_VSTART, /*mask*/ VLEN - 1);
+  csrmap[CSR_VXRM] = vxrm = state->make_pooled<vector_csr_t>(p, CSR_VXRM, /*mask*/ 0x3ul);
+  csrmap[CSR_VL] = vl = state->make_pooled<vector_csr_t>(p, CSR_VL, /*mask*/ 0);
+  csrmap[CSR_VTYPE] = vtype = state->make_pooled<vector_csr_t>(p, CSR_VTYPE, /*mask*/ 0);
+  csrmap[CSR_VLENB] = state->make_pooled<vector_csr_t>(p, CSR_VLENB, /*mask*/ 0, /*init*/ vlenb);
   assert(VCSR_VXSAT_SHIFT == 0);  // composite_csr_t assumes vxsat begins at bit 0
-  csrmap[CSR_VCSR] = std::make_shared<composite_csr_t>(p, CSR_VCSR, vxrm, vxsat, VCSR_VXRM_SHIFT);
+  csrmap[CSR_VCSR] = state->make_pooled<composite_csr_t>(p, CSR_VCSR, vxrm, vxsat, VCSR_VXRM_SHIFT);
 
   vtype->write_raw(0);
   set_vl(0, 0, 0, -1); // default to illegal configuration
 }
 
+void processor_t::vectorUnit_t::fill_agnostic(reg_t vd, reg_t esz, reg_t vstart, reg_t vl, bool masked)
+{
+  if (vta) {
+    reg_t end = vlenb * (vflmul < 1 ? 1 : reg_t(vflmul));
+    if (vl * esz < end)
+      memset(&elt_group<uint8_t>(vd, vl * esz, end, true)[vl * esz], 0xff, end - vl * esz);
+  }
+  if (masked && vma && vstart < vl) {
+    auto group = elt_group<uint8_t>(vd, vstart * esz, vl * esz, true);
+    for (reg_t base = vstart & ~reg_t(63); base < vl; base += 64) {
+      uint64_t off = active_mask(base, vstart, vl, false) & ~active_mask(base, vstart, vl, true);
+      for (; off != 0; off &= off - 1)
+        memset(&group[(base + ctz(off)) * esz], 0xff, esz);
+    }
+  }
+}
+
 reg_t processor_t::vectorUnit_t::set_vl(int rd, int rs1, reg_t reqVL, reg_t newType)
 {
   int new_vlmul = 0;
@@ -596,6 +627,7 @@ reg_t processor_t::vectorUnit_t::set_vl(int rd, int rs1, reg_t reqVL, reg_t newT
   }
 
   vstart->write_raw(0);
+  update_vcfg();
   setvl_count++;
   return vl->read();
 }
@@ -608,9 +640,43 @@ void processor_t::set_debug(bool value)
     e.second->set_debug(value);
 }
 
-void processor_t::set_histogram(bool value)
+// Prints the PC histogram to stderr, hottest PCs first, then optionally
+// the same counts summed per enclosing symbol.
+void processor_t::report_histogram()
+{
+  mmu->fold_icache_executions();
+
+  std::vector<std::pair<reg_t, uint64_t>> pcs(pc_histogram.begin(), pc_histogram.end());
+  std::sort(pcs.begin(), pcs.end(), [](const auto& a, const auto& b) {
+    return a.second != b.second ? a.second > b.second : a.first < b.first;
+  });
+  fprintf(stderr, "PC Histogram size:%zu\n", pcs.size());
+  for (auto& it : pcs)
+    fprintf(stderr, "%0" PRIx64 " %" PRIu64 "\n", it.first, it.second);
+
+  if (!histogram_by_symbol)
+    return;
+
+  std::unordered_map<std::string, uint64_t> symbols;
+  for (auto& it : pcs) {
+    uint64_t start;
+    const char* name = get_enclosing_symbol(it.first, &start);
+    symbols[name ? name : "[unknown]"] += it.second;
+  }
+  std::vector<std::pair<std::string, uint64_t>> sorted(symbols.begin(), symbols.end());
+  std::sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) {
+    return a.second != b.second ? a.second > b.second : a.first < b.first;
+  });
+  fprintf(stderr, "Symbol Histogram size:%zu\n", sorted.size());
+  for (auto& it : sorted)
+    fprintf(stderr, "%s %" PRIu64 "\n", it.first.c_str(), it.second);
+}
+
+void processor_t::set_histogram(bool value, bool by_symbol)
 {
   histogram_enabled = value;
+  histogram_by_symbol = by_symbol;
+  counting_executions = !stats_paused && (histogram_enabled || insn_mix_enabled);
 #ifndef RISCV_ENABLE_HISTOGRAM
   if (value) {
     fprintf(stderr, "PC Histogram support has not been properly enabled;");
@@ -620,20 +686,578 @@ void processor_t::set_histogram(bool value)
 #endif
 }
 
+void processor_t::set_insn_mix(bool value)
+{
+  insn_mix_enabled = value;
+  counting_executions = !stats_paused && (histogram_enabled || insn_mix_enabled);
+}
+
+void processor_t::set_stats_paused(bool paused)
+{
+  if (paused == stats_paused)
+    return;
+  mmu->fold_icache_executions();
+  stats_paused = paused;
+  counting_executions = !paused && (histogram_enabled || insn_mix_enabled);
+  // The branch macros only test for a tracer.
+  flush_branches();
+  std::swap(branch_tracer, paused_branch_tracer);
+  mmu->set_tracing_paused(paused);
+}
+
+void processor_t::reset_executions()
+{
+  mmu->fold_icache_executions();
+  pc_histogram.clear();
+  insn_mix.clear();
+  vector_insn_mix.clear();
+}
+
+void processor_t::count_executions(reg_t pc, insn_bits_t bits, uint64_t n)
+{
+  if (histogram_enabled)
+    pc_histogram[pc] += n;
+  if (!insn_mix_enabled)
+    return;
+  if (is_vector_insn(bits) && VU.vtype)
+    vector_insn_mix[bits << 8 | (VU.vtype->read() & 0x3f)] += n;
+  else
+    insn_mix[bits] += n;
+}
+
+void processor_t::write_insn_mix(FILE* f)
+{
+  mmu->fold_icache_executions();
+
+  // Encodings are resolved to instructions the way decode_insn() does,
+  // and then merged.
+  struct row_t {
+    const char* name;
+    const char* ext;
+    int vtype;
+    uint64_t count;
+  };
+  std::map<std::pair<const insn_desc_t*, int>, row_t> rows;
+  auto add = [&](insn_bits_t bits, int vtype, uint64_t count) {
+    const insn_desc_t* p = lookup_insn(bits);
+    auto& row = rows[{p, vtype}];
+    if (!row.name) {
+      const disasm_insn_t* d = disassembler->lookup(bits);
+      row = {p->name ? p->name : d ? d->get_name() : "unknown", p->ext ? p->ext : "", vtype, 0};
+    }
+    row.count += count;
+  };
+  for (auto& it : insn_mix)
+    add(it.first, -1, it.second);
+  for (auto& it : vector_insn_mix)
+    add(it.first >> 8, it.first & 0xff, it.second);
+
+  std::vector<row_t> sorted;
+  for (auto& it : rows)
+    sorted.push_back(it.second);
+  std::sort(sorted.begin(), sorted.end(), [](const row_t& a, const row_t& b) {
+    if (a.count != b.count)
+      return a.count > b.count;
+    int c = strcmp(a.name, b.name);
+    return c != 0 ? c < 0 : a.vtype < b.vtype;
+  });
+
+  static const char* const lmuls[] = {"1", "2", "4", "8", "", "1/8", "1/4", "1/2"};
+  for (auto& row : sorted) {
+    std::string name = row.name;
+    std::replace(name.begin(), name.end(), '_', '.');
+    fprintf(f, "%u,%s,%s,", id, name.c_str(), row.ext);
+    if (row.vtype >= 0)
+      fprintf(f, "%u,%s,", 8u << ((row.vtype >> 3) & 7), lmuls[row.vtype & 7]);
+    else
+      fprintf(f, ",,");
+    fprintf(f, "%" PRIu64 "\n", row.count);
+  }
+}
+
+void processor_t::set_hpm_caches(const cache_sim_t* icache, const cache_sim_t* dcache)
+{
+  hpm_icache = icache;
+  hpm_dcache = dcache;
+}
+
+void processor_t::set_branch_tracer(branchtracer_t* t)
+{
+  flush_branches();
+  (stats_paused ? paused_branch_tracer : branch_tracer) = t;
+}
+
+void processor_t::flush_branches()
+{
+  if (branch_buffered != 0)
+    branch_tracer->trace_batch(branch_buffer, branch_buffered);
+  branch_buffered = 0;
+}
+
+uint64_t processor_t::hpm_event_count(reg_t event) const
+{
+  switch (event) {
+    case HPM_EVENT_ICACHE_REFILL: return mmu->get_icache_misses();
+    case HPM_EVENT_TLB_MISS: return mmu->get_tlb_misses();
+    case HPM_EVENT_PAGE_WALK: return mmu->get_page_walks();
+    case HPM_EVENT_EXCEPTION: return exceptions_taken;
+    case HPM_EVENT_INTERRUPT: return interrupts_taken;
+    case HPM_EVENT_L1I_MISS: return hpm_icache ? hpm_icache->misses() : 0;
+    case HPM_EVENT_L1D_MISS: return hpm_dcache ? hpm_dcache->misses() : 0;
+    default: return 0;
+  }
+}
+
+// Profile basic block vectors into <prefix>_h<hartid>.bb, using the same
+// prefix as the SIFT traces so both outputs of a run sit side by side.
+void processor_t::set_bbv_interval(uint64_t interval)
+{
+  delete bbv;
+  bbv = nullptr;
+  if (interval == 0)
+    return;
+
+  std::string filename = std::string(sift_filename) + "_h" + std::to_string(id) + ".bb";
+  bbv = new bbv_profiler_t(filename.c_str(), interval);
+}
+
+void processor_t::set_call_stacks(bool value)
+{
+  delete call_stacks;
+  call_stacks = nullptr;
+  if (!value)
+    return;
+
+  std::string filename = std::string(sift_filename) + "_h" + std::to_string(id) + ".folded";
+  call_stacks = new call_stack_profiler_t(filename.c_str(), this);
+}
+
+void processor_t::set_vector_stats(bool value)
+{
+  delete vector_stats;
+  vector_stats = value ? new vector_stats_t(this) : nullptr;
+}
+
+void processor_t::set_trap_profile(bool value)
+{
+  delete trap_profile;
+  trap_profile = value ? new trap_profile_t() : nullptr;
+}
+
+void processor_t::trap_returned(bool mret)
+{
+  if (trap_profile)
+    trap_profile->trap_returned(mret ? trap_profile_t::M : state.v ? trap_profile_t::VS : trap_profile_t::HS);
+}
+
+void processor_t::set_trace_filter(reg_t priv_mask, const std::vector<std::pair<reg_t, reg_t>>& ranges,
+                                   const std::vector<reg_t>& asids)
+{
+  const reg_t all_privs = (1 << PRV_U) | (1 << PRV_S) | (1 << PRV_M);
+  trace_priv_mask = priv_mask;
+  trace_ranges = ranges;
+  trace_asids = asids;
+  trace_filter_enabled = !ranges.empty() || !asids.empty() || (priv_mask & all_privs) != all_privs;
+  if (!trace_filter_enabled)
+    state.log_filtered = false;
+}
+
+void processor_t::update_trace_filter(reg_t pc)
+{
+  bool traced = (trace_priv_mask >> state.prv) & 1;
+  if (traced && !trace_ranges.empty()) {
+    traced = false;
+    for (auto& range : trace_ranges) {
+      if (pc >= range.first && pc < range.second) {
+        traced = true;
+        break;
+      }
+    }
+  }
+  if (traced && !trace_asids.empty()) {
+    reg_t satp = state.satp->read();
+    reg_t asid = xlen == 32 ? get_field(satp, SATP32_ASID) : get_field(satp, SATP64_ASID);
+    traced = std::find(trace_asids.begin(), trace_asids.end(), asid) != trace_asids.end();
+#ifdef RISCV_ENABLE_SIFT
+    if (traced && asid != state.log_stream_key)
+      switch_sift_asid(asid);
+#endif
+  }
+
+  state.log_filtered = !traced;
+#ifdef RISCV_ENABLE_SIFT
+  state.log_sift_active = state.log_sift_in_roi && traced;
+#endif
+}
+
 #ifdef RISCV_ENABLE_COMMITLOG
-void processor_t::enable_log_commits()
+void processor_t::enable_log_commits(bool binary, bool compact)
 {
   log_commits_enabled = true;
+  if (binary && !commit_log_writer)
+    commit_log_writer = new commit_log_writer_t(log_file, compact);
+}
+
+void processor_t::capture_commits(bool compact)
+{
+  log_commits_enabled = true;
+  delete commit_log_writer;
+  commit_log_writer = new commit_log_writer_t(nullptr, compact, 4096);
 }
 #endif
 
+void processor_t::set_insn_log(insn_log_t* log)
+{
+  if (insn_log_batch && !insn_log_batch->empty())
+    insn_log->submit(*insn_log_batch);
+  delete insn_log_batch;
+  insn_log = log;
+  insn_log_batch = log ? new insn_log_batch_t(this) : nullptr;
+}
+
+#ifdef RISCV_ENABLE_SIFT
+void state_t::open_sift_stream(const sift_writer_config_t& config, size_t max_addresses)
+{
+  close_sift_streams();
+
+  log_scratch.clear();
+  log_addr_valid = 0;
+  grow_sift_log(max_addresses);
+  sift_log_reset();
+
+  log_segment = 0;
+  log_traced = 0;
+  open_sift_segment(config);
+}
+
+std::string state_t::sift_stream_name() const
+{
+  std::string name = std::string(sift_filename) + "_h" + std::to_string(log_id);
+  if (log_reset_count)
+    name += "_r" + std::to_string(log_reset_count);
+  return name;
+}
+
+void state_t::open_sift_segment(const sift_writer_config_t& config)
+{
+  delete log_writer;
+
+  std::string filename = sift_stream_name();
+  if (log_segment_length && log_segment == 0) {
+    if (log_index)
+      fclose(log_index);
+    std::string index_filename = filename + ".idx";
+    log_index = fopen(index_filename.c_str(), "w");
+    if (!log_index)
+      throw std::runtime_error("could not open " + index_filename);
+    fprintf(log_index, "# segment first_insn pc prv vl vtype file\n");
+  }
+  if (log_segment_length)
+    filename += "_seg" + std::to_string(log_segment);
+  log_segment_left = log_segment_length;
+
+  std::string response_filename = filename + "_response.sift";
+  filename += ".sift";
+  log_segment_file = filename;
+  log_writer = new sift_stream_t(filename.c_str(), response_filename.c_str(), log_id, config);
+}
+
+// Parks the current stream and resumes the one for key, opening
+// <name>_asid<key>.sift the first time.
+void state_t::switch_sift_stream(reg_t key, const sift_writer_config_t& config)
+{
+  log_parked_writers[log_stream_key] = log_writer;
+  auto it = log_parked_writers.find(key);
+  if (it != log_parked_writers.end()) {
+    log_writer = it->second;
+    log_parked_writers.erase(it);
+  } else {
+    std::string filename = sift_stream_name() + "_asid" + std::to_string(key);
+    std::string response_filename = filename + "_response.sift";
+    filename += ".sift";
+    log_writer = new sift_stream_t(filename.c_str(), response_filename.c_str(), log_id, config);
+  }
+  log_stream_key = key;
+}
+
+uint64_t state_t::sift_bytes() const
+{
+  uint64_t bytes = log_writer ? log_writer->file_bytes() : 0;
+  for (auto& parked : log_parked_writers)
+    bytes += parked.second->file_bytes();
+  return bytes;
+}
+
+void state_t::close_sift_streams()
+{
+  delete log_writer;
+  log_writer = nullptr;
+  for (auto& parked : log_parked_writers)
+    delete parked.second;
+  log_parked_writers.clear();
+  log_stream_key = LOG_HART_STREAM;
+}
+
+void state_t::grow_sift_log(size_t capacity)
+{
+  std::vector<reg_t> scratch(3 * capacity, 0);
+  std::copy(log_addr, log_addr + log_addr_valid, &scratch[0]);
+  std::copy(log_reg_addr, log_reg_addr + log_addr_valid, &scratch[capacity]);
+  log_scratch.swap(scratch);
+  log_addr = &log_scratch[0];
+  log_reg_addr = &log_scratch[capacity];
+  log_uop_addr = &log_scratch[2 * capacity];
+  log_addr_capacity = capacity;
+}
+
+void processor_t::set_sift_async(bool value)
+{
+  sift_async = value;
+  if (state.log_writer)
+    state.log_writer->set_async(value);
+}
+
+// In ROI-only mode the hart runs untraced until it executes the ROI start
+// marker and stops tracing again after the ROI end marker.
+void processor_t::set_sift_roi_only(bool value)
+{
+  sift_roi_only = value;
+  state.log_sift_in_roi = !value;
+  state.log_sift_active = state.log_sift_in_roi && !state.log_filtered;
+  state.log_sift_warming = state.log_warmup && !state.log_sift_in_roi;
+}
+
+void processor_t::set_sift_code_pages(bool value)
+{
+  if (value == sift_config.code_pages)
+    return;
+  sift_config.code_pages = value;
+  reopen_sift_stream();
+}
+
+void processor_t::set_sift_compression(bool value)
+{
+  if (value == sift_config.compress)
+    return;
+  sift_config.compress = value;
+  reopen_sift_stream();
+}
+
+void processor_t::set_sift_va2pa(bool value)
+{
+  if (value == sift_config.va2pa)
+    return;
+  sift_config.va2pa = value;
+  reopen_sift_stream();
+}
+
+void processor_t::set_sift_fifo(bool value)
+{
+  if (value == sift_config.fifo)
+    return;
+  sift_config.fifo = value;
+  reopen_sift_stream();
+}
+
+void processor_t::set_sift_warmup(size_t lines)
+{
+  delete state.log_warmup;
+  state.log_warmup = lines ? new sift_warmup_t(lines) : nullptr;
+  state.log_sift_warming = state.log_warmup && !state.log_sift_in_roi;
+}
+
+void processor_t::set_sift_segment(uint64_t length)
+{
+  if (length == state.log_segment_length)
+    return;
+  state.log_segment_length = length;
+  reopen_sift_stream();
+}
+
+void processor_t::set_sift_uop_width(reg_t bits)
+{
+  state.log_sift_uop_regs = bits == 0 ? 0 : std::max<reg_t>(1, bits / VU.VLEN);
+  state.log_sift_uop_parts = bits == 0 ? 1 : std::max<reg_t>(1, VU.VLEN / bits);
+}
+
+// A stream opened part way through the run starts with the vector
+// configuration, like a segment does.
+void processor_t::switch_sift_asid(reg_t asid)
+{
+  bool opened = !state.log_parked_writers.count(asid);
+  state.switch_sift_stream(asid, sift_config);
+  state.log_writer->set_async(sift_async);
+  if (opened && extension_enabled('V'))
+    state.log_writer->VectorConfig(VU.vl->read(), VU.vtype->read());
+}
+
+void processor_t::next_sift_segment()
+{
+  state.log_segment++;
+  state.open_sift_segment(sift_config);
+  state.log_writer->set_async(sift_async);
+}
+
+void processor_t::set_sift_period(uint64_t skip, uint64_t warm, uint64_t detail)
+{
+  sift_period[SIFT_SKIP] = skip;
+  sift_period[SIFT_WARM] = warm;
+  sift_period[SIFT_DETAIL] = detail;
+  sift_phase = SIFT_SKIP;
+  sift_phase_end = 0;
+  if (detail)
+    enter_sift_phase(SIFT_SKIP);
+  else
+    set_sift_roi_only(sift_roi_only);
+}
+
+uint64_t processor_t::sift_phase_stop(uint64_t retired)
+{
+  if (!sift_period[SIFT_DETAIL])
+    return 0;
+  if (!sift_phase_end)
+    sift_phase_end = retired + sift_period[SIFT_SKIP];
+  while (retired >= sift_phase_end) {
+    unsigned next = (sift_phase + 1) % SIFT_PHASES;
+    sift_phase_end += sift_period[next];
+    enter_sift_phase(next);
+  }
+  return sift_phase_end;
+}
+
+// A detailed window is an ROI of its own, so Sniper can reset its
+// statistics at each, and it starts with the footprint warmed before it.
+void processor_t::enter_sift_phase(unsigned phase)
+{
+  if (sift_phase == SIFT_DETAIL && state.log_sift_in_roi)
+    state.log_writer->Magic(2, 0, 0);  // SIM_ROI_END = 2 at sim_api.h
+  sift_phase = phase;
+  state.log_sift_in_roi = phase == SIFT_DETAIL;
+  state.log_sift_active = state.log_sift_in_roi && !state.log_filtered;
+  state.log_sift_warming = phase == SIFT_WARM && state.log_warmup;
+  if (phase != SIFT_DETAIL)
+    return;
+
+  if (state.log_segment_length && state.log_segment_left != state.log_segment_length)
+    next_sift_segment();
+  if (state.log_warmup)
+    state.log_warmup->emit(state.log_writer);
+  state.log_writer->Magic(1, 0, 0);  // SIM_ROI_START = 1 at sim_api.h
+  // The vsetvl that configured the vector unit was not traced.
+  if (extension_enabled('V'))
+    state.log_writer->VectorConfig(VU.vl->read(), VU.vtype->read());
+}
+
+// Each segment starts with what a reader needs to decode it without the
+// ones before: the writer sends code pages and translations anew, the
+// vector configuration is repeated, and the index records the PC and
+// privilege the segment starts from.
+void processor_t::next_sift_insn(reg_t pc)
+{
+  if (state.log_segment_left == 0)
+    next_sift_segment();
+
+  if (state.log_segment_left == state.log_segment_length) {
+    reg_t vl = 0, vtype = 0;
+    if (extension_enabled('V')) {
+      vl = VU.vl->read();
+      vtype = VU.vtype->read();
+      state.log_writer->VectorConfig(vl, vtype);
+    }
+    fprintf(state.log_index, "%u %" PRIu64 " 0x%" PRIx64 " %" PRIu64 " %" PRIu64 " 0x%" PRIx64 " %s\n",
+            state.log_segment, state.log_traced, pc, state.prv, vl, vtype,
+            state.log_segment_file.c_str());
+    fflush(state.log_index);
+  }
+
+  state.log_segment_left--;
+  state.log_traced++;
+}
+
+// A vector access touches at most VLEN elements: VLMAX at SEW=8 and LMUL=8,
+// or as many split over the fields of a segment access.  Scalar accesses
+// log only a few addresses.
+size_t processor_t::max_logged_addresses() const
+{
+  return VU.VLEN + 64;
+}
+
+// Writer settings are fixed when the writer is created, so changing them
+// reopens the stream.  This is only done before the hart starts running.
+void processor_t::reopen_sift_stream()
+{
+  if (state.log_writer)
+    state.log_writer->discard();
+  state.open_sift_stream(sift_config, max_logged_addresses());
+  state.log_writer->set_async(sift_async);
+}
+
+// In a forked child the current writer belongs to the parent's file, so it
+// is dropped rather than finished.
+void processor_t::restart_sift_stream(const char* prefix)
+{
+  sift_filename = prefix;
+  state.sift_filename = prefix;
+  state.log_writer = nullptr;
+  state.log_parked_writers.clear();
+  reopen_sift_stream();
+}
+#endif
+
+// Harts normally all have the same CSRs, so they can share one table from
+// CSR numbers to slots instead of each keeping a pointer per CSR number.
+static std::shared_ptr<const csr_slots_t> shared_csr_slots(const std::vector<reg_t>& numbers)
+{
+  static std::mutex lock;
+  static std::map<std::vector<reg_t>, std::weak_ptr<const csr_slots_t>> tables;
+
+  std::lock_guard<std::mutex> guard(lock);
+  auto& entry = tables[numbers];
+  if (auto table = entry.lock())
+    return table;
+
+  auto table = std::make_shared<csr_slots_t>();
+  table->fill(0);
+  for (size_t i = 0; i < numbers.size(); i++)
+    (*table)[numbers[i]] = i + 1;
+  entry = table;
+  return table;
+}
+
+void state_t::build_csr_table()
+{
+  std::vector<reg_t> numbers;
+  for (auto& csr : csrmap)
+    if (csr.first < 4096)
+      numbers.push_back(csr.first);
+  std::sort(numbers.begin(), numbers.end());
+
+  csr_slots = shared_csr_slots(numbers);
+  csr_list.assign(1, nullptr);
+  for (reg_t which : numbers)
+    csr_list.push_back(csrmap[which].get());
+  csr_count_hint.store(csrmap.size(), std::memory_order_relaxed);
+}
+
 void processor_t::reset()
 {
   xlen = isa->get_max_xlen();
-  state.reset(this, isa->get_max_isa(), mmu, id, reset_count, sift_filename);
+  state.reset(this, isa->get_max_isa(), mmu, id, reset_count++, sift_filename);
   state.dcsr->halt = halt_on_reset;
   halt_on_reset = false;
   VU.reset();
+  state.build_csr_table();
+  update_extension_mask();
+  state.log_filtered = false;
+#ifdef RISCV_ENABLE_SIFT
+  state.log_writer->set_async(sift_async);
+  state.log_sift_in_roi = !sift_roi_only;
+  state.log_sift_active = state.log_sift_in_roi;
+  state.log_sift_warming = state.log_warmup && !state.log_sift_in_roi;
+  // The new stream starts a new sampling period.
+  if (sift_period[SIFT_DETAIL])
+    set_sift_period(sift_period[SIFT_SKIP], sift_period[SIFT_WARM], sift_period[SIFT_DETAIL]);
+#endif
 
   if (n_pmp > 0) {
     // For backwards compatibility with software that is unaware of PMP,
@@ -649,6 +1273,21 @@ void processor_t::reset()
     sim->proc_reset(id);
 }
 
+void processor_t::update_extension_mask()
+{
+  // Before the first reset there is no misa yet; it will start out as
+  // the maximal ISA.
+  reg_t misa = state.misa ? state.misa->read() : isa->get_max_isa();
+  for (unsigned i = 0; i < 4; i++)
+    extension_mask[i] = 0;
+  for (unsigned ext = 0; ext < 256; ext++) {
+    bool enabled = ext >= 'A' && ext <= 'Z' ? (misa >> (ext - 'A')) & 1
+                                            : isa->extension_enabled(ext);
+    if (enabled)
+      extension_mask[ext / 64] |= uint64_t(1) << (ext % 64);
+  }
+}
+
 extension_t* processor_t::get_extension()
 {
   switch (custom_extensions.size()) {
@@ -677,6 +1316,7 @@ void processor_t::set_pmp_num(reg_t n)
     abort();
   }
   n_pmp = n;
+  mmu->pmp_changed();
 }
 
 void processor_t::set_pmp_granularity(reg_t gran)
@@ -688,6 +1328,7 @@ void processor_t::set_pmp_granularity(reg_t gran)
   }
 
   lg_pmp_granularity = ctz(gran);
+  mmu->pmp_changed();
 }
 
 void processor_t::set_mmu_capability(int cap)
@@ -718,10 +1359,16 @@ void processor_t::set_mmu_capability(int cap)
 }
 
 void processor_t::take_interrupt(reg_t pending_interrupts)
+{
+  if (reg_t cause = interrupt_cause(pending_interrupts))
+    throw trap_t(cause);
+}
+
+reg_t processor_t::interrupt_cause(reg_t pending_interrupts)
 {
   // Do nothing if no pending interrupts
   if (!pending_interrupts) {
-    return;
+    return 0;
   }
 
   // M-ints have higher priority over HS-ints and VS-ints
@@ -768,8 +1415,9 @@ void processor_t::take_interrupt(reg_t pending_interrupts)
     else
       abort();
 
-    throw trap_t(((reg_t)1 << (isa->get_max_xlen() - 1)) | ctz(enabled_interrupts));
+    return ((reg_t)1 << (isa->get_max_xlen() - 1)) | ctz(enabled_interrupts);
   }
+  return 0;
 }
 
 reg_t processor_t::legalize_privilege(reg_t prv)
@@ -787,7 +1435,7 @@ reg_t processor_t::legalize_privilege(reg_t prv)
 
 void processor_t::set_privilege(reg_t prv)
 {
-  mmu->flush_tlb();
+  mmu->flush_tlb_context();
   state.prv = legalize_privilege(prv);
 }
 
@@ -808,6 +1456,7 @@ void processor_t::set_virt(bool virt)
      * since changing V might change sstatus.MXR and sstatus.SUM.
      */
     state.v = virt;
+    state.status_dirty = 0;
   }
 }
 
@@ -822,7 +1471,9 @@ void processor_t::enter_debug_mode(uint8_t cause)
 
 void processor_t::debug_output_log(std::stringstream *s)
 {
-  if (log_file == stderr) {
+  if (insn_log_batch) {
+    insn_log_batch->text(s->str()); // keeps its place in the -l log
+  } else if (log_file == stderr) {
     std::ostream out(sout_.rdbuf());
     out << s->str(); // handles command line options -d -s -l
   } else {
@@ -830,11 +1481,29 @@ void processor_t::debug_output_log(std::stringstream *s)
   }
 }
 
+void processor_t::add_plugin(plugin_t* plugin)
+{
+  plugins.push_back(plugin);
+  if (plugin->wants_memory()) {
+    plugin_tracers.emplace_back(new plugin_memtracer_t(plugin, this));
+    mmu->register_memtracer(plugin_tracers.back().get());
+  }
+  plugin->attach(this);
+  // Translate the cached code again for the plugin.
+  mmu->flush_icache();
+}
+
 void processor_t::take_trap(trap_t& t, reg_t epc)
 {
+  host_prof_scope_t prof(HOST_PROF_TAKE_TRAP);
   unsigned max_xlen = isa->get_max_xlen();
 
-  if (debug) {
+  if (unlikely(observer != nullptr))
+    observer->trap_taken(this, t.cause(), epc);
+  for (auto plugin : plugins)
+    plugin->trap_taken(this, t.cause(), epc);
+
+  if (debug || insn_log_batch) {
     std::stringstream s; // first put everything in a string, later send it to output
     s << "core " << std::dec << std::setfill(' ') << std::setw(3) << id
       << ": exception " << t.name() << ", epc 0x"
@@ -860,6 +1529,7 @@ void processor_t::take_trap(trap_t& t, reg_t epc)
   reg_t bit = t.cause();
   bool curr_virt = state.v;
   bool interrupt = (bit & ((reg_t)1 << (max_xlen - 1))) != 0;
+  (interrupt ? interrupts_taken : exceptions_taken)++;
   if (interrupt) {
     vsdeleg = (curr_virt && state.prv <= PRV_S) ? state.hideleg->read() : 0;
     hsdeleg = (state.prv <= PRV_S) ? state.mideleg->read() : 0;
@@ -871,6 +1541,8 @@ void processor_t::take_trap(trap_t& t, reg_t epc)
   if (state.prv <= PRV_S && bit < max_xlen && ((vsdeleg >> bit) & 1)) {
     // Handle the trap in VS-mode
     reg_t vector = (state.vstvec->read() & 1) && interrupt ? 4 * bit : 0;
+    if (unlikely(trap_profile != nullptr))
+      trap_profile->trap_taken(t.cause(), t.name(), trap_profile_t::VS);
     state.pc = (state.vstvec->read() & ~(reg_t)1) + vector;
     state.vscause->write((interrupt) ? (t.cause() - 1) : t.cause());
     state.vsepc->write(epc);
@@ -884,6 +1556,8 @@ void processor_t::take_trap(trap_t& t, reg_t epc)
     set_privilege(PRV_S);
   } else if (state.prv <= PRV_S && bit < max_xlen && ((hsdeleg >> bit) & 1)) {
     // Handle the trap in HS-mode
+    if (unlikely(trap_profile != nullptr))
+      trap_profile->trap_taken(t.cause(), t.name(), trap_profile_t::HS);
     set_virt(false);
     reg_t vector = (state.stvec->read() & 1) && interrupt ? 4 * bit : 0;
     state.pc = (state.stvec->read() & ~(reg_t)1) + vector;
@@ -909,6 +1583,8 @@ void processor_t::take_trap(trap_t& t, reg_t epc)
     set_privilege(PRV_S);
   } else {
     // Handle the trap in M-mode
+    if (unlikely(trap_profile != nullptr))
+      trap_profile->trap_taken(t.cause(), t.name(), trap_profile_t::M);
     set_virt(false);
     reg_t vector = (state.mtvec->read() & 1) && interrupt ? 4 * bit : 0;
     state.pc = (state.mtvec->read() & ~(reg_t)1) + vector;
@@ -930,6 +1606,33 @@ void processor_t::take_trap(trap_t& t, reg_t epc)
   }
 }
 
+void processor_t::take_raised_trap(reg_t epc)
+{
+  if (state.pending_trap == CAUSE_USER_ECALL && sim && sim->emulate_syscall(this)) {
+    state.pc = epc + 4;
+    return;
+  }
+
+  switch (state.pending_trap) {
+    case CAUSE_USER_ECALL: { trap_user_ecall t; take_trap(t, epc); break; }
+    case CAUSE_SUPERVISOR_ECALL: { trap_supervisor_ecall t; take_trap(t, epc); break; }
+    case CAUSE_VIRTUAL_SUPERVISOR_ECALL: { trap_virtual_supervisor_ecall t; take_trap(t, epc); break; }
+    case CAUSE_MACHINE_ECALL: { trap_machine_ecall t; take_trap(t, epc); break; }
+    default: abort();
+  }
+  if (unlikely(trap_profile != nullptr))
+    trap_profile->last_raised();
+  step_after_trap();
+}
+
+void processor_t::step_after_trap()
+{
+  if (unlikely(state.single_step == state.STEP_STEPPED)) {
+    state.single_step = state.STEP_NONE;
+    enter_debug_mode(DCSR_CAUSE_STEP);
+  }
+}
+
 void processor_t::disasm(insn_t insn)
 {
   uint64_t bits = insn.bits();
@@ -977,11 +1680,8 @@ int processor_t::paddr_bits()
 void processor_t::put_csr(int which, reg_t val)
 {
   val = zext_xlen(val);
-  auto search = state.csrmap.find(which);
-  if (search != state.csrmap.end()) {
-    search->second->write(val);
-    return;
-  }
+  if (csr_t* csr = state.find_csr(which))
+    csr->write(val);
 }
 
 // Note that get_csr is sometimes called when read side-effects should not
@@ -989,11 +1689,10 @@ void processor_t::put_csr(int which, reg_t val)
 // side effects on reads.
 reg_t processor_t::get_csr(int which, insn_t insn, bool write, bool peek)
 {
-  auto search = state.csrmap.find(which);
-  if (search != state.csrmap.end()) {
+  if (csr_t* csr = state.find_csr(which)) {
     if (!peek)
-      search->second->verify_permissions(insn, write);
-    return search->second->read();
+      csr->verify_permissions(insn, write);
+    return csr->read();
   }
   // If we get here, the CSR doesn't exist.  Unimplemented CSRs always throw
   // illegal-instruction exceptions, not virtual-instruction exceptions.
@@ -1017,22 +1716,7 @@ insn_func_t processor_t::decode_insn(insn_t insn)
   bool rve = extension_enabled('E');
 
   if (unlikely(insn.bits() != desc.match)) {
-    // fall back to linear search
-    int cnt = 0;
-    insn_desc_t* p = &instructions[0];
-    while ((insn.bits() & p->mask) != p->match)
-      p++, cnt++;
-    desc = *p;
-
-    if (p->mask != 0 && p > &instructions[0]) {
-      if (p->match != (p - 1)->match && p->match != (p + 1)->match) {
-        // move to front of opcode list to reduce miss penalty
-        while (--p >= &instructions[0])
-          *(p + 1) = *p;
-        instructions[0] = desc;
-      }
-    }
-
+    desc = *lookup_insn(insn.bits());
     opcode_cache[idx] = desc;
     opcode_cache[idx].match = insn.bits();
   }
@@ -1040,14 +1724,122 @@ insn_func_t processor_t::decode_insn(insn_t insn)
   return desc.func(xlen, rve);
 }
 
-void processor_t::register_insn(insn_desc_t desc)
+insn_bits_t processor_t::expand_rvc(insn_t insn)
 {
-  assert(desc.rv32i && desc.rv64i && desc.rv32e && desc.rv64e);
+  // The expansion skips the compressed handlers' require_extension('C'),
+  // so misa writes that toggle C flush the icache.  RV32E's handlers check
+  // their registers, which is left to them.
+  if (!extension_enabled('C') || extension_enabled('E'))
+    return 0;
+
+  auto i_type = [](insn_bits_t match, reg_t rd, reg_t rs1, sreg_t imm) -> insn_bits_t {
+    return match | rd << 7 | rs1 << 15 | (insn_bits_t(imm) & 0xfff) << 20;
+  };
+  auto s_type = [](insn_bits_t match, reg_t rs1, reg_t rs2, sreg_t imm) -> insn_bits_t {
+    return match | (insn_bits_t(imm) & 0x1f) << 7 | rs1 << 15 | rs2 << 20 |
+           (insn_bits_t(imm) >> 5 & 0x7f) << 25;
+  };
+  auto r_type = [](insn_bits_t match, reg_t rd, reg_t rs1, reg_t rs2) -> insn_bits_t {
+    return match | rd << 7 | rs1 << 15 | rs2 << 20;
+  };
+  auto shift = [&](insn_bits_t match, reg_t rd, reg_t shamt) -> insn_bits_t {
+    return shamt < xlen ? match | rd << 7 | rd << 15 | shamt << 20 : 0;
+  };
 
-  instructions.push_back(desc);
+  // Forms that are reserved, or are HINTs the handlers reject, are left to
+  // the handlers to trap on.
+  insn_bits_t bits = insn.bits();
+  switch (bits & 0xe003) {
+    case 0x0000:  // c.addi4spn
+      if (insn.rvc_addi4spn_imm() == 0)
+        return 0;
+      return i_type(MATCH_ADDI, insn.rvc_rs2s(), X_SP, insn.rvc_addi4spn_imm());
+    case 0x4000:  // c.lw
+      return i_type(MATCH_LW, insn.rvc_rs2s(), insn.rvc_rs1s(), insn.rvc_lw_imm());
+    case 0x6000:  // c.ld; c.flw on RV32
+      if (xlen != 64)
+        return 0;
+      return i_type(MATCH_LD, insn.rvc_rs2s(), insn.rvc_rs1s(), insn.rvc_ld_imm());
+    case 0xc000:  // c.sw
+      return s_type(MATCH_SW, insn.rvc_rs1s(), insn.rvc_rs2s(), insn.rvc_lw_imm());
+    case 0xe000:  // c.sd; c.fsw on RV32
+      if (xlen != 64)
+        return 0;
+      return s_type(MATCH_SD, insn.rvc_rs1s(), insn.rvc_rs2s(), insn.rvc_ld_imm());
+    case 0x0001:  // c.addi
+      return i_type(MATCH_ADDI, insn.rvc_rd(), insn.rvc_rd(), insn.rvc_imm());
+    case 0x2001:  // c.addiw; c.jal on RV32
+      if (xlen != 64 || insn.rvc_rd() == 0)
+        return 0;
+      return i_type(MATCH_ADDIW, insn.rvc_rd(), insn.rvc_rd(), insn.rvc_imm());
+    case 0x4001:  // c.li
+      return i_type(MATCH_ADDI, insn.rvc_rd(), 0, insn.rvc_imm());
+    case 0x6001:  // c.lui, c.addi16sp
+      if (insn.rvc_rd() == X_SP) {
+        if (insn.rvc_addi16sp_imm() == 0)
+          return 0;
+        return i_type(MATCH_ADDI, X_SP, X_SP, insn.rvc_addi16sp_imm());
+      }
+      if (insn.rvc_imm() == 0)
+        return 0;
+      return MATCH_LUI | insn.rvc_rd() << 7 | (insn_bits_t(insn.rvc_imm() << 12) & 0xfffff000);
+    case 0x8001:
+      switch ((bits >> 10) & 3) {
+        case 0: return shift(MATCH_SRLI, insn.rvc_rs1s(), insn.rvc_zimm());
+        case 1: return shift(MATCH_SRAI, insn.rvc_rs1s(), insn.rvc_zimm());
+        case 2: return i_type(MATCH_ANDI, insn.rvc_rs1s(), insn.rvc_rs1s(), insn.rvc_imm());
+      }
+      switch (bits & 0x1060) {
+        case 0x0000: return r_type(MATCH_SUB, insn.rvc_rs1s(), insn.rvc_rs1s(), insn.rvc_rs2s());
+        case 0x0020: return r_type(MATCH_XOR, insn.rvc_rs1s(), insn.rvc_rs1s(), insn.rvc_rs2s());
+        case 0x0040: return r_type(MATCH_OR, insn.rvc_rs1s(), insn.rvc_rs1s(), insn.rvc_rs2s());
+        case 0x0060: return r_type(MATCH_AND, insn.rvc_rs1s(), insn.rvc_rs1s(), insn.rvc_rs2s());
+        case 0x1000:
+          return xlen == 64 ? r_type(MATCH_SUBW, insn.rvc_rs1s(), insn.rvc_rs1s(), insn.rvc_rs2s()) : 0;
+        case 0x1020:
+          return xlen == 64 ? r_type(MATCH_ADDW, insn.rvc_rs1s(), insn.rvc_rs1s(), insn.rvc_rs2s()) : 0;
+      }
+      return 0;
+    case 0x0002:  // c.slli
+      return shift(MATCH_SLLI, insn.rvc_rd(), insn.rvc_zimm());
+    case 0x4002:  // c.lwsp
+      if (insn.rvc_rd() == 0)
+        return 0;
+      return i_type(MATCH_LW, insn.rvc_rd(), X_SP, insn.rvc_lwsp_imm());
+    case 0x6002:  // c.ldsp; c.flwsp on RV32
+      if (xlen != 64 || insn.rvc_rd() == 0)
+        return 0;
+      return i_type(MATCH_LD, insn.rvc_rd(), X_SP, insn.rvc_ldsp_imm());
+    case 0x8002:  // c.mv, c.add; the jumps and c.ebreak have no rs2
+      if (insn.rvc_rs2() == 0)
+        return 0;
+      return r_type(MATCH_ADD, insn.rvc_rd(), (bits & 0x1000) ? insn.rvc_rd() : 0, insn.rvc_rs2());
+    case 0xc002:  // c.swsp
+      return s_type(MATCH_SW, X_SP, insn.rvc_rs2(), insn.rvc_swsp_imm());
+    case 0xe002:  // c.sdsp; c.fswsp on RV32
+      if (xlen != 64)
+        return 0;
+      return s_type(MATCH_SD, X_SP, insn.rvc_rs2(), insn.rvc_sdsp_imm());
+  }
+  return 0;
 }
 
-void processor_t::build_opcode_map()
+const insn_desc_t* processor_t::lookup_insn(insn_bits_t bits) const
+{
+  auto& bucket = insn_tables->decode_table[(bits & 0x7f) | ((bits >> 5) & 0x380)];
+  auto& list = bucket.by_funct7.empty() ? bucket.insns : bucket.by_funct7[(bits >> 25) & 0x7f];
+  auto p = list.data();
+  while ((bits & (*p)->mask) != (*p)->match)
+    p++;
+  return *p;
+}
+
+processor_t::insn_tables_t::~insn_tables_t()
+{
+  delete disassembler;
+}
+
+void processor_t::build_opcode_map(insn_tables_t& tables)
 {
   struct cmp {
     bool operator()(const insn_desc_t& lhs, const insn_desc_t& rhs) {
@@ -1056,29 +1848,98 @@ void processor_t::build_opcode_map()
       return lhs.match > rhs.match;
     }
   };
+  auto& instructions = tables.instructions;
   std::sort(instructions.begin(), instructions.end(), cmp());
 
-  for (size_t i = 0; i < OPCODE_CACHE_SIZE; i++)
-    opcode_cache[i] = insn_desc_t::illegal();
+  // An instruction goes into every bucket whose key agrees with it on the
+  // bits it matches on.
+  const insn_bits_t key_mask = 0x707f, funct7_mask = insn_bits_t(0x7f) << 25;
+  auto& decode_table = tables.decode_table;
+  decode_table.assign(DECODE_BUCKETS, decode_bucket_t());
+  for (auto& insn : instructions) {
+    for (size_t key = 0; key < DECODE_BUCKETS; key++) {
+      insn_bits_t bits = (key & 0x7f) | (key >> 7) << 12;
+      if ((bits & insn.mask & key_mask) == (insn.match & key_mask))
+        decode_table[key].insns.push_back(&insn);
+    }
+  }
+  for (auto& bucket : decode_table) {
+    if (bucket.insns.size() <= DECODE_SPLIT)
+      continue;
+    bucket.by_funct7.resize(128);
+    for (insn_bits_t funct7 = 0; funct7 < 128; funct7++) {
+      for (auto p : bucket.insns)
+        if (((funct7 << 25) & p->mask & funct7_mask) == (p->match & funct7_mask))
+          bucket.by_funct7[funct7].push_back(p);
+    }
+    bucket.insns.clear();
+  }
 }
 
-void processor_t::register_extension(extension_t* x)
+std::shared_ptr<processor_t::insn_tables_t> processor_t::build_insn_tables() const
 {
-  for (auto insn : x->get_instructions())
-    register_insn(insn);
-  build_opcode_map();
+  auto tables = std::make_shared<insn_tables_t>();
+  register_base_instructions(*tables);
+  for (auto x : extensions_in_order) {
+    for (auto insn : x->get_instructions()) {
+      assert(insn.rv32i && insn.rv64i && insn.rv32e && insn.rv64e);
+      tables->instructions.push_back(insn);
+    }
+  }
+  build_opcode_map(*tables);
 
-  for (auto disasm_insn : x->get_disasms())
-    disassembler->add_insn(disasm_insn);
+  tables->disassembler = new disassembler_t(isa);
+  for (auto x : extensions_in_order)
+    for (auto disasm_insn : x->get_disasms())
+      tables->disassembler->add_insn(disasm_insn);
+  return tables;
+}
 
+// Tables are looked up by ISA and by the names of the extensions on top of
+// it, so 256 harts build them once.  Extensions of the same name are
+// assumed to add the same instructions.
+void processor_t::share_insn_tables()
+{
+  static std::mutex lock;
+  static std::map<std::pair<const isa_parser_t*, std::string>,
+                  std::weak_ptr<const insn_tables_t>> cache;
+
+  std::string names;
+  for (auto x : extensions_in_order)
+    names = names + x->name() + ",";
+
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    auto& entry = cache[{isa, names}];
+    insn_tables = entry.lock();
+    if (!insn_tables) {
+      insn_tables = build_insn_tables();
+      entry = insn_tables;
+    }
+  }
+
+  disassembler = insn_tables->disassembler;
+  for (size_t i = 0; i < OPCODE_CACHE_SIZE; i++)
+    opcode_cache[i] = insn_desc_t::illegal();
+}
+
+void processor_t::add_extension(extension_t* x)
+{
   if (!custom_extensions.insert(std::make_pair(x->name(), x)).second) {
     fprintf(stderr, "extensions must have unique names (got two named \"%s\"!)\n", x->name());
     abort();
   }
+  extensions_in_order.push_back(x);
   x->set_processor(this);
 }
 
-void processor_t::register_base_instructions()
+void processor_t::register_extension(extension_t* x)
+{
+  add_extension(x);
+  share_insn_tables();
+}
+
+void processor_t::register_base_instructions(insn_tables_t& tables) const
 {
   #define DECLARE_INSN(name, match, mask) \
     insn_bits_t name##_match = (match), name##_mask = (mask); \
@@ -1087,6 +1948,10 @@ void processor_t::register_base_instructions()
   #include "encoding.h"
   #undef DECLARE_INSN
 
+  #define DEFINE_INSN_EXT(name, ext) const char* name##_ext = #ext;
+  #include "insn_ext_list.h"
+  #undef DEFINE_INSN_EXT
+
   #define DECLARE_OVERLAP_INSN(name, ext) { name##_supported &= isa->extension_enabled(ext); }
   #include "overlap_list.h"
   #undef DECLARE_OVERLAP_INSN
@@ -1097,21 +1962,21 @@ void processor_t::register_base_instructions()
     extern reg_t rv32e_##name(processor_t*, insn_t, reg_t); \
     extern reg_t rv64e_##name(processor_t*, insn_t, reg_t); \
     if (name##_supported) { \
-      register_insn((insn_desc_t) { \
+      tables.instructions.push_back((insn_desc_t) { \
         name##_match, \
         name##_mask, \
         rv32i_##name, \
         rv64i_##name, \
         rv32e_##name, \
-        rv64e_##name}); \
+        rv64e_##name, \
+        #name, \
+        name##_ext}); \
     }
   #include "insn_list.h"
   #undef DEFINE_INSN
 
   // terminate instruction list with a catch-all
-  register_insn(insn_desc_t::illegal());
-
-  build_opcode_map();
+  tables.instructions.push_back(insn_desc_t::illegal());
 }
 
 bool processor_t::load(reg_t addr, size_t len, uint8_t* bytes)
@@ -6,6 +6,9 @@
 #include "config.h"
 #include "trap.h"
 #include "abstract_device.h"
+#include <array>
+#include <memory>
+#include <memory_resource>
 #include <string>
 #include <vector>
 #include <unordered_map>
@@ -16,9 +19,11 @@
 #include "csrs.h"
 #include "isa_parser.h"
 #include "triggers.h"
+#include "branchtracer.h"
+#include "qemu_ckpt.h"
 
 #ifdef RISCV_ENABLE_SIFT
-# include "sift_writer.h"
+# include "sift_stream.h"
 #endif
 
 class processor_t;
@@ -28,9 +33,37 @@ class simif_t;
 class trap_t;
 class extension_t;
 class disassembler_t;
+class bbv_profiler_t;
+class vector_stats_t;
+class trap_profile_t;
+class call_stack_profiler_t;
+class hart_observer_t;
+class plugin_t;
+class plugin_memtracer_t;
+class commit_log_writer_t;
+class insn_log_t;
+class insn_log_batch_t;
+class cache_sim_t;
+struct icache_entry_t;
+class checkpoint_writer_t;
+class checkpoint_reader_t;
 
 reg_t illegal_instruction(processor_t* p, insn_t insn, reg_t pc);
 
+// Events that mhpmevent3-31 can select.  Vector instructions bump
+// mhpmcounter10 directly, whatever its event.
+enum hpm_event_t {
+  HPM_EVENT_NONE,
+  HPM_EVENT_ICACHE_REFILL,  // decoded-instruction cache refills
+  HPM_EVENT_TLB_MISS,       // translations that missed the first-level TLB
+  HPM_EVENT_PAGE_WALK,      // of those, translations that also missed the STLB
+  HPM_EVENT_EXCEPTION,      // exceptions taken, outside debug mode
+  HPM_EVENT_INTERRUPT,      // interrupts taken, outside debug mode
+  HPM_EVENT_L1I_MISS,       // misses in the --ic cache model
+  HPM_EVENT_L1D_MISS,       // misses in the --dc cache model
+  HPM_NUM_EVENTS
+};
+
 struct insn_desc_t
 {
   insn_bits_t match;
@@ -39,6 +72,9 @@ struct insn_desc_t
   insn_func_t rv64i;
   insn_func_t rv32e;
   insn_func_t rv64e;
+  // Mnemonic and extension of base instructions, for --insn-mix
+  const char* name = nullptr;
+  const char* ext = nullptr;
 
   insn_func_t func(int xlen, bool rve)
   {
@@ -55,7 +91,53 @@ struct insn_desc_t
 };
 
 // regnum, data
-typedef std::unordered_map<reg_t, freg_t> commit_log_reg_t;
+// An instruction writes only a handful of registers, so they are kept in
+// insertion order in a fixed array and deduplicated by a linear search,
+// which is cheaper than hashing every write.
+class commit_log_reg_t
+{
+public:
+  typedef std::pair<reg_t, freg_t> value_type;
+  static const size_t CAPACITY = 64;
+
+  freg_t& operator[](reg_t key)
+  {
+    // Repeated writes usually hit the most recently added register.
+    for (size_t i = count; i-- > 0; )
+      if (entries[i].first == key)
+        return entries[i].second;
+    assert(count < CAPACITY);
+    entries[count].first = key;
+    entries[count].second = freg_t();
+    return entries[count++].second;
+  }
+
+  // Widens the byte range [v[0], v[1]) of vector register vreg that the
+  // instruction has written to take in [lo, hi).
+  void add_vreg_bytes(reg_t vreg, reg_t lo, reg_t hi)
+  {
+    freg_t& range = (*this)[(vreg << 4) | 2];
+    if (range.v[1] == 0) {
+      range.v[0] = lo;
+      range.v[1] = hi;
+    } else {
+      range.v[0] = std::min<uint64_t>(range.v[0], lo);
+      range.v[1] = std::max<uint64_t>(range.v[1], hi);
+    }
+  }
+
+  void clear() { count = 0; }
+  size_t size() const { return count; }
+  bool empty() const { return count == 0; }
+  value_type* begin() { return entries; }
+  value_type* end() { return entries + count; }
+  const value_type* begin() const { return entries; }
+  const value_type* end() const { return entries + count; }
+
+private:
+  size_t count = 0;
+  value_type entries[CAPACITY];
+};
 
 // addr, value, size
 typedef std::vector<std::tuple<reg_t, uint64_t, uint8_t>> commit_log_mem_t;
@@ -68,6 +150,24 @@ enum VRM{
   INVALID_RM
 };
 
+// Elements of a vector register group, indexed as with vectorUnit_t::elt()
+template<class T>
+class vreg_span_t {
+public:
+  vreg_span_t(T* base, reg_t elts_per_reg) : base(base), elts_per_reg(elts_per_reg) {}
+
+  T& operator[](reg_t n) const {
+#ifdef WORDS_BIGENDIAN
+    n ^= elts_per_reg - 1;
+#endif
+    return base[n];
+  }
+
+private:
+  T* base;
+  reg_t elts_per_reg;
+};
+
 template<uint64_t N>
 struct type_usew_t;
 
@@ -122,17 +222,50 @@ struct type_sew_t<64>
   using type=int64_t;
 };
 
+// Index into state_t::csr_list by CSR number.
+typedef std::array<uint16_t, 4096> csr_slots_t;
+
 // architectural state of a RISC-V hart
 struct state_t
 {
   void reset(processor_t* const proc, reg_t max_isa, mmu_t *mmu, uint32_t id, uint32_t reset_count, const char* sift_filename);
+#ifdef RISCV_ENABLE_SIFT
+  void open_sift_stream(const sift_writer_config_t& config, size_t max_addresses);
+  void open_sift_segment(const sift_writer_config_t& config);
+  void switch_sift_stream(reg_t key, const sift_writer_config_t& config);
+  void close_sift_streams();
+  std::string sift_stream_name() const;  // without extension
+  uint64_t sift_bytes() const;  // in the files of the open streams
+#endif
 
   reg_t pc;
   regfile_t<reg_t, NXPR, true> XPR;
   regfile_t<freg_t, NFPR, false> FPR;
 
   // control and status registers
-  std::unordered_map<reg_t, csr_t_p> csrmap;
+  //
+  // reset() allocates the CSRs and csrmap's nodes from csr_pool, so that a
+  // hart's CSRs sit together and every reset after the first reuses the
+  // storage the previous one freed instead of going back to the heap.  The
+  // pool comes first so that it outlives everything allocated from it.
+  std::pmr::unsynchronized_pool_resource csr_pool;
+  template<typename T, typename... Args> std::shared_ptr<T> make_pooled(Args&&... args)
+  {
+    return std::allocate_shared<T>(std::pmr::polymorphic_allocator<T>(&csr_pool),
+                                   std::forward<Args>(args)...);
+  }
+  std::pmr::unordered_map<reg_t, csr_t_p> csrmap{&csr_pool};
+  // csrmap flattened for get_csr and put_csr; the map keeps ownership.
+  // csr_slots gives each CSR number its index in csr_list, or 0 for none,
+  // and is shared by all harts that have the same CSRs.  Rebuilt by
+  // build_csr_table whenever csrmap changes.
+  std::shared_ptr<const csr_slots_t> csr_slots;
+  std::vector<csr_t*> csr_list;
+  void build_csr_table();
+  csr_t* find_csr(reg_t which) const
+  {
+    return which < 4096 && csr_slots ? csr_list[(*csr_slots)[which]] : nullptr;
+  }
   reg_t prv;    // TODO: Can this be an enum instead?
   bool v;
   misa_csr_t_p misa;
@@ -144,9 +277,13 @@ struct state_t
   csr_t_p mcause;
   wide_counter_csr_t_p minstret;
   wide_counter_csr_t_p mcycle;
-  wide_counter_csr_t_p mhpmcounter[32];
+  hpm_counter_csr_t_p mhpmcounter[32];
   mie_csr_t_p mie;
   mip_csr_t_p mip;
+  // Whether mip & mie is nonzero.  Kept up to date by every write to
+  // either, so that the step loop only looks for an interrupt to take
+  // when one may be pending.
+  std::atomic<bool> interrupt_maybe_pending;
   csr_t_p medeleg;
   csr_t_p mideleg;
   csr_t_p mcounteren;
@@ -168,6 +305,11 @@ struct state_t
   csr_t_p hgatp;
   sstatus_csr_t_p sstatus;
   vsstatus_csr_t_p vsstatus;
+  // The FS, VS and XS fields that sstatus_csr_t::dirty has already set to
+  // Dirty in mstatus and, while V=1, vsstatus.  Cleared by any write to
+  // either and by a change of V, so that register writes only go through
+  // the status CSRs when a field may need updating.
+  reg_t status_dirty;
   csr_t_p vstvec;
   csr_t_p vsepc;
   csr_t_p vscause;
@@ -204,6 +346,7 @@ struct state_t
   csr_t_p vstimecmp;
 
   bool serialized; // whether timer CSRs are in a well-defined state
+  reg_t pending_trap; // cause raised by an insn that returned PC_TRAP
 
   // When true, execute a single instruction and then enter debug mode.  This
   // can only be set by executing dret.
@@ -222,16 +365,75 @@ struct state_t
   int last_inst_flen;
 #endif
 
+  // The hart is running code excluded by the trace filters.
+  bool log_filtered = false;
+
 #ifdef RISCV_ENABLE_SIFT
   const char* sift_filename = nullptr;
   uint32_t log_id = 0;
   int log_reset_count = 0;
-  Sift::Writer *log_writer = nullptr;
-  reg_t log_addr[4096];
-  reg_t log_reg_addr[4096];
+  sift_stream_t *log_writer = nullptr;
+  bool log_sift_in_roi = true;  // false while fast-forwarding to the ROI
+  bool log_sift_active = true;  // in the ROI and not filtered out
+  // Outside the ROI, untraced instructions feed log_warmup if it is set.
+  sift_warmup_t* log_warmup = nullptr;
+  bool log_sift_warming = false;
+  // Whether instructions log their addresses and branch outcomes.
+  bool log_sift_capturing() const { return log_sift_active || log_sift_warming; }
+  // Traced user ecalls that Sniper models become syscall records.
+  bool log_sift_syscalls = false;
+  // A vector instruction becomes a micro-op per log_sift_uop_regs
+  // registers of its group, or log_sift_uop_parts micro-ops per register,
+  // or a single record with all its addresses if log_sift_uop_regs is 0.
+  unsigned log_sift_uop_regs = 1;
+  unsigned log_sift_uop_parts = 1;
+  // With segments, the trace is split into files of log_segment_length
+  // traced instructions, each readable on its own, and log_index lists
+  // where each one starts.
+  uint64_t log_segment_length = 0;
+  uint64_t log_segment_left = 0;  // instructions until the next segment
+  unsigned log_segment = 0;
+  uint64_t log_traced = 0;        // instructions traced since the reset
+  std::string log_segment_file;
+  FILE* log_index = nullptr;
+  // With per-ASID streams, log_writer is the stream of log_stream_key and
+  // the streams of the other address spaces wait in log_parked_writers.
+  static const reg_t LOG_HART_STREAM = -1;
+  reg_t log_stream_key = LOG_HART_STREAM;
+  std::map<reg_t, sift_stream_t*> log_parked_writers;
+  // The addresses an instruction accessed, and the vector register each
+  // belongs to, in log_scratch, which is sized for the most one vector
+  // instruction can access when the stream is opened and grows if an
+  // instruction accesses more.
+  std::vector<reg_t> log_scratch;
+  reg_t* log_addr = nullptr;
+  reg_t* log_reg_addr = nullptr;
   unsigned int log_addr_valid;
+  unsigned int log_addr_capacity;
+  // log_addr[] regrouped by the vector register each access belongs to;
+  // scratch space reused by every traced instruction.
+  reg_t* log_uop_addr = nullptr;
+  // The vector registers the instruction wrote, one bit each.
+  reg_t log_vreg_write;
   bool log_is_branch;
   bool log_is_branch_taken;
+
+  void log_sift_addr(reg_t addr, reg_t reg_addr)
+  {
+    if (unlikely(log_addr_valid == log_addr_capacity))
+      grow_sift_log(2 * log_addr_capacity);
+    log_addr[log_addr_valid] = addr;
+    log_reg_addr[log_addr_valid] = reg_addr;
+    log_addr_valid++;
+  }
+  void sift_log_reset()
+  {
+    log_addr_valid = 0;
+    log_vreg_write = 0;
+    log_is_branch = false;
+    log_is_branch_taken = false;
+  }
+  void grow_sift_log(size_t capacity);
 #endif
 };
 
@@ -258,13 +460,150 @@ public:
   const isa_parser_t &get_isa() { return *isa; }
 
   void set_debug(bool value);
-  void set_histogram(bool value);
+  // With by_symbol, the report at exit also sums the counts per symbol.
+  void set_histogram(bool value, bool by_symbol = false);
+  bool get_histogram_enabled() const { return histogram_enabled; }
+  // Count executions per instruction for write_insn_mix()
+  void set_insn_mix(bool value);
+  // True while -g or --insn-mix counts every instruction executed
+  bool get_counting_executions() const { return counting_executions; }
+  // While paused, executions go uncounted, and the memory tracers and
+  // branch tracer see nothing; the models behind them keep their state.
+  void set_stats_paused(bool paused);
+  // Prints the PC histogram (see -g) so far.
+  void report_histogram();
+  // Forgets the executions counted so far.
+  void reset_executions();
+  // Writes this hart's dynamic instruction mix so far as CSV rows of
+  // hart,insn,ext,sew,lmul,count, most frequent first.  SEW and LMUL are
+  // only given for vector instructions, which are counted per vtype.
+  void write_insn_mix(FILE* f);
+  void set_bbv_interval(uint64_t interval);
+  // Restrict tracing to the privilege modes in priv_mask (bit n for
+  // privilege n) and, if ranges is non-empty, to PCs in [first, second).
+  // Only code running in a privilege in priv_mask, inside one of ranges
+  // if there are any, and under one of asids if there are any, is traced.
+  void set_trace_filter(reg_t priv_mask, const std::vector<std::pair<reg_t, reg_t>>& ranges,
+                        const std::vector<reg_t>& asids = {});
+  bbv_profiler_t* get_bbv() { return bbv; }
+  // Count instructions per call stack and write them to
+  // <prefix>_h<hartid>.folded at exit (see call_stack_profiler_t).
+  void set_call_stacks(bool value);
+  // Count vector unit utilization (see vector_stats_t).
+  void set_vector_stats(bool value);
+  vector_stats_t* get_vector_stats() { return vector_stats; }
+  // Count traps and what handling them costs (see trap_profile_t).
+  void set_trap_profile(bool value);
+  trap_profile_t* get_trap_profile() { return trap_profile; }
+  // An mret, or else an sret, is returning from a trap.
+  void trap_returned(bool mret);
+  void set_observer(hart_observer_t* o) { observer = o; observed_insns = 0; }
+  hart_observer_t* get_observer() { return observer; }
+  // Instrument the hart with plugin, which the caller owns (see plugin_t).
+  void add_plugin(plugin_t* plugin);
+  bool has_plugins() const { return !plugins.empty(); }
+  const std::vector<plugin_t*>& get_plugins() const { return plugins; }
+  // True while every retired instruction must go to observe_retire().
+  bool get_observing_retires() const
+  {
+    return bbv != nullptr || call_stacks != nullptr || vector_stats != nullptr || observer != nullptr;
+  }
+  // npc is the next PC the instruction at pc produced.
+  void observe_retire(reg_t pc, reg_t npc, insn_t insn);
+  // The cache models whose misses HPM_EVENT_L1I_MISS and HPM_EVENT_L1D_MISS
+  // count; either may be null.  They must be driven on this hart's thread.
+  void set_hpm_caches(const cache_sim_t* icache, const cache_sim_t* dcache);
+  // How many times event has happened on this hart so far
+  uint64_t hpm_event_count(reg_t event) const;
+  // Hands every conditional branch this hart executes to t, which may be
+  // null, in batches (see branchtracer_t).
+  void set_branch_tracer(branchtracer_t* t);
+  branchtracer_t* get_branch_tracer() { return branch_tracer; }
+  void log_branch(reg_t pc, bool taken)
+  {
+    branch_buffer[branch_buffered++] = {pc, taken};
+    if (branch_buffered == BRANCH_BUFFER_SIZE)
+      flush_branches();
+  }
+  // Delivers the buffered branches.
+  void flush_branches();
+#ifdef RISCV_ENABLE_SIFT
+  void set_sift_async(bool value);
+  void set_sift_roi_only(bool value);
+  bool get_sift_roi_only() const { return sift_roi_only; }
+  void set_sift_code_pages(bool value);
+  void set_sift_compression(bool value);
+  void set_sift_va2pa(bool value);
+  void set_sift_fifo(bool value);
+  void set_sift_segment(uint64_t length);
+  // Before the ROI, keep a footprint of up to lines cache lines and
+  // branches to warm the reader with when the ROI starts.
+  void set_sift_warmup(size_t lines);
+  // Sample the trace periodically: each period runs skip instructions
+  // untraced, warm more into the warmup footprint, then traces detail
+  // between ROI markers, each window in a segment of its own if the trace
+  // is segmented.  A detail of 0 turns sampling off.
+  void set_sift_period(uint64_t skip, uint64_t warm, uint64_t detail);
+  void set_sift_syscalls(bool value) { state.log_sift_syscalls = value; }
+  // Split traced vector instructions into micro-ops of bits of register
+  // group each, a power of two of at least 8, or not at all if bits is 0.
+  void set_sift_uop_width(reg_t bits);
+  // Enters the phase of the sampling period that retired falls in and
+  // returns the instret it ends at, or 0 if not sampling.
+  uint64_t sift_phase_stop(uint64_t retired);
+  // Counts a traced instruction at pc, first starting a new segment if the
+  // current one is full.
+  void next_sift_insn(reg_t pc);
+  // Continue the trace in a new stream named after prefix, which must
+  // outlive the hart, abandoning the current stream unfinished.
+  void restart_sift_stream(const char* prefix);
+  void sift_sync() { state.log_writer->Sync(); }
+  const sift_writer_config_t& get_sift_config() const { return sift_config; }
+  // The most memory addresses one instruction can log for the SIFT trace.
+  size_t max_logged_addresses() const;
+#endif
 #ifdef RISCV_ENABLE_COMMITLOG
-  void enable_log_commits();
+  // With binary set, records are buffered and written in the format of
+  // commit_log.h instead of as text; with compact also set, a vector
+  // register's record holds only the bytes the instruction wrote.
+  void enable_log_commits(bool binary, bool compact = false);
+  // Record binary commit records as enable_log_commits does, but keep them
+  // in the writer for the host to take instead of writing them to the log.
+  void capture_commits(bool compact = false);
   bool get_log_commits_enabled() const { return log_commits_enabled; }
+  commit_log_writer_t* get_commit_log_writer() { return commit_log_writer; }
+  // Whether instructions record the registers and memory they access for
+  // the commit log.  The records are left stale, not cleared, while this is
+  // false.
+  bool get_log_capturing() const { return log_commits_enabled; }
 #endif
+  // With an instruction log set, -l output is recorded on the fast path and
+  // formatted by the log's own thread instead of going through disasm().
+  void set_insn_log(insn_log_t* log);
+  insn_log_batch_t* get_insn_log_batch() { return insn_log_batch; }
   void reset();
+  void save_checkpoint(checkpoint_writer_t& ckpt);
+  void restore_checkpoint(checkpoint_reader_t& ckpt);
+  // Writes CSR values back in the order they depend on each other, leaving
+  // out the vector configuration; the counters are left to the caller.
+  void restore_csrs(const std::map<reg_t, reg_t>& csrs);
+  // Takes the hart's registers from a QEMU checkpoint, leaving those it
+  // lacks as reset left them; see qemu_ckpt.h.
+  void import_qemu_state(const qemu_regs_t& regs);
   void step(size_t n); // run for n cycles
+  // True while the hart is stalled in WFI with no enabled interrupt pending
+  // and no halt request, so stepping it would make no progress.
+  bool is_waiting_for_interrupt() const
+  {
+    return in_wfi && halt_request == HR_NONE &&
+           !(state.mip->read() & state.mie->read());
+  }
+  // Whether the last step() ended in WFI, which checkpoints leave out.
+  bool get_in_wfi() const { return in_wfi; }
+  void set_in_wfi(bool value) { in_wfi = value; }
+  // True if the last step() ended early at an interactive breakpoint or
+  // watchpoint (see mmu_t::set_breakpoint), before the instruction at pc.
+  bool is_interactive_stopped() const { return interactive_stopped; }
   void put_csr(int which, reg_t val);
   uint32_t get_id() const { return id; }
   reg_t get_csr(int which, insn_t insn, bool write, bool peek = 0);
@@ -289,11 +628,10 @@ public:
     return !custom_extensions.empty();
   }
   bool extension_enabled(unsigned char ext) const {
-    if (ext >= 'A' && ext <= 'Z')
-      return state.misa->extension_enabled(ext);
-    else
-      return isa->extension_enabled(ext);
+    return (extension_mask[ext / 64] >> (ext % 64)) & 1;
   }
+  // Recompute extension_mask after misa or the ISA string changes.
+  void update_extension_mask();
   // Is this extension enabled? and abort if this extension can
   // possibly be disabled dynamically. Useful for documenting
   // assumptions about writable misa bits.
@@ -317,12 +655,12 @@ public:
   reg_t legalize_privilege(reg_t);
   void set_privilege(reg_t);
   void set_virt(bool);
-  void update_histogram(reg_t pc);
+  void count_execution(icache_entry_t* entry, reg_t pc, insn_t insn);
+  void count_executions(reg_t pc, insn_bits_t bits, uint64_t n);
   const disassembler_t* get_disassembler() { return disassembler; }
 
   FILE *get_log_file() { return log_file; }
 
-  void register_insn(insn_desc_t);
   void register_extension(extension_t*);
 
   // MMIO slave interface
@@ -347,6 +685,12 @@ public:
   void set_mmu_capability(int cap);
 
   const char* get_symbol(uint64_t addr);
+  // The symbol whose range holds addr, setting start to its address;
+  // nullptr if there is none.  The last range found is kept, since
+  // successive lookups mostly land in the same function.
+  const char* get_enclosing_symbol(uint64_t addr, uint64_t* start);
+  // Called when stimecmp, vstimecmp or htimedelta is written.
+  void timer_changed();
 
   mmu_t *debug_mmu;
 
@@ -356,26 +700,95 @@ private:
   simif_t* sim;
   mmu_t* mmu; // main memory is always accessed via the mmu
   std::unordered_map<std::string, extension_t*> custom_extensions;
-  disassembler_t* disassembler;
+  std::vector<extension_t*> extensions_in_order;  // as registered
+  disassembler_t* disassembler;  // insn_tables->disassembler
   state_t state;
   uint32_t id;
   unsigned xlen;
   bool histogram_enabled;
+  bool in_wfi = false;
+  bool interactive_stopped = false;
   bool log_commits_enabled;
+  commit_log_writer_t* commit_log_writer = nullptr;
+  insn_log_t* insn_log = nullptr;
+  insn_log_batch_t* insn_log_batch = nullptr;
   FILE *log_file;
   std::ostream sout_; // needed for socket command interface -s, also used for -d and -l, but not for --log
   bool halt_on_reset;
   std::vector<bool> impl_table;
-
-  std::vector<insn_desc_t> instructions;
-  std::map<reg_t,uint64_t> pc_histogram;
+  // Every extension_enabled() answer, one bit per extension: the misa
+  // letters come from misa, the rest from the ISA string.  Instruction
+  // handlers check extensions on every execution, so this saves them the
+  // branch and the misa or vector<bool> lookup.
+  uint64_t extension_mask[4];
+
+  // Instructions executed per PC.  On the fast path the counts accumulate
+  // in icache entries and are only folded in here when an entry is evicted
+  // or flushed.
+  std::unordered_map<reg_t,uint64_t> pc_histogram;
+  bool histogram_by_symbol = false;
+
+  // Instructions executed per encoding, and per encoding << 8 | the low
+  // vtype bits (vsew and vlmul) for vector instructions, whose entries in
+  // the icache are not counted since vtype can differ between executions.
+  bool insn_mix_enabled = false;
+  bool counting_executions = false;
+  bool stats_paused = false;
+  std::unordered_map<insn_bits_t,uint64_t> insn_mix;
+  std::unordered_map<uint64_t,uint64_t> vector_insn_mix;
+  static bool is_vector_insn(insn_bits_t bits)
+  {
+    switch (bits & 0x7f) {
+      case 0x57: // OP-V
+        return true;
+      case 0x07: // LOAD-FP
+      case 0x27: // STORE-FP
+        return ((bits >> 12) & 7) == 0 || ((bits >> 12) & 7) >= 5;
+      default:
+        return false;
+    }
+  }
 
   static const size_t OPCODE_CACHE_SIZE = 8191;
   insn_desc_t opcode_cache[OPCODE_CACHE_SIZE];
 
-  void take_pending_interrupt() { take_interrupt(state.mip->read() & state.mie->read()); }
+  // The candidates for an encoding, in the order of instructions, by major
+  // opcode and funct3 (bits 6:0 and 14:12), and then by funct7 (bits 31:25)
+  // where that still leaves more than DECODE_SPLIT of them.  Every list
+  // ends in the catch-all illegal instruction.
+  struct decode_bucket_t {
+    std::vector<const insn_desc_t*> insns;
+    std::vector<std::vector<const insn_desc_t*>> by_funct7;
+  };
+  static const size_t DECODE_BUCKETS = 1 << 10;
+  static const size_t DECODE_SPLIT = 8;
+  const insn_desc_t* lookup_insn(insn_bits_t bits) const;
+
+  // What an ISA and the extensions registered on top of it decode to: the
+  // instructions, their decode table and the disassembler.  Harts with the
+  // same ones share these read-only, so only opcode_cache is per hart.
+  struct insn_tables_t {
+    std::vector<insn_desc_t> instructions;
+    std::vector<decode_bucket_t> decode_table;
+    disassembler_t* disassembler = nullptr;
+    ~insn_tables_t();
+  };
+  std::shared_ptr<const insn_tables_t> insn_tables;
+  void add_extension(extension_t* x);
+  void share_insn_tables();
+  std::shared_ptr<insn_tables_t> build_insn_tables() const;
+
+  // cause of the first enabled interrupt in mask, or 0 if there is none
+  reg_t interrupt_cause(reg_t mask);
+  reg_t pending_interrupt_cause() {
+    if (likely(!state.interrupt_maybe_pending.load(std::memory_order_relaxed)))
+      return 0;
+    return interrupt_cause(state.mip->read() & state.mie->read());
+  }
   void take_interrupt(reg_t mask); // take first enabled interrupt in mask
   void take_trap(trap_t& t, reg_t epc); // take an exception
+  void take_raised_trap(reg_t epc); // take the trap of an insn that returned PC_TRAP
+  void step_after_trap(); // enter debug mode if single-stepping
   void disasm(insn_t insn); // disassemble and print an instruction
   int paddr_bits();
 
@@ -385,19 +798,72 @@ private:
 
   friend class mmu_t;
   friend class clint_t;
+  friend class plic_t;
   friend class extension_t;
 
   void parse_varch_string(const char*);
   void parse_priv_string(const char*);
-  void build_opcode_map();
-  void register_base_instructions();
+  void register_base_instructions(insn_tables_t& tables) const;
+  static void build_opcode_map(insn_tables_t& tables);
   insn_func_t decode_insn(insn_t insn);
+  // The 32-bit instruction that the compressed instruction insn expands
+  // to, for it to run on that instruction's handler: 0 for the jumps and
+  // branches, whose handlers step the pc by their own length or link it,
+  // the floating-point loads and stores, and anything the expansion could
+  // make trap differently.
+  insn_bits_t expand_rvc(insn_t insn);
 
   // Track repeated executions for processor_t::disasm()
   uint64_t last_pc, last_bits, executions;
 
+  // The range get_enclosing_symbol() found last
+  struct {
+    uint64_t start = 0, end = 0;
+    const char* name = nullptr;
+  } symbol_cache;
+
   uint32_t reset_count;
   const char* sift_filename;
+  bool sift_async;
+  bool sift_roi_only;
+#ifdef RISCV_ENABLE_SIFT
+  sift_writer_config_t sift_config;
+  void reopen_sift_stream();
+  void next_sift_segment();
+  enum { SIFT_SKIP, SIFT_WARM, SIFT_DETAIL, SIFT_PHASES };
+  uint64_t sift_period[SIFT_PHASES] = {};
+  unsigned sift_phase = SIFT_SKIP;
+  uint64_t sift_phase_end = 0;  // 0 until anchored at the next stop
+  void enter_sift_phase(unsigned phase);
+#endif
+  uint64_t exceptions_taken;
+  uint64_t interrupts_taken;
+  const cache_sim_t* hpm_icache;
+  const cache_sim_t* hpm_dcache;
+  static const size_t BRANCH_BUFFER_SIZE = 1024;
+  branchtracer_t* branch_tracer;
+  branchtracer_t* paused_branch_tracer = nullptr;  // set while stats_paused
+  branch_record_t branch_buffer[BRANCH_BUFFER_SIZE];
+  size_t branch_buffered;
+  bbv_profiler_t* bbv;
+  call_stack_profiler_t* call_stacks;
+  vector_stats_t* vector_stats;
+  trap_profile_t* trap_profile;
+  hart_observer_t* observer;
+  reg_t observed_pc;       // start of the block being observed
+  reg_t observed_next_pc;  // where it continues if control is not redirected
+  uint64_t observed_insns;
+  std::vector<plugin_t*> plugins;
+  std::vector<std::unique_ptr<plugin_memtracer_t>> plugin_tracers;
+
+  bool trace_filter_enabled;
+  reg_t trace_priv_mask;
+  std::vector<std::pair<reg_t, reg_t>> trace_ranges;
+  std::vector<reg_t> trace_asids;
+  void update_trace_filter(reg_t pc);
+#ifdef RISCV_ENABLE_SIFT
+  void switch_sift_asid(reg_t asid);
+#endif
 
 public:
   entropy_source es; // Crypto ISE Entropy source.
@@ -413,15 +879,47 @@ public:
       char reg_referenced[NVPR];
       int setvl_count;
       reg_t vlmax;
-      reg_t vlenb;
       csr_t_p vxsat;
       vector_csr_t_p vxrm, vstart, vl, vtype;
       reg_t vma, vta;
       reg_t vsew;
       float vflmul;
-      reg_t ELEN, VLEN;
+      // A build configured --with-fixed-vlen/--with-fixed-elen turns these
+      // into constants, so element counts and register strides fold away.
+#ifdef RISCV_FIXED_VLEN
+      static constexpr reg_t VLEN = RISCV_FIXED_VLEN;
+      static constexpr reg_t vlenb = RISCV_FIXED_VLEN / 8;
+#else
+      reg_t VLEN = 0;
+      reg_t vlenb = 0;
+#endif
+#ifdef RISCV_FIXED_ELEN
+      static constexpr reg_t ELEN = RISCV_FIXED_ELEN;
+#else
+      reg_t ELEN = 0;
+#endif
       bool vill;
       bool vstart_alu;
+      // Whether the elements that vta and vma make agnostic are filled with
+      // ones (--varch agnostic:1), which the spec allows, to shake out
+      // software that relies on them being left undisturbed, as they are by
+      // default at no cost.
+      bool agnostic_ones;
+      // Fills the tail of the register group vd, of esz-byte elements and
+      // LMUL registers, past vl if vta, and the elements in [vstart, vl)
+      // that v0 masked off if masked and vma, with ones.
+      void fill_agnostic(reg_t vd, reg_t esz, reg_t vstart, reg_t vl, bool masked);
+
+      // The configuration summed up for require_vector, so that a vector
+      // instruction checks one word: VCFG_LEGAL while vtype is legal, and
+      // VCFG_ALU_READY while arithmetic may also start, vstart being 0 or
+      // vstart_alu set.  set_vl and every write of vstart recompute it.
+      enum { VCFG_LEGAL = 1, VCFG_ALU_READY = 2 };
+      uint8_t vcfg;
+      void update_vcfg()
+      {
+        vcfg = vill ? 0 : VCFG_LEGAL | (vstart_alu || vstart->read() == 0 ? VCFG_ALU_READY : 0);
+      }
 
       // vector element for varies SEW
       template<class T>
@@ -439,13 +937,58 @@ public:
           reg_referenced[vReg] = 1;
 
 #ifdef RISCV_ENABLE_COMMITLOG
-          if (is_write)
-            p->get_state()->log_reg_write[((vReg) << 4) | 2] = {0, 0};
+          if (is_write && p->get_log_capturing())
+            p->get_state()->log_reg_write.add_vreg_bytes(vReg, n * sizeof(T), (n + 1) * sizeof(T));
+#endif
+#ifdef RISCV_ENABLE_SIFT
+          if (is_write && p->get_state()->log_sift_active)
+            p->get_state()->log_vreg_write |= reg_t(1) << vReg;
 #endif
 
           T *regStart = (T*)((char*)reg_file + vReg * (VLEN >> 3));
           return regStart[n];
         }
+
+      // The register group starting at vReg as a single span.  The registers
+      // holding elements [start, end) are marked referenced (and logged, for
+      // writes) here, once, instead of on every element access.
+      template<class T>
+        vreg_span_t<T> elt_group(reg_t vReg, reg_t start, reg_t end, bool is_write = false) {
+          assert(vsew != 0);
+          assert((VLEN >> 3)/sizeof(T) > 0);
+          reg_t elts_per_reg = (VLEN >> 3) / (sizeof(T));
+          if (start < end) {
+            reg_t first = vReg + start / elts_per_reg, last = vReg + (end - 1) / elts_per_reg;
+            for (reg_t r = first; r <= last; r++) {
+              reg_referenced[r] = 1;
+#ifdef RISCV_ENABLE_COMMITLOG
+              if (is_write && p->get_log_capturing())
+                p->get_state()->log_reg_write.add_vreg_bytes(r,
+                  r == first ? start % elts_per_reg * sizeof(T) : 0,
+                  r == last ? ((end - 1) % elts_per_reg + 1) * sizeof(T) : VLEN >> 3);
+#endif
+#ifdef RISCV_ENABLE_SIFT
+              if (is_write && p->get_state()->log_sift_active)
+                p->get_state()->log_vreg_write |= reg_t(1) << r;
+#endif
+            }
+          }
+
+          T *regStart = (T*)((char*)reg_file + vReg * (VLEN >> 3));
+          return vreg_span_t<T>(regStart, elts_per_reg);
+        }
+
+      // Active elements among the 64 starting at base, a multiple of 64
+      // below vl and no earlier than vstart's word: those in [vstart, vl)
+      // that v0 enables, or all of them for an unmasked instruction.
+      uint64_t active_mask(reg_t base, reg_t vstart, reg_t vl, bool masked) {
+        uint64_t bits = masked ? elt<uint64_t>(0, base / 64) : UINT64_MAX;
+        if (vstart > base)
+          bits &= UINT64_MAX << (vstart - base);
+        if (vl - base < 64)
+          bits &= (UINT64_C(1) << (vl - base)) - 1;
+        return bits;
+      }
     public:
 
       void reset();
@@ -456,7 +999,6 @@ public:
         reg_referenced{0},
         setvl_count(0),
         vlmax(0),
-        vlenb(0),
         vxsat(0),
         vxrm(0),
         vstart(0),
@@ -466,10 +1008,10 @@ public:
         vta(0),
         vsew(0),
         vflmul(0),
-        ELEN(0),
-        VLEN(0),
         vill(false),
-        vstart_alu(false) {
+        vstart_alu(false),
+        agnostic_ones(false),
+        vcfg(0) {
       }
 
       ~vectorUnit_t() {
@@ -0,0 +1,207 @@
+// See LICENSE for license details.
+
+#include "progress.h"
+#include "sim.h"
+#include "processor.h"
+#include "mmu.h"
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cinttypes>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <unistd.h>
+
+constexpr std::chrono::milliseconds progress_reporter_t::POLL_INTERVAL;
+
+// How long a scraper that has connected may take to send its request
+static const int REQUEST_TIMEOUT_MS = 100;
+
+progress_reporter_t::progress_reporter_t(sim_t* sim, const char* path, uint16_t port, double interval)
+  : sim(sim), file(NULL), socket_fd(-1), interval(interval)
+{
+  if (path) {
+    file = strcmp(path, "-") == 0 ? stderr : fopen(path, "w");
+    if (!file)
+      throw std::runtime_error(std::string("could not open progress file ") + path);
+  }
+
+  if (port) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port);
+    int reuseaddr = 1;
+    socket_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (socket_fd < 0 ||
+        setsockopt(socket_fd, SOL_SOCKET, SO_REUSEADDR, &reuseaddr, sizeof(reuseaddr)) != 0 ||
+        bind(socket_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        listen(socket_fd, 4) != 0 ||
+        fcntl(socket_fd, F_SETFL, O_NONBLOCK) != 0)
+      throw std::runtime_error(std::string("could not serve metrics on port ") + std::to_string(port) +
+                               ": " + strerror(errno));
+  }
+
+  start = last_report = next_poll = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < sim->nprocs(); i++)
+    harts.push_back(sample(i));
+}
+
+progress_reporter_t::~progress_reporter_t()
+{
+  if (file) {
+    report(std::chrono::duration<double>(std::chrono::steady_clock::now() - last_report).count());
+    if (file != stderr)
+      fclose(file);
+  }
+  if (socket_fd >= 0)
+    close(socket_fd);
+}
+
+progress_reporter_t::hart_t progress_reporter_t::sample(size_t i)
+{
+  processor_t* proc = sim->get_core(i);
+  hart_t h = {};
+  h.instret = proc->get_state()->minstret->read();
+  h.tlb_misses = proc->get_mmu()->get_tlb_misses();
+  h.icache_misses = proc->get_mmu()->get_icache_misses();
+#ifdef RISCV_ENABLE_SIFT
+  h.in_roi = proc->get_state()->log_sift_in_roi;
+#else
+  h.in_roi = true;
+#endif
+  return h;
+}
+
+uint64_t progress_reporter_t::sift_bytes()
+{
+  uint64_t bytes = 0;
+#ifdef RISCV_ENABLE_SIFT
+  bytes = sift_stream_t::closed_bytes;
+  for (size_t i = 0; i < sim->nprocs(); i++)
+    bytes += sim->get_core(i)->get_state()->sift_bytes();
+#endif
+  return bytes;
+}
+
+void progress_reporter_t::poll(std::chrono::steady_clock::time_point now)
+{
+  double elapsed = std::chrono::duration<double>(now - last_report).count();
+  if (elapsed >= interval.count()) {
+    report(elapsed);
+    last_report = now;
+  }
+  if (socket_fd >= 0)
+    serve();
+}
+
+void progress_reporter_t::report(double elapsed)
+{
+  uint64_t total = 0;
+  double total_mips = 0;
+  for (size_t i = 0; i < harts.size(); i++) {
+    hart_t h = sample(i);
+    uint64_t insns = h.instret - harts[i].instret;
+    h.mips = elapsed > 0 ? insns / elapsed / 1e6 : 0;
+    h.tlb_mpki = insns ? (h.tlb_misses - harts[i].tlb_misses) * 1000.0 / insns : 0;
+    h.icache_mpki = insns ? (h.icache_misses - harts[i].icache_misses) * 1000.0 / insns : 0;
+    harts[i] = h;
+    total += h.instret;
+    total_mips += h.mips;
+  }
+  if (!file)
+    return;
+
+  double uptime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  fprintf(file, "progress: time=%.1f insns=%" PRIu64 " mips=%.2f sift_bytes=%" PRIu64,
+          uptime, total, total_mips, sift_bytes());
+  for (size_t i = 0; i < harts.size(); i++) {
+    const hart_t& h = harts[i];
+    fprintf(file, " | hart=%zu insns=%" PRIu64 " mips=%.2f roi=%d tlb_mpki=%.3f icache_mpki=%.3f",
+            i, h.instret, h.mips, h.in_roi, h.tlb_mpki, h.icache_mpki);
+  }
+  fputc('\n', file);
+  fflush(file);
+}
+
+// Counters are read as of the scrape, so a scraper can take its own
+// rates; the gauges are those of the last report.
+std::string progress_reporter_t::metrics()
+{
+  std::string s;
+  char line[160];
+  double uptime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  snprintf(line, sizeof(line),
+           "# TYPE spike_uptime_seconds gauge\nspike_uptime_seconds %.3f\n"
+           "# TYPE spike_sift_bytes_total counter\nspike_sift_bytes_total %" PRIu64 "\n",
+           uptime, sift_bytes());
+  s += line;
+
+  std::vector<hart_t> now;
+  for (size_t i = 0; i < harts.size(); i++)
+    now.push_back(sample(i));
+
+  struct metric_t {
+    const char* name;
+    const char* type;
+    std::function<std::string(size_t)> value;
+  };
+  const metric_t metrics[] = {
+    {"spike_instret_total", "counter", [&](size_t i) { return std::to_string(now[i].instret); }},
+    {"spike_tlb_misses_total", "counter", [&](size_t i) { return std::to_string(now[i].tlb_misses); }},
+    {"spike_icache_misses_total", "counter", [&](size_t i) { return std::to_string(now[i].icache_misses); }},
+    {"spike_in_roi", "gauge", [&](size_t i) { return std::to_string(int(now[i].in_roi)); }},
+    {"spike_mips", "gauge", [&](size_t i) { return std::to_string(harts[i].mips); }},
+    {"spike_tlb_mpki", "gauge", [&](size_t i) { return std::to_string(harts[i].tlb_mpki); }},
+    {"spike_icache_mpki", "gauge", [&](size_t i) { return std::to_string(harts[i].icache_mpki); }},
+  };
+  for (auto& m : metrics) {
+    s += std::string("# TYPE ") + m.name + " " + m.type + "\n";
+    for (size_t i = 0; i < harts.size(); i++)
+      s += std::string(m.name) + "{hart=\"" + std::to_string(i) + "\"} " + m.value(i) + "\n";
+  }
+  return s;
+}
+
+// Answers every scraper waiting to connect, whatever it asked for.
+void progress_reporter_t::serve()
+{
+  while (true) {
+    int client = accept(socket_fd, NULL, NULL);
+    if (client < 0)
+      return;
+
+    // Read the request, so that closing the connection does not reset it
+    // before the reply is read.
+    std::string request;
+    struct pollfd pfd = {client, POLLIN, 0};
+    char buf[1024];
+    while (request.find("\r\n\r\n") == std::string::npos && request.size() < 64 * 1024 &&
+           ::poll(&pfd, 1, REQUEST_TIMEOUT_MS) > 0) {
+      ssize_t n = read(client, buf, sizeof(buf));
+      if (n <= 0)
+        break;
+      request.append(buf, n);
+    }
+
+    std::string body = metrics();
+    std::string reply = "HTTP/1.0 200 OK\r\n"
+                        "Content-Type: text/plain; version=0.0.4\r\n"
+                        "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                        "Connection: close\r\n\r\n" + body;
+    for (size_t done = 0; done < reply.size(); ) {
+      ssize_t n = send(client, reply.data() + done, reply.size() - done, MSG_NOSIGNAL);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        break;
+      done += n;
+    }
+    close(client);
+  }
+}
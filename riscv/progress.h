@@ -0,0 +1,71 @@
+// See LICENSE for license details.
+#ifndef _RISCV_PROGRESS_H
+#define _RISCV_PROGRESS_H
+
+#include "decode.h"
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+class sim_t;
+
+// Reports how a long run is going: each hart's instret and MIPS, whether
+// it is in the ROI, its TLB and icache misses per thousand instructions,
+// and how much SIFT trace has been written.  Every interval seconds of
+// wall-clock time a line of key=value pairs goes to a file or to stderr,
+// and a Prometheus scraper may fetch the same figures, as counters and
+// gauges, over HTTP from a port.  Both are serviced between rounds of
+// quanta (see sim_t::advance_time), so a round's worth of instructions
+// bounds how late a report or a scrape's reply can be.
+class progress_reporter_t
+{
+public:
+  // path is a file, "-" for stderr, or NULL for none; port is the TCP
+  // port to serve metrics on, or 0 for none.
+  progress_reporter_t(sim_t* sim, const char* path, uint16_t port, double interval);
+  ~progress_reporter_t();
+
+  void tick()
+  {
+    auto now = std::chrono::steady_clock::now();
+    if (now >= next_poll) {
+      next_poll = now + POLL_INTERVAL;
+      poll(now);
+    }
+  }
+
+private:
+  static constexpr std::chrono::milliseconds POLL_INTERVAL{100};
+
+  struct hart_t {
+    uint64_t instret;
+    uint64_t tlb_misses;
+    uint64_t icache_misses;
+    bool in_roi;
+    // Over the interval up to the last report
+    double mips;
+    double tlb_mpki;
+    double icache_mpki;
+  };
+
+  hart_t sample(size_t i);
+  void poll(std::chrono::steady_clock::time_point now);
+  // Takes the rates over the interval since the last report, which ended
+  // elapsed seconds ago, and writes them to the file.
+  void report(double elapsed);
+  void serve();
+  std::string metrics();
+  uint64_t sift_bytes();
+
+  sim_t* sim;
+  FILE* file;
+  int socket_fd;
+  std::chrono::duration<double> interval;
+  std::chrono::steady_clock::time_point start;
+  std::chrono::steady_clock::time_point last_report;
+  std::chrono::steady_clock::time_point next_poll;
+  std::vector<hart_t> harts;  // as of the last report
+};
+
+#endif
@@ -0,0 +1,214 @@
+// See LICENSE for license details.
+
+#include "qemu_ckpt.h"
+#include "sim.h"
+#include "processor.h"
+#include "devices.h"
+#include "mmu.h"
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+
+static uint64_t parse_hex(const std::string& name, const std::string& value)
+{
+  char* end;
+  uint64_t v = strtoull(value.c_str(), &end, 16);
+  if (value.empty() || *end)
+    throw std::runtime_error("QEMU checkpoint: " + name + " is not a hex number: " + value);
+  return v;
+}
+
+// Whether name is the prefix followed by a number, which goes in n
+static bool numbered(const std::string& name, const char* prefix, size_t* n)
+{
+  size_t len = strlen(prefix);
+  if (name.size() <= len || name.compare(0, len, prefix) != 0 ||
+      name.find_first_not_of("0123456789", len) != std::string::npos)
+    return false;
+  *n = strtoul(name.c_str() + len, NULL, 10);
+  return true;
+}
+
+static void warn_unknown(const std::string& name)
+{
+  static std::set<std::string> warned;
+  if (warned.insert(name).second)
+    fprintf(stderr, "warning: QEMU checkpoint register %s is not known here; skipping it\n",
+            name.c_str());
+}
+
+qemu_ckpt_t read_qemu_registers(const std::string& path)
+{
+  std::ifstream in(path);
+  if (!in)
+    throw std::runtime_error("could not open QEMU checkpoint registers " + path);
+
+  qemu_ckpt_t ckpt;
+  qemu_regs_t* section = nullptr;
+  std::string line, token, name;
+  for (size_t lineno = 1; std::getline(in, line); lineno++) {
+    line = line.substr(0, line.find('#'));
+    std::istringstream tokens(line);
+    while (tokens >> token) {
+      size_t cpu;
+      if (token == "=") {
+        continue;
+      } else if (name.empty() && numbered(token, "CPU#", &cpu)) {
+        if (ckpt.harts.size() <= cpu)
+          ckpt.harts.resize(cpu + 1);
+        section = &ckpt.harts[cpu];
+      } else if (name.empty() && token == "CLINT") {
+        section = &ckpt.clint;
+      } else if (name.empty() && token == "UART") {
+        section = &ckpt.uart;
+      } else if (name.empty()) {
+        name = token;
+      } else {
+        if (!section) {
+          ckpt.harts.resize(1);
+          section = &ckpt.harts[0];
+        }
+        section->push_back({name, token});
+        name.clear();
+      }
+    }
+    if (!name.empty())
+      throw std::runtime_error(path + ":" + std::to_string(lineno) + ": " + name + " has no value");
+  }
+  return ckpt;
+}
+
+void processor_t::import_qemu_state(const qemu_regs_t& regs)
+{
+  static const std::map<std::string, reg_t> csr_names = {
+    #define DECLARE_CSR(name, number) {#name, number},
+    #include "encoding.h"
+    #undef DECLARE_CSR
+  };
+
+  std::map<reg_t, reg_t> csrs;
+  reg_t prv = PRV_M;
+  bool v = false;
+  for (auto& reg : regs) {
+    // QEMU writes x1/ra, f8/fs0 and so on.
+    std::string name = reg.first.substr(0, reg.first.find('/'));
+    size_t n;
+    if (name == "pc") {
+      state.pc = parse_hex(name, reg.second);
+    } else if (name == "priv") {
+      std::string mode = reg.second;
+      v = !mode.empty() && mode[0] == 'V';
+      mode = mode.substr(v);
+      prv = mode == "M" ? PRV_M : mode == "S" ? PRV_S : mode == "U" ? PRV_U :
+            parse_hex(name, mode);
+    } else if (name == "V") {
+      v = parse_hex(name, reg.second);
+    } else if (numbered(name, "x", &n) && n < NXPR) {
+      if (n != 0)
+        state.XPR.write(n, parse_hex(name, reg.second));
+    } else if (numbered(name, "f", &n) && n < NFPR) {
+      state.FPR.write(n, freg(f64(parse_hex(name, reg.second))));
+    } else if (numbered(name, "v", &n) && n < NVPR) {
+      const std::string& hex = reg.second;
+      if (VU.VLEN == 0 || hex.size() != 2 * VU.vlenb)
+        throw std::runtime_error("QEMU checkpoint: " + name + " does not have this hart's VLEN");
+      // The last two digits are byte 0.
+      uint8_t* bytes = (uint8_t*)VU.reg_file + n * VU.vlenb;
+      for (size_t i = 0; i < VU.vlenb; i++)
+        bytes[i] = parse_hex(name, hex.substr(hex.size() - 2 * (i + 1), 2));
+    } else if (csr_names.count(name) && state.csrmap.count(csr_names.at(name))) {
+      csrs[csr_names.at(name)] = parse_hex(name, reg.second);
+    } else {
+      warn_unknown(reg.first);
+    }
+  }
+
+  std::map<reg_t, reg_t> writable;
+  for (auto& [addr, val] : csrs)
+    if (addr != CSR_MISA && (addr >> 10) != 3)
+      writable[addr] = val;
+  restore_csrs(writable);
+
+  // As in restore_checkpoint, the counters absorb the bump that follows.
+  if (csrs.count(CSR_MINSTRET)) {
+    state.minstret->write(csrs[CSR_MINSTRET]);
+    state.minstret->bump(1);
+  }
+  if (csrs.count(CSR_MCYCLE)) {
+    state.mcycle->write(csrs[CSR_MCYCLE]);
+    state.mcycle->bump(1);
+  }
+  if (VU.VLEN != 0 && csrs.count(CSR_VTYPE)) {
+    VU.set_vl(1, 1, csrs[CSR_VL], csrs[CSR_VTYPE]);
+    VU.vstart->write_raw(csrs[CSR_VSTART]);
+  }
+
+  set_privilege(prv);
+  set_virt(v);
+  mmu->flush_tlb();
+  mmu->flush_g_stage();
+  mmu->flush_icache();
+  mmu->yield_load_reservation();
+}
+
+void clint_t::import_qemu_state(const qemu_regs_t& regs)
+{
+  for (auto& reg : regs) {
+    size_t n;
+    if (reg.first == "mtime")
+      mtime = parse_hex(reg.first, reg.second);
+    else if (numbered(reg.first, "mtimecmp", &n) && n < mtimecmp.size())
+      mtimecmp[n] = parse_hex(reg.first, reg.second);
+    else
+      warn_unknown("CLINT " + reg.first);
+  }
+  sync_all();
+  increment(0);
+}
+
+void ns16550_t::import_qemu_state(const qemu_regs_t& regs)
+{
+  for (auto& reg : regs) {
+    uint8_t val = parse_hex(reg.first, reg.second);
+    if (reg.first == "ier")
+      ier = val & 0x0f;
+    else if (reg.first == "fcr")
+      fifo_enabled = val & 1;
+    else if (reg.first == "lcr")
+      lcr = val;
+    else if (reg.first == "mcr")
+      mcr = val;
+    else if (reg.first == "scr")
+      scr = val;
+    else if (reg.first == "dll")
+      dll = val;
+    else if (reg.first == "dlm")
+      dlm = val;
+    else
+      warn_unknown("UART " + reg.first);
+  }
+  update_interrupt();
+}
+
+void sim_t::import_qemu_checkpoint(const std::string& dir)
+{
+  qemu_ckpt_t ckpt = read_qemu_registers(dir + "/" QEMU_CKPT_REGISTERS);
+  if (ckpt.harts.size() != procs.size())
+    throw std::runtime_error("QEMU checkpoint has " + std::to_string(ckpt.harts.size()) +
+                             " harts, not " + std::to_string(procs.size()));
+  if (!ckpt.clint.empty() && !clint)
+    throw std::runtime_error("QEMU checkpoint has CLINT state, but there is no CLINT");
+  if (!ckpt.uart.empty() && uarts.empty())
+    throw std::runtime_error("QEMU checkpoint has UART state, but there is no UART");
+
+  load_memory_dump(dir + "/" QEMU_CKPT_MEMORY);
+  for (size_t i = 0; i < procs.size(); i++)
+    procs[i]->import_qemu_state(ckpt.harts[i]);
+  if (!ckpt.clint.empty())
+    clint->import_qemu_state(ckpt.clint);
+  if (!ckpt.uart.empty())
+    uarts[0].second->import_qemu_state(ckpt.uart);
+}
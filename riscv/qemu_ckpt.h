@@ -0,0 +1,50 @@
+// See LICENSE for license details.
+#ifndef _RISCV_QEMU_CKPT_H
+#define _RISCV_QEMU_CKPT_H
+
+#include <string>
+#include <utility>
+#include <vector>
+
+// An architectural checkpoint taken in QEMU, so that a run can get to its
+// region of interest at QEMU's speed and continue from there in spike.  It
+// is a directory holding
+//
+//   memory.elf     what the QEMU monitor's "dump-guest-memory memory.elf"
+//                  writes (without -p): a PT_LOAD segment per RAM block at
+//                  its guest-physical address
+//   registers.txt  what "info registers -a" prints, with the vector
+//                  registers if QEMU shows them, and the device state
+//
+// registers.txt is a sequence of sections, each a heading and then
+// whitespace-separated <name> <hex value> pairs, any '=' between them and
+// anything after '#' ignored:
+//
+//   CPU#<n>   hart n: pc, priv (M, S or U, prefixed with V when
+//             virtualized; M if absent), V (1 when virtualized),
+//             x<n>[/<abi>], f<n>[/<abi>] (64 bits), v<n> (VLEN bits, most
+//             significant first) and any CSR by its name
+//   CLINT     mtime and mtimecmp<n>
+//   UART      the ns16550's ier, fcr, lcr, mcr, scr, dll and dlm
+//
+// Registers before the first heading belong to hart 0, as in the output of
+// a plain "info registers".  Registers left out keep their reset values.
+// Names spike does not know are skipped with a warning, and misa with the
+// read-only CSRs, since --isa and the hart decide those.
+#define QEMU_CKPT_MEMORY "memory.elf"
+#define QEMU_CKPT_REGISTERS "registers.txt"
+
+// One section of registers.txt, in order
+typedef std::vector<std::pair<std::string, std::string>> qemu_regs_t;
+
+struct qemu_ckpt_t
+{
+  std::vector<qemu_regs_t> harts;  // by CPU number
+  qemu_regs_t clint;
+  qemu_regs_t uart;
+};
+
+// Throws std::runtime_error if the file is missing or malformed.
+qemu_ckpt_t read_qemu_registers(const std::string& path);
+
+#endif
@@ -1,6 +1,7 @@
 #include <arpa/inet.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -29,9 +30,10 @@
 remote_bitbang_t::remote_bitbang_t(uint16_t port, jtag_dtm_t *tap) :
   tap(tap),
   socket_fd(0),
-  client_fd(0),
-  recv_start(0),
-  recv_end(0)
+  commands_start(0),
+  close_requested(false),
+  io_exit(false),
+  client_fd(-1)
 {
   socket_fd = socket(AF_INET, SOCK_STREAM, 0);
   if (socket_fd == -1) {
@@ -74,9 +76,48 @@ remote_bitbang_t::remote_bitbang_t(uint16_t port, jtag_dtm_t *tap) :
     abort();
   }
 
+  if (pipe(wake_fds) == -1) {
+    fprintf(stderr, "remote_bitbang failed to make pipe: %s (%d)\n",
+        strerror(errno), errno);
+    abort();
+  }
+  fcntl(wake_fds[0], F_SETFL, O_NONBLOCK);
+  fcntl(wake_fds[1], F_SETFL, O_NONBLOCK);
+
   printf("Listening for remote bitbang connection on port %d.\n",
       ntohs(addr.sin_port));
   fflush(stdout);
+
+  io = std::thread(&remote_bitbang_t::io_main, this);
+}
+
+remote_bitbang_t::~remote_bitbang_t()
+{
+  {
+    std::lock_guard<std::mutex> guard(io_lock);
+    io_exit = true;
+  }
+  wake_io();
+  io.join();
+
+  if (client_fd >= 0)
+    close(client_fd);
+  close(wake_fds[0]);
+  close(wake_fds[1]);
+  close(socket_fd);
+}
+
+
+
+void remote_bitbang_t::wake_io()
+{
+  // A full pipe already has the thread awake.
+  char c = 0;
+  if (write(wake_fds[1], &c, 1) == -1 && errno != EAGAIN) {
+    fprintf(stderr, "remote_bitbang failed to write to pipe: %s (%d)\n",
+        strerror(errno), errno);
+    abort();
+  }
 }
 
 void remote_bitbang_t::accept()
@@ -90,98 +131,163 @@ void remote_bitbang_t::accept()
           errno);
       abort();
     }
-  } else {
-    fcntl(client_fd, F_SETFL, O_NONBLOCK);
   }
 }
 
-void remote_bitbang_t::tick()
+void remote_bitbang_t::write_all(const std::string& buf)
 {
-  if (client_fd > 0) {
-    execute_commands();
-  } else {
-    this->accept();
+  size_t sent = 0;
+  while (sent < buf.size()) {
+    ssize_t bytes = write(client_fd, buf.data() + sent, buf.size() - sent);
+    if (bytes == -1) {
+      if (errno == EINTR)
+        continue;
+      fprintf(stderr, "failed to write to socket: %s (%d)\n", strerror(errno), errno);
+      abort();
+    }
+    sent += bytes;
   }
 }
 
-void remote_bitbang_t::execute_commands()
+void remote_bitbang_t::io_main()
 {
-  static char send_buf[buf_size];
-  unsigned total_processed = 0;
-  bool quit = false;
-  bool in_rti = tap->state() == RUN_TEST_IDLE;
-  bool entered_rti = false;
-  while (1) {
-    if (recv_start < recv_end) {
-      unsigned send_offset = 0;
-      while (recv_start < recv_end) {
-        uint8_t command = recv_buf[recv_start];
-
-        switch (command) {
-          case 'B': /* fprintf(stderr, "*BLINK*\n"); */ break;
-          case 'b': /* fprintf(stderr, "_______\n"); */ break;
-          case 'r': tap->reset(); break;
-          case '0': tap->set_pins(0, 0, 0); break;
-          case '1': tap->set_pins(0, 0, 1); break;
-          case '2': tap->set_pins(0, 1, 0); break;
-          case '3': tap->set_pins(0, 1, 1); break;
-          case '4': tap->set_pins(1, 0, 0); break;
-          case '5': tap->set_pins(1, 0, 1); break;
-          case '6': tap->set_pins(1, 1, 0); break;
-          case '7': tap->set_pins(1, 1, 1); break;
-          case 'R': send_buf[send_offset++] = tap->tdo() ? '1' : '0'; break;
-          case 'Q': quit = true; break;
-          default:
-                    fprintf(stderr, "remote_bitbang got unsupported command '%c'\n",
-                        command);
-        }
-        recv_start++;
-        total_processed++;
-        if (!in_rti && tap->state() == RUN_TEST_IDLE) {
-          entered_rti = true;
-          break;
-        }
-        in_rti = false;
+  char buf[buf_size];
+  std::unique_lock<std::mutex> guard(io_lock);
+  while (!io_exit) {
+    if (!sending.empty()) {
+      std::string out;
+      out.swap(sending);
+      if (client_fd >= 0) {
+        guard.unlock();
+        write_all(out);
+        guard.lock();
       }
-      unsigned sent = 0;
-      while (sent < send_offset) {
-        ssize_t bytes = write(client_fd, send_buf + sent, send_offset);
-        if (bytes == -1) {
-          fprintf(stderr, "failed to write to socket: %s (%d)\n", strerror(errno), errno);
-          abort();
-        }
-        sent += bytes;
+      continue;
+    }
+
+    if (close_requested) {
+      close_requested = false;
+      received.clear();
+      if (client_fd >= 0) {
+        close(client_fd);
+        client_fd = -1;
       }
+      continue;
     }
 
-    if (total_processed > buf_size || quit || entered_rti) {
-      // Don't go forever, because that could starve the main simulation.
-      break;
+    int fd = client_fd >= 0 ? client_fd : socket_fd;
+    bool want_input = client_fd < 0 || received.size() < max_received;
+    guard.unlock();
+
+    struct pollfd fds[2] = {
+      { wake_fds[0], POLLIN, 0 },
+      { fd, short(want_input ? POLLIN : 0), 0 },
+    };
+    if (poll(fds, 2, -1) == -1 && errno != EINTR) {
+      fprintf(stderr, "remote_bitbang failed to poll: %s (%d)\n",
+          strerror(errno), errno);
+      abort();
     }
+    if (fds[0].revents & POLLIN)
+      while (read(wake_fds[0], buf, buf_size) > 0);
 
-    recv_start = 0;
-    recv_end = read(client_fd, recv_buf, buf_size);
+    if (fd == socket_fd) {
+      guard.lock();
+      if (fds[1].revents & POLLIN)
+        this->accept();
+      continue;
+    }
 
-    if (recv_end == -1) {
-      if (errno == EAGAIN) {
-        break;
-      } else {
+    ssize_t bytes = 0;
+    if (fds[1].revents & (POLLIN | POLLHUP | POLLERR)) {
+      bytes = read(client_fd, buf, buf_size);
+      if (bytes == -1 && errno != EINTR) {
         fprintf(stderr, "remote_bitbang failed to read on socket: %s (%d)\n",
             strerror(errno), errno);
         abort();
       }
     }
-
-    if (quit) {
-      fprintf(stderr, "Remote Bitbang received 'Q'\n");
-    }
-
-    if (recv_end == 0 || quit) {
-      // The remote disconnected.
+    guard.lock();
+    if (bytes > 0) {
+      received.append(buf, bytes);
+    } else if (bytes == 0 && (fds[1].revents & (POLLIN | POLLHUP | POLLERR))) {
+      // The remote disconnected; the commands it sent before still run.
       fprintf(stderr, "Received nothing. Quitting.\n");
       close(client_fd);
-      client_fd = 0;
-      break;
+      client_fd = -1;
     }
   }
 }
+
+void remote_bitbang_t::tick()
+{
+  {
+    std::lock_guard<std::mutex> guard(io_lock);
+    // Whatever follows a 'Q' is dropped with the client.
+    if (close_requested)
+      received.clear();
+    if (received.empty() && commands_start == commands.size())
+      return;
+    bool was_full = received.size() >= max_received;
+    commands.erase(0, commands_start);
+    commands_start = 0;
+    commands.append(received);
+    received.clear();
+    if (was_full)
+      wake_io();
+  }
+  execute_commands();
+}
+
+void remote_bitbang_t::execute_commands()
+{
+  std::string replies;
+  bool quit = false;
+  bool in_rti = tap->state() == RUN_TEST_IDLE;
+  // Don't go forever, because that could starve the main simulation.
+  size_t end = std::min(commands.size(), commands_start + buf_size);
+  while (commands_start < end && !quit) {
+    uint8_t command = commands[commands_start++];
+
+    switch (command) {
+      case 'B': /* fprintf(stderr, "*BLINK*\n"); */ break;
+      case 'b': /* fprintf(stderr, "_______\n"); */ break;
+      case 'r': tap->reset(); break;
+      case '0': tap->set_pins(0, 0, 0); break;
+      case '1': tap->set_pins(0, 0, 1); break;
+      case '2': tap->set_pins(0, 1, 0); break;
+      case '3': tap->set_pins(0, 1, 1); break;
+      case '4': tap->set_pins(1, 0, 0); break;
+      case '5': tap->set_pins(1, 0, 1); break;
+      case '6': tap->set_pins(1, 1, 0); break;
+      case '7': tap->set_pins(1, 1, 1); break;
+      case 'R': replies += tap->tdo() ? '1' : '0'; break;
+      case 'Q': quit = true; break;
+      default:
+                fprintf(stderr, "remote_bitbang got unsupported command '%c'\n",
+                    command);
+    }
+    // Let the harts run after a DMI access that may need them, but
+    // carry on through runs of system bus accesses, which only need
+    // the DM.
+    if (!in_rti && tap->state() == RUN_TEST_IDLE && tap->harts_needed())
+      break;
+    in_rti = false;
+  }
+
+  if (quit) {
+    fprintf(stderr, "Remote Bitbang received 'Q'\n");
+    commands.clear();
+    commands_start = 0;
+  }
+
+  if (!replies.empty() || quit) {
+    std::lock_guard<std::mutex> guard(io_lock);
+    sending += replies;
+    close_requested |= quit;
+  }
+  if (!replies.empty() || quit)
+    wake_io();
+
+  tap->flush();
+}
@@ -3,6 +3,10 @@
 
 #include <stdint.h>
 
+#include <mutex>
+#include <string>
+#include <thread>
+
 #include "jtag_dtm.h"
 
 class remote_bitbang_t
@@ -11,6 +15,7 @@ public:
   // Create a new server, listening for connections from localhost on the given
   // port.
   remote_bitbang_t(uint16_t port, jtag_dtm_t *tap);
+  ~remote_bitbang_t();
 
   // Do a bit of work.
   void tick();
@@ -19,14 +24,31 @@ private:
   jtag_dtm_t *tap;
 
   int socket_fd;
-  int client_fd;
 
   static const ssize_t buf_size = 64 * 1024;
-  char recv_buf[buf_size];
-  ssize_t recv_start, recv_end;
+  // The I/O thread stops reading once this much input is waiting.
+  static const size_t max_received = 1024 * 1024;
+
+  // Commands taken from the I/O thread and not yet executed.
+  std::string commands;
+  size_t commands_start;
+
+  // A thread waits on the sockets with poll(), accepts the client and
+  // moves bytes between it and these buffers, so that tick() only has to
+  // run the commands that have arrived.  It owns client_fd.
+  std::mutex io_lock;
+  std::string received;
+  std::string sending;
+  bool close_requested;
+  bool io_exit;
+  int client_fd;
+  int wake_fds[2];
+  std::thread io;
 
-  // Check for a client connecting, and accept if there is one.
+  void io_main();
+  void wake_io();
   void accept();
+  void write_all(const std::string& buf);
   // Execute any commands the client has for us.
   void execute_commands();
 };
@@ -0,0 +1,232 @@
+// See LICENSE for license details.
+
+// Reverse execution for the interactive debugger.  Every interval steps,
+// sim_t::step takes a snapshot of the harts and the CLINT, and flushes the
+// store TLBs so that the first store to each page since then goes through
+// mmu_t::store_slow_path, which hands the page's old contents to the
+// snapshot.  Going back to a step restores the nearest snapshot before
+// it, undoing the pages of every later one newest first, and re-issues
+// the same step() calls from there.  The harts then take the same
+// path as long as nothing outside them differs: devices other than the
+// CLINT are not restored, and the host serves the program's requests
+// again.
+
+#include "sim.h"
+#include "checkpoint.h"
+#include "mmu.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+void sim_t::set_reverse(uint64_t interval, size_t max_snapshots)
+{
+  reverse_interval = interval;
+  reverse_max_snapshots = max_snapshots;
+  for (auto p : procs)
+    p->get_mmu()->journal_stores = true;
+  debug_mmu->journal_stores = true;
+}
+
+void sim_t::journal_store(reg_t paddr, size_t len)
+{
+  if (reverse_snapshots.empty())
+    return;
+  auto& pages = reverse_snapshots.back().pages;
+  for (reg_t page = paddr & ~reg_t(PGSIZE - 1); page < paddr + len; page += PGSIZE) {
+    if (pages.count(page))
+      continue;
+    char* host = addr_to_mem(page);
+    if (!host)
+      continue;
+    std::unique_ptr<char[]> copy(new char[PGSIZE]);
+    memcpy(copy.get(), host, PGSIZE);
+    pages.emplace(page, std::move(copy));
+  }
+}
+
+void sim_t::take_reverse_snapshot()
+{
+  reverse_snapshot_t snap;
+  snap.position = steps_taken;
+  checkpoint_writer_t ckpt(&snap.state);
+  for (auto proc : procs)
+    proc->save_checkpoint(ckpt);
+  if (clint)
+    clint->save_checkpoint(ckpt);
+  snap.current_step = current_step;
+  snap.current_proc = current_proc;
+  snap.rtc_insns = rtc_insns;
+  for (auto proc : procs)
+    snap.in_wfi.push_back(proc->get_in_wfi());
+  reverse_snapshots.push_back(std::move(snap));
+
+  // The calls before the oldest snapshot left are no longer needed.
+  if (reverse_snapshots.size() > reverse_max_snapshots) {
+    reverse_snapshots.pop_front();
+    uint64_t oldest = reverse_snapshots.front().position;
+    while (!reverse_calls.empty() &&
+           reverse_calls_start + reverse_calls.front().first * reverse_calls.front().second <= oldest) {
+      reverse_calls_start += reverse_calls.front().first * reverse_calls.front().second;
+      reverse_calls.pop_front();
+    }
+  }
+
+  for (auto proc : procs)
+    proc->get_mmu()->flush_store_tlb();
+  debug_mmu->flush_store_tlb();
+}
+
+void sim_t::restore_reverse_snapshot(size_t k)
+{
+  for (size_t j = reverse_snapshots.size(); j-- > k; )
+    for (auto& page : reverse_snapshots[j].pages)
+      memcpy(addr_to_mem(page.first), page.second.get(), PGSIZE);
+  reverse_snapshots.resize(k + 1);
+
+  reverse_snapshot_t& snap = reverse_snapshots[k];
+  snap.pages.clear();
+  checkpoint_reader_t ckpt(snap.state);
+  for (auto proc : procs)
+    proc->restore_checkpoint(ckpt);
+  if (clint)
+    clint->restore_checkpoint(ckpt);
+  current_step = snap.current_step;
+  current_proc = snap.current_proc;
+  rtc_insns = snap.rtc_insns;
+  for (size_t i = 0; i < procs.size(); i++)
+    procs[i]->set_in_wfi(snap.in_wfi[i]);
+  steps_taken = snap.position;
+
+  for (auto proc : procs)
+    proc->get_mmu()->flush_store_tlb();
+  debug_mmu->flush_store_tlb();
+}
+
+// The last snapshot at or before position
+size_t sim_t::reverse_snapshot_before(uint64_t position)
+{
+  size_t k = 0;
+  while (k + 1 < reverse_snapshots.size() && reverse_snapshots[k + 1].position <= position)
+    k++;
+  return k;
+}
+
+// Re-issues the recorded calls from steps_taken up to target, cutting the
+// last one short, and calls after_call after each.
+void sim_t::reverse_replay(uint64_t target, const std::function<void()>& after_call)
+{
+  reverse_replaying = true;
+  uint64_t start = reverse_calls_start;
+  for (auto& call : reverse_calls) {
+    uint64_t n = call.first, count = call.second;
+    uint64_t end = start + n * count;
+    // Skip the whole calls before steps_taken in one go.
+    uint64_t pos = start + std::min(count, (steps_taken - std::min(steps_taken, start)) / n) * n;
+    for (; pos < end && steps_taken < target; pos += n) {
+      uint64_t call_end = std::min(pos + n, target);
+      if (call_end > steps_taken) {
+        step(call_end - steps_taken);
+        if (after_call)
+          after_call();
+      }
+    }
+    start = end;
+    if (steps_taken >= target)
+      break;
+  }
+  reverse_replaying = false;
+}
+
+// Goes back to target, which must not be before the oldest snapshot, and
+// forgets the calls after it.
+bool sim_t::reverse_to(uint64_t target)
+{
+  if (reverse_snapshots.empty() || target < reverse_snapshots.front().position)
+    return false;
+
+  restore_reverse_snapshot(reverse_snapshot_before(target));
+  reverse_replay(target);
+
+  uint64_t start = reverse_calls_start;
+  for (size_t i = 0; i < reverse_calls.size(); i++) {
+    auto& call = reverse_calls[i];
+    uint64_t end = start + call.first * call.second;
+    if (end >= target) {
+      uint64_t whole = (target - start) / call.first;
+      uint64_t part = (target - start) % call.first;
+      reverse_calls.resize(i + 1);
+      call.second = whole;
+      if (whole == 0)
+        reverse_calls.pop_back();
+      if (part != 0)
+        reverse_calls.push_back({part, 1});
+      break;
+    }
+    start = end;
+  }
+  return true;
+}
+
+void sim_t::interactive_reverse_step(const std::string& cmd, const std::vector<std::string>& args)
+{
+  std::ostream out(sout_.rdbuf());
+  if (!reverse_interval) {
+    out << "Reverse execution needs --reverse-interval" << std::endl;
+    return;
+  }
+
+  uint64_t count = args.size() ? strtoull(args[0].c_str(), NULL, 10) : 1;
+  uint64_t oldest = reverse_snapshots.empty() ? steps_taken : reverse_snapshots.front().position;
+  uint64_t target = steps_taken - std::min(count, steps_taken - oldest);
+  if (target != steps_taken - count)
+    out << "Going back only as far as the oldest snapshot" << std::endl;
+
+  set_procs_debug(false);
+  reverse_to(target);
+}
+
+void sim_t::interactive_reverse_continue(const std::string& cmd, const std::vector<std::string>& args)
+{
+  std::ostream out(sout_.rdbuf());
+  if (!reverse_interval) {
+    out << "Reverse execution needs --reverse-interval" << std::endl;
+    return;
+  }
+  if (reverse_snapshots.empty() || steps_taken == reverse_snapshots.front().position) {
+    out << "Nothing to go back to" << std::endl;
+    return;
+  }
+
+  set_procs_debug(false);
+  uint64_t now = steps_taken;
+  if (args.empty()) {
+    reverse_to(reverse_snapshots[reverse_snapshot_before(now - 1)].position);
+    return;
+  }
+
+  // Search the stretches between snapshots from the latest one back, each
+  // from its start, checking the condition after every call.
+  until_cond_t cond = parse_until(args);
+  std::vector<uint64_t> positions;
+  for (auto& snap : reverse_snapshots)
+    positions.push_back(snap.position);
+  for (size_t k = reverse_snapshot_before(now - 1) + 1; k-- > 0; ) {
+    uint64_t end = k + 1 < positions.size() ? std::min(now, positions[k + 1]) : now;
+    uint64_t found = now;
+    restore_reverse_snapshot(reverse_snapshot_before(positions[k]));
+    if (until_holds(cond))
+      found = steps_taken;
+    reverse_replay(end, [&] {
+      if (steps_taken < now && until_holds(cond))
+        found = steps_taken;
+    });
+    if (found != now) {
+      reverse_to(found);
+      return;
+    }
+  }
+
+  out << "The condition did not hold since the oldest snapshot" << std::endl;
+  reverse_to(now);
+}
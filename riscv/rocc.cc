@@ -2,6 +2,7 @@
 
 #include "rocc.h"
 #include "trap.h"
+#include "processor.h"
 #include <cstdlib>
 
 #define customX(n) \
@@ -44,3 +45,111 @@ std::vector<disasm_insn_t*> rocc_t::get_disasms()
   std::vector<disasm_insn_t*> insns;
   return insns;
 }
+
+async_rocc_t::async_rocc_t(size_t queue_depth)
+  : queue_depth(queue_depth), counts(), next(0), worker_exit(false)
+{
+  worker = std::thread(&async_rocc_t::worker_main, this);
+}
+
+async_rocc_t::~async_rocc_t()
+{
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    worker_exit = true;
+  }
+  work_ready.notify_one();
+  worker.join();
+}
+
+void async_rocc_t::worker_main()
+{
+  std::unique_lock<std::mutex> guard(lock);
+  while (true) {
+    work_ready.wait(guard, [&]{ return worker_exit || next < queue.size(); });
+    if (worker_exit)
+      return;
+
+    command_t cmd = queue[next].cmd;
+    guard.unlock();
+    reg_t response = execute(cmd);
+    guard.lock();
+    // The hart only removes entries that are done, so this one is still
+    // at the same place.
+    queue[next].response = response;
+    queue[next].done = true;
+    next++;
+    work_done.notify_all();
+  }
+}
+
+reg_t async_rocc_t::issue(unsigned opcode, rocc_insn_t insn, reg_t xs1, reg_t xs2)
+{
+  // rd is written back later; until then the instruction leaves it as is.
+  reg_t rd = p->get_state()->XPR[insn.rd];
+  std::unique_lock<std::mutex> guard(lock);
+
+  if (insn.funct == ROCC_FENCE_FUNCT) {
+    counts.fences++;
+    write_back(guard, true);
+    return 0;
+  }
+
+  command_t cmd = {opcode, insn, xs1, xs2};
+  guard.unlock();
+  validate(cmd);
+  reg_t due = p->get_state()->minstret->read() + latency(cmd);
+  guard.lock();
+
+  if (queue.size() >= queue_depth) {
+    counts.full_stalls++;
+    work_done.wait(guard, [&]{ return queue.front().done; });
+    write_back(guard, false);
+    // Whatever its latency, the oldest command has to make room.
+    if (queue.size() >= queue_depth) {
+      entry_t& e = queue.front();
+      if (e.cmd.insn.xd)
+        p->get_state()->XPR.write(e.cmd.insn.rd, e.response);
+      queue.pop_front();
+      next--;
+    }
+  }
+
+  queue.push_back({cmd, due, false, 0});
+  counts.commands++;
+  counts.max_queued = std::max<uint64_t>(counts.max_queued, queue.size());
+  work_ready.notify_one();
+  return rd;
+}
+
+void async_rocc_t::write_back(std::unique_lock<std::mutex>& guard, bool all)
+{
+  reg_t now = p->get_state()->minstret->read();
+  while (!queue.empty()) {
+    entry_t& e = queue.front();
+    if (all)
+      work_done.wait(guard, [&]{ return e.done; });
+    else if (!e.done || now < e.due)
+      break;
+
+    if (e.cmd.insn.xd)
+      p->get_state()->XPR.write(e.cmd.insn.rd, e.response);
+    queue.pop_front();
+    next--;
+  }
+}
+
+void async_rocc_t::quantum_end()
+{
+  std::unique_lock<std::mutex> guard(lock);
+  write_back(guard, false);
+}
+
+void async_rocc_t::reset()
+{
+  // Let the model finish what it has started, and drop the responses.
+  std::unique_lock<std::mutex> guard(lock);
+  work_done.wait(guard, [&]{ return next == queue.size(); });
+  queue.clear();
+  next = 0;
+}
@@ -2,6 +2,10 @@
 #define _RISCV_ROCC_H
 
 #include "extension.h"
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
 
 struct rocc_insn_t
 {
@@ -32,6 +36,86 @@ class rocc_t : public extension_t
   std::vector<disasm_insn_t*> get_disasms();
 };
 
+// A RoCC accelerator whose model runs on a thread of its own.  A custom
+// instruction only queues its command, so the hart carries on while the
+// model works through the queue in order.  If the instruction has xd set,
+// rd keeps its old value until the response is written back, which
+// happens at the end of a quantum once the model has finished the command
+// and latency() more instructions have retired on the hart.  Software
+// waits for responses with a fence: any custom instruction with funct
+// ROCC_FENCE_FUNCT, which writes back everything queued before it and
+// gives its own rd 0.  When the queue is full, issuing waits for the
+// oldest command.
+class async_rocc_t : public rocc_t
+{
+ public:
+  struct command_t
+  {
+    unsigned opcode;  // 0-3 for custom0-custom3
+    rocc_insn_t insn;
+    reg_t xs1;
+    reg_t xs2;
+  };
+
+  struct stats_t
+  {
+    uint64_t commands;
+    uint64_t fences;
+    uint64_t full_stalls;  // issues that found the queue full
+    uint64_t max_queued;
+  };
+
+  async_rocc_t(size_t queue_depth = 16);
+  ~async_rocc_t();
+
+  reg_t custom0(rocc_insn_t insn, reg_t xs1, reg_t xs2) override { return issue(0, insn, xs1, xs2); }
+  reg_t custom1(rocc_insn_t insn, reg_t xs1, reg_t xs2) override { return issue(1, insn, xs1, xs2); }
+  reg_t custom2(rocc_insn_t insn, reg_t xs1, reg_t xs2) override { return issue(2, insn, xs1, xs2); }
+  reg_t custom3(rocc_insn_t insn, reg_t xs1, reg_t xs2) override { return issue(3, insn, xs1, xs2); }
+  void reset() override;
+  void quantum_end() override;
+
+  const stats_t& stats() const { return counts; }
+
+ protected:
+  // Runs on the hart when the command issues, and may reject it with
+  // illegal_instruction().
+  virtual void validate(const command_t& cmd) {}
+  // Runs on the model's thread and returns the response for rd.  It must
+  // not throw, and reaches memory through host_memory().
+  virtual reg_t execute(const command_t& cmd) = 0;
+  // How many instructions the hart retires before the response is due.
+  virtual reg_t latency(const command_t& cmd) { return 0; }
+
+ private:
+  struct entry_t
+  {
+    command_t cmd;
+    reg_t due;  // minstret from which the response may be written back
+    bool done;
+    reg_t response;
+  };
+
+  reg_t issue(unsigned opcode, rocc_insn_t insn, reg_t xs1, reg_t xs2);
+  // Writes back the responses at the head of the queue that are due, or
+  // with all set, waits for and writes back every one.
+  void write_back(std::unique_lock<std::mutex>& guard, bool all);
+  void worker_main();
+
+  size_t queue_depth;
+  stats_t counts;
+
+  std::mutex lock;
+  std::condition_variable work_ready;
+  std::condition_variable work_done;
+  std::deque<entry_t> queue;  // in program order
+  size_t next;                // the first entry the model has not run
+  bool worker_exit;
+  std::thread worker;
+};
+
+#define ROCC_FENCE_FUNCT 0x7f
+
 #define define_custom_func(type_name, ext_name_str, func_name, method_name) \
   static reg_t func_name(processor_t* p, insn_t insn, reg_t pc) \
   { \
@@ -0,0 +1,516 @@
+// See LICENSE for license details.
+
+#include "sift_stream.h"
+
+#ifdef RISCV_ENABLE_SIFT
+
+#include "encoding.h"
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+int sift_host_syscall(uint64_t number)
+{
+  // RISC-V uses the generic Linux numbering.
+  switch (number) {
+#ifdef SYS_futex
+    case 98: return SYS_futex;
+#endif
+#ifdef SYS_clone
+    case 220: return SYS_clone;
+#endif
+#ifdef SYS_exit
+    case 93: return SYS_exit;
+#endif
+#ifdef SYS_exit_group
+    case 94: return SYS_exit_group;
+#endif
+#ifdef SYS_sched_yield
+    case 124: return SYS_sched_yield;
+#endif
+#ifdef SYS_nanosleep
+    case 101: return SYS_nanosleep;
+#endif
+#ifdef SYS_clock_nanosleep
+    case 115: return SYS_clock_nanosleep;
+#endif
+#ifdef SYS_sched_setaffinity
+    case 122: return SYS_sched_setaffinity;
+#endif
+#ifdef SYS_sched_getaffinity
+    case 123: return SYS_sched_getaffinity;
+#endif
+  }
+  return -1;
+}
+
+sift_uop_plan_t sift_plan_uops(uint32_t bits)
+{
+  const uint32_t vd_step = 1 << 7;
+  const uint32_t vs1_step = 1 << 15;
+  const uint32_t vs2_step = 1 << 20;
+
+  uint32_t opcode = bits & 0x7f;
+  uint32_t funct3 = (bits >> 12) & 0x7;
+  uint32_t funct6 = (bits >> 26) & 0x3f;
+  bool is_opv = opcode == 0x57;
+
+  bool is_opivx = is_opv && funct3 == 0x4;
+  bool is_opfvf = is_opv && funct3 == 0x5;
+  bool is_opmvx = is_opv && funct3 == 0x6;
+  bool is_opivi = is_opv && funct3 == 0x3;
+  bool is_opfvv_vfunary0 = is_opv && funct3 == 0x1 && funct6 == 0x12;
+  bool is_opfvv_vfunary1 = is_opv && funct3 == 0x1 && funct6 == 0x13;
+  bool is_opmvv_vxunary1 = is_opv && funct3 == 0x2 && funct6 == 0x13;
+  bool is_opmvv_vmunary1 = is_opv && funct3 == 0x2 && funct6 == 0x14;
+
+  bool is_vlx_indexed = opcode == 0x07 && ((bits >> 26) & 0x1);
+  bool is_vsx_indexed = opcode == 0x27 && ((bits >> 26) & 0x1);
+
+  sift_uop_plan_t plan = {vd_step, vd_step};
+
+  // vs1 names a vector register group only for arithmetic forms whose
+  // first source is a vector.
+  if (!is_opfvv_vfunary0 && !is_opfvv_vfunary1 &&
+      !is_opmvv_vxunary1 && !is_opmvv_vmunary1 &&
+      !is_opivx && !is_opfvf && !is_opmvx && !is_opivi)
+    plan.arith_step += vs1_step;
+
+  // vs2 advances for arithmetic, and for indexed memory accesses where it
+  // holds the index vector, except for widening conversions and vmv.v.x.
+  bool is_widening_cvt = is_opfvv_vfunary0 && ((bits >> 18) & 1);
+  bool is_vmv_v_x = (bits & MASK_VMV_V_X) == MATCH_VMV_V_X;
+  if (!is_widening_cvt && !is_vmv_v_x) {
+    plan.arith_step += vs2_step;
+    if (is_vlx_indexed || is_vsx_indexed)
+      plan.mem_step += vs2_step;
+  }
+
+  return plan;
+}
+
+// Leaves a named pipe at path, replacing any other file there.
+static void make_fifo(const std::string& path)
+{
+  struct stat st;
+  if (stat(path.c_str(), &st) == 0) {
+    if (S_ISFIFO(st.st_mode))
+      return;
+    unlink(path.c_str());
+  }
+  if (mkfifo(path.c_str(), 0600) != 0)
+    throw std::runtime_error("could not create FIFO " + path + ": " + strerror(errno));
+}
+
+sift_stream_t::sift_stream_t(const char* filename, const char* response_filename, uint32_t id,
+                             const sift_writer_config_t& config)
+  : writer(nullptr), filename(filename), response_filename(response_filename), id(id),
+    compress(config.compress), discarded(false),
+    current_bits(0), vconfig_valid(false), last_vl(0), last_vtype(0),
+    code_pages(config.code_pages), va2pa(config.va2pa), records(nullptr), addr_ring(nullptr),
+    rec_head(0), addr_head(0), rec_tail(0), addr_tail(0), stop(false),
+    syncs_issued(0), syncs_done(0)
+{
+  if (config.fifo) {
+    make_fifo(this->filename);
+    make_fifo(this->response_filename);
+  } else {
+    open_writer();
+  }
+}
+
+std::atomic<uint64_t> sift_stream_t::closed_bytes(0);
+
+sift_stream_t::~sift_stream_t()
+{
+  set_async(false);
+  if (!writer && !discarded)
+    open_writer();
+  delete writer;
+  if (writer)
+    closed_bytes += file_bytes();
+}
+
+uint64_t sift_stream_t::file_bytes() const
+{
+  struct stat st;
+  if (stat(filename.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+    return 0;
+  return st.st_size;
+}
+
+void sift_stream_t::open_writer()
+{
+  writer = new Sift::Writer(filename.c_str(), // filename
+                            nullptr, // getCodeFunc
+                            compress, // useCompression
+                            response_filename.c_str(), // response_filename
+                            id, // id
+                            false, // arch32
+                            !code_pages, // require_icache_per_insn
+                            va2pa, // send_va2pa_mapping
+                            get_code, // getCodeFunc2
+                            this, // GetCodeFunc2Data
+                            get_physical_address, // getPhysicalAddressFunc
+                            this); // GetPhysicalAddressData
+}
+
+void sift_stream_t::set_async(bool enable)
+{
+  if (enable == is_async())
+    return;
+
+  if (enable) {
+    records = new record_t[RECORD_RING_SIZE];
+    addr_ring = new uint64_t[ADDR_RING_SIZE];
+    rec_head = rec_tail = 0;
+    addr_head = addr_tail = 0;
+    stop = false;
+    worker = std::thread(&sift_stream_t::worker_main, this);
+  } else {
+    stop.store(true, std::memory_order_release);
+    worker.join();
+    delete[] records;
+    delete[] addr_ring;
+    records = nullptr;
+    addr_ring = nullptr;
+  }
+}
+
+void sift_stream_t::flush()
+{
+  if (!is_async())
+    return;
+
+  while (rec_tail.load(std::memory_order_acquire) != rec_head.load(std::memory_order_relaxed))
+    std::this_thread::yield();
+}
+
+void sift_stream_t::Instruction(uint64_t addr, uint8_t size, uint32_t bits,
+                                uint64_t num_addresses, const uint64_t* addresses,
+                                bool is_branch, bool taken, bool is_predicate, bool executed)
+{
+  assert(num_addresses <= MAX_ADDRESSES);
+
+  record_t rec = {};
+  rec.type = RECORD_INSTRUCTION;
+  rec.addr = addr;
+  rec.size = size;
+  rec.bits = bits;
+  rec.num_addresses = num_addresses;
+  rec.is_branch = is_branch;
+  rec.taken = taken;
+  rec.is_predicate = is_predicate;
+  rec.executed = executed;
+
+  if (is_async())
+    push(rec, addresses);
+  else
+    emit(rec, addresses);
+}
+
+void sift_stream_t::Magic(uint64_t a, uint64_t b, uint64_t c)
+{
+  record_t rec = {};
+  rec.type = RECORD_MAGIC;
+  rec.addr = a;
+  rec.arg[0] = b;
+  rec.arg[1] = c;
+
+  if (is_async())
+    push(rec, nullptr);
+  else
+    emit(rec, nullptr);
+}
+
+void sift_stream_t::Sync()
+{
+  record_t rec = {};
+  rec.type = RECORD_SYNC;
+  syncs_issued++;
+
+  if (!is_async()) {
+    emit(rec, nullptr);
+    return;
+  }
+
+  push(rec, nullptr);
+  while (syncs_done.load(std::memory_order_acquire) + 1 < syncs_issued)
+    std::this_thread::yield();
+}
+
+void sift_stream_t::VectorConfig(uint64_t vl, uint64_t vtype)
+{
+  if (vconfig_valid && vl == last_vl && vtype == last_vtype)
+    return;
+
+  vconfig_valid = true;
+  last_vl = vl;
+  last_vtype = vtype;
+  Magic(5, vl, vtype);  // SIM_CMD_USER = 5 at sim_api.h
+}
+
+void sift_stream_t::CacheOnly(uint8_t icount, Sift::CacheOnlyType type, uint64_t eip, uint64_t address)
+{
+  record_t rec = {};
+  rec.type = RECORD_CACHE_ONLY;
+  rec.size = icount;
+  rec.addr = eip;
+  rec.arg[0] = address;
+  rec.arg[1] = type;
+
+  if (is_async())
+    push(rec, nullptr);
+  else
+    emit(rec, nullptr);
+}
+
+void sift_stream_t::Syscall(uint16_t number, const uint64_t* args)
+{
+  record_t rec = {};
+  rec.type = RECORD_SYSCALL;
+  rec.addr = number;
+  rec.num_addresses = 6;
+
+  if (is_async())
+    push(rec, args);
+  else
+    emit(rec, args);
+}
+
+void sift_stream_t::emit(const record_t& rec, const uint64_t* addresses)
+{
+  if (!writer)
+    open_writer();
+
+  switch (rec.type) {
+    case RECORD_INSTRUCTION:
+      current_bits = rec.bits;
+      writer->Instruction(rec.addr, rec.size, rec.num_addresses,
+                          const_cast<uint64_t*>(addresses), rec.is_branch,
+                          rec.taken, rec.is_predicate, rec.executed);
+      break;
+    case RECORD_MAGIC:
+      writer->Magic(rec.addr, rec.arg[0], rec.arg[1]);
+      break;
+    case RECORD_SYNC:
+      writer->Sync();
+      syncs_done.fetch_add(1, std::memory_order_release);
+      break;
+    case RECORD_CACHE_ONLY:
+      writer->CacheOnly(rec.size, Sift::CacheOnlyType(rec.arg[1]), rec.addr, rec.arg[0]);
+      break;
+    case RECORD_SYSCALL:
+      writer->Syscall(rec.addr, reinterpret_cast<const char*>(addresses),
+                      rec.num_addresses * sizeof(uint64_t));
+      break;
+  }
+}
+
+void sift_stream_t::add_code_page(uint64_t page, const uint8_t* bytes)
+{
+  std::unique_ptr<uint8_t[]> copy(new uint8_t[CODE_PAGE_SIZE]);
+  std::copy(bytes, bytes + CODE_PAGE_SIZE, copy.get());
+
+  std::lock_guard<std::mutex> lock(code_lock);
+  code[page] = std::move(copy);
+  sent_pages.insert(page);
+}
+
+void sift_stream_t::get_code(uint8_t* dst, const uint8_t* src, uint32_t size, void* arg)
+{
+  auto stream = static_cast<sift_stream_t*>(arg);
+  if (!stream->code_pages) {
+    for (uint32_t i = 0; i < size; ++i)
+      dst[i] = (stream->current_bits >> (i * 8)) & 0xff;
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(stream->code_lock);
+  for (uint32_t i = 0; i < size; ++i) {
+    uint64_t addr = (uint64_t)src + i;
+    auto page = stream->code.find(addr & ~(CODE_PAGE_SIZE - 1));
+    dst[i] = page == stream->code.end() ? 0 : page->second[addr & (CODE_PAGE_SIZE - 1)];
+  }
+}
+
+void sift_stream_t::PageMapping(uint64_t vpage, uint64_t ppage)
+{
+  auto known = known_pages.find(vpage);
+  if (known != known_pages.end() && known->second == ppage)
+    return;
+  known_pages[vpage] = ppage;
+
+  std::lock_guard<std::mutex> lock(page_lock);
+  pages[vpage] = ppage;
+}
+
+// Pages the MMU never translated through its TLB (e.g. MMIO) are reported
+// as identity-mapped.
+uint64_t sift_stream_t::get_physical_address(void* arg, uint64_t vaddr)
+{
+  auto stream = static_cast<sift_stream_t*>(arg);
+  uint64_t offset = vaddr & (CODE_PAGE_SIZE - 1);
+
+  std::lock_guard<std::mutex> lock(stream->page_lock);
+  auto page = stream->pages.find(vaddr - offset);
+  return page == stream->pages.end() ? vaddr : page->second + offset;
+}
+
+// The length of the run of equally spaced addresses that starts at a[i],
+// taking at least two addresses where there are.
+static size_t run_length(const uint64_t* a, size_t i, size_t n)
+{
+  size_t j = std::min(i + 2, n);
+  while (j < n && a[j] - a[j - 1] == a[i + 1] - a[i])
+    j++;
+  return j - i;
+}
+
+void sift_stream_t::push(const record_t& rec, const uint64_t* addresses)
+{
+  size_t head = rec_head.load(std::memory_order_relaxed);
+  size_t ahead = addr_head.load(std::memory_order_relaxed);
+
+  size_t n = rec.num_addresses;
+  size_t words = n;
+  if (rec.type == RECORD_INSTRUCTION && n > 3) {
+    size_t runs = 0;
+    for (size_t i = 0; i < n && 3 * runs < n; i += run_length(addresses, i, n))
+      runs++;
+    words = std::min(n, 3 * runs);
+  }
+
+  // Apply back-pressure when the writer thread falls behind.
+  while (head - rec_tail.load(std::memory_order_acquire) >= RECORD_RING_SIZE ||
+         ahead + words - addr_tail.load(std::memory_order_acquire) > ADDR_RING_SIZE)
+    std::this_thread::yield();
+
+  record_t& slot = records[head & (RECORD_RING_SIZE - 1)];
+  slot = rec;
+  slot.runs = words < n;
+  if (slot.runs) {
+    for (size_t i = 0, w = ahead; i < n; w += 3) {
+      size_t len = run_length(addresses, i, n);
+      addr_ring[w & (ADDR_RING_SIZE - 1)] = addresses[i];
+      addr_ring[(w + 1) & (ADDR_RING_SIZE - 1)] = len > 1 ? addresses[i + 1] - addresses[i] : 0;
+      addr_ring[(w + 2) & (ADDR_RING_SIZE - 1)] = len;
+      i += len;
+    }
+  } else {
+    for (size_t i = 0; i < n; i++)
+      addr_ring[(ahead + i) & (ADDR_RING_SIZE - 1)] = addresses[i];
+  }
+
+  addr_head.store(ahead + words, std::memory_order_release);
+  rec_head.store(head + 1, std::memory_order_release);
+}
+
+void sift_stream_t::drain()
+{
+  size_t tail = rec_tail.load(std::memory_order_relaxed);
+  size_t atail = addr_tail.load(std::memory_order_relaxed);
+  size_t head = rec_head.load(std::memory_order_acquire);
+  // On the worker's stack rather than in every hart's stream.
+  uint64_t drain_buf[MAX_ADDRESSES];
+
+  for (; tail != head; tail++) {
+    const record_t& rec = records[tail & (RECORD_RING_SIZE - 1)];
+    if (rec.runs) {
+      for (size_t i = 0; i < rec.num_addresses; atail += 3) {
+        uint64_t base = addr_ring[atail & (ADDR_RING_SIZE - 1)];
+        uint64_t stride = addr_ring[(atail + 1) & (ADDR_RING_SIZE - 1)];
+        uint64_t len = addr_ring[(atail + 2) & (ADDR_RING_SIZE - 1)];
+        for (uint64_t k = 0; k < len; k++)
+          drain_buf[i++] = base + k * stride;
+      }
+    } else {
+      for (size_t i = 0; i < rec.num_addresses; i++)
+        drain_buf[i] = addr_ring[(atail + i) & (ADDR_RING_SIZE - 1)];
+      atail += rec.num_addresses;
+    }
+    emit(rec, drain_buf);
+
+    addr_tail.store(atail, std::memory_order_release);
+    rec_tail.store(tail + 1, std::memory_order_release);
+  }
+}
+
+void sift_stream_t::worker_main()
+{
+  unsigned idle = 0;
+  while (true) {
+    bool stopping = stop.load(std::memory_order_acquire);
+    if (rec_tail.load(std::memory_order_relaxed) != rec_head.load(std::memory_order_acquire)) {
+      drain();
+      idle = 0;
+    } else if (stopping) {
+      break;
+    } else if (++idle < 64) {
+      std::this_thread::yield();
+    } else {
+      std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+  }
+}
+
+void sift_warmup_t::access(uint64_t pc, uint64_t addr, bool write)
+{
+  uint64_t key = addr >> LINE_SHIFT << 2;
+  auto it = touches.find(key);
+  // A line once written stays dirty in the reader's caches.
+  if (!write && it != touches.end() && it->second.type == Sift::CacheOnlyMemWrite)
+    write = true;
+  touch(key, pc, addr, write ? Sift::CacheOnlyMemWrite : Sift::CacheOnlyMemRead);
+}
+
+void sift_warmup_t::touch(uint64_t key, uint64_t pc, uint64_t addr, Sift::CacheOnlyType type)
+{
+  touches[key] = {clock++, pc, addr, type};
+  if (touches.size() >= 2 * limit)
+    prune();
+}
+
+void sift_warmup_t::prune()
+{
+  if (touches.size() <= limit)
+    return;
+
+  std::vector<uint64_t> lasts;
+  lasts.reserve(touches.size());
+  for (auto& t : touches)
+    lasts.push_back(t.second.last);
+  std::nth_element(lasts.begin(), lasts.end() - limit, lasts.end());
+  uint64_t oldest = *(lasts.end() - limit);
+
+  for (auto it = touches.begin(); it != touches.end(); ) {
+    if (it->second.last < oldest)
+      it = touches.erase(it);
+    else
+      ++it;
+  }
+}
+
+void sift_warmup_t::emit(sift_stream_t* stream)
+{
+  prune();
+  std::vector<const touch_t*> order;
+  order.reserve(touches.size());
+  for (auto& t : touches)
+    order.push_back(&t.second);
+  std::sort(order.begin(), order.end(),
+            [](const touch_t* a, const touch_t* b) { return a->last < b->last; });
+
+  for (auto t : order)
+    stream->CacheOnly(0, t->type, t->pc, t->addr);
+  touches.clear();
+  last_fetch = -1;
+}
+
+#endif // RISCV_ENABLE_SIFT
@@ -0,0 +1,265 @@
+// See LICENSE for license details.
+#ifndef _RISCV_SIFT_STREAM_H
+#define _RISCV_SIFT_STREAM_H
+
+#include "config.h"
+
+#ifdef RISCV_ENABLE_SIFT
+
+#include "sift_writer.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Describes how the encoding reported for each micro-op of a vector
+// instruction that is split per register of its group advances from one
+// micro-op to the next.  It depends only on the static instruction, so it
+// is computed once when the instruction is decoded into the icache.
+struct sift_uop_plan_t
+{
+  uint32_t arith_step;  // the instruction touched no memory
+  uint32_t mem_step;    // the instruction accessed memory
+};
+
+sift_uop_plan_t sift_plan_uops(uint32_t bits);
+
+// The host's number for a RISC-V Linux system call that Sniper's syscall
+// model acts on (thread creation and exit, futexes, sleeps and yields), or
+// -1 for any other call.  Sniper decodes syscall records by the numbering
+// of the host it runs on.
+int sift_host_syscall(uint64_t number);
+
+// Writer settings that are fixed when a stream is opened.
+struct sift_writer_config_t
+{
+  bool code_pages = false;  // send code pages instead of per-insn encodings
+  bool compress = true;     // zlib-compress the trace
+  bool va2pa = false;       // send the physical page of each virtual page
+  bool fifo = false;        // stream through named pipes to a running reader
+};
+
+// One hart's SIFT output stream.  By default every event is handed straight
+// to the underlying Sift::Writer.  In asynchronous mode the simulation thread
+// only pushes compact fixed-size records into a lock-free single-producer /
+// single-consumer ring, and a background thread drains the ring into the
+// writer, so compression and file I/O no longer run on the simulation thread.
+//
+// The writer learns the code it executes in one of two ways.  By default the
+// encoding of every instruction is sent along with it, which is what lets a
+// split vector instruction report a different encoding per micro-op.  In
+// code-page mode each code page is sent once, the first time an instruction
+// runs from it, and micro-ops carry the encoding found in memory.
+//
+// In FIFO mode the trace and response files are named pipes, created if
+// they do not exist, and a reader such as Sniper consumes the trace while
+// it is written instead of from disk afterwards.  The writer, which opens
+// the pipes, is then only created for the first record, or when the stream
+// ends, so that a stream that is discarded before the hart runs never
+// connects to the reader.
+class sift_stream_t
+{
+public:
+  sift_stream_t(const char* filename, const char* response_filename, uint32_t id,
+                const sift_writer_config_t& config = sift_writer_config_t());
+  ~sift_stream_t();
+
+  // bits is the encoding the writer reports for this instruction, which may
+  // differ from the one in memory when a vector instruction is split.
+  void Instruction(uint64_t addr, uint8_t size, uint32_t bits,
+                   uint64_t num_addresses, const uint64_t* addresses,
+                   bool is_branch, bool taken, bool is_predicate, bool executed);
+  void Magic(uint64_t a, uint64_t b, uint64_t c);
+
+  // Report the vector configuration after a vsetvl.  Strip-mined loops
+  // repeat the same vsetvl every iteration, so only changes are emitted,
+  // as a SIM_CMD_USER magic (sim_api.h) carrying vl and vtype.
+  void VectorConfig(uint64_t vl, uint64_t vtype);
+
+  // A memory access or branch outcome for the reader to warm its caches
+  // and branch predictor with, outside of any instruction record.
+  void CacheOnly(uint8_t icount, Sift::CacheOnlyType type, uint64_t eip, uint64_t address);
+
+  // A system call, by host number, and its six argument registers.
+  void Syscall(uint16_t number, const uint64_t* args);
+
+  // Start or stop the background writer thread.  Stopping drains every
+  // record that is still queued before returning.
+  void set_async(bool enable);
+  bool is_async() const { return worker.joinable(); }
+
+  // Block until every queued record has reached the writer.
+  void flush();
+
+  // The stream is being replaced before it emitted anything; in FIFO mode
+  // it then never opens the pipes.
+  void discard() { discarded = true; }
+
+  // How much of the trace has reached its file, or 0 for a FIFO; and the
+  // total of that for the streams since closed.
+  uint64_t file_bytes() const;
+  static std::atomic<uint64_t> closed_bytes;
+
+  // Wait for the trace consumer to catch up with this stream through the
+  // writer's response channel.  In asynchronous mode the previous Sync
+  // must have completed before this returns, so the simulation runs at
+  // most one sync interval ahead of the consumer.
+  void Sync();
+
+  // In code-page mode, the simulation thread must add every code page an
+  // instruction spans before emitting the instruction.
+  bool sends_code_pages() const { return code_pages; }
+  bool has_code_page(uint64_t page) const { return sent_pages.count(page) != 0; }
+  void add_code_page(uint64_t page, const uint8_t* bytes);
+
+  // In va2pa mode the writer sends a VA->PA record the first time it sees
+  // each virtual page.  The MMU reports translations as it refills its TLB,
+  // so the cost is per refill rather than per access.
+  bool sends_va2pa() const { return va2pa; }
+  void PageMapping(uint64_t vpage, uint64_t ppage);
+
+private:
+  enum record_type_t : uint8_t {
+    RECORD_INSTRUCTION,
+    RECORD_MAGIC,
+    RECORD_SYNC,
+    RECORD_CACHE_ONLY,
+    RECORD_SYSCALL,
+  };
+
+  struct record_t {
+    uint64_t addr;      // PC, or first magic argument
+    uint64_t arg[2];    // remaining magic arguments, or cache-only address and type
+                        // (a syscall's arguments travel as its addresses)
+    uint32_t num_addresses;
+    uint32_t bits;
+    record_type_t type;
+    uint8_t size;
+    bool is_branch;
+    bool taken;
+    bool is_predicate;
+    bool executed;
+    bool runs;          // the addresses travel as runs (see push)
+  };
+
+  // Both rings must be powers of two.  Memory addresses live in their own
+  // ring so that records stay fixed-size regardless of how many addresses
+  // a vector access produces.  Those of an instruction go in as runs of
+  // equally spaced addresses, three words each, when that takes fewer
+  // words, as it does for unit-stride, strided and segment accesses.
+  static const size_t RECORD_RING_SIZE = 1 << 16;
+  static const size_t ADDR_RING_SIZE = 1 << 18;
+  static const size_t MAX_ADDRESSES = 4096;
+
+  void open_writer();
+  void push(const record_t& rec, const uint64_t* addresses);
+  void drain();
+  void worker_main();
+  void emit(const record_t& rec, const uint64_t* addresses);
+
+  // Sift::Writer callback that supplies the code bytes of the instruction
+  // currently being emitted, or of the code page at src.
+  static void get_code(uint8_t* dst, const uint8_t* src, uint32_t size, void* arg);
+
+  // Sift::Writer callback that translates a virtual address.
+  static uint64_t get_physical_address(void* arg, uint64_t vaddr);
+
+  static const uint64_t CODE_PAGE_SIZE = 4096;
+
+  Sift::Writer* writer;
+  std::string filename;
+  std::string response_filename;
+  uint32_t id;
+  bool compress;
+  bool discarded;
+  uint32_t current_bits;
+
+  // Last vector configuration emitted by VectorConfig.
+  bool vconfig_valid;
+  uint64_t last_vl;
+  uint64_t last_vtype;
+
+  bool code_pages;
+  std::unordered_set<uint64_t> sent_pages;  // simulation thread only
+  // Page contents, read by the writer thread in asynchronous mode.
+  std::mutex code_lock;
+  std::unordered_map<uint64_t, std::unique_ptr<uint8_t[]>> code;
+
+  bool va2pa;
+  std::unordered_map<uint64_t, uint64_t> known_pages;  // simulation thread only
+  // Translations read by the writer thread in asynchronous mode.
+  std::mutex page_lock;
+  std::unordered_map<uint64_t, uint64_t> pages;
+
+  record_t* records;
+  uint64_t* addr_ring;
+
+  // Producer-owned and consumer-owned indices live on separate cache lines.
+  alignas(64) std::atomic<size_t> rec_head;
+  std::atomic<size_t> addr_head;
+  alignas(64) std::atomic<size_t> rec_tail;
+  std::atomic<size_t> addr_tail;
+  alignas(64) std::atomic<bool> stop;
+  uint64_t syncs_issued;               // simulation thread only
+  std::atomic<uint64_t> syncs_done;
+
+  std::thread worker;
+};
+
+// The footprint of a hart before its ROI: the cache lines it last read,
+// wrote or fetched from and the last outcome of each branch, keeping only
+// the most recent ones up to a limit.  When the ROI starts it is sent as
+// cache-only records, least recently touched first, so that the reader
+// starts the ROI with warm caches and predictors without a full trace of
+// the warm-up.
+class sift_warmup_t
+{
+public:
+  explicit sift_warmup_t(size_t limit) : limit(limit), clock(0), last_fetch(-1) {}
+
+  // Straight-line code touches each line once on the way through.
+  void fetch(uint64_t pc)
+  {
+    if ((pc >> LINE_SHIFT) != last_fetch) {
+      last_fetch = pc >> LINE_SHIFT;
+      touch(last_fetch << 2 | 1, pc, pc, Sift::CacheOnlyMemIcache);
+    }
+  }
+  void access(uint64_t pc, uint64_t addr, bool write);
+  void branch(uint64_t pc, bool taken)
+  {
+    touch(pc << 2 | 2, pc, 0, taken ? Sift::CacheOnlyBranchTaken : Sift::CacheOnlyBranchNotTaken);
+  }
+
+  // Sends the footprint to stream and forgets it.
+  void emit(sift_stream_t* stream);
+
+private:
+  static const unsigned LINE_SHIFT = 6;
+
+  struct touch_t {
+    uint64_t last;  // clock of the latest touch
+    uint64_t pc;
+    uint64_t addr;
+    Sift::CacheOnlyType type;
+  };
+
+  void touch(uint64_t key, uint64_t pc, uint64_t addr, Sift::CacheOnlyType type);
+  // Drops all but the limit most recently touched entries.
+  void prune();
+
+  size_t limit;
+  uint64_t clock;
+  uint64_t last_fetch;
+  std::unordered_map<uint64_t, touch_t> touches;
+};
+
+#endif // RISCV_ENABLE_SIFT
+
+#endif
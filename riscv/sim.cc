@@ -4,20 +4,32 @@
 #include "mmu.h"
 #include "dts.h"
 #include "remote_bitbang.h"
+#include "gdb_server.h"
+#include "vector_stats.h"
+#include "trap_profile.h"
+#include "commit_log.h"
 #include "byteorder.h"
 #include "platform.h"
 #include "libfdt.h"
+#include "elf.h"
+#include <algorithm>
 #include <fstream>
+#include <iterator>
 #include <map>
 #include <iostream>
 #include <sstream>
+#include <cinttypes>
 #include <climits>
 #include <cstdlib>
 #include <cassert>
+#include <sched.h>
 #include <signal.h>
 #include <unistd.h>
+#include <sys/mman.h>
 #include <sys/wait.h>
 #include <sys/types.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 volatile bool ctrlc_pressed = false;
 static void handle_signal(int sig)
@@ -28,6 +40,12 @@ static void handle_signal(int sig)
   signal(sig, &handle_signal);
 }
 
+static volatile sig_atomic_t insn_mix_requested = false;
+static void handle_insn_mix_signal(int sig)
+{
+  insn_mix_requested = true;
+}
+
 sim_t::sim_t(const cfg_t *cfg, bool halted,
              std::vector<std::pair<reg_t, mem_t*>> mems,
              std::vector<std::pair<reg_t, abstract_device_t*>> plugin_devices,
@@ -55,12 +73,48 @@ sim_t::sim_t(const cfg_t *cfg, bool halted,
     acceptor_ptr(acceptor_ptr),
 #endif
     sout_(nullptr),
+    parallel(false),
+    round(0),
+    harts_running(0),
+    workers_exit(false),
+    distributed(nullptr),
+    kvm_ff(nullptr),
+    kvm_ff_insns(0),
+    kvm_ff_resume(false),
+    interleave(INTERLEAVE),
+    rtc_insns(0),
+    sift_sync(false),
     current_step(0),
     current_proc(0),
+    htif_watch(false),
+    host_poll_quanta(0),
+    user_mode(false),
+    user_brk_start(0),
+    user_brk(0),
+    user_brk_top(0),
+    user_mmap_bottom(0),
+    libc_intercepts(false),
+    share_images(false),
+    checkpoint_save_instret(0),
+    stop_instret(0),
+    stop_roi_instret(0),
+    steps_taken(0),
+    reverse_interval(0),
+    reverse_max_snapshots(0),
+    reverse_calls_start(0),
+    reverse_replaying(false),
+    next_sample(0),
+    sample_jobs(1),
+    sample_end(0),
+    sift_prefix(sift_filename),
+    sift_periodic(false),
+    trace_priv_mask(-1),
     debug(false),
     histogram_enabled(false),
     log(false),
+    commit_log(false),
     remote_bitbang(NULL),
+    gdb_server(NULL),
     debug_module(this, dm_config)
 {
   signal(SIGINT, &handle_signal);
@@ -70,8 +124,20 @@ sim_t::sim_t(const cfg_t *cfg, bool halted,
   for (auto& x : mems)
     bus.add_device(x.first, x.second);
 
-  for (auto& x : plugin_devices)
+  for (auto& x : plugin_devices) {
     bus.add_device(x.first, x.second);
+    if (auto plugin = dynamic_cast<mmio_plugin_device_t*>(x.second)) {
+      auto dma_ptr = [](void* sim, reg_t paddr, size_t len, size_t* run) {
+        return (uint8_t*)static_cast<sim_t*>(sim)->direct_ptr(paddr, len, run);
+      };
+      plugin->attach(mmio_host_t{this, dma_ptr});
+      ticked_devices.push_back(plugin);
+    }
+    if (auto virtio = dynamic_cast<virtio_mmio_t*>(x.second))
+      virtio_devices.emplace_back(x.first, virtio);
+    if (auto uart = dynamic_cast<ns16550_t*>(x.second))
+      uarts.emplace_back(x.first, uart);
+  }
 
   debug_module.add_device(&bus);
 
@@ -82,6 +148,22 @@ sim_t::sim_t(const cfg_t *cfg, bool halted,
                                log_file.get(), sout_, debug_mmu, sift_filename);
   }
 
+  // UARTs and virtio devices signal through a PLIC, taking its sources
+  // in that order.
+  if (!uarts.empty() || !virtio_devices.empty()) {
+    plic.reset(new plic_t(procs, uarts.size() + virtio_devices.size()));
+    bus.add_device(PLIC_BASE, plic.get());
+    uint32_t irq = 1;
+    for (auto& x : uarts) {
+      x.second->attach(plic.get(), irq++);
+      ticked_devices.push_back(x.second);
+    }
+    for (auto& x : virtio_devices) {
+      x.second->attach(this, plic.get(), irq++);
+      ticked_devices.push_back(x.second);
+    }
+  }
+
   make_dtb();
 
   void *fdt = (void *)dtb.c_str();
@@ -95,7 +177,8 @@ sim_t::sim_t(const cfg_t *cfg, bool halted,
   // setting the dtb_file argument has one.
   reg_t clint_base;
   if (fdt_parse_clint(fdt, &clint_base, "riscv,clint0") == 0) {
-    clint.reset(new clint_t(procs, CPU_HZ / INSNS_PER_RTC_TICK, cfg->real_time_clint()));
+    clint.reset(new clint_t(procs, CPU_HZ / INSNS_PER_RTC_TICK, cfg->real_time_clint(),
+                            cfg->real_time_clint_precision));
     bus.add_device(clint_base, clint.get());
   }
 
@@ -172,6 +255,24 @@ sim_t::sim_t(const cfg_t *cfg, bool halted,
 
 sim_t::~sim_t()
 {
+  {
+    std::lock_guard<std::mutex> lock(round_lock);
+    workers_exit = true;
+  }
+  round_start.notify_all();
+  for (auto& worker : workers)
+    worker.join();
+
+  insn_log.reset();
+  progress.reset();
+  if (!insn_mix_path.empty())
+    write_insn_mix(insn_mix_path);
+  if (!vector_stats_path.empty())
+    write_vector_stats();
+  if (!atomic_profile_path.empty())
+    write_atomic_profile();
+  if (!trap_profile_path.empty())
+    write_trap_profile();
   for (size_t i = 0; i < procs.size(); i++)
     delete procs[i];
   delete debug_mmu;
@@ -182,17 +283,64 @@ void sim_thread_main(void* arg)
   ((sim_t*)arg)->main();
 }
 
-void sim_t::main()
+void sim_t::start()
 {
-  if (!debug && log)
+  htif_t::start();
+
+  // Every rank has loaded the program before any runs it.
+  if (distributed) {
+    if (distributed->get_rank() != 0)
+      detach_tohost();
+    try {
+      distributed->connect();
+    } catch (std::exception& e) {
+      std::cerr << e.what() << std::endl;
+      exit(1);
+    }
+  }
+
+  for (auto& [paddr, path] : load_images)
+    load_image(paddr, path);
+
+  // Plain -l logging keeps the harts on the fast path.  With the commit
+  // log in the same file, lines must interleave per instruction as before.
+  if (!debug && log && !commit_log) {
+    insn_log.reset(new insn_log_t(log_file.get(), sout_.rdbuf()));
+    for (auto p : procs)
+      p->set_insn_log(insn_log.get());
+  } else if (!debug && log) {
     set_procs_debug(true);
+  }
+
+  if (!checkpoint_restore_path.empty())
+    restore_checkpoint(checkpoint_restore_path.c_str());
+  if (!qemu_checkpoint_path.empty())
+    import_qemu_checkpoint(qemu_checkpoint_path);
 
+  apply_trace_filter();
+}
+
+void sim_t::main()
+{
   while (!done())
   {
-    if (debug || ctrlc_pressed)
+    if (debug || ctrlc_pressed) {
+      // The interactive debugger owns the output from here on, and logs
+      // through disasm() as the harts' debug flags direct.
+      if (insn_log) {
+        for (auto p : procs)
+          p->set_insn_log(nullptr);
+        insn_log.reset();
+        set_procs_debug(true);
+      }
       interactive();
+    }
+    else if (gdb_server)
+      gdb_server->tick();
+    else if (parallel)
+      step_parallel();
     else
-      step(INTERLEAVE);
+      step(interleave);
     if (remote_bitbang) {
       remote_bitbang->tick();
     }
@@ -203,27 +351,136 @@ int sim_t::run()
 {
   host = context_t::current();
   target.init(sim_thread_main, this);
-  return htif_t::run();
+  int code = htif_t::run();
+  if (distributed)
+    distributed->finish(code);
+
+  wait_for_samples(0);
+  for (; next_sample < samples.size(); next_sample++)
+    fprintf(stderr, "sample %zu was not reached before the program exited\n",
+            samples[next_sample].index);
+  return code;
 }
 
 void sim_t::step(size_t n)
 {
+  if (reverse_interval && !reverse_replaying) {
+    if (!reverse_calls.empty() && reverse_calls.back().first == n)
+      reverse_calls.back().second++;
+    else
+      reverse_calls.push_back({n, 1});
+  }
+
   for (size_t i = 0, steps = 0; i < n; i += steps)
   {
-    steps = std::min(n - i, INTERLEAVE - current_step);
-    procs[current_proc]->step(steps);
+    // Fast-forward natively once the firmware has handed over to the
+    // kernel.
+    if (unlikely(kvm_ff_insns) && current_proc == 0 && procs[0]->get_state()->prv != PRV_M) {
+      uint64_t insns = kvm_ff_insns;
+      kvm_ff_insns = 0;
+      if (!kvm_run_hart0(insns))
+        return;
+    }
+
+    steps = std::min(n - i, interleave - current_step);
+
+    // Snapshot for reverse execution exactly every interval steps; the
+    // re-executed calls are cut at the same points.
+    if (reverse_interval) {
+      if (steps_taken % reverse_interval == 0 &&
+          (reverse_snapshots.empty() || reverse_snapshots.back().position < steps_taken))
+        take_reverse_snapshot();
+      steps = std::min<size_t>(steps, reverse_interval - steps_taken % reverse_interval);
+    }
+
+    // Stop hart 0 exactly at the checkpoint.
+    bool checkpointing = current_proc == 0 && checkpoint_save_instret != 0;
+    if (checkpointing)
+      steps = std::min<size_t>(steps, checkpoint_save_instret - procs[0]->get_state()->minstret->read());
+
+    // Likewise at the instruction limit.
+    if (current_proc == 0 && stop_instret != 0)
+      steps = std::min<size_t>(steps, stop_instret - std::min(stop_instret, procs[0]->get_state()->minstret->read()));
+
+    // Likewise at the start of each sample, and in a sample's child at
+    // its end.
+    uint64_t sample_stop = current_proc == 0 ? next_sample_stop() : 0;
+    if (sample_stop) {
+      uint64_t retired = procs[0]->get_state()->minstret->read();
+      steps = std::min<size_t>(steps, sample_stop - std::min(sample_stop, retired));
+    }
+
+#ifdef RISCV_ENABLE_SIFT
+    // Switch between skipping, warming and tracing exactly at the phase
+    // boundaries of the sampling period.
+    if (sift_periodic) {
+      uint64_t retired = procs[current_proc]->get_state()->minstret->read();
+      steps = std::min<size_t>(steps, procs[current_proc]->sift_phase_stop(retired) - retired);
+    }
+#endif
+
+    // Stop exactly at the hart's next PC sample.
+    if (pc_sampler)
+      steps = std::min<size_t>(steps, pc_sampler->insns_until_sample(procs[current_proc]));
+
+    // Likewise at the page heat map's next TLB flush or epoch.
+    if (page_heat && current_proc == 0)
+      steps = std::min<size_t>(steps, page_heat->insns_until_due(procs[0]->get_state()->minstret->read()));
+
+    // A hart stalled in WFI is passed over until an interrupt wakes it.
+    if (steps && !procs[current_proc]->is_waiting_for_interrupt())
+      procs[current_proc]->step(steps);
+
+    if (pc_sampler)
+      pc_sampler->maybe_sample(procs[current_proc]);
+
+    if (page_heat && current_proc == 0 && page_heat->insns_until_due(procs[0]->get_state()->minstret->read()) == 0) {
+      // The exact mode's accesses are still buffered in the MMUs.
+      if (page_heat->exact())
+        for (auto p : procs)
+          p->get_mmu()->flush_trace();
+      if (page_heat->advance(procs[0]->get_state()->minstret->read()))
+        for (auto p : procs)
+          p->get_mmu()->flush_tlb();
+    }
+
+    // Hand a hart stopped by the interactive debugger straight back to it.
+    if (unlikely(procs[current_proc]->is_interactive_stopped())) {
+      if (!procs[current_proc]->get_mmu()->marker_stopped)
+        return;
+      save_marker_checkpoint();
+    }
+
+    if (checkpointing && procs[0]->get_state()->minstret->read() >= checkpoint_save_instret) {
+      save_checkpoint(checkpoint_save_path.c_str());
+      checkpoint_save_instret = 0;
+    }
+
+    if (sample_stop && sample_stop_reached(procs[0]->get_state()->minstret->read()))
+      return;
+
+    if (unlikely(stop_instret != 0 || procs[current_proc]->get_mmu()->marker_seen) && stop_reached())
+      return;
 
     current_step += steps;
-    if (current_step == INTERLEAVE)
+    steps_taken += steps;
+    if (current_step == interleave)
     {
       current_step = 0;
       procs[current_proc]->get_mmu()->yield_load_reservation();
-      if (++current_proc == procs.size()) {
-        current_proc = 0;
-        if (clint) clint->increment(INTERLEAVE / INSNS_PER_RTC_TICK);
+      procs[current_proc]->get_mmu()->flush_trace();
+#ifdef RISCV_ENABLE_SIFT
+      if (sift_sync)
+        procs[current_proc]->sift_sync();
+#endif
+      if (++current_proc == (distributed ? distributed->end_hart() : procs.size())) {
+        current_proc = distributed ? distributed->first_hart() : 0;
+        if (distributed)
+          sync_ranks();
+        advance_time(interleave);
       }
 
-      host->switch_to();
+      yield_to_host();
     }
   }
 }
@@ -233,17 +490,787 @@ void sim_t::set_debug(bool value)
   debug = value;
 }
 
-void sim_t::set_histogram(bool value)
+void sim_t::set_histogram(bool value, bool by_symbol)
 {
   histogram_enabled = value;
   for (size_t i = 0; i < procs.size(); i++) {
-    procs[i]->set_histogram(histogram_enabled);
+    procs[i]->set_histogram(histogram_enabled, by_symbol);
   }
 }
 
-void sim_t::configure_log(bool enable_log, bool enable_commitlog)
+void sim_t::set_insn_mix(const char* path)
+{
+  insn_mix_path = path;
+  for (size_t i = 0; i < procs.size(); i++)
+    procs[i]->set_insn_mix(true);
+  signal(SIGUSR1, &handle_insn_mix_signal);
+}
+
+void sim_t::write_insn_mix(const std::string& path)
+{
+  FILE* f = fopen(path.c_str(), "w");
+  if (!f) {
+    perror(path.c_str());
+    return;
+  }
+  fprintf(f, "hart,insn,ext,sew,lmul,count\n");
+  for (size_t i = 0; i < procs.size(); i++)
+    procs[i]->write_insn_mix(f);
+  fclose(f);
+}
+
+void sim_t::set_bbv_interval(uint64_t interval)
+{
+  for (size_t i = 0; i < procs.size(); i++) {
+    procs[i]->set_bbv_interval(interval);
+  }
+}
+
+void sim_t::set_call_stacks(bool value)
+{
+  for (size_t i = 0; i < procs.size(); i++)
+    procs[i]->set_call_stacks(value);
+}
+
+void sim_t::set_vector_stats(const char* path)
+{
+  vector_stats_path = path;
+  for (size_t i = 0; i < procs.size(); i++)
+    procs[i]->set_vector_stats(true);
+}
+
+void sim_t::write_vector_stats()
+{
+  FILE* f = fopen(vector_stats_path.c_str(), "w");
+  if (!f) {
+    perror(vector_stats_path.c_str());
+    return;
+  }
+  fprintf(f, "hart,class,sew,lmul,insns,elements,vlmax_elements,masked_off,tail,"
+             "vl_utilization,masked_off_ratio,tail_ratio\n");
+  for (size_t i = 0; i < procs.size(); i++)
+    procs[i]->get_vector_stats()->write(f, procs[i]->get_id());
+  fclose(f);
+}
+
+void sim_t::set_trap_profile(const char* path)
+{
+  trap_profile_path = path;
+  for (size_t i = 0; i < procs.size(); i++)
+    procs[i]->set_trap_profile(true);
+}
+
+void sim_t::write_trap_profile()
+{
+  FILE* f = fopen(trap_profile_path.c_str(), "w");
+  if (!f) {
+    perror(trap_profile_path.c_str());
+    return;
+  }
+  fprintf(f, "hart,cause,name,level,traps,raised,returns,insns,insns_per_return,"
+             "host_ns,host_ns_per_return\n");
+  for (size_t i = 0; i < procs.size(); i++) {
+    trap_profile_t* profile = procs[i]->get_trap_profile();
+    profile->settle(procs[i]->get_state()->minstret->read());
+    profile->write(f, procs[i]->get_id());
+  }
+  fclose(f);
+}
+
+void sim_t::set_atomic_profile(const char* path)
+{
+  atomic_profile_path = path;
+  for (auto p : procs) {
+    atomic_profiles.emplace_back(new atomic_profile_t());
+    p->get_mmu()->atomic_profile = atomic_profiles.back().get();
+  }
+}
+
+void sim_t::write_atomic_profile()
+{
+  FILE* f = fopen(atomic_profile_path.c_str(), "w");
+  if (!f) {
+    perror(atomic_profile_path.c_str());
+    return;
+  }
+  std::vector<const atomic_profile_t*> harts;
+  for (auto& profile : atomic_profiles)
+    harts.push_back(profile.get());
+  atomic_profile_t::write_report(f, harts, [&](uint64_t addr) { return describe_addr(addr); });
+  fclose(f);
+}
+
+void sim_t::set_pc_sampling(const char* path, uint64_t period, size_t depth)
+{
+  pc_sampler.reset(new pc_sampler_t(path, period, depth, this));
+}
+
+void sim_t::set_progress(const char* path, uint16_t port, double interval)
+{
+  progress.reset(new progress_reporter_t(this, path, port, interval));
+}
+
+void sim_t::set_page_heat(const char* path, uint64_t epoch, uint64_t flush_period, bool exact)
+{
+  page_heat.reset(new page_heat_t(path, epoch, flush_period, exact));
+  for (auto p : procs) {
+    if (exact)
+      p->get_mmu()->register_memtracer(page_heat.get());
+    else
+      p->get_mmu()->page_heat = page_heat.get();
+  }
+}
+
+void sim_t::set_memory_advice(uint64_t epoch, uint64_t flush_period)
+{
+  if (!page_heat)
+    set_page_heat(nullptr, epoch, flush_period, false);
+  page_heat->set_epoch_hook([this](const page_heat_t::counts_t& counts) { advise_memory(counts); });
+}
+
+void sim_t::advise_memory(const page_heat_t::counts_t& counts)
+{
+  std::vector<reg_t> touched;
+  touched.reserve(counts.size());
+  for (auto& page : counts)
+    touched.push_back(page.first);
+  std::sort(touched.begin(), touched.end());
+
+  // One madvise per run of pages that are contiguous in the host too.
+  auto advise = [this](const std::vector<reg_t>& ppns, int advice) {
+    char* start = nullptr;
+    size_t len = 0;
+    for (reg_t ppn : ppns) {
+      char* host = addr_to_mem(ppn << PGSHIFT);
+      if (host && host == start + len) {
+        len += PGSIZE;
+        continue;
+      }
+      if (start)
+        madvise(start, len, advice);
+      start = host;
+      len = host ? PGSIZE : 0;
+    }
+    if (start)
+      madvise(start, len, advice);
+  };
+
+  advise(touched, MADV_WILLNEED);
+#ifdef MADV_COLD
+  std::vector<reg_t> cooled;
+  std::set_difference(advised_pages.begin(), advised_pages.end(), touched.begin(), touched.end(),
+                      std::back_inserter(cooled));
+  advise(cooled, MADV_COLD);
+#endif
+  advised_pages.swap(touched);
+}
+
+void sim_t::add_plugin(plugin_t* plugin)
+{
+  plugins.emplace_back(plugin);
+  for (auto p : procs)
+    p->add_plugin(plugin);
+}
+
+void sim_t::set_block_cache(bool value, bool inline_ops, bool fuse_ops)
+{
+  if (!value)
+    return;
+  for (size_t i = 0; i < procs.size(); i++) {
+    procs[i]->get_mmu()->enable_block_cache(inline_ops, fuse_ops);
+  }
+}
+
+void sim_t::configure_icache(size_t sets, size_t ways, bool stats)
+{
+  for (size_t i = 0; i < procs.size(); i++) {
+    procs[i]->get_mmu()->configure_icache(sets, ways);
+    procs[i]->get_mmu()->set_icache_stats(stats);
+  }
+}
+
+void sim_t::configure_tlb(size_t entries, size_t stlb_sets, size_t stlb_ways, bool stats)
+{
+  for (size_t i = 0; i < procs.size(); i++) {
+    procs[i]->get_mmu()->configure_tlb(entries, stlb_sets, stlb_ways);
+    procs[i]->get_mmu()->set_tlb_stats(stats);
+  }
+}
+
+void sim_t::configure_walk_cache(size_t entries)
+{
+  for (size_t i = 0; i < procs.size(); i++) {
+    procs[i]->get_mmu()->configure_walk_cache(entries);
+  }
+}
+
+void sim_t::set_trace_filter(reg_t priv_mask, const char* ranges,
+                             const std::vector<reg_t>& asids)
+{
+  trace_priv_mask = priv_mask;
+  trace_ranges = ranges ? ranges : "";
+  trace_asids = asids;
+}
+
+void sim_t::apply_trace_filter()
+{
+  std::vector<std::pair<reg_t, reg_t>> ranges;
+  std::stringstream specs(trace_ranges);
+  std::string spec;
+  while (std::getline(specs, spec, ',')) {
+    // Each bound is a number or a symbol; a lone symbol covers the code up
+    // to the next symbol.
+    auto resolve = [&](const std::string& s, bool is_end) {
+      char* end;
+      reg_t addr = strtoull(s.c_str(), &end, 0);
+      if (!s.empty() && *end == '\0')
+        return addr;
+      uint64_t start, next;
+      if (!find_symbol(s, &start, &next)) {
+        std::cerr << "trace range symbol '" << s << "' not found\n";
+        exit(1);
+      }
+      return is_end ? next : start;
+    };
+
+    size_t colon = spec.find(':');
+    if (colon == std::string::npos)
+      ranges.push_back({resolve(spec, false), resolve(spec, true)});
+    else
+      ranges.push_back({resolve(spec.substr(0, colon), false),
+                        resolve(spec.substr(colon + 1), false)});
+  }
+
+  for (size_t i = 0; i < procs.size(); i++) {
+    procs[i]->set_trace_filter(trace_priv_mask, ranges, trace_asids);
+  }
+}
+
+void sim_t::set_checkpoint_save(const char* path, uint64_t instret)
+{
+  checkpoint_save_path = path;
+  checkpoint_save_instret = instret;
+}
+
+void sim_t::set_checkpoint_restore(const char* path)
+{
+  checkpoint_restore_path = path;
+}
+
+void sim_t::set_checkpoint_at_marker(const char* path)
+{
+  checkpoint_marker_path = path;
+  procs[0]->get_mmu()->set_marker_stop(true);
+}
+
+static insn_bits_t magic_marker(uint32_t id)
+{
+  return (insn_bits_t(id) << 20) | 0x13;  // addi x0, x0, id
+}
+
+void sim_t::set_stop_policy(uint64_t max_instret, uint64_t roi_instret, bool at_roi_end,
+                            const std::vector<uint32_t>& magic_ids)
+{
+  stop_instret = max_instret;
+  stop_roi_instret = roi_instret;
+  if (at_roi_end)
+    stop_markers.push_back(magic_marker(2));
+  for (uint32_t id : magic_ids)
+    stop_markers.push_back(magic_marker(id));
+  watch_stop_markers();
+}
+
+void sim_t::set_stats_roi(std::function<void(size_t, bool)> on_roi)
+{
+  stats_roi_hook = on_roi;
+  for (auto proc : procs)
+    proc->set_stats_paused(true);
+  watch_stop_markers();
+}
+
+// The harts watch for the markers of all the policies at once.
+void sim_t::watch_stop_markers()
+{
+  std::vector<insn_bits_t> watched = stop_markers;
+  if (stop_roi_instret || stats_roi_hook)
+    watched.push_back(magic_marker(1));
+  if (stats_roi_hook)
+    watched.push_back(magic_marker(2));
+  if (!watched.empty()) {
+    for (auto proc : procs)
+      proc->get_mmu()->watch_markers(watched);
+  }
+}
+
+// A hart retired an ROI marker.  Nested or unmatched markers are ignored.
+void sim_t::stats_roi_marker(bool start)
+{
+  if (start == in_stats_roi)
+    return;
+  in_stats_roi = start;
+  if (start) {
+    stats_roi_hook(stats_rois, true);
+    for (auto proc : procs)
+      proc->set_stats_paused(false);
+    return;
+  }
+
+  size_t k = stats_rois++;
+  for (auto proc : procs)
+    proc->set_stats_paused(true);
+  stats_roi_hook(k, false);
+  if (histogram_enabled) {
+    fprintf(stderr, "ROI %zu:\n", k);
+    for (auto proc : procs)
+      proc->report_histogram();
+  }
+  if (!insn_mix_path.empty())
+    write_insn_mix(insn_mix_path + ".roi" + std::to_string(k));
+  for (auto proc : procs)
+    proc->reset_executions();
+}
+
+// Applies the stop policies after a step of the current hart.  Returns
+// whether the run is over.
+bool sim_t::stop_reached()
+{
+  mmu_t* mmu = procs[current_proc]->get_mmu();
+  insn_bits_t marker = mmu->marker_seen;
+  mmu->marker_seen = 0;
+  uint64_t retired = procs[0]->get_state()->minstret->read();
+
+  if (stats_roi_hook && (marker == magic_marker(1) || marker == magic_marker(2)))
+    stats_roi_marker(marker == magic_marker(1));
+
+  const char* why = nullptr;
+  if (marker && std::find(stop_markers.begin(), stop_markers.end(), marker) != stop_markers.end())
+    why = marker == magic_marker(2) ? "the ROI end marker" : "a magic marker";
+  else if (marker == magic_marker(1) && stop_roi_instret) {
+    stop_instret = retired + stop_roi_instret;
+    stop_roi_instret = 0;
+  }
+  if (!why && stop_instret != 0 && retired >= stop_instret)
+    why = "the instruction limit";
+  if (!why)
+    return false;
+
+  fprintf(stderr, "stopping at %s (hart %zu), with hart 0 at instruction %" PRIu64 "\n",
+          why, current_proc, retired);
+  if (kvm_ff_resume) {
+    kvm_run_hart0(0);
+    return true;
+  }
+  request_exit(0);
+  host->switch_to();
+  return true;
+}
+
+// Hart 0 stopped before the marker, which runs once this is disarmed.
+void sim_t::save_marker_checkpoint()
+{
+  mmu_t* mmu = procs[0]->get_mmu();
+  mmu->marker_stopped = false;
+  mmu->set_marker_stop(false);
+
+  std::string tmp = checkpoint_marker_path + ".tmp" + std::to_string(getpid());
+  save_checkpoint(tmp.c_str());
+  if (rename(tmp.c_str(), checkpoint_marker_path.c_str()) != 0) {
+    remove(tmp.c_str());
+    throw std::runtime_error("could not create checkpoint " + checkpoint_marker_path);
+  }
+  fprintf(stderr, "saved boot checkpoint %s at instruction %" PRIu64 "\n",
+          checkpoint_marker_path.c_str(), procs[0]->get_state()->minstret->read());
+}
+
+void sim_t::set_samples(const std::vector<std::pair<uint64_t, uint64_t>>& samples,
+                        size_t jobs, std::function<void(size_t)> on_fork)
+{
+  for (size_t i = 0; i < samples.size(); i++)
+    this->samples.push_back({samples[i].first, samples[i].second, i});
+  std::stable_sort(this->samples.begin(), this->samples.end(),
+                   [](const sample_t& a, const sample_t& b) { return a.start < b.start; });
+  sample_jobs = std::max<size_t>(jobs, 1);
+  sample_fork_hook = on_fork;
+#ifdef RISCV_ENABLE_SIFT
+  // Only the children trace.
+  if (!samples.empty())
+    set_sift_roi_only(true);
+#endif
+}
+
+uint64_t sim_t::next_sample_stop()
+{
+  if (sample_end)
+    return sample_end;
+  return next_sample < samples.size() ? samples[next_sample].start : 0;
+}
+
+// Returns whether this is a sample's child that is done.
+bool sim_t::sample_stop_reached(uint64_t instret)
+{
+  if (sample_end) {
+    if (instret < sample_end)
+      return false;
+    request_exit(0);
+    host->switch_to();
+    return true;
+  }
+
+  while (next_sample < samples.size() && samples[next_sample].start <= instret)
+    fork_sample(samples[next_sample++]);
+  return false;
+}
+
+void sim_t::fork_sample(const sample_t& sample)
+{
+  wait_for_samples(sample_jobs - 1);
+
+  // Accesses still buffered for the cache models belong to the parent, and
+  // so does anything buffered for its output files.
+  for (auto proc : procs)
+    proc->get_mmu()->flush_trace();
+  std::cout.flush();
+  fflush(NULL);
+
+  pid_t pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    exit(1);
+  }
+  if (pid > 0) {
+    sample_children[pid] = sample.index;
+    return;
+  }
+
+  // The child leaves the terminal to the parent.
+  std::string prefix = sift_prefix + "_s" + std::to_string(sample.index);
+  std::string out_path = prefix + ".out";
+  int out = open(out_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  int in = open("/dev/null", O_RDONLY);
+  if (out < 0 || in < 0) {
+    perror(out < 0 ? out_path.c_str() : "/dev/null");
+    exit(1);
+  }
+  dup2(out, STDOUT_FILENO);
+  dup2(in, STDIN_FILENO);
+  close(out);
+  close(in);
+
+  samples.clear();
+  next_sample = 0;
+  sample_children.clear();
+  sample_end = sample.start + sample.length;
+#ifdef RISCV_ENABLE_SIFT
+  sample_sift_prefix = prefix;
+  for (auto proc : procs) {
+    proc->restart_sift_stream(sample_sift_prefix.c_str());
+    proc->set_sift_roi_only(false);
+  }
+#endif
+  if (sample_fork_hook)
+    sample_fork_hook(sample.index);
+}
+
+void sim_t::wait_for_samples(size_t max_running)
+{
+  while (sample_children.size() > max_running) {
+    int status;
+    pid_t pid = wait(&status);
+    if (pid < 0) {
+      perror("wait");
+      exit(1);
+    }
+    auto it = sample_children.find(pid);
+    if (it == sample_children.end())
+      continue;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+      fprintf(stderr, "sample %zu failed\n", it->second);
+    sample_children.erase(it);
+  }
+}
+
+#ifdef RISCV_ENABLE_SIFT
+void sim_t::set_sift_async(bool value)
+{
+  for (size_t i = 0; i < procs.size(); i++) {
+    procs[i]->set_sift_async(value);
+  }
+}
+
+void sim_t::set_sift_roi_only(bool value)
+{
+  for (size_t i = 0; i < procs.size(); i++) {
+    procs[i]->set_sift_roi_only(value);
+  }
+}
+
+void sim_t::set_sift_code_pages(bool value)
+{
+  for (size_t i = 0; i < procs.size(); i++) {
+    procs[i]->set_sift_code_pages(value);
+  }
+}
+
+void sim_t::set_sift_compression(bool value)
+{
+  for (size_t i = 0; i < procs.size(); i++) {
+    procs[i]->set_sift_compression(value);
+  }
+}
+
+void sim_t::set_sift_va2pa(bool value)
+{
+  for (size_t i = 0; i < procs.size(); i++) {
+    procs[i]->set_sift_va2pa(value);
+  }
+}
+
+void sim_t::set_sift_fifo(bool value)
+{
+  for (size_t i = 0; i < procs.size(); i++) {
+    procs[i]->set_sift_fifo(value);
+  }
+}
+
+void sim_t::set_sift_segment(uint64_t length)
+{
+  for (size_t i = 0; i < procs.size(); i++) {
+    procs[i]->set_sift_segment(length);
+  }
+}
+
+void sim_t::set_sift_period(uint64_t skip, uint64_t warm, uint64_t detail)
+{
+  sift_periodic = detail != 0;
+  for (size_t i = 0; i < procs.size(); i++) {
+    procs[i]->set_sift_period(skip, warm, detail);
+  }
+}
+
+void sim_t::set_sift_syscalls(bool value)
+{
+  for (size_t i = 0; i < procs.size(); i++) {
+    procs[i]->set_sift_syscalls(value);
+  }
+}
+
+void sim_t::set_sift_uop_width(reg_t bits)
+{
+  for (size_t i = 0; i < procs.size(); i++) {
+    procs[i]->set_sift_uop_width(bits);
+  }
+}
+
+void sim_t::set_sift_warmup(size_t lines)
+{
+  for (size_t i = 0; i < procs.size(); i++) {
+    procs[i]->set_sift_warmup(lines);
+  }
+}
+
+void sim_t::set_sift_sync(size_t interval)
+{
+  sift_sync = interval != 0;
+  if (sift_sync)
+    interleave = interval;
+}
+#endif
+
+void sim_t::set_parallel(bool value)
+{
+  parallel = value;
+  if (value && !reservation_owners)
+    reservation_owners.reset(new std::atomic<uint32_t>[mmu_t::RESERVATION_SLOTS]());
+  for (size_t i = 0; i < procs.size(); i++) {
+    procs[i]->get_mmu()->parallel_atomics = value;
+    procs[i]->get_mmu()->reservation_owners = reservation_owners.get();
+  }
+}
+
+void sim_t::set_distributed(distributed_t* d)
+{
+  distributed = d;
+  current_proc = d->first_hart();
+  // The other ranks' harts run at the same time, on the same memory.
+  for (auto proc : procs) {
+    proc->get_mmu()->parallel_atomics = true;
+    proc->get_mmu()->reservation_owners = d->get_reservation_owners();
+  }
+  if (clint)
+    d->attach(clint.get());
+}
+
+void sim_t::sync_ranks()
+{
+  bool idle = true;
+  for (size_t i = distributed->first_hart(); i < distributed->end_hart(); i++)
+    idle &= procs[i]->is_waiting_for_interrupt();
+  int code;
+  if (!distributed->sync(idle, &code))
+    request_exit(code);
+}
+
+void sim_t::set_kvm_fast_forward(kvm_ff_t* k, uint64_t insns, bool resume)
+{
+  kvm_ff = k;
+  kvm_ff_insns = insns;
+  kvm_ff_resume = resume;
+}
+
+bool sim_t::kvm_run_hart0(uint64_t insns)
+{
+  int code = 0;
+  uint64_t start = procs[0]->get_state()->minstret->read();
+  bool running;
+  try {
+    running = kvm_ff->run(procs[0], clint.get(), insns, &code);
+  } catch (std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    exit(1);
+  }
+  fprintf(stderr, "KVM ran hart 0 natively for %" PRIu64 " instructions%s\n",
+          procs[0]->get_state()->minstret->read() - start,
+          running ? "" : ", until the guest shut down");
+  if (!running) {
+    request_exit(code);
+    host->switch_to();
+  }
+  return running;
+}
+
+void sim_t::set_pin_harts(bool value)
+{
+  hart_cpus.clear();
+  cpu_set_t allowed;
+  if (!value || sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+    return;
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    if (CPU_ISSET(cpu, &allowed))
+      hart_cpus.push_back(cpu);
+}
+
+// Threads inherit their creator's affinity, so the CPUs are listed before
+// any is pinned.
+void sim_t::pin_hart_thread(size_t id)
+{
+  if (hart_cpus.empty())
+    return;
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(hart_cpus[id % hart_cpus.size()], &cpus);
+  if (sched_setaffinity(0, sizeof(cpus), &cpus) != 0)
+    fprintf(stderr, "warning: could not pin hart %zu to CPU %d\n",
+            id, hart_cpus[id % hart_cpus.size()]);
+}
+
+void sim_t::parallel_worker(size_t id)
+{
+  pin_hart_thread(id);
+  uint64_t last_round = 0;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(round_lock);
+      round_start.wait(lock, [&]{ return round != last_round || workers_exit; });
+      if (workers_exit)
+        return;
+      last_round = round;
+    }
+
+    if (!procs[id]->is_waiting_for_interrupt())
+      procs[id]->step(interleave);
+
+    std::lock_guard<std::mutex> lock(round_lock);
+    if (--harts_running == 0)
+      round_done.notify_one();
+  }
+}
+
+void sim_t::step_parallel()
+{
+  if (workers.empty()) {
+    for (size_t i = 1; i < procs.size(); i++)
+      workers.emplace_back(&sim_t::parallel_worker, this, i);
+    pin_hart_thread(0);
+  }
+
+  // Hart 0 runs on this thread while the workers run the others.
+  {
+    std::lock_guard<std::mutex> lock(round_lock);
+    harts_running = procs.size() - 1;
+    round++;
+  }
+  round_start.notify_all();
+  if (!procs[0]->is_waiting_for_interrupt())
+    procs[0]->step(interleave);
+  {
+    std::unique_lock<std::mutex> lock(round_lock);
+    round_done.wait(lock, [&]{ return harts_running == 0; });
+  }
+
+  for (size_t i = 0; i < procs.size(); i++) {
+    if (pc_sampler)
+      pc_sampler->maybe_sample(procs[i]);
+    procs[i]->get_mmu()->yield_load_reservation();
+    procs[i]->get_mmu()->flush_trace();
+#ifdef RISCV_ENABLE_SIFT
+    if (sift_sync)
+      procs[i]->sift_sync();
+#endif
+  }
+  advance_time(interleave);
+
+  yield_to_host();
+}
+
+uint64_t sim_t::step_hart(size_t i, size_t n)
+{
+  processor_t* proc = procs.at(i);
+  if (proc->is_waiting_for_interrupt())
+    return 0;
+
+  uint64_t before = proc->get_state()->minstret->read();
+  proc->step(n);
+  // As if the hart's quantum had ended.
+  proc->get_mmu()->yield_load_reservation();
+  proc->get_mmu()->flush_trace();
+  return proc->get_state()->minstret->read() - before;
+}
+
+void sim_t::advance_time(size_t insns)
+{
+  for (auto dev : ticked_devices)
+    dev->tick(insns);
+  if (progress)
+    progress->tick();
+  rtc_insns += insns;
+  if (clint) clint->increment(rtc_insns / INSNS_PER_RTC_TICK);
+  rtc_insns %= INSNS_PER_RTC_TICK;
+  if (clint && all_harts_idle())
+    clint->advance_to_next_timer();
+}
+
+// When every hart is waiting for an interrupt, nothing can happen until
+// the next timer fires.
+bool sim_t::all_harts_idle()
+{
+  if (distributed)
+    return distributed->all_idle();
+  for (auto proc : procs)
+    if (!proc->is_waiting_for_interrupt())
+      return false;
+  return true;
+}
+
+void sim_t::set_interleave(size_t value)
+{
+  interleave = value;
+}
+
+void sim_t::configure_log(bool enable_log, bool enable_commitlog, bool binary_commitlog,
+                          bool compact_commitlog)
 {
   log = enable_log;
+  commit_log = enable_commitlog;
 
   if (!enable_commitlog)
     return;
@@ -255,8 +1282,10 @@ void sim_t::configure_log(bool enable_log, bool enable_commitlog)
         stderr);
   abort();
 #else
+  if (binary_commitlog)
+    fwrite(COMMIT_LOG_MAGIC, 1, COMMIT_LOG_MAGIC_LEN, log_file.get());
   for (processor_t *proc : procs) {
-    proc->enable_log_commits();
+    proc->enable_log_commits(binary_commitlog, compact_commitlog);
   }
 #endif
 }
@@ -276,13 +1305,36 @@ bool sim_t::mmio_load(reg_t addr, size_t len, uint8_t* bytes)
 {
   if (addr + len < addr || !paddr_ok(addr + len - 1))
     return false;
+  std::unique_lock<std::mutex> lock(mmio_lock, std::defer_lock);
+  if (parallel || get_async_syscalls())
+    lock.lock();
+  if (unlikely(!mmio_overrides.empty())) {
+    auto it = mmio_overrides.find({addr, len});
+    if (it != mmio_overrides.end()) {
+      uint64_t value = it->second.front();
+      it->second.pop_front();
+      if (it->second.empty())
+        mmio_overrides.erase(it);
+      memcpy(bytes, &value, std::min(len, sizeof(value)));
+      return true;
+    }
+  }
   return bus.load(addr, len, bytes);
 }
 
+void sim_t::override_mmio_load(reg_t addr, size_t len, uint64_t value)
+{
+  std::lock_guard<std::mutex> lock(mmio_lock);
+  mmio_overrides[{addr, len}].push_back(value);
+}
+
 bool sim_t::mmio_store(reg_t addr, size_t len, const uint8_t* bytes)
 {
   if (addr + len < addr || !paddr_ok(addr + len - 1))
     return false;
+  std::unique_lock<std::mutex> lock(mmio_lock, std::defer_lock);
+  if (parallel || get_async_syscalls())
+    lock.lock();
   return bus.store(addr, len, bytes);
 }
 
@@ -303,8 +1355,10 @@ void sim_t::make_dtb()
     std::pair<reg_t, reg_t> initrd_bounds = cfg->initrd_bounds();
     dts = make_dts(INSNS_PER_RTC_TICK, CPU_HZ,
                    initrd_bounds.first, initrd_bounds.second,
-                   cfg->bootargs(), procs, mems);
-    dtb = dts_compile(dts);
+                   cfg->bootargs(), procs, mems, uarts, virtio_devices);
+    dtb = build_dtb(INSNS_PER_RTC_TICK, CPU_HZ,
+                    initrd_bounds.first, initrd_bounds.second,
+                    cfg->bootargs(), procs, mems, uarts, virtio_devices);
   }
 
   int fdt_code = fdt_check_header(dtb.c_str());
@@ -380,12 +1434,80 @@ const char* sim_t::get_symbol(uint64_t addr)
   return htif_t::get_symbol(addr);
 }
 
+const char* sim_t::get_enclosing_symbol(uint64_t addr, uint64_t* start, uint64_t* end)
+{
+  return htif_t::get_enclosing_symbol(addr, start, end);
+}
+
+std::string sim_t::describe_addr(reg_t addr)
+{
+  uint64_t start;
+  const char* symbol = get_enclosing_symbol(addr, &start);
+  if (!symbol)
+    return "";
+
+  std::ostringstream s;
+  s << symbol << "+0x" << std::hex << addr - start;
+  return s.str();
+}
+
 // htif
 
 void sim_t::reset()
 {
   if (dtb_enabled)
     set_rom();
+  if (user_mode)
+    start_user_program();
+
+  if (libc_intercepts) {
+    unsigned found = 0;
+    for (const char* name : {"memcpy", "memset", "strlen", "memcmp"}) {
+      uint64_t start;
+      if (!find_function(name, &start))
+        continue;
+      for (auto proc : procs)
+        proc->get_mmu()->set_libc_intercept(start, name);
+      found++;
+    }
+    if (found == 0)
+      fprintf(stderr, "warning: --native-libc found no libc routines in the ELF\n");
+  }
+
+  // Watch the page(s) holding tohost and fromhost, unless the program has
+  // none or they are too far apart to watch cheaply, or harts in other
+  // processes write them too.
+  reg_t tohost = get_tohost_addr(), fromhost = get_fromhost_addr();
+  reg_t lo = std::min(tohost, fromhost), hi = std::max(tohost, fromhost) + 8;
+  htif_watch = tohost != 0 && hi - lo <= 2 * PGSIZE && !distributed;
+  if (htif_watch) {
+    for (auto proc : procs)
+      proc->get_mmu()->set_htif_watch(lo, hi);
+  }
+}
+
+// Run the HTIF host loop only once the target has written tohost or
+// fromhost or an asynchronous syscall has finished, and otherwise every HOST_POLL_QUANTA quanta so that host
+// devices, such as console input, still get ticked.
+void sim_t::yield_to_host()
+{
+  // No hart is in the middle of a step here.
+  if (unlikely(insn_mix_requested)) {
+    insn_mix_requested = false;
+    write_insn_mix(insn_mix_path);
+  }
+
+  if (htif_watch) {
+    bool written = async_reply_ready();
+    for (auto proc : procs)
+      written |= proc->get_mmu()->htif_store_seen;
+    if (!written && ++host_poll_quanta < HOST_POLL_QUANTA)
+      return;
+    for (auto proc : procs)
+      proc->get_mmu()->htif_store_seen = false;
+  }
+  host_poll_quanta = 0;
+  host->switch_to();
 }
 
 void sim_t::idle()
@@ -393,9 +1515,14 @@ void sim_t::idle()
   target.switch_to();
 }
 
+// The syscall thread comes here for memory that direct_ptr does not reach,
+// while the HTIF loop may be here for tohost and fromhost.
 void sim_t::read_chunk(addr_t taddr, size_t len, void* dst)
 {
   assert(len == 8);
+  std::unique_lock<std::mutex> lock(debug_mmu_lock, std::defer_lock);
+  if (get_async_syscalls())
+    lock.lock();
   auto data = debug_mmu->to_target(debug_mmu->load_uint64(taddr));
   memcpy(dst, &data, sizeof data);
 }
@@ -403,11 +1530,184 @@ void sim_t::read_chunk(addr_t taddr, size_t len, void* dst)
 void sim_t::write_chunk(addr_t taddr, size_t len, const void* src)
 {
   assert(len == 8);
+  std::unique_lock<std::mutex> lock(debug_mmu_lock, std::defer_lock);
+  if (get_async_syscalls())
+    lock.lock();
   target_endian<uint64_t> data;
   memcpy(&data, src, sizeof data);
   debug_mmu->store_uint64(taddr, debug_mmu->from_target(data));
 }
 
+// Untouched pages of RAM are left unallocated rather than written with zeros.
+void sim_t::clear_chunk(addr_t taddr, size_t len)
+{
+  if (paddr_ok(taddr)) {
+    auto desc = bus.find_device(taddr);
+    if (auto mem = dynamic_cast<mem_t*>(desc.second)) {
+      if (reverse_interval)
+        journal_store(taddr, len);
+      if (mem->clear(taddr - desc.first, len))
+        return;
+    }
+  }
+  htif_t::clear_chunk(taddr, len);
+}
+
+template<typename ehdr_t, typename phdr_t>
+static std::vector<phdr_t> read_load_segments(int fd)
+{
+  ehdr_t eh;
+  if (pread(fd, &eh, sizeof(eh), 0) != sizeof(eh))
+    return {};
+  std::vector<phdr_t> ph(eh.e_phnum);
+  if (pread(fd, ph.data(), ph.size() * sizeof(phdr_t), eh.e_phoff) != ssize_t(ph.size() * sizeof(phdr_t)))
+    return {};
+  ph.erase(std::remove_if(ph.begin(), ph.end(), [](const phdr_t& p) {
+    return p.p_type != PT_LOAD || p.p_filesz == 0;
+  }), ph.end());
+  return ph;
+}
+
+// Loads what it can of a little-endian ELF's segments into memory from the
+// file itself and leaves the rest to the ELF loader.
+void sim_t::share_elf_image(const std::string& path)
+{
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return;
+  Elf64_Ehdr eh;
+  std::vector<std::tuple<reg_t, reg_t, reg_t>> segments;  // paddr, filesz, offset
+  if (pread(fd, &eh, sizeof(eh), 0) == sizeof(eh) && IS_ELFLE(eh) && IS_ELF64(eh)) {
+    for (auto& p : read_load_segments<Elf64_Ehdr, Elf64_Phdr>(fd))
+      segments.push_back({p.p_paddr, p.p_filesz, p.p_offset});
+  } else if (IS_ELFLE(eh) && IS_ELF32(eh)) {
+    for (auto& p : read_load_segments<Elf32_Ehdr, Elf32_Phdr>(fd))
+      segments.push_back({p.p_paddr, p.p_filesz, p.p_offset});
+  }
+
+  for (auto& [paddr, filesz, offset] : segments) {
+    if (!paddr_ok(paddr))
+      continue;
+    auto desc = bus.find_device(paddr);
+    auto mem = dynamic_cast<mem_t*>(desc.second);
+    if (mem && mem->load_file(paddr - desc.first, filesz, fd, offset))
+      shared_segments.push_back({paddr, filesz});
+  }
+  close(fd);
+}
+
+void sim_t::load_memory_dump(const std::string& path)
+{
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    throw std::runtime_error("could not open memory dump " + path);
+  Elf64_Ehdr eh;
+  std::vector<std::tuple<reg_t, reg_t, reg_t>> segments;  // paddr, filesz, offset
+  if (pread(fd, &eh, sizeof(eh), 0) == sizeof(eh) && IS_ELFLE(eh) && IS_ELF64(eh)) {
+    for (auto& p : read_load_segments<Elf64_Ehdr, Elf64_Phdr>(fd))
+      segments.push_back({p.p_paddr, p.p_filesz, p.p_offset});
+  } else if (IS_ELFLE(eh) && IS_ELF32(eh)) {
+    for (auto& p : read_load_segments<Elf32_Ehdr, Elf32_Phdr>(fd))
+      segments.push_back({p.p_paddr, p.p_filesz, p.p_offset});
+  } else {
+    close(fd);
+    throw std::runtime_error(path + " is not a little-endian ELF file");
+  }
+
+  for (auto& [paddr, filesz, offset] : segments) {
+    reg_t mem_offset;
+    mem_t* mem = image_mem(paddr, filesz, &mem_offset);
+    if (!mem) {
+      fprintf(stderr, "warning: skipping the %" PRIu64 " bytes of %s at 0x%" PRIx64
+                      ", which are not memory here\n", filesz, path.c_str(), paddr);
+      continue;
+    }
+    if (!mem->load_file(mem_offset, filesz, fd, offset)) {
+      close(fd);
+      throw std::runtime_error("could not load " + path);
+    }
+  }
+  close(fd);
+}
+
+// The memory holding all of [paddr, paddr + len), and paddr's offset in it
+mem_t* sim_t::image_mem(reg_t paddr, reg_t len, reg_t* offset)
+{
+  if (len == 0 || paddr + len < paddr || !paddr_ok(paddr + len - 1))
+    return nullptr;
+  auto desc = bus.find_device(paddr);
+  auto mem = dynamic_cast<mem_t*>(desc.second);
+  if (!mem || paddr - desc.first + len > mem->size())
+    return nullptr;
+  *offset = paddr - desc.first;
+  return mem;
+}
+
+void sim_t::load_image(reg_t paddr, const std::string& path)
+{
+  int fd = open(path.c_str(), O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) < 0)
+    throw std::runtime_error("could not open image " + path);
+  reg_t offset;
+  mem_t* mem = image_mem(paddr, st.st_size, &offset);
+  bool loaded = mem && mem->load_file(offset, st.st_size, fd, 0);
+  close(fd);
+  if (!loaded) {
+    char where[32];
+    snprintf(where, sizeof(where), "0x%" PRIx64, paddr);
+    throw std::runtime_error("image " + path + " does not fit in one memory region at " + where);
+  }
+}
+
+void sim_t::dump_image(reg_t paddr, reg_t len, const char* path)
+{
+  reg_t offset;
+  mem_t* mem = image_mem(paddr, len, &offset);
+  if (!mem) {
+    char range[64];
+    snprintf(range, sizeof(range), "0x%" PRIx64 "+0x%" PRIx64, paddr, len);
+    throw std::runtime_error(std::string(range) + " is not within one memory region");
+  }
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if (fd < 0)
+    throw std::runtime_error(std::string("could not create image ") + path);
+  bool saved = ftruncate(fd, len) == 0 && mem->save_file(offset, len, fd, 0);
+  if (close(fd) != 0 || !saved)
+    throw std::runtime_error(std::string("could not write image ") + path);
+}
+
+void sim_t::load_payload(const std::string& payload, reg_t* entry, elf_symtab_t* symtab)
+{
+  shared_segments.clear();
+  if (share_images)
+    share_elf_image(payload);
+  htif_t::load_payload(payload, entry, symtab);
+}
+
+bool sim_t::is_address_preloaded(addr_t taddr, size_t len)
+{
+  return std::find(shared_segments.begin(), shared_segments.end(),
+                   std::make_pair(reg_t(taddr), len)) != shared_segments.end();
+}
+
+// Extends the run page by page for as long as the host pages are adjacent,
+// which for flat memory is the whole remainder of the region.
+char* sim_t::direct_ptr(addr_t taddr, size_t len, size_t* run)
+{
+  char* base = addr_to_mem(taddr);
+  if (!base)
+    return NULL;
+  size_t n = std::min(len, size_t(PGSIZE - taddr % PGSIZE));
+  while (n < len && addr_to_mem(taddr + n) == base + n)
+    n += std::min(size_t(len - n), size_t(PGSIZE));
+  *run = n;
+  // The host may write through it.
+  if (reverse_interval)
+    journal_store(taddr, n);
+  return base;
+}
+
 void sim_t::set_target_endianness(memif_endianness_t endianness)
 {
 #ifdef RISCV_ENABLE_DUAL_ENDIAN
@@ -432,4 +1732,18 @@ memif_endianness_t sim_t::get_target_endianness() const
 void sim_t::proc_reset(unsigned id)
 {
   debug_module.proc_reset(id);
+  // The reset rebuilt the hart's time CSR.
+  if (clint)
+    for (auto proc : procs)
+      if (proc->get_id() == id)
+        clint->timer_changed(proc);
+}
+
+void sim_t::timer_changed(processor_t* proc)
+{
+  std::unique_lock<std::mutex> lock(mmio_lock, std::defer_lock);
+  if (parallel || get_async_syscalls())
+    lock.lock();
+  if (clint)
+    clint->timer_changed(proc);
 }
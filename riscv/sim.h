@@ -14,19 +14,34 @@
 #include "cfg.h"
 #include "debug_module.h"
 #include "devices.h"
+#include "distributed.h"
+#include "kvm_ff.h"
+#include "insn_log.h"
 #include "log_file.h"
+#include "pc_sampler.h"
+#include "page_heat.h"
+#include "plugin.h"
+#include "progress.h"
 #include "processor.h"
 #include "simif.h"
 
 #include <fesvr/htif.h>
 #include <fesvr/context.h>
 #include <vector>
+#include <deque>
 #include <string>
+#include <functional>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
 #include <sys/types.h>
 
 class mmu_t;
 class remote_bitbang_t;
+class gdb_server_t;
 
 // this class encapsulates the processors and memory in a RISC-V machine.
 class sim_t : public htif_t, public simif_t
@@ -47,33 +62,210 @@ public:
 
   // run the simulation to completion
   int run();
+
+  // To embed the simulator without run(), which switches host contexts
+  // and polls until the program exits: call start() once to load the
+  // program, then run the harts with step_hart(), the devices and the
+  // timer with advance_time(), and poll() for the program's requests to
+  // the host until it returns false.  Harts can be inspected through
+  // get_core(i)->get_state() and memory through memif() in between.
+  void start() override;
+  // Runs hart i for up to n instructions, unless it is waiting for an
+  // interrupt, and returns how many it retired.
+  uint64_t step_hart(size_t i, size_t n);
+  // Moves the devices and the CLINT on by insns instructions' worth of
+  // time, and skips ahead to the next timer when all harts are idle.
+  void advance_time(size_t insns);
+  // The next load of len bytes at the MMIO address addr returns value
+  // instead of reading the device, as a cosimulated design's own device
+  // answered it.  Values queued for the same load are returned in order.
+  void override_mmio_load(reg_t addr, size_t len, uint64_t value);
   void set_debug(bool value);
-  void set_histogram(bool value);
+  void set_histogram(bool value, bool by_symbol = false);
+  // Count the dynamic instruction mix of every hart and write it to path
+  // as CSV at exit, and also whenever the process receives SIGUSR1.
+  void set_insn_mix(const char* path);
+  void set_bbv_interval(uint64_t interval);
+  void set_call_stacks(bool value);
+  // Write each hart's vector unit utilization to path as CSV at exit.
+  void set_vector_stats(const char* path);
+  // Write every hart's AMOs, LRs and SCs per cache line to path as CSV at
+  // exit (see atomic_profile_t).
+  void set_atomic_profile(const char* path);
+  // Write every hart's traps per cause and privilege, and the instructions
+  // and host time their handlers took, to path as CSV at exit (see
+  // trap_profile_t).
+  void set_trap_profile(const char* path);
+  // Write every hart's PC, and up to depth of its callers, to path every
+  // period instructions (see pc_sampler_t).
+  void set_pc_sampling(const char* path, uint64_t period, size_t depth);
+  // Report progress every interval seconds to path ("-" for stderr) and,
+  // unless port is 0, serve metrics on it (see progress_reporter_t).
+  void set_progress(const char* path, uint16_t port, double interval);
+  // Write how often each physical page was touched in each epoch of hart
+  // 0's instructions to path (see page_heat_t).
+  void set_page_heat(const char* path, uint64_t epoch, uint64_t flush_period, bool exact);
+  // At the end of each page heat epoch, advise the host kernel to read in
+  // the pages touched in it and to reclaim those touched in the previous
+  // one but not since first, for memory mapped from a file larger than the
+  // host's (see mem_t::share).  Keeps a page heat map of its own, writing
+  // nothing, if set_page_heat was not called first.
+  void set_memory_advice(uint64_t epoch, uint64_t flush_period);
+  // Attach plugin to every hart, and own it (see plugin_t).
+  void add_plugin(plugin_t* plugin);
+  void set_block_cache(bool value, bool inline_ops, bool fuse_ops = false);
+  void configure_icache(size_t sets, size_t ways, bool stats);
+  void configure_tlb(size_t entries, size_t stlb_sets, size_t stlb_ways, bool stats);
+  void configure_walk_cache(size_t entries);
+
+  // Save the whole machine to path once hart 0 has retired instret
+  // instructions, or start from a previously saved machine instead of the
+  // freshly loaded program.
+  // Only trace (SIFT and commit log) code running in the privilege modes
+  // in priv_mask and, if ranges is non-empty, inside one of its
+  // comma-separated "lo:hi" ranges or symbols.  Symbols are resolved
+  // once the program has been loaded.
+  void set_trace_filter(reg_t priv_mask, const char* ranges,
+                        const std::vector<reg_t>& asids = {});
+
+  // Run the program as a static RV64 Linux executable in U-mode on hart 0,
+  // without pk: the simulator sets up its stack and services its system
+  // calls on the host.  The memory region holding its entry point must
+  // also hold its stack and heap.
+  void set_user_mode(bool value) { user_mode = value; }
+  // Run the program's memcpy, memset, strlen and memcmp natively whenever
+  // no hart is being traced (see mmu_t::set_libc_intercept).
+  void set_libc_intercepts(bool value) { libc_intercepts = value; }
+  // Map the program's loadable segments into memory copy-on-write from
+  // the ELF file instead of copying them, so processes running the same
+  // program share its pages (see mem_t::load_file).
+  void set_share_images(bool value) { share_images = value; }
+  // Load the raw image in path at paddr once the program is loaded, mapping
+  // its whole pages copy-on-write (see mem_t::load_file).  The range must
+  // lie within one memory region.
+  void add_load_image(reg_t paddr, const char* path) { load_images.push_back({paddr, path}); }
+  // Write len bytes of memory from paddr to path as a raw image.
+  void dump_image(reg_t paddr, reg_t len, const char* path);
+  bool emulate_syscall(processor_t* proc);
+  void set_checkpoint_save(const char* path, uint64_t instret);
+  void set_checkpoint_restore(const char* path);
+  // Save the machine state to path when hart 0 is about to execute a
+  // boot-done or ROI start marker (see mmu_t::set_marker_stop).  The file
+  // appears atomically, so concurrent runs can share a cache of them.
+  void set_checkpoint_at_marker(const char* path);
+  void save_checkpoint(const char* path);
+  void restore_checkpoint(const char* path);
+  // Start from the QEMU checkpoint in dir, described in qemu_ckpt.h.
+  void set_qemu_checkpoint(const char* dir) { qemu_checkpoint_path = dir; }
+  void import_qemu_checkpoint(const std::string& dir);
+  // Load the PT_LOAD segments of an ELF core file, such as QEMU's
+  // dump-guest-memory writes, at their physical addresses, skipping any
+  // that lie outside memory.
+  void load_memory_dump(const std::string& path);
+  // End the run as if the program had exited with 0 once hart 0 has
+  // retired max_instret instructions, or roi_instret after any hart's ROI
+  // start marker (0 for no limit), or right after any hart retires the ROI
+  // end marker, if at_roi_end, or one of the markers addi x0, x0, <id> for
+  // the magic_ids.
+  void set_stop_policy(uint64_t max_instret, uint64_t roi_instret, bool at_roi_end,
+                       const std::vector<uint32_t>& magic_ids);
+  // Count and model only inside ROIs, from any hart's ROI start marker to
+  // the next ROI end marker: the harts run with their statistics paused
+  // (see processor_t::set_stats_paused) outside them.  on_roi(k, true) is
+  // called at the start of the k-th ROI, and on_roi(k, false) at its end,
+  // with the harts paused again, to report and reset the models the caller
+  // owns; -g and --insn-mix report each ROI themselves.
+  void set_stats_roi(std::function<void(size_t, bool)> on_roi);
+  // Reverse execution for the interactive debugger: every interval steps,
+  // snapshot the harts and the CLINT, and from then on the old contents of
+  // each page the first time it is stored to, keeping the last
+  // max_snapshots snapshots.  reverse-step and reverse-continue restore the
+  // nearest one and re-execute the same step() calls from it.
+  void set_reverse(uint64_t interval, size_t max_snapshots);
+  void journal_store(reg_t paddr, size_t len);
+  // Each sample is a (start, length) pair in hart 0 instructions.  This
+  // process runs untraced, and as hart 0 reaches the start of a sample
+  // forks a child that inherits the warm machine, traces the next length
+  // instructions to the SIFT prefix <prefix>_s<k>, k the sample's index,
+  // and exits; its stdout goes to <prefix>_s<k>.out.  The child calls
+  // on_fork(k) first.  At most jobs children run at once.
+  void set_samples(const std::vector<std::pair<uint64_t, uint64_t>>& samples,
+                   size_t jobs, std::function<void(size_t)> on_fork);
+  // Switch harts every value instructions; each round of switches also
+  // advances the CLINT by value / INSNS_PER_RTC_TICK ticks.
+  void set_interleave(size_t value);
+  // Run every hart on its own host thread; the harts meet at a barrier
+  // after each quantum, where time advances and the host is polled.
+  // Requires flat memory.
+  void set_parallel(bool value);
+  // Pin each --parallel hart's thread to a CPU of its own, taken in turn
+  // from those this process may run on.
+  void set_pin_harts(bool value);
+  // Run only d's share of the harts, as one rank of several processes, and
+  // meet the other ranks after every round of quanta.  Requires memory
+  // that d has shared.
+  void set_distributed(distributed_t* d);
+  // Run hart 0 natively under k for about insns instructions once it has
+  // first left M-mode.  With resume, a stop policy that ends the run hands
+  // the hart back to k instead, so the program finishes natively (see
+  // kvm_ff_t).
+  void set_kvm_fast_forward(kvm_ff_t* k, uint64_t insns, bool resume);
+#ifdef RISCV_ENABLE_SIFT
+  void set_sift_async(bool value);
+  void set_sift_roi_only(bool value);
+  void set_sift_code_pages(bool value);
+  void set_sift_compression(bool value);
+  void set_sift_va2pa(bool value);
+  void set_sift_fifo(bool value);
+  void set_sift_segment(uint64_t length);
+  void set_sift_warmup(size_t lines);
+  void set_sift_period(uint64_t skip, uint64_t warm, uint64_t detail);
+  void set_sift_syscalls(bool value);
+  // See processor_t::set_sift_uop_width.
+  void set_sift_uop_width(reg_t bits);
+  // Run the harts in quanta of interval instructions and, after each
+  // quantum, wait for Sniper to catch up with that hart's trace.
+  void set_sift_sync(size_t interval);
+#endif
 
   // Configure logging
   //
   // If enable_log is true, an instruction trace will be generated. If
   // enable_commitlog is true, so will the commit results (if this
   // build was configured without support for commit logging, the
-  // function will print an error message and abort).
-  void configure_log(bool enable_log, bool enable_commitlog);
+  // function will print an error message and abort). If binary_commitlog
+  // is also true, the commit results are written in the binary format of
+  // commit_log.h, and with compact_commitlog, vector registers are logged
+  // as just the bytes each instruction wrote.
+  void configure_log(bool enable_log, bool enable_commitlog, bool binary_commitlog = false,
+                     bool compact_commitlog = false);
 
   void set_procs_debug(bool value);
   void set_remote_bitbang(remote_bitbang_t* remote_bitbang) {
     this->remote_bitbang = remote_bitbang;
   }
+  // Run the harts under the GDB stub, which stops them until a debugger
+  // connects.
+  void set_gdb_server(gdb_server_t* gdb_server) { this->gdb_server = gdb_server; }
   const char* get_dts() { if (dts.empty()) reset(); return dts.c_str(); }
   processor_t* get_core(size_t i) { return procs.at(i); }
   unsigned nprocs() const { return procs.size(); }
+  // Name the code at addr as "symbol+0xoffset", or "" if no symbol is at
+  // or below it.
+  std::string describe_addr(reg_t addr);
 
   // Callback for processors to let the simulation know they were reset.
   void proc_reset(unsigned id);
+  void timer_changed(processor_t* proc);
 
 private:
   isa_parser_t isa;
   const cfg_t * const cfg;
   std::vector<std::pair<reg_t, mem_t*>> mems;
   std::vector<std::pair<reg_t, abstract_device_t*>> plugin_devices;
+  std::vector<std::pair<reg_t, ns16550_t*>> uarts;
+  std::vector<std::pair<reg_t, virtio_mmio_t*>> virtio_devices;
+  std::vector<abstract_device_t*> ticked_devices;  // ticked every quantum
   mmu_t* debug_mmu;  // debug port into main memory
   std::vector<processor_t*> procs;
   std::pair<reg_t, reg_t> initrd_range;
@@ -83,8 +275,10 @@ private:
   bool dtb_enabled;
   std::unique_ptr<rom_device_t> boot_rom;
   std::unique_ptr<clint_t> clint;
+  std::unique_ptr<plic_t> plic;
   bus_t bus;
   log_file_t log_file;
+  std::unique_ptr<insn_log_t> insn_log; // -l output formatted off the harts' threads
 
   FILE *cmd_file; // pointer to debug command input file
 
@@ -100,15 +294,141 @@ private:
 
   processor_t* get_core(const std::string& i);
   void step(size_t n); // step through simulation
+  void step_parallel(); // run one quantum on every hart at once
+  bool all_harts_idle();
+  void parallel_worker(size_t id);
+  bool parallel;
+  std::vector<std::thread> workers;
+  std::vector<int> hart_cpus;  // empty unless harts are pinned
+  void pin_hart_thread(size_t id);
+  std::mutex round_lock;
+  std::condition_variable round_start;
+  std::condition_variable round_done;
+  uint64_t round;
+  size_t harts_running;
+  bool workers_exit;
+  distributed_t* distributed;
+  void sync_ranks();
+  kvm_ff_t* kvm_ff;
+  uint64_t kvm_ff_insns;  // 0 once hart 0 has been fast-forwarded
+  bool kvm_ff_resume;
+  // Runs hart 0 under kvm_ff; ends the run once the guest shuts down.
+  bool kvm_run_hart0(uint64_t insns);
+  std::mutex mmio_lock;  // with --parallel or asynchronous syscalls
+  std::mutex debug_mmu_lock;  // with asynchronous syscalls
+  std::map<std::pair<reg_t, size_t>, std::deque<uint64_t>> mmio_overrides;
+  std::unique_ptr<std::atomic<uint32_t>[]> reservation_owners;  // see mmu_t
   static const size_t INTERLEAVE = 5000;
   static const size_t INSNS_PER_RTC_TICK = 100; // 10 MHz clock for 1 BIPS core
   static const size_t CPU_HZ = 1000000000; // 1GHz CPU
+  size_t interleave;
+  size_t rtc_insns; // instructions not yet converted to RTC ticks
+  bool sift_sync;
   size_t current_step;
   size_t current_proc;
+  static const size_t HOST_POLL_QUANTA = 64;
+  bool htif_watch; // stores to tohost/fromhost are flagged by the MMUs
+  size_t host_poll_quanta;
+  void yield_to_host();
+  bool user_mode;
+  reg_t user_brk_start;
+  reg_t user_brk;
+  reg_t user_brk_top;      // highest break so far; memory above is unused
+  reg_t user_mmap_bottom;  // mmap allocates downwards from below the stack
+  static const reg_t USER_STACK_SIZE = 8 << 20;
+  bool libc_intercepts;
+  bool share_images;
+  std::vector<std::pair<reg_t, size_t>> shared_segments;  // (paddr, filesz)
+  void share_elf_image(const std::string& path);
+  std::vector<std::pair<reg_t, std::string>> load_images;  // (paddr, path)
+  void load_image(reg_t paddr, const std::string& path);
+  mem_t* image_mem(reg_t paddr, reg_t len, reg_t* offset);
+  void start_user_program();
+  reg_t user_set_brk(reg_t addr);
+  reg_t user_mmap(reg_t addr, reg_t len, reg_t flags, reg_t fd, reg_t off);
+  void user_clear(reg_t addr, reg_t len);
+  std::string checkpoint_save_path;
+  uint64_t checkpoint_save_instret;
+  std::string checkpoint_restore_path;
+  std::string qemu_checkpoint_path;
+  std::string checkpoint_marker_path;
+  void save_marker_checkpoint();
+  uint64_t stop_instret;  // on hart 0; 0 for none
+  uint64_t stop_roi_instret;
+  std::vector<insn_bits_t> stop_markers;
+  bool stop_reached();
+  void watch_stop_markers();
+  std::function<void(size_t, bool)> stats_roi_hook;
+  bool in_stats_roi = false;
+  size_t stats_rois = 0;  // ended so far
+  void stats_roi_marker(bool start);
+  struct reverse_snapshot_t {
+    uint64_t position;  // in steps_taken
+    std::vector<char> state;  // the harts and the CLINT, as in a checkpoint
+    size_t current_step;
+    size_t current_proc;
+    size_t rtc_insns;
+    std::vector<bool> in_wfi;
+    // The contents at the snapshot of the pages stored to since
+    std::map<reg_t, std::unique_ptr<char[]>> pages;
+  };
+  uint64_t steps_taken;  // the sum of step()'s n so far
+  uint64_t reverse_interval;
+  size_t reverse_max_snapshots;
+  std::deque<reverse_snapshot_t> reverse_snapshots;
+  // The n of each step() call since the first snapshot, run-length
+  // encoded as (n, count), and the position the first call started at
+  std::deque<std::pair<size_t, uint64_t>> reverse_calls;
+  uint64_t reverse_calls_start;
+  bool reverse_replaying;
+  void take_reverse_snapshot();
+  void restore_reverse_snapshot(size_t k);
+  void reverse_replay(uint64_t target, const std::function<void()>& after_call = nullptr);
+  bool reverse_to(uint64_t target);
+  size_t reverse_snapshot_before(uint64_t position);
+  struct sample_t {
+    uint64_t start;
+    uint64_t length;
+    size_t index;
+  };
+  std::vector<sample_t> samples;  // by start
+  size_t next_sample;
+  size_t sample_jobs;
+  std::map<pid_t, size_t> sample_children;  // running children -> sample
+  uint64_t sample_end;  // in a sample's child, where it exits; else 0
+  std::function<void(size_t)> sample_fork_hook;
+  std::string sift_prefix;
+  bool sift_periodic;
+  std::string sample_sift_prefix;
+  uint64_t next_sample_stop();
+  bool sample_stop_reached(uint64_t instret);
+  void fork_sample(const sample_t& sample);
+  void wait_for_samples(size_t max_running);
+  reg_t trace_priv_mask;
+  std::string trace_ranges;
+  std::vector<reg_t> trace_asids;
+  void apply_trace_filter();
   bool debug;
   bool histogram_enabled; // provide a histogram of PCs
+  std::string insn_mix_path;
+  void write_insn_mix(const std::string& path);
+  std::string vector_stats_path;
+  void write_vector_stats();
+  std::string atomic_profile_path;
+  std::vector<std::unique_ptr<atomic_profile_t>> atomic_profiles;  // per hart
+  void write_atomic_profile();
+  std::string trap_profile_path;
+  void write_trap_profile();
+  std::unique_ptr<pc_sampler_t> pc_sampler;
+  std::unique_ptr<progress_reporter_t> progress;
+  std::unique_ptr<page_heat_t> page_heat;
+  std::vector<reg_t> advised_pages;  // touched in the last epoch, sorted
+  void advise_memory(const page_heat_t::counts_t& counts);
+  std::vector<std::unique_ptr<plugin_t>> plugins;
   bool log;
+  bool commit_log;
   remote_bitbang_t* remote_bitbang;
+  gdb_server_t* gdb_server;
 
   // memory-mapped I/O routines
   char* addr_to_mem(reg_t addr);
@@ -118,6 +438,7 @@ private:
   void set_rom();
 
   const char* get_symbol(uint64_t addr);
+  const char* get_enclosing_symbol(uint64_t addr, uint64_t* start, uint64_t* end = nullptr);
 
   // presents a prompt for introspection into the simulation
   void interactive();
@@ -140,6 +461,18 @@ private:
   void interactive_until(const std::string& cmd, const std::vector<std::string>& args, bool noisy);
   void interactive_until_silent(const std::string& cmd, const std::vector<std::string>& args);
   void interactive_until_noisy(const std::string& cmd, const std::vector<std::string>& args);
+  void interactive_reverse_step(const std::string& cmd, const std::vector<std::string>& args);
+  void interactive_reverse_continue(const std::string& cmd, const std::vector<std::string>& args);
+  // The condition of until, while and reverse-continue:
+  // <reg|pc|mem> <args...> <val>
+  struct until_cond_t {
+    reg_t (sim_t::*func)(const std::vector<std::string>&);
+    std::vector<std::string> args;
+    reg_t val;
+    int max_xlen;
+  };
+  until_cond_t parse_until(const std::vector<std::string>& args);
+  bool until_holds(const until_cond_t& cond);
   reg_t get_reg(const std::vector<std::string>& args);
   freg_t get_freg(const std::vector<std::string>& args, int size);
   reg_t get_mem(const std::vector<std::string>& args);
@@ -148,6 +481,7 @@ private:
   friend class processor_t;
   friend class mmu_t;
   friend class debug_module_t;
+  friend class gdb_server_t;
 
   // htif
   friend void sim_thread_main(void*);
@@ -159,6 +493,10 @@ private:
   void idle();
   void read_chunk(addr_t taddr, size_t len, void* dst);
   void write_chunk(addr_t taddr, size_t len, const void* src);
+  void clear_chunk(addr_t taddr, size_t len);
+  void load_payload(const std::string& payload, reg_t* entry, elf_symtab_t* symtab) override;
+  bool is_address_preloaded(addr_t taddr, size_t len) override;
+  char* direct_ptr(addr_t taddr, size_t len, size_t* run);
   size_t chunk_align() { return 8; }
   size_t chunk_max_size() { return 8; }
   void set_target_endianness(memif_endianness_t endianness);
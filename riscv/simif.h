@@ -5,6 +5,8 @@
 
 #include "decode.h"
 
+class processor_t;
+
 // this is the interface to the simulator used by the processors and memory
 class simif_t
 {
@@ -16,8 +18,20 @@ public:
   virtual bool mmio_store(reg_t addr, size_t len, const uint8_t* bytes) = 0;
   // Callback for processors to let the simulation know they were reset.
   virtual void proc_reset(unsigned id) = 0;
+  // Callback for processors to let the simulation know that a register
+  // deciding when their timer interrupts fire has been written.
+  virtual void timer_changed(processor_t* proc) {}
+  // Services the user ecall proc just executed instead of trapping, when
+  // the simulator runs user programs without a kernel.  Returns whether it
+  // did, having written the result to a0.
+  virtual bool emulate_syscall(processor_t* proc) { return false; }
+  // The target is about to store len bytes at paddr, while the MMU
+  // journals stores (see mmu_t::journal_stores).
+  virtual void journal_store(reg_t paddr, size_t len) {}
 
   virtual const char* get_symbol(uint64_t addr) = 0;
+  // The symbol whose range [*start, *end) holds addr, if any.
+  virtual const char* get_enclosing_symbol(uint64_t addr, uint64_t* start, uint64_t* end) { return nullptr; }
 
 };
 
@@ -0,0 +1,94 @@
+// See LICENSE for license details.
+
+#include "stride_profile.h"
+#include <algorithm>
+#include <cinttypes>
+
+stride_profile_t::stride_profile_t()
+  : table(1024), used(0)
+{
+}
+
+stride_profile_t::entry_t* stride_profile_t::lookup(uint64_t pc)
+{
+  size_t mask = table.size() - 1;
+  for (size_t i = (pc * 0x9e3779b97f4a7c15ULL) >> 32 & mask; ; i = (i + 1) & mask) {
+    entry_t* e = &table[i];
+    if (e->accesses == 0 || e->pc == pc)
+      return e;
+  }
+}
+
+// Kept at most half full, so probes stay short.
+void stride_profile_t::grow()
+{
+  std::vector<entry_t> old(table.size() * 2);
+  old.swap(table);
+  for (auto& e : old)
+    if (e.accesses)
+      *lookup(e.pc) = e;
+}
+
+void stride_profile_t::access(uint64_t pc, uint64_t addr, uint32_t bytes, bool store)
+{
+  entry_t* e = lookup(pc);
+  if (e->accesses == 0) {
+    if (++used * 2 > table.size()) {
+      grow();
+      e = lookup(pc);
+    }
+    *e = entry_t();
+    e->pc = pc;
+    e->last_addr = addr;
+    std::fill(e->set, e->set + SET_WAYS, addr);
+  } else {
+    int64_t stride = addr - e->last_addr;
+    e->stride_hits += stride == e->stride;
+    e->stride = stride;
+    e->last_addr = addr;
+
+    if (std::find(e->set, e->set + SET_WAYS, addr) != e->set + SET_WAYS) {
+      e->set_hits++;
+    } else {
+      e->set[e->set_next] = addr;
+      e->set_next = (e->set_next + 1) % SET_WAYS;
+    }
+  }
+  e->accesses++;
+  e->bytes = std::max(e->bytes, bytes);
+  e->loads |= !store;
+  e->stores |= store;
+}
+
+void stride_profile_t::write_report(FILE* f, uint32_t hart,
+                                    const std::function<std::string(uint64_t)>& symbolize)
+{
+  std::vector<const entry_t*> pcs;
+  for (auto& e : table)
+    if (e.accesses)
+      pcs.push_back(&e);
+  std::sort(pcs.begin(), pcs.end(), [](const entry_t* a, const entry_t* b) {
+    return a->accesses != b->accesses ? a->accesses > b->accesses : a->pc < b->pc;
+  });
+
+  for (auto e : pcs) {
+    // The first access has no stride, and the first SET_WAYS distinct
+    // addresses miss the set.
+    uint64_t repeats = e->accesses - 1;
+    double strided = repeats ? double(e->stride_hits) / repeats : 0;
+    double small_set = repeats ? double(e->set_hits) / repeats : 0;
+    const char* pattern = repeats == 0 ? "single" :
+                          strided >= MOSTLY ? "strided" :
+                          small_set >= MOSTLY ? "small-set" : "irregular";
+    const char* kind = e->loads && e->stores ? "amo" : e->stores ? "store" : "load";
+    fprintf(f, "%" PRIu32 ",0x%" PRIx64 ",%s,%s,%" PRIu64 ",%" PRIu32 ",%s,%" PRId64 ",%.4f,%.4f\n",
+            hart, e->pc, symbolize(e->pc).c_str(), kind, e->accesses, e->bytes, pattern,
+            e->stride, strided, small_set);
+  }
+}
+
+void stride_profile_t::reset_stats()
+{
+  std::fill(table.begin(), table.end(), entry_t());
+  used = 0;
+}
@@ -0,0 +1,81 @@
+// See LICENSE for license details.
+
+#ifndef _RISCV_STRIDE_PROFILE_H
+#define _RISCV_STRIDE_PROFILE_H
+
+#include "memtracer.h"
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Classifies the data accesses of each load and store pc of one hart by
+// the pattern of their virtual addresses, to find the loops worth
+// vectorizing or prefetching.  Each pc keeps its last address and stride
+// and its last few distinct addresses, in an open-addressed table of
+// fixed-size entries, so an access costs a probe and a few compares.  A pc
+// is
+//
+//   strided    when most of its accesses repeat the previous stride (0 for
+//              an address that does not change)
+//   small-set  when most of the rest hit one of its last SET_WAYS addresses
+//   irregular  otherwise
+//
+// and single if it made only one access.
+class stride_profile_t : public memtracer_t
+{
+ public:
+  stride_profile_t();
+
+  bool interested_in_range(uint64_t begin, uint64_t end, access_type type)
+  {
+    return type == LOAD || type == STORE;
+  }
+  // Without a pc the access cannot be attributed.
+  void trace(uint64_t addr, size_t bytes, access_type type) {}
+  void trace_batch(const access_record_t* recs, size_t n)
+  {
+    for (size_t i = 0; i < n; i++)
+      if (recs[i].type == LOAD || recs[i].type == STORE)
+        access(recs[i].pc, recs[i].vaddr, recs[i].bytes, recs[i].type == STORE);
+  }
+  void clean_invalidate(uint64_t addr, size_t bytes, bool clean, bool inval) {}
+
+  // Writes a line per pc, the most accessed first, of
+  // hart,pc,symbol,kind,accesses,bytes,pattern,stride,strided,small_set
+  // as CSV; strided and small_set are the fractions of the accesses that
+  // repeated the stride or hit the small set.
+  void write_report(FILE* f, uint32_t hart,
+                    const std::function<std::string(uint64_t)>& symbolize);
+  void reset_stats();
+
+ private:
+  static const size_t SET_WAYS = 4;
+  // A pc that repeats its stride or hits its small set this often is
+  // classified by it.
+  static constexpr double MOSTLY = 0.75;
+
+  struct entry_t {
+    uint64_t pc;
+    uint64_t last_addr;
+    int64_t stride;
+    uint64_t set[SET_WAYS];  // the most recent distinct addresses
+    uint64_t accesses;  // 0 for a free entry
+    uint64_t stride_hits;
+    uint64_t set_hits;
+    uint32_t bytes;  // of the widest access
+    uint8_t set_next;  // round-robin victim
+    uint8_t loads;  // whether any access was a load, or a store
+    uint8_t stores;
+  };
+
+  void access(uint64_t pc, uint64_t addr, uint32_t bytes, bool store);
+  entry_t* lookup(uint64_t pc);
+  void grow();
+
+  std::vector<entry_t> table;  // a power of two long
+  size_t used;
+};
+
+#endif
@@ -0,0 +1,124 @@
+// See LICENSE for license details.
+
+#include "tlbsim.h"
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+
+tlb_sim_t::level_t::level_t(const char* config, const std::string& name)
+  : accesses(0), misses(0), clock(0), name(name)
+{
+  char* end;
+  sets = strtoul(config, &end, 10);
+  ways = *end == ':' ? strtoul(end + 1, &end, 10) : 0;
+  if (*end || sets == 0 || (sets & (sets - 1)) || ways == 0) {
+    std::cerr << "TLB configurations must be of the form sets:ways, where sets" << std::endl;
+    std::cerr << "is a power of two and ways is positive." << std::endl;
+    exit(1);
+  }
+  entries.assign(sets * ways, entry_t{0, 0, 0, 0});
+}
+
+bool tlb_sim_t::level_t::access(uint64_t vpn, uint64_t ppn, uint8_t page_shift)
+{
+  accesses++;
+  clock++;
+  entry_t* set = &entries[(vpn & (sets - 1)) * ways];
+  entry_t* victim = set;
+  for (size_t i = 0; i < ways; i++) {
+    entry_t& e = set[i];
+    if (e.page_shift == page_shift && e.vpn == vpn && e.ppn == ppn) {
+      e.last_use = clock;
+      return true;
+    }
+    if (e.last_use < victim->last_use)
+      victim = &e;
+  }
+
+  misses++;
+  *victim = entry_t{vpn, ppn, page_shift, clock};
+  return false;
+}
+
+void tlb_sim_t::level_t::print_stats(uint64_t insns)
+{
+  if (accesses == 0)
+    return;
+
+  std::cout << name << " ";
+  std::cout << "Accesses:              " << accesses << std::endl;
+  std::cout << name << " ";
+  std::cout << "Misses:                " << misses << std::endl;
+  std::cout << name << " ";
+  std::cout << "Miss Rate:             " << 100.0 * misses / accesses << '%' << std::endl;
+  if (insns != 0) {
+    std::cout << name << " ";
+    std::cout << "MPKI:                  " << 1000.0 * misses / insns << std::endl;
+  }
+}
+
+tlb_sim_t::tlb_sim_t(const char* itlb_config, const char* dtlb_config,
+                     const char* l2tlb_config, const std::string& name)
+  : name(name), walks(0), walk_refs(0)
+{
+  if (itlb_config)
+    itlb.reset(new level_t(itlb_config, name + " ITLB"));
+  if (dtlb_config)
+    dtlb.reset(new level_t(dtlb_config, name + " DTLB"));
+  if (l2tlb_config)
+    l2tlb.reset(new level_t(l2tlb_config, name + " L2TLB"));
+}
+
+void tlb_sim_t::trace_batch(const access_record_t* recs, size_t n)
+{
+  for (size_t i = 0; i < n; i++) {
+    const access_record_t& r = recs[i];
+    if (r.page_shift == 0)
+      continue;
+
+    uint64_t vpn = r.vaddr >> r.page_shift;
+    uint64_t ppn = r.addr >> r.page_shift;
+    level_t* l1 = r.type == FETCH ? itlb.get() : dtlb.get();
+    if (l1 && l1->access(vpn, ppn, r.page_shift))
+      continue;
+    if (l2tlb && l2tlb->access(vpn, ppn, r.page_shift))
+      continue;
+    if (!l1 && !l2tlb)
+      continue;
+    walks++;
+    walk_refs += r.walk_refs;
+  }
+}
+
+void tlb_sim_t::print_stats(uint64_t insns)
+{
+  std::cout << std::setprecision(3) << std::fixed;
+  if (itlb)
+    itlb->print_stats(insns);
+  if (dtlb)
+    dtlb->print_stats(insns);
+  if (l2tlb)
+    l2tlb->print_stats(insns);
+  if (walks == 0)
+    return;
+
+  std::cout << name << " ";
+  std::cout << "Walks:                 " << walks << std::endl;
+  std::cout << name << " ";
+  std::cout << "Walk References:       " << walk_refs << std::endl;
+  std::cout << name << " ";
+  std::cout << "Mean Walk References:  " << double(walk_refs) / walks << std::endl;
+  if (insns != 0) {
+    std::cout << name << " ";
+    std::cout << "Walks Per Kinsn:       " << 1000.0 * walks / insns << std::endl;
+  }
+}
+
+void tlb_sim_t::reset_stats()
+{
+  for (level_t* l : {itlb.get(), dtlb.get(), l2tlb.get()})
+    if (l)
+      l->accesses = l->misses = 0;
+  walks = walk_refs = 0;
+}
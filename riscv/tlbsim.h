@@ -0,0 +1,76 @@
+// See LICENSE for license details.
+
+#ifndef _RISCV_TLB_SIM_H
+#define _RISCV_TLB_SIM_H
+
+#include "memtracer.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+// A model of one hart's TLBs, unrelated to the MMU's own: first-level I
+// and D TLBs, each optional, in front of an optional unified second-level
+// TLB, all set-associative with LRU replacement.  It sees the hart's traced
+// accesses with their virtual addresses, so untranslated ones (bare mode,
+// M-mode) are left out.  Entries are indexed and tagged by the virtual page
+// number at the size of the page, so one entry covers a whole huge page.
+// They are also tagged with the physical page rather than an ASID, so one
+// context's entries never serve another's different mappings.  A
+// translation that misses every level costs a walk of as many page-table
+// references as the MMU reports it needs without caches, including G-stage
+// references under the hypervisor extension.
+class tlb_sim_t : public memtracer_t
+{
+ public:
+  // Each configuration is <sets>:<ways>, or null for no such TLB.
+  tlb_sim_t(const char* itlb, const char* dtlb, const char* l2tlb, const std::string& name);
+
+  bool interested_in_range(uint64_t begin, uint64_t end, access_type type)
+  {
+    return (type == FETCH ? itlb : dtlb) || l2tlb;
+  }
+  // Without a virtual address an access says nothing about the TLBs.
+  void trace(uint64_t addr, size_t bytes, access_type type) {}
+  void clean_invalidate(uint64_t addr, size_t bytes, bool clean, bool inval) {}
+  void trace_batch(const access_record_t* recs, size_t n);
+
+  // MPKI is per thousand of the insns the hart retired while the accesses
+  // were traced.
+  void print_stats(uint64_t insns);
+  void reset_stats();
+
+ private:
+  class level_t
+  {
+   public:
+    level_t(const char* config, const std::string& name);
+    // True on a hit; a miss fills the entry.
+    bool access(uint64_t vpn, uint64_t ppn, uint8_t page_shift);
+    void print_stats(uint64_t insns);
+
+    uint64_t accesses;
+    uint64_t misses;
+
+   private:
+    struct entry_t {
+      uint64_t vpn;
+      uint64_t ppn;
+      uint8_t page_shift;  // 0 if invalid
+      uint64_t last_use;
+    };
+    size_t sets;
+    size_t ways;
+    std::vector<entry_t> entries;
+    uint64_t clock;
+    std::string name;
+  };
+
+  std::unique_ptr<level_t> itlb;
+  std::unique_ptr<level_t> dtlb;
+  std::unique_ptr<level_t> l2tlb;
+  std::string name;
+  uint64_t walks;
+  uint64_t walk_refs;
+};
+
+#endif
@@ -0,0 +1,77 @@
+// See LICENSE for license details.
+
+#include "trap_profile.h"
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+
+static uint64_t host_ns()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void trap_profile_t::trap_taken(reg_t cause, const char* name, level_t level)
+{
+  counts_t& c = counts[{cause, level}];
+  if (c.traps++ == 0)
+    c.name = name;
+  events.push_back({true, level, &c, host_ns()});
+}
+
+void trap_profile_t::last_raised()
+{
+  if (!events.empty() && events.back().taken)
+    events.back().counts->raised++;
+}
+
+void trap_profile_t::trap_returned(level_t level)
+{
+  events.push_back({false, level, nullptr, host_ns()});
+}
+
+void trap_profile_t::settle_events(uint64_t instret)
+{
+  for (auto& e : events) {
+    if (e.taken) {
+      if (open.size() == MAX_NESTING)
+        open.erase(open.begin());
+      open.push_back({e.level, e.counts, instret, e.host_ns});
+      continue;
+    }
+
+    // Returning from level also leaves the traps nested in its handler.
+    auto it = std::find_if(open.rbegin(), open.rend(),
+                           [&](const frame_t& f) { return f.level == e.level; });
+    if (it == open.rend())
+      continue;
+    counts_t* c = it->counts;
+    c->returns++;
+    c->insns += instret - it->instret;
+    c->host_ns += e.host_ns - it->host_ns;
+    open.erase(std::prev(it.base()), open.end());
+  }
+  events.clear();
+}
+
+void trap_profile_t::write(FILE* f, uint32_t hart)
+{
+  static const char* const level_names[NUM_LEVELS] = {"M", "HS", "VS"};
+
+  std::vector<std::pair<key_t, const counts_t*>> rows;
+  for (auto& [key, c] : counts)
+    rows.push_back({key, &c});
+  std::stable_sort(rows.begin(), rows.end(), [](const std::pair<key_t, const counts_t*>& a,
+                                                const std::pair<key_t, const counts_t*>& b) {
+    return a.second->insns > b.second->insns;
+  });
+
+  for (auto& [key, c] : rows) {
+    double insns_per_return = c->returns ? double(c->insns) / c->returns : 0;
+    double ns_per_return = c->returns ? double(c->host_ns) / c->returns : 0;
+    fprintf(f, "%" PRIu32 ",0x%" PRIx64 ",%s,%s,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64
+               ",%.1f,%" PRIu64 ",%.1f\n",
+            hart, key.first, c->name.c_str(), level_names[key.second], c->traps, c->raised,
+            c->returns, c->insns, insns_per_return, c->host_ns, ns_per_return);
+  }
+}
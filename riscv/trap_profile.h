@@ -0,0 +1,80 @@
+// See LICENSE for license details.
+#ifndef _RISCV_TRAP_PROFILE_H
+#define _RISCV_TRAP_PROFILE_H
+
+#include "decode.h"
+#include <cstdio>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Counts one hart's traps per cause and per privilege they are handled in,
+// and what handling them costs: the instructions retired and the host
+// time from taking each trap to the mret or sret that returns from it.
+// The cost of a trap includes that of the traps nested in its handler, as
+// the M-mode emulation of a misaligned access inside a page fault handler.
+// A trap whose handler never returns, or returns from under a nested trap
+// that did not, is counted but costs nothing.
+//
+// Taking a trap and returning from one both end processor_t::step's run
+// of instructions, so the instructions are counted from minstret once the
+// run has added its own (see settle).
+class trap_profile_t
+{
+public:
+  enum level_t { M, HS, VS, NUM_LEVELS };
+
+  // The hart took a trap with this cause, named name, to level.
+  void trap_taken(reg_t cause, const char* name, level_t level);
+  // The last trap taken was raised without throwing (see raise_trap_cause).
+  void last_raised();
+  // The hart is running an mret, or an sret in HS or VS.
+  void trap_returned(level_t level);
+  // instret is the hart's minstret, with no run of instructions in
+  // progress: the traps and returns since the last call happened there.
+  void settle(uint64_t instret)
+  {
+    if (__builtin_expect(!events.empty(), 0))
+      settle_events(instret);
+  }
+  // Writes a CSV row per cause and level seen, the costliest first, as
+  // hart,cause,name,level,traps,raised,returns,insns,insns_per_return,
+  // host_ns,host_ns_per_return.
+  void write(FILE* f, uint32_t hart);
+
+private:
+  // Open traps further down than this are forgotten.
+  static const size_t MAX_NESTING = 16;
+
+  struct counts_t {
+    std::string name;
+    uint64_t traps = 0;
+    uint64_t raised = 0;  // of traps, those raised without throwing
+    uint64_t returns = 0;
+    uint64_t insns = 0;  // from trap to return, of the traps returned from
+    uint64_t host_ns = 0;
+  };
+  typedef std::pair<reg_t, level_t> key_t;
+
+  struct event_t {
+    bool taken;  // or returned
+    level_t level;
+    counts_t* counts;  // of the trap taken
+    uint64_t host_ns;
+  };
+  struct frame_t {
+    level_t level;
+    counts_t* counts;
+    uint64_t instret;
+    uint64_t host_ns;
+  };
+
+  void settle_events(uint64_t instret);
+
+  std::map<key_t, counts_t> counts;
+  std::vector<event_t> events;  // not yet settled
+  std::vector<frame_t> open;  // traps not yet returned from, innermost last
+};
+
+#endif
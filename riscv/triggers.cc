@@ -1,4 +1,5 @@
 #include "debug_defines.h"
+#include "mmu.h"
 #include "processor.h"
 #include "triggers.h"
 
@@ -81,13 +82,20 @@ bool mcontrol_t::tdata2_write(processor_t * const proc, const reg_t val) noexcep
   return true;
 }
 
+// The bits a NAPOT match compares: those above the lowest clear bit of
+// tdata2, and none if every bit is set.
+static reg_t napot_mask(reg_t tdata2) {
+  int bits = cto(tdata2) + 1;
+  return bits >= 64 ? 0 : ~((reg_t(1) << bits) - 1);
+}
+
 bool mcontrol_t::simple_match(unsigned xlen, reg_t value) const {
   switch (match) {
     case triggers::mcontrol_t::MATCH_EQUAL:
       return value == tdata2;
     case triggers::mcontrol_t::MATCH_NAPOT:
       {
-        reg_t mask = ~((1 << (cto(tdata2)+1)) - 1);
+        reg_t mask = napot_mask(tdata2);
         return (value & mask) == (tdata2 & mask);
       }
     case triggers::mcontrol_t::MATCH_GE:
@@ -108,6 +116,35 @@ bool mcontrol_t::simple_match(unsigned xlen, reg_t value) const {
   assert(0);
 }
 
+bool mcontrol_t::may_match_page(unsigned xlen, reg_t page) const {
+  // Data-value triggers can fire on any address.
+  if (select)
+    return true;
+
+  if (xlen == 32)
+    page &= 0xffffffff;
+  reg_t page_mask = ~reg_t(PGSIZE - 1);
+
+  switch (match) {
+    case triggers::mcontrol_t::MATCH_EQUAL:
+      return (tdata2 & page_mask) == page;
+    case triggers::mcontrol_t::MATCH_NAPOT:
+      {
+        // Mask bits within the page are satisfied by some address in it.
+        reg_t mask = napot_mask(tdata2) & page_mask;
+        return (page & mask) == (tdata2 & mask);
+      }
+    case triggers::mcontrol_t::MATCH_GE:
+      return page + (PGSIZE - 1) >= tdata2;
+    case triggers::mcontrol_t::MATCH_LT:
+      return page < tdata2;
+    case triggers::mcontrol_t::MATCH_MASK_LOW:
+    case triggers::mcontrol_t::MATCH_MASK_HIGH:
+      return true;
+  }
+  return true;
+}
+
 match_result_t mcontrol_t::memory_access_match(processor_t * const proc, operation_t operation, reg_t address, reg_t data) {
   state_t * const state = proc->get_state();
   if ((operation == triggers::OPERATION_EXECUTE && !execute_bit) ||
@@ -188,6 +225,18 @@ match_result_t module_t::memory_access_match(action_t * const action, operation_
   return MATCH_NONE;
 }
 
+bool module_t::may_match_page(operation_t operation, reg_t page) const
+{
+  for (auto trigger : triggers) {
+    bool armed = (operation == OPERATION_EXECUTE && trigger->execute()) ||
+                 (operation == OPERATION_STORE && trigger->store()) ||
+                 (operation == OPERATION_LOAD && trigger->load());
+    if (armed && trigger->may_match_page(proc->get_xlen(), page))
+      return true;
+  }
+  return false;
+}
+
 reg_t module_t::tdata1_read(const processor_t * const proc, unsigned index) const noexcept
 {
   return triggers[index]->tdata1_read(proc);
@@ -55,6 +55,10 @@ public:
   virtual bool store() const { return false; }
   virtual bool load() const { return false; }
 
+  // Conservatively report whether any address in the page starting at page
+  // could match, so the MMU can leave unaffected pages on the fast path.
+  virtual bool may_match_page(unsigned xlen, reg_t page) const { return true; }
+
 public:
   bool dmode;
   action_t action;
@@ -93,6 +97,8 @@ public:
   virtual match_result_t memory_access_match(processor_t * const proc,
       operation_t operation, reg_t address, reg_t data) override;
 
+  virtual bool may_match_page(unsigned xlen, reg_t page) const override;
+
 private:
   bool simple_match(unsigned xlen, reg_t value) const;
 
@@ -120,6 +126,9 @@ public:
   match_result_t memory_access_match(action_t * const action,
       operation_t operation, reg_t address, reg_t data);
 
+  // True if a trigger armed for operation might fire somewhere in the page.
+  bool may_match_page(operation_t operation, reg_t page) const;
+
   reg_t tdata1_read(const processor_t * const proc, unsigned index) const noexcept;
   bool tdata1_write(processor_t * const proc, unsigned index, const reg_t val) noexcept;
   reg_t tdata2_read(const processor_t * const proc, unsigned index) const noexcept;
@@ -0,0 +1,195 @@
+// See LICENSE for license details.
+
+#include "sim.h"
+#include "processor.h"
+#include "elf.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+
+#define AT_NULL 0
+#define AT_PHDR 3
+#define AT_PHENT 4
+#define AT_PHNUM 5
+#define AT_PAGESZ 6
+#define AT_ENTRY 9
+#define AT_UID 11
+#define AT_EUID 12
+#define AT_GID 13
+#define AT_EGID 14
+#define AT_CLKTCK 17
+#define AT_RANDOM 25
+
+#define USER_MAP_FIXED 0x10
+#define USER_MAP_ANONYMOUS 0x20
+
+static reg_t page_round_up(reg_t addr)
+{
+  return (addr + PGSIZE - 1) & ~reg_t(PGSIZE - 1);
+}
+
+// Lays out the initial stack as Linux does for a static executable, with
+// the heap after its last segment and mappings below the stack.
+void sim_t::start_user_program()
+{
+  const std::string& path = target_args()[0];
+  FILE* file = fopen(path.c_str(), "rb");
+  if (!file)
+    throw std::runtime_error("could not open " + path);
+  Elf64_Ehdr eh;
+  bool ok = fread(&eh, sizeof(eh), 1, file) == 1 && IS_ELF64(eh);
+  std::vector<Elf64_Phdr> ph(ok ? eh.e_phnum : 0);
+  ok = ok && fseek(file, eh.e_phoff, SEEK_SET) == 0 &&
+       fread(ph.data(), sizeof(Elf64_Phdr), ph.size(), file) == ph.size();
+  fclose(file);
+  if (!ok)
+    throw std::runtime_error("--user requires an RV64 ELF executable: " + path);
+
+  reg_t phdr = 0, end = 0;
+  for (auto& p : ph) {
+    if (p.p_type != PT_LOAD)
+      continue;
+    end = std::max<reg_t>(end, p.p_vaddr + p.p_memsz);
+    if (eh.e_phoff >= p.p_offset && eh.e_phoff < p.p_offset + p.p_filesz)
+      phdr = p.p_vaddr + eh.e_phoff - p.p_offset;
+  }
+
+  reg_t entry = get_entry_point(), top = 0;
+  for (auto& m : mems) {
+    if (entry >= m.first && entry < m.first + m.second->size())
+      top = m.first + m.second->size();
+  }
+  user_brk_start = user_brk = user_brk_top = page_round_up(end);
+  user_mmap_bottom = top - USER_STACK_SIZE;
+  if (top == 0 || user_brk > user_mmap_bottom)
+    throw std::runtime_error("--user needs a memory region holding the program, "
+                             "its heap and an 8 MiB stack");
+
+  // Strings and AT_RANDOM's bytes at the top, then argc, argv, an empty
+  // environment and the auxiliary vector.
+  reg_t sp = top;
+  std::vector<reg_t> argv;
+  for (auto& arg : target_args()) {
+    sp -= arg.size() + 1;
+    memif().write(sp, arg.size() + 1, arg.c_str());
+    argv.push_back(sp);
+  }
+  std::random_device random;
+  uint8_t random_bytes[16];
+  for (auto& byte : random_bytes)
+    byte = random();
+  sp -= sizeof(random_bytes);
+  memif().write(sp, sizeof(random_bytes), random_bytes);
+  reg_t at_random = sp;
+
+  std::vector<reg_t> words;
+  words.push_back(argv.size());
+  words.insert(words.end(), argv.begin(), argv.end());
+  words.push_back(0);  // argv[argc]
+  words.push_back(0);  // envp[0]
+  const reg_t auxv[][2] = {
+    {AT_PHDR, phdr}, {AT_PHENT, sizeof(Elf64_Phdr)}, {AT_PHNUM, ph.size()},
+    {AT_PAGESZ, PGSIZE}, {AT_ENTRY, entry},
+    {AT_UID, reg_t(getuid())}, {AT_EUID, reg_t(geteuid())},
+    {AT_GID, reg_t(getgid())}, {AT_EGID, reg_t(getegid())},
+    {AT_CLKTCK, 100}, {AT_RANDOM, at_random}, {AT_NULL, 0}
+  };
+  for (auto& aux : auxv)
+    words.insert(words.end(), aux, aux + 2);
+
+  std::vector<target_endian<uint64_t>> target_words;
+  for (reg_t word : words)
+    target_words.push_back(to_target<uint64_t>(word));
+  sp = (sp - target_words.size() * sizeof(uint64_t)) & ~reg_t(15);
+  memif().write(sp, target_words.size() * sizeof(uint64_t), target_words.data());
+
+  processor_t* proc = procs[0];
+  state_t* state = proc->get_state();
+  state->XPR.write(2, sp);
+  state->XPR.write(10, 0);  // no dynamic linker's exit hook
+  state->pc = entry;
+  // FP and vector instructions work from the start, and U-mode can read
+  // the counters.
+  reg_t mstatus = proc->get_csr(CSR_MSTATUS);
+  mstatus = set_field(mstatus, MSTATUS_FS, 1);
+  if (proc->extension_enabled('V'))
+    mstatus = set_field(mstatus, MSTATUS_VS, 1);
+  proc->put_csr(CSR_MSTATUS, mstatus);
+  proc->put_csr(CSR_MCOUNTEREN, -1);
+  if (proc->extension_enabled('S'))
+    proc->put_csr(CSR_SCOUNTEREN, -1);
+  proc->set_privilege(PRV_U);
+}
+
+void sim_t::user_clear(reg_t addr, reg_t len)
+{
+  static const uint8_t zeros[PGSIZE] = {};
+  for (reg_t pos = 0; pos < len; pos += PGSIZE)
+    memif().write(addr + pos, std::min<reg_t>(PGSIZE, len - pos), zeros);
+}
+
+reg_t sim_t::user_set_brk(reg_t addr)
+{
+  if (addr < user_brk_start || addr > user_mmap_bottom)
+    return user_brk;
+  // Memory the break has covered before may hold stale data.
+  if (addr > user_brk)
+    user_clear(user_brk, std::min(addr, user_brk_top) - std::min(user_brk, user_brk_top));
+  user_brk = addr;
+  user_brk_top = std::max(user_brk_top, addr);
+  return user_brk;
+}
+
+// Mappings are never reused, so fresh ones are already zero; memory is
+// plain physical memory, so protections are not enforced.
+reg_t sim_t::user_mmap(reg_t addr, reg_t len, reg_t flags, reg_t fd, reg_t off)
+{
+  len = page_round_up(len);
+  if (len == 0)
+    return -EINVAL;
+  if (flags & USER_MAP_FIXED) {
+    // Unlike a fresh mapping, a fixed one may cover memory in use.
+    user_clear(addr, len);
+  } else {
+    if (user_mmap_bottom - user_brk < len)
+      return -ENOMEM;
+    addr = user_mmap_bottom -= len;
+  }
+  if (!(flags & USER_MAP_ANONYMOUS)) {
+    const reg_t pread_args[6] = {fd, addr, len, off, 0, 0};
+    reg_t ret = proxy_syscall(67, pread_args);
+    if (sreg_t(ret) < 0)
+      return ret;
+  }
+  return addr;
+}
+
+bool sim_t::emulate_syscall(processor_t* proc)
+{
+  if (!user_mode)
+    return false;
+
+  state_t* state = proc->get_state();
+  reg_t n = state->XPR[17], a[6];
+  for (int i = 0; i < 6; i++)
+    a[i] = state->XPR[10 + i];
+
+  reg_t ret;
+  switch (n) {
+    case 214: ret = user_set_brk(a[0]); break;
+    case 215: ret = 0; break;  // munmap
+    case 216: ret = -ENOMEM; break;  // mremap, so callers copy instead
+    case 222: ret = user_mmap(a[0], a[1], a[3], a[4], a[5]); break;
+    default: ret = proxy_syscall(n, a); break;
+  }
+  state->XPR.write(10, ret);
+
+  // exit, exit_group, kill and tgkill end the program.
+  if ((n == 93 || n == 94 || n == 129 || n == 131) && host)
+    host->switch_to();
+  return true;
+}
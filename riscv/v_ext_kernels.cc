@@ -0,0 +1,468 @@
+// See LICENSE for license details.
+
+#include "v_ext_kernels.h"
+#include "host_fpu.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// -O2 only vectorizes loops that need no scalar epilogue, which these do.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC optimize("vect-cost-model=dynamic")
+#endif
+
+#if defined(__x86_64__) && defined(__GLIBC__) && defined(__GNUC__) && !defined(__clang__)
+#define VK_TARGETS __attribute__((target_clones("arch=x86-64-v4", "arch=x86-64-v3", "default")))
+#else
+#define VK_TARGETS
+#endif
+
+// The kernels are written as plain loops for the compiler to vectorize.
+// ivdep is safe because an element only ever reads the same index it
+// writes, and the operation is resolved once, outside the loop.
+#define VK_LOOP(EXPR) \
+  _Pragma("GCC ivdep") \
+  for (reg_t i = 0; i < n; i++) { \
+    T a = vs2[i]; \
+    T b = vk_operand(src, i); \
+    vd[i] = EXPR; \
+  } \
+  break
+
+template<class T> static inline T vk_operand(const T* vs1, reg_t i) { return vs1[i]; }
+template<class T> static inline T vk_operand(T rs1, reg_t) { return rs1; }
+
+template<class T, class S>
+static inline __attribute__((always_inline))
+void vk_run(vk_op_t op, T* vd, const T* vs2, S src, reg_t n)
+{
+  // Wrapping arithmetic is done unsigned; only min and max see the sign.
+  typedef typename std::make_unsigned<T>::type U;
+  const unsigned shift_mask = sizeof(T) * 8 - 1;
+
+  switch (op) {
+    case VK_ADD:  VK_LOOP(U(a) + U(b));
+    case VK_SUB:  VK_LOOP(U(a) - U(b));
+    case VK_RSUB: VK_LOOP(U(b) - U(a));
+    case VK_AND:  VK_LOOP(a & b);
+    case VK_OR:   VK_LOOP(a | b);
+    case VK_XOR:  VK_LOOP(a ^ b);
+    case VK_MUL:  VK_LOOP(U(a) * U(b));
+    case VK_SLL:  VK_LOOP(U(a) << (b & shift_mask));
+    case VK_SRL:  VK_LOOP(U(a) >> (b & shift_mask));
+    case VK_MIN:  VK_LOOP(b <= a ? b : a);
+    case VK_MAX:  VK_LOOP(b >= a ? b : a);
+  }
+}
+
+#define VK_DEFINE(T) \
+  VK_TARGETS void vk_vv(vk_op_t op, T* vd, const T* vs2, const T* vs1, reg_t n) \
+  { \
+    vk_run(op, vd, vs2, vs1, n); \
+  } \
+  VK_TARGETS void vk_vx(vk_op_t op, T* vd, const T* vs2, T rs1, reg_t n) \
+  { \
+    vk_run(op, vd, vs2, rs1, n); \
+  }
+
+VK_DEFINE(uint8_t)
+VK_DEFINE(uint16_t)
+VK_DEFINE(uint32_t)
+VK_DEFINE(uint64_t)
+VK_DEFINE(int8_t)
+VK_DEFINE(int16_t)
+VK_DEFINE(int32_t)
+VK_DEFINE(int64_t)
+
+// The accumulator is carried in a local, which the vectorizer splits into
+// one partial result per lane and combines after the loop.
+#define VKR_LOOP(EXPR) \
+  for (reg_t i = 0; i < n; i++) { \
+    T a = vs2[i]; \
+    acc = EXPR; \
+  } \
+  break
+
+template<class T>
+static inline __attribute__((always_inline))
+T vkr_run(vk_red_op_t op, const T* vs2, T init, reg_t n)
+{
+  typedef typename std::make_unsigned<T>::type U;
+  T acc = init;
+
+  switch (op) {
+    case VKR_SUM: VKR_LOOP(U(acc) + U(a));
+    case VKR_AND: VKR_LOOP(acc & a);
+    case VKR_OR:  VKR_LOOP(acc | a);
+    case VKR_XOR: VKR_LOOP(acc ^ a);
+    case VKR_MIN: VKR_LOOP(a <= acc ? a : acc);
+    case VKR_MAX: VKR_LOOP(a >= acc ? a : acc);
+  }
+  return acc;
+}
+
+#define VKR_DEFINE(T) \
+  VK_TARGETS T vk_red(vk_red_op_t op, const T* vs2, T init, reg_t n) \
+  { \
+    return vkr_run(op, vs2, init, n); \
+  }
+
+VKR_DEFINE(uint8_t)
+VKR_DEFINE(uint16_t)
+VKR_DEFINE(uint32_t)
+VKR_DEFINE(uint64_t)
+VKR_DEFINE(int8_t)
+VKR_DEFINE(int16_t)
+VKR_DEFINE(int32_t)
+VKR_DEFINE(int64_t)
+
+#define VKW_DEFINE(N, W) \
+  VK_TARGETS W vk_wred(const N* vs2, W init, reg_t n) \
+  { \
+    typedef std::make_unsigned<W>::type U; \
+    U acc = init; \
+    for (reg_t i = 0; i < n; i++) \
+      acc += U(W(vs2[i])); \
+    return acc; \
+  }
+
+VKW_DEFINE(int8_t, int16_t)
+VKW_DEFINE(int16_t, int32_t)
+VKW_DEFINE(int32_t, int64_t)
+VKW_DEFINE(uint8_t, uint16_t)
+VKW_DEFINE(uint16_t, uint32_t)
+VKW_DEFINE(uint32_t, uint64_t)
+
+// With the field count a constant, the vectorizer sees an interleaved
+// group of accesses and turns it into host shuffles.
+template<class T, unsigned NF>
+static inline __attribute__((always_inline))
+void vks_load(T* const* fields, const T* src, reg_t n)
+{
+  T* out[NF];
+  for (unsigned f = 0; f < NF; f++)
+    out[f] = fields[f];
+  _Pragma("GCC ivdep")
+  for (reg_t i = 0; i < n; i++)
+    for (unsigned f = 0; f < NF; f++)
+      out[f][i] = src[i * NF + f];
+}
+
+template<class T, unsigned NF>
+static inline __attribute__((always_inline))
+void vks_store(T* dst, T* const* fields, reg_t n)
+{
+  const T* in[NF];
+  for (unsigned f = 0; f < NF; f++)
+    in[f] = fields[f];
+  _Pragma("GCC ivdep")
+  for (reg_t i = 0; i < n; i++)
+    for (unsigned f = 0; f < NF; f++)
+      dst[i * NF + f] = in[f][i];
+}
+
+#define VKS_CASES(FN, T, ...) \
+  switch (nf) { \
+    case 2: FN<T, 2>(__VA_ARGS__); break; \
+    case 3: FN<T, 3>(__VA_ARGS__); break; \
+    case 4: FN<T, 4>(__VA_ARGS__); break; \
+    case 5: FN<T, 5>(__VA_ARGS__); break; \
+    case 6: FN<T, 6>(__VA_ARGS__); break; \
+    case 7: FN<T, 7>(__VA_ARGS__); break; \
+    case 8: FN<T, 8>(__VA_ARGS__); break; \
+  }
+
+#define VKS_DEFINE(T) \
+  VK_TARGETS void vk_seg_load(T* const* fields, const T* src, reg_t nf, reg_t n) \
+  { \
+    VKS_CASES(vks_load, T, fields, src, n) \
+  } \
+  VK_TARGETS void vk_seg_store(T* dst, T* const* fields, reg_t nf, reg_t n) \
+  { \
+    VKS_CASES(vks_store, T, dst, fields, n) \
+  }
+
+VKS_DEFINE(uint8_t)
+VKS_DEFINE(uint16_t)
+VKS_DEFINE(uint32_t)
+VKS_DEFINE(uint64_t)
+
+// An out-of-range index still loads vs2[0], so that the loop is a plain
+// gather with a select for the vectorizer.
+template<class T, class I>
+static inline __attribute__((always_inline))
+void vkp_gather(T* vd, const T* vs2, const I* idx, reg_t vlmax, reg_t n)
+{
+  for (reg_t i = 0; i < n; i++) {
+    reg_t j = idx[i];
+    T val = vs2[j < vlmax ? j : 0];
+    vd[i] = j < vlmax ? val : 0;
+  }
+}
+
+#define VKG_DEFINE(T, I) \
+  VK_TARGETS void vk_gather(T* vd, const T* vs2, const I* idx, reg_t vlmax, reg_t n) \
+  { \
+    vkp_gather(vd, vs2, idx, vlmax, n); \
+  }
+
+VKG_DEFINE(uint8_t, uint8_t)
+VKG_DEFINE(uint16_t, uint16_t)
+VKG_DEFINE(uint32_t, uint32_t)
+VKG_DEFINE(uint64_t, uint64_t)
+VKG_DEFINE(uint8_t, uint16_t)
+VKG_DEFINE(uint32_t, uint16_t)
+VKG_DEFINE(uint64_t, uint16_t)
+
+// A mask word with every bit set is copied as a run.
+template<class T>
+static void vkp_compress(T* vd, const T* vs2, const uint64_t* mask, reg_t vl)
+{
+  reg_t pos = 0;
+  for (reg_t base = 0; base < vl; base += 64) {
+    uint64_t bits = mask[base / 64];
+    if (vl - base < 64)
+      bits &= (UINT64_C(1) << (vl - base)) - 1;
+    if (bits == UINT64_MAX) {
+      memcpy(vd + pos, vs2 + base, 64 * sizeof(T));
+      pos += 64;
+      continue;
+    }
+    for (; bits != 0; bits &= bits - 1)
+      vd[pos++] = vs2[base + __builtin_ctzll(bits)];
+  }
+}
+
+#define VKC_DEFINE(T) \
+  void vk_compress(T* vd, const T* vs2, const uint64_t* mask, reg_t vl) \
+  { \
+    vkp_compress(vd, vs2, mask, vl); \
+  }
+
+VKC_DEFINE(uint8_t)
+VKC_DEFINE(uint16_t)
+VKC_DEFINE(uint32_t)
+VKC_DEFINE(uint64_t)
+
+// Floating-point kernels go through softfloat, or the host FPU where
+// host_fpu.h allows, so there is nothing here for the vectorizer; the win
+// is in skipping the per-element register access and fflags update.
+static inline float32_t vkf_add(float32_t a, float32_t b) { return fast_f32_add(a, b); }
+static inline float64_t vkf_add(float64_t a, float64_t b) { return fast_f64_add(a, b); }
+static inline float32_t vkf_sub(float32_t a, float32_t b) { return fast_f32_sub(a, b); }
+static inline float64_t vkf_sub(float64_t a, float64_t b) { return fast_f64_sub(a, b); }
+static inline float32_t vkf_mul(float32_t a, float32_t b) { return fast_f32_mul(a, b); }
+static inline float64_t vkf_mul(float64_t a, float64_t b) { return fast_f64_mul(a, b); }
+static inline float32_t vkf_div(float32_t a, float32_t b) { return fast_f32_div(a, b); }
+static inline float64_t vkf_div(float64_t a, float64_t b) { return fast_f64_div(a, b); }
+static inline float32_t vkf_sqrt(float32_t a) { return fast_f32_sqrt(a); }
+static inline float64_t vkf_sqrt(float64_t a) { return fast_f64_sqrt(a); }
+static inline float32_t vkf_min(float32_t a, float32_t b) { return f32_min(a, b); }
+static inline float64_t vkf_min(float64_t a, float64_t b) { return f64_min(a, b); }
+static inline float32_t vkf_max(float32_t a, float32_t b) { return f32_max(a, b); }
+static inline float64_t vkf_max(float64_t a, float64_t b) { return f64_max(a, b); }
+static inline float32_t vkf_mulAdd(float32_t a, float32_t b, float32_t c) { return fast_f32_mulAdd(a, b, c); }
+static inline float64_t vkf_mulAdd(float64_t a, float64_t b, float64_t c) { return fast_f64_mulAdd(a, b, c); }
+
+#define VKF_LOOP(EXPR) \
+  for (reg_t i = 0; i < n; i++) { \
+    T a = vs2[i]; \
+    T b = vk_operand(src, i); \
+    vd[i] = EXPR; \
+  } \
+  break
+
+template<class T, class S>
+static inline __attribute__((always_inline))
+void vkf_run(vk_fp_op_t op, T* vd, const T* vs2, S src, reg_t n)
+{
+  switch (op) {
+    case VKF_ADD:  VKF_LOOP(vkf_add(a, b));
+    case VKF_SUB:  VKF_LOOP(vkf_sub(a, b));
+    case VKF_RSUB: VKF_LOOP(vkf_sub(b, a));
+    case VKF_MUL:  VKF_LOOP(vkf_mul(a, b));
+    case VKF_DIV:  VKF_LOOP(vkf_div(a, b));
+    case VKF_RDIV: VKF_LOOP(vkf_div(b, a));
+    case VKF_MACC: VKF_LOOP(vkf_mulAdd(b, a, vd[i]));
+    case VKF_MADD: VKF_LOOP(vkf_mulAdd(vd[i], b, a));
+    case VKF_SQRT:
+      for (reg_t i = 0; i < n; i++)
+        vd[i] = vkf_sqrt(vs2[i]);
+      break;
+  }
+}
+
+// Workers that each run one chunk of the current job, with the caller's
+// rounding mode, and wait for the next.  Between jobs they spin for a while
+// before sleeping, since a vector loop issues one large instruction after
+// another.
+class vk_pool_t
+{
+ public:
+  vk_pool_t(unsigned threads) : chunks(threads)
+  {
+    for (unsigned i = 1; i < threads; i++)
+      workers.emplace_back(&vk_pool_t::work, this, i);
+  }
+
+  ~vk_pool_t()
+  {
+    {
+      std::lock_guard<std::mutex> guard(wake_lock);
+      stopping = true;
+      generation++;
+    }
+    wake.notify_all();
+    for (auto& t : workers)
+      t.join();
+  }
+
+  // Runs job(chunk) for each chunk in [0, chunks), or returns false at
+  // once if another thread's job is running.
+  bool run(const std::function<void(unsigned)>& fn)
+  {
+    std::unique_lock<std::mutex> busy(job_lock, std::try_to_lock);
+    if (!busy.owns_lock())
+      return false;
+
+    job = &fn;
+    rounding_mode = softfloat_roundingMode;
+    flags.store(0, std::memory_order_relaxed);
+    pending.store(chunks - 1, std::memory_order_relaxed);
+    {
+      std::lock_guard<std::mutex> guard(wake_lock);
+      generation.fetch_add(1, std::memory_order_release);
+    }
+    if (sleepers.load(std::memory_order_relaxed))
+      wake.notify_all();
+
+    fn(0);
+    while (pending.load(std::memory_order_acquire))
+      std::this_thread::yield();
+    softfloat_exceptionFlags |= flags.load(std::memory_order_relaxed);
+    return true;
+  }
+
+  const unsigned chunks;
+
+ private:
+  void work(unsigned chunk)
+  {
+    uint64_t seen = 0;
+    while (true) {
+      for (unsigned spin = 0; generation.load(std::memory_order_acquire) == seen && spin < 2000; spin++)
+        std::this_thread::yield();
+      if (generation.load(std::memory_order_acquire) == seen) {
+        std::unique_lock<std::mutex> guard(wake_lock);
+        sleepers++;
+        wake.wait(guard, [&] { return generation.load(std::memory_order_relaxed) != seen; });
+        sleepers--;
+      }
+      seen = generation.load(std::memory_order_acquire);
+      if (stopping)
+        return;
+
+      softfloat_roundingMode = rounding_mode;
+      softfloat_exceptionFlags = 0;
+      (*job)(chunk);
+      flags.fetch_or(softfloat_exceptionFlags, std::memory_order_relaxed);
+      pending.fetch_sub(1, std::memory_order_release);
+    }
+  }
+
+  std::mutex job_lock;
+  const std::function<void(unsigned)>* job = nullptr;
+  uint_fast8_t rounding_mode = 0;
+  std::atomic<uint8_t> flags{0};
+  std::atomic<unsigned> pending{0};
+
+  std::mutex wake_lock;
+  std::condition_variable wake;
+  std::atomic<uint64_t> generation{0};
+  std::atomic<unsigned> sleepers{0};
+  std::atomic<bool> stopping{false};
+  std::vector<std::thread> workers;
+};
+
+static std::unique_ptr<vk_pool_t> vk_pool;
+static reg_t vk_split_min = 0;
+
+void vk_set_threads(unsigned threads, reg_t min_elts)
+{
+  vk_pool.reset(threads > 1 ? new vk_pool_t(threads) : nullptr);
+  vk_split_min = min_elts;
+}
+
+template<class T> static inline const T* vk_advance(const T* vs1, reg_t i) { return vs1 + i; }
+template<class T> static inline T vk_advance(T rs1, reg_t) { return rs1; }
+
+// Chunks start on 64-byte boundaries so that no two threads write the same
+// cache line of vd.
+template<class T, class S>
+static void vkf_run_split(vk_fp_op_t op, T* vd, const T* vs2, S src, reg_t n)
+{
+  if (vk_pool && n >= vk_split_min) {
+    const reg_t align = 64 / sizeof(T);
+    reg_t per_chunk = ((n + vk_pool->chunks - 1) / vk_pool->chunks + align - 1) & ~(align - 1);
+    std::function<void(unsigned)> fn = [&](unsigned chunk) {
+      reg_t lo = std::min(n, chunk * per_chunk), hi = std::min(n, lo + per_chunk);
+      if (lo < hi)
+        vkf_run(op, vd + lo, vs2 + lo, vk_advance(src, lo), hi - lo);
+    };
+    if (vk_pool->run(fn))
+      return;
+  }
+  vkf_run(op, vd, vs2, src, n);
+}
+
+#define VKF_DEFINE(T) \
+  void vk_fp_vv(vk_fp_op_t op, T* vd, const T* vs2, const T* vs1, reg_t n) \
+  { \
+    vkf_run_split(op, vd, vs2, vs1, n); \
+  } \
+  void vk_fp_vf(vk_fp_op_t op, T* vd, const T* vs2, T rs1, reg_t n) \
+  { \
+    vkf_run_split(op, vd, vs2, rs1, n); \
+  }
+
+VKF_DEFINE(float32_t)
+VKF_DEFINE(float64_t)
+
+template<class T>
+static inline __attribute__((always_inline))
+T vkfr_run(vk_fp_red_op_t op, const T* vs2, T init, reg_t n)
+{
+  T acc = init;
+
+  switch (op) {
+    case VKFR_SUM: VKR_LOOP(vkf_add(acc, a));
+    case VKFR_MIN: VKR_LOOP(vkf_min(acc, a));
+    case VKFR_MAX: VKR_LOOP(vkf_max(acc, a));
+  }
+  return acc;
+}
+
+float32_t vk_fp_red(vk_fp_red_op_t op, const float32_t* vs2, float32_t init, reg_t n)
+{
+  return vkfr_run(op, vs2, init, n);
+}
+
+float64_t vk_fp_red(vk_fp_red_op_t op, const float64_t* vs2, float64_t init, reg_t n)
+{
+  return vkfr_run(op, vs2, init, n);
+}
+
+float64_t vk_fp_wred(const float32_t* vs2, float64_t init, reg_t n)
+{
+  float64_t acc = init;
+  for (reg_t i = 0; i < n; i++)
+    acc = vkf_add(acc, f32_to_f64(vs2[i]));
+  return acc;
+}
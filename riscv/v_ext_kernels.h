@@ -0,0 +1,162 @@
+// See LICENSE for license details.
+#ifndef _RISCV_V_EXT_KERNELS_H
+#define _RISCV_V_EXT_KERNELS_H
+
+#include "decode.h"
+#include "softfloat_types.h"
+#include <cstdint>
+
+// Host kernels for unmasked, same-width integer vector operations.  Each
+// call computes vd[i] = op(vs2[i], b) for i in [0, n), where b is vs1[i] or
+// a scalar, over whole register groups laid out as in vectorUnit_t.  vd may
+// coincide exactly with a source but must not partially overlap one.
+//
+// On x86-64 each kernel is built for AVX-512, AVX2 and baseline SSE2, and
+// the dynamic loader binds the best one for the host at startup.
+enum vk_op_t {
+  VK_ADD,
+  VK_SUB,   // vs2 - b
+  VK_RSUB,  // b - vs2
+  VK_AND,
+  VK_OR,
+  VK_XOR,
+  VK_MUL,
+  VK_SLL,   // shift amounts are taken modulo the element width
+  VK_SRL,   // logical for unsigned element types
+  VK_MIN,   // signed or unsigned according to the element type
+  VK_MAX,
+};
+
+#define VK_DECLARE(T) \
+  void vk_vv(vk_op_t op, T* vd, const T* vs2, const T* vs1, reg_t n); \
+  void vk_vx(vk_op_t op, T* vd, const T* vs2, T rs1, reg_t n);
+
+VK_DECLARE(uint8_t)
+VK_DECLARE(uint16_t)
+VK_DECLARE(uint32_t)
+VK_DECLARE(uint64_t)
+VK_DECLARE(int8_t)
+VK_DECLARE(int16_t)
+VK_DECLARE(int32_t)
+VK_DECLARE(int64_t)
+
+#undef VK_DECLARE
+
+// Reductions of unmasked register groups: op folded over init and vs2[i]
+// for i in [0, n).  None of them depends on the order of the elements, so
+// the kernels combine them in host vector lanes.
+enum vk_red_op_t {
+  VKR_SUM,
+  VKR_AND,
+  VKR_OR,
+  VKR_XOR,
+  VKR_MIN,  // signed or unsigned according to the element type
+  VKR_MAX,
+};
+
+#define VKR_DECLARE(T) \
+  T vk_red(vk_red_op_t op, const T* vs2, T init, reg_t n);
+
+VKR_DECLARE(uint8_t)
+VKR_DECLARE(uint16_t)
+VKR_DECLARE(uint32_t)
+VKR_DECLARE(uint64_t)
+VKR_DECLARE(int8_t)
+VKR_DECLARE(int16_t)
+VKR_DECLARE(int32_t)
+VKR_DECLARE(int64_t)
+
+#undef VKR_DECLARE
+
+// Widening sums, each element sign- or zero-extended according to its type.
+int16_t vk_wred(const int8_t* vs2, int16_t init, reg_t n);
+int32_t vk_wred(const int16_t* vs2, int32_t init, reg_t n);
+int64_t vk_wred(const int32_t* vs2, int64_t init, reg_t n);
+uint16_t vk_wred(const uint8_t* vs2, uint16_t init, reg_t n);
+uint32_t vk_wred(const uint16_t* vs2, uint32_t init, reg_t n);
+uint64_t vk_wred(const uint32_t* vs2, uint64_t init, reg_t n);
+
+// Batched softfloat for unmasked vector floating-point operations:
+// vd[i] = op(vs2[i], b) for i in [0, n), with b as above.  Each element is
+// rounded per softfloat_roundingMode and its exceptions accumulate in
+// softfloat_exceptionFlags, exactly as a call per element would, so the
+// caller merges them into fflags once for the whole group.
+enum vk_fp_op_t {
+  VKF_ADD,
+  VKF_SUB,   // vs2 - b
+  VKF_RSUB,  // b - vs2
+  VKF_MUL,
+  VKF_DIV,   // vs2 / b
+  VKF_RDIV,  // b / vs2
+  VKF_MACC,  // b * vs2 + vd
+  VKF_MADD,  // vd * b + vs2
+  VKF_SQRT,  // sqrt(vs2); b is ignored
+};
+
+#define VKF_DECLARE(T) \
+  void vk_fp_vv(vk_fp_op_t op, T* vd, const T* vs2, const T* vs1, reg_t n); \
+  void vk_fp_vf(vk_fp_op_t op, T* vd, const T* vs2, T rs1, reg_t n);
+
+VKF_DECLARE(float32_t)
+VKF_DECLARE(float64_t)
+
+#undef VKF_DECLARE
+
+// Splits the batched floating-point operations of at least min_elts
+// elements into threads chunks, run by threads - 1 host worker threads and
+// the caller.  Each chunk's exceptions are ORed into the caller's
+// softfloat_exceptionFlags, so vd and fflags are those of one loop.  Only
+// one operation is split at a time; a --parallel hart that finds the
+// workers busy runs its own alone.  Not safe to call once harts run.
+void vk_set_threads(unsigned threads, reg_t min_elts);
+
+// Unit-stride segment accesses: vk_seg_load splits the n records of nf
+// fields at src into the arrays fields[0] to fields[nf - 1], and
+// vk_seg_store interleaves the fields back into records at dst.  nf is 2
+// to 8; the arrays must not overlap the records.
+#define VKS_DECLARE(T) \
+  void vk_seg_load(T* const* fields, const T* src, reg_t nf, reg_t n); \
+  void vk_seg_store(T* dst, T* const* fields, reg_t nf, reg_t n);
+
+VKS_DECLARE(uint8_t)
+VKS_DECLARE(uint16_t)
+VKS_DECLARE(uint32_t)
+VKS_DECLARE(uint64_t)
+
+#undef VKS_DECLARE
+
+// Permutations.  vk_gather sets vd[i] to vs2[idx[i]], or to 0 if idx[i] is
+// vlmax or more, for i in [0, n).  vk_compress packs the vs2[i] whose bit
+// is set in mask, for i in [0, vl), at the start of vd.  vd must not
+// overlap vs2.
+#define VKP_DECLARE(T) \
+  void vk_gather(T* vd, const T* vs2, const T* idx, reg_t vlmax, reg_t n); \
+  void vk_compress(T* vd, const T* vs2, const uint64_t* mask, reg_t vl);
+
+VKP_DECLARE(uint8_t)
+VKP_DECLARE(uint16_t)
+VKP_DECLARE(uint32_t)
+VKP_DECLARE(uint64_t)
+
+#undef VKP_DECLARE
+
+// vrgatherei16, whose indices are 16 bits whatever the element width
+void vk_gather(uint8_t* vd, const uint8_t* vs2, const uint16_t* idx, reg_t vlmax, reg_t n);
+void vk_gather(uint32_t* vd, const uint32_t* vs2, const uint16_t* idx, reg_t vlmax, reg_t n);
+void vk_gather(uint64_t* vd, const uint64_t* vs2, const uint16_t* idx, reg_t vlmax, reg_t n);
+
+// Floating-point reductions, folded in element order as the element loop
+// folds them, so that the ordered and unordered sums both give the same
+// result as before.  Exceptions accumulate as for the batched operations.
+enum vk_fp_red_op_t {
+  VKFR_SUM,
+  VKFR_MIN,
+  VKFR_MAX,
+};
+
+float32_t vk_fp_red(vk_fp_red_op_t op, const float32_t* vs2, float32_t init, reg_t n);
+float64_t vk_fp_red(vk_fp_red_op_t op, const float64_t* vs2, float64_t init, reg_t n);
+// The sum of init and every vs2[i] widened to double precision
+float64_t vk_fp_wred(const float32_t* vs2, float64_t init, reg_t n);
+
+#endif
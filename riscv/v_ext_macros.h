@@ -10,12 +10,15 @@
   const int midx = i / 64; \
   const int mpos = i % 64;
 
+// The rest of a mask word that is all zeros is skipped at once.
 #define VI_LOOP_ELEMENT_SKIP(BODY) \
   VI_MASK_VARS \
   if (insn.v_vm() == 0) { \
     BODY; \
-    bool skip = ((P.VU.elt<uint64_t>(0, midx) >> mpos) & 0x1) == 0; \
-    if (skip) { \
+    uint64_t mrest = P.VU.elt<uint64_t>(0, midx) >> mpos; \
+    if ((mrest & 0x1) == 0) { \
+        if (mrest == 0) \
+          i |= 63; \
         continue; \
     } \
   }
@@ -204,14 +207,17 @@ static inline bool is_aligned(const unsigned val, const unsigned pos)
 //
 // vector: loop header and end helper
 //
-#define VI_GENERAL_LOOP_BASE \
+#define VI_LOOP_COMMON \
   require(P.VU.vsew >= e8 && P.VU.vsew <= e64); \
   require_vector(true); \
   reg_t vl = P.VU.vl->read(); \
   reg_t sew = P.VU.vsew; \
   reg_t rd_num = insn.rd(); \
   reg_t rs1_num = insn.rs1(); \
-  reg_t rs2_num = insn.rs2(); \
+  reg_t rs2_num = insn.rs2();
+
+#define VI_GENERAL_LOOP_BASE \
+  VI_LOOP_COMMON \
   for (reg_t i = P.VU.vstart->read(); i < vl; ++i) {
 
 #define VI_LOOP_BASE \
@@ -250,24 +256,32 @@ static inline bool is_aligned(const unsigned val, const unsigned pos)
   const uint128_t op_mask = (UINT64_MAX >> (64 - sew)); \
   uint64_t carry = (v0 >> mpos) & 0x1;
 
+// Mask results are gathered for 64 elements at a time and written back
+// with one update of the destination word.
+#define VI_MASK_RESULT_LOOP_BASE \
+  for (reg_t base = P.VU.vstart->read() & ~reg_t(63); base < vl; base += 64) { \
+    uint64_t active = P.VU.active_mask(base, P.VU.vstart->read(), vl, insn.v_vm() == 0); \
+    uint64_t res_word = 0; \
+    for (uint64_t bits = active; bits != 0; bits &= bits - 1) { \
+      reg_t i = base + ctz(bits); \
+      uint64_t res = 0;
+
+#define VI_MASK_RESULT_LOOP_END \
+      res_word |= (res & 1) << (i - base); \
+    } \
+    if (active != 0) { \
+      uint64_t &vdi = P.VU.elt<uint64_t>(rd_num, base / 64, true); \
+      vdi = (vdi & ~active) | res_word; \
+    } \
+  } \
+  P.VU.vstart->write(0);
+
 #define VI_LOOP_CMP_BASE \
-  require(P.VU.vsew >= e8 && P.VU.vsew <= e64); \
-  require_vector(true); \
-  reg_t vl = P.VU.vl->read(); \
-  reg_t sew = P.VU.vsew; \
-  reg_t rd_num = insn.rd(); \
-  reg_t rs1_num = insn.rs1(); \
-  reg_t rs2_num = insn.rs2(); \
-  for (reg_t i = P.VU.vstart->read(); i < vl; ++i) { \
-    VI_LOOP_ELEMENT_SKIP(); \
-    uint64_t mmask = UINT64_C(1) << mpos; \
-    uint64_t &vdi = P.VU.elt<uint64_t>(insn.rd(), midx, true); \
-    uint64_t res = 0;
+  VI_LOOP_COMMON \
+  VI_MASK_RESULT_LOOP_BASE
 
 #define VI_LOOP_CMP_END \
-    vdi = (vdi & ~mmask) | (((res) << mpos) & mmask); \
-  } \
-  P.VU.vstart->write(0);
+  VI_MASK_RESULT_LOOP_END
 
 #define VI_LOOP_MASK(op) \
   require(P.VU.vsew <= e64); \
@@ -653,151 +667,405 @@ static inline bool is_aligned(const unsigned val, const unsigned pos)
     REDUCTION_ULOOP(e64, BODY) \
   }
 
-// genearl VXI signed/unsigned loop
-#define VI_VV_ULOOP(BODY) \
-  VI_CHECK_SSS(true) \
-  VI_LOOP_BASE \
+//
+// vector: same-width loops over register-group spans
+//
+// Each operand's register group is resolved once per instruction with
+// elt_group(), so the element loop indexes plain memory rather than paying
+// for elt()'s bookkeeping on every element.  The mask is read a word at a
+// time and BODY runs over each run of consecutive active elements, so
+// masked-off elements cost nothing.
+// The agnostic elements of a same-width vd of esz-byte elements, left
+// undisturbed unless the --varch asks for them to be filled with ones.
+#define VI_AGNOSTIC_FILL(esz) \
+  if (unlikely(P.VU.agnostic_ones)) \
+    P.VU.fill_agnostic(rd_num, esz, P.VU.vstart->read(), vl, insn.v_vm() == 0);
+
+#define VI_SPAN_LOOP(SPANS, PARAMS, BODY) \
+  { \
+    SPANS \
+    for (reg_t base = P.VU.vstart->read() & ~reg_t(63); base < vl; base += 64) { \
+      uint64_t active = P.VU.active_mask(base, P.VU.vstart->read(), vl, insn.v_vm() == 0); \
+      while (active != 0) { \
+        uint64_t rest = active & (active + (active & -active)); \
+        reg_t end = base + ctz(active) + popcount(active ^ rest); \
+        for (reg_t i = base + ctz(active); i < end; ++i) { \
+          PARAMS \
+          BODY; \
+        } \
+        active = rest; \
+      } \
+    } \
+    VI_AGNOSTIC_FILL(sizeof(vd_span[0])) \
+  }
+
+#define VV_SPANS(td, t1, t2) \
+  auto vd_span = P.VU.elt_group<td>(rd_num, P.VU.vstart->read(), vl, true); \
+  auto vs1_span = P.VU.elt_group<t1>(rs1_num, P.VU.vstart->read(), vl); \
+  auto vs2_span = P.VU.elt_group<t2>(rs2_num, P.VU.vstart->read(), vl);
+
+#define V_SPANS(td, t2) \
+  auto vd_span = P.VU.elt_group<td>(rd_num, P.VU.vstart->read(), vl, true); \
+  auto vs2_span = P.VU.elt_group<t2>(rs2_num, P.VU.vstart->read(), vl);
+
+#define VV_SPAN_PARAMS(td, t1, t2) \
+  td &vd = vd_span[i]; \
+  t1 vs1 = vs1_span[i]; \
+  t2 vs2 = vs2_span[i];
+
+#define VX_SPAN_PARAMS(td, t1, t2) \
+  td &vd = vd_span[i]; \
+  t1 rs1 = (t1)RS1; \
+  t2 vs2 = vs2_span[i];
+
+#define VI_SPAN_PARAMS(td, imm) \
+  td &vd = vd_span[i]; \
+  td imm = (td)insn.v_##imm(); \
+  td vs2 = vs2_span[i];
+
+#define VV_SPAN_LOOP(x, BODY) \
+  VI_SPAN_LOOP(VV_SPANS(type_sew_t<x>::type, type_sew_t<x>::type, type_sew_t<x>::type), \
+               VV_SPAN_PARAMS(type_sew_t<x>::type, type_sew_t<x>::type, type_sew_t<x>::type), BODY)
+
+#define VV_U_SPAN_LOOP(x, BODY) \
+  VI_SPAN_LOOP(VV_SPANS(type_usew_t<x>::type, type_usew_t<x>::type, type_usew_t<x>::type), \
+               VV_SPAN_PARAMS(type_usew_t<x>::type, type_usew_t<x>::type, type_usew_t<x>::type), BODY)
+
+#define VV_SU_SPAN_LOOP(x, BODY) \
+  VI_SPAN_LOOP(VV_SPANS(type_sew_t<x>::type, type_usew_t<x>::type, type_sew_t<x>::type), \
+               VV_SPAN_PARAMS(type_sew_t<x>::type, type_usew_t<x>::type, type_sew_t<x>::type), BODY)
+
+#define VX_SPAN_LOOP(x, BODY) \
+  VI_SPAN_LOOP(V_SPANS(type_sew_t<x>::type, type_sew_t<x>::type), \
+               VX_SPAN_PARAMS(type_sew_t<x>::type, type_sew_t<x>::type, type_sew_t<x>::type), BODY)
+
+#define VX_U_SPAN_LOOP(x, BODY) \
+  VI_SPAN_LOOP(V_SPANS(type_usew_t<x>::type, type_usew_t<x>::type), \
+               VX_SPAN_PARAMS(type_usew_t<x>::type, type_usew_t<x>::type, type_usew_t<x>::type), BODY)
+
+#define VX_SU_SPAN_LOOP(x, BODY) \
+  VI_SPAN_LOOP(V_SPANS(type_sew_t<x>::type, type_sew_t<x>::type), \
+               VX_SPAN_PARAMS(type_sew_t<x>::type, type_usew_t<x>::type, type_sew_t<x>::type), BODY)
+
+#define VI_IMM_SPAN_LOOP(x, BODY) \
+  VI_SPAN_LOOP(V_SPANS(type_sew_t<x>::type, type_sew_t<x>::type), \
+               VI_SPAN_PARAMS(type_sew_t<x>::type, simm5), BODY)
+
+#define VI_U_IMM_SPAN_LOOP(x, BODY) \
+  VI_SPAN_LOOP(V_SPANS(type_usew_t<x>::type, type_usew_t<x>::type), \
+               VI_SPAN_PARAMS(type_usew_t<x>::type, zimm5), BODY)
+
+#define VI_SPAN_SEW_LOOP(LOOP, BODY) \
+  VI_LOOP_COMMON \
   if (sew == e8) { \
-    VV_U_PARAMS(e8); \
-    BODY; \
+    LOOP(e8, BODY) \
   } else if (sew == e16) { \
-    VV_U_PARAMS(e16); \
-    BODY; \
+    LOOP(e16, BODY) \
   } else if (sew == e32) { \
-    VV_U_PARAMS(e32); \
-    BODY; \
+    LOOP(e32, BODY) \
   } else if (sew == e64) { \
-    VV_U_PARAMS(e64); \
-    BODY; \
+    LOOP(e64, BODY) \
   } \
-  VI_LOOP_END
+  P.VU.vstart->write(0);
 
-#define VI_VV_LOOP(BODY) \
-  VI_CHECK_SSS(true) \
-  VI_LOOP_BASE \
+//
+// vector: host kernel loops
+//
+// Unmasked operations starting at element 0 are handed whole to a host
+// kernel from v_ext_kernels.h; everything else runs BODY element by element.
+#ifdef WORDS_BIGENDIAN
+#define VI_KERNEL_OK false
+#else
+#define VI_KERNEL_OK (insn.v_vm() == 1 && P.VU.vstart->read() == 0)
+#endif
+
+#define VV_KERNEL_CALL(OP, T) \
+  vk_vv(OP, &P.VU.elt_group<T>(rd_num, 0, vl, true)[0], \
+        &P.VU.elt_group<T>(rs2_num, 0, vl)[0], \
+        &P.VU.elt_group<T>(rs1_num, 0, vl)[0], vl); \
+  VI_AGNOSTIC_FILL(sizeof(T))
+
+#define VX_KERNEL_CALL(OP, T) \
+  vk_vx(OP, &P.VU.elt_group<T>(rd_num, 0, vl, true)[0], \
+        &P.VU.elt_group<T>(rs2_num, 0, vl)[0], (T)RS1, vl); \
+  VI_AGNOSTIC_FILL(sizeof(T))
+
+#define VI_KERNEL_CALL(OP, T) \
+  vk_vx(OP, &P.VU.elt_group<T>(rd_num, 0, vl, true)[0], \
+        &P.VU.elt_group<T>(rs2_num, 0, vl)[0], (T)kernel_imm, vl); \
+  VI_AGNOSTIC_FILL(sizeof(T))
+
+#define VI_KERNEL_SEW_LOOP(CALL, OP, TYPE) \
+  VI_LOOP_COMMON \
   if (sew == e8) { \
-    VV_PARAMS(e8); \
-    BODY; \
+    CALL(OP, TYPE<e8>::type) \
   } else if (sew == e16) { \
-    VV_PARAMS(e16); \
-    BODY; \
+    CALL(OP, TYPE<e16>::type) \
   } else if (sew == e32) { \
-    VV_PARAMS(e32); \
-    BODY; \
+    CALL(OP, TYPE<e32>::type) \
   } else if (sew == e64) { \
-    VV_PARAMS(e64); \
-    BODY; \
+    CALL(OP, TYPE<e64>::type) \
   } \
-  VI_LOOP_END
+  P.VU.vstart->write(0);
+
+// TYPE is type_sew_t or type_usew_t, picking the signedness of VK_MIN and
+// VK_MAX; LOOP is the element-wise loop BODY falls back to.
+#define VI_VV_KERNEL_LOOP(OP, TYPE, LOOP, BODY) \
+  if (VI_KERNEL_OK) { \
+    VI_CHECK_SSS(true) \
+    VI_KERNEL_SEW_LOOP(VV_KERNEL_CALL, OP, TYPE) \
+  } else { \
+    LOOP(BODY) \
+  }
+
+#define VI_VX_KERNEL_LOOP(OP, TYPE, LOOP, BODY) \
+  if (VI_KERNEL_OK) { \
+    VI_CHECK_SSS(false) \
+    VI_KERNEL_SEW_LOOP(VX_KERNEL_CALL, OP, TYPE) \
+  } else { \
+    LOOP(BODY) \
+  }
+
+#define VI_VI_KERNEL_LOOP(OP, TYPE, IMM, LOOP, BODY) \
+  if (VI_KERNEL_OK) { \
+    VI_CHECK_SSS(false) \
+    reg_t kernel_imm = IMM; \
+    VI_KERNEL_SEW_LOOP(VI_KERNEL_CALL, OP, TYPE) \
+  } else { \
+    LOOP(BODY) \
+  }
+
+// Unmasked reductions fold the whole of vs2 in one kernel call.  vd[0] is
+// only written for a nonzero vl, as in the element loop.
+#define RED_KERNEL_CALL(OP, T) { \
+  auto &vd_0_des = P.VU.elt<T>(rd_num, 0, true); \
+  T vd_0_res = P.VU.elt<T>(rs1_num, 0); \
+  if (vl > 0) \
+    vd_0_des = vk_red(OP, &P.VU.elt_group<T>(rs2_num, 0, vl)[0], vd_0_res, vl); \
+}
+
+#define WIDE_RED_KERNEL_CALL(TYPE, sew1, sew2) { \
+  auto &vd_0_des = P.VU.elt<TYPE<sew2>::type>(rd_num, 0, true); \
+  auto vd_0_res = P.VU.elt<TYPE<sew2>::type>(rs1_num, 0); \
+  if (vl > 0) \
+    vd_0_des = vk_wred(&P.VU.elt_group<TYPE<sew1>::type>(rs2_num, 0, vl)[0], vd_0_res, vl); \
+}
+
+#define VI_VV_REDUCTION_KERNEL_LOOP(OP, TYPE, LOOP, BODY) \
+  if (VI_KERNEL_OK) { \
+    VI_CHECK_REDUCTION(false); \
+    VI_KERNEL_SEW_LOOP(RED_KERNEL_CALL, OP, TYPE) \
+  } else { \
+    LOOP(BODY) \
+  }
+
+#define VI_VV_WIDE_REDUCTION_KERNEL_LOOP(TYPE, LOOP, BODY) \
+  if (VI_KERNEL_OK) { \
+    VI_CHECK_REDUCTION(true); \
+    VI_LOOP_COMMON \
+    if (sew == e8) { \
+      WIDE_RED_KERNEL_CALL(TYPE, e8, e16) \
+    } else if (sew == e16) { \
+      WIDE_RED_KERNEL_CALL(TYPE, e16, e32) \
+    } else if (sew == e32) { \
+      WIDE_RED_KERNEL_CALL(TYPE, e32, e64) \
+    } \
+    P.VU.vstart->write(0); \
+  } else { \
+    LOOP(BODY) \
+  }
+
+//
+// vector: bulk permutations
+//
+// Unmasked permutations starting at element 0 move whole runs of elements
+// of the register file, or hand them to a kernel from v_ext_kernels.h,
+// instead of going through elt() per element.  The VI_*_BULK macros are
+// false when they leave the instruction to its element loop, and otherwise
+// make the checks VI_LOOP_BASE would have.
+#define VI_PERM_BULK_CHECK \
+  require(P.VU.vsew >= e8 && P.VU.vsew <= e64); \
+  require_vector(true);
+
+// The bytes of elements [start, end) of the group at reg
+#define VI_PERM_BYTES(reg, start, end, is_write) \
+  (&P.VU.elt_group<uint8_t>(reg, (start) * esz, (end) * esz, is_write)[(start) * esz])
+
+// vd[i] = vs2[i - offset] for i in [offset, vl); vd and vs2 are disjoint.
+#define VI_SLIDEUP_BULK(offset) ({ \
+  const bool bulk = VI_KERNEL_OK; \
+  if (bulk) { \
+    VI_PERM_BULK_CHECK \
+    const reg_t vl = P.VU.vl->read(); \
+    const reg_t esz = P.VU.vsew >> 3; \
+    const reg_t off = offset; \
+    if (off < vl) \
+      memcpy(VI_PERM_BYTES(insn.rd(), off, vl, true), \
+             VI_PERM_BYTES(insn.rs2(), 0, vl - off, false), (vl - off) * esz); \
+    P.VU.vstart->write(0); \
+  } \
+  bulk; \
+})
+
+// vd[i] = vs2[i + sh], or 0 past vlmax, for i in [0, vl); vd may be vs2.
+#define VI_SLIDEDOWN_BULK(sh) ({ \
+  const bool bulk = VI_KERNEL_OK; \
+  if (bulk) { \
+    VI_PERM_BULK_CHECK \
+    const reg_t vl = P.VU.vl->read(); \
+    const reg_t esz = P.VU.vsew >> 3; \
+    const reg_t n = (sh) < P.VU.vlmax ? std::min<reg_t>(vl, P.VU.vlmax - (sh)) : 0; \
+    uint8_t* vd = VI_PERM_BYTES(insn.rd(), 0, vl, true); \
+    if (n > 0) \
+      memmove(vd, VI_PERM_BYTES(insn.rs2(), reg_t(sh), reg_t(sh) + n, false), n * esz); \
+    memset(vd + n * esz, 0, (vl - n) * esz); \
+    P.VU.vstart->write(0); \
+  } \
+  bulk; \
+})
+
+// vd[0] = x and vd[i] = vs2[i - 1] for i in [1, vl)
+#define VI_SLIDE1UP_BULK(x) ({ \
+  const bool bulk = VI_KERNEL_OK; \
+  if (bulk) { \
+    VI_PERM_BULK_CHECK \
+    const reg_t vl = P.VU.vl->read(); \
+    const reg_t esz = P.VU.vsew >> 3; \
+    const reg_t val = x; \
+    if (vl > 0) { \
+      uint8_t* vd = VI_PERM_BYTES(insn.rd(), 0, vl, true); \
+      memcpy(vd + esz, VI_PERM_BYTES(insn.rs2(), 0, vl - 1, false), (vl - 1) * esz); \
+      memcpy(vd, &val, esz); \
+    } \
+    P.VU.vstart->write(0); \
+  } \
+  bulk; \
+})
+
+// vd[i] = vs2[i + 1] for i in [0, vl - 1) and vd[vl - 1] = x; vd may be vs2.
+#define VI_SLIDE1DOWN_BULK(x) ({ \
+  const bool bulk = VI_KERNEL_OK; \
+  if (bulk) { \
+    VI_PERM_BULK_CHECK \
+    const reg_t vl = P.VU.vl->read(); \
+    const reg_t esz = P.VU.vsew >> 3; \
+    const reg_t val = x; \
+    if (vl > 0) { \
+      uint8_t* vd = VI_PERM_BYTES(insn.rd(), 0, vl, true); \
+      memmove(vd, VI_PERM_BYTES(insn.rs2(), 1, vl, false), (vl - 1) * esz); \
+      memcpy(vd + (vl - 1) * esz, &val, esz); \
+    } \
+    P.VU.vstart->write(0); \
+  } \
+  bulk; \
+})
+
+#define GATHER_KERNEL_CALL(T, I) \
+  vk_gather(&P.VU.elt_group<T>(insn.rd(), 0, vl, true)[0], \
+            &P.VU.elt_group<T>(insn.rs2(), 0, P.VU.vlmax)[0], \
+            &P.VU.elt_group<I>(insn.rs1(), 0, vl)[0], P.VU.vlmax, vl);
+
+// vd[i] = vs2[vs1[i]], or 0 past vlmax, for i in [0, vl), with the indices
+// of type I8 to I64 for each SEW.
+#define VI_GATHER_BULK(I8, I16, I32, I64) ({ \
+  const bool bulk = VI_KERNEL_OK; \
+  if (bulk) { \
+    VI_PERM_BULK_CHECK \
+    const reg_t vl = P.VU.vl->read(); \
+    switch (P.VU.vsew) { \
+      case e8:  GATHER_KERNEL_CALL(uint8_t, I8) break; \
+      case e16: GATHER_KERNEL_CALL(uint16_t, I16) break; \
+      case e32: GATHER_KERNEL_CALL(uint32_t, I32) break; \
+      default:  GATHER_KERNEL_CALL(uint64_t, I64) break; \
+    } \
+    P.VU.vstart->write(0); \
+  } \
+  bulk; \
+})
+
+#define GATHER_SPLAT_CALL(T) { \
+  T val = index < P.VU.vlmax ? P.VU.elt<T>(insn.rs2(), index) : 0; \
+  T* vd = &P.VU.elt_group<T>(insn.rd(), 0, vl, true)[0]; \
+  std::fill(vd, vd + vl, val); \
+}
+
+// vd[i] = vs2[idx], or 0 if idx is past vlmax, for i in [0, vl)
+#define VI_GATHER_SPLAT_BULK(idx) ({ \
+  const bool bulk = VI_KERNEL_OK; \
+  if (bulk) { \
+    VI_PERM_BULK_CHECK \
+    const reg_t vl = P.VU.vl->read(); \
+    const reg_t index = idx; \
+    switch (P.VU.vsew) { \
+      case e8:  GATHER_SPLAT_CALL(uint8_t) break; \
+      case e16: GATHER_SPLAT_CALL(uint16_t) break; \
+      case e32: GATHER_SPLAT_CALL(uint32_t) break; \
+      default:  GATHER_SPLAT_CALL(uint64_t) break; \
+    } \
+    P.VU.vstart->write(0); \
+  } \
+  bulk; \
+})
+
+#define COMPRESS_KERNEL_CALL(T) \
+  vk_compress(&P.VU.elt_group<T>(insn.rd(), 0, count, true)[0], \
+              &P.VU.elt_group<T>(insn.rs2(), 0, vl)[0], mask, vl);
+
+// Packs the vs2[i] whose bit is set in vs1, for i in [0, vl), at the start
+// of vd.  vcompress is always unmasked.
+#define VI_COMPRESS_BULK() ({ \
+  const bool bulk = VI_KERNEL_OK; \
+  if (bulk) { \
+    VI_PERM_BULK_CHECK \
+    const reg_t vl = P.VU.vl->read(); \
+    const uint64_t* mask = &P.VU.elt_group<uint64_t>(insn.rs1(), 0, (vl + 63) / 64)[0]; \
+    reg_t count = 0; \
+    for (reg_t base = 0; base < vl; base += 64) \
+      count += popcount(mask[base / 64] & P.VU.active_mask(base, 0, vl, false)); \
+    switch (P.VU.vsew) { \
+      case e8:  COMPRESS_KERNEL_CALL(uint8_t) break; \
+      case e16: COMPRESS_KERNEL_CALL(uint16_t) break; \
+      case e32: COMPRESS_KERNEL_CALL(uint32_t) break; \
+      default:  COMPRESS_KERNEL_CALL(uint64_t) break; \
+    } \
+    P.VU.vstart->write(0); \
+  } \
+  bulk; \
+})
+
+// genearl VXI signed/unsigned loop
+#define VI_VV_ULOOP(BODY) \
+  VI_CHECK_SSS(true) \
+  VI_SPAN_SEW_LOOP(VV_U_SPAN_LOOP, BODY)
+
+#define VI_VV_LOOP(BODY) \
+  VI_CHECK_SSS(true) \
+  VI_SPAN_SEW_LOOP(VV_SPAN_LOOP, BODY)
 
 #define VI_VX_ULOOP(BODY) \
   VI_CHECK_SSS(false) \
-  VI_LOOP_BASE \
-  if (sew == e8) { \
-    VX_U_PARAMS(e8); \
-    BODY; \
-  } else if (sew == e16) { \
-    VX_U_PARAMS(e16); \
-    BODY; \
-  } else if (sew == e32) { \
-    VX_U_PARAMS(e32); \
-    BODY; \
-  } else if (sew == e64) { \
-    VX_U_PARAMS(e64); \
-    BODY; \
-  } \
-  VI_LOOP_END
+  VI_SPAN_SEW_LOOP(VX_U_SPAN_LOOP, BODY)
 
 #define VI_VX_LOOP(BODY) \
   VI_CHECK_SSS(false) \
-  VI_LOOP_BASE \
-  if (sew == e8) { \
-    VX_PARAMS(e8); \
-    BODY; \
-  } else if (sew == e16) { \
-    VX_PARAMS(e16); \
-    BODY; \
-  } else if (sew == e32) { \
-    VX_PARAMS(e32); \
-    BODY; \
-  } else if (sew == e64) { \
-    VX_PARAMS(e64); \
-    BODY; \
-  } \
-  VI_LOOP_END
+  VI_SPAN_SEW_LOOP(VX_SPAN_LOOP, BODY)
 
 #define VI_VI_ULOOP(BODY) \
   VI_CHECK_SSS(false) \
-  VI_LOOP_BASE \
-  if (sew == e8) { \
-    VI_U_PARAMS(e8); \
-    BODY; \
-  } else if (sew == e16) { \
-    VI_U_PARAMS(e16); \
-    BODY; \
-  } else if (sew == e32) { \
-    VI_U_PARAMS(e32); \
-    BODY; \
-  } else if (sew == e64) { \
-    VI_U_PARAMS(e64); \
-    BODY; \
-  } \
-  VI_LOOP_END
+  VI_SPAN_SEW_LOOP(VI_U_IMM_SPAN_LOOP, BODY)
 
 #define VI_VI_LOOP(BODY) \
   VI_CHECK_SSS(false) \
-  VI_LOOP_BASE \
-  if (sew == e8) { \
-    VI_PARAMS(e8); \
-    BODY; \
-  } else if (sew == e16) { \
-    VI_PARAMS(e16); \
-    BODY; \
-  } else if (sew == e32) { \
-    VI_PARAMS(e32); \
-    BODY; \
-  } else if (sew == e64) { \
-    VI_PARAMS(e64); \
-    BODY; \
-  } \
-  VI_LOOP_END
+  VI_SPAN_SEW_LOOP(VI_IMM_SPAN_LOOP, BODY)
 
 // signed unsigned operation loop (e.g. mulhsu)
 #define VI_VV_SU_LOOP(BODY) \
   VI_CHECK_SSS(true) \
-  VI_LOOP_BASE \
-  if (sew == e8) { \
-    VV_SU_PARAMS(e8); \
-    BODY; \
-  } else if (sew == e16) { \
-    VV_SU_PARAMS(e16); \
-    BODY; \
-  } else if (sew == e32) { \
-    VV_SU_PARAMS(e32); \
-    BODY; \
-  } else if (sew == e64) { \
-    VV_SU_PARAMS(e64); \
-    BODY; \
-  } \
-  VI_LOOP_END
+  VI_SPAN_SEW_LOOP(VV_SU_SPAN_LOOP, BODY)
 
 #define VI_VX_SU_LOOP(BODY) \
   VI_CHECK_SSS(false) \
-  VI_LOOP_BASE \
-  if (sew == e8) { \
-    VX_SU_PARAMS(e8); \
-    BODY; \
-  } else if (sew == e16) { \
-    VX_SU_PARAMS(e16); \
-    BODY; \
-  } else if (sew == e32) { \
-    VX_SU_PARAMS(e32); \
-    BODY; \
-  } else if (sew == e64) { \
-    VX_SU_PARAMS(e64); \
-    BODY; \
-  } \
-  VI_LOOP_END
+  VI_SPAN_SEW_LOOP(VX_SU_SPAN_LOOP, BODY)
 
 // narrow operation loop
 #define VI_VV_LOOP_NARROW(BODY) \
@@ -1172,112 +1440,229 @@ reg_t index[P.VU.vlmax]; \
   } \
 }
 
-#define VI_LD(stride, offset, elt_width, is_mask_ldst) \
-  const reg_t nf = insn.v_nf() + 1; \
-  const reg_t vl = is_mask_ldst ? ((P.VU.vl->read() + 7) / 8) : P.VU.vl->read(); \
-  const reg_t baseAddr = RS1; \
-  const reg_t vd = insn.rd(); \
-  VI_CHECK_LOAD(elt_width, is_mask_ldst); \
+// Strided and indexed accesses first take the span of their active
+// elements.  If every element is aligned and the span lies in at most
+// VI_SPAN_MAX_PAGES pages that all hit in the TLB, no element can fault, so
+// the elements are moved through the vec_hit accessors and vstart is only
+// cleared at the end.  Otherwise the elements go one by one through the
+// usual accessors, which fault in element order.
+#define VI_SPAN_MAX_PAGES 8
+
+#define VI_SPAN_HITS(addr, esz, type) ({ \
+  reg_t span_lo = -1, span_hi = 0, span_or = 0; \
+  bool span_ok = true; \
+  for (reg_t i = 0; span_ok && i < vl; ++i) { \
+    VI_ELEMENT_SKIP(i); \
+    for (reg_t fn = 0; fn < nf; ++fn) { \
+      const reg_t a = (addr); \
+      span_lo = std::min(span_lo, a); \
+      span_hi = std::max(span_hi, a + (esz) - 1); \
+      span_or |= a; \
+    } \
+    span_ok = span_hi - span_lo < (reg_t(VI_SPAN_MAX_PAGES) << PGSHIFT); \
+  } \
+  span_ok && span_lo <= span_hi && (span_or & ((esz) - 1)) == 0 && \
+    MMU.vec_span_hits(span_lo, span_hi, type, VI_SPAN_MAX_PAGES); \
+})
+
+#define VI_LD_LOOP(stride, offset, elt_width, access, track_vstart) \
   for (reg_t i = 0; i < vl; ++i) { \
     VI_ELEMENT_SKIP(i); \
     VI_STRIP(i); \
-    P.VU.vstart->write(i); \
+    if (track_vstart) \
+      P.VU.vstart->write(i); \
     for (reg_t fn = 0; fn < nf; ++fn) { \
-      elt_width##_t val = MMU.load_vec_##elt_width( \
+      elt_width##_t val = MMU.access##elt_width( \
         baseAddr + (stride) + (offset) * sizeof(elt_width##_t),      \
         vd + fn * emul, vreg_inx);                                   \
       P.VU.elt<elt_width##_t>(vd + fn * emul, vreg_inx, true) = val; \
     } \
-  } \
-  P.VU.vstart->write(0);
+  }
 
-#define VI_LD_INDEX(elt_width, is_seg) \
+#define VI_LD(stride, offset, elt_width, is_mask_ldst) \
   const reg_t nf = insn.v_nf() + 1; \
-  const reg_t vl = P.VU.vl->read(); \
+  const reg_t vl = is_mask_ldst ? ((P.VU.vl->read() + 7) / 8) : P.VU.vl->read(); \
   const reg_t baseAddr = RS1; \
   const reg_t vd = insn.rd(); \
-  if (!is_seg) \
-    require(nf == 1); \
-  VI_CHECK_LD_INDEX(elt_width); \
-  VI_DUPLICATE_VREG(insn.rs2(), elt_width); \
+  VI_CHECK_LOAD(elt_width, is_mask_ldst); \
+  if (VI_SPAN_HITS(baseAddr + (stride) + (offset) * sizeof(elt_width##_t), \
+                   sizeof(elt_width##_t), LOAD)) { \
+    VI_LD_LOOP(stride, offset, elt_width, load_vec_hit_, false) \
+  } else { \
+    VI_LD_LOOP(stride, offset, elt_width, load_vec_, true) \
+  } \
+  P.VU.vstart->write(0);
+
+#define VI_LD_INDEX_LOOP(access, track_vstart) \
   for (reg_t i = 0; i < vl; ++i) { \
     VI_ELEMENT_SKIP(i); \
     VI_STRIP(i); \
-    P.VU.vstart->write(i); \
+    if (track_vstart) \
+      P.VU.vstart->write(i); \
     for (reg_t fn = 0; fn < nf; ++fn) { \
       switch (P.VU.vsew) { \
         case e8: \
           P.VU.elt<uint8_t>(vd + fn * flmul, vreg_inx, true) = \
-              MMU.load_vec_uint8(baseAddr + index[i] + fn * 1, vd + fn * flmul, vreg_inx); \
+              MMU.access##uint8(baseAddr + index[i] + fn * 1, vd + fn * flmul, vreg_inx); \
           break; \
         case e16: \
           P.VU.elt<uint16_t>(vd + fn * flmul, vreg_inx, true) = \
-              MMU.load_vec_uint16(baseAddr + index[i] + fn * 2, vd + fn * flmul, vreg_inx); \
+              MMU.access##uint16(baseAddr + index[i] + fn * 2, vd + fn * flmul, vreg_inx); \
           break; \
         case e32: \
           P.VU.elt<uint32_t>(vd + fn * flmul, vreg_inx, true) = \
-              MMU.load_vec_uint32(baseAddr + index[i] + fn * 4, vd + fn * flmul, vreg_inx); \
+              MMU.access##uint32(baseAddr + index[i] + fn * 4, vd + fn * flmul, vreg_inx); \
           break; \
         default: \
           P.VU.elt<uint64_t>(vd + fn * flmul, vreg_inx, true) = \
-              MMU.load_vec_uint64(baseAddr + index[i] + fn * 8, vd + fn * flmul, vreg_inx); \
+              MMU.access##uint64(baseAddr + index[i] + fn * 8, vd + fn * flmul, vreg_inx); \
           break; \
       } \
     } \
-  } \
-  P.VU.vstart->write(0);
+  }
 
-#define VI_ST(stride, offset, elt_width, is_mask_ldst) \
+#define VI_LD_INDEX(elt_width, is_seg) \
   const reg_t nf = insn.v_nf() + 1; \
-  const reg_t vl = is_mask_ldst ? ((P.VU.vl->read() + 7) / 8) : P.VU.vl->read(); \
+  const reg_t vl = P.VU.vl->read(); \
   const reg_t baseAddr = RS1; \
-  const reg_t vs3 = insn.rd(); \
-  VI_CHECK_STORE(elt_width, is_mask_ldst); \
+  const reg_t vd = insn.rd(); \
+  if (!is_seg) \
+    require(nf == 1); \
+  VI_CHECK_LD_INDEX(elt_width); \
+  VI_DUPLICATE_VREG(insn.rs2(), elt_width); \
+  const reg_t esz = P.VU.vsew >> 3; \
+  if (VI_SPAN_HITS(baseAddr + index[i] + fn * esz, esz, LOAD)) { \
+    VI_LD_INDEX_LOOP(load_vec_hit_, false) \
+  } else { \
+    VI_LD_INDEX_LOOP(load_vec_, true) \
+  } \
+  P.VU.vstart->write(0);
+
+#define VI_ST_LOOP(stride, offset, elt_width, access, track_vstart) \
   for (reg_t i = 0; i < vl; ++i) { \
     VI_STRIP(i) \
     VI_ELEMENT_SKIP(i); \
-    P.VU.vstart->write(i); \
+    if (track_vstart) \
+      P.VU.vstart->write(i); \
     for (reg_t fn = 0; fn < nf; ++fn) { \
       elt_width##_t val = P.VU.elt<elt_width##_t>(vs3 + fn * emul, vreg_inx); \
-      MMU.store_vec_##elt_width( \
+      MMU.access##elt_width( \
         baseAddr + (stride) + (offset) * sizeof(elt_width##_t), val, vs3 + fn * emul, vreg_inx); \
     } \
-  } \
-  P.VU.vstart->write(0);
+  }
 
-#define VI_ST_INDEX(elt_width, is_seg) \
+#define VI_ST(stride, offset, elt_width, is_mask_ldst) \
   const reg_t nf = insn.v_nf() + 1; \
-  const reg_t vl = P.VU.vl->read(); \
+  const reg_t vl = is_mask_ldst ? ((P.VU.vl->read() + 7) / 8) : P.VU.vl->read(); \
   const reg_t baseAddr = RS1; \
   const reg_t vs3 = insn.rd(); \
-  if (!is_seg) \
-    require(nf == 1); \
-  VI_CHECK_ST_INDEX(elt_width); \
-  VI_DUPLICATE_VREG(insn.rs2(), elt_width); \
+  VI_CHECK_STORE(elt_width, is_mask_ldst); \
+  if (VI_SPAN_HITS(baseAddr + (stride) + (offset) * sizeof(elt_width##_t), \
+                   sizeof(elt_width##_t), STORE)) { \
+    VI_ST_LOOP(stride, offset, elt_width, store_vec_hit_, false) \
+  } else { \
+    VI_ST_LOOP(stride, offset, elt_width, store_vec_, true) \
+  } \
+  P.VU.vstart->write(0);
+
+// Unit-stride accesses that are unmasked, aligned and confined to one page
+// that hits in the TLB are copied straight between that page and the
+// register file, with segments split into or gathered from their field
+// registers by a host kernel; VI_LDST_BULK is false if it left that to the
+// element-by-element loop.
+#ifdef WORDS_BIGENDIAN
+#define VI_LDST_BULK(elt_width, is_mask_ldst, is_load) false
+#else
+#define VI_LDST_BULK(elt_width, is_mask_ldst, is_load) ({ \
+  typedef std::make_unsigned<elt_width##_t>::type bulk_t; \
+  const reg_t nf = insn.v_nf() + 1; \
+  const reg_t vl = is_mask_ldst ? ((P.VU.vl->read() + 7) / 8) : P.VU.vl->read(); \
+  const reg_t vstart = P.VU.vstart->read(); \
+  const reg_t addr = RS1 + vstart * nf * sizeof(bulk_t); \
+  const reg_t len = vstart < vl ? (vl - vstart) * nf * sizeof(bulk_t) : 0; \
+  VI_CHECK_STORE(elt_width, is_mask_ldst); \
+  if (is_load) { \
+    require_vm; \
+  } \
+  char* host = NULL; \
+  if (insn.v_vm() && (addr & (sizeof(bulk_t) - 1)) == 0) \
+    host = MMU.vec_host_ptr(addr, len, is_load ? LOAD : STORE); \
+  if (host) { \
+    bulk_t* regs[8]; \
+    for (reg_t fn = 0; fn < nf; fn++) \
+      regs[fn] = &P.VU.elt_group<bulk_t>(insn.rd() + fn * emul, vstart, vl, is_load)[vstart]; \
+    if (is_load) { \
+      MMU.log_vec_range<bulk_t>(addr, vl - vstart, insn.rd(), vstart, NULL, nf, emul); \
+      if (nf == 1) \
+        memcpy(regs[0], host, len); \
+      else \
+        vk_seg_load(regs, (const bulk_t*)host, nf, vl - vstart); \
+    } else { \
+      if (nf == 1) \
+        memcpy(host, regs[0], len); \
+      else \
+        vk_seg_store((bulk_t*)host, regs, nf, vl - vstart); \
+      MMU.log_vec_range<bulk_t>(addr, vl - vstart, insn.rd(), vstart, (const bulk_t*)host, \
+                                nf, emul); \
+    } \
+    P.VU.vstart->write(0); \
+  } \
+  host != NULL; \
+})
+#endif
+
+#define VI_LD_UNIT_STRIDE(elt_width, is_mask_ldst) \
+  if (!VI_LDST_BULK(elt_width, is_mask_ldst, true)) { \
+    VI_LD(0, (i * nf + fn), elt_width, is_mask_ldst); \
+  }
+
+#define VI_ST_UNIT_STRIDE(elt_width, is_mask_ldst) \
+  if (!VI_LDST_BULK(elt_width, is_mask_ldst, false)) { \
+    VI_ST(0, (i * nf + fn), elt_width, is_mask_ldst); \
+  }
+
+#define VI_ST_INDEX_LOOP(access, track_vstart) \
   for (reg_t i = 0; i < vl; ++i) { \
     VI_STRIP(i) \
     VI_ELEMENT_SKIP(i); \
-    P.VU.vstart->write(i); \
+    if (track_vstart) \
+      P.VU.vstart->write(i); \
     for (reg_t fn = 0; fn < nf; ++fn) { \
       switch (P.VU.vsew) { \
       case e8: \
-        MMU.store_vec_uint8(baseAddr + index[i] + fn * 1, \
-                            P.VU.elt<uint8_t>(vs3 + fn * flmul, vreg_inx), vs3 + fn * flmul, vreg_inx); \
+        MMU.access##uint8(baseAddr + index[i] + fn * 1, \
+                          P.VU.elt<uint8_t>(vs3 + fn * flmul, vreg_inx), vs3 + fn * flmul, vreg_inx); \
         break; \
       case e16: \
-        MMU.store_vec_uint16(baseAddr + index[i] + fn * 2, \
-                             P.VU.elt<uint16_t>(vs3 + fn * flmul, vreg_inx), vs3 + fn * flmul, vreg_inx); \
+        MMU.access##uint16(baseAddr + index[i] + fn * 2, \
+                           P.VU.elt<uint16_t>(vs3 + fn * flmul, vreg_inx), vs3 + fn * flmul, vreg_inx); \
         break; \
       case e32: \
-        MMU.store_vec_uint32(baseAddr + index[i] + fn * 4, \
-                             P.VU.elt<uint32_t>(vs3 + fn * flmul, vreg_inx), vs3 + fn * flmul, vreg_inx); \
+        MMU.access##uint32(baseAddr + index[i] + fn * 4, \
+                           P.VU.elt<uint32_t>(vs3 + fn * flmul, vreg_inx), vs3 + fn * flmul, vreg_inx); \
         break; \
       default: \
-        MMU.store_vec_uint64(baseAddr + index[i] + fn * 8, \
-                             P.VU.elt<uint64_t>(vs3 + fn * flmul, vreg_inx), vs3 + fn * flmul, vreg_inx); \
+        MMU.access##uint64(baseAddr + index[i] + fn * 8, \
+                           P.VU.elt<uint64_t>(vs3 + fn * flmul, vreg_inx), vs3 + fn * flmul, vreg_inx); \
         break; \
       } \
     } \
+  }
+
+#define VI_ST_INDEX(elt_width, is_seg) \
+  const reg_t nf = insn.v_nf() + 1; \
+  const reg_t vl = P.VU.vl->read(); \
+  const reg_t baseAddr = RS1; \
+  const reg_t vs3 = insn.rd(); \
+  if (!is_seg) \
+    require(nf == 1); \
+  VI_CHECK_ST_INDEX(elt_width); \
+  VI_DUPLICATE_VREG(insn.rs2(), elt_width); \
+  const reg_t esz = P.VU.vsew >> 3; \
+  if (VI_SPAN_HITS(baseAddr + index[i] + fn * esz, esz, STORE)) { \
+    VI_ST_INDEX_LOOP(store_vec_hit_, false) \
+  } else { \
+    VI_ST_INDEX_LOOP(store_vec_, true) \
   } \
   P.VU.vstart->write(0);
 
@@ -1492,13 +1877,42 @@ reg_t index[P.VU.vlmax]; \
   for (reg_t i = P.VU.vstart->read(); i < vl; ++i) { \
     VI_LOOP_ELEMENT_SKIP();
 
+#define VFP_VV_SPAN_LOOP(width, BODY) \
+  VI_SPAN_LOOP(VV_SPANS(float##width##_t, float##width##_t, float##width##_t), \
+               VV_SPAN_PARAMS(float##width##_t, float##width##_t, float##width##_t), BODY)
+
+#define VFP_VF_SPAN_LOOP(width, BODY) \
+  VI_SPAN_LOOP(V_SPANS(float##width##_t, float##width##_t), \
+               float##width##_t &vd = vd_span[i]; \
+               float##width##_t rs1 = f##width(READ_FREG(rs1_num)); \
+               float##width##_t vs2 = vs2_span[i];, BODY)
+
+#define VFP_V_SPAN_LOOP(width, BODY) \
+  VI_SPAN_LOOP(V_SPANS(float##width##_t, float##width##_t), \
+               float##width##_t &vd = vd_span[i]; \
+               float##width##_t vs2 = vs2_span[i];, BODY)
+
+#define VI_VFP_SPAN_SEW_LOOP(LOOP, BODY16, BODY32, BODY64) \
+  VI_VFP_COMMON \
+  switch (P.VU.vsew) { \
+    case e16: \
+      LOOP(16, BODY16) \
+      break; \
+    case e32: \
+      LOOP(32, BODY32) \
+      break; \
+    case e64: \
+      LOOP(64, BODY64) \
+      break; \
+    default: \
+      require(0); \
+      break; \
+  }; \
+  P.VU.vstart->write(0);
+
 #define VI_VFP_LOOP_CMP_BASE \
   VI_VFP_COMMON \
-  for (reg_t i = P.VU.vstart->read(); i < vl; ++i) { \
-    VI_LOOP_ELEMENT_SKIP(); \
-    uint64_t mmask = UINT64_C(1) << mpos; \
-    uint64_t &vd = P.VU.elt<uint64_t>(rd_num, midx, true); \
-    uint64_t res = 0;
+  VI_MASK_RESULT_LOOP_BASE
 
 #define VI_VFP_LOOP_REDUCTION_BASE(width) \
   float##width##_t vd_0 = P.VU.elt<float##width##_t>(rd_num, 0); \
@@ -1572,74 +1986,21 @@ reg_t index[P.VU.vlmax]; \
   }
 
 #define VI_VFP_LOOP_CMP_END \
-  switch (P.VU.vsew) { \
-    case e16: \
-    case e32: \
-    case e64: { \
-      vd = (vd & ~mmask) | (((res) << mpos) & mmask); \
-      break; \
-    } \
-    default: \
-      require(0); \
-      break; \
-    }; \
-  } \
-  P.VU.vstart->write(0);
+  VI_MASK_RESULT_LOOP_END
 
 #define VI_VFP_VV_LOOP(BODY16, BODY32, BODY64) \
   VI_CHECK_SSS(true); \
-  VI_VFP_LOOP_BASE \
-  switch (P.VU.vsew) { \
-    case e16: { \
-      VFP_VV_PARAMS(16); \
-      BODY16; \
-      set_fp_exceptions; \
-      break; \
-    } \
-    case e32: { \
-      VFP_VV_PARAMS(32); \
-      BODY32; \
-      set_fp_exceptions; \
-      break; \
-    } \
-    case e64: { \
-      VFP_VV_PARAMS(64); \
-      BODY64; \
-      set_fp_exceptions; \
-      break; \
-    } \
-    default: \
-      require(0); \
-      break; \
-  }; \
-  DEBUG_RVV_FP_VV; \
-  VI_VFP_LOOP_END
+  VI_VFP_SPAN_SEW_LOOP(VFP_VV_SPAN_LOOP, \
+                       BODY16; set_fp_exceptions; DEBUG_RVV_FP_VV, \
+                       BODY32; set_fp_exceptions; DEBUG_RVV_FP_VV, \
+                       BODY64; set_fp_exceptions; DEBUG_RVV_FP_VV)
 
 #define VI_VFP_V_LOOP(BODY16, BODY32, BODY64) \
   VI_CHECK_SSS(false); \
-  VI_VFP_LOOP_BASE \
-  switch (P.VU.vsew) { \
-    case e16: { \
-      VFP_V_PARAMS(16); \
-      BODY16; \
-      break; \
-    } \
-    case e32: { \
-      VFP_V_PARAMS(32); \
-      BODY32; \
-      break; \
-    } \
-    case e64: { \
-      VFP_V_PARAMS(64); \
-      BODY64; \
-      break; \
-    } \
-    default: \
-      require(0); \
-      break; \
-  }; \
-  set_fp_exceptions; \
-  VI_VFP_LOOP_END
+  VI_VFP_SPAN_SEW_LOOP(VFP_V_SPAN_LOOP, \
+                       BODY16; set_fp_exceptions, \
+                       BODY32; set_fp_exceptions, \
+                       BODY64; set_fp_exceptions)
 
 #define VI_VFP_VV_LOOP_REDUCTION(BODY16, BODY32, BODY64) \
   VI_CHECK_REDUCTION(false) \
@@ -1707,32 +2068,99 @@ reg_t index[P.VU.vlmax]; \
 
 #define VI_VFP_VF_LOOP(BODY16, BODY32, BODY64) \
   VI_CHECK_SSS(false); \
-  VI_VFP_LOOP_BASE \
-  switch (P.VU.vsew) { \
-    case e16: { \
-      VFP_VF_PARAMS(16); \
-      BODY16; \
-      set_fp_exceptions; \
-      break; \
-    } \
-    case e32: { \
-      VFP_VF_PARAMS(32); \
-      BODY32; \
-      set_fp_exceptions; \
-      break; \
-    } \
-    case e64: { \
-      VFP_VF_PARAMS(64); \
-      BODY64; \
-      set_fp_exceptions; \
-      break; \
-    } \
-    default: \
-      require(0); \
-      break; \
-  }; \
-  DEBUG_RVV_FP_VF; \
-  VI_VFP_LOOP_END
+  VI_VFP_SPAN_SEW_LOOP(VFP_VF_SPAN_LOOP, \
+                       BODY16; set_fp_exceptions; DEBUG_RVV_FP_VF, \
+                       BODY32; set_fp_exceptions; DEBUG_RVV_FP_VF, \
+                       BODY64; set_fp_exceptions; DEBUG_RVV_FP_VF)
+
+// Unmasked single- and double-precision operations starting at element 0
+// are handed whole to a batched kernel from v_ext_kernels.h, and fflags is
+// updated once for the group; half precision and everything else run the
+// BODYs element by element.
+#define VI_VFP_KERNEL_OK \
+  (VI_KERNEL_OK && !DEBUG_RVV && (P.VU.vsew == e32 || P.VU.vsew == e64))
+
+#define VFP_VV_KERNEL_CALL(OP, width) \
+  vk_fp_vv(OP, &P.VU.elt_group<float##width##_t>(rd_num, 0, vl, true)[0], \
+           &P.VU.elt_group<float##width##_t>(rs2_num, 0, vl)[0], \
+           &P.VU.elt_group<float##width##_t>(rs1_num, 0, vl)[0], vl); \
+  VI_AGNOSTIC_FILL(sizeof(float##width##_t))
+
+#define VFP_VF_KERNEL_CALL(OP, width) \
+  vk_fp_vf(OP, &P.VU.elt_group<float##width##_t>(rd_num, 0, vl, true)[0], \
+           &P.VU.elt_group<float##width##_t>(rs2_num, 0, vl)[0], \
+           f##width(READ_FREG(rs1_num)), vl); \
+  VI_AGNOSTIC_FILL(sizeof(float##width##_t))
+
+#define VFP_V_KERNEL_CALL(OP, width) \
+  vk_fp_vf(OP, &P.VU.elt_group<float##width##_t>(rd_num, 0, vl, true)[0], \
+           &P.VU.elt_group<float##width##_t>(rs2_num, 0, vl)[0], \
+           float##width##_t{0}, vl); \
+  VI_AGNOSTIC_FILL(sizeof(float##width##_t))
+
+#define VI_VFP_KERNEL_SEW_LOOP(CALL, OP) \
+  VI_VFP_COMMON \
+  if (P.VU.vsew == e32) { \
+    CALL(OP, 32) \
+  } else { \
+    CALL(OP, 64) \
+  } \
+  set_fp_exceptions; \
+  P.VU.vstart->write(0);
+
+#define VI_VFP_VV_KERNEL_LOOP(OP, BODY16, BODY32, BODY64) \
+  if (VI_VFP_KERNEL_OK) { \
+    VI_CHECK_SSS(true); \
+    VI_VFP_KERNEL_SEW_LOOP(VFP_VV_KERNEL_CALL, OP) \
+  } else { \
+    VI_VFP_VV_LOOP(BODY16, BODY32, BODY64) \
+  }
+
+#define VI_VFP_VF_KERNEL_LOOP(OP, BODY16, BODY32, BODY64) \
+  if (VI_VFP_KERNEL_OK) { \
+    VI_CHECK_SSS(false); \
+    VI_VFP_KERNEL_SEW_LOOP(VFP_VF_KERNEL_CALL, OP) \
+  } else { \
+    VI_VFP_VF_LOOP(BODY16, BODY32, BODY64) \
+  }
+
+#define VI_VFP_V_KERNEL_LOOP(OP, BODY16, BODY32, BODY64) \
+  if (VI_VFP_KERNEL_OK) { \
+    VI_CHECK_SSS(false); \
+    VI_VFP_KERNEL_SEW_LOOP(VFP_V_KERNEL_CALL, OP) \
+  } else { \
+    VI_VFP_V_LOOP(BODY16, BODY32, BODY64) \
+  }
+
+// Reductions take the kernel only with an active element, so that vd[0]
+// always gets the folded value rather than a propagated vs1[0].
+#define VFP_RED_KERNEL_CALL(OP, width) \
+  P.VU.elt<float##width##_t>(rd_num, 0, true) = \
+    vk_fp_red(OP, &P.VU.elt_group<float##width##_t>(rs2_num, 0, vl)[0], \
+              P.VU.elt<float##width##_t>(rs1_num, 0), vl);
+
+#define VI_VFP_VV_REDUCTION_KERNEL_LOOP(OP, BODY16, BODY32, BODY64) \
+  if (VI_VFP_KERNEL_OK && P.VU.vl->read() > 0) { \
+    VI_CHECK_REDUCTION(false) \
+    VI_VFP_KERNEL_SEW_LOOP(VFP_RED_KERNEL_CALL, OP) \
+  } else { \
+    VI_VFP_VV_LOOP_REDUCTION(BODY16, BODY32, BODY64) \
+  }
+
+// Only single to double precision has a kernel.
+#define VI_VFP_VV_WIDE_REDUCTION_KERNEL_LOOP(BODY16, BODY32) \
+  if (VI_KERNEL_OK && !DEBUG_RVV && P.VU.vsew == e32 && P.VU.vl->read() > 0) { \
+    VI_CHECK_REDUCTION(true) \
+    VI_VFP_COMMON \
+    require(p->extension_enabled('D')); \
+    P.VU.elt<float64_t>(rd_num, 0, true) = \
+      vk_fp_wred(&P.VU.elt_group<float32_t>(rs2_num, 0, vl)[0], \
+                 P.VU.elt<float64_t>(rs1_num, 0), vl); \
+    set_fp_exceptions; \
+    P.VU.vstart->write(0); \
+  } else { \
+    VI_VFP_VV_LOOP_WIDE_REDUCTION(BODY16, BODY32) \
+  }
 
 #define VI_VFP_VV_LOOP_CMP(BODY16, BODY32, BODY64) \
   VI_CHECK_MSS(true); \
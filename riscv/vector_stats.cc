@@ -0,0 +1,99 @@
+// See LICENSE for license details.
+
+#include "vector_stats.h"
+#include "processor.h"
+#include "arith.h"
+#include <cinttypes>
+
+#define OP_LOAD_FP	0x07
+#define OP_STORE_FP	0x27
+#define OP_V	0x57
+
+#define OPIVV	0
+#define OPFVV	1
+#define OPMVV	2
+#define OPIVI	3
+#define OPIVX	4
+#define OPFVF	5
+#define OPMVX	6
+#define OPCFG	7
+
+// Instructions whose vm bit selects v0 as an operand rather than as a mask:
+// vadc, vmadc, vsbc, vmsbc, and vmerge and vfmerge.
+static bool v0_is_operand(insn_bits_t bits)
+{
+  unsigned funct3 = (bits >> 12) & 7, funct6 = bits >> 26;
+  if ((bits & 0x7f) != OP_V || funct3 == OPMVV || funct3 == OPMVX || funct3 == OPCFG)
+    return false;
+  if (funct3 == OPFVV || funct3 == OPFVF)
+    return funct6 == 0x17;
+  return (funct6 >= 0x10 && funct6 <= 0x13) || funct6 == 0x17;
+}
+
+void vector_stats_t::retire(insn_t insn)
+{
+  insn_bits_t bits = insn.bits();
+  class_t cls;
+  switch (bits & 0x7f) {
+    case OP_LOAD_FP:
+    case OP_STORE_FP: {
+      // Widths 1-4 are scalar floating point.
+      unsigned width = (bits >> 12) & 7;
+      if (width != 0 && width < 5)
+        return;
+      cls = (bits & 0x7f) == OP_LOAD_FP ? LOAD : STORE;
+      break;
+    }
+    case OP_V:
+      switch ((bits >> 12) & 7) {
+        case OPIVV: case OPIVI: case OPIVX: cls = INT; break;
+        case OPMVV: case OPMVX: cls = MUL_RED_MASK; break;
+        case OPFVV: case OPFVF: cls = FP; break;
+        default: cls = VSETVL; break;
+      }
+      break;
+    default:
+      return;
+  }
+
+  auto& VU = proc->VU;
+  if (VU.vill)
+    return;
+  reg_t vl = VU.vl->read(), vlmax = VU.vlmax;
+  counts_t& c = counts[cls][VU.vtype->read() & 0x3f];
+  c.insns++;
+  c.elements += vl;
+  c.vlmax_elements += vlmax;
+  c.tail += vlmax > vl ? vlmax - vl : 0;
+
+  // Masks are read from v0's storage directly, since reading it through
+  // elt() would mark it referenced for the commit log.
+  if (cls != VSETVL && ((bits >> 25) & 1) == 0 && !v0_is_operand(bits)) {
+    const uint64_t* v0 = (const uint64_t*)VU.reg_file;
+    uint64_t active = 0;
+    for (reg_t i = 0; i < vl; i += 64) {
+      uint64_t word = v0[i / 64];
+      active += popcount(vl - i >= 64 ? word : word & ((uint64_t(1) << (vl - i)) - 1));
+    }
+    c.masked_off += vl - active;
+  }
+}
+
+void vector_stats_t::write(FILE* f, uint32_t hart)
+{
+  static const char* const classes[] = {"load", "store", "int", "mul-red-mask", "fp", "vsetvl"};
+  static const char* const lmuls[] = {"1", "2", "4", "8", "", "1/8", "1/4", "1/2"};
+  for (int cls = 0; cls < NUM_CLASSES; cls++) {
+    for (int vtype = 0; vtype < 64; vtype++) {
+      const counts_t& c = counts[cls][vtype];
+      if (c.insns == 0)
+        continue;
+      fprintf(f, "%" PRIu32 ",%s,%d,%s,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%.4f,%.4f,%.4f\n",
+              hart, classes[cls], 8 << (vtype >> 3), lmuls[vtype & 7], c.insns, c.elements,
+              c.vlmax_elements, c.masked_off, c.tail,
+              c.vlmax_elements ? double(c.elements) / c.vlmax_elements : 0.0,
+              c.elements ? double(c.masked_off) / c.elements : 0.0,
+              c.vlmax_elements ? double(c.tail) / c.vlmax_elements : 0.0);
+    }
+  }
+}
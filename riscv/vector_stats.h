@@ -0,0 +1,46 @@
+// See LICENSE for license details.
+#ifndef _RISCV_VECTOR_STATS_H
+#define _RISCV_VECTOR_STATS_H
+
+#include "decode.h"
+#include <cstdio>
+
+class processor_t;
+
+// Counts how well one hart's vector instructions use the vector unit, per
+// class of instruction and per SEW and LMUL: how many ran, how many
+// elements they processed (vl) against how many they could have (VLMAX),
+// how many of those elements a mask turned off, and how many were tail.
+// vsetvl, vsetvli and vsetivli are counted under the vtype they set, so
+// their rows show how often code moves to each SEW and LMUL.
+class vector_stats_t
+{
+public:
+  vector_stats_t(processor_t* proc) : proc(proc), counts() {}
+
+  // Called after each vector instruction retires.  A trapping instruction
+  // does not retire, so a fault-only-first load counts once, with the vl it
+  // trimmed to.
+  void retire(insn_t insn);
+  // Writes a CSV row per class and vtype seen, as
+  // hart,class,sew,lmul,insns,elements,vlmax_elements,masked_off,tail,
+  // vl_utilization,masked_off_ratio,tail_ratio.
+  void write(FILE* f, uint32_t hart);
+
+private:
+  enum class_t { LOAD, STORE, INT, MUL_RED_MASK, FP, VSETVL, NUM_CLASSES };
+
+  struct counts_t {
+    uint64_t insns;
+    uint64_t elements;        // sum of vl
+    uint64_t vlmax_elements;  // sum of VLMAX
+    uint64_t masked_off;      // of elements, those v0 turned off
+    uint64_t tail;            // sum of VLMAX - vl
+  };
+
+  processor_t* proc;
+  // By class and by vtype's vsew and vlmul fields
+  counts_t counts[NUM_CLASSES][64];
+};
+
+#endif
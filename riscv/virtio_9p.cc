@@ -0,0 +1,875 @@
+#include "devices.h"
+#include "simif.h"
+#include "mmu.h"
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define VIRTIO_ID_9P	9
+
+#define VIRTIO_9P_F_MOUNT_TAG	(1ull << 0)
+
+// 9P2000.L messages; each reply's type is its request's plus one.
+#define P9_RLERROR	7
+#define P9_TSTATFS	8
+#define P9_TLOPEN	12
+#define P9_TLCREATE	14
+#define P9_TSYMLINK	16
+#define P9_TREADLINK	22
+#define P9_TGETATTR	24
+#define P9_TSETATTR	26
+#define P9_TXATTRWALK	30
+#define P9_TREADDIR	40
+#define P9_TFSYNC	50
+#define P9_TLOCK	52
+#define P9_TGETLOCK	54
+#define P9_TLINK	70
+#define P9_TMKDIR	72
+#define P9_TRENAMEAT	74
+#define P9_TUNLINKAT	76
+#define P9_TVERSION	100
+#define P9_TATTACH	104
+#define P9_TFLUSH	108
+#define P9_TWALK	110
+#define P9_TREAD	116
+#define P9_TWRITE	118
+#define P9_TCLUNK	120
+#define P9_TREMOVE	122
+
+#define P9_HDR_SIZE	7  // size[4] type[1] tag[2]
+#define P9_TWRITE_SIZE	(P9_HDR_SIZE + 16)  // fid[4] offset[8] count[4]
+#define P9_RREAD_SIZE	(P9_HDR_SIZE + 4)  // count[4]
+#define P9_MAX_MSIZE	(1 << 20)
+
+#define P9_QTDIR	0x80
+#define P9_QTSYMLINK	0x02
+#define P9_GETATTR_BASIC	0x7ffull
+#define P9_LOCK_SUCCESS	0
+#define P9_LOCK_TYPE_UNLCK	2
+#define P9_STATFS_MAGIC	0x01021997
+
+#define P9_DOTL_ACCMODE	03
+#define P9_DOTL_CREATE	0100
+#define P9_DOTL_EXCL	0200
+#define P9_DOTL_TRUNC	01000
+#define P9_DOTL_APPEND	02000
+#define P9_DOTL_DSYNC	010000
+#define P9_DOTL_SYNC	04000000
+#define P9_AT_REMOVEDIR	0x200
+
+#define P9_SETATTR_MODE	0x1
+#define P9_SETATTR_UID	0x2
+#define P9_SETATTR_GID	0x4
+#define P9_SETATTR_SIZE	0x8
+#define P9_SETATTR_ATIME	0x10
+#define P9_SETATTR_MTIME	0x20
+#define P9_SETATTR_ATIME_SET	0x80
+#define P9_SETATTR_MTIME_SET	0x100
+
+struct virtio_9p_t::fid_t {
+  std::string path;  // guarded by fids_lock
+  int fd = -1;
+  DIR* dir = NULL;
+  uint64_t dir_pos = 0;  // the index of the next entry dir reads
+  std::mutex lock;       // guards fd, dir and dir_pos
+
+  ~fid_t()
+  {
+    if (dir)
+      closedir(dir);
+    else if (fd >= 0)
+      close(fd);
+  }
+};
+
+// A message too short for its fields
+struct p9_short_t {};
+
+class p9_reader_t {
+ public:
+  p9_reader_t(const std::vector<uint8_t>& msg) : msg(msg), pos(0) {}
+
+  template<class T> T get()
+  {
+    T val;
+    if (pos + sizeof(T) > msg.size())
+      throw p9_short_t();
+    memcpy(&val, &msg[pos], sizeof(T));
+    pos += sizeof(T);
+    return val;
+  }
+
+  std::string str()
+  {
+    uint16_t len = get<uint16_t>();
+    if (pos + len > msg.size())
+      throw p9_short_t();
+    std::string s((const char*)&msg[pos], len);
+    pos += len;
+    return s;
+  }
+
+ private:
+  const std::vector<uint8_t>& msg;
+  size_t pos;
+};
+
+class p9_writer_t {
+ public:
+  p9_writer_t(std::vector<uint8_t>& msg) : msg(msg) {}
+
+  template<class T> void put(T val)
+  {
+    const uint8_t* p = (const uint8_t*)&val;
+    msg.insert(msg.end(), p, p + sizeof(T));
+  }
+
+  void str(const std::string& s)
+  {
+    put<uint16_t>(s.size());
+    msg.insert(msg.end(), s.begin(), s.end());
+  }
+
+  void qid(uint8_t type, uint64_t path)
+  {
+    put<uint8_t>(type);
+    put<uint32_t>(0);  // version, which would only matter to a caching client
+    put<uint64_t>(path);
+  }
+
+  void qid(const struct stat& st)
+  {
+    qid(S_ISDIR(st.st_mode) ? P9_QTDIR : S_ISLNK(st.st_mode) ? P9_QTSYMLINK : 0, st.st_ino);
+  }
+
+ private:
+  std::vector<uint8_t>& msg;
+};
+
+static void copy_from(const std::vector<std::pair<uint8_t*, size_t>>& bufs, size_t offset, uint8_t* dst, size_t len)
+{
+  for (auto& b : bufs) {
+    if (len == 0)
+      break;
+    if (offset >= b.second) {
+      offset -= b.second;
+      continue;
+    }
+    size_t n = std::min(len, b.second - offset);
+    memcpy(dst, b.first + offset, n);
+    dst += n;
+    len -= n;
+    offset = 0;
+  }
+}
+
+static void copy_to(const std::vector<std::pair<uint8_t*, size_t>>& bufs, size_t offset, const uint8_t* src, size_t len)
+{
+  for (auto& b : bufs) {
+    if (len == 0)
+      break;
+    if (offset >= b.second) {
+      offset -= b.second;
+      continue;
+    }
+    size_t n = std::min(len, b.second - offset);
+    memcpy(b.first + offset, src, n);
+    src += n;
+    len -= n;
+    offset = 0;
+  }
+}
+
+// The iovecs of [offset, offset + len) of bufs
+static void slice(const std::vector<std::pair<uint8_t*, size_t>>& bufs, size_t offset, size_t len,
+                  std::vector<struct iovec>& iov)
+{
+  for (auto& b : bufs) {
+    if (len == 0 || iov.size() == IOV_MAX)
+      break;
+    if (offset >= b.second) {
+      offset -= b.second;
+      continue;
+    }
+    size_t n = std::min(len, b.second - offset);
+    iov.push_back({b.first + offset, n});
+    len -= n;
+    offset = 0;
+  }
+}
+
+static std::string join(const std::string& dir, const std::string& name)
+{
+  return dir.empty() ? name : dir + "/" + name;
+}
+
+static bool valid_name(const std::string& name)
+{
+  return !name.empty() && name != "." && name != ".." && name.find('/') == std::string::npos;
+}
+
+static int host_open_flags(uint32_t flags)
+{
+  int host = 0;
+  switch (flags & P9_DOTL_ACCMODE) {
+    case 0: host = O_RDONLY; break;
+    case 1: host = O_WRONLY; break;
+    default: host = O_RDWR; break;
+  }
+  if (flags & P9_DOTL_CREATE) host |= O_CREAT;
+  if (flags & P9_DOTL_EXCL) host |= O_EXCL;
+  if (flags & P9_DOTL_TRUNC) host |= O_TRUNC;
+  if (flags & P9_DOTL_APPEND) host |= O_APPEND;
+  if (flags & P9_DOTL_DSYNC) host |= O_DSYNC;
+  if (flags & P9_DOTL_SYNC) host |= O_SYNC;
+  return host | O_NOFOLLOW;
+}
+
+virtio_9p_t::virtio_9p_t(const std::string& args)
+  : virtio_mmio_t(VIRTIO_ID_9P, VIRTIO_9P_F_MOUNT_TAG, 1, QUEUE_SIZE),
+    tag("spike"), in_flight(0), workers_exit(false)
+{
+  root = args;
+  size_t comma = args.find(",tag=");
+  if (comma != std::string::npos) {
+    root = args.substr(0, comma);
+    tag = args.substr(comma + 5);
+  }
+  while (root.size() > 1 && root.back() == '/')
+    root.pop_back();
+
+  struct stat st;
+  if (stat(root.c_str(), &st) != 0)
+    throw std::runtime_error("could not export directory " + root + ": " + strerror(errno));
+  if (!S_ISDIR(st.st_mode))
+    throw std::runtime_error("could not export " + root + ": not a directory");
+  if (tag.empty() || tag.size() > UINT16_MAX)
+    throw std::runtime_error("bad virtio-9p mount tag " + tag);
+
+  for (size_t i = 0; i < NUM_WORKERS; i++)
+    workers.emplace_back(&virtio_9p_t::worker_main, this);
+}
+
+virtio_9p_t::~virtio_9p_t()
+{
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    workers_exit = true;
+  }
+  work_ready.notify_all();
+  for (auto& w : workers)
+    w.join();
+  for (auto req : submitted)
+    delete req;
+  for (auto req : finished)
+    delete req;
+  for (auto& f : flushes)
+    delete f.first;
+}
+
+// Waits out the requests still with the workers, since they hold pointers
+// into the guest's buffers, and drops their replies and every fid.
+void virtio_9p_t::reset_device()
+{
+  {
+    std::unique_lock<std::mutex> guard(lock);
+    drained.wait(guard, [&]{ return in_flight == 0; });
+    for (auto req : finished)
+      delete req;
+    finished.clear();
+    for (auto& f : flushes)
+      delete f.first;
+    flushes.clear();
+    active_tags.clear();
+  }
+  std::lock_guard<std::mutex> guard(fids_lock);
+  fids.clear();
+}
+
+bool virtio_9p_t::load_config(reg_t offset, size_t len, uint8_t* bytes)
+{
+  // struct virtio_9p_config: the tag's length, then the tag
+  std::vector<uint8_t> config(2 + tag.size());
+  uint16_t tag_len = tag.size();
+  memcpy(&config[0], &tag_len, 2);
+  memcpy(&config[2], tag.data(), tag.size());
+  if (offset + len > config.size())
+    return false;
+  memcpy(bytes, &config[offset], len);
+  return true;
+}
+
+void virtio_9p_t::notify(size_t q)
+{
+  uint16_t head;
+  while (peek_avail(queues[0], &head)) {
+    queues[0].last_avail++;
+    submit(head);
+  }
+}
+
+void virtio_9p_t::submit(uint16_t head)
+{
+  request_t* req = new request_t{head, 0, 0, {}, {}, 0, 0, 0};
+
+  std::vector<desc_t> chain;
+  read_chain(queues[0], head, chain);
+  bool mapped = true;
+  for (auto& d : chain) {
+    mapped = mapped && map_guest(d.addr, d.len, d.write ? req->out : req->in);
+    (d.write ? req->out_len : req->in_len) += d.len;
+  }
+
+  uint8_t hdr[P9_HDR_SIZE + 2];
+  if (!mapped || req->in_len < P9_HDR_SIZE || req->out_len < P9_HDR_SIZE + 4) {
+    // Without a message and room for an error there is no reply to make.
+    std::lock_guard<std::mutex> guard(lock);
+    finished.push_back(req);
+    return;
+  }
+  copy_from(req->in, 0, hdr, std::min(req->in_len, sizeof(hdr)));
+  req->type = hdr[4];
+  memcpy(&req->tag, hdr + 5, 2);
+
+  std::lock_guard<std::mutex> guard(lock);
+  if (req->type == P9_TFLUSH && req->in_len >= sizeof(hdr)) {
+    uint16_t old_tag;
+    memcpy(&old_tag, hdr + P9_HDR_SIZE, 2);
+    uint8_t reply[P9_HDR_SIZE] = {P9_HDR_SIZE, 0, 0, 0, P9_TFLUSH + 1};
+    memcpy(reply + 5, &req->tag, 2);
+    copy_to(req->out, 0, reply, sizeof(reply));
+    req->written = sizeof(reply);
+    flushes.emplace_back(req, old_tag);
+    return;
+  }
+  submitted.push_back(req);
+  active_tags.insert(req->tag);
+  in_flight++;
+  work_ready.notify_one();
+}
+
+void virtio_9p_t::worker_main()
+{
+  std::unique_lock<std::mutex> guard(lock);
+  while (true) {
+    work_ready.wait(guard, [&]{ return workers_exit || !submitted.empty(); });
+    if (workers_exit)
+      return;
+    request_t* req = submitted.front();
+    submitted.pop_front();
+
+    guard.unlock();
+    execute(req);
+    guard.lock();
+
+    finished.push_back(req);
+    active_tags.erase(active_tags.find(req->tag));
+    if (--in_flight == 0)
+      drained.notify_all();
+  }
+}
+
+// Runs on a worker thread.  A write's data is left in the guest's buffers,
+// from which it goes straight to the file.
+void virtio_9p_t::execute(request_t* req)
+{
+  size_t len = req->type == P9_TWRITE ? P9_TWRITE_SIZE : std::min<size_t>(req->in_len, P9_MAX_MSIZE);
+  std::vector<uint8_t> msg(std::min(len, req->in_len) - P9_HDR_SIZE);
+  copy_from(req->in, P9_HDR_SIZE, msg.data(), msg.size());
+
+  std::vector<uint8_t> reply;
+  size_t extra = 0;
+  uint8_t type = req->type + 1;
+  int err;
+  try {
+    err = serve(req, msg, reply, &extra);
+  } catch (p9_short_t&) {
+    err = EINVAL;
+  }
+  if (err != 0) {
+    reply.clear();
+    p9_writer_t(reply).put<uint32_t>(err);
+    type = P9_RLERROR;
+    extra = 0;
+  }
+
+  uint8_t hdr[P9_HDR_SIZE];
+  uint32_t size = P9_HDR_SIZE + reply.size() + extra;
+  memcpy(hdr, &size, 4);
+  hdr[4] = type;
+  memcpy(hdr + 5, &req->tag, 2);
+  copy_to(req->out, 0, hdr, sizeof(hdr));
+  copy_to(req->out, P9_HDR_SIZE, reply.data(), reply.size());
+  req->written = std::min<size_t>(size, req->out_len);
+}
+
+std::shared_ptr<virtio_9p_t::fid_t> virtio_9p_t::lookup(uint32_t id, std::string* path)
+{
+  std::lock_guard<std::mutex> guard(fids_lock);
+  auto it = fids.find(id);
+  if (it == fids.end())
+    return NULL;
+  if (path)
+    *path = it->second->path;
+  return it->second;
+}
+
+// Moves the fids at or below from to the same place below to, as the
+// client expects after a rename.
+void virtio_9p_t::rename_fids(const std::string& from, const std::string& to)
+{
+  std::lock_guard<std::mutex> guard(fids_lock);
+  for (auto& it : fids) {
+    std::string& path = it.second->path;
+    if (path == from)
+      path = to;
+    else if (path.compare(0, from.size() + 1, from + "/") == 0)
+      path = to + path.substr(from.size());
+  }
+}
+
+int virtio_9p_t::serve(request_t* req, const std::vector<uint8_t>& msg, std::vector<uint8_t>& reply, size_t* extra)
+{
+  p9_reader_t in(msg);
+  p9_writer_t out(reply);
+  std::shared_ptr<fid_t> f;
+  std::string path;
+  struct stat st;
+
+  switch (req->type) {
+    case P9_TVERSION: {
+      uint32_t msize = in.get<uint32_t>();
+      std::string version = in.str();
+      {
+        std::lock_guard<std::mutex> guard(fids_lock);
+        fids.clear();
+      }
+      out.put<uint32_t>(std::min<uint32_t>(msize, P9_MAX_MSIZE));
+      out.str(version == "9P2000.L" ? version : "unknown");
+      return 0;
+    }
+
+    case P9_TATTACH: {
+      uint32_t fid = in.get<uint32_t>();
+      if (lstat(root.c_str(), &st) != 0)
+        return errno;
+      std::lock_guard<std::mutex> guard(fids_lock);
+      fids[fid] = std::make_shared<fid_t>();
+      out.qid(st);
+      return 0;
+    }
+
+    case P9_TWALK: {
+      uint32_t fid = in.get<uint32_t>(), newfid = in.get<uint32_t>();
+      uint16_t nwname = in.get<uint16_t>();
+      std::vector<std::string> names;
+      for (uint16_t i = 0; i < nwname; i++)
+        names.push_back(in.str());
+      if (!(f = lookup(fid, &path)))
+        return EBADF;
+
+      std::vector<struct stat> qids;
+      for (auto& name : names) {
+        // Each step is from a directory, so the walk follows no symlink.
+        int err = 0;
+        std::string next;
+        if (lstat(host_path(path).c_str(), &st) != 0)
+          err = errno;
+        else if (!S_ISDIR(st.st_mode))
+          err = ENOTDIR;
+        else if (name == "..")
+          next = path.rfind('/') == std::string::npos ? "" : path.substr(0, path.rfind('/'));
+        else if (name == ".")
+          next = path;
+        else if (valid_name(name))
+          next = join(path, name);
+        else
+          err = ENOENT;
+        if (err == 0 && lstat(host_path(next).c_str(), &st) != 0)
+          err = errno;
+        if (err != 0) {
+          if (qids.empty())
+            return err;
+          break;
+        }
+        path = next;
+        qids.push_back(st);
+      }
+
+      if (qids.size() == names.size()) {
+        std::lock_guard<std::mutex> guard(fids_lock);
+        fids[newfid] = std::make_shared<fid_t>();
+        fids[newfid]->path = path;
+      }
+      out.put<uint16_t>(qids.size());
+      for (auto& q : qids)
+        out.qid(q);
+      return 0;
+    }
+
+    case P9_TGETATTR: {
+      if (!(f = lookup(in.get<uint32_t>(), &path)))
+        return EBADF;
+      if (lstat(host_path(path).c_str(), &st) != 0)
+        return errno;
+      out.put<uint64_t>(P9_GETATTR_BASIC);
+      out.qid(st);
+      out.put<uint32_t>(st.st_mode);
+      out.put<uint32_t>(st.st_uid);
+      out.put<uint32_t>(st.st_gid);
+      out.put<uint64_t>(st.st_nlink);
+      out.put<uint64_t>(st.st_rdev);
+      out.put<uint64_t>(st.st_size);
+      out.put<uint64_t>(st.st_blksize);
+      out.put<uint64_t>(st.st_blocks);
+      out.put<uint64_t>(st.st_atim.tv_sec);
+      out.put<uint64_t>(st.st_atim.tv_nsec);
+      out.put<uint64_t>(st.st_mtim.tv_sec);
+      out.put<uint64_t>(st.st_mtim.tv_nsec);
+      out.put<uint64_t>(st.st_ctim.tv_sec);
+      out.put<uint64_t>(st.st_ctim.tv_nsec);
+      for (int i = 0; i < 4; i++)
+        out.put<uint64_t>(0);  // btime, gen and data_version, which are not valid
+      return 0;
+    }
+
+    case P9_TSETATTR: {
+      uint32_t fid = in.get<uint32_t>(), valid = in.get<uint32_t>(), mode = in.get<uint32_t>();
+      uint32_t uid = in.get<uint32_t>(), gid = in.get<uint32_t>();
+      uint64_t size = in.get<uint64_t>();
+      struct timespec times[2];
+      for (auto& t : times) {
+        t.tv_sec = in.get<uint64_t>();
+        t.tv_nsec = in.get<uint64_t>();
+      }
+      if (!(f = lookup(fid, &path)))
+        return EBADF;
+      std::string host = host_path(path);
+
+      if ((valid & P9_SETATTR_MODE) && chmod(host.c_str(), mode & 07777) != 0)
+        return errno;
+      // The simulator's user may not give files away, and the guest need
+      // not know that.
+      if ((valid & (P9_SETATTR_UID | P9_SETATTR_GID)) &&
+          lchown(host.c_str(), (valid & P9_SETATTR_UID) ? uid : -1, (valid & P9_SETATTR_GID) ? gid : -1) != 0)
+        errno = 0;
+      if ((valid & P9_SETATTR_SIZE) && truncate(host.c_str(), size) != 0)
+        return errno;
+      if (valid & (P9_SETATTR_ATIME | P9_SETATTR_MTIME)) {
+        if (!(valid & P9_SETATTR_ATIME))
+          times[0].tv_nsec = UTIME_OMIT;
+        else if (!(valid & P9_SETATTR_ATIME_SET))
+          times[0].tv_nsec = UTIME_NOW;
+        if (!(valid & P9_SETATTR_MTIME))
+          times[1].tv_nsec = UTIME_OMIT;
+        else if (!(valid & P9_SETATTR_MTIME_SET))
+          times[1].tv_nsec = UTIME_NOW;
+        if (utimensat(AT_FDCWD, host.c_str(), times, AT_SYMLINK_NOFOLLOW) != 0)
+          return errno;
+      }
+      return 0;
+    }
+
+    case P9_TLOPEN: {
+      uint32_t fid = in.get<uint32_t>(), flags = in.get<uint32_t>();
+      if (!(f = lookup(fid, &path)))
+        return EBADF;
+      std::string host = host_path(path);
+      if (lstat(host.c_str(), &st) != 0)
+        return errno;
+      std::lock_guard<std::mutex> guard(f->lock);
+      if (f->fd >= 0)
+        return EBADF;
+      f->fd = S_ISDIR(st.st_mode) ? open(host.c_str(), O_RDONLY | O_DIRECTORY) :
+                                    open(host.c_str(), host_open_flags(flags & ~P9_DOTL_CREATE));
+      if (f->fd < 0)
+        return errno;
+      out.qid(st);
+      out.put<uint32_t>(0);  // iounit: as much as msize allows
+      return 0;
+    }
+
+    case P9_TLCREATE: {
+      uint32_t fid = in.get<uint32_t>();
+      std::string name = in.str();
+      uint32_t flags = in.get<uint32_t>(), mode = in.get<uint32_t>();
+      if (!(f = lookup(fid, &path)))
+        return EBADF;
+      if (!valid_name(name))
+        return EINVAL;
+      std::string child = join(path, name);
+      std::lock_guard<std::mutex> guard(f->lock);
+      if (f->fd >= 0)
+        return EBADF;
+      int fd = open(host_path(child).c_str(), host_open_flags(flags) | O_CREAT, mode & 07777);
+      if (fd < 0)
+        return errno;
+      fstat(fd, &st);
+      f->fd = fd;
+      {
+        std::lock_guard<std::mutex> fids_guard(fids_lock);
+        f->path = child;
+      }
+      out.qid(st);
+      out.put<uint32_t>(0);
+      return 0;
+    }
+
+    case P9_TREAD: {
+      uint32_t fid = in.get<uint32_t>();
+      uint64_t offset = in.get<uint64_t>();
+      uint32_t count = in.get<uint32_t>();
+      if (!(f = lookup(fid, NULL)))
+        return EBADF;
+      std::vector<struct iovec> iov;
+      slice(req->out, P9_RREAD_SIZE, std::min<size_t>(count, req->out_len - P9_RREAD_SIZE), iov);
+      std::lock_guard<std::mutex> guard(f->lock);
+      ssize_t n = f->fd < 0 || f->dir ? (errno = EBADF, -1) : preadv(f->fd, iov.data(), iov.size(), offset);
+      if (n < 0)
+        return errno;
+      out.put<uint32_t>(n);
+      *extra = n;
+      return 0;
+    }
+
+    case P9_TWRITE: {
+      uint32_t fid = in.get<uint32_t>();
+      uint64_t offset = in.get<uint64_t>();
+      uint32_t count = in.get<uint32_t>();
+      if (!(f = lookup(fid, NULL)))
+        return EBADF;
+      std::vector<struct iovec> iov;
+      slice(req->in, P9_TWRITE_SIZE, std::min<size_t>(count, req->in_len - P9_TWRITE_SIZE), iov);
+      std::lock_guard<std::mutex> guard(f->lock);
+      ssize_t n = f->fd < 0 || f->dir ? (errno = EBADF, -1) : pwritev(f->fd, iov.data(), iov.size(), offset);
+      if (n < 0)
+        return errno;
+      out.put<uint32_t>(n);
+      return 0;
+    }
+
+    case P9_TCLUNK:
+    case P9_TREMOVE: {
+      uint32_t fid = in.get<uint32_t>();
+      if (!(f = lookup(fid, &path)))
+        return EBADF;
+      {
+        std::lock_guard<std::mutex> guard(fids_lock);
+        fids.erase(fid);
+      }
+      if (req->type == P9_TREMOVE) {
+        std::string host = host_path(path);
+        if (lstat(host.c_str(), &st) != 0 ||
+            (S_ISDIR(st.st_mode) ? rmdir(host.c_str()) : unlink(host.c_str())) != 0)
+          return errno;
+      }
+      return 0;
+    }
+
+    case P9_TREADDIR: {
+      uint32_t fid = in.get<uint32_t>();
+      uint64_t offset = in.get<uint64_t>();
+      uint32_t count = in.get<uint32_t>();
+      if (!(f = lookup(fid, NULL)))
+        return EBADF;
+      count = std::min<size_t>(count, req->out_len - P9_RREAD_SIZE);
+
+      std::lock_guard<std::mutex> guard(f->lock);
+      if (f->fd < 0)
+        return EBADF;
+      if (!f->dir && !(f->dir = fdopendir(f->fd)))
+        return errno;
+      // An offset is the index of an entry, so reading from anywhere but
+      // where the last read stopped starts over.
+      if (offset != f->dir_pos) {
+        rewinddir(f->dir);
+        for (f->dir_pos = 0; f->dir_pos < offset && readdir(f->dir); f->dir_pos++)
+          ;
+      }
+
+      std::vector<uint8_t> entries;
+      p9_writer_t w(entries);
+      while (true) {
+        long loc = telldir(f->dir);
+        errno = 0;
+        struct dirent* e = readdir(f->dir);
+        if (!e) {
+          if (errno != 0 && entries.empty())
+            return errno;
+          break;
+        }
+        size_t name_len = strlen(e->d_name);
+        if (entries.size() + 13 + 8 + 1 + 2 + name_len > count) {
+          seekdir(f->dir, loc);
+          break;
+        }
+        w.qid(e->d_type == DT_DIR ? P9_QTDIR : e->d_type == DT_LNK ? P9_QTSYMLINK : 0, e->d_ino);
+        w.put<uint64_t>(++f->dir_pos);
+        w.put<uint8_t>(e->d_type);
+        w.str(e->d_name);
+      }
+      out.put<uint32_t>(entries.size());
+      reply.insert(reply.end(), entries.begin(), entries.end());
+      return 0;
+    }
+
+    case P9_TSTATFS: {
+      struct statvfs sv;
+      if (!(f = lookup(in.get<uint32_t>(), NULL)))
+        return EBADF;
+      if (statvfs(root.c_str(), &sv) != 0)
+        return errno;
+      out.put<uint32_t>(P9_STATFS_MAGIC);
+      out.put<uint32_t>(sv.f_bsize);
+      out.put<uint64_t>(sv.f_blocks);
+      out.put<uint64_t>(sv.f_bfree);
+      out.put<uint64_t>(sv.f_bavail);
+      out.put<uint64_t>(sv.f_files);
+      out.put<uint64_t>(sv.f_ffree);
+      out.put<uint64_t>(sv.f_fsid);
+      out.put<uint32_t>(sv.f_namemax);
+      return 0;
+    }
+
+    case P9_TMKDIR:
+    case P9_TSYMLINK: {
+      uint32_t fid = in.get<uint32_t>();
+      std::string name = in.str();
+      std::string target = req->type == P9_TSYMLINK ? in.str() : std::string();
+      uint32_t mode = req->type == P9_TMKDIR ? in.get<uint32_t>() : 0;
+      if (!(f = lookup(fid, &path)))
+        return EBADF;
+      if (!valid_name(name))
+        return EINVAL;
+      std::string host = host_path(join(path, name));
+      if ((req->type == P9_TMKDIR ? mkdir(host.c_str(), mode & 07777) : symlink(target.c_str(), host.c_str())) != 0 ||
+          lstat(host.c_str(), &st) != 0)
+        return errno;
+      out.qid(st);
+      return 0;
+    }
+
+    case P9_TREADLINK: {
+      if (!(f = lookup(in.get<uint32_t>(), &path)))
+        return EBADF;
+      char target[PATH_MAX];
+      ssize_t n = readlink(host_path(path).c_str(), target, sizeof(target));
+      if (n < 0)
+        return errno;
+      out.str(std::string(target, n));
+      return 0;
+    }
+
+    case P9_TUNLINKAT: {
+      uint32_t fid = in.get<uint32_t>();
+      std::string name = in.str();
+      uint32_t flags = in.get<uint32_t>();
+      if (!(f = lookup(fid, &path)))
+        return EBADF;
+      if (!valid_name(name))
+        return EINVAL;
+      std::string host = host_path(join(path, name));
+      if (((flags & P9_AT_REMOVEDIR) ? rmdir(host.c_str()) : unlink(host.c_str())) != 0)
+        return errno;
+      return 0;
+    }
+
+    case P9_TRENAMEAT: {
+      uint32_t old_fid = in.get<uint32_t>();
+      std::string old_name = in.str();
+      uint32_t new_fid = in.get<uint32_t>();
+      std::string new_name = in.str(), new_path;
+      if (!(f = lookup(old_fid, &path)) || !lookup(new_fid, &new_path))
+        return EBADF;
+      if (!valid_name(old_name) || !valid_name(new_name))
+        return EINVAL;
+      std::string from = join(path, old_name), to = join(new_path, new_name);
+      if (rename(host_path(from).c_str(), host_path(to).c_str()) != 0)
+        return errno;
+      rename_fids(from, to);
+      return 0;
+    }
+
+    case P9_TLINK: {
+      uint32_t dir_fid = in.get<uint32_t>(), fid = in.get<uint32_t>();
+      std::string name = in.str(), target;
+      if (!(f = lookup(dir_fid, &path)) || !lookup(fid, &target))
+        return EBADF;
+      if (!valid_name(name))
+        return EINVAL;
+      if (link(host_path(target).c_str(), host_path(join(path, name)).c_str()) != 0)
+        return errno;
+      return 0;
+    }
+
+    case P9_TFSYNC: {
+      uint32_t fid = in.get<uint32_t>(), datasync = in.get<uint32_t>();
+      if (!(f = lookup(fid, NULL)))
+        return EBADF;
+      std::lock_guard<std::mutex> guard(f->lock);
+      if (f->fd < 0)
+        return EBADF;
+      if ((datasync ? fdatasync(f->fd) : fsync(f->fd)) != 0)
+        return errno;
+      return 0;
+    }
+
+    // The guest's kernel arbitrates locks among its own processes before
+    // asking, and nothing else takes them, so every lock is granted.
+    case P9_TLOCK:
+      out.put<uint8_t>(P9_LOCK_SUCCESS);
+      return 0;
+
+    case P9_TGETLOCK: {
+      in.get<uint32_t>();
+      in.get<uint8_t>();
+      uint64_t start = in.get<uint64_t>(), length = in.get<uint64_t>();
+      uint32_t proc_id = in.get<uint32_t>();
+      std::string client_id = in.str();
+      out.put<uint8_t>(P9_LOCK_TYPE_UNLCK);
+      out.put<uint64_t>(start);
+      out.put<uint64_t>(length);
+      out.put<uint32_t>(proc_id);
+      out.str(client_id);
+      return 0;
+    }
+
+    // Extended attributes, device nodes, and the older rename
+    // (which renameat replaces) are not supported.
+    default:
+      return EOPNOTSUPP;
+  }
+}
+
+// Posts the replies finished since the last quantum to the used ring,
+// then the flushes whose requests have all been answered.
+void virtio_9p_t::tick(reg_t cycles)
+{
+  std::vector<request_t*> done;
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    done.swap(finished);
+    for (size_t i = 0; i < flushes.size(); ) {
+      if (active_tags.count(flushes[i].second) == 0) {
+        done.push_back(flushes[i].first);
+        flushes.erase(flushes.begin() + i);
+      } else {
+        i++;
+      }
+    }
+  }
+  if (done.empty())
+    return;
+
+  for (auto req : done) {
+    push_used(queues[0], req->head, req->written);
+    delete req;
+  }
+  publish_used(queues[0]);
+}
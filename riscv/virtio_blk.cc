@@ -0,0 +1,269 @@
+#include "devices.h"
+#include "simif.h"
+#include "mmu.h"
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define VIRTIO_ID_BLOCK	2
+
+#define VIRTIO_BLK_F_RO	(1ull << 5)
+#define VIRTIO_BLK_F_FLUSH	(1ull << 9)
+
+#define VIRTIO_BLK_T_IN	0
+#define VIRTIO_BLK_T_OUT	1
+#define VIRTIO_BLK_T_FLUSH	4
+#define VIRTIO_BLK_T_GET_ID	8
+
+#define VIRTIO_BLK_S_OK	0
+#define VIRTIO_BLK_S_IOERR	1
+#define VIRTIO_BLK_S_UNSUPP	2
+
+#define VIRTIO_BLK_SECTOR_SIZE	512
+#define VIRTIO_BLK_ID_BYTES	20
+
+static bool read_only_image(const std::string& args)
+{
+  return args.size() > 3 && args.compare(args.size() - 3, 3, ",ro") == 0;
+}
+
+virtio_blk_t::virtio_blk_t(const std::string& args)
+  : virtio_mmio_t(VIRTIO_ID_BLOCK, VIRTIO_BLK_F_FLUSH | (read_only_image(args) ? VIRTIO_BLK_F_RO : 0),
+                  1, QUEUE_SIZE),
+    read_only(read_only_image(args)), in_flight(0), workers_exit(false)
+{
+  std::string path = read_only ? args.substr(0, args.size() - 3) : args;
+
+  fd = open(path.c_str(), read_only ? O_RDONLY : O_RDWR);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0)
+    throw std::runtime_error("could not open disk image " + path + ": " + strerror(errno));
+  capacity = st.st_size / VIRTIO_BLK_SECTOR_SIZE;
+
+  for (size_t i = 0; i < NUM_WORKERS; i++)
+    workers.emplace_back(&virtio_blk_t::worker_main, this);
+}
+
+virtio_blk_t::~virtio_blk_t()
+{
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    workers_exit = true;
+  }
+  work_ready.notify_all();
+  for (auto& w : workers)
+    w.join();
+  for (auto req : submitted)
+    delete req;
+  for (auto req : finished)
+    delete req;
+  close(fd);
+}
+
+// Waits out the requests still with the workers, since they hold pointers
+// into the guest's buffers, and drops their results.
+void virtio_blk_t::reset_device()
+{
+  std::unique_lock<std::mutex> guard(lock);
+  drained.wait(guard, [&]{ return in_flight == 0; });
+  for (auto req : finished)
+    delete req;
+  finished.clear();
+}
+
+bool virtio_blk_t::load_config(reg_t offset, size_t len, uint8_t* bytes)
+{
+  // struct virtio_blk_config, of which only the capacity is implemented.
+  uint8_t config[8];
+  memcpy(config, &capacity, sizeof(capacity));
+  if (offset + len > sizeof(config))
+    return false;
+  memcpy(bytes, config + offset, len);
+  return true;
+}
+
+void virtio_blk_t::notify(size_t q)
+{
+  uint16_t head;
+  while (peek_avail(queues[0], &head)) {
+    queues[0].last_avail++;
+    submit(head);
+  }
+}
+
+// Parses the descriptor chain at head, which holds the request header, the
+// data buffers and, in its last byte, the status.
+void virtio_blk_t::submit(uint16_t head)
+{
+  request_t* req = new request_t{head, 0, 0, {}, NULL, 0, VIRTIO_BLK_S_OK};
+
+  std::vector<desc_t> chain;
+  read_chain(queues[0], head, chain);
+
+  struct {
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t sector;
+  } hdr;
+  desc_t& last = chain.back();
+  if (chain.size() < 2 || chain[0].len < sizeof(hdr) || !last.write || last.len == 0 ||
+      !(req->status = (uint8_t*)sim->addr_to_mem(last.addr + last.len - 1))) {
+    // Without a header and a status byte the chain can only be returned.
+    req->status = NULL;
+    complete(req, VIRTIO_BLK_S_IOERR);
+    return;
+  }
+
+  std::vector<std::pair<uint8_t*, size_t>> header;
+  map_guest(chain[0].addr, sizeof(hdr), header);
+  uint8_t* p = (uint8_t*)&hdr;
+  for (auto& h : header) {
+    memcpy(p, h.first, h.second);
+    p += h.second;
+  }
+  req->type = hdr.type;
+  req->offset = hdr.sector * VIRTIO_BLK_SECTOR_SIZE;
+
+  size_t data_len = 0;
+  bool writes_guest = req->type == VIRTIO_BLK_T_IN || req->type == VIRTIO_BLK_T_GET_ID;
+  for (size_t i = 1; i < chain.size(); i++) {
+    size_t len = i == chain.size() - 1 ? chain[i].len - 1 : chain[i].len;
+    if (chain[i].write != writes_guest && len != 0) {
+      complete(req, VIRTIO_BLK_S_IOERR);
+      return;
+    }
+    if (!map_guest(chain[i].addr, len, req->data)) {
+      complete(req, VIRTIO_BLK_S_IOERR);
+      return;
+    }
+    data_len += len;
+  }
+
+  switch (req->type) {
+    case VIRTIO_BLK_T_IN:
+    case VIRTIO_BLK_T_OUT:
+      if (hdr.sector > capacity || data_len / VIRTIO_BLK_SECTOR_SIZE > capacity - hdr.sector ||
+          data_len % VIRTIO_BLK_SECTOR_SIZE != 0 || (req->type == VIRTIO_BLK_T_OUT && read_only)) {
+        complete(req, VIRTIO_BLK_S_IOERR);
+        return;
+      }
+      if (req->type == VIRTIO_BLK_T_IN)
+        req->written = data_len;
+      break;
+    case VIRTIO_BLK_T_FLUSH:
+      break;
+    case VIRTIO_BLK_T_GET_ID: {
+      char id[VIRTIO_BLK_ID_BYTES] = "spike-virtio-blk";
+      const char* src = id;
+      size_t left = std::min(data_len, sizeof(id));
+      for (auto& d : req->data) {
+        size_t n = std::min(left, d.second);
+        memcpy(d.first, src, n);
+        src += n;
+        left -= n;
+      }
+      req->written = std::min(data_len, sizeof(id));
+      complete(req, VIRTIO_BLK_S_OK);
+      return;
+    }
+    default:
+      complete(req, VIRTIO_BLK_S_UNSUPP);
+      return;
+  }
+
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    submitted.push_back(req);
+    in_flight++;
+  }
+  work_ready.notify_one();
+}
+
+void virtio_blk_t::complete(request_t* req, uint8_t result)
+{
+  req->result = result;
+  std::lock_guard<std::mutex> guard(lock);
+  finished.push_back(req);
+}
+
+void virtio_blk_t::worker_main()
+{
+  std::unique_lock<std::mutex> guard(lock);
+  while (true) {
+    work_ready.wait(guard, [&]{ return workers_exit || !submitted.empty(); });
+    if (workers_exit)
+      return;
+    request_t* req = submitted.front();
+    submitted.pop_front();
+
+    guard.unlock();
+    execute(req);
+    guard.lock();
+
+    finished.push_back(req);
+    if (--in_flight == 0)
+      drained.notify_all();
+  }
+}
+
+// Runs on a worker thread, touching only req and the guest buffers it
+// maps, which the driver leaves alone until the request completes.
+void virtio_blk_t::execute(request_t* req)
+{
+  if (req->type == VIRTIO_BLK_T_FLUSH) {
+    req->result = fdatasync(fd) == 0 ? VIRTIO_BLK_S_OK : VIRTIO_BLK_S_IOERR;
+    return;
+  }
+
+  std::vector<struct iovec> iov;
+  for (auto& d : req->data)
+    iov.push_back({d.first, d.second});
+
+  off_t offset = req->offset;
+  size_t next = 0;
+  while (next < iov.size()) {
+    int count = std::min<size_t>(iov.size() - next, IOV_MAX);
+    ssize_t done = req->type == VIRTIO_BLK_T_IN ?
+                   preadv(fd, &iov[next], count, offset) :
+                   pwritev(fd, &iov[next], count, offset);
+    if (done < 0 && errno == EINTR)
+      continue;
+    if (done <= 0) {
+      req->result = VIRTIO_BLK_S_IOERR;
+      return;
+    }
+    offset += done;
+    // Step past what was transferred, which may end mid-buffer.
+    while (next < iov.size() && size_t(done) >= iov[next].iov_len)
+      done -= iov[next++].iov_len;
+    if (next < iov.size()) {
+      iov[next].iov_base = (char*)iov[next].iov_base + done;
+      iov[next].iov_len -= done;
+    }
+  }
+  req->result = VIRTIO_BLK_S_OK;
+}
+
+// Posts the requests finished since the last quantum to the used ring.
+void virtio_blk_t::tick(reg_t cycles)
+{
+  std::vector<request_t*> done;
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    done.swap(finished);
+  }
+  if (done.empty())
+    return;
+
+  for (auto req : done) {
+    if (req->status)
+      *req->status = req->result;
+    push_used(queues[0], req->head, req->status ? req->written + 1 : 0);
+    delete req;
+  }
+  publish_used(queues[0]);
+}
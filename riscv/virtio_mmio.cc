@@ -0,0 +1,252 @@
+#include "devices.h"
+#include "simif.h"
+#include "mmu.h"
+#include <cstring>
+
+/* 000 magic value          070 device status
+ * 004 version              080 queue descriptor table lo, hi
+ * 008 device id            090 queue driver (available) ring lo, hi
+ * 00c vendor id            0a0 queue device (used) ring lo, hi
+ * 010 device features      0fc config generation
+ * 014 device features sel  100 device configuration
+ * 020 driver features
+ * 024 driver features sel
+ * 030 queue sel
+ * 034 queue num max
+ * 038 queue num
+ * 044 queue ready
+ * 050 queue notify
+ * 060 interrupt status
+ * 064 interrupt ack
+ */
+
+#define VIRTIO_MAGIC_VALUE	0x000
+#define VIRTIO_VERSION	0x004
+#define VIRTIO_DEVICE_ID	0x008
+#define VIRTIO_VENDOR_ID	0x00c
+#define VIRTIO_DEVICE_FEATURES	0x010
+#define VIRTIO_DEVICE_FEATURES_SEL	0x014
+#define VIRTIO_DRIVER_FEATURES	0x020
+#define VIRTIO_DRIVER_FEATURES_SEL	0x024
+#define VIRTIO_QUEUE_SEL	0x030
+#define VIRTIO_QUEUE_NUM_MAX	0x034
+#define VIRTIO_QUEUE_NUM	0x038
+#define VIRTIO_QUEUE_READY	0x044
+#define VIRTIO_QUEUE_NOTIFY	0x050
+#define VIRTIO_INTERRUPT_STATUS	0x060
+#define VIRTIO_INTERRUPT_ACK	0x064
+#define VIRTIO_STATUS	0x070
+#define VIRTIO_QUEUE_DESC_LOW	0x080
+#define VIRTIO_QUEUE_DESC_HIGH	0x084
+#define VIRTIO_QUEUE_DRIVER_LOW	0x090
+#define VIRTIO_QUEUE_DRIVER_HIGH	0x094
+#define VIRTIO_QUEUE_DEVICE_LOW	0x0a0
+#define VIRTIO_QUEUE_DEVICE_HIGH	0x0a4
+#define VIRTIO_CONFIG_GENERATION	0x0fc
+#define VIRTIO_CONFIG	0x100
+
+#define VIRTIO_MAGIC	0x74726976  // "virt"
+#define VIRTIO_VENDOR	0x554d4551  // "QEMU", which drivers expect of generic devices
+
+#define VIRTIO_STATUS_FEATURES_OK	0x8
+#define VIRTIO_INT_USED_RING	0x1
+
+#define VIRTIO_F_VERSION_1	(1ull << 32)
+
+#define VIRTQ_DESC_F_NEXT	0x1
+#define VIRTQ_DESC_F_WRITE	0x2
+#define VIRTQ_AVAIL_F_NO_INTERRUPT	0x1
+
+virtio_mmio_t::virtio_mmio_t(uint32_t device_id, uint64_t features, size_t num_queues, uint32_t queue_size)
+  : sim(NULL), plic(NULL), irq(0), queues(num_queues), device_id(device_id),
+    device_features(features | VIRTIO_F_VERSION_1), queue_size(queue_size)
+{
+  reset_transport();
+}
+
+void virtio_mmio_t::attach(simif_t* sim, plic_t* plic, uint32_t irq)
+{
+  this->sim = sim;
+  this->plic = plic;
+  this->irq = irq;
+}
+
+void virtio_mmio_t::reset_transport()
+{
+  device_features_sel = driver_features_sel = 0;
+  driver_features = 0;
+  status = 0;
+  interrupt_status = 0;
+  queue_sel = 0;
+  for (auto& q : queues)
+    q = queue_t{queue_size, false, 0, 0, 0, 0, 0};
+  if (plic)
+    plic->set_interrupt_level(irq, false);
+}
+
+bool virtio_mmio_t::load(reg_t addr, size_t len, uint8_t* bytes)
+{
+  if (addr >= VIRTIO_CONFIG)
+    return load_config(addr - VIRTIO_CONFIG, len, bytes);
+
+  if (len != 4 || addr % 4 != 0)
+    return false;
+
+  bool have_queue = queue_sel < queues.size();
+  uint32_t val = 0;
+  switch (addr) {
+    case VIRTIO_MAGIC_VALUE: val = VIRTIO_MAGIC; break;
+    case VIRTIO_VERSION: val = 2; break;
+    case VIRTIO_DEVICE_ID: val = device_id; break;
+    case VIRTIO_VENDOR_ID: val = VIRTIO_VENDOR; break;
+    case VIRTIO_DEVICE_FEATURES:
+      val = device_features_sel < 2 ? device_features >> (32 * device_features_sel) : 0;
+      break;
+    case VIRTIO_QUEUE_NUM_MAX: val = have_queue ? queue_size : 0; break;
+    case VIRTIO_QUEUE_READY: val = have_queue && queues[queue_sel].ready; break;
+    case VIRTIO_INTERRUPT_STATUS: val = interrupt_status; break;
+    case VIRTIO_STATUS: val = status; break;
+    case VIRTIO_CONFIG_GENERATION: val = 0; break;
+  }
+  memcpy(bytes, &val, 4);
+  return true;
+}
+
+bool virtio_mmio_t::store(reg_t addr, size_t len, const uint8_t* bytes)
+{
+  if (len != 4 || addr % 4 != 0 || addr >= VIRTIO_CONFIG)
+    return false;
+
+  uint32_t val;
+  memcpy(&val, bytes, 4);
+
+  bool queue_reg = (addr >= VIRTIO_QUEUE_NUM && addr <= VIRTIO_QUEUE_READY) ||
+                   (addr >= VIRTIO_QUEUE_DESC_LOW && addr <= VIRTIO_QUEUE_DEVICE_HIGH);
+  if (queue_reg && queue_sel >= queues.size())
+    return true;
+  queue_t& q = queues[queue_reg ? queue_sel : 0];
+
+  switch (addr) {
+    case VIRTIO_DEVICE_FEATURES_SEL: device_features_sel = val; break;
+    case VIRTIO_DRIVER_FEATURES:
+      if (driver_features_sel < 2)
+        driver_features = (driver_features & ~(0xffffffffull << (32 * driver_features_sel))) |
+                          (uint64_t(val) << (32 * driver_features_sel));
+      break;
+    case VIRTIO_DRIVER_FEATURES_SEL: driver_features_sel = val; break;
+    case VIRTIO_QUEUE_SEL: queue_sel = val; break;
+    case VIRTIO_QUEUE_NUM:
+      if (val != 0 && val <= queue_size && (val & (val - 1)) == 0)
+        q.num = val;
+      break;
+    case VIRTIO_QUEUE_READY: q.ready = val & 1; break;
+    case VIRTIO_QUEUE_NOTIFY:
+      if (val < queues.size() && queues[val].ready && sim)
+        notify(val);
+      break;
+    case VIRTIO_INTERRUPT_ACK:
+      interrupt_status &= ~val;
+      if (interrupt_status == 0 && plic)
+        plic->set_interrupt_level(irq, false);
+      break;
+    case VIRTIO_STATUS:
+      if (val == 0) {
+        reset_device();
+        reset_transport();
+      } else {
+        // Only a driver that speaks version 1 may go on.
+        if (!(driver_features & VIRTIO_F_VERSION_1))
+          val &= ~VIRTIO_STATUS_FEATURES_OK;
+        status = val;
+      }
+      break;
+    case VIRTIO_QUEUE_DESC_LOW: q.desc_addr = (q.desc_addr & ~0xffffffffull) | val; break;
+    case VIRTIO_QUEUE_DESC_HIGH: q.desc_addr = (q.desc_addr & 0xffffffff) | (uint64_t(val) << 32); break;
+    case VIRTIO_QUEUE_DRIVER_LOW: q.avail_addr = (q.avail_addr & ~0xffffffffull) | val; break;
+    case VIRTIO_QUEUE_DRIVER_HIGH: q.avail_addr = (q.avail_addr & 0xffffffff) | (uint64_t(val) << 32); break;
+    case VIRTIO_QUEUE_DEVICE_LOW: q.used_addr = (q.used_addr & ~0xffffffffull) | val; break;
+    case VIRTIO_QUEUE_DEVICE_HIGH: q.used_addr = (q.used_addr & 0xffffffff) | (uint64_t(val) << 32); break;
+  }
+  return true;
+}
+
+// Ring fields are naturally aligned, so none straddles a page.
+template<class T> T virtio_mmio_t::guest_load(reg_t addr)
+{
+  T val = 0;
+  if (char* host = sim->addr_to_mem(addr))
+    memcpy(&val, host, sizeof(T));
+  return val;
+}
+
+template<class T> void virtio_mmio_t::guest_store(reg_t addr, T val)
+{
+  if (char* host = sim->addr_to_mem(addr))
+    memcpy(host, &val, sizeof(T));
+}
+
+template uint8_t virtio_mmio_t::guest_load<uint8_t>(reg_t);
+template uint16_t virtio_mmio_t::guest_load<uint16_t>(reg_t);
+template uint32_t virtio_mmio_t::guest_load<uint32_t>(reg_t);
+template uint64_t virtio_mmio_t::guest_load<uint64_t>(reg_t);
+template void virtio_mmio_t::guest_store<uint8_t>(reg_t, uint8_t);
+template void virtio_mmio_t::guest_store<uint16_t>(reg_t, uint16_t);
+template void virtio_mmio_t::guest_store<uint32_t>(reg_t, uint32_t);
+template void virtio_mmio_t::guest_store<uint64_t>(reg_t, uint64_t);
+
+bool virtio_mmio_t::map_guest(reg_t addr, size_t len, std::vector<std::pair<uint8_t*, size_t>>& out)
+{
+  while (len > 0) {
+    size_t n = std::min<size_t>(len, PGSIZE - addr % PGSIZE);
+    uint8_t* host = (uint8_t*)sim->addr_to_mem(addr);
+    if (!host)
+      return false;
+    if (!out.empty() && out.back().first + out.back().second == host)
+      out.back().second += n;
+    else
+      out.emplace_back(host, n);
+    addr += n;
+    len -= n;
+  }
+  return true;
+}
+
+bool virtio_mmio_t::peek_avail(queue_t& q, uint16_t* head)
+{
+  if (!q.ready || !sim || q.last_avail == guest_load<uint16_t>(q.avail_addr + 2))
+    return false;
+  *head = guest_load<uint16_t>(q.avail_addr + 4 + 2 * (q.last_avail % q.num));
+  return true;
+}
+
+void virtio_mmio_t::read_chain(queue_t& q, uint16_t head, std::vector<desc_t>& chain)
+{
+  chain.clear();
+  for (uint16_t i = head; chain.size() < q.num; ) {
+    reg_t desc = q.desc_addr + 16 * (i % q.num);
+    uint16_t flags = guest_load<uint16_t>(desc + 12);
+    chain.push_back({guest_load<uint64_t>(desc), guest_load<uint32_t>(desc + 8),
+                     (flags & VIRTQ_DESC_F_WRITE) != 0});
+    if (!(flags & VIRTQ_DESC_F_NEXT))
+      break;
+    i = guest_load<uint16_t>(desc + 14);
+  }
+}
+
+void virtio_mmio_t::push_used(queue_t& q, uint16_t head, uint32_t written)
+{
+  reg_t elem = q.used_addr + 4 + 8 * (q.used_idx % q.num);
+  guest_store<uint32_t>(elem, head);
+  guest_store<uint32_t>(elem + 4, written);
+  q.used_idx++;
+}
+
+void virtio_mmio_t::publish_used(queue_t& q)
+{
+  guest_store<uint16_t>(q.used_addr + 2, q.used_idx);
+  if (!(guest_load<uint16_t>(q.avail_addr) & VIRTQ_AVAIL_F_NO_INTERRUPT)) {
+    interrupt_status |= VIRTIO_INT_USED_RING;
+    if (plic)
+      plic->set_interrupt_level(irq, true);
+  }
+}
@@ -0,0 +1,186 @@
+#include "devices.h"
+#include "simif.h"
+#include "mmu.h"
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <net/if.h>
+#include <linux/if_tun.h>
+#endif
+
+#define VIRTIO_ID_NET	1
+
+#define VIRTIO_NET_F_MAC	(1ull << 5)
+
+#define VIRTIO_NET_S_LINK_UP	1
+
+// struct virtio_net_hdr as version 1 lays it out, num_buffers included
+#define VIRTIO_NET_HDR_SIZE	12
+#define VIRTIO_NET_HDR_NUM_BUFFERS	10
+
+#define RX_QUEUE	0
+#define TX_QUEUE	1
+
+virtio_net_t::virtio_net_t(const std::string& args)
+  : virtio_mmio_t(VIRTIO_ID_NET, VIRTIO_NET_F_MAC, 2, QUEUE_SIZE),
+    fd(-1), mac{0x52, 0x54, 0x00, 0x12, 0x34, 0x56}, tx_pending(false), quanta(0)
+{
+  std::string ifname;
+  size_t start = 0;
+  while (start <= args.size()) {
+    size_t end = args.find(',', start);
+    if (end == std::string::npos)
+      end = args.size();
+    std::string opt = args.substr(start, end - start);
+    if (start == 0 && opt.compare(0, 4, "tap:") == 0) {
+      ifname = opt.substr(4);
+    } else if (opt.compare(0, 4, "mac=") == 0) {
+      if (sscanf(opt.c_str() + 4, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx",
+                 &mac[0], &mac[1], &mac[2], &mac[3], &mac[4], &mac[5]) != 6)
+        throw std::runtime_error("bad virtio-net MAC address " + opt.substr(4));
+    } else {
+      throw std::runtime_error("bad virtio-net option " + opt + "; expected tap:<interface>[,mac=<address>]");
+    }
+    start = end + 1;
+  }
+  if (ifname.empty() || ifname.size() >= 16)
+    throw std::runtime_error("virtio-net needs a TAP interface, as tap:<interface>");
+
+#ifdef __linux__
+  // The TAP passes each frame with a virtio-net header, so frames go to
+  // and from the guest's buffers as they are.
+  struct ifreq ifr;
+  memset(&ifr, 0, sizeof(ifr));
+  ifr.ifr_flags = IFF_TAP | IFF_NO_PI | IFF_VNET_HDR;
+  strncpy(ifr.ifr_name, ifname.c_str(), IFNAMSIZ - 1);
+  int hdr_size = VIRTIO_NET_HDR_SIZE;
+  fd = open("/dev/net/tun", O_RDWR | O_NONBLOCK);
+  if (fd < 0 || ioctl(fd, TUNSETIFF, &ifr) != 0 || ioctl(fd, TUNSETVNETHDRSZ, &hdr_size) != 0) {
+    std::string err = strerror(errno);
+    if (fd >= 0)
+      close(fd);
+    throw std::runtime_error("could not open TAP interface " + ifname + ": " + err);
+  }
+#else
+  throw std::runtime_error("virtio-net TAP interfaces are only supported on Linux");
+#endif
+}
+
+virtio_net_t::~virtio_net_t()
+{
+  if (fd >= 0)
+    close(fd);
+}
+
+void virtio_net_t::reset_device()
+{
+  tx_pending = false;
+}
+
+bool virtio_net_t::load_config(reg_t offset, size_t len, uint8_t* bytes)
+{
+  // struct virtio_net_config up to its status
+  uint8_t config[8];
+  uint16_t status = VIRTIO_NET_S_LINK_UP;
+  memcpy(config, mac, sizeof(mac));
+  memcpy(config + 6, &status, sizeof(status));
+  if (offset + len > sizeof(config))
+    return false;
+  memcpy(bytes, config + offset, len);
+  return true;
+}
+
+// Transmit buffers wait for the end of the quantum, where a burst of them
+// is written at once; receive buffers are filled as frames are polled.
+void virtio_net_t::notify(size_t q)
+{
+  if (q == TX_QUEUE)
+    tx_pending = true;
+}
+
+bool virtio_net_t::map_chain(const std::vector<desc_t>& chain, bool write, std::vector<struct iovec>& iov)
+{
+  std::vector<std::pair<uint8_t*, size_t>> host;
+  for (auto& d : chain)
+    if (d.write == write && !map_guest(d.addr, d.len, host))
+      return false;
+  if (host.size() > IOV_MAX)
+    return false;
+  iov.clear();
+  for (auto& h : host)
+    iov.push_back({h.first, h.second});
+  return true;
+}
+
+void virtio_net_t::transmit()
+{
+  queue_t& q = queues[TX_QUEUE];
+  std::vector<desc_t> chain;
+  std::vector<struct iovec> iov;
+  bool sent = false;
+  uint16_t head;
+  while (peek_avail(q, &head)) {
+    read_chain(q, head, chain);
+    // A frame the TAP has no room for stays queued for the next quantum.
+    if (map_chain(chain, false, iov) && writev(fd, iov.data(), iov.size()) < 0 &&
+        (errno == EAGAIN || errno == EWOULDBLOCK))
+      return;
+    q.last_avail++;
+    push_used(q, head, 0);
+    sent = true;
+  }
+  tx_pending = false;
+  if (sent)
+    publish_used(q);
+}
+
+void virtio_net_t::receive()
+{
+  queue_t& q = queues[RX_QUEUE];
+  std::vector<desc_t> chain;
+  std::vector<struct iovec> iov;
+  bool received = false;
+  uint16_t head;
+  // Frames wait in the TAP until the driver has a buffer for them.
+  while (peek_avail(q, &head)) {
+    read_chain(q, head, chain);
+    ssize_t len = 0;
+    if (map_chain(chain, true, iov)) {
+      len = readv(fd, iov.data(), iov.size());
+      if (len < 0)
+        break;
+      // The TAP writes the header without num_buffers, which is one when
+      // buffers are not merged.
+      if (len >= VIRTIO_NET_HDR_SIZE) {
+        uint16_t num_buffers = 1;
+        size_t offset = VIRTIO_NET_HDR_NUM_BUFFERS;
+        for (size_t i = 0, n = 0; i < iov.size() && n < sizeof(num_buffers); i++) {
+          for (; offset < iov[i].iov_len && n < sizeof(num_buffers); offset++, n++)
+            ((uint8_t*)iov[i].iov_base)[offset] = ((uint8_t*)&num_buffers)[n];
+          offset -= std::min(offset, iov[i].iov_len);
+        }
+      } else {
+        len = 0;
+      }
+    }
+    q.last_avail++;
+    push_used(q, head, len);
+    received = true;
+  }
+  if (received)
+    publish_used(q);
+}
+
+void virtio_net_t::tick(reg_t cycles)
+{
+  if (tx_pending)
+    transmit();
+  if (++quanta % POLL_INTERVAL == 0)
+    receive();
+}
@@ -9,11 +9,14 @@
 uint_fast16_t f16_classify( float16_t a )
 {
     union ui16_f16 uA;
-    uint_fast16_t uiA;
 
     uA.f = a;
-    uiA = uA.ui;
+    return softfloat_f16ClassifyTable[uA.ui];
 
+}
+
+uint_fast16_t softfloat_f16UIClassify( uint_fast16_t uiA )
+{
     uint_fast16_t infOrNaN = expF16UI( uiA ) == 0x1F;
     uint_fast16_t subnormalOrZero = expF16UI( uiA ) == 0;
     bool sign = signF16UI( uiA );
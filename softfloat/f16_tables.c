@@ -0,0 +1,37 @@
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "platform.h"
+#include "internals.h"
+#include "specialize.h"
+#include "softfloat.h"
+
+/*----------------------------------------------------------------------------
+| With only 65536 half-precision inputs, the conversions to wider formats,
+| classification and the reciprocal estimates are looked up instead of
+| computed.  The tables take 1.1 MiB and are filled before main runs.
+*----------------------------------------------------------------------------*/
+uint16_t softfloat_f16ClassifyTable[0x10000];
+uint32_t softfloat_f16ToF32Table[0x10000];
+uint64_t softfloat_f16ToF64Table[0x10000];
+uint16_t softfloat_f16Rsqrte7Table[0x10000];
+uint16_t softfloat_f16Recip7Table[0x10000];
+
+static void __attribute__((constructor)) softfloat_initF16Tables( void )
+{
+    uint_fast8_t flags = softfloat_exceptionFlags;
+    uint_fast8_t roundingMode = softfloat_roundingMode;
+    uint_fast32_t uiA;
+
+    softfloat_roundingMode = softfloat_round_near_even;
+    for ( uiA = 0; uiA < 0x10000; ++uiA ) {
+        softfloat_f16ClassifyTable[uiA] = softfloat_f16UIClassify( uiA );
+        softfloat_f16ToF32Table[uiA] = softfloat_f16UIToF32UI( uiA );
+        softfloat_f16ToF64Table[uiA] = softfloat_f16UIToF64UI( uiA );
+        softfloat_f16Rsqrte7Table[uiA] = softfloat_f16UIRsqrte7( uiA );
+        softfloat_f16Recip7Table[uiA] = softfloat_f16UIRecip7( uiA );
+    }
+    softfloat_roundingMode = roundingMode;
+    softfloat_exceptionFlags = flags;
+
+}
@@ -44,19 +44,28 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 float32_t f16_to_f32( float16_t a )
 {
     union ui16_f16 uA;
-    uint_fast16_t uiA;
+    union ui32_f32 uZ;
+
+    uA.f = a;
+    if ( softfloat_isSigNaNF16UI( uA.ui ) ) {
+        softfloat_raiseFlags( softfloat_flag_invalid );
+    }
+    uZ.ui = softfloat_f16ToF32Table[uA.ui];
+    return uZ.f;
+
+}
+
+uint_fast32_t softfloat_f16UIToF32UI( uint_fast16_t uiA )
+{
     bool sign;
     int_fast8_t exp;
     uint_fast16_t frac;
     struct commonNaN commonNaN;
     uint_fast32_t uiZ;
     struct exp8_sig16 normExpSig;
-    union ui32_f32 uZ;
 
     /*------------------------------------------------------------------------
     *------------------------------------------------------------------------*/
-    uA.f = a;
-    uiA = uA.ui;
     sign = signF16UI( uiA );
     exp  = expF16UI( uiA );
     frac = fracF16UI( uiA );
@@ -86,8 +95,7 @@ float32_t f16_to_f32( float16_t a )
     *------------------------------------------------------------------------*/
     uiZ = packToF32UI( sign, exp + 0x70, (uint_fast32_t) frac<<13 );
  uiZ:
-    uZ.ui = uiZ;
-    return uZ.f;
+    return uiZ;
 
 }
 
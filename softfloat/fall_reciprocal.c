@@ -98,7 +98,22 @@ float16_t f16_rsqrte7(float16_t in)
     union ui16_f16 uA;
 
     uA.f = in;
-    unsigned int ret = f16_classify(in);
+    unsigned int ret = softfloat_f16ClassifyTable[uA.ui];
+    if (ret & 0x107) // negative or sNaN
+        softfloat_exceptionFlags |= softfloat_flag_invalid;
+    if (ret & 0x018) // +-0
+        softfloat_exceptionFlags |= softfloat_flag_infinite;
+    uA.ui = softfloat_f16Rsqrte7Table[uA.ui];
+
+    return uA.f;
+}
+
+uint_fast16_t softfloat_f16UIRsqrte7(uint_fast16_t uiA)
+{
+    union ui16_f16 uA;
+
+    uA.ui = uiA;
+    unsigned int ret = softfloat_f16UIClassify(uiA);
     bool sub = false;
     switch(ret) {
     case 0x001: // -inf
@@ -127,7 +142,7 @@ float16_t f16_rsqrte7(float16_t in)
         break;
     }
 
-    return uA.f;
+    return uA.ui;
 }
 
 float32_t f32_rsqrte7(float32_t in)
@@ -267,7 +282,28 @@ float16_t f16_recip7(float16_t in)
     union ui16_f16 uA;
 
     uA.f = in;
-    unsigned int ret = f16_classify(in);
+    // The reciprocal of a subnormal this small overflows, to a result
+    // that depends on the rounding mode.
+    if (!(uA.ui & 0x7e00) && (uA.ui & 0x1ff)) {
+        uA.ui = softfloat_f16UIRecip7(uA.ui);
+        return uA.f;
+    }
+    unsigned int ret = softfloat_f16ClassifyTable[uA.ui];
+    if (ret & 0x100) // sNaN
+        softfloat_exceptionFlags |= softfloat_flag_invalid;
+    if (ret & 0x018) // +-0
+        softfloat_exceptionFlags |= softfloat_flag_infinite;
+    uA.ui = softfloat_f16Recip7Table[uA.ui];
+
+    return uA.f;
+}
+
+uint_fast16_t softfloat_f16UIRecip7(uint_fast16_t uiA)
+{
+    union ui16_f16 uA;
+
+    uA.ui = uiA;
+    unsigned int ret = softfloat_f16UIClassify(uiA);
     bool sub = false;
     bool round_abnormal = false;
     switch(ret) {
@@ -302,7 +338,7 @@ float16_t f16_recip7(float16_t in)
         break;
     }
 
-    return uA.f;
+    return uA.ui;
 }
 
 float32_t f32_recip7(float32_t in)
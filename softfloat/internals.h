@@ -97,6 +97,23 @@ struct exp8_sig16 softfloat_normSubnormalF16Sig( uint_fast16_t );
 float16_t softfloat_roundPackToF16( bool, int_fast16_t, uint_fast16_t );
 float16_t softfloat_normRoundPackToF16( bool, int_fast16_t, uint_fast16_t );
 
+/*----------------------------------------------------------------------------
+| Results for every half-precision input, filled in by f16_tables.c from the
+| functions below at startup.  Exception flags are not part of the tables;
+| the callers raise them from the input's class.
+*----------------------------------------------------------------------------*/
+extern uint16_t softfloat_f16ClassifyTable[0x10000];
+extern uint32_t softfloat_f16ToF32Table[0x10000];
+extern uint64_t softfloat_f16ToF64Table[0x10000];
+extern uint16_t softfloat_f16Rsqrte7Table[0x10000];
+extern uint16_t softfloat_f16Recip7Table[0x10000];
+
+uint_fast16_t softfloat_f16UIClassify( uint_fast16_t );
+uint_fast32_t softfloat_f16UIToF32UI( uint_fast16_t );
+uint_fast64_t softfloat_f16UIToF64UI( uint_fast16_t );
+uint_fast16_t softfloat_f16UIRsqrte7( uint_fast16_t );
+uint_fast16_t softfloat_f16UIRecip7( uint_fast16_t );
+
 float16_t softfloat_addMagsF16( uint_fast16_t, uint_fast16_t );
 float16_t softfloat_subMagsF16( uint_fast16_t, uint_fast16_t );
 float16_t
@@ -50,8 +50,24 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <stdint.h>
 #include "softfloat_types.h"
 
+/*----------------------------------------------------------------------------
+| The rounding mode and exception flags are per thread, so that harts and
+| simulations running on different threads do not see each other's.  Every
+| floating-point instruction sets the one and reads and clears the other, so
+| with GCC and Clang they are __thread in C++ as well, which unlike
+| thread_local needs no check for a dynamic initializer on each access, and
+| use the initial-exec model, which makes an access one load relative to the
+| thread pointer instead of a call to __tls_get_addr in position-independent
+| code.
+*----------------------------------------------------------------------------*/
 #ifndef THREAD_LOCAL
-#define THREAD_LOCAL
+#if defined(__GNUC__)
+#define THREAD_LOCAL __thread __attribute__((tls_model("initial-exec")))
+#elif defined(__cplusplus)
+#define THREAD_LOCAL thread_local
+#else
+#define THREAD_LOCAL __thread
+#endif
 #endif
 
 #ifdef __cplusplus
@@ -5,19 +5,174 @@
 // in its input, then replaces them with the disassembly
 // enclosed hexadecimal number, interpreted as a RISC-V
 // instruction.
+//
+// Input is read in large blocks, each cut at line boundaries into one
+// slice per thread.  A thread turns its slice into a list of spans: the
+// unchanged text between tokens points straight into the input buffer,
+// and only the disassemblies are copied, so the output of all slices can
+// be written back in order with writev.  A block is handed over as soon
+// as the input runs dry, so interactive use is not delayed.
 
 #include "disasm.h"
 #include "extension.h"
 #include <iostream>
 #include <string>
 #include <cstdint>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <poll.h>
+#include <sys/uio.h>
+#include <unistd.h>
 #include <fesvr/option_parser.h>
 using namespace std;
 
+// Bytes each thread handles per round.
+static const size_t SLICE_SIZE = 16 << 20;
+
+// Bound on distinct encodings remembered per thread.
+static const size_t MAX_CACHED = 1 << 16;
+
+class dasm_slice_t
+{
+ public:
+  dasm_slice_t(const disassembler_t* disassembler) : disassembler(disassembler) {}
+
+  void scan(const char* p, const char* end);
+  void write();
+
+ private:
+  // A span of output: base + off when base is set, text + off otherwise.
+  struct span_t {
+    const char* base;
+    size_t off;
+    size_t len;
+  };
+
+  void emit(const char* p, size_t len);
+  void emit_text(const string& s);
+
+  const disassembler_t* disassembler;
+  vector<span_t> spans;
+  string text;
+  unordered_map<insn_bits_t, string> cache;
+};
+
+void dasm_slice_t::emit(const char* p, size_t len)
+{
+  if (len == 0)
+    return;
+  if (!spans.empty() && spans.back().base && spans.back().base + spans.back().len == p)
+    spans.back().len += len;
+  else
+    spans.push_back(span_t{p, 0, len});
+}
+
+void dasm_slice_t::emit_text(const string& s)
+{
+  spans.push_back(span_t{NULL, text.size(), s.size()});
+  text += s;
+}
+
+void dasm_slice_t::scan(const char* p, const char* end)
+{
+  static const char token[] = "DASM(";
+  const size_t token_len = strlen(token);
+
+  const char* copied = p;
+  while (p < end) {
+    const char* start = (const char*)memmem(p, end - p, token, token_len);
+    if (!start)
+      break;
+    p = start + token_len;
+
+    if (end - p >= 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X'))
+      p += 2;
+
+    const char* digits = p;
+    insn_bits_t bits = 0;
+    for (; p < end && isxdigit(*p); p++)
+      bits = bits << 4 | (isdigit(*p) ? *p - '0' : (*p | 0x20) - 'a' + 10);
+    if (p == digits || p == end || *p != ')')
+      continue;
+    // Like strtoull, saturate encodings too wide to fit.
+    if (p - digits > 16)
+      bits = UINT64_MAX;
+    p++;
+
+    auto it = cache.find(bits);
+    if (it == cache.end()) {
+      if (cache.size() >= MAX_CACHED)
+        cache.clear();
+      it = cache.emplace(bits, disassembler->disassemble(bits)).first;
+    }
+    emit(copied, start - copied);
+    emit_text(it->second);
+    copied = p;
+  }
+  emit(copied, end - copied);
+
+  // Every line of output is terminated, even an unterminated last one.
+  static const char newline = '\n';
+  if (end[-1] != '\n')
+    emit(&newline, 1);
+}
+
+void dasm_slice_t::write()
+{
+  vector<struct iovec> iov;
+  for (auto& s : spans)
+    iov.push_back({(void*)((s.base ? s.base : text.data()) + s.off), s.len});
+  spans.clear();
+
+  for (size_t i = 0; i < iov.size(); ) {
+    ssize_t n = writev(1, &iov[i], std::min(iov.size() - i, size_t(IOV_MAX)));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0) {
+      perror("spike-dasm: write");
+      exit(1);
+    }
+    for (; i < iov.size() && size_t(n) >= iov[i].iov_len; i++)
+      n -= iov[i].iov_len;
+    if (n > 0) {
+      iov[i].iov_base = (char*)iov[i].iov_base + n;
+      iov[i].iov_len -= n;
+    }
+  }
+  text.clear();
+}
+
+// Disassembles [p, end), which must end on a line boundary or at the end
+// of the input, across all slices, and writes it out in order.
+static void dasm_block(vector<dasm_slice_t>& slices, const char* p, const char* end)
+{
+  while (p < end) {
+    vector<thread> threads;
+    size_t used = 0;
+    for (; used < slices.size() && p < end; used++) {
+      const char* slice_end = end;
+      if (size_t(end - p) > SLICE_SIZE) {
+        slice_end = (const char*)memchr(p + SLICE_SIZE, '\n', end - p - SLICE_SIZE);
+        slice_end = slice_end ? slice_end + 1 : end;
+      }
+      threads.emplace_back(&dasm_slice_t::scan, &slices[used], p, slice_end);
+      p = slice_end;
+    }
+    for (size_t i = 0; i < used; i++) {
+      threads[i].join();
+      slices[i].write();
+    }
+  }
+}
+
 int main(int argc, char** argv)
 {
-  string s;
   const char* isa = DEFAULT_ISA;
+  size_t nthreads = std::max(1u, std::thread::hardware_concurrency());
 
   std::function<extension_t*()> extension;
   option_parser_t parser;
@@ -25,6 +180,7 @@ int main(int argc, char** argv)
   parser.option(0, "extension", 1, [&](const char* s){extension = find_extension(s);});
 #endif
   parser.option(0, "isa", 1, [&](const char* s){isa = s;});
+  parser.option('j', "threads", 1, [&](const char* s){nthreads = std::max(1ul, strtoul(s, 0, 0));});
   parser.parse(argv);
 
   isa_parser_t isa_parser(isa, DEFAULT_PRIV);
@@ -35,31 +191,43 @@ int main(int argc, char** argv)
     }
   }
 
-  while (getline(cin, s))
-  {
-    for (size_t pos = 0; (pos = s.find("DASM(", pos)) != string::npos; )
-    {
-      size_t start = pos;
-
-      pos += strlen("DASM(");
-
-      if (s[pos] == '0' && (s[pos+1] == 'x' || s[pos+1] == 'X'))
-        pos += 2;
-
-      if (!isxdigit(s[pos]))
+  vector<dasm_slice_t> slices(nthreads, dasm_slice_t(disassembler));
+  vector<char> buf(SLICE_SIZE * nthreads);
+  size_t held = 0;
+  for (bool eof = false; !eof; ) {
+    while (held < buf.size()) {
+      ssize_t n = read(0, buf.data() + held, buf.size() - held);
+      if (n < 0 && errno == EINTR)
         continue;
+      if (n < 0) {
+        perror("spike-dasm: read");
+        return 1;
+      }
+      if (n == 0) {
+        eof = true;
+        break;
+      }
+      held += n;
+      // Don't hold back output while the writer is idle.
+      struct pollfd pfd = {0, POLLIN, 0};
+      if (poll(&pfd, 1, 0) == 0)
+        break;
+    }
 
-      char* endp;
-      insn_bits_t bits = strtoull(&s[pos], &endp, 16);
-      if (*endp != ')')
+    // Hand over every complete line and keep the partial one for later.
+    const char* lines_end = buf.data() + held;
+    if (!eof) {
+      while (lines_end > buf.data() && lines_end[-1] != '\n')
+        lines_end--;
+      if (lines_end == buf.data()) {
+        if (held == buf.size())
+          buf.resize(buf.size() * 2);
         continue;
-
-      string dis = disassembler->disassemble(bits);
-      s = s.substr(0, start) + dis + s.substr(endp - &s[0] + 1);
-      pos = start + dis.length();
+      }
     }
-
-    cout << s << '\n';
+    dasm_block(slices, buf.data(), lines_end);
+    held -= lines_end - buf.data();
+    memmove(buf.data(), lines_end, held);
   }
 
   return 0;
@@ -0,0 +1,179 @@
+// See LICENSE for license details.
+
+// This program replays an access trace written with --access-trace through
+// any number of cache configurations at once, so that a sweep costs one
+// simulation.  The trace is decoded once, a block at a time, and every
+// block is handed to a pool of threads that each drive a share of the
+// configurations.  Each configuration is built as spike builds --ic, --dc
+// and --l2: one I$ and one D$ seen by every hart, in front of an optional
+// L2.
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "access_trace.h"
+#include "cachesim.h"
+
+static void usage()
+{
+  fprintf(stderr, "usage: spike-cache-replay [-j <threads>] <trace> <config>...\n");
+  fprintf(stderr, "where each config is one or more of ic=<cache>, dc=<cache> and\n");
+  fprintf(stderr, "l2=<cache>, separated by commas, and a cache is configured as\n");
+  fprintf(stderr, "spike's --ic, --dc and --l2 are, e.g. dc=64:8:64:lru,l2=512:8:64\n");
+  exit(1);
+}
+
+struct system_t {
+  std::unique_ptr<cache_sim_t> ic;
+  std::unique_ptr<cache_sim_t> dc;
+  std::unique_ptr<cache_sim_t> l2;
+
+  system_t(const std::string& config, size_t index)
+  {
+    std::string prefix = "[" + std::to_string(index) + "] ";
+    size_t start = 0;
+    while (start <= config.size()) {
+      size_t end = config.find(',', start);
+      if (end == std::string::npos)
+        end = config.size();
+      std::string field = config.substr(start, end - start);
+      start = end + 1;
+
+      std::string kind = field.substr(0, 3);
+      const char* cache_config = field.c_str() + 3;
+      if (kind == "ic=")
+        ic.reset(cache_sim_t::construct(cache_config, (prefix + "I$").c_str()));
+      else if (kind == "dc=")
+        dc.reset(cache_sim_t::construct(cache_config, (prefix + "D$").c_str()));
+      else if (kind == "l2=")
+        l2.reset(cache_sim_t::construct(cache_config, (prefix + "L2$").c_str()));
+      else
+        usage();
+    }
+    if (!ic && !dc)
+      usage();
+    if (ic && l2) ic->set_miss_handler(&*l2);
+    if (dc && l2) dc->set_miss_handler(&*l2);
+  }
+
+  void replay(const std::vector<access_trace_record_t>& recs)
+  {
+    for (auto& r : recs) {
+      if (r.type == ACCESS_TRACE_CMO) {
+        // The L2 sees the operation through each L1, as in spike.
+        if (ic) ic->clean_invalidate(r.addr, r.bytes, r.clean, r.inval);
+        if (dc) dc->clean_invalidate(r.addr, r.bytes, r.clean, r.inval);
+      } else if (r.type == FETCH) {
+        if (ic) ic->access(r.addr, r.bytes, false, r.pc);
+      } else {
+        if (dc) dc->access(r.addr, r.bytes, r.type == STORE, r.pc);
+      }
+    }
+  }
+};
+
+typedef std::shared_ptr<const std::vector<access_trace_record_t>> block_t;
+
+// Blocks waiting for one worker, which drives its systems through them in
+// order.  A null block ends the trace.
+class worker_t
+{
+ public:
+  void push(block_t block)
+  {
+    std::unique_lock<std::mutex> guard(lock);
+    room.wait(guard, [&] { return queue.size() < MAX_QUEUED; });
+    queue.push_back(block);
+    ready.notify_one();
+  }
+
+  void run()
+  {
+    while (true) {
+      block_t block;
+      {
+        std::unique_lock<std::mutex> guard(lock);
+        ready.wait(guard, [&] { return !queue.empty(); });
+        block = queue.front();
+        queue.pop_front();
+        room.notify_one();
+      }
+      if (!block)
+        return;
+      for (auto s : systems)
+        s->replay(*block);
+    }
+  }
+
+  std::vector<system_t*> systems;
+  std::thread thread;
+
+ private:
+  static const size_t MAX_QUEUED = 4;
+
+  std::mutex lock;
+  std::condition_variable ready;
+  std::condition_variable room;
+  std::deque<block_t> queue;
+};
+
+int main(int argc, char** argv)
+{
+  size_t nthreads = std::thread::hardware_concurrency();
+  int arg = 1;
+  if (arg < argc && strcmp(argv[arg], "-j") == 0) {
+    if (arg + 1 >= argc || (nthreads = strtoul(argv[arg + 1], nullptr, 10)) == 0)
+      usage();
+    arg += 2;
+  }
+  if (argc - arg < 2)
+    usage();
+
+  const char* trace = argv[arg++];
+  std::vector<std::unique_ptr<system_t>> systems;
+  for (; arg < argc; arg++)
+    systems.emplace_back(new system_t(argv[arg], systems.size()));
+
+  nthreads = std::max<size_t>(1, std::min(nthreads, systems.size()));
+  std::vector<worker_t> workers(nthreads);
+  for (size_t i = 0; i < systems.size(); i++)
+    workers[i % nthreads].systems.push_back(systems[i].get());
+  for (auto& w : workers)
+    w.thread = std::thread(&worker_t::run, &w);
+
+  const size_t BLOCK_SIZE = 1 << 16;
+  int status = 0;
+  try {
+    access_trace_reader_t reader(trace);
+    while (true) {
+      auto block = std::make_shared<std::vector<access_trace_record_t>>(BLOCK_SIZE);
+      block->resize(reader.read(block->data(), BLOCK_SIZE));
+      if (block->empty())
+        break;
+      for (auto& w : workers)
+        w.push(block);
+    }
+  } catch (std::exception& e) {
+    fprintf(stderr, "spike-cache-replay: %s\n", e.what());
+    status = 1;
+  }
+
+  for (auto& w : workers) {
+    w.push(nullptr);
+    w.thread.join();
+  }
+  // Caches print their statistics when they are destroyed.
+  for (auto& s : systems)
+    s.reset();
+  return status;
+}
@@ -0,0 +1,125 @@
+// See LICENSE for license details.
+
+// This little program reads a binary commit log written with
+// --log-commits-binary and prints it in the --log-commits text format.
+// A log written with --log-commits-compact holds only the bytes written of
+// each vector register, which are printed as v<n>[<offset>+<bytes>]
+// followed by those bytes, most significant first.
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "commit_log.h"
+#include "disasm.h"
+
+static bool read_exact(FILE* in, void* data, size_t len)
+{
+  return fread(data, 1, len, in) == len;
+}
+
+static void truncated()
+{
+  fprintf(stderr, "spike-commit-decode: truncated commit log\n");
+  exit(1);
+}
+
+int main(int argc, char** argv)
+{
+  FILE* in = stdin;
+  if (argc > 2) {
+    fprintf(stderr, "usage: spike-commit-decode [binary commit log]\n");
+    return 1;
+  }
+  if (argc == 2 && !(in = fopen(argv[1], "rb"))) {
+    perror(argv[1]);
+    return 1;
+  }
+
+  char magic[COMMIT_LOG_MAGIC_LEN];
+  if (!read_exact(in, magic, sizeof(magic)) ||
+      memcmp(magic, COMMIT_LOG_MAGIC, sizeof(magic)) != 0) {
+    fprintf(stderr, "spike-commit-decode: not a binary commit log\n");
+    return 1;
+  }
+
+  FILE* out = stdout;
+  commit_log_insn_t rec;
+  std::vector<uint64_t> value;
+  std::vector<uint8_t> vbytes;
+  while (read_exact(in, &rec, sizeof(rec))) {
+    commit_log_vconfig_t vconfig = {};
+    if ((rec.flags & COMMIT_LOG_VCONFIG) && !read_exact(in, &vconfig, sizeof(vconfig)))
+      truncated();
+
+    fprintf(out, "core%4" PRId32 ": ", rec.core);
+    fprintf(out, "%1d ", rec.priv);
+    commit_log_print_value(out, rec.xlen, rec.pc);
+    fprintf(out, " (");
+    commit_log_print_value(out, rec.insn_len * 8, rec.insn);
+    fprintf(out, ")");
+    if (rec.flags & COMMIT_LOG_VCONFIG)
+      fprintf(out, " e%" PRIu64 " %s%" PRIu64 " l%" PRIu64,
+              vconfig.vsew, vconfig.fractional ? "mf" : "m", vconfig.lmul, vconfig.vl);
+
+    for (unsigned i = 0; i < rec.nregs; i++) {
+      uint32_t key;
+      if (!read_exact(in, &key, sizeof(key)))
+        truncated();
+      int rd = key >> 4;
+      if ((key & 0xf) == 2 && (rec.flags & COMMIT_LOG_VBYTES)) {
+        commit_log_vbytes_t range;
+        if (!read_exact(in, &range, sizeof(range)))
+          truncated();
+        vbytes.resize(range.bytes);
+        if (!read_exact(in, vbytes.data(), range.bytes))
+          truncated();
+        fprintf(out, " v%d[%" PRIu32 "+%" PRIu32 "] 0x", rd, range.offset, range.bytes);
+        for (size_t b = range.bytes; b-- > 0; )
+          fprintf(out, "%02x", vbytes[b]);
+        continue;
+      }
+      size_t bytes = 8, width = rec.xlen;
+      switch (key & 0xf) {
+        case 1: bytes = 16; width = rec.flen; break;
+        case 2: bytes = vconfig.vlen / 8; width = vconfig.vlen; break;
+        case 3: bytes = 0; break;
+      }
+      value.assign(bytes / 8 + 2, 0);
+      if (!read_exact(in, value.data(), bytes))
+        truncated();
+      if (bytes == 0)
+        continue;
+
+      switch (key & 0xf) {
+        case 1: fprintf(out, " f%-2d ", rd); break;
+        case 2: fprintf(out, " v%-2d ", rd); break;
+        case 4: fprintf(out, " c%d_%s ", rd, csr_name(rd)); break;
+        default: fprintf(out, " x%-2d ", rd); break;
+      }
+      commit_log_print_value(out, width, value.data());
+    }
+
+    for (unsigned i = 0; i < rec.nloads; i++) {
+      uint64_t addr;
+      if (!read_exact(in, &addr, sizeof(addr)))
+        truncated();
+      fprintf(out, " mem ");
+      commit_log_print_value(out, rec.xlen, addr);
+    }
+
+    for (unsigned i = 0; i < rec.nstores; i++) {
+      commit_log_store_t store;
+      if (!read_exact(in, &store, sizeof(store)))
+        truncated();
+      fprintf(out, " mem ");
+      commit_log_print_value(out, rec.xlen, store.addr);
+      fprintf(out, " ");
+      commit_log_print_value(out, store.size << 3, store.value);
+    }
+    fprintf(out, "\n");
+  }
+
+  return 0;
+}
@@ -4,11 +4,27 @@
 //   core   0: 0x000000008000c36c (0xfe843783) ld      a5, -24(s0)
 // in its inputs, then output the RISC-V instruction with the disassembly
 // enclosed hexadecimal number.
+//
+// Inputs are mapped into memory when they are regular files and read in
+// large blocks otherwise.  Each block is cut at line boundaries into one
+// slice per thread; the slices are scanned in parallel and their output
+// is written back in input order.
 
 #include <iostream>
 #include <string>
 #include <cstdint>
-#include <regex>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "fesvr/option_parser.h"
 
 #include "disasm.h"
@@ -16,16 +32,207 @@
 
 using namespace std;
 
+// Bytes each thread scans per round; also bounds the buffered output.
+static const size_t SLICE_SIZE = 64 << 20;
+
+static const char UNKNOWN_OP[] = "unknown_op";
+
+class scanner_t
+{
+ public:
+  scanner_t(const disassembler_t* disasm, bool histogram)
+    : disasm(disasm), histogram(histogram) {}
+
+  void scan(const char* p, const char* end);
+
+  string out;
+  unordered_map<const char*, uint64_t> counts;
+
+ private:
+  const char* name(uint64_t opcode);
+  void parse_line(const char* p, const char* end);
+
+  const disassembler_t* disasm;
+  bool histogram;
+  unordered_map<uint64_t, const char*> names;
+};
+
+static bool is_space(char c)
+{
+  return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+static int hex_digit(char c)
+{
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  c |= 0x20;
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  return -1;
+}
+
+const char* scanner_t::name(uint64_t opcode)
+{
+  auto it = names.find(opcode);
+  if (it != names.end())
+    return it->second;
+
+  const disasm_insn_t* insn = disasm->lookup(opcode);
+  const char* n = insn ? insn->get_name() : UNKNOWN_OP;
+  names.emplace(opcode, n);
+  return n;
+}
+
+// Matches ^core\s+\d+:\s+0x[0-9a-f]+\s+\(0x([0-9a-f]+)\), ignoring case.
+void scanner_t::parse_line(const char* p, const char* end)
+{
+  if (end - p < 4 || strncasecmp(p, "core", 4) != 0)
+    return;
+  p += 4;
+
+  const char* q = p;
+  while (p < end && is_space(*p)) p++;
+  if (p == q) return;
+  for (q = p; p < end && *p >= '0' && *p <= '9'; p++);
+  if (p == q || p == end || *p++ != ':') return;
+  for (q = p; p < end && is_space(*p); p++);
+  if (p == q) return;
+  if (end - p < 2 || p[0] != '0' || (p[1] | 0x20) != 'x') return;
+  p += 2;
+  for (q = p; p < end && hex_digit(*p) >= 0; p++);
+  if (p == q) return;
+  for (q = p; p < end && is_space(*p); p++);
+  if (p == q) return;
+  if (end - p < 3 || p[0] != '(' || p[1] != '0' || (p[2] | 0x20) != 'x') return;
+  p += 3;
+
+  uint64_t opcode = 0;
+  int d;
+  for (q = p; p < end && (d = hex_digit(*p)) >= 0; p++)
+    opcode = opcode << 4 | d;
+  if (p == q || p == end || *p != ')') return;
+  // Like strtoull, saturate encodings too wide to fit.
+  if (p - q > 16)
+    opcode = UINT64_MAX;
+
+  const char* n = name(opcode);
+  if (histogram) {
+    counts[n]++;
+  } else {
+    out += n;
+    out += '\n';
+  }
+}
+
+void scanner_t::scan(const char* p, const char* end)
+{
+  while (p < end) {
+    const char* eol = (const char*)memchr(p, '\n', end - p);
+    if (!eol)
+      eol = end;
+    parse_line(p, eol);
+    p = eol + 1;
+  }
+}
+
+static void write_all(const string& s)
+{
+  if (!s.empty() && fwrite(s.data(), 1, s.size(), stdout) != s.size()) {
+    perror("spike-log-parser: write");
+    exit(1);
+  }
+}
+
+// Scans [p, end), which must end on a line boundary, across all scanners.
+static void scan_block(vector<scanner_t>& scanners, const char* p, const char* end)
+{
+  while (p < end) {
+    vector<thread> threads;
+    size_t used = 0;
+    for (; used < scanners.size() && p < end; used++) {
+      const char* slice_end = end;
+      if (size_t(end - p) > SLICE_SIZE) {
+        slice_end = (const char*)memchr(p + SLICE_SIZE, '\n', end - p - SLICE_SIZE);
+        slice_end = slice_end ? slice_end + 1 : end;
+      }
+      threads.emplace_back(&scanner_t::scan, &scanners[used], p, slice_end);
+      p = slice_end;
+    }
+    for (size_t i = 0; i < used; i++) {
+      threads[i].join();
+      write_all(scanners[i].out);
+      scanners[i].out.clear();
+    }
+  }
+}
+
+static bool scan_mapped(vector<scanner_t>& scanners, int fd)
+{
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+    return false;
+  if (st.st_size == 0)
+    return true;
+
+  void* base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (base == MAP_FAILED)
+    return false;
+  madvise(base, st.st_size, MADV_SEQUENTIAL);
+  scan_block(scanners, (const char*)base, (const char*)base + st.st_size);
+  munmap(base, st.st_size);
+  return true;
+}
+
+static void scan_stream(vector<scanner_t>& scanners, int fd)
+{
+  vector<char> buf(SLICE_SIZE * scanners.size());
+  size_t held = 0;
+  for (bool eof = false; !eof; ) {
+    while (held < buf.size()) {
+      ssize_t n = read(fd, buf.data() + held, buf.size() - held);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n < 0) {
+        perror("spike-log-parser: read");
+        exit(1);
+      }
+      if (n == 0) {
+        eof = true;
+        break;
+      }
+      held += n;
+    }
+
+    // Hand over every complete line and keep the partial one for later.
+    const char* lines_end = buf.data() + held;
+    if (!eof) {
+      while (lines_end > buf.data() && lines_end[-1] != '\n')
+        lines_end--;
+      if (lines_end == buf.data()) {
+        buf.resize(buf.size() * 2);
+        continue;
+      }
+    }
+    scan_block(scanners, buf.data(), lines_end);
+    held -= lines_end - buf.data();
+    memmove(buf.data(), lines_end, held);
+  }
+}
+
 int main(int argc, char** argv)
 {
-  string s;
   const char* isa_string = DEFAULT_ISA;
+  size_t nthreads = std::max(1u, std::thread::hardware_concurrency());
+  bool histogram = false;
 
   std::function<extension_t*()> extension;
   option_parser_t parser;
   parser.option(0, "extension", 1, [&](const char* s){extension = find_extension(s);});
   parser.option(0, "isa", 1, [&](const char* s){isa_string = s;});
-  parser.parse(argv);
+  parser.option('j', "threads", 1, [&](const char* s){nthreads = std::max(1ul, strtoul(s, 0, 0));});
+  parser.option(0, "histogram", 0, [&](const char* s){histogram = true;});
+  const char* const* files = parser.parse(argv);
 
   isa_parser_t isa(isa_string, DEFAULT_PRIV);
   processor_t p(&isa, DEFAULT_VARCH, 0, 0, false, nullptr, cerr, nullptr);
@@ -33,28 +240,36 @@ int main(int argc, char** argv)
     p.register_extension(extension());
   }
 
-  std::regex reg("^core\\s+\\d+:\\s+0x[0-9a-f]+\\s+\\(0x([0-9a-f]+)\\)", std::regex_constants::icase);
-  std::smatch m;
-  std::ssub_match sm ;
+  vector<scanner_t> scanners(nthreads, scanner_t(p.get_disassembler(), histogram));
 
-  while (getline(cin,s)){
-    if (regex_search(s, m, reg)){
-      // the opcode string
-      string op = m[1].str();
-      uint32_t bit_num = op.size() * 4;
-      uint64_t opcode = strtoull(op.c_str(), nullptr, 16);
+  if (!*files) {
+    if (!scan_mapped(scanners, 0))
+      scan_stream(scanners, 0);
+  }
+  for (; *files; files++) {
+    int fd = open(*files, O_RDONLY);
+    if (fd < 0) {
+      perror(*files);
+      return 1;
+    }
+    if (!scan_mapped(scanners, fd))
+      scan_stream(scanners, fd);
+    close(fd);
+  }
 
-      if (bit_num<64){
-          opcode = opcode << (64-bit_num) >> (64-bit_num);
-      }
+  if (histogram) {
+    // Distinct encodings may share a mnemonic, so merge by name.
+    unordered_map<string, uint64_t> counts;
+    for (auto& s : scanners)
+      for (auto& c : s.counts)
+        counts[c.first] += c.second;
 
-      const disasm_insn_t* disasm = p.get_disassembler()->lookup(opcode);
-      if (disasm) {
-          cout << disasm->get_name() << '\n';
-      } else {
-          cout << "unknown_op\n";
-      }
-    }
+    vector<pair<string, uint64_t>> sorted(counts.begin(), counts.end());
+    std::sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) {
+      return a.second != b.second ? a.second > b.second : a.first < b.first;
+    });
+    for (auto& c : sorted)
+      printf("%" PRIu64 " %s\n", c.second, c.first.c_str());
   }
 
   return 0;
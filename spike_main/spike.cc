@@ -4,29 +4,181 @@
 #include "sim.h"
 #include "mmu.h"
 #include "remote_bitbang.h"
+#include "gdb_server.h"
 #include "cachesim.h"
+#include "bpsim.h"
+#include "tlbsim.h"
+#include "misscurve.h"
+#include "stride_profile.h"
+#include "access_trace.h"
 #include "extension.h"
+#include "plugin.h"
+#include "v_ext_kernels.h"
 #include <dlfcn.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #include <fesvr/option_parser.h>
+#include <fesvr/host_prof.h>
+#include <fesvr/replay_log.h>
+#include <cinttypes>
+#include <cstring>
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 #include <vector>
 #include <string>
 #include <memory>
+#include <map>
+#include <set>
 #include <fstream>
+#include <sstream>
 #include "../VERSION"
 
 static void help(int exit_code = 1)
 {
   fprintf(stderr, "Spike RISC-V ISA Simulator " SPIKE_VERSION "\n\n");
   fprintf(stderr, "usage: spike [host options] <target program> [target options]\n");
+  fprintf(stderr, "       spike --batch=<manifest> [batch options] [host options]\n");
   fprintf(stderr, "Host Options:\n");
   fprintf(stderr, "  -p<n>                 Simulate <n> processors [default 1]\n");
   fprintf(stderr, "  -m<n>                 Provide <n> MiB of target memory [default 2048]\n");
   fprintf(stderr, "  -m<a:m,b:n,...>       Provide memory regions of size m and n bytes\n");
   fprintf(stderr, "                          at base addresses a and b (with 4 KiB alignment)\n");
+  fprintf(stderr, "  --flat-mem            Reserve each memory region as one lazily zeroed\n");
+  fprintf(stderr, "                          mapping instead of allocating pages on demand\n");
+  fprintf(stderr, "  --share-images        Map the program's segments, the kernel and the initrd\n");
+  fprintf(stderr, "                          copy-on-write from their files, so processes\n");
+  fprintf(stderr, "                          running the same images share their pages\n");
+  fprintf(stderr, "  --load-image=<addr>:<file>\n");
+  fprintf(stderr, "                        Map the raw image <file> into memory at <addr>,\n");
+  fprintf(stderr, "                          copy-on-write, after loading the program\n");
+  fprintf(stderr, "  --dump-image=<addr>:<len>:<file>\n");
+  fprintf(stderr, "                        Write <len> bytes of memory from <addr> to <file>\n");
+  fprintf(stderr, "                          when the simulation ends\n");
+  fprintf(stderr, "  --parallel            Run each hart on its own host thread (requires\n");
+  fprintf(stderr, "                          --flat-mem)\n");
+  fprintf(stderr, "  --rank=<r>:<n>        Run only harts [r*N/n, (r+1)*N/n) of the N, as rank r\n");
+  fprintf(stderr, "                          of n spike processes that together simulate the\n");
+  fprintf(stderr, "                          machine, rank 0 serving the HTIF (requires\n");
+  fprintf(stderr, "                          --flat-mem and --shared-mem)\n");
+  fprintf(stderr, "  --rank-server=<host>:<port>\n");
+  fprintf(stderr, "                        Where rank 0 waits for the other ranks\n");
+  fprintf(stderr, "                          [default: 127.0.0.1:7075]\n");
+  fprintf(stderr, "  --shared-mem=<file>   Map the --rank's memory from <file>, which every rank\n");
+  fprintf(stderr, "                          maps and which must start out empty or absent\n");
+  fprintf(stderr, "  --mem-dir=<dir>       Map --flat-mem memory from a sparse file in <dir>,\n");
+  fprintf(stderr, "                          so that more of it than the host has can be paged\n");
+  fprintf(stderr, "                          to disk, with hints from a page heat map on which\n");
+  fprintf(stderr, "                          pages to keep resident (see --page-heat-epoch)\n");
+  fprintf(stderr, "  --async-syscalls      Serve the program's system calls on a host thread of\n");
+  fprintf(stderr, "                          their own, so that other harts keep running while\n");
+  fprintf(stderr, "                          one waits on host I/O (requires --flat-mem)\n");
+  fprintf(stderr, "  --hugepages           Back --flat-mem memory with hugetlbfs pages if the\n");
+  fprintf(stderr, "                          host has enough reserved [default: transparent\n");
+  fprintf(stderr, "                          huge pages]\n");
+  fprintf(stderr, "  --numa                Pin each --parallel hart's thread to its own CPU and\n");
+  fprintf(stderr, "                          interleave memory across the NUMA nodes\n");
+  fprintf(stderr, "  --vector-threads=<n>[:<min>]\n");
+  fprintf(stderr, "                        Split unmasked single- and double-precision vector\n");
+  fprintf(stderr, "                          FP instructions of at least <min> elements\n");
+  fprintf(stderr, "                          [default 1024] across <n> host threads\n");
+  fprintf(stderr, "  --interleave=<n>      Switch harts every <n> instructions [default 5000]\n");
+  fprintf(stderr, "  --record=<file>       Record the order of atomics across --parallel harts\n");
+  fprintf(stderr, "                          and the host inputs (terminal, seed CSR, real-time\n");
+  fprintf(stderr, "                          mtime) to <file>\n");
+  fprintf(stderr, "  --replay=<file>       Rerun a --record run in the same order, with the\n");
+  fprintf(stderr, "                          same inputs\n");
   fprintf(stderr, "  -d                    Interactive debug mode\n");
   fprintf(stderr, "  -g                    Track histogram of PCs\n");
+  fprintf(stderr, "  --histogram-symbols   Like -g, and also sum the histogram per symbol\n");
+  fprintf(stderr, "  --call-stacks         Count instructions per call stack and write them to\n");
+  fprintf(stderr, "                          <prefix>_h<hartid>.folded for flamegraph.pl\n");
+  fprintf(stderr, "  --host-profile        Print where the simulator spent host time at exit\n");
+  fprintf(stderr, "  --insn-mix=<file>     Write the dynamic instruction mix of each hart to\n");
+  fprintf(stderr, "                          <file> as CSV at exit and on SIGUSR1\n");
+  fprintf(stderr, "  --vector-stats=<file> Write each hart's vector utilization (vl against\n");
+  fprintf(stderr, "                          VLMAX, masked-off and tail elements) per class\n");
+  fprintf(stderr, "                          and SEW/LMUL to <file> as CSV at exit\n");
+  fprintf(stderr, "  --atomic-profile=<file> Write the AMOs, LR/SC pairs, SC failures and\n");
+  fprintf(stderr, "                          retries, and LR spin loops, of every cache line\n");
+  fprintf(stderr, "                          to <file> as CSV at exit, most contended first\n");
+  fprintf(stderr, "  --trap-profile=<file> Write each hart's traps per cause and privilege\n");
+  fprintf(stderr, "                          handled in, and the instructions and host time\n");
+  fprintf(stderr, "                          from trap to mret or sret, to <file> as CSV at exit\n");
+  fprintf(stderr, "  --block-cache         Dispatch decoded basic blocks instead of single\n");
+  fprintf(stderr, "                          instructions on the fast path\n");
+  fprintf(stderr, "  --icache=<s>:<w>      Use a simulator instruction cache of <s> sets and\n");
+  fprintf(stderr, "                          <w> ways [default 1024:1]\n");
+  fprintf(stderr, "  --icache-stats        Print simulator icache lookup statistics at exit\n");
+  fprintf(stderr, "  --tlb=<n>             Use a simulator TLB of <n> entries [default 256]\n");
+  fprintf(stderr, "  --stlb=<s>:<w>        Back the simulator TLB with a second level of <s>\n");
+  fprintf(stderr, "                          sets and <w> ways\n");
+  fprintf(stderr, "  --walk-cache=<n>      Cache upper page-table levels, and guest-physical\n");
+  fprintf(stderr, "                          translations, in <n> entries each\n");
+  fprintf(stderr, "  --tlb-stats           Print simulator TLB statistics at exit\n");
+  fprintf(stderr, "  --block-inline        Like --block-cache, and also execute simple integer\n");
+  fprintf(stderr, "                          instructions inline while they are not traced\n");
+  fprintf(stderr, "  --block-fuse          Like --block-inline, and also run common pairs of\n");
+  fprintf(stderr, "                          those instructions with a single dispatch\n");
+  fprintf(stderr, "  --bbv=<n>             Write SimPoint basic block vectors every <n>\n");
+  fprintf(stderr, "                          instructions to <prefix>_h<hartid>.bb\n");
+  fprintf(stderr, "  --pc-samples=<file>   Write each hart's PC to <file> in `perf script`\n");
+  fprintf(stderr, "                          format every --pc-sample-period instructions\n");
+  fprintf(stderr, "  --pc-sample-period=<n> Instructions between PC samples [default 1000000]\n");
+  fprintf(stderr, "  --pc-sample-depth=<n> Also sample up to <n> callers, following the\n");
+  fprintf(stderr, "                          guest's frame pointers [default 0]\n");
+  fprintf(stderr, "  --page-heat=<file>    Write how often each physical page was touched in\n");
+  fprintf(stderr, "                          each --page-heat-epoch to <file> as CSV, counting\n");
+  fprintf(stderr, "                          TLB refills\n");
+  fprintf(stderr, "  --page-heat-epoch=<n> Instructions of hart 0 per epoch [default 100000000]\n");
+  fprintf(stderr, "  --page-heat-flush=<n> Instructions between TLB flushes [default 100000]\n");
+  fprintf(stderr, "  --page-heat-exact     Count every access instead, by tracing them all\n");
+  fprintf(stderr, "  --progress=<file>     Every --progress-interval seconds, write each\n");
+  fprintf(stderr, "                          hart's instret, MIPS, ROI state and TLB and\n");
+  fprintf(stderr, "                          icache MPKI, and the SIFT bytes written, to\n");
+  fprintf(stderr, "                          <file>, or to stderr if <file> is -\n");
+  fprintf(stderr, "  --progress-port=<port> Serve the same figures to Prometheus over HTTP\n");
+  fprintf(stderr, "  --progress-interval=<s> Seconds between progress reports [default 10]\n");
+  fprintf(stderr, "  --max-instret=<n>     Stop, as if the program had exited, once hart 0 has\n");
+  fprintf(stderr, "                          retired <n> instructions\n");
+  fprintf(stderr, "  --roi-instret=<n>     Stop once hart 0 has retired <n> instructions after\n");
+  fprintf(stderr, "                          the first ROI start marker (addi x0, x0, 1)\n");
+  fprintf(stderr, "  --stop-at-roi-end     Stop after the ROI end marker (addi x0, x0, 2)\n");
+  fprintf(stderr, "  --stop-on-magic=<id>  Stop after the marker addi x0, x0, <id>, for <id> from\n");
+  fprintf(stderr, "                          1 to 2047; may be given more than once\n");
+  fprintf(stderr, "  --ckpt-save=<path>    Save the machine state to <path> once hart 0\n");
+  fprintf(stderr, "                          has retired the --ckpt-at instruction count\n");
+  fprintf(stderr, "  --ckpt-at=<n>         Instruction count for --ckpt-save\n");
+  fprintf(stderr, "  --ckpt-restore=<path> Start from a machine state saved with --ckpt-save\n");
+  fprintf(stderr, "  --qemu-ckpt=<dir>     Start from the memory.elf and registers.txt that\n");
+  fprintf(stderr, "                          QEMU's dump-guest-memory and info registers -a\n");
+  fprintf(stderr, "                          wrote to <dir> (see riscv/qemu_ckpt.h)\n");
+  fprintf(stderr, "  --kvm-ff=<n>          Once the firmware leaves M-mode, run the hart natively\n");
+  fprintf(stderr, "                          under KVM for about <n> instructions, on a RISC-V\n");
+  fprintf(stderr, "                          host with the H extension (see riscv/kvm_ff.h;\n");
+  fprintf(stderr, "                          requires --flat-mem and a single hart)\n");
+  fprintf(stderr, "  --kvm-resume          Instead of stopping at a --max-instret, --roi-instret,\n");
+  fprintf(stderr, "                          --stop-at-roi-end or --stop-on-magic stop, finish the\n");
+  fprintf(stderr, "                          program natively under KVM (requires --kvm-ff)\n");
+  fprintf(stderr, "  --reverse-interval=<n> Snapshot the machine every <n> steps, so that the\n");
+  fprintf(stderr, "                          debugger can go back with reverse-step and\n");
+  fprintf(stderr, "                          reverse-continue\n");
+  fprintf(stderr, "  --reverse-snapshots=<n> Keep the last <n> snapshots [default 16]\n");
+  fprintf(stderr, "  --boot-cache=<dir>    Start from the checkpoint in <dir> for this program,\n");
+  fprintf(stderr, "                          kernel, initrd, DTB and machine configuration, or\n");
+  fprintf(stderr, "                          save one there when hart 0 reaches a boot-done\n");
+  fprintf(stderr, "                          (addi x0, x0, 3) or ROI start marker\n");
+  fprintf(stderr, "  --sample=<start>:<len>[,...]\n");
+  fprintf(stderr, "                        Run untraced, and when hart 0 has retired <start>\n");
+  fprintf(stderr, "                          instructions fork a child that traces the next\n");
+  fprintf(stderr, "                          <len> to <prefix>_s<k>_h<hartid>.sift, with its\n");
+  fprintf(stderr, "                          cache statistics in <prefix>_s<k>.out and any\n");
+  fprintf(stderr, "                          --cache-report in <file>.s<k>\n");
+  fprintf(stderr, "  --sample-jobs=<n>     Run at most <n> --sample children at once\n");
+  fprintf(stderr, "                          [default: the number of host cores]\n");
   fprintf(stderr, "  -l                    Generate a log of execution\n");
 #ifdef HAVE_BOOST_ASIO
   fprintf(stderr, "  -s                    Command I/O via socket (use with -d)\n");
@@ -39,23 +191,95 @@ static void help(int exit_code = 1)
   fprintf(stderr, "  --priv=<m|mu|msu>     RISC-V privilege modes supported [default %s]\n", DEFAULT_PRIV);
   fprintf(stderr, "  --varch=<name>        RISC-V Vector uArch string [default %s]\n", DEFAULT_VARCH);
   fprintf(stderr, "  --pc=<address>        Override ELF entry point\n");
+  fprintf(stderr, "  --user                Run a static RV64 Linux program in U-mode without\n");
+  fprintf(stderr, "                          pk, servicing its system calls on the host; -m must\n");
+  fprintf(stderr, "                          give a region holding it, its heap and its stack\n");
+  fprintf(stderr, "  --native-libc         Run the program's memcpy, memset, strlen and memcmp\n");
+  fprintf(stderr, "                          natively while no hart is traced, charging an\n");
+  fprintf(stderr, "                          estimate of their instructions to minstret\n");
   fprintf(stderr, "  --hartids=<a,b,...>   Explicitly specify hartids, default is 0,1,...\n");
-  fprintf(stderr, "  --ic=<S>:<W>:<B>      Instantiate a cache model with S sets,\n");
-  fprintf(stderr, "  --dc=<S>:<W>:<B>        W ways, and B-byte blocks (with S and\n");
-  fprintf(stderr, "  --l2=<S>:<W>:<B>        B both powers of 2).\n");
+  fprintf(stderr, "  --ic=<S>:<W>:<B>[:<P>] Instantiate a cache model with S sets,\n");
+  fprintf(stderr, "  --dc=<S>:<W>:<B>[:<P>]   W ways, and B-byte blocks (with S and\n");
+  fprintf(stderr, "  --l2=<S>:<W>:<B>[:<P>]   B both powers of 2), replaced by policy P\n");
+  fprintf(stderr, "                          (random, lru, plru or srrip).  A further\n");
+  fprintf(stderr, "                          :<F>[=<D>] adds prefetcher F (next, stride or\n");
+  fprintf(stderr, "                          stream) of degree D\n");
+  fprintf(stderr, "  --coherence=<msi|mesi> Give each hart its own --ic/--dc caches, with\n");
+  fprintf(stderr, "                          the D$s kept coherent by a directory, in front\n");
+  fprintf(stderr, "                          of the shared --l2\n");
+  fprintf(stderr, "  --cache-sample=<n>    Simulate only 1/n of the sets of the --ic/--dc\n");
+  fprintf(stderr, "                          caches (n a power of two) and scale their\n");
+  fprintf(stderr, "                          and the --l2's statistics to estimate the rest\n");
+  fprintf(stderr, "  --cache-report=<file> Write the cache models' statistics, with accesses\n");
+  fprintf(stderr, "                          and misses per pc, to <file> as JSON\n");
+  fprintf(stderr, "  --cache-reuse         Add a reuse-distance histogram per cache to the\n");
+  fprintf(stderr, "                          --cache-report\n");
+  fprintf(stderr, "  --cache-thread        Simulate the --ic/--dc/--l2 caches on their own host\n");
+  fprintf(stderr, "                          thread\n");
+  fprintf(stderr, "  --miss-curve=<file>   Write the misses of LRU caches of every size on the\n");
+  fprintf(stderr, "                          harts' data accesses to <file> as CSV, sampled\n");
+  fprintf(stderr, "                          as --cache-sample says\n");
+  fprintf(stderr, "  --miss-curve-config=<B>[:<S>[,<S>...][:<W>]] Give the --miss-curve\n");
+  fprintf(stderr, "                          B-byte lines (default 64) and, besides the\n");
+  fprintf(stderr, "                          fully-associative curve, curves for S sets by\n");
+  fprintf(stderr, "                          up to W ways (default 16)\n");
+  fprintf(stderr, "  --stride-profile=<file> Classify each load and store pc's addresses as\n");
+  fprintf(stderr, "                          strided, small-set or irregular, and write them,\n");
+  fprintf(stderr, "                          the most accessed first, to <file> as CSV\n");
+  fprintf(stderr, "  --miss-stream=<file>  Write the fills and writebacks of the last level of\n");
+  fprintf(stderr, "                          the --ic/--dc/--l2 caches to <file>, in the\n");
+  fprintf(stderr, "                          compact binary format of riscv/miss_stream.h\n");
+  fprintf(stderr, "  --access-trace=<file> Write every hart's memory accesses to <file> for\n");
+  fprintf(stderr, "                          spike-cache-replay\n");
+  fprintf(stderr, "  --itlb=<S>:<W>        Give each hart a model of an I-TLB, D-TLB and/or\n");
+  fprintf(stderr, "  --dtlb=<S>:<W>          second-level TLB with S sets (a power of 2) and\n");
+  fprintf(stderr, "  --l2tlb=<S>:<W>         W ways, fed its traced virtual addresses\n");
+  fprintf(stderr, "  --bp=<model>[:<n>...] Give each hart a branch predictor model fed its\n");
+  fprintf(stderr, "                          conditional branches: bimodal[:n], gshare[:n[:h]]\n");
+  fprintf(stderr, "                          or tage[:n], with 2^n entries per table\n");
+  fprintf(stderr, "  --bp-report=<file>    Write the --bp models' branches, mispredicts and\n");
+  fprintf(stderr, "                          MPKI per pc to <file> as CSV\n");
+  fprintf(stderr, "  --stats-roi           Count -g, --insn-mix and the cache, TLB, branch\n");
+  fprintf(stderr, "                          and stride models only between ROI start and end\n");
+  fprintf(stderr, "                          markers (addi x0, x0, 1 and 2), reporting each ROI\n");
+  fprintf(stderr, "                          to its files with .roi<k> appended\n");
   fprintf(stderr, "  --device=<P,B,A>      Attach MMIO plugin device from an --extlib library\n");
   fprintf(stderr, "                          P -- Name of the MMIO plugin\n");
   fprintf(stderr, "                          B -- Base memory address of the device\n");
   fprintf(stderr, "                          A -- String arguments to pass to the plugin\n");
   fprintf(stderr, "                          This flag can be used multiple times.\n");
   fprintf(stderr, "                          The extlib flag for the library must come first.\n");
+  fprintf(stderr, "                          Built in are ns16550, a UART on the terminal;\n");
+  fprintf(stderr, "                          virtio-blk, which takes a disk image path as A,\n");
+  fprintf(stderr, "                          with \",ro\" appended for read-only;\n");
+  fprintf(stderr, "                          virtio-net, which takes tap:<interface> as A,\n");
+  fprintf(stderr, "                          with \",mac=<address>\" optionally appended; and\n");
+  fprintf(stderr, "                          virtio-9p, which takes a host directory to share\n");
+  fprintf(stderr, "                          as A, with \",tag=<tag>\" optionally appended.\n");
   fprintf(stderr, "  --log-cache-miss      Generate a log of cache miss\n");
   fprintf(stderr, "  --log-commits         Generate a log of commits info\n");
+  fprintf(stderr, "  --log-commits-binary  Like --log-commits, but write a buffered binary log\n");
+  fprintf(stderr, "                          to the --log file; see spike-commit-decode\n");
+  fprintf(stderr, "  --log-commits-compact Like --log-commits-binary, but log only the bytes\n");
+  fprintf(stderr, "                          of each vector register that were written\n");
+  fprintf(stderr, "  --trace-priv=<MSU>    Only trace (SIFT, commit log) code running in the\n");
+  fprintf(stderr, "                          given privilege modes, e.g. U\n");
+  fprintf(stderr, "  --trace-range=<lo:hi,sym,...>\n");
+  fprintf(stderr, "                        Only trace code in these PC ranges; bounds may\n");
+  fprintf(stderr, "                          be ELF symbols, a lone symbol spans its function\n");
+  fprintf(stderr, "  --trace-asid=<n,...>  Only trace code running under these satp ASIDs; the\n");
+  fprintf(stderr, "                          SIFT trace of each goes to <prefix>_h<hartid>_asid<n>\n");
   fprintf(stderr, "  --extension=<name>    Specify RoCC Extension\n");
   fprintf(stderr, "                          This flag can be used multiple times.\n");
   fprintf(stderr, "  --extlib=<name>       Shared library to load\n");
   fprintf(stderr, "                        This flag can be used multiple times.\n");
+  fprintf(stderr, "  --plugin=<name>[:<args>] Instrument every hart with the plugin <name> from\n");
+  fprintf(stderr, "                          an --extlib library, which must come first; may\n");
+  fprintf(stderr, "                          be given more than once.  Per-block callbacks\n");
+  fprintf(stderr, "                          need --block-cache\n");
   fprintf(stderr, "  --rbb-port=<port>     Listen on <port> for remote bitbang connection\n");
+  fprintf(stderr, "  --gdb-port=<port>     Listen on <port> for GDB, which accesses the harts\n");
+  fprintf(stderr, "                          directly; they wait for it to connect\n");
   fprintf(stderr, "  --dump-dts            Print device tree string and exit\n");
   fprintf(stderr, "  --dtb=<path>          Use specified device tree blob [default: auto-generate]\n");
   fprintf(stderr, "  --disable-dtb         Don't write the device tree blob into memory\n");
@@ -63,11 +287,44 @@ static void help(int exit_code = 1)
   fprintf(stderr, "  --initrd=<path>       Load kernel initrd into memory\n");
   fprintf(stderr, "  --bootargs=<args>     Provide custom bootargs for kernel [default: console=hvc0 earlycon=sbi]\n");
   fprintf(stderr, "  --real-time-clint     Increment clint time at real-time rate\n");
+  fprintf(stderr, "  --real-time-clint-precision=<us>\n");
+  fprintf(stderr, "                        Like --real-time-clint, but let the time lag by\n");
+  fprintf(stderr, "                          up to <us> microseconds, so it can come from the\n");
+  fprintf(stderr, "                          host's cheaper coarse clock\n");
   fprintf(stderr, "  --dm-progsize=<words> Progsize for the debug module [default 2]\n");
   fprintf(stderr, "  --dm-sba=<bits>       Debug system bus access supports up to "
       "<bits> wide accesses [default 0]\n");
 #ifdef RISCV_ENABLE_SIFT
-  fprintf(stderr, "  --sift=<prefix>       Enable SIFT tracing to <prefix>.sift\n");
+  fprintf(stderr, "  --sift=<prefix>       Enable SIFT tracing to <prefix>_h<hartid>.sift\n");
+  fprintf(stderr, "  --sift=fifo:<prefix>  Like --sift=<prefix>, but make the trace and response\n");
+  fprintf(stderr, "                          files named pipes for a concurrently running Sniper\n");
+  fprintf(stderr, "  --sift-async          Compress and write SIFT traces on background threads\n");
+  fprintf(stderr, "  --sift-roi            Only trace between the SIFT ROI start and end markers\n");
+  fprintf(stderr, "  --sift-warmup=<n>     Warm Sniper's caches and branch predictor at each\n");
+  fprintf(stderr, "                          ROI start with up to the <n> most recently touched\n");
+  fprintf(stderr, "                          lines and branches before it\n");
+  fprintf(stderr, "  --sift-code-pages     Send each code page to the SIFT writer once instead\n");
+  fprintf(stderr, "                          of the encoding of every instruction\n");
+  fprintf(stderr, "  --sift-compression=<zlib|none>\n");
+  fprintf(stderr, "                        Compression of SIFT traces [default zlib]\n");
+  fprintf(stderr, "  --sift-va2pa          Record the physical page of each virtual page in\n");
+  fprintf(stderr, "                          SIFT traces\n");
+  fprintf(stderr, "  --sift-segment=<n>    Split each hart's SIFT trace into files of <n>\n");
+  fprintf(stderr, "                          instructions that can be read independently,\n");
+  fprintf(stderr, "                          listed in <prefix>_h<hartid>.idx\n");
+  fprintf(stderr, "  --sift-period=<skip>:<warm>:<detail>\n");
+  fprintf(stderr, "                        Sample the SIFT trace: repeatedly run <skip>\n");
+  fprintf(stderr, "                          instructions untraced, <warm> collecting the\n");
+  fprintf(stderr, "                          --sift-warmup footprint, and trace <detail> as\n");
+  fprintf(stderr, "                          an ROI [default footprint 65536]\n");
+  fprintf(stderr, "  --sift-syscalls       Record user ecalls for thread creation and exit,\n");
+  fprintf(stderr, "                          futexes, sleeps and yields in SIFT traces\n");
+  fprintf(stderr, "  --sift-vector-uops=<insn|reg|n>\n");
+  fprintf(stderr, "                        Trace each vector instruction as one record, as\n");
+  fprintf(stderr, "                          one per register of its group, or as one per <n>\n");
+  fprintf(stderr, "                          bits of the group, a power of two [default reg]\n");
+  fprintf(stderr, "  --sift-sync=<n>       Switch harts every <n> instructions and wait for\n");
+  fprintf(stderr, "                          Sniper to catch up with each hart's trace\n");
 #endif
   fprintf(stderr, "  --dm-auth             Debug module requires debugger to authenticate\n");
   fprintf(stderr, "  --dmi-rti=<n>         Number of Run-Test/Idle cycles "
@@ -80,6 +337,14 @@ static void help(int exit_code = 1)
   fprintf(stderr, "  --dm-no-impebreak     Debug module won't support implicit ebreak in program buffer\n");
   fprintf(stderr, "  --blocksz=<size>      Cache block size (B) for CMO operations(powers of 2) [default 64]\n");
 
+  fprintf(stderr, "Batch Options:\n");
+  fprintf(stderr, "  --batch=<manifest>    Run each line of <manifest>, a command line without\n");
+  fprintf(stderr, "                          the leading spike, as a job of its own, after the\n");
+  fprintf(stderr, "                          host options common to every job ('#' comments)\n");
+  fprintf(stderr, "  --batch-jobs=<n>      Run up to <n> jobs at once [default: online CPUs]\n");
+  fprintf(stderr, "  --batch-out=<dir>     Write job<i>.out, job<i>.err and results.csv to\n");
+  fprintf(stderr, "                          <dir> [default spike-batch]\n");
+
   exit(exit_code);
 }
 
@@ -102,8 +367,18 @@ static std::ifstream::pos_type get_file_size(const char *filename)
 }
 
 static void read_file_bytes(const char *filename,size_t fileoff,
-                            mem_t* mem, size_t memoff, size_t read_sz)
+                            mem_t* mem, size_t memoff, size_t read_sz,
+                            bool share = false)
 {
+  if (share) {
+    int fd = open(filename, O_RDONLY);
+    bool loaded = fd >= 0 && mem->load_file(memoff, read_sz, fd, fileoff);
+    if (fd >= 0)
+      close(fd);
+    if (loaded)
+      return;
+  }
+
   std::ifstream in(filename, std::ios::in | std::ios::binary);
   in.seekg(fileoff, std::ios::beg);
 
@@ -112,6 +387,61 @@ static void read_file_bytes(const char *filename,size_t fileoff,
   mem->store(memoff, read_sz, (uint8_t*)&read_buf[0]);
 }
 
+// FNV-1a
+static uint64_t hash_bytes(uint64_t hash, const void* data, size_t len)
+{
+  for (size_t i = 0; i < len; i++)
+    hash = (hash ^ ((const uint8_t*)data)[i]) * 0x100000001b3;
+  return hash;
+}
+
+static uint64_t hash_string(uint64_t hash, const char* s)
+{
+  return hash_bytes(hash, s ? s : "", s ? strlen(s) + 1 : 0);
+}
+
+static uint64_t hash_file(uint64_t hash, const char* path)
+{
+  std::ifstream in(path, std::ios::in | std::ios::binary);
+  char buf[65536];
+  while (in.read(buf, sizeof(buf)) || in.gcount() > 0)
+    hash = hash_bytes(hash, buf, in.gcount());
+  return hash;
+}
+
+// The boot checkpoint for everything that shapes the machine's state at
+// the end of boot: the arguments and the files they name, and the
+// configuration that the generated DTB is built from.
+static std::string boot_cache_path(const char* dir, const cfg_t& cfg,
+                                   const std::vector<std::string>& htif_args,
+                                   const char* kernel, const char* initrd,
+                                   const char* dtb_file)
+{
+  uint64_t hash = 0xcbf29ce484222325;
+  for (auto& arg : htif_args) {
+    hash = hash_string(hash, arg.c_str());
+    if (check_file_exists(arg.c_str()))
+      hash = hash_file(hash, arg.c_str());
+  }
+  for (const char* file : {kernel, initrd, dtb_file}) {
+    hash = hash_string(hash, file);
+    if (file)
+      hash = hash_file(hash, file);
+  }
+  for (const char* s : {cfg.isa(), cfg.priv(), cfg.varch(), cfg.bootargs()})
+    hash = hash_string(hash, s);
+  for (auto& m : cfg.mem_layout())
+    hash = hash_bytes(hash_bytes(hash, &m.base, sizeof(m.base)), &m.size, sizeof(m.size));
+  for (int id : cfg.hartids())
+    hash = hash_bytes(hash, &id, sizeof(id));
+  reg_t start_pc = cfg.start_pc.value_or(-1);
+  hash = hash_bytes(hash, &start_pc, sizeof(start_pc));
+
+  char name[32];
+  snprintf(name, sizeof(name), "/boot-%016" PRIx64 ".ckpt", hash);
+  return dir + std::string(name);
+}
+
 bool sort_mem_region(const mem_cfg_t &a, const mem_cfg_t &b)
 {
   if (a.base == b.base)
@@ -198,16 +528,83 @@ static std::vector<mem_cfg_t> parse_mem_layout(const char* arg)
   return res;
 }
 
-static std::vector<std::pair<reg_t, mem_t*>> make_mems(const std::vector<mem_cfg_t> &layout)
+static std::vector<std::pair<reg_t, mem_t*>> make_mems(const std::vector<mem_cfg_t> &layout, bool flat,
+                                                       bool huge)
 {
   std::vector<std::pair<reg_t, mem_t*>> mems;
   mems.reserve(layout.size());
   for (const auto &cfg : layout) {
-    mems.push_back(std::make_pair(cfg.base, new mem_t(cfg.size)));
+    mems.push_back(std::make_pair(cfg.base, new mem_t(cfg.size, flat, huge)));
   }
   return mems;
 }
 
+// Maps the flat memories from one sparse file in dir, with no name, so
+// that the host kernel pages them to and from it like a page cache rather
+// than swapping anonymous memory.  The file goes with the process.
+static bool map_mems_from_dir(const char* dir, const std::vector<std::pair<reg_t, mem_t*>>& mems)
+{
+  int fd = -1;
+#ifdef O_TMPFILE
+  fd = open(dir, O_RDWR | O_TMPFILE, 0600);
+#endif
+  if (fd < 0) {
+    std::string path = std::string(dir) + "/spike-mem.XXXXXX";
+    fd = mkstemp(&path[0]);
+    if (fd >= 0)
+      unlink(path.c_str());
+  }
+  if (fd < 0)
+    return false;
+
+  off_t size = 0;
+  for (auto& m : mems)
+    size += m.second->size();
+  bool ok = ftruncate(fd, size) == 0;
+  off_t offset = 0;
+  for (auto& m : mems) {
+    ok = ok && m.second->share(fd, offset);
+    offset += m.second->size();
+  }
+  // The mappings keep the file.
+  close(fd);
+  return ok;
+}
+
+// The host's online NUMA nodes, e.g. "0-1" or "0,2", as a mask.
+static unsigned long online_numa_nodes()
+{
+  std::ifstream in("/sys/devices/system/node/online");
+  std::string list;
+  unsigned long mask = 0;
+  if (!(in >> list))
+    return mask;
+  std::stringstream ss(list);
+  std::string range;
+  while (std::getline(ss, range, ',')) {
+    unsigned lo = 0, hi = 0;
+    int n = sscanf(range.c_str(), "%u-%u", &lo, &hi);
+    if (n < 1)
+      continue;
+    if (n == 1)
+      hi = lo;
+    for (unsigned node = lo; node <= hi && node < sizeof(mask) * 8; node++)
+      mask |= 1UL << node;
+  }
+  return mask;
+}
+
+static void parse_geometry(const char* s, size_t* sets, size_t* ways)
+{
+  char* p;
+  *sets = strtoull(s, &p, 0);
+  if (*p != ':')
+    help();
+  *ways = strtoull(p + 1, &p, 0);
+  if (*p || *sets == 0 || (*sets & (*sets - 1)) || *ways == 0)
+    help();
+}
+
 static unsigned long atoul_safe(const char* s)
 {
   char* e;
@@ -225,6 +622,101 @@ static unsigned long atoul_nonzero_safe(const char* s)
   return res;
 }
 
+static void parse_vector_threads(const char* s, unsigned* threads, reg_t* min_elts)
+{
+  char* p;
+  *threads = strtoul(s, &p, 10);
+  if (*p == ':')
+    *min_elts = strtoull(p + 1, &p, 0);
+  if (*p || *threads == 0 || *min_elts == 0)
+    help();
+}
+
+static std::vector<std::pair<uint64_t, uint64_t>> parse_samples(const char* s)
+{
+  std::vector<std::pair<uint64_t, uint64_t>> samples;
+  while (true) {
+    char* p;
+    uint64_t start = strtoull(s, &p, 0);
+    if (*p != ':')
+      help();
+    uint64_t length = strtoull(p + 1, &p, 0);
+    if (length == 0 || (*p && *p != ','))
+      help();
+    samples.push_back({start, length});
+    if (!*p)
+      return samples;
+    s = p + 1;
+  }
+}
+
+// <addr>:<file>, or with len <addr>:<len>:<file>
+struct image_arg_t {
+  reg_t addr;
+  reg_t len;
+  const char* path;
+};
+
+static image_arg_t parse_image(const char* s, bool with_len)
+{
+  image_arg_t image = {0, 0, nullptr};
+  char* p;
+  image.addr = strtoull(s, &p, 0);
+  if (*p != ':')
+    help();
+  if (with_len) {
+    image.len = strtoull(p + 1, &p, 0);
+    if (*p != ':' || image.len == 0)
+      help();
+  }
+  image.path = p + 1;
+  if (!*image.path)
+    help();
+  return image;
+}
+
+static void parse_period(const char* s, uint64_t period[3])
+{
+  char* p;
+  for (int i = 0; i < 3; i++) {
+    period[i] = strtoull(s, &p, 0);
+    if (*p != (i < 2 ? ':' : '\0'))
+      help();
+    s = p + 1;
+  }
+  if (period[2] == 0)
+    help();
+}
+
+// The --sift-vector-uops width in bits, 0 for whole instructions, or -1
+// for a register each
+static reg_t parse_sift_vector_uops(const char* s)
+{
+  if (strcmp(s, "insn") == 0)
+    return 0;
+  if (strcmp(s, "reg") == 0)
+    return -1;
+  char* p;
+  reg_t bits = strtoull(s, &p, 0);
+  if (*p || bits < 8 || (bits & (bits - 1)))
+    help();
+  return bits;
+}
+
+static std::vector<reg_t> parse_asids(const char* s)
+{
+  std::vector<reg_t> asids;
+  char* p;
+  while (true) {
+    asids.push_back(strtoull(s, &p, 0));
+    if (p == s || (*p && *p != ','))
+      help();
+    if (!*p)
+      return asids;
+    s = p + 1;
+  }
+}
+
 static std::vector<int> parse_hartids(const char *s)
 {
   std::string const str(s);
@@ -240,11 +732,77 @@ static std::vector<int> parse_hartids(const char *s)
   return hartids;
 }
 
-int main(int argc, char** argv)
+static int run_spike(int argc, char** argv)
 {
   bool debug = false;
   bool halted = false;
   bool histogram = false;
+  bool histogram_symbols = false;
+  const char* insn_mix = nullptr;
+  const char* vector_stats = nullptr;
+  const char* atomic_profile = nullptr;
+  const char* trap_profile = nullptr;
+  uint64_t bbv_interval = 0;
+  bool call_stacks = false;
+  const char* pc_samples = nullptr;
+  uint64_t pc_sample_period = 1000000;
+  size_t pc_sample_depth = 0;
+  const char* page_heat = nullptr;
+  uint64_t page_heat_epoch = 100000000;
+  uint64_t page_heat_flush = 100000;
+  bool page_heat_exact = false;
+  const char* progress_path = nullptr;
+  uint16_t progress_port = 0;
+  double progress_interval = 10;
+  bool flat_mem = false;
+  bool share_images = false;
+  std::vector<image_arg_t> load_images;
+  std::vector<image_arg_t> dump_images;
+  bool huge_pages = false;
+  bool numa = false;
+  bool parallel = false;
+  size_t rank = 0, ranks = 0;
+  const char* rank_server = "127.0.0.1:7075";
+  const char* shared_mem = NULL;
+  const char* mem_dir = NULL;
+  bool async_syscalls = false;
+  unsigned vector_threads = 1;
+  reg_t vector_split_min = 1024;
+  size_t interleave = 5000;
+  bool block_cache = false;
+  bool block_inline = false;
+  bool block_fuse = false;
+  size_t icache_sets = mmu_t::ICACHE_SETS;
+  size_t icache_ways = mmu_t::ICACHE_WAYS;
+  bool icache_stats = false;
+  size_t tlb_entries = mmu_t::TLB_ENTRIES;
+  size_t stlb_sets = 1;
+  size_t stlb_ways = 0;
+  bool tlb_stats = false;
+  size_t walk_cache_entries = 0;
+  reg_t trace_priv_mask = -1;
+  const char* trace_ranges = nullptr;
+  std::vector<reg_t> trace_asids;
+  const char* checkpoint_save = nullptr;
+  uint64_t checkpoint_at = 0;
+  uint64_t max_instret = 0;
+  uint64_t roi_instret = 0;
+  bool stop_at_roi_end = false;
+  bool stats_roi = false;
+  std::vector<uint32_t> stop_magic_ids;
+  const char* checkpoint_restore = nullptr;
+  const char* qemu_checkpoint = nullptr;
+  uint64_t kvm_ff_insns = 0;
+  bool kvm_resume = false;
+  const char* boot_cache = nullptr;
+  uint64_t reverse_interval = 0;
+  size_t reverse_snapshots = 16;
+  bool user_mode = false;
+  bool native_libc = false;
+  std::vector<std::pair<uint64_t, uint64_t>> samples;
+  size_t sample_jobs = std::max(1L, sysconf(_SC_NPROCESSORS_ONLN));
+  const char* replay_path = nullptr;
+  bool replaying = false;
   bool log = false;
   bool socket = false;  // command line option -s
   bool dump_dts = false;
@@ -252,18 +810,60 @@ int main(int argc, char** argv)
   const char* kernel = NULL;
   reg_t kernel_offset, kernel_size;
   std::vector<std::pair<reg_t, abstract_device_t*>> plugin_devices;
+  // Outlives the caches that feed it
+  std::unique_ptr<miss_stream_t> miss_stream;
   std::unique_ptr<icache_sim_t> ic;
   std::unique_ptr<dcache_sim_t> dc;
   std::unique_ptr<cache_sim_t> l2;
+  std::unique_ptr<cache_sim_thread_t> cache_thread;
+  std::unique_ptr<coherent_caches_t> coherent;
+  std::vector<std::unique_ptr<bp_sim_t>> bps;
+  std::vector<std::unique_ptr<tlb_sim_t>> tlbs;
+  std::unique_ptr<access_trace_writer_t> access_trace;
+  std::unique_ptr<miss_curve_t> miss_curve;
+  const char* miss_curve_path = NULL;
+  const char* miss_curve_config = "64";
+  std::vector<std::unique_ptr<stride_profile_t>> stride_profiles;
+  const char* stride_profile_path = NULL;
+  const char* miss_stream_path = NULL;
+  const char* access_trace_path = NULL;
+  const char* ic_config = NULL;
+  const char* dc_config = NULL;
+  const char* coherence = NULL;
+  size_t cache_sample = 1;
+  const char* cache_report = NULL;
+  bool cache_reuse = false;
+  const char* itlb_config = NULL;
+  const char* dtlb_config = NULL;
+  const char* l2tlb_config = NULL;
+  const char* bp_config = NULL;
+  const char* bp_report = NULL;
   bool log_cache = false;
   bool log_commits = false;
+  bool log_commits_binary = false;
+  bool log_commits_compact = false;
   const char *log_path = nullptr;
   std::vector<std::function<extension_t*()>> extensions;
+  std::vector<std::pair<plugin_factory_t, std::string>> plugins;
   const char* initrd = NULL;
   const char* dtb_file = NULL;
   uint16_t rbb_port = 0;
   bool use_rbb = false;
+  uint16_t gdb_port = 0;
+  bool use_gdb = false;
   const char* sift_filename = "spike";
+  bool sift_async = false;
+  bool sift_roi_only = false;
+  bool sift_code_pages = false;
+  bool sift_compression = true;
+  bool sift_va2pa = false;
+  bool sift_fifo = false;
+  uint64_t sift_segment = 0;
+  size_t sift_warmup = 0;
+  uint64_t sift_period[3] = {};
+  bool sift_syscalls = false;
+  size_t sift_sync = 0;
+  reg_t sift_uop_width = -1;
   unsigned dmi_rti = 0;
   reg_t blocksz = 64;
   debug_module_config_t dm_config = {
@@ -327,7 +927,16 @@ int main(int argc, char** argv)
     std::string args(avail, '\0');
     stream.readsome(&args[0], avail);
 
-    plugin_devices.emplace_back(base, new mmio_plugin_device_t(name, args));
+    if (name == "ns16550")
+      plugin_devices.emplace_back(base, new ns16550_t(args));
+    else if (name == "virtio-blk")
+      plugin_devices.emplace_back(base, new virtio_blk_t(args));
+    else if (name == "virtio-net")
+      plugin_devices.emplace_back(base, new virtio_net_t(args));
+    else if (name == "virtio-9p")
+      plugin_devices.emplace_back(base, new virtio_9p_t(args));
+    else
+      plugin_devices.emplace_back(base, new mmio_plugin_device_t(name, args));
   };
 
   option_parser_t parser;
@@ -335,6 +944,108 @@ int main(int argc, char** argv)
   parser.option('h', "help", 0, [&](const char* s){help(0);});
   parser.option('d', 0, 0, [&](const char* s){debug = true;});
   parser.option('g', 0, 0, [&](const char* s){histogram = true;});
+  parser.option(0, "histogram-symbols", 0, [&](const char* s){histogram = histogram_symbols = true;});
+  parser.option(0, "call-stacks", 0, [&](const char* s){call_stacks = true;});
+  parser.option(0, "insn-mix", 1, [&](const char* s){insn_mix = s;});
+  parser.option(0, "atomic-profile", 1, [&](const char* s){atomic_profile = s;});
+  parser.option(0, "trap-profile", 1, [&](const char* s){trap_profile = s;});
+  parser.option(0, "vector-stats", 1, [&](const char* s){vector_stats = s;});
+  parser.option(0, "host-profile", 0, [&](const char* s){host_prof_enable();});
+  parser.option(0, "trace-priv", 1, [&](const char* s){
+    trace_priv_mask = 0;
+    for (; *s; s++) {
+      switch (toupper(*s)) {
+        case 'M': trace_priv_mask |= 1 << PRV_M; break;
+        case 'S': trace_priv_mask |= 1 << PRV_S; break;
+        case 'U': trace_priv_mask |= 1 << PRV_U; break;
+        default:
+          fprintf(stderr, "error: bad privilege mode '%c' in --trace-priv\n", *s);
+          suggest_help();
+      }
+    }
+  });
+  parser.option(0, "trace-range", 1, [&](const char* s){trace_ranges = s;});
+  parser.option(0, "trace-asid", 1, [&](const char* s){trace_asids = parse_asids(s);});
+  parser.option(0, "bbv", 1, [&](const char* s){bbv_interval = atoul_nonzero_safe(s);});
+  parser.option(0, "pc-samples", 1, [&](const char* s){pc_samples = s;});
+  parser.option(0, "pc-sample-period", 1, [&](const char* s){pc_sample_period = atoul_nonzero_safe(s);});
+  parser.option(0, "pc-sample-depth", 1, [&](const char* s){pc_sample_depth = atoul_safe(s);});
+  parser.option(0, "page-heat", 1, [&](const char* s){page_heat = s;});
+  parser.option(0, "page-heat-epoch", 1, [&](const char* s){page_heat_epoch = atoul_nonzero_safe(s);});
+  parser.option(0, "page-heat-flush", 1, [&](const char* s){page_heat_flush = atoul_nonzero_safe(s);});
+  parser.option(0, "page-heat-exact", 0, [&](const char* s){page_heat_exact = true;});
+  parser.option(0, "progress", 1, [&](const char* s){progress_path = s;});
+  parser.option(0, "progress-port", 1, [&](const char* s){progress_port = atoul_nonzero_safe(s);});
+  parser.option(0, "progress-interval", 1, [&](const char* s){
+    char* end;
+    progress_interval = strtod(s, &end);
+    if (*end || !(progress_interval > 0)) {
+      fprintf(stderr, "--progress-interval must be a positive number of seconds\n");
+      exit(1);
+    }
+  });
+  parser.option(0, "flat-mem", 0, [&](const char* s){flat_mem = true;});
+  parser.option(0, "share-images", 0, [&](const char* s){share_images = true;});
+  parser.option(0, "load-image", 1, [&](const char* s){load_images.push_back(parse_image(s, false));});
+  parser.option(0, "dump-image", 1, [&](const char* s){dump_images.push_back(parse_image(s, true));});
+  parser.option(0, "hugepages", 0, [&](const char* s){huge_pages = true;});
+  parser.option(0, "numa", 0, [&](const char* s){numa = true;});
+  parser.option(0, "parallel", 0, [&](const char* s){parallel = true;});
+  parser.option(0, "rank", 1, [&](const char* s){
+    char* p;
+    rank = strtoul(s, &p, 0);
+    if (*p != ':')
+      help();
+    ranks = strtoul(p + 1, &p, 0);
+    if (*p || ranks < 2 || rank >= ranks)
+      help();
+  });
+  parser.option(0, "rank-server", 1, [&](const char* s){rank_server = s;});
+  parser.option(0, "shared-mem", 1, [&](const char* s){shared_mem = s;});
+  parser.option(0, "mem-dir", 1, [&](const char* s){mem_dir = s;});
+  parser.option(0, "async-syscalls", 0, [&](const char* s){async_syscalls = true;});
+  parser.option(0, "vector-threads", 1, [&](const char* s){parse_vector_threads(s, &vector_threads, &vector_split_min);});
+  parser.option(0, "record", 1, [&](const char* s){replay_path = s; replaying = false;});
+  parser.option(0, "replay", 1, [&](const char* s){replay_path = s; replaying = true;});
+  parser.option(0, "interleave", 1, [&](const char* s){interleave = atoul_nonzero_safe(s);});
+  parser.option(0, "block-cache", 0, [&](const char* s){block_cache = true;});
+  parser.option(0, "icache", 1, [&](const char* s){parse_geometry(s, &icache_sets, &icache_ways);});
+  parser.option(0, "icache-stats", 0, [&](const char* s){icache_stats = true;});
+  parser.option(0, "tlb", 1, [&](const char* s){
+    tlb_entries = atoul_nonzero_safe(s);
+    if (tlb_entries & (tlb_entries - 1))
+      help();
+  });
+  parser.option(0, "stlb", 1, [&](const char* s){parse_geometry(s, &stlb_sets, &stlb_ways);});
+  parser.option(0, "walk-cache", 1, [&](const char* s){
+    walk_cache_entries = atoul_nonzero_safe(s);
+    if (walk_cache_entries & (walk_cache_entries - 1))
+      help();
+  });
+  parser.option(0, "tlb-stats", 0, [&](const char* s){tlb_stats = true;});
+  parser.option(0, "block-inline", 0, [&](const char* s){block_cache = block_inline = true;});
+  parser.option(0, "block-fuse", 0, [&](const char* s){block_cache = block_inline = block_fuse = true;});
+  parser.option(0, "max-instret", 1, [&](const char* s){max_instret = atoul_nonzero_safe(s);});
+  parser.option(0, "roi-instret", 1, [&](const char* s){roi_instret = atoul_nonzero_safe(s);});
+  parser.option(0, "stop-at-roi-end", 0, [&](const char* s){stop_at_roi_end = true;});
+  parser.option(0, "stats-roi", 0, [&](const char* s){stats_roi = true;});
+  parser.option(0, "stop-on-magic", 1, [&](const char* s){
+    unsigned long id = atoul_nonzero_safe(s);
+    if (id > 2047)
+      help();
+    stop_magic_ids.push_back(id);
+  });
+  parser.option(0, "ckpt-save", 1, [&](const char* s){checkpoint_save = s;});
+  parser.option(0, "ckpt-at", 1, [&](const char* s){checkpoint_at = atoul_nonzero_safe(s);});
+  parser.option(0, "ckpt-restore", 1, [&](const char* s){checkpoint_restore = s;});
+  parser.option(0, "qemu-ckpt", 1, [&](const char* s){qemu_checkpoint = s;});
+  parser.option(0, "kvm-ff", 1, [&](const char* s){kvm_ff_insns = atoul_nonzero_safe(s);});
+  parser.option(0, "kvm-resume", 0, [&](const char* s){kvm_resume = true;});
+  parser.option(0, "boot-cache", 1, [&](const char* s){boot_cache = s;});
+  parser.option(0, "reverse-interval", 1, [&](const char* s){reverse_interval = atoul_nonzero_safe(s);});
+  parser.option(0, "reverse-snapshots", 1, [&](const char* s){reverse_snapshots = atoul_nonzero_safe(s);});
+  parser.option(0, "sample", 1, [&](const char* s){samples = parse_samples(s);});
+  parser.option(0, "sample-jobs", 1, [&](const char* s){sample_jobs = atoul_nonzero_safe(s);});
   parser.option('l', 0, 0, [&](const char* s){log = true;});
 #ifdef HAVE_BOOST_ASIO
   parser.option('s', 0, 0, [&](const char* s){socket = true;});
@@ -344,20 +1055,54 @@ int main(int argc, char** argv)
   // I wanted to use --halted, but for some reason that doesn't work.
   parser.option('H', 0, 0, [&](const char* s){halted = true;});
   parser.option(0, "rbb-port", 1, [&](const char* s){use_rbb = true; rbb_port = atoul_safe(s);});
+  parser.option(0, "gdb-port", 1, [&](const char* s){use_gdb = true; gdb_port = atoul_safe(s);});
   parser.option(0, "pc", 1, [&](const char* s){cfg.start_pc = strtoull(s, 0, 0);});
+  parser.option(0, "user", 0, [&](const char* s){user_mode = true;});
+  parser.option(0, "native-libc", 0, [&](const char* s){native_libc = true;});
   parser.option(0, "hartids", 1, [&](const char* s){
     cfg.hartids = parse_hartids(s);
     cfg.explicit_hartids = true;
   });
-  parser.option(0, "ic", 1, [&](const char* s){ic.reset(new icache_sim_t(s));});
-  parser.option(0, "dc", 1, [&](const char* s){dc.reset(new dcache_sim_t(s));});
+  parser.option(0, "ic", 1, [&](const char* s){ic_config = s;});
+  parser.option(0, "dc", 1, [&](const char* s){dc_config = s;});
   parser.option(0, "l2", 1, [&](const char* s){l2.reset(cache_sim_t::construct(s, "L2$"));});
+  parser.option(0, "coherence", 1, [&](const char* s){
+    if (strcmp(s, "msi") && strcmp(s, "mesi")) {
+      fprintf(stderr, "--coherence must be msi or mesi\n");
+      exit(1);
+    }
+    coherence = s;
+  });
+  parser.option(0, "cache-sample", 1, [&](const char* s){cache_sample = atoul_nonzero_safe(s);});
+  parser.option(0, "cache-report", 1, [&](const char* s){cache_report = s;});
+  parser.option(0, "cache-reuse", 0, [&](const char* s){cache_reuse = true;});
+  parser.option(0, "cache-thread", 0, [&](const char* s){cache_thread.reset(new cache_sim_thread_t());});
+  parser.option(0, "miss-curve", 1, [&](const char* s){miss_curve_path = s;});
+  parser.option(0, "miss-curve-config", 1, [&](const char* s){miss_curve_config = s;});
+  parser.option(0, "stride-profile", 1, [&](const char* s){stride_profile_path = s;});
+  parser.option(0, "miss-stream", 1, [&](const char* s){miss_stream_path = s;});
+  parser.option(0, "access-trace", 1, [&](const char* s){access_trace_path = s;});
+  parser.option(0, "itlb", 1, [&](const char* s){itlb_config = s;});
+  parser.option(0, "dtlb", 1, [&](const char* s){dtlb_config = s;});
+  parser.option(0, "l2tlb", 1, [&](const char* s){l2tlb_config = s;});
+  parser.option(0, "bp", 1, [&](const char* s){delete bp_sim_t::construct(s, ""); bp_config = s;});
+  parser.option(0, "bp-report", 1, [&](const char* s){bp_report = s;});
   parser.option(0, "log-cache-miss", 0, [&](const char* s){log_cache = true;});
   parser.option(0, "isa", 1, [&](const char* s){cfg.isa = s;});
   parser.option(0, "priv", 1, [&](const char* s){cfg.priv = s;});
   parser.option(0, "varch", 1, [&](const char* s){cfg.varch = s;});
   parser.option(0, "device", 1, device_parser);
   parser.option(0, "extension", 1, [&](const char* s){extensions.push_back(find_extension(s));});
+  parser.option(0, "plugin", 1, [&](const char* s){
+    const char* colon = strchr(s, ':');
+    std::string name = colon ? std::string(s, colon - s) : s;
+    plugin_factory_t factory = find_plugin(name.c_str());
+    if (!factory) {
+      fprintf(stderr, "Unknown plugin '%s'; load its library with --extlib first\n", name.c_str());
+      exit(-1);
+    }
+    plugins.push_back({factory, colon ? colon + 1 : ""});
+  });
   parser.option(0, "dump-dts", 0, [&](const char *s){dump_dts = true;});
   parser.option(0, "disable-dtb", 0, [&](const char *s){dtb_enabled = false;});
   parser.option(0, "dtb", 1, [&](const char *s){dtb_file = s;});
@@ -365,6 +1110,10 @@ int main(int argc, char** argv)
   parser.option(0, "initrd", 1, [&](const char* s){initrd = s;});
   parser.option(0, "bootargs", 1, [&](const char* s){cfg.bootargs = s;});
   parser.option(0, "real-time-clint", 0, [&](const char *s){cfg.real_time_clint = true;});
+  parser.option(0, "real-time-clint-precision", 1, [&](const char *s){
+    cfg.real_time_clint = true;
+    cfg.real_time_clint_precision = atoul_safe(s) * 1000;
+  });
   parser.option(0, "extlib", 1, [&](const char *s){
     void *lib = dlopen(s, RTLD_NOW | RTLD_GLOBAL);
     if (lib == NULL) {
@@ -373,7 +1122,30 @@ int main(int argc, char** argv)
     }
   });
 #ifdef RISCV_ENABLE_SIFT
-  parser.option(0, "sift", 1, [&](const char* s){sift_filename = s;});
+  parser.option(0, "sift", 1, [&](const char* s){
+    sift_fifo = strncmp(s, "fifo:", 5) == 0;
+    sift_filename = sift_fifo ? s + 5 : s;
+  });
+  parser.option(0, "sift-async", 0, [&](const char* s){sift_async = true;});
+  parser.option(0, "sift-roi", 0, [&](const char* s){sift_roi_only = true;});
+  parser.option(0, "sift-warmup", 1, [&](const char* s){sift_warmup = atoul_nonzero_safe(s);});
+  parser.option(0, "sift-code-pages", 0, [&](const char* s){sift_code_pages = true;});
+  parser.option(0, "sift-va2pa", 0, [&](const char* s){sift_va2pa = true;});
+  parser.option(0, "sift-period", 1, [&](const char* s){parse_period(s, sift_period);});
+  parser.option(0, "sift-syscalls", 0, [&](const char* s){sift_syscalls = true;});
+  parser.option(0, "sift-sync", 1, [&](const char* s){sift_sync = atoul_nonzero_safe(s);});
+  parser.option(0, "sift-vector-uops", 1, [&](const char* s){sift_uop_width = parse_sift_vector_uops(s);});
+  parser.option(0, "sift-segment", 1, [&](const char* s){sift_segment = atoul_nonzero_safe(s);});
+  parser.option(0, "sift-compression", 1, [&](const char* s){
+    if (std::string(s) == "zlib")
+      sift_compression = true;
+    else if (std::string(s) == "none")
+      sift_compression = false;
+    else {
+      fprintf(stderr, "error: unsupported SIFT compression '%s'\n", s);
+      suggest_help();
+    }
+  });
 #endif
   parser.option(0, "dm-progsize", 1,
       [&](const char* s){dm_config.progbufsize = atoul_safe(s);});
@@ -395,6 +1167,10 @@ int main(int argc, char** argv)
       [&](const char* s){dm_config.support_haltgroups = false;});
   parser.option(0, "log-commits", 0,
                 [&](const char* s){log_commits = true;});
+  parser.option(0, "log-commits-binary", 0,
+                [&](const char* s){log_commits = log_commits_binary = true;});
+  parser.option(0, "log-commits-compact", 0,
+                [&](const char* s){log_commits = log_commits_binary = log_commits_compact = true;});
   parser.option(0, "log", 1,
                 [&](const char* s){log_path = s;});
   FILE *cmd_file = NULL;
@@ -418,7 +1194,102 @@ int main(int argc, char** argv)
   if (!*argv1)
     help();
 
-  std::vector<std::pair<reg_t, mem_t*>> mems = make_mems(cfg.mem_layout());
+  if (huge_pages && !flat_mem) {
+    fprintf(stderr, "--hugepages requires --flat-mem\n");
+    return 1;
+  }
+  if (numa && !parallel) {
+    fprintf(stderr, "--numa requires --parallel\n");
+    return 1;
+  }
+  if (mem_dir && !flat_mem) {
+    fprintf(stderr, "--mem-dir requires --flat-mem\n");
+    return 1;
+  }
+  if (mem_dir && (huge_pages || ranks)) {
+    fprintf(stderr, "--mem-dir cannot be combined with %s\n", huge_pages ? "--hugepages" : "--rank");
+    return 1;
+  }
+  if (shared_mem && !ranks) {
+    fprintf(stderr, "--shared-mem requires --rank\n");
+    return 1;
+  }
+  // A rank runs only its own harts, on memory every rank maps, and keeps
+  // only its CLINT in step with the others.
+  if (ranks) {
+    const char* conflict =
+      parallel ? "--parallel" :
+      huge_pages ? "--hugepages" :
+      share_images ? "--share-images" :
+      cfg.real_time_clint() ? "--real-time-clint" :
+      user_mode ? "--user" :
+      boot_cache ? "--boot-cache" :
+      checkpoint_save ? "--ckpt-save" :
+      checkpoint_restore ? "--ckpt-restore" :
+      reverse_interval ? "--reverse-interval" :
+      !samples.empty() ? "--sample" :
+      debug ? "-d" :
+      use_gdb ? "--gdb-port" :
+      nullptr;
+    if (conflict) {
+      fprintf(stderr, "--rank cannot be combined with %s\n", conflict);
+      return 1;
+    }
+    if (!flat_mem || !shared_mem) {
+      fprintf(stderr, "--rank requires --flat-mem and --shared-mem\n");
+      return 1;
+    }
+  }
+  if (kvm_resume && !kvm_ff_insns) {
+    fprintf(stderr, "--kvm-resume requires --kvm-ff\n");
+    return 1;
+  }
+  // KVM runs hart 0 alone, on spike's memory, and nothing watches it while
+  // it does.
+  if (kvm_ff_insns) {
+    const char* conflict =
+      parallel ? "--parallel" :
+      ranks ? "--rank" :
+      cfg.real_time_clint() ? "--real-time-clint" :
+      user_mode ? "--user" :
+      reverse_interval ? "--reverse-interval" :
+      !samples.empty() ? "--sample" :
+      debug ? "-d" :
+      use_gdb ? "--gdb-port" :
+      nullptr;
+    if (conflict) {
+      fprintf(stderr, "--kvm-ff cannot be combined with %s\n", conflict);
+      return 1;
+    }
+    if (!flat_mem || cfg.nprocs() != 1) {
+      fprintf(stderr, "--kvm-ff requires --flat-mem and a single hart\n");
+      return 1;
+    }
+  }
+  std::vector<std::pair<reg_t, mem_t*>> mems = make_mems(cfg.mem_layout(), flat_mem, huge_pages);
+  // Sharing before anything is loaded makes every rank load the same
+  // program into the same memory.
+  std::unique_ptr<distributed_t> distributed;
+  if (ranks) {
+    try {
+      distributed.reset(new distributed_t(rank, ranks, rank_server, cfg.nprocs()));
+      distributed->share_memory(shared_mem, mems);
+    } catch (std::exception& e) {
+      std::cerr << e.what() << std::endl;
+      exit(1);
+    }
+  }
+  if (mem_dir && !map_mems_from_dir(mem_dir, mems)) {
+    fprintf(stderr, "could not map memory from a file in %s\n", mem_dir);
+    return 1;
+  }
+  // Interleaving before anything is loaded places every page.
+  unsigned long numa_nodes = numa ? online_numa_nodes() : 0;
+  if (numa_nodes & (numa_nodes - 1)) {
+    for (auto& m : mems)
+      if (!m.second->interleave_nodes(numa_nodes))
+        fprintf(stderr, "warning: could not interleave memory across NUMA nodes\n");
+  }
 
   if (kernel && check_file_exists(kernel)) {
     const char *isa = cfg.isa();
@@ -429,7 +1300,7 @@ int main(int argc, char** argv)
       kernel_offset = 0x400000;
     for (auto& m : mems) {
       if (kernel_size && (kernel_offset + kernel_size) < m.second->size()) {
-         read_file_bytes(kernel, 0, m.second, kernel_offset, kernel_size);
+         read_file_bytes(kernel, 0, m.second, kernel_offset, kernel_size, share_images);
          break;
       }
     }
@@ -441,8 +1312,13 @@ int main(int argc, char** argv)
       if (initrd_size && (initrd_size + 0x1000) < m.second->size()) {
          reg_t initrd_end = m.first + m.second->size() - 0x1000;
          reg_t initrd_start = initrd_end - initrd_size;
+         // A page-aligned initrd can be shared.
+         if (share_images) {
+           initrd_start &= ~reg_t(PGSIZE - 1);
+           initrd_end = initrd_start + initrd_size;
+         }
          cfg.initrd_bounds = std::make_pair(initrd_start, initrd_end);
-         read_file_bytes(initrd, 0, m.second, initrd_start - m.first, initrd_size);
+         read_file_bytes(initrd, 0, m.second, initrd_start - m.first, initrd_size, share_images);
          break;
       }
     }
@@ -504,30 +1380,551 @@ int main(int argc, char** argv)
     remote_bitbang.reset(new remote_bitbang_t(rbb_port, &(*jtag_dtm)));
     s.set_remote_bitbang(&(*remote_bitbang));
   }
+  if (use_gdb && parallel) {
+    fprintf(stderr, "--gdb-port cannot be combined with --parallel\n");
+    return 1;
+  }
+  std::unique_ptr<gdb_server_t> gdb_server;
+  if (use_gdb) {
+    gdb_server.reset(new gdb_server_t(gdb_port, &s));
+    s.set_gdb_server(gdb_server.get());
+  }
 
   if (dump_dts) {
     printf("%s", s.get_dts());
     return 0;
   }
 
+  if (coherence) {
+    if (cache_thread) {
+      fprintf(stderr, "--coherence cannot be combined with --cache-thread\n");
+      return 1;
+    }
+    if (ic_config || dc_config) {
+      coherent.reset(new coherent_caches_t(cfg.nprocs(), ic_config, dc_config,
+                                           l2.get(), !strcmp(coherence, "mesi")));
+      coherent->set_log(log_cache);
+      coherent->set_sampling(cache_sample);
+      if (cache_report)
+        coherent->set_profiling(true, cache_reuse);
+    }
+  } else {
+    if (ic_config) ic.reset(new icache_sim_t(ic_config));
+    if (dc_config) dc.reset(new dcache_sim_t(dc_config));
+  }
+  if (cache_sample != 1) {
+    if (ic) ic->set_sampling(cache_sample);
+    if (dc) dc->set_sampling(cache_sample);
+    // The L2 only sees the misses of sampled L1 sets.
+    if (l2) l2->set_sampling(cache_sample, false);
+  }
+  if (cache_report) {
+    if (ic) ic->get_cache()->set_profiling(true, cache_reuse);
+    if (dc) dc->get_cache()->set_profiling(true, cache_reuse);
+    if (l2) l2->set_profiling(true, cache_reuse);
+  }
   if (ic && l2) ic->set_miss_handler(&*l2);
   if (dc && l2) dc->set_miss_handler(&*l2);
   if (ic) ic->set_log(log_cache);
   if (dc) dc->set_log(log_cache);
+  if (miss_stream_path) {
+    if (cache_thread) {
+      fprintf(stderr, "--miss-stream cannot be combined with --cache-thread\n");
+      return 1;
+    }
+    if (!l2 && (coherent || (!ic && !dc))) {
+      fprintf(stderr, "--miss-stream requires --l2%s\n", coherent ? " with --coherence" : ", --ic or --dc");
+      return 1;
+    }
+    size_t linesz = l2 ? l2->get_linesz() : ic ? ic->get_cache()->get_linesz() : dc->get_cache()->get_linesz();
+    if (!l2 && ic && dc && dc->get_cache()->get_linesz() != linesz) {
+      fprintf(stderr, "--miss-stream without --l2 requires --ic and --dc lines of one size\n");
+      return 1;
+    }
+    try {
+      miss_stream.reset(new miss_stream_t(miss_stream_path, linesz));
+    } catch (std::exception& e) {
+      std::cerr << e.what() << std::endl;
+      exit(1);
+    }
+    if (l2) {
+      l2->set_miss_stream(miss_stream.get());
+    } else {
+      if (ic) ic->get_cache()->set_miss_stream(miss_stream.get());
+      if (dc) dc->get_cache()->set_miss_stream(miss_stream.get());
+    }
+  }
+  if (cache_thread) {
+    if (ic) cache_thread->hook(&*ic);
+    if (dc) cache_thread->hook(&*dc);
+  }
+  if (access_trace_path) {
+    try {
+      access_trace.reset(new access_trace_writer_t(access_trace_path, cfg.nprocs()));
+    } catch (std::exception& e) {
+      std::cerr << e.what() << std::endl;
+      exit(1);
+    }
+  }
+  if (miss_curve_path)
+    miss_curve.reset(new miss_curve_t(miss_curve_config, cache_sample));
   for (size_t i = 0; i < cfg.nprocs(); i++)
   {
-    if (ic) s.get_core(i)->get_mmu()->register_memtracer(&*ic);
-    if (dc) s.get_core(i)->get_mmu()->register_memtracer(&*dc);
+    if (coherent) {
+      s.get_core(i)->get_mmu()->register_memtracer(coherent->get_tracer(i));
+      s.get_core(i)->set_hpm_caches(coherent->get_icache(i), coherent->get_dcache(i));
+    } else if (cache_thread && (ic || dc)) {
+      // The caches' statistics change on the cache thread, so the
+      // performance counters leave them alone.
+      s.get_core(i)->get_mmu()->register_memtracer(&*cache_thread);
+    } else {
+      if (ic) s.get_core(i)->get_mmu()->register_memtracer(&*ic);
+      if (dc) s.get_core(i)->get_mmu()->register_memtracer(&*dc);
+      s.get_core(i)->set_hpm_caches(ic ? ic->get_cache() : nullptr, dc ? dc->get_cache() : nullptr);
+    }
+    if (access_trace)
+      s.get_core(i)->get_mmu()->register_memtracer(access_trace->get_tracer(i));
+    if (miss_curve)
+      s.get_core(i)->get_mmu()->register_memtracer(miss_curve.get());
+    if (stride_profile_path) {
+      stride_profiles.emplace_back(new stride_profile_t());
+      s.get_core(i)->get_mmu()->register_memtracer(stride_profiles.back().get());
+    }
+    if (itlb_config || dtlb_config || l2tlb_config) {
+      tlbs.emplace_back(new tlb_sim_t(itlb_config, dtlb_config, l2tlb_config,
+                                      "C" + std::to_string(i)));
+      s.get_core(i)->get_mmu()->register_memtracer(tlbs.back().get());
+    }
+    if (bp_config) {
+      bps.emplace_back(bp_sim_t::construct(bp_config, ("C" + std::to_string(i) + " BP").c_str()));
+      s.get_core(i)->set_branch_tracer(bps.back().get());
+    }
     for (auto e : extensions)
       s.get_core(i)->register_extension(e());
     s.get_core(i)->get_mmu()->set_cache_blocksz(blocksz);
   }
 
   s.set_debug(debug);
-  s.configure_log(log, log_commits);
-  s.set_histogram(histogram);
+  if (bp_report && !bp_config) {
+    fprintf(stderr, "--bp-report requires --bp\n");
+    return 1;
+  }
+  if (log_commits_binary && !log_path) {
+    fprintf(stderr, "--log-commits-binary and --log-commits-compact require --log\n");
+    return 1;
+  }
+  s.configure_log(log, log_commits, log_commits_binary, log_commits_compact);
+  s.set_histogram(histogram, histogram_symbols);
+  if (insn_mix)
+    s.set_insn_mix(insn_mix);
+  if (vector_stats)
+    s.set_vector_stats(vector_stats);
+  if (atomic_profile)
+    s.set_atomic_profile(atomic_profile);
+  if (trap_profile)
+    s.set_trap_profile(trap_profile);
+  s.set_bbv_interval(bbv_interval);
+  s.set_call_stacks(call_stacks);
+  if (pc_samples)
+    s.set_pc_sampling(pc_samples, pc_sample_period, pc_sample_depth);
+  if (page_heat)
+    s.set_page_heat(page_heat, page_heat_epoch, page_heat_flush, page_heat_exact);
+  // The page heat map runs on hart 0's thread.
+  if (mem_dir && !parallel)
+    s.set_memory_advice(page_heat_epoch, page_heat_flush);
+  if (progress_path || progress_port)
+    s.set_progress(progress_path, progress_port, progress_interval);
+  s.set_block_cache(block_cache, block_inline, block_fuse);
+  for (auto& plugin : plugins)
+    s.add_plugin(plugin.first(plugin.second));
+  s.configure_icache(icache_sets, icache_ways, icache_stats);
+  s.configure_tlb(tlb_entries, stlb_sets, stlb_ways, tlb_stats);
+  s.configure_walk_cache(walk_cache_entries);
+  s.set_trace_filter(trace_priv_mask, trace_ranges, trace_asids);
+  if (checkpoint_save && !checkpoint_at) {
+    fprintf(stderr, "--ckpt-save requires --ckpt-at\n");
+    return 1;
+  }
+  // The program runs on one hart, in its own state rather than a restored
+  // one.
+  if (user_mode && (cfg.nprocs() != 1 || checkpoint_restore)) {
+    fprintf(stderr, "--user %s\n", checkpoint_restore ? "cannot be combined with --ckpt-restore"
+                                                       : "requires a single hart");
+    return 1;
+  }
+  if (qemu_checkpoint && (checkpoint_restore || boot_cache || user_mode)) {
+    fprintf(stderr, "--qemu-ckpt cannot be combined with %s\n",
+            checkpoint_restore ? "--ckpt-restore" : boot_cache ? "--boot-cache" : "--user");
+    return 1;
+  }
+  s.set_user_mode(user_mode);
+  s.set_libc_intercepts(native_libc);
+  s.set_share_images(share_images);
+  for (auto& image : load_images)
+    s.add_load_image(image.addr, image.path);
+  if (parallel && !flat_mem) {
+    fprintf(stderr, "--parallel requires --flat-mem\n");
+    return 1;
+  }
+  if (async_syscalls && !flat_mem) {
+    fprintf(stderr, "--async-syscalls requires --flat-mem\n");
+    return 1;
+  }
+  // When a call completes depends on the host.
+  if (async_syscalls && (replay_path || reverse_interval || !samples.empty() || checkpoint_save)) {
+    fprintf(stderr, "--async-syscalls cannot be combined with --record, --replay, "
+                    "--reverse-interval, --sample or --ckpt-save\n");
+    return 1;
+  }
+  if (parallel && coherent) {
+    fprintf(stderr, "--parallel cannot be combined with --coherence\n");
+    return 1;
+  }
+  if (parallel && cache_thread) {
+    fprintf(stderr, "--parallel cannot be combined with --cache-thread\n");
+    return 1;
+  }
+  // The curve's stacks are shared by every hart.
+  if (parallel && page_heat) {
+    fprintf(stderr, "--parallel cannot be combined with --page-heat\n");
+    return 1;
+  }
+  if (parallel && miss_stream) {
+    fprintf(stderr, "--parallel cannot be combined with --miss-stream\n");
+    return 1;
+  }
+  if (parallel && miss_curve) {
+    fprintf(stderr, "--parallel cannot be combined with --miss-curve\n");
+    return 1;
+  }
+  bool stop_policy = max_instret || roi_instret || stop_at_roi_end || !stop_magic_ids.empty();
+  if (stop_policy && (parallel || !samples.empty())) {
+    fprintf(stderr, "--max-instret, --roi-instret, --stop-at-roi-end and --stop-on-magic "
+                    "cannot be combined with %s\n", parallel ? "--parallel" : "--sample");
+    return 1;
+  }
+  if (stats_roi && (parallel || !samples.empty())) {
+    fprintf(stderr, "--stats-roi cannot be combined with %s\n", parallel ? "--parallel" : "--sample");
+    return 1;
+  }
+  if (parallel && checkpoint_save) {
+    fprintf(stderr, "--parallel cannot be combined with --ckpt-save\n");
+    return 1;
+  }
+  if (boot_cache && (checkpoint_save || checkpoint_restore || user_mode || parallel ||
+                     !load_images.empty())) {
+    fprintf(stderr, "--boot-cache cannot be combined with --ckpt-save, --ckpt-restore, "
+                    "--user, --parallel or --load-image\n");
+    return 1;
+  }
+  // Re-execution must make the same step() calls and see the same
+  // machine as the first time.
+  if (reverse_interval) {
+    const char* conflict =
+      parallel ? "--parallel" :
+      cfg.real_time_clint() ? "--real-time-clint" :
+      user_mode ? "--user" :
+      boot_cache ? "--boot-cache" :
+      checkpoint_save ? "--ckpt-save" :
+      !samples.empty() ? "--sample" :
+      pc_samples ? "--pc-samples" :
+      use_gdb ? "--gdb-port" :
+      use_rbb ? "--rbb-port" :
+      nullptr;
+    if (conflict) {
+      fprintf(stderr, "--reverse-interval cannot be combined with %s\n", conflict);
+      return 1;
+    }
+  }
+  // A sample's child must be the only user of everything it inherits
+  // that writes to a file or runs on another thread.
+  if (!samples.empty()) {
+    const char* conflict =
+      parallel ? "--parallel" :
+      vector_threads > 1 ? "--vector-threads" :
+      cache_thread ? "--cache-thread" :
+      debug ? "-d" :
+      log || log_commits ? "-l and --log-commits" :
+      insn_mix ? "--insn-mix" :
+      vector_stats ? "--vector-stats" :
+      atomic_profile ? "--atomic-profile" :
+      trap_profile ? "--trap-profile" :
+      access_trace_path ? "--access-trace" :
+      bbv_interval ? "--bbv" :
+      call_stacks ? "--call-stacks" :
+      pc_samples ? "--pc-samples" :
+      progress_path || progress_port ? "--progress and --progress-port" :
+      replay_path ? "--record and --replay" :
+#ifdef RISCV_ENABLE_SIFT
+      sift_async ? "--sift-async" :
+      sift_sync ? "--sift-sync" :
+      sift_fifo ? "--sift=fifo:" :
+      sift_segment ? "--sift-segment" :
+      sift_warmup ? "--sift-warmup" :
+      sift_period[2] ? "--sift-period" :
+#endif
+      nullptr;
+    if (conflict) {
+      fprintf(stderr, "--sample cannot be combined with %s\n", conflict);
+      return 1;
+    }
+  }
+#ifdef RISCV_ENABLE_SIFT
+  // A reader that follows the trace as it is written sees only one file.
+  if (sift_segment && (sift_fifo || sift_sync)) {
+    fprintf(stderr, "--sift-segment cannot be combined with %s\n",
+            sift_fifo ? "--sift=fifo:" : "--sift-sync");
+    return 1;
+  }
+  // Segments and syncing follow a single stream per hart.
+  if (!trace_asids.empty() && (sift_segment || sift_sync)) {
+    fprintf(stderr, "--trace-asid cannot be combined with %s\n",
+            sift_segment ? "--sift-segment" : "--sift-sync");
+    return 1;
+  }
+  // The period places the ROIs itself, at instruction counts only the
+  // interleaved stepping stops at.
+  if (sift_period[2] && (sift_roi_only || parallel)) {
+    fprintf(stderr, "--sift-period cannot be combined with %s\n",
+            sift_roi_only ? "--sift-roi" : "--parallel");
+    return 1;
+  }
+  if (sift_period[2] && sift_period[1] && !sift_warmup)
+    sift_warmup = 65536;
+  // Without an ROI there is nothing before it to warm from.
+  if (sift_warmup && !sift_roi_only && !sift_period[2]) {
+    fprintf(stderr, "--sift-warmup requires --sift-roi or --sift-period\n");
+    return 1;
+  }
+#endif
+  s.set_interleave(interleave);
+  s.set_parallel(parallel);
+  if (distributed)
+    s.set_distributed(distributed.get());
+  std::unique_ptr<kvm_ff_t> kvm_ff;
+  if (kvm_ff_insns) {
+    try {
+      kvm_ff.reset(new kvm_ff_t(&s, mems));
+    } catch (std::exception& e) {
+      std::cerr << e.what() << std::endl;
+      exit(1);
+    }
+  }
+  if (kvm_ff)
+    s.set_kvm_fast_forward(kvm_ff.get(), kvm_ff_insns, kvm_resume);
+  s.set_async_syscalls(async_syscalls);
+  vk_set_threads(vector_threads, vector_split_min);
+  s.set_pin_harts(numa);
+  if (checkpoint_save)
+    s.set_checkpoint_save(checkpoint_save, checkpoint_at);
+  s.set_stop_policy(max_instret, roi_instret, stop_at_roi_end, stop_magic_ids);
+  if (reverse_interval)
+    s.set_reverse(reverse_interval, reverse_snapshots);
+  if (checkpoint_restore)
+    s.set_checkpoint_restore(checkpoint_restore);
+  if (qemu_checkpoint)
+    s.set_qemu_checkpoint(qemu_checkpoint);
+  if (boot_cache) {
+    std::string path = boot_cache_path(boot_cache, cfg, htif_args, kernel, initrd, dtb_file);
+    if (check_file_exists(path.c_str()))
+      s.set_checkpoint_restore(path.c_str());
+    else
+      s.set_checkpoint_at_marker(path.c_str());
+  }
+#ifdef RISCV_ENABLE_SIFT
+  s.set_sift_async(sift_async);
+  s.set_sift_roi_only(sift_roi_only);
+  s.set_sift_code_pages(sift_code_pages);
+  s.set_sift_compression(sift_compression);
+  s.set_sift_va2pa(sift_va2pa);
+  s.set_sift_fifo(sift_fifo);
+  s.set_sift_segment(sift_segment);
+  s.set_sift_warmup(sift_warmup);
+  s.set_sift_period(sift_period[0], sift_period[1], sift_period[2]);
+  s.set_sift_syscalls(sift_syscalls);
+  if (sift_uop_width != reg_t(-1))
+    s.set_sift_uop_width(sift_uop_width);
+  s.set_sift_sync(sift_sync);
+#endif
+  // Each child counts only the accesses of its own sample, in caches the
+  // run up to it has warmed.
+  std::string cache_report_path = cache_report ? cache_report : "";
+  std::string bp_report_path = bp_report ? bp_report : "";
+  std::string miss_curve_file = miss_curve_path ? miss_curve_path : "";
+  std::string stride_profile_file = stride_profile_path ? stride_profile_path : "";
+  // Per hart, the instret from which the --bp and TLB models have counted
+  std::vector<uint64_t> models_start(cfg.nprocs(), 0);
+  auto reset_models = [&]() {
+    if (ic) ic->get_cache()->reset_stats();
+    if (dc) dc->get_cache()->reset_stats();
+    if (l2) l2->reset_stats();
+    if (coherent) coherent->reset_stats();
+    for (size_t i = 0; i < bps.size(); i++) {
+      s.get_core(i)->flush_branches();
+      bps[i]->reset_stats();
+    }
+    for (size_t i = 0; i < tlbs.size(); i++) {
+      s.get_core(i)->get_mmu()->flush_trace();
+      tlbs[i]->reset_stats();
+    }
+    for (size_t i = 0; i < cfg.nprocs(); i++)
+      models_start[i] = s.get_core(i)->get_state()->minstret->read();
+    if (miss_curve) {
+      for (size_t i = 0; i < cfg.nprocs(); i++)
+        s.get_core(i)->get_mmu()->flush_trace();
+      miss_curve->reset_stats();
+    }
+    for (size_t i = 0; i < stride_profiles.size(); i++) {
+      s.get_core(i)->get_mmu()->flush_trace();
+      stride_profiles[i]->reset_stats();
+    }
+  };
+  s.set_samples(samples, sample_jobs, [&](size_t k) {
+    reset_models();
+    if (cache_report)
+      cache_report_path += ".s" + std::to_string(k);
+    if (bp_report)
+      bp_report_path += ".s" + std::to_string(k);
+    if (miss_curve)
+      miss_curve_file += ".s" + std::to_string(k);
+    if (stride_profile_path)
+      stride_profile_file += ".s" + std::to_string(k);
+  });
+
+  // Writes the models' reports to their files with suffix appended.
+  auto write_reports = [&](const std::string& suffix) {
+    bool ok = true;
+    if (cache_report) {
+      for (size_t i = 0; i < cfg.nprocs(); i++)
+        s.get_core(i)->get_mmu()->flush_trace();
+      if (cache_thread)
+        cache_thread->sync();
+
+      std::ofstream out(cache_report_path + suffix);
+      if (out) {
+        auto symbolize = [&](uint64_t pc) { return s.describe_addr(pc); };
+        std::vector<cache_sim_t*> caches;
+        if (ic) caches.push_back(ic->get_cache());
+        if (dc) caches.push_back(dc->get_cache());
+        if (l2) caches.push_back(&*l2);
+        out << "{\"caches\": [\n";
+        if (coherent) {
+          coherent->write_report(out, symbolize);
+          if (l2)
+            out << ",\n";
+        }
+        for (size_t i = 0; i < caches.size(); i++) {
+          caches[i]->write_report(out, symbolize);
+          out << (i + 1 < caches.size() ? ",\n" : "");
+        }
+        out << "\n]}\n";
+      } else {
+        fprintf(stderr, "could not open %s\n", (cache_report_path + suffix).c_str());
+        ok = false;
+      }
+    }
+
+    if (!bps.empty()) {
+      FILE* out = bp_report ? fopen((bp_report_path + suffix).c_str(), "w") : nullptr;
+      if (bp_report && !out) {
+        fprintf(stderr, "could not open %s\n", (bp_report_path + suffix).c_str());
+        ok = false;
+      }
+      if (out)
+        fprintf(out, "hart,pc,symbol,branches,mispredicts,mpki\n");
+      for (size_t i = 0; i < bps.size(); i++) {
+        processor_t* p = s.get_core(i);
+        p->flush_branches();
+        uint64_t insns = p->get_state()->minstret->read() - models_start[i];
+        bps[i]->print_stats(insns);
+        if (out)
+          bps[i]->write_report(out, p->get_id(), insns, [&](uint64_t pc) { return s.describe_addr(pc); });
+      }
+      if (out)
+        fclose(out);
+    }
+
+    for (size_t i = 0; i < tlbs.size(); i++) {
+      processor_t* p = s.get_core(i);
+      p->get_mmu()->flush_trace();
+      tlbs[i]->print_stats(p->get_state()->minstret->read() - models_start[i]);
+    }
+
+    if (miss_curve) {
+      for (size_t i = 0; i < cfg.nprocs(); i++)
+        s.get_core(i)->get_mmu()->flush_trace();
+      if (FILE* out = fopen((miss_curve_file + suffix).c_str(), "w")) {
+        miss_curve->write_report(out);
+        fclose(out);
+      } else {
+        fprintf(stderr, "could not open %s\n", (miss_curve_file + suffix).c_str());
+        ok = false;
+      }
+    }
+
+    if (stride_profile_path) {
+      if (FILE* out = fopen((stride_profile_file + suffix).c_str(), "w")) {
+        fprintf(out, "hart,pc,symbol,kind,accesses,bytes,pattern,stride,strided,small_set\n");
+        for (size_t i = 0; i < stride_profiles.size(); i++) {
+          processor_t* p = s.get_core(i);
+          p->get_mmu()->flush_trace();
+          stride_profiles[i]->write_report(out, p->get_id(), [&](uint64_t pc) { return s.describe_addr(pc); });
+        }
+        fclose(out);
+      } else {
+        fprintf(stderr, "could not open %s\n", (stride_profile_file + suffix).c_str());
+        ok = false;
+      }
+    }
+    return ok;
+  };
+  // What the caches print at exit they print for each ROI, and then count
+  // the next one from zero, keeping their contents.  At exit the models
+  // report what remains of an ROI left open.
+  if (stats_roi) {
+    s.set_stats_roi([&](size_t k, bool start) {
+      if (start) {
+        reset_models();
+        return;
+      }
+      if (cache_thread)
+        cache_thread->sync();
+      fprintf(stderr, "ROI %zu:\n", k);
+      if (ic) ic->get_cache()->print_stats();
+      if (dc) dc->get_cache()->print_stats();
+      if (l2) l2->print_stats();
+      if (coherent) coherent->print_stats();
+      write_reports(".roi" + std::to_string(k));
+      reset_models();
+    });
+  }
+
+  std::unique_ptr<replay_log_t> replay;
+  if (replay_path) {
+    try {
+      replay.reset(new replay_log_t(replay_path, replaying));
+    } catch (std::exception& e) {
+      std::cerr << e.what() << std::endl;
+      exit(1);
+    }
+    replay_log = replay.get();
+  }
 
   auto return_code = s.run();
+  host_prof_report(stderr);
+  for (auto& image : dump_images) {
+    try {
+      s.dump_image(image.addr, image.len, image.path);
+    } catch (std::exception& e) {
+      std::cerr << e.what() << std::endl;
+      return_code = 1;
+    }
+  }
+  replay_log = nullptr;
+  replay.reset();
+
+  if (!write_reports(""))
+    return 1;
 
   for (auto& mem : mems)
     delete mem.second;
@@ -537,3 +1934,165 @@ int main(int argc, char** argv)
 
   return return_code;
 }
+
+// The files a job's arguments name, for the batch driver to read once
+static void add_input_files(const std::vector<std::string>& args, std::set<std::string>* files)
+{
+  for (auto& arg : args) {
+    std::string path = arg.substr(arg[0] == '-' && arg.find('=') != std::string::npos ? arg.find('=') + 1 : 0);
+    struct stat st;
+    if (!path.empty() && path[0] != '-' && stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode))
+      files->insert(path);
+  }
+}
+
+// Runs every job of the manifest in a child forked from this process, up
+// to jobs at a time.  Forking skips each job's process start-up and
+// dynamic linking, and the inputs the jobs share, such as the program,
+// are read once and stay mapped here, so the children load them from the
+// page cache; with --share-images they map them copy-on-write instead of
+// copying.  Each job builds its own sim_t, as its ISA and configuration
+// decide, so that jobs cannot disturb one another.
+static int run_batch(int argc, char** argv)
+{
+  const char* manifest = argv[1] + strlen("--batch=");
+  size_t max_running = std::max<long>(sysconf(_SC_NPROCESSORS_ONLN), 1);
+  std::string out_dir = "spike-batch";
+  int first_common = 2;
+  for (; first_common < argc; first_common++) {
+    const char* arg = argv[first_common];
+    if (strncmp(arg, "--batch-jobs=", 13) == 0)
+      max_running = atoul_nonzero_safe(arg + 13);
+    else if (strncmp(arg, "--batch-out=", 12) == 0)
+      out_dir = arg + 12;
+    else
+      break;
+  }
+  std::vector<std::string> common(argv + first_common, argv + argc);
+
+  std::ifstream in(manifest);
+  if (!in) {
+    fprintf(stderr, "could not open %s\n", manifest);
+    return 1;
+  }
+  std::vector<std::vector<std::string>> jobs;
+  std::string line, token;
+  while (std::getline(in, line)) {
+    std::istringstream tokens(line.substr(0, line.find('#')));
+    std::vector<std::string> args = common;
+    size_t ncommon = args.size();
+    while (tokens >> token)
+      args.push_back(token);
+    if (args.size() > ncommon)
+      jobs.push_back(args);
+  }
+
+  if (mkdir(out_dir.c_str(), 0777) != 0 && errno != EEXIST) {
+    perror(out_dir.c_str());
+    return 1;
+  }
+  std::string results_path = out_dir + "/results.csv";
+  FILE* results = fopen(results_path.c_str(), "w");
+  if (!results) {
+    perror(results_path.c_str());
+    return 1;
+  }
+  fprintf(results, "job,exit_code,wall_seconds,user_seconds,sys_seconds,max_rss_kb,args\n");
+
+  std::set<std::string> files;
+  for (auto& job : jobs)
+    add_input_files(job, &files);
+  std::vector<std::pair<void*, size_t>> mappings;
+  for (auto& path : files) {
+    int fd = open(path.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0) {
+      if (fd >= 0)
+        close(fd);
+      continue;
+    }
+    void* p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED | MAP_POPULATE, fd, 0);
+    if (p != MAP_FAILED)
+      mappings.push_back({p, st.st_size});
+    close(fd);
+  }
+
+  struct running_t {
+    size_t job;
+    struct timespec start;
+  };
+  std::map<pid_t, running_t> running;
+  size_t next = 0, failed = 0;
+  while (next < jobs.size() || !running.empty()) {
+    if (next < jobs.size() && running.size() < max_running) {
+      size_t job = next++;
+      running_t r = {job, {}};
+      clock_gettime(CLOCK_MONOTONIC, &r.start);
+      fflush(stdout);
+      fflush(stderr);
+      pid_t pid = fork();
+      if (pid < 0) {
+        perror("fork");
+        return 1;
+      }
+      if (pid == 0) {
+        std::string prefix = out_dir + "/job" + std::to_string(job);
+        if (!freopen("/dev/null", "r", stdin) ||
+            !freopen((prefix + ".out").c_str(), "w", stdout) ||
+            !freopen((prefix + ".err").c_str(), "w", stderr))
+          _exit(1);
+        for (auto& m : mappings)
+          munmap(m.first, m.second);
+        std::vector<char*> job_argv = {argv[0]};
+        for (auto& arg : jobs[job])
+          job_argv.push_back(const_cast<char*>(arg.c_str()));
+        job_argv.push_back(nullptr);
+        exit(run_spike(job_argv.size() - 1, job_argv.data()));
+      }
+      running[pid] = r;
+      continue;
+    }
+
+    int status;
+    struct rusage usage;
+    pid_t pid = wait4(-1, &status, 0, &usage);
+    if (pid < 0) {
+      perror("wait4");
+      return 1;
+    }
+    auto it = running.find(pid);
+    if (it == running.end())
+      continue;
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    size_t job = it->second.job;
+    double wall = (end.tv_sec - it->second.start.tv_sec) + (end.tv_nsec - it->second.start.tv_nsec) / 1e9;
+    running.erase(it);
+
+    int code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    failed += code != 0;
+    std::string args;
+    for (auto& arg : jobs[job])
+      args += (args.empty() ? "" : " ") + arg;
+    fprintf(results, "%zu,%d,%.3f,%.3f,%.3f,%ld,\"%s\"\n", job, code, wall,
+            usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6,
+            usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6,
+            usage.ru_maxrss, args.c_str());
+    fflush(results);
+  }
+  fclose(results);
+
+  for (auto& m : mappings)
+    munmap(m.first, m.second);
+  if (failed)
+    fprintf(stderr, "%zu of %zu jobs failed; see %s\n", failed, jobs.size(), results_path.c_str());
+  return failed != 0;
+}
+
+int main(int argc, char** argv)
+{
+  // The batch options come first; the rest are common to every job.
+  if (argc > 1 && strncmp(argv[1], "--batch=", 8) == 0)
+    return run_batch(argc, argv);
+  return run_spike(argc, argv);
+}